@@ -0,0 +1,134 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bufpool.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+struct bufpool {
+    /** Lock protecting all fields below */
+    pthread_mutex_t lock;
+
+    /** Size of a buffer (bytes) */
+    size_t buf_size;
+
+    /** Unused buffers (free_max entries) */
+    void **free_bufs;
+
+    /** Maximum number of unused buffers */
+    unsigned int free_max;
+
+    /** Number of entries in @p free_bufs */
+    unsigned int free_count;
+
+    /** Number of buffers handed out and not yet returned */
+    unsigned int in_use;
+
+    /** Has the owner freed the pool? */
+    bool closed;
+};
+
+struct bufpool *bufpool_new(size_t buf_size, unsigned int free_max)
+{
+    struct bufpool *pool = calloc(1, sizeof(struct bufpool));
+    assert(pool);
+
+    int rv = pthread_mutex_init(&pool->lock, NULL);
+    assert(rv == 0);
+    pool->buf_size = buf_size;
+    pool->free_max = free_max;
+    pool->free_bufs = calloc(free_max, sizeof(void *));
+    assert(pool->free_bufs || free_max == 0);
+
+    return pool;
+}
+
+/**
+ * Destroy the pool (called without lock held, no buffers in use)
+ */
+static void bufpool_destroy(struct bufpool *pool)
+{
+    for (unsigned int i = 0; i < pool->free_count; i++) {
+        free(pool->free_bufs[i]);
+    }
+    free(pool->free_bufs);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+void bufpool_free(struct bufpool **pool_p)
+{
+    assert(pool_p);
+    struct bufpool *pool = *pool_p;
+    if (!pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    assert(!pool->closed);
+    pool->closed = true;
+    bool destroy = pool->in_use == 0;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (destroy) {
+        bufpool_destroy(pool);
+    }
+    *pool_p = NULL;
+}
+
+void *bufpool_get(struct bufpool *pool, bool *allocated)
+{
+    void *buf = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    assert(!pool->closed);
+    if (pool->free_count) {
+        buf = pool->free_bufs[--pool->free_count];
+    }
+    pool->in_use++;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (allocated) {
+        *allocated = !buf;
+    }
+    if (!buf) {
+        buf = malloc(pool->buf_size);
+        assert(buf);
+    }
+    return buf;
+}
+
+void bufpool_put(void *buf, void *pool_void)
+{
+    struct bufpool *pool = pool_void;
+    assert(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    assert(pool->in_use > 0);
+    pool->in_use--;
+    if (!pool->closed && pool->free_count < pool->free_max) {
+        pool->free_bufs[pool->free_count++] = buf;
+        buf = NULL;
+    }
+    bool destroy = pool->closed && pool->in_use == 0;
+    pthread_mutex_unlock(&pool->lock);
+
+    free(buf);
+    if (destroy) {
+        bufpool_destroy(pool);
+    }
+}
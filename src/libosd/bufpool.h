@@ -0,0 +1,72 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Pool of fixed-size buffers
+ *
+ * Buffers handed to ZeroMQ without copying (zmq_msg_init_data()) are
+ * returned from the thread which happens to release the message last, which
+ * is often a ZeroMQ I/O thread. The pool recycles these buffers instead of
+ * freeing them, all functions are thread safe.
+ *
+ * Up to free_max unused buffers are kept, more buffers are freed when they
+ * are returned. The pool can be freed while buffers are still in use: it is
+ * destroyed once the last buffer is returned.
+ */
+
+struct bufpool;
+
+/**
+ * Create a new buffer pool
+ *
+ * @param buf_size size of a buffer (bytes)
+ * @param free_max maximum number of unused buffers kept in the pool
+ */
+struct bufpool *bufpool_new(size_t buf_size, unsigned int free_max);
+
+/**
+ * Free a buffer pool
+ *
+ * Buffers still in use can be returned with bufpool_put() afterwards.
+ */
+void bufpool_free(struct bufpool **pool_p);
+
+/**
+ * Get a buffer from the pool
+ *
+ * @param[out] allocated set to true if the pool was empty and a new buffer
+ *                       was allocated. Set to NULL if not needed.
+ * @return the buffer, buf_size bytes
+ */
+void *bufpool_get(struct bufpool *pool, bool *allocated);
+
+/**
+ * Return a buffer to the pool
+ *
+ * The signature matches zmq_free_fn: pass the pool as hint to
+ * zmq_msg_init_data() to return the buffer once ZeroMQ is done with it.
+ *
+ * @param buf a buffer obtained from bufpool_get()
+ * @param pool_void the pool @p buf was obtained from
+ */
+void bufpool_put(void *buf, void *pool_void);
+
+#endif  // BUFPOOL_H
@@ -0,0 +1,367 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "capture.h"
+
+#include <assert.h>
+#include <endian.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include "osd-private.h"
+#include "worker.h"
+
+/** Size of the stdio buffer of the capture file */
+#define CAPTURE_FILE_BUFSIZE (1024 * 1024)
+
+struct capture_writer {
+    /** Writer thread */
+    struct worker_ctx *worker;
+
+    /** Socket to pass records to the writer thread */
+    zsock_t *record_socket;
+
+    /** Start of the capture (CLOCK_MONOTONIC, ns) */
+    uint64_t start_ns;
+};
+
+/**
+ * User context of the writer thread
+ */
+struct capture_writer_usr_ctx {
+    /** The capture file */
+    FILE *file;
+
+    /** Inproc endpoint records are received from */
+    char *endpoint;
+
+    /** Socket records are received from */
+    zsock_t *record_socket;
+};
+
+struct osd_capture_reader {
+    struct osd_log_ctx *log_ctx;
+
+    /** The capture file */
+    FILE *file;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+size_t capture_record_size(const zframe_t *src, const zframe_t *dest,
+                           const zframe_t *packet)
+{
+    return CAPTURE_RECORD_HDR_SIZE + zframe_size((zframe_t *)src) +
+           zframe_size((zframe_t *)dest) + zframe_size((zframe_t *)packet);
+}
+
+void capture_record_encode(uint8_t *buf, uint64_t timestamp_ns,
+                           const zframe_t *src, const zframe_t *dest,
+                           const zframe_t *packet)
+{
+    size_t src_len = zframe_size((zframe_t *)src);
+    size_t dest_len = zframe_size((zframe_t *)dest);
+    size_t packet_size = zframe_size((zframe_t *)packet);
+    assert(src_len <= OSD_CAPTURE_IDENTITY_MAX);
+    assert(dest_len <= OSD_CAPTURE_IDENTITY_MAX);
+    assert(packet_size <= UINT16_MAX);
+
+    uint16_t packet_size_le = htole16(packet_size);
+    capture_record_set_timestamp(buf, timestamp_ns);
+    memcpy(buf + 8, &packet_size_le, sizeof(packet_size_le));
+    buf[10] = src_len;
+    buf[11] = dest_len;
+    buf += CAPTURE_RECORD_HDR_SIZE;
+    memcpy(buf, zframe_data((zframe_t *)src), src_len);
+    buf += src_len;
+    memcpy(buf, zframe_data((zframe_t *)dest), dest_len);
+    buf += dest_len;
+    memcpy(buf, zframe_data((zframe_t *)packet), packet_size);
+}
+
+size_t capture_record_get_size(const uint8_t *record)
+{
+    uint16_t packet_size_le;
+    memcpy(&packet_size_le, record + 8, sizeof(packet_size_le));
+    return CAPTURE_RECORD_HDR_SIZE + record[10] + record[11] +
+           le16toh(packet_size_le);
+}
+
+uint64_t capture_record_get_timestamp(const uint8_t *record)
+{
+    uint64_t timestamp_le;
+    memcpy(&timestamp_le, record, sizeof(timestamp_le));
+    return le64toh(timestamp_le);
+}
+
+void capture_record_set_timestamp(uint8_t *record, uint64_t timestamp_ns)
+{
+    uint64_t timestamp_le = htole64(timestamp_ns);
+    memcpy(record, &timestamp_le, sizeof(timestamp_le));
+}
+
+/**
+ * Writer thread: write records to the file
+ */
+static int writer_record_rcv(zloop_t *loop, zsock_t *reader, void *file_void)
+{
+    FILE *file = file_void;
+
+    zframe_t *frame;
+    while ((frame = zframe_recv(reader))) {
+        fwrite(zframe_data(frame), zframe_size(frame), 1, file);
+        zframe_destroy(&frame);
+    }
+    return 0;
+}
+
+static osd_result writer_thread_init(struct worker_thread_ctx *thread_ctx)
+{
+    struct capture_writer_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    usrctx->record_socket = zsock_new(ZMQ_PAIR);
+    assert(usrctx->record_socket);
+    zsock_set_rcvhwm(usrctx->record_socket, CAPTURE_QUEUE_LEN);
+    zsock_set_rcvtimeo(usrctx->record_socket, 0);
+    int zmq_rv = zsock_connect(usrctx->record_socket, "%s", usrctx->endpoint);
+    assert(zmq_rv == 0);
+
+    zmq_rv = zloop_reader(thread_ctx->zloop, usrctx->record_socket,
+                          writer_record_rcv, usrctx->file);
+    assert(zmq_rv == 0);
+    zloop_reader_set_tolerant(thread_ctx->zloop, usrctx->record_socket);
+
+    return OSD_OK;
+}
+
+static osd_result writer_thread_destroy(struct worker_thread_ctx *thread_ctx)
+{
+    struct capture_writer_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    // write records still queued
+    writer_record_rcv(thread_ctx->zloop, usrctx->record_socket, usrctx->file);
+    zloop_reader_end(thread_ctx->zloop, usrctx->record_socket);
+    zsock_destroy(&usrctx->record_socket);
+
+    if (fclose(usrctx->file) != 0) {
+        err(thread_ctx->log_ctx, "Unable to write capture file: %s",
+            strerror(errno));
+    }
+
+    free(usrctx->endpoint);
+    free(usrctx);
+    thread_ctx->usr = NULL;
+
+    return OSD_OK;
+}
+
+osd_result capture_writer_new(struct capture_writer **writer,
+                              struct osd_log_ctx *log_ctx,
+                              const char *filename)
+{
+    osd_result rv;
+
+    // Open the file here to report errors to the caller.
+    FILE *file = fopen(filename, "wb");
+    if (!file) {
+        err(log_ctx, "Unable to create capture file %s: %s", filename,
+            strerror(errno));
+        return OSD_ERROR_FAILURE;
+    }
+    setvbuf(file, NULL, _IOFBF, CAPTURE_FILE_BUFSIZE);
+    if (fwrite(OSD_CAPTURE_MAGIC, OSD_CAPTURE_MAGIC_SIZE, 1, file) != 1) {
+        err(log_ctx, "Unable to write capture file %s: %s", filename,
+            strerror(errno));
+        fclose(file);
+        return OSD_ERROR_FAILURE;
+    }
+
+    struct capture_writer *w = calloc(1, sizeof(struct capture_writer));
+    assert(w);
+
+    char endpoint[64];
+    snprintf(endpoint, sizeof(endpoint), "inproc://osd-capture-%p", (void *)w);
+    w->record_socket = zsock_new(ZMQ_PAIR);
+    assert(w->record_socket);
+    zsock_set_sndhwm(w->record_socket, CAPTURE_QUEUE_LEN);
+    zsock_set_sndtimeo(w->record_socket, 0);
+    int zmq_rv = zsock_bind(w->record_socket, "%s", endpoint);
+    assert(zmq_rv == 0);
+
+    struct capture_writer_usr_ctx *usrctx =
+        calloc(1, sizeof(struct capture_writer_usr_ctx));
+    assert(usrctx);
+    usrctx->file = file;
+    usrctx->endpoint = strdup(endpoint);
+
+    rv = worker_new(&w->worker, log_ctx, writer_thread_init,
+                    writer_thread_destroy, NULL, usrctx);
+    if (OSD_FAILED(rv)) {
+        zsock_destroy(&w->record_socket);
+        free(w);
+        return rv;
+    }
+
+    w->start_ns = now_ns();
+
+    *writer = w;
+    return OSD_OK;
+}
+
+void capture_writer_free(struct capture_writer **writer_p)
+{
+    assert(writer_p);
+    struct capture_writer *writer = *writer_p;
+    if (!writer) {
+        return;
+    }
+
+    worker_free(&writer->worker);
+    zsock_destroy(&writer->record_socket);
+
+    free(writer);
+    *writer_p = NULL;
+}
+
+osd_result capture_writer_record(struct capture_writer *writer,
+                                 const zframe_t *src, const zframe_t *dest,
+                                 const zframe_t *packet)
+{
+    zframe_t *rec = zframe_new(NULL, capture_record_size(src, dest, packet));
+    assert(rec);
+    capture_record_encode(zframe_data(rec), now_ns() - writer->start_ns, src,
+                          dest, packet);
+
+    if (zframe_send(&rec, writer->record_socket, ZFRAME_DONTWAIT) != 0) {
+        zframe_destroy(&rec);
+        return OSD_ERROR_COM;
+    }
+    return OSD_OK;
+}
+
+API_EXPORT
+osd_result osd_capture_reader_new(struct osd_capture_reader **ctx,
+                                  struct osd_log_ctx *log_ctx,
+                                  const char *filename)
+{
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        err(log_ctx, "Unable to open capture file %s: %s", filename,
+            strerror(errno));
+        return OSD_ERROR_FAILURE;
+    }
+
+    struct osd_capture_reader *c = calloc(1, sizeof(struct osd_capture_reader));
+    assert(c);
+    c->log_ctx = log_ctx;
+    c->file = file;
+
+    osd_result rv = osd_capture_reader_rewind(c);
+    if (OSD_FAILED(rv)) {
+        err(log_ctx, "%s is not a capture file.", filename);
+        osd_capture_reader_free(&c);
+        return rv;
+    }
+
+    *ctx = c;
+    return OSD_OK;
+}
+
+API_EXPORT
+osd_result osd_capture_reader_rewind(struct osd_capture_reader *ctx)
+{
+    assert(ctx);
+
+    char magic[OSD_CAPTURE_MAGIC_SIZE];
+    rewind(ctx->file);
+    if (fread(magic, sizeof(magic), 1, ctx->file) != 1 ||
+        memcmp(magic, OSD_CAPTURE_MAGIC, OSD_CAPTURE_MAGIC_SIZE)) {
+        return OSD_ERROR_FAILURE;
+    }
+    return OSD_OK;
+}
+
+API_EXPORT
+osd_result osd_capture_reader_next(struct osd_capture_reader *ctx,
+                                   struct osd_capture_record *record)
+{
+    assert(ctx);
+    assert(record);
+
+    record->packet = NULL;
+
+    uint8_t hdr[CAPTURE_RECORD_HDR_SIZE];
+    size_t hdr_read = fread(hdr, 1, sizeof(hdr), ctx->file);
+    if (hdr_read == 0 && feof(ctx->file)) {
+        return OSD_OK;
+    }
+    if (hdr_read != sizeof(hdr)) {
+        err(ctx->log_ctx, "Truncated record in capture file.");
+        return OSD_ERROR_FAILURE;
+    }
+
+    record->timestamp_ns = capture_record_get_timestamp(hdr);
+    record->src_identity_len = hdr[10];
+    record->dest_identity_len = hdr[11];
+    size_t packet_size = capture_record_get_size(hdr) -
+                         CAPTURE_RECORD_HDR_SIZE - record->src_identity_len -
+                         record->dest_identity_len;
+
+    if (packet_size < 3 * sizeof(uint16_t) || packet_size % 2) {
+        err(ctx->log_ctx, "Invalid packet size %zu in capture file.",
+            packet_size);
+        return OSD_ERROR_FAILURE;
+    }
+
+    struct osd_packet *pkg;
+    osd_result rv = osd_packet_new(&pkg, packet_size / sizeof(uint16_t));
+    assert(OSD_SUCCEEDED(rv));
+
+    if ((record->src_identity_len &&
+         fread(record->src_identity, record->src_identity_len, 1,
+               ctx->file) != 1) ||
+        (record->dest_identity_len &&
+         fread(record->dest_identity, record->dest_identity_len, 1,
+               ctx->file) != 1) ||
+        fread(pkg->data_raw, packet_size, 1, ctx->file) != 1) {
+        err(ctx->log_ctx, "Truncated record in capture file.");
+        osd_packet_free(&pkg);
+        return OSD_ERROR_FAILURE;
+    }
+
+    record->packet = pkg;
+    return OSD_OK;
+}
+
+API_EXPORT
+void osd_capture_reader_free(struct osd_capture_reader **ctx_p)
+{
+    assert(ctx_p);
+    struct osd_capture_reader *ctx = *ctx_p;
+    if (!ctx) {
+        return;
+    }
+
+    fclose(ctx->file);
+    free(ctx);
+    *ctx_p = NULL;
+}
@@ -0,0 +1,110 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <czmq.h>
+#include <osd/capture.h>
+#include <osd/osd.h>
+
+/**
+ * Capture file writer
+ *
+ * Writes records in the format described in osd/capture.h. The writer is
+ * used from the host controller I/O thread: encoding a record costs one
+ * memory copy, the file is written by a separate writer thread. Records are
+ * passed to the writer thread over an inproc socket with a queue of
+ * CAPTURE_QUEUE_LEN records; if the writer thread falls behind, records are
+ * dropped instead of slowing down the routing.
+ */
+
+/** Number of records queued for the writer thread */
+#define CAPTURE_QUEUE_LEN 100000
+
+/** Size of the record header in the capture file (bytes) */
+#define CAPTURE_RECORD_HDR_SIZE 12
+
+struct capture_writer;
+
+/**
+ * Get the size of a record (bytes)
+ */
+size_t capture_record_size(const zframe_t *src, const zframe_t *dest,
+                           const zframe_t *packet);
+
+/**
+ * Encode a record
+ *
+ * @param buf buffer of capture_record_size() bytes the record is written to
+ * @param timestamp_ns timestamp of the record
+ * @param src ZeroMQ identity of the client which sent the packet
+ * @param dest ZeroMQ identity of the client the packet is routed to
+ * @param packet the DI packet
+ */
+void capture_record_encode(uint8_t *buf, uint64_t timestamp_ns,
+                           const zframe_t *src, const zframe_t *dest,
+                           const zframe_t *packet);
+
+/**
+ * Get the size of an encoded record from its header (bytes)
+ */
+size_t capture_record_get_size(const uint8_t *record);
+
+/**
+ * Get the timestamp of an encoded record
+ */
+uint64_t capture_record_get_timestamp(const uint8_t *record);
+
+/**
+ * Set the timestamp of an encoded record
+ */
+void capture_record_set_timestamp(uint8_t *record, uint64_t timestamp_ns);
+
+/**
+ * Create a new capture file and start the writer thread
+ *
+ * An existing file is overwritten.
+ *
+ * @param writer the writer
+ * @param log_ctx the log context
+ * @param filename the capture file
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if the file cannot be created
+ */
+osd_result capture_writer_new(struct capture_writer **writer,
+                              struct osd_log_ctx *log_ctx,
+                              const char *filename);
+
+/**
+ * Write all queued records, close the file and stop the writer thread
+ */
+void capture_writer_free(struct capture_writer **writer_p);
+
+/**
+ * Record a routed packet
+ *
+ * @param writer the writer
+ * @param src ZeroMQ identity of the client which sent the packet
+ * @param dest ZeroMQ identity of the client the packet is routed to
+ * @param packet the DI packet
+ * @return OSD_OK if the record was queued for writing,
+ *         OSD_ERROR_COM if the queue is full and the record was dropped
+ */
+osd_result capture_writer_record(struct capture_writer *writer,
+                                 const zframe_t *src, const zframe_t *dest,
+                                 const zframe_t *packet);
+
+#endif  // CAPTURE_H
@@ -0,0 +1,682 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <osd/devicesim.h>
+#include <osd/module.h>
+#include <osd/osd.h>
+#include <osd/packet.h>
+#include <osd/reg.h>
+#include "osd-private.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+/** Largest packet sent or accepted by the simulated device (words) */
+#define DEVICESIM_MAX_PKT_LEN 64
+
+/** System vendor and device ID reported by the SCM */
+#define DEVICESIM_SYSTEM_VENDOR_ID OSD_MODULE_VENDOR_OSD
+#define DEVICESIM_SYSTEM_DEVICE_ID 0xffff
+
+/**
+ * Number of EVENT packets a trace module buffers if they aren't read from
+ * the device, older packets are dropped
+ */
+#define DEVICESIM_TRACE_BUFFER_LEN 1024
+
+// MAM register map
+#define DEVICESIM_REG_MAM_AW 0x0200
+#define DEVICESIM_REG_MAM_DW 0x0201
+#define DEVICESIM_REG_MAM_REGIONS 0x0202
+#define DEVICESIM_REG_MAM_REGION0_BASEADDR 0x0280 /* 4 words, low word first */
+#define DEVICESIM_REG_MAM_REGION0_MEMSIZE 0x0284  /* 4 words, low word first */
+
+// MAM transfer header (first payload word)
+#define DEVICESIM_MAM_HDR_WE BIT(15)
+#define DEVICESIM_MAM_HDR_SYNC BIT(14)
+#define DEVICESIM_MAM_HDR_LEN_MASK 0x3fff
+
+/**
+ * A debug module in the simulated device
+ */
+struct devicesim_module {
+    /** Address, vendor, type and version */
+    struct osd_module_desc desc;
+
+    /** Register OSD_REG_BASE_MOD_CS */
+    uint16_t cs;
+
+    /** Register OSD_REG_BASE_MOD_EVENT_DEST */
+    uint16_t event_dest;
+
+    /** Trace modules: time the next EVENT packet is emitted (ns) */
+    uint64_t next_event_ns;
+
+    /** Trace modules: sequence number of the next EVENT packet */
+    uint16_t event_seq;
+};
+
+/**
+ * A packet waiting to be read from the device
+ */
+struct devicesim_pkt {
+    struct devicesim_pkt *next;
+
+    /** Time the packet arrives at the host (ns) */
+    uint64_t ready_ns;
+
+    struct osd_packet *pkg;
+};
+
+struct osd_devicesim_ctx {
+    struct osd_log_ctx *log_ctx;
+
+    struct osd_devicesim_config config;
+
+    /** All modules, indexed by local address */
+    struct devicesim_module *mods;
+    /** Number of entries in @p mods */
+    unsigned int mods_len;
+    /** Index of the first trace module in @p mods */
+    unsigned int trace_mods_first;
+
+    /** Memory behind the MAM */
+    uint8_t *mem;
+
+    /** Time between two EVENT packets of a trace module (ns), 0 if none */
+    uint64_t event_interval_ns;
+
+    /** One-way link latency (ns) */
+    uint64_t link_latency_ns;
+
+    /** Lock protecting all fields below */
+    pthread_mutex_t lock;
+
+    /** Signalled when a packet was written to the device */
+    pthread_cond_t cond;
+
+    /** Responses waiting to be read, in the order of ready_ns */
+    struct devicesim_pkt *resp_head;
+    struct devicesim_pkt *resp_tail;
+
+    /** State of the random number generator */
+    unsigned int rand_state;
+
+    struct osd_devicesim_stats stats;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+API_EXPORT
+void osd_devicesim_config_init(struct osd_devicesim_config *config)
+{
+    memset(config, 0, sizeof(*config));
+    config->mem_size = 1024 * 1024;
+    config->stm_count = 1;
+    config->ctm_count = 1;
+    config->event_rate = 10000;
+    config->event_payload_min = 1;
+    config->event_payload_max = 8;
+    config->link_latency_us = 0;
+    config->seed = 1;
+}
+
+static void module_init(struct devicesim_module *mod, unsigned int subnet_addr,
+                        unsigned int local_addr, uint16_t type)
+{
+    mod->desc.addr = osd_diaddr_build(subnet_addr, local_addr);
+    mod->desc.vendor = OSD_MODULE_VENDOR_OSD;
+    mod->desc.type = type;
+    mod->desc.version = 0;
+}
+
+API_EXPORT
+osd_result osd_devicesim_new(struct osd_devicesim_ctx **ctx,
+                             struct osd_log_ctx *log_ctx,
+                             const struct osd_devicesim_config *config)
+{
+    unsigned int mods_len =
+        1 + (config->mem_size ? 1 : 0) + config->stm_count + config->ctm_count;
+    if (config->subnet_addr > OSD_DIADDR_SUBNET_MAX ||
+        mods_len > OSD_DIADDR_LOCAL_MAX + 1) {
+        err(log_ctx, "Invalid subnet address or too many modules.");
+        return OSD_ERROR_FAILURE;
+    }
+    if (config->event_payload_min < 1 ||
+        config->event_payload_min > config->event_payload_max ||
+        osd_packet_get_data_size_words_from_payload(
+            config->event_payload_max) > DEVICESIM_MAX_PKT_LEN) {
+        err(log_ctx, "EVENT payload size must be between 1 and %d words.",
+            DEVICESIM_MAX_PKT_LEN - 3);
+        return OSD_ERROR_FAILURE;
+    }
+    if (config->mem_size > UINT32_MAX) {
+        err(log_ctx, "Memory size must be below 4 GB.");
+        return OSD_ERROR_FAILURE;
+    }
+
+    struct osd_devicesim_ctx *c = calloc(1, sizeof(struct osd_devicesim_ctx));
+    assert(c);
+
+    c->log_ctx = log_ctx;
+    c->config = *config;
+    c->rand_state = config->seed;
+    c->link_latency_ns = config->link_latency_us * 1000ULL;
+    if (config->event_rate) {
+        c->event_interval_ns = 1000000000ULL / config->event_rate;
+    }
+
+    if (config->mem_size) {
+        c->mem = calloc(1, config->mem_size);
+        if (!c->mem) {
+            err(log_ctx, "Unable to allocate %zu bytes of device memory.",
+                config->mem_size);
+            free(c);
+            return OSD_ERROR_OOM;
+        }
+    }
+
+    c->mods = calloc(mods_len, sizeof(struct devicesim_module));
+    assert(c->mods);
+    c->mods_len = mods_len;
+    unsigned int addr = 0;
+    module_init(&c->mods[addr], config->subnet_addr, addr,
+                OSD_MODULE_TYPE_STD_SCM);
+    addr++;
+    if (config->mem_size) {
+        module_init(&c->mods[addr], config->subnet_addr, addr,
+                    OSD_MODULE_TYPE_STD_MAM);
+        addr++;
+    }
+    c->trace_mods_first = addr;
+    for (unsigned int i = 0; i < config->stm_count; i++, addr++) {
+        module_init(&c->mods[addr], config->subnet_addr, addr,
+                    OSD_MODULE_TYPE_STD_STM);
+    }
+    for (unsigned int i = 0; i < config->ctm_count; i++, addr++) {
+        module_init(&c->mods[addr], config->subnet_addr, addr,
+                    OSD_MODULE_TYPE_STD_CTM);
+    }
+
+    int irv = pthread_mutex_init(&c->lock, NULL);
+    assert(irv == 0);
+    pthread_condattr_t condattr;
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    irv = pthread_cond_init(&c->cond, &condattr);
+    assert(irv == 0);
+    pthread_condattr_destroy(&condattr);
+
+    *ctx = c;
+    return OSD_OK;
+}
+
+API_EXPORT
+void osd_devicesim_free(struct osd_devicesim_ctx **ctx_p)
+{
+    assert(ctx_p);
+    struct osd_devicesim_ctx *ctx = *ctx_p;
+    if (!ctx) {
+        return;
+    }
+
+    struct devicesim_pkt *p = ctx->resp_head;
+    while (p) {
+        struct devicesim_pkt *next = p->next;
+        osd_packet_free(&p->pkg);
+        free(p);
+        p = next;
+    }
+
+    pthread_cond_destroy(&ctx->cond);
+    pthread_mutex_destroy(&ctx->lock);
+    free(ctx->mods);
+    free(ctx->mem);
+    free(ctx);
+    *ctx_p = NULL;
+}
+
+/**
+ * Queue a response to be read from the device
+ *
+ * The response arrives at the host after the request traveled to the device
+ * and the response back.
+ */
+static void queue_response(struct osd_devicesim_ctx *ctx,
+                           struct osd_packet *pkg)
+{
+    struct devicesim_pkt *p = calloc(1, sizeof(struct devicesim_pkt));
+    assert(p);
+    p->pkg = pkg;
+    p->ready_ns = now_ns() + 2 * ctx->link_latency_ns;
+
+    if (ctx->resp_tail) {
+        ctx->resp_tail->next = p;
+    } else {
+        ctx->resp_head = p;
+    }
+    ctx->resp_tail = p;
+}
+
+static struct osd_packet *packet_new(size_t payload_words, uint16_t dest,
+                                     uint16_t src, unsigned int type,
+                                     unsigned int type_sub)
+{
+    struct osd_packet *pkg;
+    osd_result rv = osd_packet_new(
+        &pkg, osd_packet_get_data_size_words_from_payload(payload_words));
+    assert(OSD_SUCCEEDED(rv));
+    osd_packet_set_header(pkg, dest, src, type, type_sub);
+    return pkg;
+}
+
+static bool is_trace_module(const struct devicesim_module *mod)
+{
+    return mod->desc.type == OSD_MODULE_TYPE_STD_STM ||
+           mod->desc.type == OSD_MODULE_TYPE_STD_CTM;
+}
+
+/**
+ * Read a 16 bit register
+ *
+ * @return true if the register exists
+ */
+static bool reg_read(struct osd_devicesim_ctx *ctx,
+                     struct devicesim_module *mod, uint16_t reg_addr,
+                     uint16_t *value)
+{
+    switch (reg_addr) {
+    case OSD_REG_BASE_MOD_VENDOR:
+        *value = mod->desc.vendor;
+        return true;
+    case OSD_REG_BASE_MOD_TYPE:
+        *value = mod->desc.type;
+        return true;
+    case OSD_REG_BASE_MOD_VERSION:
+        *value = mod->desc.version;
+        return true;
+    case OSD_REG_BASE_MOD_CS:
+        *value = mod->cs;
+        return true;
+    case OSD_REG_BASE_MOD_EVENT_DEST:
+        *value = mod->event_dest;
+        return true;
+    }
+
+    if (mod->desc.type == OSD_MODULE_TYPE_STD_SCM) {
+        switch (reg_addr) {
+        case OSD_REG_SCM_SYSTEM_VENDOR_ID:
+            *value = DEVICESIM_SYSTEM_VENDOR_ID;
+            return true;
+        case OSD_REG_SCM_SYSTEM_DEVICE_ID:
+            *value = DEVICESIM_SYSTEM_DEVICE_ID;
+            return true;
+        case OSD_REG_SCM_NUM_MOD:
+            *value = ctx->mods_len;
+            return true;
+        case OSD_REG_SCM_MAX_PKT_LEN:
+            *value = DEVICESIM_MAX_PKT_LEN;
+            return true;
+        case OSD_REG_SCM_SYSRST:
+            *value = 0;
+            return true;
+        }
+    } else if (mod->desc.type == OSD_MODULE_TYPE_STD_MAM) {
+        uint64_t mem_size = ctx->config.mem_size;
+        switch (reg_addr) {
+        case DEVICESIM_REG_MAM_AW:
+            *value = 32;
+            return true;
+        case DEVICESIM_REG_MAM_DW:
+            *value = 16;
+            return true;
+        case DEVICESIM_REG_MAM_REGIONS:
+            *value = 1;
+            return true;
+        case DEVICESIM_REG_MAM_REGION0_BASEADDR ...
+            DEVICESIM_REG_MAM_REGION0_BASEADDR + 3:
+            *value = 0;
+            return true;
+        case DEVICESIM_REG_MAM_REGION0_MEMSIZE ...
+            DEVICESIM_REG_MAM_REGION0_MEMSIZE + 3:
+            *value = mem_size >>
+                     (16 * (reg_addr - DEVICESIM_REG_MAM_REGION0_MEMSIZE));
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Write a 16 bit register
+ *
+ * @return true if the register exists and is writable
+ */
+static bool reg_write(struct osd_devicesim_ctx *ctx,
+                      struct devicesim_module *mod, uint16_t reg_addr,
+                      uint16_t value)
+{
+    switch (reg_addr) {
+    case OSD_REG_BASE_MOD_CS:
+        if (is_trace_module(mod) && (value & OSD_REG_BASE_MOD_CS_ACTIVE) &&
+            !(mod->cs & OSD_REG_BASE_MOD_CS_ACTIVE)) {
+            // the first EVENT packet is emitted one interval after the write
+            // arrived at the device
+            mod->next_event_ns =
+                now_ns() + ctx->link_latency_ns + ctx->event_interval_ns;
+        }
+        mod->cs = value;
+        return true;
+    case OSD_REG_BASE_MOD_EVENT_DEST:
+        mod->event_dest = value;
+        return true;
+    }
+
+    if (mod->desc.type == OSD_MODULE_TYPE_STD_SCM &&
+        reg_addr == OSD_REG_SCM_SYSRST) {
+        return true;  // nothing to reset in the simulation
+    }
+    return false;
+}
+
+/**
+ * Answer a register access
+ */
+static void handle_reg_access(struct osd_devicesim_ctx *ctx,
+                              struct devicesim_module *mod,
+                              const struct osd_packet *pkg)
+{
+    unsigned int type_sub = osd_packet_get_type_sub(pkg);
+    unsigned int payload_words = pkg->data_size_words - 3;
+    uint16_t dest = osd_packet_get_src(pkg);
+    uint16_t src = mod->desc.addr;
+
+    struct osd_packet *resp;
+    uint16_t value;
+    if (type_sub == REQ_READ_REG_16 && payload_words == 1 &&
+        reg_read(ctx, mod, pkg->data.payload[0], &value)) {
+        resp = packet_new(1, dest, src, OSD_PACKET_TYPE_REG,
+                          RESP_READ_REG_SUCCESS_16);
+        resp->data.payload[0] = value;
+    } else if (type_sub == REQ_WRITE_REG_16 && payload_words == 2 &&
+               reg_write(ctx, mod, pkg->data.payload[0],
+                         pkg->data.payload[1])) {
+        resp = packet_new(0, dest, src, OSD_PACKET_TYPE_REG,
+                          RESP_WRITE_REG_SUCCESS);
+    } else if (type_sub >= REQ_READ_REG_16 && type_sub <= REQ_READ_REG_128) {
+        resp = packet_new(0, dest, src, OSD_PACKET_TYPE_REG,
+                          RESP_READ_REG_ERROR);
+    } else if (type_sub >= REQ_WRITE_REG_16 &&
+               type_sub <= REQ_WRITE_REG_128) {
+        resp = packet_new(0, dest, src, OSD_PACKET_TYPE_REG,
+                          RESP_WRITE_REG_ERROR);
+    } else {
+        dbg(ctx->log_ctx, "Ignoring register packet with subtype %u.",
+            type_sub);
+        return;
+    }
+
+    ctx->stats.reg_accesses++;
+    queue_response(ctx, resp);
+}
+
+/**
+ * Execute a memory transfer of the MAM
+ */
+static void handle_mem_access(struct osd_devicesim_ctx *ctx,
+                              struct devicesim_module *mod,
+                              const struct osd_packet *pkg)
+{
+    unsigned int payload_words = pkg->data_size_words - 3;
+    if (payload_words < 3) {
+        err(ctx->log_ctx, "Ignoring too short MAM transfer.");
+        return;
+    }
+
+    const uint16_t *payload = pkg->data.payload;
+    bool we = payload[0] & DEVICESIM_MAM_HDR_WE;
+    bool sync = payload[0] & DEVICESIM_MAM_HDR_SYNC;
+    size_t len_words = payload[0] & DEVICESIM_MAM_HDR_LEN_MASK;
+    uint64_t addr = (uint64_t)payload[1] << 16 | payload[2];
+    uint16_t dest = osd_packet_get_src(pkg);
+
+    if (addr + len_words * 2 > ctx->config.mem_size ||
+        (we && payload_words != 3 + len_words)) {
+        err(ctx->log_ctx,
+            "Ignoring invalid MAM transfer of %zu words at 0x%" PRIx64 ".",
+            len_words, addr);
+        return;
+    }
+
+    uint8_t *mem = ctx->mem + addr;
+    if (we) {
+        for (size_t i = 0; i < len_words; i++) {
+            mem[2 * i] = payload[3 + i] >> 8;
+            mem[2 * i + 1] = payload[3 + i] & 0xff;
+        }
+        if (sync) {
+            queue_response(ctx, packet_new(0, dest, mod->desc.addr,
+                                           OSD_PACKET_TYPE_PLAIN, 0));
+        }
+    } else {
+        // split the data into packets of the maximum size
+        const size_t chunk_max = DEVICESIM_MAX_PKT_LEN - 3;
+        for (size_t pos = 0; pos < len_words; pos += chunk_max) {
+            size_t chunk = len_words - pos;
+            if (chunk > chunk_max) {
+                chunk = chunk_max;
+            }
+            struct osd_packet *resp = packet_new(chunk, dest, mod->desc.addr,
+                                                 OSD_PACKET_TYPE_PLAIN, 0);
+            for (size_t i = 0; i < chunk; i++) {
+                resp->data.payload[i] =
+                    mem[2 * (pos + i)] << 8 | mem[2 * (pos + i) + 1];
+            }
+            queue_response(ctx, resp);
+        }
+    }
+    ctx->stats.mem_bytes += len_words * 2;
+}
+
+API_EXPORT
+osd_result osd_devicesim_packet_write(const struct osd_packet *pkg,
+                                      void *cb_arg)
+{
+    struct osd_devicesim_ctx *ctx = cb_arg;
+    assert(ctx);
+
+    if (pkg->data_size_words < 3 ||
+        pkg->data_size_words > DEVICESIM_MAX_PKT_LEN) {
+        err(ctx->log_ctx, "Ignoring packet of invalid size (%u words).",
+            pkg->data_size_words);
+        return OSD_OK;
+    }
+
+    unsigned int dest = osd_packet_get_dest(pkg);
+    unsigned int local_addr = osd_diaddr_localaddr(dest);
+    if (osd_diaddr_subnet(dest) != ctx->config.subnet_addr ||
+        local_addr >= ctx->mods_len) {
+        dbg(ctx->log_ctx, "Ignoring packet to unknown module %u.", dest);
+        return OSD_OK;
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+    struct devicesim_module *mod = &ctx->mods[local_addr];
+    unsigned int type = osd_packet_get_type(pkg);
+    if (type == OSD_PACKET_TYPE_REG) {
+        handle_reg_access(ctx, mod, pkg);
+    } else if (type == OSD_PACKET_TYPE_PLAIN &&
+               mod->desc.type == OSD_MODULE_TYPE_STD_MAM) {
+        handle_mem_access(ctx, mod, pkg);
+    } else {
+        dbg(ctx->log_ctx, "Ignoring packet of type %u to module %u.", type,
+            dest);
+    }
+    pthread_cond_signal(&ctx->cond);
+    pthread_mutex_unlock(&ctx->lock);
+
+    return OSD_OK;
+}
+
+/**
+ * Get the active trace module emitting the next EVENT packet
+ *
+ * EVENT packets which didn't fit into the trace buffer of a module are
+ * dropped.
+ *
+ * @return the trace module, or NULL if no trace module is active
+ */
+static struct devicesim_module *next_trace_module(
+    struct osd_devicesim_ctx *ctx, uint64_t now)
+{
+    if (!ctx->event_interval_ns) {
+        return NULL;
+    }
+
+    struct devicesim_module *next = NULL;
+    for (unsigned int i = ctx->trace_mods_first; i < ctx->mods_len; i++) {
+        struct devicesim_module *mod = &ctx->mods[i];
+        if (!(mod->cs & OSD_REG_BASE_MOD_CS_ACTIVE) || !mod->event_dest) {
+            continue;
+        }
+
+        uint64_t buffered = 0;
+        if (now > mod->next_event_ns + ctx->link_latency_ns) {
+            buffered = (now - mod->next_event_ns - ctx->link_latency_ns) /
+                       ctx->event_interval_ns;
+        }
+        if (buffered > DEVICESIM_TRACE_BUFFER_LEN) {
+            uint64_t dropped = buffered - DEVICESIM_TRACE_BUFFER_LEN;
+            mod->next_event_ns += dropped * ctx->event_interval_ns;
+            mod->event_seq += dropped;
+            ctx->stats.events_dropped += dropped;
+        }
+
+        if (!next || mod->next_event_ns < next->next_event_ns) {
+            next = mod;
+        }
+    }
+    return next;
+}
+
+/**
+ * Create the next EVENT packet of a trace module
+ */
+static struct osd_packet *event_new(struct osd_devicesim_ctx *ctx,
+                                    struct devicesim_module *mod)
+{
+    unsigned int payload_min = ctx->config.event_payload_min;
+    unsigned int payload_max = ctx->config.event_payload_max;
+    unsigned int payload_words =
+        payload_min +
+        rand_r(&ctx->rand_state) % (payload_max - payload_min + 1);
+
+    struct osd_packet *pkg = packet_new(payload_words, mod->event_dest,
+                                        mod->desc.addr, OSD_PACKET_TYPE_EVENT,
+                                        0);
+    pkg->data.payload[0] = mod->event_seq;
+    for (unsigned int i = 1; i < payload_words; i++) {
+        pkg->data.payload[i] = i;
+    }
+
+    mod->event_seq++;
+    mod->next_event_ns += ctx->event_interval_ns;
+    ctx->stats.events_sent++;
+    return pkg;
+}
+
+static void unlock_mutex(void *mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
+API_EXPORT
+osd_result osd_devicesim_packet_read(struct osd_packet **pkg, void *cb_arg)
+{
+    struct osd_devicesim_ctx *ctx = cb_arg;
+    assert(ctx);
+
+    *pkg = NULL;
+
+    // the gateway cancels the thread reading from the device while it waits
+    pthread_mutex_lock(&ctx->lock);
+    pthread_cleanup_push(unlock_mutex, &ctx->lock);
+
+    while (!*pkg) {
+        uint64_t now = now_ns();
+        uint64_t deadline = UINT64_MAX;
+
+        // responses and EVENT packets are read in the order they arrive
+        struct devicesim_pkt *resp = ctx->resp_head;
+        struct devicesim_module *mod = next_trace_module(ctx, now);
+        uint64_t event_ready_ns =
+            mod ? mod->next_event_ns + ctx->link_latency_ns : UINT64_MAX;
+
+        if (resp && resp->ready_ns <= now &&
+            resp->ready_ns <= event_ready_ns) {
+            ctx->resp_head = resp->next;
+            if (!ctx->resp_head) {
+                ctx->resp_tail = NULL;
+            }
+            *pkg = resp->pkg;
+            free(resp);
+            break;
+        }
+        if (event_ready_ns <= now) {
+            *pkg = event_new(ctx, mod);
+            break;
+        }
+
+        if (resp) {
+            deadline = resp->ready_ns;
+        }
+        if (event_ready_ns < deadline) {
+            deadline = event_ready_ns;
+        }
+        if (deadline == UINT64_MAX) {
+            pthread_cond_wait(&ctx->cond, &ctx->lock);
+        } else {
+            struct timespec ts = {
+                .tv_sec = deadline / 1000000000ULL,
+                .tv_nsec = deadline % 1000000000ULL,
+            };
+            pthread_cond_timedwait(&ctx->cond, &ctx->lock, &ts);
+        }
+    }
+
+    pthread_cleanup_pop(1);
+    return OSD_OK;
+}
+
+API_EXPORT
+void osd_devicesim_get_stats(struct osd_devicesim_ctx *ctx,
+                             struct osd_devicesim_stats *stats)
+{
+    assert(ctx);
+    assert(stats);
+
+    pthread_mutex_lock(&ctx->lock);
+    *stats = ctx->stats;
+    pthread_mutex_unlock(&ctx->lock);
+}
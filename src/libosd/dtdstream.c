@@ -0,0 +1,115 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "dtdstream.h"
+
+#include <assert.h>
+#include <string.h>
+
+/** Size of the packet header (words) */
+#define HEADER_WORDS 3
+
+void dtdstream_init(struct dtdstream *s)
+{
+    memset(s, 0, sizeof(*s));
+}
+
+void dtdstream_reset(struct dtdstream *s)
+{
+    osd_packet_free(&s->pkg);
+    s->words = 0;
+    s->skip_words = 0;
+    s->split = false;
+}
+
+/**
+ * Process a complete word of the stream
+ *
+ * @return true if the word completed a packet
+ */
+static bool process_word(struct dtdstream *s, uint16_t word)
+{
+    if (s->skip_words) {
+        s->skip_words--;
+        return false;
+    }
+    if (!s->pkg) {
+        if (word < HEADER_WORDS) {
+            s->invalid++;
+            s->skip_words = word;
+            return false;
+        }
+        osd_result rv = osd_packet_new(&s->pkg, word);
+        assert(OSD_SUCCEEDED(rv));
+        s->words = 0;
+        return false;
+    }
+    s->pkg->data_raw[s->words++] = word;
+    return s->words == s->pkg->data_size_words;
+}
+
+size_t dtdstream_parse(struct dtdstream *s, const uint8_t *data, size_t len,
+                       struct osd_packet **pkg)
+{
+    size_t pos = 0;
+    *pkg = NULL;
+
+    while (pos < len) {
+        // a word split between two buffers
+        if (s->split) {
+            s->split = false;
+            if (process_word(s, s->split_byte << 8 | data[pos++])) {
+                break;
+            }
+            continue;
+        }
+        if (len - pos == 1) {
+            s->split_byte = data[pos++];
+            s->split = true;
+            break;
+        }
+
+        // the bulk of the packet data: convert all words available at once
+        if (s->pkg && !s->skip_words) {
+            size_t words = s->pkg->data_size_words - s->words;
+            if (words > (len - pos) / 2) {
+                words = (len - pos) / 2;
+            }
+            uint16_t *dest = s->pkg->data_raw + s->words;
+            for (size_t i = 0; i < words; i++) {
+                dest[i] = data[pos] << 8 | data[pos + 1];
+                pos += 2;
+            }
+            s->words += words;
+            if (s->words == s->pkg->data_size_words) {
+                break;
+            }
+            continue;
+        }
+
+        uint16_t word = data[pos] << 8 | data[pos + 1];
+        pos += 2;
+        if (process_word(s, word)) {
+            break;
+        }
+    }
+
+    if (s->pkg && s->words == s->pkg->data_size_words) {
+        *pkg = s->pkg;
+        s->pkg = NULL;
+        s->words = 0;
+    }
+    return pos;
+}
@@ -0,0 +1,84 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DTDSTREAM_H
+#define DTDSTREAM_H
+
+#include <osd/osd.h>
+#include <osd/packet.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Parser of Debug Transport Datagrams (DTDs) received as a byte stream
+ *
+ * Devices connected through a TCP connection or a serial port send their
+ * packets as a stream of DTDs: every packet is preceded by its size in
+ * 16 bit words, all words in big endian (as with GLIP). The parser turns the
+ * received bytes into packets, reading straight from the buffers the data
+ * was received into. A DTD can be split over any number of buffers, also
+ * within a word.
+ *
+ * DTDs shorter than a packet header are skipped and counted.
+ *
+ * The object is not locked.
+ */
+struct dtdstream {
+    /** Packet being assembled, NULL while waiting for the size of a DTD */
+    struct osd_packet *pkg;
+
+    /** Number of words of @p pkg already received */
+    size_t words;
+
+    /** Words of an invalid DTD still to be skipped */
+    size_t skip_words;
+
+    /** First byte of a word split between two buffers */
+    uint8_t split_byte;
+
+    /** Is @p split_byte set? */
+    bool split;
+
+    /** Number of invalid DTDs skipped */
+    uint64_t invalid;
+};
+
+/**
+ * Initialize a parser
+ */
+void dtdstream_init(struct dtdstream *s);
+
+/**
+ * Drop a partially received packet and start over with the next DTD
+ */
+void dtdstream_reset(struct dtdstream *s);
+
+/**
+ * Parse received data
+ *
+ * Parsing stops after the first complete packet. Call the function again
+ * with the remaining data to get the next packet.
+ *
+ * @param data the received bytes
+ * @param len number of bytes in @p data
+ * @param[out] pkg the next complete packet (the caller frees it), or NULL if
+ *                 all data was consumed without completing a packet
+ * @return the number of bytes consumed
+ */
+size_t dtdstream_parse(struct dtdstream *s, const uint8_t *data, size_t len,
+                       struct osd_packet **pkg);
+
+#endif  // DTDSTREAM_H
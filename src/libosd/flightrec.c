@@ -0,0 +1,358 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flightrec.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include "capture.h"
+#include "osd-private.h"
+
+struct flightrec {
+    struct osd_log_ctx *log_ctx;
+
+    /** Ring buffer of encoded capture records */
+    uint8_t *buf;
+    /** Size of buf (bytes) */
+    size_t size;
+
+    /**
+     * Offset of the oldest record. The records are stored in
+     * [tail, data_end) and [0, head) if the ring is wrapped, and in
+     * [tail, head) otherwise.
+     */
+    size_t tail;
+    /** Offset the next record is written to */
+    size_t head;
+    /** End of the records at the end of buf (if wrapped) */
+    size_t data_end;
+    /** Do the records continue at the start of buf? */
+    bool wrapped;
+    /** Number of records in the ring */
+    size_t records;
+
+    /**
+     * Packets triggering a dump: bit (type << 4 | type_sub) is set for each
+     * trigger
+     */
+    uint64_t trigger_mask;
+
+    /** Is a windowed dump armed? */
+    bool window_armed;
+    /** Number of records in the armed window */
+    size_t window_records;
+    /** Records still to be recorded until the window is complete */
+    size_t window_remaining;
+
+    /** Base name of the dump files */
+    char *dump_filename;
+    /** Number of the next dump file */
+    unsigned int dump_seq;
+
+    /** Thread writing the last dump */
+    pthread_t dump_thread;
+    /** Has dump_thread been started (and not yet been joined)? */
+    bool dump_thread_started;
+    /** Is dump_thread still writing? (accessed atomically) */
+    int dump_running;
+};
+
+/**
+ * A dump being written
+ */
+struct flightrec_dump_job {
+    struct flightrec *fr;
+
+    /** The records (in order, without gaps) */
+    uint8_t *buf;
+    /** Size of buf (bytes) */
+    size_t len;
+
+    /** The file to write */
+    char *filename;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+osd_result flightrec_new(struct flightrec **fr, struct osd_log_ctx *log_ctx,
+                         size_t size, const char *dump_filename)
+{
+    if (size < FLIGHTREC_SIZE_MIN) {
+        err(log_ctx, "Flight recorder size must be at least %d bytes.",
+            FLIGHTREC_SIZE_MIN);
+        return OSD_ERROR_FAILURE;
+    }
+
+    struct flightrec *f = calloc(1, sizeof(struct flightrec));
+    assert(f);
+
+    f->buf = malloc(size);
+    if (!f->buf) {
+        err(log_ctx, "Unable to allocate %zu bytes for the flight recorder.",
+            size);
+        free(f);
+        return OSD_ERROR_OOM;
+    }
+    f->size = size;
+    f->log_ctx = log_ctx;
+    f->dump_filename = strdup(dump_filename);
+    assert(f->dump_filename);
+
+    *fr = f;
+    return OSD_OK;
+}
+
+void flightrec_free(struct flightrec **fr_p)
+{
+    assert(fr_p);
+    struct flightrec *fr = *fr_p;
+    if (!fr) {
+        return;
+    }
+
+    if (fr->dump_thread_started) {
+        pthread_join(fr->dump_thread, NULL);
+    }
+
+    free(fr->dump_filename);
+    free(fr->buf);
+    free(fr);
+    *fr_p = NULL;
+}
+
+/**
+ * Remove the oldest record from the ring
+ */
+static void ring_drop_oldest(struct flightrec *fr)
+{
+    assert(fr->records);
+
+    fr->tail += capture_record_get_size(fr->buf + fr->tail);
+    fr->records--;
+    if (fr->wrapped && fr->tail >= fr->data_end) {
+        fr->tail = 0;
+        fr->wrapped = false;
+    }
+    if (!fr->records) {
+        fr->head = fr->tail = 0;
+        fr->wrapped = false;
+    }
+}
+
+/**
+ * Make space for a record of @p len bytes at the head of the ring
+ *
+ * @return the record
+ */
+static uint8_t *ring_reserve(struct flightrec *fr, size_t len)
+{
+    assert(len <= fr->size);
+
+    while (1) {
+        if (!fr->wrapped) {
+            if (fr->size - fr->head >= len) {
+                break;
+            }
+            // continue at the start of the buffer
+            fr->data_end = fr->head;
+            fr->head = 0;
+            fr->wrapped = true;
+        }
+        if (fr->tail - fr->head >= len) {
+            break;
+        }
+        ring_drop_oldest(fr);
+    }
+
+    uint8_t *rec = fr->buf + fr->head;
+    fr->head += len;
+    fr->records++;
+    return rec;
+}
+
+bool flightrec_record(struct flightrec *fr, const zframe_t *src,
+                      const zframe_t *dest, const zframe_t *packet)
+{
+    size_t len = capture_record_size(src, dest, packet);
+    if (len > fr->size) {
+        return false;
+    }
+    capture_record_encode(ring_reserve(fr, len), now_ns(), src, dest, packet);
+
+    if (fr->window_remaining) {
+        fr->window_remaining--;
+        return fr->window_remaining == 0;
+    }
+    return false;
+}
+
+osd_result flightrec_arm(struct flightrec *fr, size_t pre_records,
+                         size_t post_records)
+{
+    if (fr->window_armed) {
+        return OSD_ERROR_FAILURE;
+    }
+    fr->window_armed = true;
+    fr->window_records = pre_records + post_records;
+    fr->window_remaining = post_records;
+    return OSD_OK;
+}
+
+bool flightrec_is_armed(struct flightrec *fr)
+{
+    return fr->window_armed;
+}
+
+void flightrec_add_trigger(struct flightrec *fr, unsigned int type,
+                           unsigned int type_sub)
+{
+    assert(type <= OSD_PACKET_TYPE_RES);
+    assert(type_sub < 16);
+    fr->trigger_mask |= 1ULL << (type << 4 | type_sub);
+}
+
+bool flightrec_is_trigger(struct flightrec *fr,
+                          const struct osd_packet *packet)
+{
+    if (!fr->trigger_mask) {
+        return false;
+    }
+    unsigned int bit = osd_packet_get_type(packet) << 4 |
+                       osd_packet_get_type_sub(packet);
+    return fr->trigger_mask & (1ULL << bit);
+}
+
+/**
+ * Dump thread: write a dump to its file
+ */
+static void *dump_thread_main(void *job_void)
+{
+    struct flightrec_dump_job *job = job_void;
+    struct flightrec *fr = job->fr;
+
+    // timestamps in the file start at the oldest record
+    uint64_t start_ns = job->len ? capture_record_get_timestamp(job->buf) : 0;
+    for (size_t pos = 0; pos < job->len;
+         pos += capture_record_get_size(job->buf + pos)) {
+        capture_record_set_timestamp(
+            job->buf + pos,
+            capture_record_get_timestamp(job->buf + pos) - start_ns);
+    }
+
+    FILE *file = fopen(job->filename, "wb");
+    if (!file) {
+        err(fr->log_ctx, "Unable to create flight recorder dump %s: %s",
+            job->filename, strerror(errno));
+    } else {
+        bool ok =
+            fwrite(OSD_CAPTURE_MAGIC, OSD_CAPTURE_MAGIC_SIZE, 1, file) == 1 &&
+            (!job->len || fwrite(job->buf, job->len, 1, file) == 1);
+        if (fclose(file) != 0) {
+            ok = false;
+        }
+        if (!ok) {
+            err(fr->log_ctx, "Unable to write flight recorder dump %s: %s",
+                job->filename, strerror(errno));
+        } else {
+            info(fr->log_ctx, "Wrote flight recorder dump %s (%zu bytes)",
+                 job->filename, job->len);
+        }
+    }
+
+    free(job->filename);
+    free(job->buf);
+    free(job);
+
+    __atomic_store_n(&fr->dump_running, 0, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+osd_result flightrec_dump(struct flightrec *fr)
+{
+    if (fr->dump_thread_started) {
+        if (__atomic_load_n(&fr->dump_running, __ATOMIC_ACQUIRE)) {
+            err(fr->log_ctx, "Flight recorder dump still being written, "
+                "ignoring trigger.");
+            fr->window_armed = false;
+            fr->window_remaining = 0;
+            return OSD_ERROR_FAILURE;
+        }
+        pthread_join(fr->dump_thread, NULL);
+        fr->dump_thread_started = false;
+    }
+
+    struct flightrec_dump_job *job =
+        calloc(1, sizeof(struct flightrec_dump_job));
+    assert(job);
+    job->fr = fr;
+
+    size_t filename_len = strlen(fr->dump_filename) + 12;
+    job->filename = malloc(filename_len);
+    assert(job->filename);
+    snprintf(job->filename, filename_len, "%s.%u", fr->dump_filename,
+             fr->dump_seq++);
+
+    // skip the records before an armed window
+    size_t start = fr->tail;
+    bool start_wrapped = fr->wrapped;
+    if (fr->window_armed) {
+        size_t window = fr->window_records - fr->window_remaining;
+        for (size_t skip = fr->records > window ? fr->records - window : 0;
+             skip; skip--) {
+            start += capture_record_get_size(fr->buf + start);
+            if (start_wrapped && start >= fr->data_end) {
+                start = 0;
+                start_wrapped = false;
+            }
+        }
+        fr->window_armed = false;
+        fr->window_remaining = 0;
+    }
+
+    // copy the records in order
+    size_t first_len = (start_wrapped ? fr->data_end : fr->head) - start;
+    size_t second_len = start_wrapped ? fr->head : 0;
+    if (!fr->records) {
+        first_len = 0;
+    }
+    job->len = first_len + second_len;
+    job->buf = malloc(job->len ? job->len : 1);
+    assert(job->buf);
+    memcpy(job->buf, fr->buf + start, first_len);
+    memcpy(job->buf + first_len, fr->buf, second_len);
+
+    __atomic_store_n(&fr->dump_running, 1, __ATOMIC_RELAXED);
+    int irv = pthread_create(&fr->dump_thread, NULL, dump_thread_main, job);
+    if (irv != 0) {
+        err(fr->log_ctx, "Unable to start flight recorder dump thread: %s",
+            strerror(irv));
+        __atomic_store_n(&fr->dump_running, 0, __ATOMIC_RELAXED);
+        free(job->filename);
+        free(job->buf);
+        free(job);
+        return OSD_ERROR_FAILURE;
+    }
+    fr->dump_thread_started = true;
+
+    return OSD_OK;
+}
@@ -0,0 +1,121 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLIGHTREC_H
+#define FLIGHTREC_H
+
+#include <czmq.h>
+#include <osd/osd.h>
+#include <osd/packet.h>
+#include <stdbool.h>
+
+/**
+ * Flight recorder: the most recent routed packets in memory
+ *
+ * The recorder keeps the packets in a ring buffer of fixed size, encoded as
+ * capture records (see capture.h). Once the buffer is full, the oldest
+ * records are overwritten. The ring is owned by the thread recording the
+ * packets and is not locked; recording a packet costs one memory copy.
+ *
+ * On a dump, the content of the ring is copied and written to a capture file
+ * by a separate thread. Only one dump is written at a time. A dump either
+ * covers the whole ring, or only a window around a trigger (see
+ * flightrec_arm()).
+ */
+
+/** Smallest size of the ring buffer (bytes) */
+#define FLIGHTREC_SIZE_MIN (64 * 1024)
+
+struct flightrec;
+
+/**
+ * Create a flight recorder
+ *
+ * @param fr the flight recorder
+ * @param log_ctx the log context
+ * @param size size of the ring buffer (bytes, at least FLIGHTREC_SIZE_MIN)
+ * @param dump_filename base name of the dump files. The dumps are written to
+ *                      <dump_filename>.<N>, with N counting up from 0.
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if @p size is too small
+ *         OSD_ERROR_OOM if the ring buffer cannot be allocated
+ */
+osd_result flightrec_new(struct flightrec **fr, struct osd_log_ctx *log_ctx,
+                         size_t size, const char *dump_filename);
+
+/**
+ * Free the flight recorder, waiting for a running dump to finish
+ */
+void flightrec_free(struct flightrec **fr_p);
+
+/**
+ * Record a routed packet
+ *
+ * @param fr the flight recorder
+ * @param src ZeroMQ identity of the client which sent the packet
+ * @param dest ZeroMQ identity of the client the packet is routed to
+ * @param packet the DI packet
+ * @return true if this record completed an armed window, which should now be
+ *         dumped with flightrec_dump()
+ */
+bool flightrec_record(struct flightrec *fr, const zframe_t *src,
+                      const zframe_t *dest, const zframe_t *packet);
+
+/**
+ * Dump packets of a given type and subtype
+ *
+ * @param fr the flight recorder
+ * @param type the packet type (enum osd_packet_type)
+ * @param type_sub the packet subtype
+ */
+void flightrec_add_trigger(struct flightrec *fr, unsigned int type,
+                           unsigned int type_sub);
+
+/**
+ * Does a packet trigger a dump?
+ */
+bool flightrec_is_trigger(struct flightrec *fr,
+                          const struct osd_packet *packet);
+
+/**
+ * Arm a windowed dump
+ *
+ * The next dump only contains the last @p pre_records records up to now and
+ * the @p post_records records following them. flightrec_record() reports
+ * when the window is complete.
+ *
+ * @return OSD_OK if the window was armed,
+ *         OSD_ERROR_FAILURE if a window is already armed
+ */
+osd_result flightrec_arm(struct flightrec *fr, size_t pre_records,
+                         size_t post_records);
+
+/**
+ * Is a windowed dump armed?
+ */
+bool flightrec_is_armed(struct flightrec *fr);
+
+/**
+ * Dump the recorded packets to the next dump file
+ *
+ * If a window is armed, only the records of the window are dumped (up to
+ * now, if it is not complete yet), and the window is disarmed.
+ *
+ * @return OSD_OK if the dump was started,
+ *         OSD_ERROR_FAILURE if a dump is still being written
+ */
+osd_result flightrec_dump(struct flightrec *fr);
+
+#endif  // FLIGHTREC_H
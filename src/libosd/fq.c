@@ -0,0 +1,239 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "fq.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+/**
+ * The items of one source
+ */
+struct fq_flow {
+    /** Source of the items */
+    const void *src;
+
+    /** Queued items */
+    zlist_t *items;
+
+    /** Bytes the flow may still dequeue in this round */
+    size_t deficit;
+};
+
+struct fq {
+    /**
+     * Flows with queued items (struct fq_flow), in round robin order
+     *
+     * The first flow is served next. Flows are freed once they are empty.
+     */
+    zlist_t *flows;
+
+    /** Number of items in all flows */
+    size_t size;
+
+    /** Maximum number of items per flow */
+    size_t flow_max;
+
+    /** Get the size of an item */
+    fq_item_size_fn size_fn;
+};
+
+static struct fq_flow *fq_find_flow(const struct fq *fq, const void *src)
+{
+    struct fq_flow *flow;
+    for (flow = zlist_first(fq->flows); flow; flow = zlist_next(fq->flows)) {
+        if (flow->src == src) {
+            return flow;
+        }
+    }
+    return NULL;
+}
+
+static void fq_flow_free(struct fq_flow **flow_p)
+{
+    struct fq_flow *flow = *flow_p;
+    assert(zlist_size(flow->items) == 0);
+    zlist_destroy(&flow->items);
+    free(flow);
+    *flow_p = NULL;
+}
+
+/**
+ * Remove and free a flow after its last item was removed
+ */
+static void fq_flow_remove_if_empty(struct fq *fq, struct fq_flow *flow)
+{
+    if (zlist_size(flow->items)) {
+        return;
+    }
+    zlist_remove(fq->flows, flow);
+    fq_flow_free(&flow);
+}
+
+struct fq *fq_new(fq_item_size_fn size_fn, size_t flow_max)
+{
+    struct fq *fq = calloc(1, sizeof(struct fq));
+    assert(fq);
+    fq->flows = zlist_new();
+    assert(fq->flows);
+    fq->size_fn = size_fn;
+    fq->flow_max = flow_max;
+    return fq;
+}
+
+void fq_free(struct fq **fq_p)
+{
+    assert(fq_p);
+    struct fq *fq = *fq_p;
+    if (!fq) {
+        return;
+    }
+
+    assert(fq->size == 0);
+    zlist_destroy(&fq->flows);
+    free(fq);
+    *fq_p = NULL;
+}
+
+int fq_enqueue(struct fq *fq, const void *src, void *item)
+{
+    int rv;
+
+    struct fq_flow *flow = fq_find_flow(fq, src);
+    if (!flow) {
+        flow = calloc(1, sizeof(struct fq_flow));
+        assert(flow);
+        flow->src = src;
+        flow->items = zlist_new();
+        assert(flow->items);
+        rv = zlist_append(fq->flows, flow);
+        assert(rv == 0);
+    } else if (zlist_size(flow->items) >= fq->flow_max) {
+        return -1;
+    }
+
+    rv = zlist_append(flow->items, item);
+    assert(rv == 0);
+    fq->size++;
+    return 0;
+}
+
+void *fq_peek(struct fq *fq, const void **src)
+{
+    if (fq->size == 0) {
+        return NULL;
+    }
+
+    // Every round adds a quantum to the deficit of the first flow, so this
+    // loop terminates.
+    while (1) {
+        struct fq_flow *flow = zlist_first(fq->flows);
+        void *item = zlist_first(flow->items);
+        if (fq->size_fn(item) <= flow->deficit) {
+            if (src) {
+                *src = flow->src;
+            }
+            return item;
+        }
+
+        // not enough deficit left: the next flow's turn
+        flow->deficit += FQ_QUANTUM;
+        zlist_pop(fq->flows);
+        zlist_append(fq->flows, flow);
+    }
+}
+
+void *fq_dequeue(struct fq *fq, const void **src)
+{
+    void *item = fq_peek(fq, src);
+    if (!item) {
+        return NULL;
+    }
+
+    struct fq_flow *flow = zlist_first(fq->flows);
+    zlist_pop(flow->items);
+    flow->deficit -= fq->size_fn(item);
+    fq->size--;
+    fq_flow_remove_if_empty(fq, flow);
+
+    return item;
+}
+
+void *fq_drop_oldest(struct fq *fq, const void *src)
+{
+    struct fq_flow *flow = fq_find_flow(fq, src);
+    if (!flow) {
+        return NULL;
+    }
+
+    void *item = zlist_pop(flow->items);
+    fq->size--;
+    fq_flow_remove_if_empty(fq, flow);
+    return item;
+}
+
+void *fq_pop_any(struct fq *fq, const void **src)
+{
+    struct fq_flow *flow = zlist_first(fq->flows);
+    if (!flow) {
+        return NULL;
+    }
+
+    if (src) {
+        *src = flow->src;
+    }
+    void *item = zlist_pop(flow->items);
+    fq->size--;
+    fq_flow_remove_if_empty(fq, flow);
+    return item;
+}
+
+void fq_forget_src(struct fq *fq, const void *src)
+{
+    if (src == NULL) {
+        return;
+    }
+
+    struct fq_flow *flow = fq_find_flow(fq, src);
+    if (!flow) {
+        return;
+    }
+
+    struct fq_flow *null_flow = fq_find_flow(fq, NULL);
+    if (!null_flow) {
+        flow->src = NULL;
+        return;
+    }
+
+    // merge into the existing flow, the flow limit doesn't apply here
+    void *item;
+    while ((item = zlist_pop(flow->items))) {
+        int rv = zlist_append(null_flow->items, item);
+        assert(rv == 0);
+    }
+    zlist_remove(fq->flows, flow);
+    fq_flow_free(&flow);
+}
+
+size_t fq_size(const struct fq *fq)
+{
+    return fq->size;
+}
+
+size_t fq_src_size(const struct fq *fq, const void *src)
+{
+    struct fq_flow *flow = fq_find_flow(fq, src);
+    return flow ? zlist_size(flow->items) : 0;
+}
@@ -0,0 +1,118 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FQ_H
+#define FQ_H
+
+#include <czmq.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Fair queue
+ *
+ * A queue holding items from multiple sources. Every source gets its own
+ * FIFO (a "flow"); the flows are served with Deficit Round Robin (DRR): in
+ * each round a flow may dequeue up to FQ_QUANTUM bytes (plus what it didn't
+ * use in earlier rounds). Sources sending large amounts of data therefore
+ * get the same share of the output as sources sending little data, as long
+ * as both have items waiting, and a single source cannot fill the whole
+ * queue.
+ *
+ * Sources are identified by an opaque pointer, which is only compared, never
+ * dereferenced. NULL is a valid source (e.g. for unknown senders).
+ */
+
+/** Bytes a flow may dequeue per round */
+#define FQ_QUANTUM 256
+
+/**
+ * Get the size of an item in bytes
+ */
+typedef size_t (*fq_item_size_fn)(const void *item);
+
+struct fq;
+
+/**
+ * Create a new fair queue
+ *
+ * @param size_fn function returning the size of an item
+ * @param flow_max maximum number of items queued per source
+ */
+struct fq *fq_new(fq_item_size_fn size_fn, size_t flow_max);
+
+/**
+ * Free a fair queue
+ *
+ * The queue must be empty.
+ */
+void fq_free(struct fq **fq_p);
+
+/**
+ * Append an item to the flow of a source
+ *
+ * @return 0 on success, -1 if the flow of @p src already holds the maximum
+ *         number of items
+ */
+int fq_enqueue(struct fq *fq, const void *src, void *item);
+
+/**
+ * Get the item to dequeue next, without removing it
+ *
+ * @param[out] src the source of the item. Set to NULL if not needed.
+ * @return the item, or NULL if the queue is empty
+ */
+void *fq_peek(struct fq *fq, const void **src);
+
+/**
+ * Remove the item returned by the preceding call to fq_peek()
+ *
+ * @return the item, or NULL if the queue is empty
+ */
+void *fq_dequeue(struct fq *fq, const void **src);
+
+/**
+ * Remove the oldest item of a source
+ *
+ * @return the item, or NULL if no items of @p src are queued
+ */
+void *fq_drop_oldest(struct fq *fq, const void *src);
+
+/**
+ * Remove any item (in no particular order), e.g. to clear the queue
+ *
+ * @return the item, or NULL if the queue is empty
+ */
+void *fq_pop_any(struct fq *fq, const void **src);
+
+/**
+ * Move all items of a source to the flow of the NULL source
+ *
+ * Call this function before the object identifying the source becomes
+ * invalid.
+ */
+void fq_forget_src(struct fq *fq, const void *src);
+
+/**
+ * Number of items in the queue (all sources)
+ */
+size_t fq_size(const struct fq *fq);
+
+/**
+ * Number of items of a source in the queue
+ */
+size_t fq_src_size(const struct fq *fq, const void *src);
+
+#endif  // FQ_H
@@ -17,13 +17,194 @@
 #include <osd/osd.h>
 #include <osd/packet.h>
 #include "osd-private.h"
+#include "bufpool.h"
+#include "latency.h"
+#include "proto.h"
+#include "rxfilter.h"
+#include "shm.h"
+#include "stats.h"
+#include "tclass.h"
+#include "trace.h"
 #include "worker.h"
+#include "wirecomp.h"
 
 #include <assert.h>
+#include <endian.h>
 #include <errno.h>
 #include <stdbool.h>
 #include <string.h>
 
+/**
+ * ZeroMQ endpoints forwarding data from the device RX thread to the I/O
+ * thread, one per traffic class
+ */
+static const char *devicerx_endpoints[OSD_TCLASS_COUNT] = {
+        [OSD_TCLASS_CONTROL] = "inproc://devicerx-control",
+        [OSD_TCLASS_BULK] = "inproc://devicerx",
+};
+
+/**
+ * Maximum number of messages processed in one go before returning to the
+ * event loop
+ *
+ * Within such a batch messages are scheduled by traffic class.
+ */
+#define IO_BATCH_MAX 64
+
+/**
+ * Maximum number of bulk packets read from a pollable device while the
+ * gateway waits for credits
+ *
+ * Once the backlog is full the device isn't read any more until credits
+ * arrive. Until then control packets are read and forwarded as usual.
+ */
+#define DEVICE_FD_BACKLOG_MAX 1024
+
+/**
+ * Size of the buffer collecting packets written to the device in one go
+ * (uint16_t words)
+ *
+ * The buffer holds at least one packet of the maximum size.
+ */
+#define DEVICE_TX_BUF_WORDS (64 * 1024)
+
+/** Default maximum size of a batch of packets read from the device (bytes) */
+#define DEVICERX_BATCH_BYTES_DEFAULT (16 * 1024)
+
+/** Default maximum time a packet read from the device is batched (ms) */
+#define DEVICERX_BATCH_DELAY_MS_DEFAULT 1
+
+/** Number of unused device RX batch buffers kept for reuse */
+#define DEVICERX_BUF_POOL_SIZE 16
+
+/**
+ * Size of the buffers packet_read_batch reads to (uint16_t words)
+ *
+ * The buffer holds at least one packet of the maximum size.
+ */
+#define DEVICERX_READ_BUF_WORDS OSD_GATEWAY_READ_BATCH_MIN_WORDS
+
+/** Number of unused packet_read_batch buffers kept for reuse */
+#define DEVICERX_READ_POOL_SIZE 8
+
+/**
+ * Period of the timer sending the summaries of aggregated sources (ms)
+ *
+ * Summaries are sent up to this much later than their interval ends.
+ */
+#define DEVICERX_SUMMARY_TIMER_MS 10
+
+/**
+ * Bulk packets read from the device, waiting to be forwarded to the I/O
+ * thread in one message
+ *
+ * The device RX thread collects packets in the batch and sends it once it
+ * holds max_bytes. Since the device RX thread blocks while waiting for the
+ * next packet, a batch which doesn't fill up is sent by a timer in the I/O
+ * thread after max_delay_ms (see hostiothread_flush_devicerx_batch()).
+ *
+ * The batch is sent as message "B", followed by one frame containing the
+ * packets as DTDs: the packet size in 16 bit words, followed by the packet.
+ * The buffer is handed over to ZeroMQ without copying and returns to the
+ * pool once the last packet in it was sent to the host controller.
+ */
+struct devicerx_batch {
+    /** Lock protecting all fields below and the use of @p sock */
+    pthread_mutex_t lock;
+
+    /** Socket to send the batch to, NULL if not connected to the device */
+    zsock_t *sock;
+
+    /** Maximum size of a batch (bytes), 0 to disable batching */
+    size_t max_bytes;
+
+    /** Maximum time a packet is kept in the batch (ms) */
+    unsigned int max_delay_ms;
+
+    /** Buffers for batches (max_bytes each) */
+    struct bufpool *pool;
+
+    /** Batched packets (from @p pool) */
+    uint8_t *buf;
+
+    /** Bytes used in @p buf */
+    size_t len;
+
+    /** Number of packets in @p buf */
+    unsigned int packets;
+
+    /** Time the last packet was read from the device (ns) */
+    uint64_t last_rx_ns;
+
+    /**
+     * Statistics: packets forwarded in one batch (recorded by both threads,
+     * serialized by @p lock)
+     */
+    struct stats_hist *stats_batch;
+
+    /**
+     * Statistics: bytes of packet data copied into batches (device RX
+     * thread)
+     */
+    uint64_t *stats_copy_bytes;
+
+    /**
+     * Statistics: batch buffers allocated because the pool was empty
+     * (recorded by both threads, serialized by @p lock)
+     */
+    uint64_t *stats_buf_allocs;
+};
+
+/**
+ * Batch of bulk packets being forwarded by the I/O thread
+ *
+ * The batch is a frame received from the device RX thread, or a buffer read
+ * from a pollable device with packet_read_batch. The packets of the batch are
+ * sent to the host controller straight out of the batch. The batch is shared
+ * by the I/O thread (while it forwards the batch) and by all messages which
+ * are not yet sent.
+ */
+struct devicerx_batch_ref {
+    /** The packets as DTDs, see struct devicerx_batch */
+    uint8_t *data;
+
+    /** Size of @p data (bytes) */
+    size_t size;
+
+    /** Free the batch, called as free_fn(data, hint) */
+    zmq_free_fn *free_fn;
+
+    /** Argument passed to @p free_fn */
+    void *hint;
+
+    /** Number of users of @p data */
+    uint32_t refs;
+};
+
+/**
+ * Filter for bulk packets read from the device (see rxfilter.h)
+ *
+ * The filter is applied by the thread reading the device (the device RX
+ * thread, or the I/O thread for pollable devices) before packets are batched
+ * or forwarded. It is replaced and its summaries are sent by the I/O thread.
+ */
+struct devicerx_filter {
+    /** Lock protecting @p filter */
+    pthread_mutex_t lock;
+
+    /** The filter, NULL if all packets are forwarded */
+    struct rxfilter *filter;
+
+    /** Is @p filter set? (read without the lock) */
+    bool active;
+
+    /** Statistics: packets dropped by the filter */
+    uint64_t *stats_filtered;
+
+    /** Statistics: packets replaced by summaries */
+    uint64_t *stats_aggregated;
+};
+
 /**
  * Gateway context
  */
@@ -44,18 +225,76 @@ struct osd_gateway_ctx {
     pthread_t devicerxthread;
 
     /**
-     * ZeroMQ PAIR socket, forwarding data read from the device to the I/O
-     * thread
+     * ZeroMQ PAIR sockets, forwarding data read from the device to the I/O
+     * thread (one per traffic class)
      */
-    zsock_t *device_rx_socket;
+    zsock_t *device_rx_socket[OSD_TCLASS_COUNT];
 
     /**
-     * Read a single packet from the device (blocking)
+     * Read a single packet from the device (blocking), NULL for devices read
+     * with packet_read_batch
      */
     packet_read_fn packet_read;
 
+    /**
+     * Read packets from the device (blocking, or without blocking if the
+     * device is read through device_fd), NULL for devices read with
+     * packet_read
+     */
+    packet_read_batch_fn packet_read_batch;
+
+    /** Buffers for packet_read_batch (DEVICERX_READ_BUF_WORDS each) */
+    struct bufpool *devicerx_read_pool;
+
+    /** Buffer the device RX thread reads to next (from devicerx_read_pool) */
+    uint16_t *devicerx_read_buf;
+
     /** Callback argument pointer (passed to the callbacks, internally unused)*/
     void *cb_arg;
+
+    /** Flow control statistics (updated by the I/O thread) */
+    struct osd_flowctrl_stats flowctrl_stats;
+
+    /** Traffic statistics */
+    struct stats_registry *stats;
+
+    /** Statistics: packets read from the device (device RX thread) */
+    uint64_t *stats_device_rx_packets;
+
+    /** Statistics: bytes read from the device (device RX thread) */
+    uint64_t *stats_device_rx_bytes;
+
+    /** Statistics: failed reads from the device (device RX thread) */
+    uint64_t *stats_device_rx_errors;
+
+    /**
+     * Statistics: calls to packet_read or packet_read_batch which returned
+     * packets (device RX thread)
+     */
+    uint64_t *stats_device_rx_reads;
+
+    /** Bulk packets read from the device, waiting to be forwarded */
+    struct devicerx_batch devicerx_batch;
+
+    /** Filter for bulk packets read from the device */
+    struct devicerx_filter devicerx_filter;
+
+    /**
+     * File descriptor of a pollable device, -1 if the device is read by the
+     * device RX thread (see osd_gateway_set_device_fd())
+     */
+    int device_fd;
+
+    /** Read a packet from the pollable device without blocking */
+    packet_read_fn packet_read_nonblocking;
+
+    /**
+     * Number of traced requests waiting for their response from the device
+     * (updated by the I/O thread)
+     *
+     * The device RX thread only takes timestamps while requests are traced.
+     */
+    uint32_t latency_traces_pending;
 };
 
 struct hostiothread_usr_ctx {
@@ -65,362 +304,2410 @@ struct hostiothread_usr_ctx {
     /** ZeroMQ address/URL of the host controller */
     char *host_controller_address;
 
+    /** Shared-memory connection, if host_controller_address is a shm:// URL */
+    struct shm_client *shm_client;
+
+    /** Protocol version negotiated with the host controller */
+    int proto_version;
+
+    /** Sequence number of the next version 2 message */
+    uint32_t tx_seq;
+
+    /** Compress data to the host controller if it supports it? */
+    bool compress;
+
+    /** Is data to the host controller compressed on this connection? */
+    bool tx_compress;
+
     /** Write a packet to the device */
     packet_write_fn packet_write;
 
+    /** Write a stream of packets to the device, NULL if not supported */
+    packet_write_batch_fn packet_write_batch;
+
+    /**
+     * Packets to be written to the device with packet_write_batch, as a
+     * stream of DTDs (DEVICE_TX_BUF_WORDS)
+     */
+    uint16_t *tx_buf;
+
+    /** Number of words used in @p tx_buf */
+    size_t tx_buf_words;
+
+    /** Number of packets in @p tx_buf */
+    unsigned int tx_buf_packets;
+
+    /** Trace records of the traced requests in @p tx_buf */
+    struct latency_trace *tx_buf_traces[IO_BATCH_MAX];
+
+    /** Number of entries in @p tx_buf_traces */
+    unsigned int tx_buf_traces_len;
+
     /** Callback argument pointer (passed to the callbacks, internally unused)*/
     void *cb_arg;
 
     /**
-     * ZeroMQ PAIR socket, receiving data from the device RX thread, to be
-     * forwarded to the host controller
+     * ZeroMQ PAIR sockets, receiving data from the device RX thread, to be
+     * forwarded to the host controller (one per traffic class)
+     */
+    zsock_t *device_rx_socket[OSD_TCLASS_COUNT];
+
+    /** Traffic class scheduler for data from the device */
+    struct tclass_sched rx_sched;
+
+    /** Device RX batch (owned by struct osd_gateway_ctx) */
+    struct devicerx_batch *devicerx_batch;
+
+    /** ID of the timer flushing the device RX batch, -1 if not active */
+    int devicerx_flush_timer_id;
+
+    /**
+     * Batch (from the device RX thread or read from device_fd) which is not
+     * yet completely forwarded to the host controller (only while stalled),
+     * or NULL
+     */
+    struct devicerx_batch_ref *devicerx_batch_ref;
+
+    /** Offset of the next packet in @p devicerx_batch_ref */
+    size_t devicerx_batch_offset;
+
+    /** Device RX filter (owned by struct osd_gateway_ctx) */
+    struct devicerx_filter *devicerx_filter;
+
+    /** ID of the timer sending filter summaries, -1 if not active */
+    int devicerx_summary_timer_id;
+
+    /**
+     * File descriptor of a pollable device read in this thread, -1 if the
+     * device is read by the device RX thread
+     */
+    int device_fd;
+
+    /** Read a packet from device_fd without blocking */
+    packet_read_fn packet_read_nonblocking;
+
+    /**
+     * Read packets from device_fd without blocking, used instead of
+     * packet_read_nonblocking if set
+     */
+    packet_read_batch_fn packet_read_batch;
+
+    /** Buffers for packet_read_batch (owned by struct osd_gateway_ctx) */
+    struct bufpool *devicerx_read_pool;
+
+    /** Is device_fd registered in the zloop? */
+    bool device_fd_polled;
+
+    /**
+     * Bulk packets (struct osd_packet) read from device_fd while no credits
+     * were left, waiting to be forwarded to the host controller
+     */
+    zlist_t *device_fd_backlog;
+
+    /** Statistics: packets read from the device (owned by osd_gateway_ctx) */
+    uint64_t *stats_device_rx_packets;
+
+    /** Statistics: bytes read from the device (owned by osd_gateway_ctx) */
+    uint64_t *stats_device_rx_bytes;
+
+    /**
+     * Statistics: failed reads from the device (owned by osd_gateway_ctx)
+     */
+    uint64_t *stats_device_rx_errors;
+
+    /**
+     * Statistics: reads from the device which returned packets (owned by
+     * osd_gateway_ctx)
+     */
+    uint64_t *stats_device_rx_reads;
+
+    /**
+     * Data frames received from the host controller, waiting to be written
+     * to the device (one queue per traffic class)
+     */
+    zlist_t *tx_queue[OSD_TCLASS_COUNT];
+
+    /** Traffic class scheduler for data to the device */
+    struct tclass_sched tx_sched;
+
+    /**
+     * Addresses of the subnets connected to this gateway. The gateway
+     * registers with the host controller for all of them.
+     */
+    uint16_t device_subnet_addrs[OSD_DIADDR_SUBNET_MAX + 1];
+
+    /** Number of entries in @p device_subnet_addrs */
+    unsigned int device_subnet_count;
+
+    /** Flow control: credits granted to the host controller */
+    struct proto_credit_rx rx_credit;
+
+    /** Flow control: has the host controller granted us credits? */
+    bool tx_flowctrl;
+
+    /** Flow control: credits for data messages to the host controller */
+    uint32_t tx_credits;
+
+    /**
+     * Flow control: start of the current stall (us), 0 if not stalled
+     *
+     * While stalled no bulk data is read from @p device_rx_socket, which in
+     * turn blocks the device RX thread once the socket's high water mark is
+     * reached. Control messages are not subject to flow control.
+     */
+    int64_t tx_stall_start_us;
+
+    /** Flow control statistics (owned by struct osd_gateway_ctx) */
+    struct osd_flowctrl_stats *flowctrl_stats;
+
+    /** Statistics registry (owned by struct osd_gateway_ctx) */
+    struct stats_registry *stats;
+
+    /** Statistics: packets written to the device */
+    uint64_t *stats_device_tx_packets;
+
+    /** Statistics: bytes written to the device */
+    uint64_t *stats_device_tx_bytes;
+
+    /** Statistics: failed writes to the device */
+    uint64_t *stats_device_tx_errors;
+
+    /** Statistics: calls to packet_write or packet_write_batch */
+    uint64_t *stats_device_tx_writes;
+
+    /** Statistics: packets forwarded to the host controller */
+    uint64_t *stats_host_tx_packets;
+
+    /** Statistics: summaries of aggregated sources sent */
+    uint64_t *stats_host_tx_summaries;
+
+    /** Statistics: uncompressed bytes of compressed messages */
+    uint64_t *stats_host_compress_in_bytes;
+
+    /** Statistics: compressed bytes of compressed messages */
+    uint64_t *stats_host_compress_out_bytes;
+
+    /** Statistics: time spent compressing (ns) */
+    uint64_t *stats_host_compress_ns;
+
+    /** Statistics: packets written to the device in one go */
+    struct stats_hist *stats_device_tx_batch;
+
+    /** Stats endpoint socket, NULL if no endpoint is bound */
+    zsock_t *stats_socket;
+
+    /**
+     * Trace records of requests written to the device, waiting for the
+     * response (struct latency_trace), see latency_trace_key()
      */
-    zsock_t *device_rx_socket;
+    zhash_t *latency_traces;
 
-    /** Address of the subnet connected to this gateway */
-    uint16_t device_subnet_addr;
+    /** Number of entries in latency_traces (owned by osd_gateway_ctx) */
+    uint32_t *latency_traces_pending;
 };
 
 /**
- * Read data from the device encoded as Debug Transport Datagrams (DTDs)
+ * Pollable device passed to the I/O thread with I-ATTACH-DEVICE-FD
  */
-static void *devicerxthread_main(void *gateway_ctx_void)
+struct device_fd_attach {
+    int fd;
+    packet_read_fn packet_read_nonblocking;
+    packet_read_batch_fn packet_read_batch;
+    struct bufpool *read_pool;
+};
+
+static int forward_devicerx_to_hostctrl(zloop_t *loop, zsock_t *reader,
+                                        void *thread_ctx_void);
+static void hostiothread_forward_devicerx_batch(
+    struct worker_thread_ctx *thread_ctx);
+static void hostiothread_devicerx_batch_start(
+    struct hostiothread_usr_ctx *usrctx, void *data, size_t size,
+    zmq_free_fn *free_fn, void *hint);
+static void hostiothread_devicerx_batch_done(
+    struct hostiothread_usr_ctx *usrctx);
+static void hostiothread_forward_devicerx_msg(
+    struct worker_thread_ctx *thread_ctx, zmsg_t **msg,
+    enum osd_traffic_class tclass);
+static void hostiothread_forward_devicerx_packet(
+    struct worker_thread_ctx *thread_ctx, void *data, size_t size,
+    zmq_free_fn *free_fn, void *hint, uint64_t rx_time_ns,
+    enum osd_traffic_class tclass);
+static void hostiothread_poll_device_fd(struct worker_thread_ctx *thread_ctx,
+                                        bool enable);
+static osd_result hostiothread_set_rx_filter(
+    struct worker_thread_ctx *thread_ctx, const char *rules);
+static void hostiothread_handle_gw_filter(struct worker_thread_ctx *thread_ctx,
+                                          const zframe_t *body);
+
+/**
+ * Send data without copying it
+ *
+ * ZeroMQ takes ownership of @p data and calls @p free_fn(data, hint) once
+ * the message is sent, or right away if sending fails. The callback may run
+ * in any thread.
+ *
+ * @param flags ZMQ_SNDMORE and/or ZMQ_DONTWAIT
+ * @return 0 on success, -1 on failure
+ */
+static int send_zerocopy(zsock_t *sock, void *data, size_t size,
+                         zmq_free_fn *free_fn, void *hint, int flags)
 {
-    osd_result rv;
-    int zmq_rv;
-    struct osd_gateway_ctx *gateway_ctx = gateway_ctx_void;
-    assert(gateway_ctx);
+    zmq_msg_t msg;
+    int zmq_rv = zmq_msg_init_data(&msg, data, size, free_fn, hint);
+    assert(zmq_rv == 0);
+    if (zmq_msg_send(&msg, zsock_resolve(sock), flags) == -1) {
+        zmq_msg_close(&msg);
+        return -1;
+    }
+    return 0;
+}
 
-    while (1) {
-        struct osd_packet *rcv_packet = NULL;
-        rv = gateway_ctx->packet_read(&rcv_packet, gateway_ctx->cb_arg);
-        if (OSD_FAILED(rv)) {
-            if (rv == OSD_ERROR_NOT_CONNECTED) {
-                dbg(gateway_ctx->log_ctx,
-                    "Connection to device was "
-                    "terminated. Aborting read thread.");
-                return (void *)OSD_ERROR_NOT_CONNECTED;
-            } else {
-                err(gateway_ctx->log_ctx,
-                    "packet_read() failed with error "
-                    "%d. Trying again.",
-                    rv);
-                continue;
-            }
+/**
+ * Free a malloc()ed buffer handed over to ZeroMQ (zmq_free_fn)
+ */
+static void free_zerocopy(void *data, void *hint)
+{
+    free(data);
+}
+
+/**
+ * Free a packet handed over to ZeroMQ (zmq_free_fn)
+ */
+static void devicerx_packet_free(void *data, void *pkg_void)
+{
+    struct osd_packet *pkg = pkg_void;
+    osd_packet_free(&pkg);
+}
+
+/**
+ * Send a single packet read from the device to the I/O thread
+ *
+ * The message is "D", packet data[, RX time]. The packet data isn't copied:
+ * the packet is handed over to ZeroMQ and freed once the message is gone.
+ *
+ * @param pkg_p the packet, set to NULL
+ * @param rx_time_ns time the packet was read (ns), or 0 if not measured
+ */
+static void devicerx_send_packet(zsock_t *sock, struct osd_packet **pkg_p,
+                                 uint64_t rx_time_ns)
+{
+    struct osd_packet *pkg = *pkg_p;
+    *pkg_p = NULL;
+
+    if (zstr_sendm(sock, "D") != 0) {
+        osd_packet_free(&pkg);
+        return;
+    }
+    // once the first frame is queued the remaining ones are queued as well
+    int zmq_rv = send_zerocopy(sock, pkg->data_raw, osd_packet_sizeof(pkg),
+                               devicerx_packet_free, pkg,
+                               rx_time_ns ? ZMQ_SNDMORE : 0);
+    assert(zmq_rv == 0);
+    if (rx_time_ns) {
+        zframe_t *rx_time_frame = zframe_new(&rx_time_ns, sizeof(rx_time_ns));
+        assert(rx_time_frame);
+        zmq_rv = zframe_send(&rx_time_frame, sock, 0);
+        assert(zmq_rv == 0);
+    }
+}
+
+/**
+ * Get an empty buffer for the device RX batch
+ */
+static void devicerx_batch_new_buf(struct devicerx_batch *batch)
+{
+    bool allocated;
+    batch->buf = bufpool_get(batch->pool, &allocated);
+    if (allocated) {
+        stats_counter_add(batch->stats_buf_allocs, 1);
+    }
+    batch->len = 0;
+    batch->packets = 0;
+}
+
+/**
+ * Send the device RX batch to the I/O thread
+ *
+ * Call with batch->lock held.
+ *
+ * @param flags ZFRAME_DONTWAIT to give up instead of blocking if the I/O
+ *              thread doesn't keep up, 0 otherwise
+ * @return 0 if the batch was sent or is empty, -1 otherwise
+ */
+static int devicerx_batch_flush(struct devicerx_batch *batch, int flags)
+{
+    if (!batch->packets) {
+        return 0;
+    }
+    if (!batch->sock) {
+        return -1;
+    }
+
+    zframe_t *type_frame = zframe_new("B", 1);
+    assert(type_frame);
+    if (zframe_send(&type_frame, batch->sock, ZFRAME_MORE | flags) != 0) {
+        zframe_destroy(&type_frame);
+        return -1;
+    }
+    // once the first frame is queued the remaining ones are queued as well
+    int zmq_rv = send_zerocopy(batch->sock, batch->buf, batch->len,
+                               bufpool_put, batch->pool, 0);
+    assert(zmq_rv == 0);
+
+    stats_hist_record(batch->stats_batch, batch->packets);
+    devicerx_batch_new_buf(batch);
+    return 0;
+}
+
+static void devicerx_batch_unlock(void *batch_void)
+{
+    struct devicerx_batch *batch = batch_void;
+    pthread_mutex_unlock(&batch->lock);
+}
+
+/**
+ * Add a bulk packet read from the device to the device RX batch
+ *
+ * The first packet after a pause in the packet stream (no packet within the
+ * maximum batching delay) is forwarded right away, keeping the latency of
+ * sporadic packets low. A batch is only built while packets arrive in quick
+ * succession.
+ *
+ * Batched packets are copied into the batch and freed, packets forwarded
+ * right away are handed over without copying.
+ *
+ * @param pkg_p the packet, set to NULL
+ */
+static void devicerx_batch_add(struct devicerx_batch *batch,
+                               struct osd_packet **pkg_p)
+{
+    struct osd_packet *pkg = *pkg_p;
+    size_t pkg_size = sizeof(uint16_t) + osd_packet_sizeof(pkg);
+    uint64_t now_ns = latency_now_ns();
+
+    // the thread might be cancelled while waiting for the I/O thread
+    pthread_cleanup_push(devicerx_batch_unlock, batch);
+    pthread_mutex_lock(&batch->lock);
+
+    bool after_pause =
+        now_ns - batch->last_rx_ns >= batch->max_delay_ms * 1000000ULL;
+    batch->last_rx_ns = now_ns;
+
+    if (batch->len + pkg_size > batch->max_bytes) {
+        devicerx_batch_flush(batch, 0);
+    }
+    if ((after_pause && !batch->packets) || pkg_size > batch->max_bytes) {
+        devicerx_send_packet(batch->sock, pkg_p, 0);
+    } else {
+        memcpy(batch->buf + batch->len, &pkg->data_size_words,
+               sizeof(uint16_t));
+        memcpy(batch->buf + batch->len + sizeof(uint16_t), pkg->data_raw,
+               osd_packet_sizeof(pkg));
+        stats_counter_add(batch->stats_copy_bytes, osd_packet_sizeof(pkg));
+        batch->len += pkg_size;
+        batch->packets++;
+        if (batch->len == batch->max_bytes) {
+            devicerx_batch_flush(batch, 0);
         }
-        assert(rcv_packet);
+    }
+
+    pthread_cleanup_pop(1);
+    osd_packet_free(pkg_p);
+}
+
+/**
+ * Apply the device RX filter to a bulk packet
+ *
+ * @return true if the packet is forwarded, false if it is dropped
+ */
+static bool devicerx_filter_apply(struct devicerx_filter *rxf,
+                                  const struct osd_packet *pkg)
+{
+    if (!__atomic_load_n(&rxf->active, __ATOMIC_ACQUIRE)) {
+        return true;
+    }
+
+    enum rxfilter_verdict verdict = RXFILTER_PASS;
+    pthread_mutex_lock(&rxf->lock);
+    if (rxf->filter) {
+        verdict = rxfilter_apply(rxf->filter, pkg, latency_now_ns());
+    }
+    pthread_mutex_unlock(&rxf->lock);
+
+    if (verdict == RXFILTER_PASS) {
+        return true;
+    }
+    stats_counter_add(verdict == RXFILTER_DROP ? rxf->stats_filtered
+                                               : rxf->stats_aggregated,
+                      1);
+    return false;
+}
+
+/**
+ * Apply the device RX filter to a bulk packet, freeing dropped packets
+ *
+ * @return true if the packet is forwarded, false if it was dropped (and
+ *         freed)
+ */
+static bool devicerx_filter_pass(struct devicerx_filter *rxf,
+                                 struct osd_packet **pkg_p)
+{
+    if (devicerx_filter_apply(rxf, *pkg_p)) {
+        return true;
+    }
+    osd_packet_free(pkg_p);
+    return false;
+}
+
+/**
+ * Get an empty buffer for packet_read_batch
+ *
+ * @param stats_buf_allocs counter of buffers allocated because the pool was
+ *                         empty
+ */
+static uint16_t *devicerx_read_buf_get(struct bufpool *pool,
+                                       uint64_t *stats_buf_allocs)
+{
+    bool allocated;
+    uint16_t *buf = bufpool_get(pool, &allocated);
+    if (allocated) {
+        stats_counter_add(stats_buf_allocs, 1);
+    }
+    return buf;
+}
+
+/**
+ * Check the DTDs returned by packet_read_batch
+ *
+ * @return true if @p dtds consists of complete DTDs of valid packets
+ */
+static bool devicerx_read_valid(const uint16_t *dtds, size_t size_words)
+{
+    size_t pos = 0;
+    while (pos < size_words) {
+        if (dtds[pos] < 3 || dtds[pos] >= size_words - pos) {
+            return false;
+        }
+        pos += 1 + dtds[pos];
+    }
+    return true;
+}
+
+/**
+ * Forward a control packet read with packet_read_batch
+ *
+ * @param pkg_p the packet, set to NULL
+ * @param arg argument passed to devicerx_sort_read()
+ */
+typedef void (*devicerx_control_fn)(struct osd_packet **pkg_p, void *arg);
+
+/**
+ * Sort the packets read with packet_read_batch by traffic class
+ *
+ * All packets are counted and traced. Control packets are copied out of the
+ * buffer and passed to @p control_fn one by one. Bulk packets which pass the
+ * device RX filter are moved to the front of the buffer, to be forwarded
+ * together straight out of the buffer.
+ *
+ * @param dtds the packets read (checked with devicerx_read_valid())
+ * @param[in,out] size_words size of @p dtds in words, set to the size of the
+ *                           bulk packets left in @p dtds
+ * @return number of bulk packets left in @p dtds
+ */
+static unsigned int devicerx_sort_read(uint16_t *dtds, size_t *size_words,
+                                       struct devicerx_filter *rxf,
+                                       uint64_t *stats_rx_packets,
+                                       uint64_t *stats_rx_bytes,
+                                       devicerx_control_fn control_fn,
+                                       void *control_arg)
+{
+    size_t pos = 0;
+    size_t bulk_words = 0;
+    unsigned int packets = 0;
+    unsigned int bulk_packets = 0;
+    while (pos < *size_words) {
+        struct osd_packet *dtd = (struct osd_packet *)(dtds + pos);
+        size_t dtd_words = 1 + dtd->data_size_words;
+        pos += dtd_words;
+        packets++;
+
+        TRACE_PACKET_PKG(device_rx, dtd);
+        stats_counter_add(stats_rx_bytes, osd_packet_sizeof(dtd));
+
+        if (osd_packet_get_traffic_class(dtd) == OSD_TCLASS_CONTROL) {
+            struct osd_packet *pkg;
+            osd_result rv = osd_packet_new(&pkg, dtd->data_size_words);
+            assert(OSD_SUCCEEDED(rv));
+            memcpy(pkg->data_raw, dtd->data_raw, osd_packet_sizeof(dtd));
+            control_fn(&pkg, control_arg);
+            continue;
+        }
+        if (!devicerx_filter_apply(rxf, dtd)) {
+            continue;
+        }
+        if (dtds + bulk_words != (uint16_t *)dtd) {
+            memmove(dtds + bulk_words, dtd, dtd_words * sizeof(uint16_t));
+        }
+        bulk_words += dtd_words;
+        bulk_packets++;
+    }
+    stats_counter_add(stats_rx_packets, packets);
+    *size_words = bulk_words;
+    return bulk_packets;
+}
+
+/**
+ * Forward a control packet read with packet_read_batch to the I/O thread
+ * (devicerx_control_fn)
+ */
+static void devicerxthread_send_control(struct osd_packet **pkg_p,
+                                        void *gateway_ctx_void)
+{
+    struct osd_gateway_ctx *gateway_ctx = gateway_ctx_void;
+
+    uint64_t rx_time_ns = 0;
+    if (__atomic_load_n(&gateway_ctx->latency_traces_pending,
+                        __ATOMIC_RELAXED)) {
+        rx_time_ns = latency_now_ns();
+    }
+    devicerx_send_packet(gateway_ctx->device_rx_socket[OSD_TCLASS_CONTROL],
+                         pkg_p, rx_time_ns);
+}
+
+/**
+ * Send the bulk packets of a packet_read_batch buffer to the I/O thread
+ *
+ * The buffer is sent as batch "B" (see struct devicerx_batch) without
+ * copying, and returns to the pool once the last packet in it was sent to
+ * the host controller. The device RX thread continues with a new buffer.
+ */
+static void devicerxthread_send_read_buf(struct osd_gateway_ctx *gateway_ctx,
+                                         size_t size_words,
+                                         unsigned int packets)
+{
+    struct devicerx_batch *batch = &gateway_ctx->devicerx_batch;
+
+    // the thread might be cancelled while waiting for the I/O thread
+    pthread_cleanup_push(devicerx_batch_unlock, batch);
+    pthread_mutex_lock(&batch->lock);
+
+    zframe_t *type_frame = zframe_new("B", 1);
+    assert(type_frame);
+    if (zframe_send(&type_frame, batch->sock, ZFRAME_MORE) == 0) {
+        // once the first frame is queued the remaining ones are queued as
+        // well
+        uint16_t *buf = gateway_ctx->devicerx_read_buf;
+        gateway_ctx->devicerx_read_buf = NULL;
+        int zmq_rv = send_zerocopy(batch->sock, buf,
+                                   size_words * sizeof(uint16_t), bufpool_put,
+                                   gateway_ctx->devicerx_read_pool, 0);
+        assert(zmq_rv == 0);
+        stats_hist_record(batch->stats_batch, packets);
+        gateway_ctx->devicerx_read_buf = devicerx_read_buf_get(
+            gateway_ctx->devicerx_read_pool, batch->stats_buf_allocs);
+    } else {
+        zframe_destroy(&type_frame);
+    }
+
+    pthread_cleanup_pop(1);
+}
+
+/**
+ * Read data from a device with packet_read_batch
+ *
+ * Control packets are forwarded to the I/O thread one by one, the bulk
+ * packets of every read in one batch.
+ */
+static void *devicerxthread_main_batched(struct osd_gateway_ctx *gateway_ctx)
+{
+    osd_result rv;
+
+    while (1) {
+        size_t size_words = 0;
+        rv = gateway_ctx->packet_read_batch(gateway_ctx->devicerx_read_buf,
+                                            DEVICERX_READ_BUF_WORDS,
+                                            &size_words, gateway_ctx->cb_arg);
+        if (rv == OSD_ERROR_NOT_CONNECTED) {
+            dbg(gateway_ctx->log_ctx,
+                "Connection to device was "
+                "terminated. Aborting read thread.");
+            return (void *)OSD_ERROR_NOT_CONNECTED;
+        } else if (OSD_FAILED(rv)) {
+            err(gateway_ctx->log_ctx,
+                "packet_read_batch() failed with error %d. Trying again.",
+                rv);
+            stats_counter_add(gateway_ctx->stats_device_rx_errors, 1);
+            continue;
+        }
+        assert(size_words <= DEVICERX_READ_BUF_WORDS);
+        if (!devicerx_read_valid(gateway_ctx->devicerx_read_buf,
+                                 size_words)) {
+            err(gateway_ctx->log_ctx,
+                "Dropping %zu words of malformed data read from the device.",
+                size_words);
+            stats_counter_add(gateway_ctx->stats_device_rx_errors, 1);
+            continue;
+        }
+        if (!size_words) {
+            continue;
+        }
+        stats_counter_add(gateway_ctx->stats_device_rx_reads, 1);
+
+        unsigned int bulk_packets = devicerx_sort_read(
+            gateway_ctx->devicerx_read_buf, &size_words,
+            &gateway_ctx->devicerx_filter,
+            gateway_ctx->stats_device_rx_packets,
+            gateway_ctx->stats_device_rx_bytes, devicerxthread_send_control,
+            gateway_ctx);
+        if (bulk_packets) {
+            devicerxthread_send_read_buf(gateway_ctx, size_words,
+                                         bulk_packets);
+        }
+    }
+
+    return (void *)OSD_OK;
+}
+
+/**
+ * Read data from the device encoded as Debug Transport Datagrams (DTDs)
+ *
+ * Control packets are forwarded to the I/O thread one by one, bulk packets
+ * in batches (see struct devicerx_batch).
+ */
+static void *devicerxthread_main(void *gateway_ctx_void)
+{
+    osd_result rv;
+    struct osd_gateway_ctx *gateway_ctx = gateway_ctx_void;
+    assert(gateway_ctx);
+
+    if (gateway_ctx->packet_read_batch) {
+        return devicerxthread_main_batched(gateway_ctx);
+    }
+
+    while (1) {
+        struct osd_packet *rcv_packet = NULL;
+        rv = gateway_ctx->packet_read(&rcv_packet, gateway_ctx->cb_arg);
+        if (OSD_FAILED(rv)) {
+            if (rv == OSD_ERROR_NOT_CONNECTED) {
+                dbg(gateway_ctx->log_ctx,
+                    "Connection to device was "
+                    "terminated. Aborting read thread.");
+                return (void *)OSD_ERROR_NOT_CONNECTED;
+            } else {
+                err(gateway_ctx->log_ctx,
+                    "packet_read() failed with error "
+                    "%d. Trying again.",
+                    rv);
+                stats_counter_add(gateway_ctx->stats_device_rx_errors, 1);
+                continue;
+            }
+        }
+        assert(rcv_packet);
+        TRACE_PACKET_PKG(device_rx, rcv_packet);
+        uint64_t rx_time_ns = 0;
+        if (__atomic_load_n(&gateway_ctx->latency_traces_pending,
+                            __ATOMIC_RELAXED)) {
+            rx_time_ns = latency_now_ns();
+        }
+        stats_counter_add(gateway_ctx->stats_device_rx_reads, 1);
+        stats_counter_add(gateway_ctx->stats_device_rx_packets, 1);
+        stats_counter_add(gateway_ctx->stats_device_rx_bytes,
+                          osd_packet_sizeof(rcv_packet));
+
+        // Only responses to register accesses (control packets) are traced,
+        // bulk packets can be batched without losing trace information.
+        enum osd_traffic_class tclass =
+            osd_packet_get_traffic_class(rcv_packet);
+        if (tclass == OSD_TCLASS_BULK &&
+            !devicerx_filter_pass(&gateway_ctx->devicerx_filter,
+                                  &rcv_packet)) {
+            continue;
+        }
+        if (tclass == OSD_TCLASS_BULK &&
+            gateway_ctx->devicerx_batch.max_bytes) {
+            devicerx_batch_add(&gateway_ctx->devicerx_batch, &rcv_packet);
+        } else {
+            devicerx_send_packet(gateway_ctx->device_rx_socket[tclass],
+                                 &rcv_packet, rx_time_ns);
+        }
+    }
+
+    return (void *)OSD_OK;
+}
+
+/**
+ * Get the key of a request in hostiothread_usr_ctx.latency_traces
+ *
+ * Register accesses from one host module to one debug module are
+ * serialized, the addresses therefore identify the request. A response has
+ * the addresses of its request swapped.
+ *
+ * @param data the DI packet
+ * @param size size of @p data (bytes)
+ * @param is_response is the packet a response?
+ * @param[out] key the key
+ */
+static void latency_trace_key(const void *data, size_t size, bool is_response,
+                              char key[10])
+{
+    uint16_t hdr[2];  // dest, src
+    assert(size >= sizeof(hdr));
+    memcpy(hdr, data, sizeof(hdr));
+
+    uint16_t req_src = is_response ? hdr[0] : hdr[1];
+    uint16_t req_dest = is_response ? hdr[1] : hdr[0];
+    snprintf(key, 10, "%04x%04x", req_src, req_dest);
+}
+
+static void latency_traces_update_pending(
+    struct hostiothread_usr_ctx *usrctx)
+{
+    __atomic_store_n(usrctx->latency_traces_pending,
+                     zhash_size(usrctx->latency_traces), __ATOMIC_RELAXED);
+}
+
+/**
+ * Remember the trace record of a request received from the host controller
+ */
+static void latency_trace_request(struct hostiothread_usr_ctx *usrctx,
+                                  zframe_t *data_frame, zframe_t *trace_frame)
+{
+    struct latency_trace *trace = malloc(sizeof(struct latency_trace));
+    assert(trace);
+    if (OSD_FAILED(latency_trace_from_frame(trace_frame, trace))) {
+        free(trace);
+        return;
+    }
+    latency_stamp(trace, LATENCY_STAGE_GATEWAY_RX);
+
+    char key[10];
+    latency_trace_key(zframe_data(data_frame), zframe_size(data_frame),
+                      false, key);
+    zhash_update(usrctx->latency_traces, key, trace);
+    zhash_freefn(usrctx->latency_traces, key, free);
+    latency_traces_update_pending(usrctx);
+}
+
+/**
+ * Flow control: grant credits to the host controller if needed
+ */
+static void hostiothread_grant_credits(struct worker_thread_ctx *thread_ctx)
+{
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    if (usrctx->proto_version != PROTO_VERSION_2) {
+        return;
+    }
+
+    uint32_t credits = proto_credit_rx_refill(&usrctx->rx_credit);
+    if (credits == 0) {
+        return;
+    }
+
+    zmsg_t *msg = proto_msg_new_u32(PROTO_OP_CREDIT, usrctx->tx_seq++, credits);
+    int zmq_rv = zmsg_send(&msg, usrctx->hostctrl_socket);
+    if (zmq_rv != 0) {
+        err(thread_ctx->log_ctx, "Unable to grant credits to host controller.");
+        zmsg_destroy(&msg);
+    }
+}
+
+/**
+ * Flow control: stop reading from the device until credits are available
+ */
+static void hostiothread_stall_devicerx(struct worker_thread_ctx *thread_ctx)
+{
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    if (usrctx->tx_stall_start_us) {
+        return;
+    }
+
+    zloop_reader_end(thread_ctx->zloop,
+                     usrctx->device_rx_socket[OSD_TCLASS_BULK]);
+    usrctx->tx_stall_start_us = zclock_usecs();
+    stats_counter_add(&usrctx->flowctrl_stats->tx_stalls, 1);
+}
+
+/**
+ * Flow control: continue reading from the device after a stall
+ */
+static void hostiothread_resume_devicerx(struct worker_thread_ctx *thread_ctx)
+{
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    if (!usrctx->tx_stall_start_us) {
+        return;
+    }
+
+    stats_counter_add(&usrctx->flowctrl_stats->tx_stall_time_us,
+                      zclock_usecs() - usrctx->tx_stall_start_us);
+    usrctx->tx_stall_start_us = 0;
+
+    // forward the rest of a batch or the backlog first, which might use up
+    // all credits
+    hostiothread_forward_devicerx_batch(thread_ctx);
+    struct osd_packet *pkg;
+    while (!usrctx->tx_stall_start_us &&
+           (pkg = zlist_pop(usrctx->device_fd_backlog))) {
+        hostiothread_forward_devicerx_packet(
+            thread_ctx, pkg->data_raw, osd_packet_sizeof(pkg),
+            devicerx_packet_free, pkg, 0, OSD_TCLASS_BULK);
+    }
+    if (usrctx->tx_stall_start_us) {
+        return;
+    }
+    hostiothread_poll_device_fd(thread_ctx, true);
+
+    zsock_t *sock = usrctx->device_rx_socket[OSD_TCLASS_BULK];
+    int zmq_rv = zloop_reader(thread_ctx->zloop, sock,
+                              forward_devicerx_to_hostctrl, thread_ctx);
+    assert(zmq_rv == 0);
+    zloop_reader_set_tolerant(thread_ctx->zloop, sock);
+}
+
+/**
+ * Flow control: the host controller granted us credits
+ */
+static void hostiothread_handle_credit(struct worker_thread_ctx *thread_ctx,
+                                       const zframe_t *body)
+{
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    uint32_t credits;
+    if (OSD_FAILED(proto_body_get_u32(body, &credits))) {
+        err(thread_ctx->log_ctx, "Ignoring malformed CREDIT message.");
+        return;
+    }
+
+    usrctx->tx_flowctrl = true;
+    usrctx->tx_credits += credits;
+    stats_counter_add(&usrctx->flowctrl_stats->tx_credits, credits);
+
+    if (usrctx->tx_credits > 0) {
+        hostiothread_resume_devicerx(thread_ctx);
+    }
+}
+
+/**
+ * Sort a message received from the host controller into the TX queues
+ *
+ * Management messages are processed right away.
+ */
+static void hostiothread_queue_from_hostctrl(
+    struct worker_thread_ctx *thread_ctx, zmsg_t **msg_p)
+{
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    zmsg_t *msg = *msg_p;
+    zframe_t *type_frame = zmsg_first(msg);
+    assert(type_frame);
+
+    struct proto_hdr hdr;
+    bool is_v2 = OSD_SUCCEEDED(proto_hdr_parse(type_frame, &hdr));
+    if (is_v2 && hdr.opcode == PROTO_OP_CREDIT) {
+        hostiothread_handle_credit(thread_ctx, zmsg_next(msg));
+
+    } else if (is_v2 && hdr.opcode == PROTO_OP_GW_FILTER) {
+        hostiothread_handle_gw_filter(thread_ctx, zmsg_next(msg));
+
+    } else if (is_v2 && hdr.opcode != PROTO_OP_DATA) {
+        err(thread_ctx->log_ctx,
+            "Ignoring unexpected management message 0x%02x.", hdr.opcode);
+
+    } else if (is_v2 || zframe_streq(type_frame, "D")) {
+        zframe_t *type_frame_popped = zmsg_pop(msg);
+        zframe_destroy(&type_frame_popped);
+        zframe_t *data_frame = zmsg_pop(msg);
+        assert(data_frame);
+
+        if (is_v2 && (hdr.flags & PROTO_FLAG_TRACE)) {
+            latency_trace_request(usrctx, data_frame, zmsg_first(msg));
+        } else if (zhash_size(usrctx->latency_traces)) {
+            // an untraced request replaces a traced one with the same
+            // addresses, whose response never arrived
+            char key[10];
+            latency_trace_key(zframe_data(data_frame), zframe_size(data_frame),
+                              false, key);
+            zhash_delete(usrctx->latency_traces, key);
+            latency_traces_update_pending(usrctx);
+        }
+
+        enum osd_traffic_class tclass = tclass_from_frame(data_frame);
+        int zmq_rv = zlist_append(usrctx->tx_queue[tclass], data_frame);
+        assert(zmq_rv == 0);
+
+    } else if (zframe_streq(type_frame, "M")) {
+        assert(0 && "TODO: Handle incoming management messages.");
+
+    } else {
+        assert(0 && "Message of unknown type received.");
+    }
+
+    zmsg_destroy(msg_p);
+}
+
+/**
+ * Get the trace record of a request which is written to the device
+ *
+ * @return the trace record, or NULL if the request isn't traced
+ */
+static struct latency_trace *hostiothread_tx_trace(
+    struct hostiothread_usr_ctx *usrctx, zframe_t *data_frame)
+{
+    if (!zhash_size(usrctx->latency_traces)) {
+        return NULL;
+    }
+
+    char key[10];
+    latency_trace_key(zframe_data(data_frame), zframe_size(data_frame),
+                      false, key);
+    struct latency_trace *trace = zhash_lookup(usrctx->latency_traces, key);
+    if (trace && trace->ts_ns[LATENCY_STAGE_DEVICE_WRITE]) {
+        return NULL;  // stale record of an earlier request
+    }
+    return trace;
+}
+
+/**
+ * Log a failed write to the device
+ *
+ * @param packets number of packets which were not written
+ */
+static void hostiothread_device_write_failed(
+    struct worker_thread_ctx *thread_ctx, osd_result device_write_rv,
+    unsigned int packets)
+{
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    stats_counter_add(usrctx->stats_device_tx_errors, packets);
+    if (device_write_rv == OSD_ERROR_NOT_CONNECTED) {
+        err(thread_ctx->log_ctx, "Connection to device was terminated.");
+        // XXX: Handle this case, inform the host controller of the
+        // transmission error and disconnect?
+    } else {
+        err(thread_ctx->log_ctx,
+            "Device write failed (%d). %u packet(s) dropped.",
+            device_write_rv, packets);
+    }
+}
+
+/**
+ * Write a single data frame to the device with packet_write()
+ *
+ * The packet is passed to packet_write from the (otherwise unused) TX
+ * buffer, which has the layout of struct osd_packet.
+ *
+ * @return OSD_OK on success, any other value indicates an error
+ */
+static osd_result hostiothread_write_packet(
+    struct worker_thread_ctx *thread_ctx, zframe_t **data_frame,
+    struct latency_trace *trace)
+{
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    size_t pkg_size = zframe_size(*data_frame);
+    assert(pkg_size >= 3 * sizeof(uint16_t) &&
+           pkg_size <= UINT16_MAX * sizeof(uint16_t));
+    struct osd_packet *pkg = (struct osd_packet *)usrctx->tx_buf;
+    pkg->data_size_words = pkg_size / sizeof(uint16_t);
+    memcpy(pkg->data_raw, zframe_data(*data_frame), pkg_size);
+    zframe_destroy(data_frame);
+    TRACE_PACKET_PKG(gateway_tx, pkg);
+    if (trace) {
+        latency_stamp(trace, LATENCY_STAGE_DEVICE_WRITE);
+    }
+    osd_result device_write_rv = usrctx->packet_write(pkg, usrctx->cb_arg);
+    if (trace) {
+        latency_stamp(trace, LATENCY_STAGE_DEVICE_WRITE_DONE);
+    }
+    if (OSD_FAILED(device_write_rv)) {
+        hostiothread_device_write_failed(thread_ctx, device_write_rv, 1);
+        return device_write_rv;
+    }
+    stats_counter_add(usrctx->stats_device_tx_writes, 1);
+    stats_counter_add(usrctx->stats_device_tx_packets, 1);
+    stats_counter_add(usrctx->stats_device_tx_bytes, pkg_size);
+    return OSD_OK;
+}
+
+/**
+ * Write all packets collected in the TX buffer to the device in one go with
+ * packet_write_batch()
+ *
+ * @return OSD_OK on success, any other value indicates an error
+ */
+static osd_result hostiothread_write_tx_buf(
+    struct worker_thread_ctx *thread_ctx)
+{
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    if (!usrctx->tx_buf_packets) {
+        return OSD_OK;
+    }
+
+    for (unsigned int i = 0; i < usrctx->tx_buf_traces_len; i++) {
+        latency_stamp(usrctx->tx_buf_traces[i], LATENCY_STAGE_DEVICE_WRITE);
+    }
+    osd_result device_write_rv = usrctx->packet_write_batch(
+        usrctx->tx_buf, usrctx->tx_buf_words, usrctx->cb_arg);
+    for (unsigned int i = 0; i < usrctx->tx_buf_traces_len; i++) {
+        latency_stamp(usrctx->tx_buf_traces[i],
+                      LATENCY_STAGE_DEVICE_WRITE_DONE);
+    }
+
+    unsigned int packets = usrctx->tx_buf_packets;
+    size_t words = usrctx->tx_buf_words;
+    usrctx->tx_buf_words = 0;
+    usrctx->tx_buf_packets = 0;
+    usrctx->tx_buf_traces_len = 0;
+
+    if (OSD_FAILED(device_write_rv)) {
+        hostiothread_device_write_failed(thread_ctx, device_write_rv, packets);
+        return device_write_rv;
+    }
+    stats_counter_add(usrctx->stats_device_tx_writes, 1);
+    stats_counter_add(usrctx->stats_device_tx_packets, packets);
+    // the TX buffer contains one size word per packet
+    stats_counter_add(usrctx->stats_device_tx_bytes,
+                      (words - packets) * sizeof(uint16_t));
+    return OSD_OK;
+}
+
+/**
+ * Add a data frame to the TX buffer, writing the buffer to the device first
+ * if the frame doesn't fit
+ *
+ * @return OSD_OK on success, any other value indicates an error
+ */
+static osd_result hostiothread_tx_buf_add(struct worker_thread_ctx *thread_ctx,
+                                          zframe_t **data_frame,
+                                          struct latency_trace *trace)
+{
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    osd_result rv;
+    size_t size_words = zframe_size(*data_frame) / sizeof(uint16_t);
+    assert(size_words >= 3 && size_words <= UINT16_MAX);
+
+    if (usrctx->tx_buf_words + 1 + size_words > DEVICE_TX_BUF_WORDS ||
+        (trace && usrctx->tx_buf_traces_len == IO_BATCH_MAX)) {
+        rv = hostiothread_write_tx_buf(thread_ctx);
+        if (OSD_FAILED(rv)) {
+            zframe_destroy(data_frame);
+            return rv;
+        }
+    }
+
+    uint16_t *dtd = usrctx->tx_buf + usrctx->tx_buf_words;
+    dtd[0] = size_words;
+    memcpy(&dtd[1], zframe_data(*data_frame), size_words * sizeof(uint16_t));
+    TRACE_PACKET_PKG(gateway_tx, (struct osd_packet *)dtd);
+    zframe_destroy(data_frame);
+
+    usrctx->tx_buf_words += 1 + size_words;
+    usrctx->tx_buf_packets++;
+    if (trace) {
+        usrctx->tx_buf_traces[usrctx->tx_buf_traces_len++] = trace;
+    }
+    return OSD_OK;
+}
+
+/**
+ * Write all queued data frames to the device
+ *
+ * The traffic class scheduler decides which queue is served next. If the
+ * device supports it (packet_write_batch), all frames are written as one
+ * stream of DTDs, otherwise each frame is written on its own.
+ *
+ * @return 0 if all frames were written, -1 if writing to the device failed
+ */
+static int hostiothread_write_to_device(struct worker_thread_ctx *thread_ctx)
+{
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    osd_result rv;
+    int tclass;
+    uint64_t written = 0;
+    while ((tclass = tclass_sched_next(
+                &usrctx->tx_sched,
+                zlist_size(usrctx->tx_queue[OSD_TCLASS_CONTROL]) != 0,
+                zlist_size(usrctx->tx_queue[OSD_TCLASS_BULK]) != 0)) != -1) {
+        zframe_t *data_frame = zlist_pop(usrctx->tx_queue[tclass]);
+
+        // The packet is written to the device right away, the host
+        // controller can send the next one. Only bulk traffic is subject to
+        // flow control.
+        if (tclass == OSD_TCLASS_BULK) {
+            proto_credit_rx_use(&usrctx->rx_credit);
+            hostiothread_grant_credits(thread_ctx);
+        }
+
+        struct latency_trace *trace =
+            hostiothread_tx_trace(usrctx, data_frame);
+        if (usrctx->packet_write_batch) {
+            rv = hostiothread_tx_buf_add(thread_ctx, &data_frame, trace);
+        } else {
+            rv = hostiothread_write_packet(thread_ctx, &data_frame, trace);
+        }
+        if (OSD_FAILED(rv)) {
+            return -1;
+        }
+        written++;
+    }
+
+    if (OSD_FAILED(hostiothread_write_tx_buf(thread_ctx))) {
+        return -1;
+    }
+    if (written) {
+        stats_hist_record(usrctx->stats_device_tx_batch, written);
+    }
+    return 0;
+}
+
+/**
+ * Process incoming messages from the host controller
+ *
+ * All messages which are already waiting are received first (up to
+ * IO_BATCH_MAX) and then written to the device, scheduled by traffic class.
+ *
+ * @return 0 if the message was processed, -1 if @p loop should be terminated
+ */
+static int hostiothread_rcv_from_hostctrl(zloop_t *loop, zsock_t *reader,
+                                          void *thread_ctx_void)
+{
+    struct worker_thread_ctx *thread_ctx =
+        (struct worker_thread_ctx *)thread_ctx_void;
+    assert(thread_ctx);
+
+    for (int i = 0; i < IO_BATCH_MAX; i++) {
+        if (i > 0 && !(zsock_events(reader) & ZMQ_POLLIN)) {
+            break;
+        }
+
+        zmsg_t *msg = zmsg_recv(reader);
+        if (!msg) {
+            return -1;  // process was interrupted, terminate zloop
+        }
+        hostiothread_queue_from_hostctrl(thread_ctx, &msg);
+    }
+
+    return hostiothread_write_to_device(thread_ctx);
+}
+
+/**
+ * Send a command to the host controller
+ */
+static osd_result hostiothread_send_cmd(struct worker_thread_ctx *thread_ctx,
+                                        const char *command)
+{
+    int rv;
+
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+    zsock_t *sock = usrctx->hostctrl_socket;
+
+    // request
+    zmsg_t *msg_req = zmsg_new();
+    assert(msg_req);
+
+    rv = zmsg_addstr(msg_req, "M");
+    assert(rv == 0);
+    rv = zmsg_addstr(msg_req, command);
+    assert(rv == 0);
+    rv = zmsg_send(&msg_req, sock);
+    if (rv != 0) {
+        err(thread_ctx->log_ctx, "Unable to send %s request to host controller",
+            command);
+        return OSD_ERROR_FAILURE;
+    }
+
+    // response
+    errno = 0;
+    zmsg_t *msg_resp = zmsg_recv(sock);
+    if (!msg_resp) {
+        err(thread_ctx->log_ctx,
+            "No response received from host controller "
+            "at %s: %s (%d)",
+            usrctx->host_controller_address, strerror(errno), errno);
+        return OSD_ERROR_FAILURE;
+    }
+
+    zframe_t *type_frame = zmsg_pop(msg_resp);
+    assert(type_frame);
+    assert(zframe_streq(type_frame, "M"));
+    zframe_destroy(&type_frame);
+
+    zframe_t *status_frame = zmsg_pop(msg_resp);
+    assert(status_frame);
+    if (!zframe_streq(status_frame, "ACK")) {
+        char *status_str = zframe_strdup(status_frame);
+        err(thread_ctx->log_ctx,
+            "Received status %s as response to "
+            "%s when expecting 'ACK'.",
+            status_str, command);
+        free(status_str);
+
+        return OSD_ERROR_FAILURE;
+    }
+    zframe_destroy(&status_frame);
+
+    zmsg_destroy(&msg_resp);
+
+    return OSD_OK;
+}
+
+/**
+ * Send a command with a subnet parameter to the host controller
+ *
+ * The command is sent in the negotiated protocol version.
+ *
+ * @param opcode the command in protocol version 2
+ * @param command_str the command in protocol version 1
+ */
+static osd_result hostiothread_send_subnet_cmd(
+    struct worker_thread_ctx *thread_ctx, uint8_t opcode,
+    const char *command_str, uint16_t subnet)
+{
+    int rv;
+    osd_result osd_rv;
+
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    if (usrctx->proto_version == PROTO_VERSION_2) {
+        struct proto_hdr resp_hdr;
+        uint16_t subnet_le = htole16(subnet);
+        osd_rv = proto_request(usrctx->hostctrl_socket, thread_ctx->log_ctx,
+                               opcode, usrctx->tx_seq++, &subnet_le,
+                               sizeof(subnet_le), &resp_hdr, NULL);
+        if (OSD_FAILED(osd_rv)) {
+            return OSD_ERROR_FAILURE;
+        }
+        if (resp_hdr.opcode != PROTO_OP_ACK) {
+            err(thread_ctx->log_ctx,
+                "Received response 0x%02x to %s when expecting ACK.",
+                resp_hdr.opcode, command_str);
+            return OSD_ERROR_FAILURE;
+        }
+        return OSD_OK;
+    }
+
+    char *command;
+    rv = asprintf(&command, "%s %u", command_str, subnet);
+    assert(rv != -1);
+
+    osd_rv = hostiothread_send_cmd(thread_ctx, command);
+    free(command);
+    return osd_rv;
+}
+
+/**
+ * Unregister as gateway for the first @p count device subnets
+ *
+ * @return OSD_OK if all subnets were unregistered, the error of the last
+ *         failed request otherwise
+ */
+static osd_result hostiothread_unregister_gw_subnets(
+    struct worker_thread_ctx *thread_ctx, unsigned int count)
+{
+    osd_result osd_rv;
+    osd_result retval = OSD_OK;
+
+    assert(thread_ctx);
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    for (unsigned int i = 0; i < count; i++) {
+        uint16_t subnet = usrctx->device_subnet_addrs[i];
+        osd_rv = hostiothread_send_subnet_cmd(
+            thread_ctx, PROTO_OP_GW_UNREGISTER, "GW_UNREGISTER", subnet);
+        if (OSD_FAILED(osd_rv)) {
+            retval = osd_rv;
+            continue;
+        }
+
+        dbg(thread_ctx->log_ctx,
+            "Unregistered as gateway for subnet %u with "
+            "host controller.",
+            subnet);
+    }
+
+    return retval;
+}
+
+/**
+ * Register as gateway for all device subnets
+ *
+ * All subnets are registered over the same connection: the host controller
+ * serves them as one client.
+ */
+static osd_result hostiothread_register_gw(struct worker_thread_ctx *thread_ctx)
+{
+    osd_result osd_rv;
+
+    assert(thread_ctx);
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    for (unsigned int i = 0; i < usrctx->device_subnet_count; i++) {
+        uint16_t subnet = usrctx->device_subnet_addrs[i];
+        osd_rv = hostiothread_send_subnet_cmd(thread_ctx, PROTO_OP_GW_REGISTER,
+                                              "GW_REGISTER", subnet);
+        if (OSD_FAILED(osd_rv)) {
+            err(thread_ctx->log_ctx,
+                "Unable to register as gateway for subnet %u.", subnet);
+            hostiothread_unregister_gw_subnets(thread_ctx, i);
+            return osd_rv;
+        }
+
+        dbg(thread_ctx->log_ctx,
+            "Registered as gateway for subnet %u with "
+            "host controller.",
+            subnet);
+    }
+
+    return OSD_OK;
+}
+
+/**
+ * Unregister as gateway for all device subnets
+ */
+static osd_result hostiothread_unregister_gw(
+    struct worker_thread_ctx *thread_ctx)
+{
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    return hostiothread_unregister_gw_subnets(thread_ctx,
+                                              usrctx->device_subnet_count);
+}
+
+/**
+ * Add a device subnet (before connecting to the host controller)
+ */
+static osd_result hostiothread_add_subnet(struct worker_thread_ctx *thread_ctx,
+                                          uint16_t subnet)
+{
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    if (subnet > OSD_DIADDR_SUBNET_MAX) {
+        err(thread_ctx->log_ctx, "Invalid subnet %u.", subnet);
+        return OSD_ERROR_FAILURE;
+    }
+    for (unsigned int i = 0; i < usrctx->device_subnet_count; i++) {
+        if (usrctx->device_subnet_addrs[i] == subnet) {
+            err(thread_ctx->log_ctx, "Subnet %u was already added.", subnet);
+            return OSD_ERROR_FAILURE;
+        }
+    }
+
+    usrctx->device_subnet_addrs[usrctx->device_subnet_count++] = subnet;
+    return OSD_OK;
+}
+
+/**
+ * Negotiate the compression of data messages with the host controller
+ *
+ * Host controllers which don't support compression reject the request, data
+ * is sent uncompressed to them.
+ */
+static void hostiothread_negotiate_compression(
+    struct worker_thread_ctx *thread_ctx)
+{
+    osd_result osd_rv;
+
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    usrctx->tx_compress = false;
+    if (!usrctx->compress) {
+        return;
+    }
+    if (usrctx->proto_version != PROTO_VERSION_2) {
+        info(thread_ctx->log_ctx, "Host controller doesn't support "
+             "compression, sending data uncompressed.");
+        return;
+    }
+
+    struct proto_hdr resp_hdr;
+    uint16_t codec_le = htole16(WIRECOMP_CODEC_DELTA_LZ);
+    osd_rv = proto_request(usrctx->hostctrl_socket, thread_ctx->log_ctx,
+                           PROTO_OP_COMPRESS, usrctx->tx_seq++, &codec_le,
+                           sizeof(codec_le), &resp_hdr, NULL);
+    if (OSD_FAILED(osd_rv) || resp_hdr.opcode != PROTO_OP_ACK) {
+        info(thread_ctx->log_ctx, "Host controller doesn't support "
+             "compression, sending data uncompressed.");
+        return;
+    }
+
+    usrctx->tx_compress = true;
+    dbg(thread_ctx->log_ctx, "Compressing data to the host controller.");
+}
+
+/**
+ * Connect to the host controller in the I/O thread
+ *
+ * This function is called by the inprochelper as response to the I-CONNECT
+ * message. It creates a new DIALER ZeroMQ socket and uses it to connect to the
+ * host controller. After completion the function sends out a I-CONNECT-DONE
+ * message. The message value is -1 if the connection failed for any reason,
+ * or the DI address assigned to the host module if the connection was
+ * successfully established.
+ */
+static void hostiothread_connect_to_hostctrl(
+    struct worker_thread_ctx *thread_ctx)
+{
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    osd_result retval;
+    osd_result osd_rv;
+
+    // create new DIALER socket to connect with the host controller. A
+    // shared-memory connection is reached through an inproc endpoint.
+    const char *hostctrl_endpoint = usrctx->host_controller_address;
+    if (shm_is_url(usrctx->host_controller_address)) {
+        osd_rv = shm_client_new(&usrctx->shm_client, thread_ctx->log_ctx,
+                                usrctx->host_controller_address);
+        if (OSD_FAILED(osd_rv)) {
+            retval = -1;
+            goto free_return;
+        }
+        hostctrl_endpoint = shm_client_get_endpoint(usrctx->shm_client);
+    }
+    usrctx->hostctrl_socket = zsock_new_dealer(hostctrl_endpoint);
+    if (!usrctx->hostctrl_socket) {
+        err(thread_ctx->log_ctx, "Unable to connect to %s",
+            usrctx->host_controller_address);
+        retval = -1;
+        goto free_return;
+    }
+    zsock_set_rcvtimeo(usrctx->hostctrl_socket, ZMQ_RCV_TIMEOUT);
+
+    // Agree on a protocol version with the host controller
+    osd_rv = proto_negotiate(usrctx->hostctrl_socket, thread_ctx->log_ctx,
+                             &usrctx->proto_version);
+    if (OSD_FAILED(osd_rv)) {
+        retval = -1;
+        goto free_return;
+    }
+
+    // Register us as gateway for the device subnets
+    osd_rv = hostiothread_register_gw(thread_ctx);
+    if (OSD_FAILED(osd_rv)) {
+        retval = -1;
+        goto free_return;
+    }
+
+    hostiothread_negotiate_compression(thread_ctx);
+
+    // Allow the host controller to send data to us
+    usrctx->rx_credit.outstanding = 0;
+    usrctx->tx_flowctrl = false;
+    usrctx->tx_credits = 0;
+    hostiothread_grant_credits(thread_ctx);
+
+    // register handler for messages coming from the host controller
+    int zmq_rv;
+    zmq_rv = zloop_reader(thread_ctx->zloop, usrctx->hostctrl_socket,
+                          hostiothread_rcv_from_hostctrl, thread_ctx);
+    assert(zmq_rv == 0);
+    zloop_reader_set_tolerant(thread_ctx->zloop, usrctx->hostctrl_socket);
+
+    retval = 0;
+free_return:
+    if (retval == -1) {
+        zsock_destroy(&usrctx->hostctrl_socket);
+        shm_client_free(&usrctx->shm_client);
+    }
+    worker_send_status(thread_ctx->inproc_socket, "I-CONNECT-DONE", retval);
+}
+
+/**
+ * Disconnect from the host controller in the I/O thread
+ *
+ * This function is called when receiving a I-DISCONNECT message in the
+ * I/O thread. After the disconnect is done a I-DISCONNECT-DONE message is sent
+ * to the main thread.
+ */
+static void hostiothread_disconnect_from_hostctrl(
+    struct worker_thread_ctx *thread_ctx)
+{
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    osd_result retval;
+    osd_result osd_rv;
+
+    zloop_reader_end(thread_ctx->zloop, usrctx->hostctrl_socket);
+
+    // Unregister us as gateway for the device subnets
+    osd_rv = hostiothread_unregister_gw(thread_ctx);
+    if (OSD_FAILED(osd_rv)) {
+        err(thread_ctx->log_ctx,
+            "Unable to unregister as gateway, continuing "
+            "anyway.");
+    }
+
+    zsock_destroy(&usrctx->hostctrl_socket);
+    shm_client_free(&usrctx->shm_client);
+
+    // Credits are only valid for one connection. Packets of a batch which
+    // couldn't be forwarded are dropped.
+    hostiothread_devicerx_batch_done(usrctx);
+    hostiothread_resume_devicerx(thread_ctx);
+    if (usrctx->tx_flowctrl) {
+        stats_counter_add(&usrctx->flowctrl_stats->tx_credits,
+                          -(int64_t)usrctx->tx_credits);
+    }
+    usrctx->tx_flowctrl = false;
+    usrctx->tx_credits = 0;
+    usrctx->tx_compress = false;
+
+    retval = OSD_OK;
+
+    worker_send_status(thread_ctx->inproc_socket, "I-DISCONNECT-DONE", retval);
+}
+
+/**
+ * Change the traffic class scheduling in both directions
+ */
+static void hostiothread_set_tclass_weight(
+    struct worker_thread_ctx *thread_ctx, unsigned int control_weight)
+{
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    tclass_sched_init(&usrctx->rx_sched, control_weight);
+    tclass_sched_init(&usrctx->tx_sched, control_weight);
+}
+
+/**
+ * Forward a control packet read from a pollable device with
+ * packet_read_batch to the host controller (devicerx_control_fn)
+ */
+static void hostiothread_forward_device_fd_control(struct osd_packet **pkg_p,
+                                                   void *thread_ctx_void)
+{
+    struct worker_thread_ctx *thread_ctx = thread_ctx_void;
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    uint64_t rx_time_ns = 0;
+    if (zhash_size(usrctx->latency_traces)) {
+        rx_time_ns = latency_now_ns();
+    }
+    struct osd_packet *pkg = *pkg_p;
+    *pkg_p = NULL;
+    hostiothread_forward_devicerx_packet(
+        thread_ctx, pkg->data_raw, osd_packet_sizeof(pkg),
+        devicerx_packet_free, pkg, rx_time_ns, OSD_TCLASS_CONTROL);
+}
+
+/**
+ * Read packets from a pollable device with packet_read_batch
+ *
+ * Up to IO_BATCH_MAX reads are done. The bulk packets of a read are
+ * forwarded to the host controller as a batch, straight out of the read
+ * buffer. If the gateway runs out of credits before the batch is forwarded,
+ * the device isn't polled any more until credits arrive, see
+ * hostiothread_resume_devicerx().
+ */
+static void hostiothread_read_device_fd_batched(
+    struct worker_thread_ctx *thread_ctx)
+{
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    osd_result rv;
+    for (int i = 0; i < IO_BATCH_MAX; i++) {
+        if (usrctx->devicerx_batch_ref) {
+            hostiothread_poll_device_fd(thread_ctx, false);
+            break;
+        }
+
+        uint16_t *buf =
+            devicerx_read_buf_get(usrctx->devicerx_read_pool,
+                                  usrctx->devicerx_batch->stats_buf_allocs);
+        size_t size_words = 0;
+        rv = usrctx->packet_read_batch(buf, DEVICERX_READ_BUF_WORDS,
+                                       &size_words, usrctx->cb_arg);
+        if (rv == OSD_ERROR_NOT_CONNECTED) {
+            err(thread_ctx->log_ctx, "Connection to device was terminated.");
+            bufpool_put(buf, usrctx->devicerx_read_pool);
+            hostiothread_poll_device_fd(thread_ctx, false);
+            break;
+        } else if (OSD_FAILED(rv)) {
+            err(thread_ctx->log_ctx,
+                "packet_read_batch() failed with error %d.", rv);
+            stats_counter_add(usrctx->stats_device_rx_errors, 1);
+            bufpool_put(buf, usrctx->devicerx_read_pool);
+            break;
+        }
+        assert(size_words <= DEVICERX_READ_BUF_WORDS);
+        if (!devicerx_read_valid(buf, size_words)) {
+            err(thread_ctx->log_ctx,
+                "Dropping %zu words of malformed data read from the device.",
+                size_words);
+            stats_counter_add(usrctx->stats_device_rx_errors, 1);
+            bufpool_put(buf, usrctx->devicerx_read_pool);
+            break;
+        }
+        if (!size_words) {
+            bufpool_put(buf, usrctx->devicerx_read_pool);
+            break;  // no more packets available
+        }
+        stats_counter_add(usrctx->stats_device_rx_reads, 1);
+
+        unsigned int bulk_packets = devicerx_sort_read(
+            buf, &size_words, usrctx->devicerx_filter,
+            usrctx->stats_device_rx_packets, usrctx->stats_device_rx_bytes,
+            hostiothread_forward_device_fd_control, thread_ctx);
+        if (!bulk_packets) {
+            bufpool_put(buf, usrctx->devicerx_read_pool);
+            continue;
+        }
+        stats_hist_record(usrctx->devicerx_batch->stats_batch, bulk_packets);
+        hostiothread_devicerx_batch_start(usrctx, buf,
+                                          size_words * sizeof(uint16_t),
+                                          bufpool_put,
+                                          usrctx->devicerx_read_pool);
+        hostiothread_forward_devicerx_batch(thread_ctx);
+    }
+}
+
+/**
+ * Handler inside the I/O worker thread: read packets from a pollable device
+ *
+ * Called if device_fd is readable. Up to IO_BATCH_MAX packets are read and
+ * forwarded to the host controller directly, without copying the packet
+ * data. While the gateway waits for credits, bulk packets are kept in a
+ * backlog; once the backlog is full the device isn't polled any more.
+ */
+static int hostiothread_read_device_fd(zloop_t *loop, zmq_pollitem_t *item,
+                                       void *thread_ctx_void)
+{
+    struct worker_thread_ctx *thread_ctx = thread_ctx_void;
+    assert(thread_ctx);
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    if (usrctx->packet_read_batch) {
+        hostiothread_read_device_fd_batched(thread_ctx);
+        return 0;
+    }
+
+    osd_result rv;
+    for (int i = 0; i < IO_BATCH_MAX; i++) {
+        if (zlist_size(usrctx->device_fd_backlog) >= DEVICE_FD_BACKLOG_MAX) {
+            hostiothread_poll_device_fd(thread_ctx, false);
+            break;
+        }
+
+        struct osd_packet *pkg = NULL;
+        rv = usrctx->packet_read_nonblocking(&pkg, usrctx->cb_arg);
+        if (rv == OSD_ERROR_NOT_CONNECTED) {
+            err(thread_ctx->log_ctx, "Connection to device was terminated.");
+            hostiothread_poll_device_fd(thread_ctx, false);
+            break;
+        } else if (OSD_FAILED(rv)) {
+            err(thread_ctx->log_ctx, "packet_read() failed with error %d.",
+                rv);
+            stats_counter_add(usrctx->stats_device_rx_errors, 1);
+            break;
+        }
+        if (!pkg) {
+            break;  // no more packets available
+        }
+
+        TRACE_PACKET_PKG(device_rx, pkg);
+        uint64_t rx_time_ns = 0;
+        if (zhash_size(usrctx->latency_traces)) {
+            rx_time_ns = latency_now_ns();
+        }
+        stats_counter_add(usrctx->stats_device_rx_reads, 1);
+        stats_counter_add(usrctx->stats_device_rx_packets, 1);
+        stats_counter_add(usrctx->stats_device_rx_bytes,
+                          osd_packet_sizeof(pkg));
+
+        // bulk packets in the backlog aren't traced
+        enum osd_traffic_class tclass = osd_packet_get_traffic_class(pkg);
+        if (tclass == OSD_TCLASS_BULK &&
+            !devicerx_filter_pass(usrctx->devicerx_filter, &pkg)) {
+            continue;
+        }
+        if (tclass == OSD_TCLASS_BULK &&
+            (usrctx->tx_stall_start_us ||
+             zlist_size(usrctx->device_fd_backlog))) {
+            int zmq_rv = zlist_append(usrctx->device_fd_backlog, pkg);
+            assert(zmq_rv == 0);
+        } else {
+            hostiothread_forward_devicerx_packet(
+                thread_ctx, pkg->data_raw, osd_packet_sizeof(pkg),
+                devicerx_packet_free, pkg, rx_time_ns, tclass);
+        }
+    }
 
-        zmsg_t *msg;
-        msg = zmsg_new();
-        assert(msg);
-        zmq_rv = zmsg_addstr(msg, "D");
-        assert(zmq_rv == 0);
-        zmq_rv = zmsg_addmem(msg, rcv_packet->data_raw,
-                             osd_packet_sizeof(rcv_packet));
-        zmsg_send(&msg, gateway_ctx->device_rx_socket);
+    return 0;
+}
+
+/**
+ * Start or stop polling the pollable device (if one is attached)
+ */
+static void hostiothread_poll_device_fd(struct worker_thread_ctx *thread_ctx,
+                                        bool enable)
+{
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    if (usrctx->device_fd == -1 || usrctx->device_fd_polled == enable) {
+        return;
     }
 
-    return (void *)OSD_OK;
+    zmq_pollitem_t item = {NULL, usrctx->device_fd, ZMQ_POLLIN, 0};
+    if (enable) {
+        int zmq_rv = zloop_poller(thread_ctx->zloop, &item,
+                                  hostiothread_read_device_fd, thread_ctx);
+        assert(zmq_rv == 0);
+        zloop_poller_set_tolerant(thread_ctx->zloop, &item);
+    } else {
+        zloop_poller_end(thread_ctx->zloop, &item);
+    }
+    usrctx->device_fd_polled = enable;
 }
 
 /**
- * Process incoming messages from the host controller
+ * Attach a pollable device to the I/O thread
  *
- * @return 0 if the message was processed, -1 if @p loop should be terminated
+ * @param device_fd_frame struct device_fd_attach
  */
-static int hostiothread_rcv_from_hostctrl(zloop_t *loop, zsock_t *reader,
-                                          void *thread_ctx_void)
+static void hostiothread_attach_device_fd(struct worker_thread_ctx *thread_ctx,
+                                          zframe_t *device_fd_frame)
 {
-    struct worker_thread_ctx *thread_ctx =
-        (struct worker_thread_ctx *)thread_ctx_void;
-    assert(thread_ctx);
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    struct device_fd_attach attach;
+    assert(device_fd_frame && zframe_size(device_fd_frame) == sizeof(attach));
+    memcpy(&attach, zframe_data(device_fd_frame), sizeof(attach));
+
+    assert(usrctx->device_fd == -1);
+    usrctx->device_fd = attach.fd;
+    usrctx->packet_read_nonblocking = attach.packet_read_nonblocking;
+    usrctx->packet_read_batch = attach.packet_read_batch;
+    usrctx->devicerx_read_pool = attach.read_pool;
+    hostiothread_poll_device_fd(thread_ctx, true);
+}
 
+/**
+ * Detach the pollable device from the I/O thread
+ *
+ * Bulk packets in the backlog or in a batch which isn't forwarded yet are
+ * dropped.
+ */
+static void hostiothread_detach_device_fd(struct worker_thread_ctx *thread_ctx)
+{
     struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
     assert(usrctx);
 
-    int retval;
-    osd_result rv;
+    hostiothread_poll_device_fd(thread_ctx, false);
+    usrctx->device_fd = -1;
+    usrctx->packet_read_nonblocking = NULL;
+    usrctx->packet_read_batch = NULL;
+    usrctx->devicerx_read_pool = NULL;
+    hostiothread_devicerx_batch_done(usrctx);
 
-    zmsg_t *msg = zmsg_recv(reader);
-    if (!msg) {
-        return -1;  // process was interrupted, terminate zloop
+    struct osd_packet *pkg;
+    while ((pkg = zlist_pop(usrctx->device_fd_backlog))) {
+        osd_packet_free(&pkg);
     }
+}
 
-    zframe_t *type_frame = zmsg_first(msg);
-    assert(type_frame);
-    if (zframe_streq(type_frame, "D")) {
-        zframe_t *data_frame = zmsg_next(msg);
-        assert(data_frame);
+static osd_result hostiothread_handle_inproc_request(
+    struct worker_thread_ctx *thread_ctx, const char *name, zmsg_t *msg)
+{
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
 
-        struct osd_packet *pkg;
-        rv = osd_packet_new_from_zframe(&pkg, data_frame);
-        assert(OSD_SUCCEEDED(rv));
-        osd_result device_write_rv = usrctx->packet_write(pkg, usrctx->cb_arg);
-        free(pkg);
-        if (OSD_FAILED(device_write_rv)) {
-            if (device_write_rv == OSD_ERROR_NOT_CONNECTED) {
-                err(thread_ctx->log_ctx,
-                    "Connection to device was terminated.");
-                // XXX: Handle this case, inform the host controller of the
-                // transmission error and disconnect?
-            } else {
-                err(thread_ctx->log_ctx,
-                    "Device write failed (%d). Packet dropped.",
-                    device_write_rv);
-            }
-            retval = -1;
-            goto free_return;
-        }
+    if (!strcmp(name, "I-CONNECT")) {
+        hostiothread_connect_to_hostctrl(thread_ctx);
 
-    } else if (zframe_streq(type_frame, "M")) {
-        assert(0 && "TODO: Handle incoming management messages.");
+    } else if (!strcmp(name, "I-DISCONNECT")) {
+        hostiothread_disconnect_from_hostctrl(thread_ctx);
 
+    } else if (!strcmp(name, "I-SET-TCLASS-WEIGHT")) {
+        zframe_t *value_frame = zmsg_next(msg);
+        assert(value_frame && zframe_size(value_frame) == sizeof(int));
+        int weight;
+        memcpy(&weight, zframe_data(value_frame), sizeof(int));
+        hostiothread_set_tclass_weight(thread_ctx, weight);
+        worker_send_status(thread_ctx->inproc_socket,
+                           "I-SET-TCLASS-WEIGHT-DONE", OSD_OK);
+
+    } else if (!strcmp(name, "I-SET-PACKET-WRITE-BATCH")) {
+        zframe_t *value_frame = zmsg_next(msg);
+        assert(value_frame &&
+               zframe_size(value_frame) == sizeof(packet_write_batch_fn));
+        packet_write_batch_fn packet_write_batch;
+        memcpy(&packet_write_batch, zframe_data(value_frame),
+               sizeof(packet_write_batch_fn));
+        osd_result rv = OSD_OK;
+        if (packet_write_batch || usrctx->packet_write) {
+            usrctx->packet_write_batch = packet_write_batch;
+        } else {
+            err(thread_ctx->log_ctx,
+                "A batched gateway can't write single packets.");
+            rv = OSD_ERROR_FAILURE;
+        }
+        worker_send_status(thread_ctx->inproc_socket,
+                           "I-SET-PACKET-WRITE-BATCH-DONE", rv);
+
+    } else if (!strcmp(name, "I-SET-COMPRESSION")) {
+        zframe_t *value_frame = zmsg_next(msg);
+        assert(value_frame && zframe_size(value_frame) == sizeof(int));
+        int enable;
+        memcpy(&enable, zframe_data(value_frame), sizeof(int));
+        usrctx->compress = enable;
+        worker_send_status(thread_ctx->inproc_socket,
+                           "I-SET-COMPRESSION-DONE", OSD_OK);
+
+    } else if (!strcmp(name, "I-ADD-SUBNET")) {
+        zframe_t *value_frame = zmsg_next(msg);
+        assert(value_frame && zframe_size(value_frame) == sizeof(uint16_t));
+        uint16_t subnet;
+        memcpy(&subnet, zframe_data(value_frame), sizeof(uint16_t));
+        worker_send_status(thread_ctx->inproc_socket, "I-ADD-SUBNET-DONE",
+                           hostiothread_add_subnet(thread_ctx, subnet));
+
+    } else if (!strcmp(name, "I-ATTACH-DEVICE-FD")) {
+        hostiothread_attach_device_fd(thread_ctx, zmsg_next(msg));
+        worker_send_status(thread_ctx->inproc_socket,
+                           "I-ATTACH-DEVICE-FD-DONE", OSD_OK);
+
+    } else if (!strcmp(name, "I-DETACH-DEVICE-FD")) {
+        hostiothread_detach_device_fd(thread_ctx);
+        worker_send_status(thread_ctx->inproc_socket,
+                           "I-DETACH-DEVICE-FD-DONE", OSD_OK);
+
+    } else if (!strcmp(name, "I-SET-RX-FILTER")) {
+        char *rules = zframe_strdup(zmsg_next(msg));
+        worker_send_status(thread_ctx->inproc_socket, "I-SET-RX-FILTER-DONE",
+                           hostiothread_set_rx_filter(thread_ctx, rules));
+        free(rules);
+
+    } else if (!strcmp(name, "I-SET-STATS-ENDPOINT")) {
+        char *endpoint = zframe_strdup(zmsg_next(msg));
+        osd_result rv = stats_endpoint_bind(thread_ctx->zloop, usrctx->stats,
+                                            endpoint, &usrctx->stats_socket);
+        if (OSD_FAILED(rv)) {
+            err(thread_ctx->log_ctx, "Unable to bind stats endpoint %s",
+                endpoint);
+        }
+        free(endpoint);
+        worker_send_status(thread_ctx->inproc_socket,
+                           "I-SET-STATS-ENDPOINT-DONE", rv);
+#if 0
+    } else if (!strcmp(name, "D")) {
+        // Forward data packet to the host controller
+        rv = zmsg_send(&msg, usrctx->hostctrl_socket);
+        assert(rv == 0);
+#endif
     } else {
-        assert(0 && "Message of unknown type received.");
+        assert(0 && "Received unknown message from main thread.");
     }
 
-    retval = 0;
-free_return:
     zmsg_destroy(&msg);
 
-    return retval;
+    return OSD_OK;
 }
 
 /**
- * Send a command to the host controller
+ * Account for packets forwarded to the host controller
+ *
+ * Every bulk packet uses one credit. Reading bulk data from the device
+ * stops once all credits are used up.
  */
-static osd_result hostiothread_send_cmd(struct worker_thread_ctx *thread_ctx,
-                                        const char *command)
+static void hostiothread_devicerx_sent(struct worker_thread_ctx *thread_ctx,
+                                       enum osd_traffic_class tclass,
+                                       uint32_t packets)
 {
-    int rv;
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    stats_counter_add(usrctx->stats_host_tx_packets, packets);
+
+    if (usrctx->tx_flowctrl && tclass == OSD_TCLASS_BULK) {
+        usrctx->tx_credits -= packets;
+        stats_counter_add(&usrctx->flowctrl_stats->tx_credits,
+                          -(int64_t)packets);
+        if (usrctx->tx_credits == 0) {
+            hostiothread_stall_devicerx(thread_ctx);
+        }
+    }
+}
 
+/**
+ * Forward a packet read from the device to the host controller
+ *
+ * The packet data isn't copied: it is handed over to ZeroMQ, which calls
+ * @p free_fn(data, hint) once the message is sent.
+ *
+ * @param data the packet data
+ * @param size size of @p data (bytes)
+ * @param rx_time_ns time the packet was read from the device (ns), or 0 if
+ *                   not measured
+ */
+static void hostiothread_forward_devicerx_packet(
+    struct worker_thread_ctx *thread_ctx, void *data, size_t size,
+    zmq_free_fn *free_fn, void *hint, uint64_t rx_time_ns,
+    enum osd_traffic_class tclass)
+{
     struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
     assert(usrctx);
-    zsock_t *sock = usrctx->hostctrl_socket;
 
-    // request
-    zmsg_t *msg_req = zmsg_new();
-    assert(msg_req);
+    int zmq_rv;
 
-    rv = zmsg_addstr(msg_req, "M");
-    assert(rv == 0);
-    rv = zmsg_addstr(msg_req, command);
-    assert(rv == 0);
-    rv = zmsg_send(&msg_req, sock);
-    if (rv != 0) {
-        err(thread_ctx->log_ctx, "Unable to send %s request to host controller",
-            command);
-        return OSD_ERROR_FAILURE;
+    // attach the trace record of the request to its response
+    zframe_t *trace_frame = NULL;
+    if (rx_time_ns) {
+        char key[10];
+        latency_trace_key(data, size, true, key);
+        struct latency_trace *trace =
+            zhash_lookup(usrctx->latency_traces, key);
+        if (trace && trace->ts_ns[LATENCY_STAGE_DEVICE_WRITE]) {
+            trace->ts_ns[LATENCY_STAGE_DEVICE_RX] = rx_time_ns;
+            latency_stamp(trace, LATENCY_STAGE_GATEWAY_TX);
+            trace_frame = latency_trace_frame_new(trace);
+            zhash_delete(usrctx->latency_traces, key);
+            latency_traces_update_pending(usrctx);
+        }
     }
 
-    // response
-    errno = 0;
-    zmsg_t *msg_resp = zmsg_recv(sock);
-    if (!msg_resp) {
-        err(thread_ctx->log_ctx,
-            "No response received from host controller "
-            "at %s: %s (%d)",
-            usrctx->host_controller_address, strerror(errno), errno);
-        return OSD_ERROR_FAILURE;
+    // message to the host controller: header, packet data[, trace record]
+    zframe_t *hdr_frame;
+    if (usrctx->proto_version == PROTO_VERSION_2) {
+        hdr_frame = proto_hdr_frame_new(
+            PROTO_OP_DATA, trace_frame ? PROTO_FLAG_TRACE : 0,
+            usrctx->tx_seq++);
+    } else {
+        hdr_frame = zframe_new("D", 1);
+        assert(hdr_frame);
+        zframe_destroy(&trace_frame);
+    }
+    zmq_rv = zframe_send(&hdr_frame, usrctx->hostctrl_socket, ZFRAME_MORE);
+    assert(zmq_rv == 0);
+    zmq_rv = send_zerocopy(usrctx->hostctrl_socket, data, size, free_fn, hint,
+                           trace_frame ? ZMQ_SNDMORE : 0);
+    assert(zmq_rv == 0);
+    if (trace_frame) {
+        zmq_rv = zframe_send(&trace_frame, usrctx->hostctrl_socket, 0);
+        assert(zmq_rv == 0);
     }
 
-    zframe_t *type_frame = zmsg_pop(msg_resp);
-    assert(type_frame);
-    assert(zframe_streq(type_frame, "M"));
-    zframe_destroy(&type_frame);
+    hostiothread_devicerx_sent(thread_ctx, tclass, 1);
+}
 
-    zframe_t *status_frame = zmsg_pop(msg_resp);
-    assert(status_frame);
-    if (!zframe_streq(status_frame, "ACK")) {
-        char *status_str = zframe_strdup(status_frame);
-        err(thread_ctx->log_ctx,
-            "Received status %s as response to "
-            "%s when expecting 'ACK'.",
-            status_str, command);
-        free(status_str);
+/**
+ * Destroy a frame handed over to ZeroMQ (zmq_free_fn)
+ */
+static void devicerx_frame_free(void *data, void *frame_void)
+{
+    zframe_t *frame = frame_void;
+    zframe_destroy(&frame);
+}
 
-        return OSD_ERROR_FAILURE;
+/**
+ * Forward a message from the device RX thread to the host controller
+ *
+ * The message is "D", packet data[, RX time], see devicerx_send_packet().
+ */
+static void hostiothread_forward_devicerx_msg(
+    struct worker_thread_ctx *thread_ctx, zmsg_t **msg,
+    enum osd_traffic_class tclass)
+{
+    zframe_t *type_frame = zmsg_pop(*msg);
+    zframe_destroy(&type_frame);
+    zframe_t *data_frame = zmsg_pop(*msg);
+    assert(data_frame);
+
+    uint64_t rx_time_ns = 0;
+    zframe_t *rx_time_frame = zmsg_pop(*msg);
+    if (rx_time_frame && zframe_size(rx_time_frame) == sizeof(rx_time_ns)) {
+        memcpy(&rx_time_ns, zframe_data(rx_time_frame), sizeof(rx_time_ns));
     }
-    zframe_destroy(&status_frame);
+    zframe_destroy(&rx_time_frame);
+    zmsg_destroy(msg);
 
-    zmsg_destroy(&msg_resp);
+    hostiothread_forward_devicerx_packet(
+        thread_ctx, zframe_data(data_frame), zframe_size(data_frame),
+        devicerx_frame_free, data_frame, rx_time_ns, tclass);
+}
 
-    return OSD_OK;
+/**
+ * Drop a reference to a device RX batch (zmq_free_fn)
+ *
+ * Called by the I/O thread and by ZeroMQ for the messages referencing the
+ * batch, possibly at the same time.
+ */
+static void devicerx_batch_ref_put(void *data, void *ref_void)
+{
+    struct devicerx_batch_ref *ref = ref_void;
+    if (__atomic_sub_fetch(&ref->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        ref->free_fn(ref->data, ref->hint);
+        free(ref);
+    }
 }
 
 /**
- * Register as gateway for a subnet
+ * Start forwarding a batch
+ *
+ * @param data the packets as DTDs, freed with @p free_fn(data, hint) once
+ *             all packets are sent
+ * @param size size of @p data (bytes)
  */
-static osd_result hostiothread_register_gw(struct worker_thread_ctx *thread_ctx)
+static void hostiothread_devicerx_batch_start(
+    struct hostiothread_usr_ctx *usrctx, void *data, size_t size,
+    zmq_free_fn *free_fn, void *hint)
 {
-    int rv;
-    osd_result osd_rv;
+    assert(!usrctx->devicerx_batch_ref);
+
+    struct devicerx_batch_ref *ref = malloc(sizeof(struct devicerx_batch_ref));
+    assert(ref);
+    ref->data = data;
+    ref->size = size;
+    ref->free_fn = free_fn;
+    ref->hint = hint;
+    ref->refs = 1;
+
+    usrctx->devicerx_batch_ref = ref;
+    usrctx->devicerx_batch_offset = 0;
+}
 
-    assert(thread_ctx);
+/**
+ * Stop forwarding the current device RX batch
+ *
+ * The batch is freed once all messages referencing it are sent.
+ */
+static void hostiothread_devicerx_batch_done(
+    struct hostiothread_usr_ctx *usrctx)
+{
+    if (!usrctx->devicerx_batch_ref) {
+        return;
+    }
+    devicerx_batch_ref_put(NULL, usrctx->devicerx_batch_ref);
+    usrctx->devicerx_batch_ref = NULL;
+    usrctx->devicerx_batch_offset = 0;
+}
+
+/**
+ * Forward packets of a batch read from the device to the host controller in
+ * one compressed message
+ *
+ * All remaining packets of the batch are sent, or as many as the gateway has
+ * credits for. Every packet uses one credit.
+ */
+static void hostiothread_forward_devicerx_compressed(
+    struct worker_thread_ctx *thread_ctx)
+{
     struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
     assert(usrctx);
 
-    char *command;
-    rv = asprintf(&command, "GW_REGISTER %u", usrctx->device_subnet_addr);
-    assert(rv != -1);
+    int zmq_rv;
 
-    osd_rv = hostiothread_send_cmd(thread_ctx, command);
-    free(command);
-    if (OSD_FAILED(osd_rv)) {
-        return osd_rv;
+    struct devicerx_batch_ref *ref = usrctx->devicerx_batch_ref;
+    const uint16_t *dtds =
+        (const uint16_t *)(ref->data + usrctx->devicerx_batch_offset);
+    size_t batch_words =
+        (ref->size - usrctx->devicerx_batch_offset) / sizeof(uint16_t);
+
+    size_t size_words = 0;
+    uint32_t packets = 0;
+    while (size_words < batch_words &&
+           (!usrctx->tx_flowctrl || packets < usrctx->tx_credits)) {
+        size_words += 1 + dtds[size_words];
+        packets++;
+    }
+    assert(size_words <= batch_words);
+
+    uint64_t start_ns = latency_now_ns();
+    uint8_t *data = malloc(wirecomp_bound(size_words));
+    assert(data);
+    size_t size = wirecomp_encode(dtds, size_words, data);
+    stats_counter_add(usrctx->stats_host_compress_ns,
+                      latency_now_ns() - start_ns);
+    stats_counter_add(usrctx->stats_host_compress_in_bytes,
+                      size_words * sizeof(uint16_t));
+    stats_counter_add(usrctx->stats_host_compress_out_bytes, size);
+
+    usrctx->devicerx_batch_offset += size_words * sizeof(uint16_t);
+    if (usrctx->devicerx_batch_offset == ref->size) {
+        hostiothread_devicerx_batch_done(usrctx);
     }
 
-    dbg(thread_ctx->log_ctx,
-        "Registered as gateway for subnet %u with "
-        "host controller.",
-        usrctx->device_subnet_addr);
+    zframe_t *hdr_frame =
+        proto_hdr_frame_new(PROTO_OP_DATA_COMPRESSED, 0, usrctx->tx_seq++);
+    zmq_rv = zframe_send(&hdr_frame, usrctx->hostctrl_socket, ZFRAME_MORE);
+    assert(zmq_rv == 0);
+    zmq_rv = send_zerocopy(usrctx->hostctrl_socket, data, size,
+                           free_zerocopy, NULL, 0);
+    assert(zmq_rv == 0);
 
-    return OSD_OK;
+    hostiothread_devicerx_sent(thread_ctx, OSD_TCLASS_BULK, packets);
 }
 
 /**
- * Unregister as gateway for a subnet
+ * Forward the packets of a batch read from the device to the host controller
+ *
+ * The packets are forwarded until the batch is done or the gateway runs out
+ * of credits. In the latter case the rest of the batch is forwarded once
+ * credits arrive, see hostiothread_resume_devicerx().
+ *
+ * The packets are sent straight out of the batch without copying.
  */
-static osd_result hostiothread_unregister_gw(
+static void hostiothread_forward_devicerx_batch(
     struct worker_thread_ctx *thread_ctx)
 {
-    int rv;
-    osd_result osd_rv;
-
-    assert(thread_ctx);
     struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
     assert(usrctx);
 
-    char *command;
-    rv = asprintf(&command, "GW_UNREGISTER %u", usrctx->device_subnet_addr);
-    assert(rv != -1);
+    while (usrctx->devicerx_batch_ref && !usrctx->tx_stall_start_us) {
+        if (usrctx->tx_compress) {
+            hostiothread_forward_devicerx_compressed(thread_ctx);
+            continue;
+        }
 
-    osd_rv = hostiothread_send_cmd(thread_ctx, command);
-    free(command);
-    if (OSD_FAILED(osd_rv)) {
-        return osd_rv;
+        struct devicerx_batch_ref *ref = usrctx->devicerx_batch_ref;
+        uint8_t *data = ref->data + usrctx->devicerx_batch_offset;
+        uint16_t size_words;
+        memcpy(&size_words, data, sizeof(uint16_t));
+        size_t size = size_words * sizeof(uint16_t);
+        assert(usrctx->devicerx_batch_offset + sizeof(uint16_t) + size <=
+               ref->size);
+
+        usrctx->devicerx_batch_offset += sizeof(uint16_t) + size;
+        __atomic_add_fetch(&ref->refs, 1, __ATOMIC_RELAXED);
+        hostiothread_forward_devicerx_packet(
+            thread_ctx, data + sizeof(uint16_t), size, devicerx_batch_ref_put,
+            ref, 0, OSD_TCLASS_BULK);
+
+        if (usrctx->devicerx_batch_offset == ref->size) {
+            hostiothread_devicerx_batch_done(usrctx);
+        }
     }
-
-    dbg(thread_ctx->log_ctx,
-        "Unregistered as gateway for subnet %u with "
-        "host controller.",
-        usrctx->device_subnet_addr);
-
-    return OSD_OK;
 }
 
 /**
- * Connect to the host controller in the I/O thread
+ * Timer handler: send the device RX batch if the device RX thread didn't
  *
- * This function is called by the inprochelper as response to the I-CONNECT
- * message. It creates a new DIALER ZeroMQ socket and uses it to connect to the
- * host controller. After completion the function sends out a I-CONNECT-DONE
- * message. The message value is -1 if the connection failed for any reason,
- * or the DI address assigned to the host module if the connection was
- * successfully established.
+ * The timer stops once no packets were read from the device for the maximum
+ * batching delay. It is started again with the next bulk message from the
+ * device RX thread: the first packet after such a pause is never batched.
  */
-static void hostiothread_connect_to_hostctrl(
-    struct worker_thread_ctx *thread_ctx)
+static int hostiothread_flush_devicerx_batch(zloop_t *loop, int timer_id,
+                                             void *thread_ctx_void)
 {
+    struct worker_thread_ctx *thread_ctx = thread_ctx_void;
+    assert(thread_ctx);
     struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
     assert(usrctx);
+    struct devicerx_batch *batch = usrctx->devicerx_batch;
 
-    osd_result retval;
-    osd_result osd_rv;
+    // The device RX thread holds the lock while it waits for us to receive
+    // a full batch: don't block, but try again with the next tick.
+    if (pthread_mutex_trylock(&batch->lock) != 0) {
+        return 0;
+    }
+    bool idle = false;
+    if (batch->packets) {
+        devicerx_batch_flush(batch, ZFRAME_DONTWAIT);
+    } else {
+        idle = latency_now_ns() - batch->last_rx_ns >=
+               batch->max_delay_ms * 1000000ULL;
+    }
+    pthread_mutex_unlock(&batch->lock);
 
-    // create new DIALER socket to connect with the host controller
-    usrctx->hostctrl_socket = zsock_new_dealer(usrctx->host_controller_address);
-    if (!usrctx->hostctrl_socket) {
-        err(thread_ctx->log_ctx, "Unable to connect to %s",
-            usrctx->host_controller_address);
-        retval = -1;
-        goto free_return;
+    if (idle) {
+        zloop_timer_end(loop, timer_id);
+        usrctx->devicerx_flush_timer_id = -1;
     }
-    zsock_set_rcvtimeo(usrctx->hostctrl_socket, ZMQ_RCV_TIMEOUT);
+    return 0;
+}
 
-    // Register us as gateway for the device subnet
-    osd_rv = hostiothread_register_gw(thread_ctx);
-    if (OSD_FAILED(osd_rv)) {
-        retval = -1;
-        goto free_return;
+/**
+ * Start the timer flushing the device RX batch (if it isn't running yet)
+ */
+static void hostiothread_devicerx_flush_timer_start(
+    struct worker_thread_ctx *thread_ctx)
+{
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    if (usrctx->devicerx_flush_timer_id != -1 ||
+        !usrctx->devicerx_batch->max_bytes) {
+        return;
     }
+    usrctx->devicerx_flush_timer_id = zloop_timer(
+        thread_ctx->zloop, usrctx->devicerx_batch->max_delay_ms, 0,
+        hostiothread_flush_devicerx_batch, thread_ctx);
+    assert(usrctx->devicerx_flush_timer_id != -1);
+}
 
-    // register handler for messages coming from the host controller
-    int zmq_rv;
-    zmq_rv = zloop_reader(thread_ctx->zloop, usrctx->hostctrl_socket,
-                          hostiothread_rcv_from_hostctrl, thread_ctx);
-    assert(zmq_rv == 0);
-    zloop_reader_set_tolerant(thread_ctx->zloop, usrctx->hostctrl_socket);
+/**
+ * Send the summaries of aggregated sources to the host controller
+ *
+ * Summaries are bulk packets: they are only sent while credits are left.
+ * Summaries which can't be sent are created with a later call, with
+ * @p all they are dropped.
+ *
+ * @param filter the filter (locked by the caller)
+ * @param all send the summaries of all sources, even if their interval is
+ *            not over yet
+ */
+static void hostiothread_send_summaries(struct worker_thread_ctx *thread_ctx,
+                                        struct rxfilter *filter, bool all)
+{
+    struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
 
-    retval = 0;
-free_return:
-    if (retval == -1) {
-        zsock_destroy(&usrctx->hostctrl_socket);
+    if (!usrctx->hostctrl_socket) {
+        return;
     }
-    worker_send_status(thread_ctx->inproc_socket, "I-CONNECT-DONE", retval);
+
+    struct osd_packet *pkgs[IO_BATCH_MAX];
+    size_t count, max;
+    do {
+        max = IO_BATCH_MAX;
+        if (usrctx->tx_flowctrl && usrctx->tx_credits < max) {
+            max = usrctx->tx_credits;
+        }
+        if (max == 0) {
+            break;
+        }
+        count = rxfilter_flush(filter, latency_now_ns(), all, pkgs, max);
+        for (size_t i = 0; i < count; i++) {
+            hostiothread_forward_devicerx_packet(
+                thread_ctx, pkgs[i]->data_raw, osd_packet_sizeof(pkgs[i]),
+                devicerx_packet_free, pkgs[i], 0, OSD_TCLASS_BULK);
+        }
+        stats_counter_add(usrctx->stats_host_tx_summaries, count);
+    } while (count == max);
 }
 
 /**
- * Disconnect from the host controller in the I/O thread
- *
- * This function is called when receiving a I-DISCONNECT message in the
- * I/O thread. After the disconnect is done a I-DISCONNECT-DONE message is sent
- * to the main thread.
+ * Timer handler: send the summaries of aggregated sources
  */
-static void hostiothread_disconnect_from_hostctrl(
-    struct worker_thread_ctx *thread_ctx)
+static int hostiothread_devicerx_summary_timer(zloop_t *loop, int timer_id,
+                                               void *thread_ctx_void)
 {
+    struct worker_thread_ctx *thread_ctx = thread_ctx_void;
+    assert(thread_ctx);
     struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
     assert(usrctx);
+    struct devicerx_filter *rxf = usrctx->devicerx_filter;
 
-    osd_result retval;
-    osd_result osd_rv;
-
-    zloop_reader_end(thread_ctx->zloop, usrctx->hostctrl_socket);
-
-    // Unregister us as gateway for the device subnet
-    osd_rv = hostiothread_unregister_gw(thread_ctx);
-    if (OSD_FAILED(osd_rv)) {
-        err(thread_ctx->log_ctx,
-            "Unable to unregister as gateway, continuing "
-            "anyway.");
+    pthread_mutex_lock(&rxf->lock);
+    if (rxf->filter) {
+        hostiothread_send_summaries(thread_ctx, rxf->filter, false);
     }
-
-    zsock_destroy(&usrctx->hostctrl_socket);
-
-    retval = OSD_OK;
-
-    worker_send_status(thread_ctx->inproc_socket, "I-DISCONNECT-DONE", retval);
+    pthread_mutex_unlock(&rxf->lock);
+    return 0;
 }
 
-static osd_result hostiothread_handle_inproc_request(
-    struct worker_thread_ctx *thread_ctx, const char *name, zmsg_t *msg)
+/**
+ * Replace the device RX filter
+ *
+ * The pending summaries of the previous filter are sent right away.
+ *
+ * @param rules the filter rules (see osd_gateway_set_rx_filter())
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if the rules are invalid
+ */
+static osd_result hostiothread_set_rx_filter(
+    struct worker_thread_ctx *thread_ctx, const char *rules)
 {
     struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
     assert(usrctx);
+    struct devicerx_filter *rxf = usrctx->devicerx_filter;
 
-    if (!strcmp(name, "I-CONNECT")) {
-        hostiothread_connect_to_hostctrl(thread_ctx);
+    struct rxfilter *filter;
+    osd_result rv = rxfilter_new(&filter, rules);
+    if (OSD_FAILED(rv)) {
+        err(thread_ctx->log_ctx, "Invalid device RX filter rules '%s'.",
+            rules);
+        return rv;
+    }
+    if (!rxfilter_rules_count(filter)) {
+        rxfilter_free(&filter);
+    }
 
-    } else if (!strcmp(name, "I-DISCONNECT")) {
-        hostiothread_disconnect_from_hostctrl(thread_ctx);
-#if 0
-    } else if (!strcmp(name, "D")) {
-        // Forward data packet to the host controller
-        rv = zmsg_send(&msg, usrctx->hostctrl_socket);
-        assert(rv == 0);
-#endif
-    } else {
-        assert(0 && "Received unknown message from main thread.");
+    pthread_mutex_lock(&rxf->lock);
+    struct rxfilter *old_filter = rxf->filter;
+    rxf->filter = filter;
+    __atomic_store_n(&rxf->active, filter != NULL, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&rxf->lock);
+
+    if (old_filter) {
+        hostiothread_send_summaries(thread_ctx, old_filter, true);
+        rxfilter_free(&old_filter);
     }
 
-    zmsg_destroy(&msg);
+    bool aggregates = filter && rxfilter_aggregates(filter);
+    if (aggregates && usrctx->devicerx_summary_timer_id == -1) {
+        usrctx->devicerx_summary_timer_id =
+            zloop_timer(thread_ctx->zloop, DEVICERX_SUMMARY_TIMER_MS, 0,
+                        hostiothread_devicerx_summary_timer, thread_ctx);
+        assert(usrctx->devicerx_summary_timer_id != -1);
+    } else if (!aggregates && usrctx->devicerx_summary_timer_id != -1) {
+        zloop_timer_end(thread_ctx->zloop,
+                        usrctx->devicerx_summary_timer_id);
+        usrctx->devicerx_summary_timer_id = -1;
+    }
 
+    info(thread_ctx->log_ctx, "Device RX filter set to '%s'.", rules);
     return OSD_OK;
 }
 
 /**
- * Handler inside the I/O worker thread: forward a packet to the host controller
+ * Handle a filter request (PROTO_OP_GW_FILTER) from the host controller
+ *
+ * The filter applies to all subnets served by the gateway; the host
+ * controller only sends filter requests to gateways serving a single subnet.
+ * Invalid rules are logged, the request isn't answered.
+ */
+static void hostiothread_handle_gw_filter(struct worker_thread_ctx *thread_ctx,
+                                          const zframe_t *body)
+{
+    uint16_t subnet;
+    char *rules;
+    osd_result rv = proto_body_get_u16_str(body, &subnet, &rules);
+    if (OSD_FAILED(rv)) {
+        err(thread_ctx->log_ctx, "Ignoring malformed filter request.");
+        return;
+    }
+    dbg(thread_ctx->log_ctx, "Filter request for subnet %u: '%s'", subnet,
+        rules);
+    hostiothread_set_rx_filter(thread_ctx, rules);
+    free(rules);
+}
+
+/**
+ * Handler inside the I/O worker thread: forward packets to the host controller
+ *
+ * Called if data from the device is waiting in any of the traffic classes.
+ * Up to IO_BATCH_MAX waiting messages are forwarded, scheduled by traffic
+ * class. A batch of bulk packets counts as one message.
  */
 static int forward_devicerx_to_hostctrl(zloop_t *loop, zsock_t *reader,
                                         void *thread_ctx_void)
@@ -431,15 +2718,41 @@ static int forward_devicerx_to_hostctrl(zloop_t *loop, zsock_t *reader,
     struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
     assert(usrctx);
 
-    int zmq_rv;
+    zsock_t **socks = usrctx->device_rx_socket;
+    for (int i = 0; i < IO_BATCH_MAX; i++) {
+        bool control_ready =
+            zsock_events(socks[OSD_TCLASS_CONTROL]) & ZMQ_POLLIN;
+        bool bulk_ready = !usrctx->tx_stall_start_us &&
+                          (zsock_events(socks[OSD_TCLASS_BULK]) & ZMQ_POLLIN);
+        int tclass =
+            tclass_sched_next(&usrctx->rx_sched, control_ready, bulk_ready);
+        if (tclass == -1) {
+            break;
+        }
 
-    zmsg_t *msg = zmsg_recv(reader);
-    if (!msg) {
-        return -1;  // process was interrupted, terminate zloop
-    }
+        zmsg_t *msg = zmsg_recv(socks[tclass]);
+        if (!msg) {
+            return -1;  // process was interrupted, terminate zloop
+        }
+        if (tclass != OSD_TCLASS_BULK) {
+            hostiothread_forward_devicerx_msg(thread_ctx, &msg, tclass);
+            continue;
+        }
 
-    zmq_rv = zmsg_send(&msg, usrctx->hostctrl_socket);
-    assert(zmq_rv == 0);
+        hostiothread_devicerx_flush_timer_start(thread_ctx);
+        if (zframe_streq(zmsg_first(msg), "B")) {
+            zframe_t *batch_frame = zmsg_next(msg);
+            assert(batch_frame);
+            zmsg_remove(msg, batch_frame);
+            zmsg_destroy(&msg);
+            hostiothread_devicerx_batch_start(
+                usrctx, zframe_data(batch_frame), zframe_size(batch_frame),
+                devicerx_frame_free, batch_frame);
+            hostiothread_forward_devicerx_batch(thread_ctx);
+        } else {
+            hostiothread_forward_devicerx_msg(thread_ctx, &msg, tclass);
+        }
+    }
 
     return 0;
 }
@@ -452,13 +2765,33 @@ static osd_result hostiothread_init(struct worker_thread_ctx *thread_ctx)
 
     int zmq_rv;
 
-    usrctx->device_rx_socket = zsock_new_pair(">inproc://devicerx");
-    assert(usrctx->device_rx_socket);
+    for (int c = 0; c < OSD_TCLASS_COUNT; c++) {
+        usrctx->device_rx_socket[c] = zsock_new(ZMQ_PAIR);
+        assert(usrctx->device_rx_socket[c]);
+        zmq_rv = zsock_connect(usrctx->device_rx_socket[c], "%s",
+                               devicerx_endpoints[c]);
+        assert(zmq_rv == 0);
 
-    zmq_rv = zloop_reader(thread_ctx->zloop, usrctx->device_rx_socket,
-                          forward_devicerx_to_hostctrl, thread_ctx);
-    assert(zmq_rv == 0);
-    zloop_reader_set_tolerant(thread_ctx->zloop, usrctx->device_rx_socket);
+        zmq_rv = zloop_reader(thread_ctx->zloop, usrctx->device_rx_socket[c],
+                              forward_devicerx_to_hostctrl, thread_ctx);
+        assert(zmq_rv == 0);
+        zloop_reader_set_tolerant(thread_ctx->zloop,
+                                  usrctx->device_rx_socket[c]);
+
+        usrctx->tx_queue[c] = zlist_new();
+        assert(usrctx->tx_queue[c]);
+    }
+    usrctx->latency_traces = zhash_new();
+    assert(usrctx->latency_traces);
+    usrctx->devicerx_flush_timer_id = -1;
+    usrctx->devicerx_summary_timer_id = -1;
+    usrctx->device_fd = -1;
+    usrctx->device_fd_backlog = zlist_new();
+    assert(usrctx->device_fd_backlog);
+    usrctx->tx_buf = malloc(DEVICE_TX_BUF_WORDS * sizeof(uint16_t));
+    assert(usrctx->tx_buf);
+    tclass_sched_init(&usrctx->rx_sched, OSD_TCLASS_WEIGHT_STRICT);
+    tclass_sched_init(&usrctx->tx_sched, OSD_TCLASS_WEIGHT_STRICT);
 
     return OSD_OK;
 }
@@ -469,7 +2802,23 @@ static osd_result hostiothread_destroy(struct worker_thread_ctx *thread_ctx)
     struct hostiothread_usr_ctx *usrctx = thread_ctx->usr;
     assert(usrctx);
 
-    zsock_destroy(&usrctx->device_rx_socket);
+    stats_endpoint_close(thread_ctx->zloop, &usrctx->stats_socket);
+
+    for (int c = 0; c < OSD_TCLASS_COUNT; c++) {
+        zsock_destroy(&usrctx->device_rx_socket[c]);
+
+        zframe_t *data_frame;
+        while ((data_frame = zlist_pop(usrctx->tx_queue[c]))) {
+            zframe_destroy(&data_frame);
+        }
+        zlist_destroy(&usrctx->tx_queue[c]);
+    }
+    hostiothread_detach_device_fd(thread_ctx);
+    zlist_destroy(&usrctx->device_fd_backlog);
+    hostiothread_devicerx_batch_done(usrctx);
+    free(usrctx->tx_buf);
+    zhash_destroy(&usrctx->latency_traces);
+    __atomic_store_n(usrctx->latency_traces_pending, 0, __ATOMIC_RELAXED);
 
     free(usrctx->host_controller_address);
     free(usrctx);
@@ -478,14 +2827,20 @@ static osd_result hostiothread_destroy(struct worker_thread_ctx *thread_ctx)
     return OSD_OK;
 }
 
-API_EXPORT
-osd_result osd_gateway_new(struct osd_gateway_ctx **ctx,
-                           struct osd_log_ctx *log_ctx,
-                           const char *host_controller_address,
-                           uint16_t device_subnet_addr,
-                           packet_read_fn packet_read,
-                           packet_write_fn packet_write,
-                           void *cb_arg)
+/**
+ * Create a gateway accessing the device either one packet at a time
+ * (packet_read, packet_write) or in batches (packet_read_batch,
+ * packet_write_batch)
+ */
+static osd_result gateway_new(struct osd_gateway_ctx **ctx,
+                              struct osd_log_ctx *log_ctx,
+                              const char *host_controller_address,
+                              uint16_t device_subnet_addr,
+                              packet_read_fn packet_read,
+                              packet_write_fn packet_write,
+                              packet_read_batch_fn packet_read_batch,
+                              packet_write_batch_fn packet_write_batch,
+                              void *cb_arg)
 {
     osd_result rv;
 
@@ -496,7 +2851,9 @@ osd_result osd_gateway_new(struct osd_gateway_ctx **ctx,
     c->is_connected_to_hostctrl = false;
     c->is_connected_to_device = false;
     c->packet_read = packet_read;
+    c->packet_read_batch = packet_read_batch;
     c->cb_arg = cb_arg;
+    c->device_fd = -1;
 
     // prepare custom data passed to I/O thread for host communication
     struct hostiothread_usr_ctx *hostiothread_usr_data =
@@ -505,8 +2862,64 @@ osd_result osd_gateway_new(struct osd_gateway_ctx **ctx,
     hostiothread_usr_data->host_controller_address =
         strdup(host_controller_address);
     hostiothread_usr_data->packet_write = packet_write;
+    hostiothread_usr_data->packet_write_batch = packet_write_batch;
     hostiothread_usr_data->cb_arg = cb_arg;
-    hostiothread_usr_data->device_subnet_addr = device_subnet_addr;
+    hostiothread_usr_data->device_subnet_addrs[0] = device_subnet_addr;
+    hostiothread_usr_data->device_subnet_count = 1;
+    hostiothread_usr_data->flowctrl_stats = &c->flowctrl_stats;
+    hostiothread_usr_data->latency_traces_pending =
+        &c->latency_traces_pending;
+
+    int irv = pthread_mutex_init(&c->devicerx_batch.lock, NULL);
+    assert(irv == 0);
+    c->devicerx_batch.max_bytes = DEVICERX_BATCH_BYTES_DEFAULT;
+    c->devicerx_batch.max_delay_ms = DEVICERX_BATCH_DELAY_MS_DEFAULT;
+    hostiothread_usr_data->devicerx_batch = &c->devicerx_batch;
+
+    irv = pthread_mutex_init(&c->devicerx_filter.lock, NULL);
+    assert(irv == 0);
+    hostiothread_usr_data->devicerx_filter = &c->devicerx_filter;
+
+    c->stats = stats_new();
+    c->stats_device_rx_packets = stats_counter(c->stats, "device.rx_packets");
+    c->stats_device_rx_bytes = stats_counter(c->stats, "device.rx_bytes");
+    c->stats_device_rx_errors = stats_counter(c->stats, "device.rx_errors");
+    c->stats_device_rx_reads = stats_counter(c->stats, "device.rx_reads");
+    c->devicerx_batch.stats_batch = stats_hist(c->stats, "device.rx_batch");
+    c->devicerx_batch.stats_copy_bytes =
+        stats_counter(c->stats, "device.rx_copy_bytes");
+    c->devicerx_batch.stats_buf_allocs =
+        stats_counter(c->stats, "device.rx_buf_allocs");
+    c->devicerx_filter.stats_filtered =
+        stats_counter(c->stats, "device.rx_filtered");
+    c->devicerx_filter.stats_aggregated =
+        stats_counter(c->stats, "device.rx_aggregated");
+    hostiothread_usr_data->stats_device_rx_packets =
+        c->stats_device_rx_packets;
+    hostiothread_usr_data->stats_device_rx_bytes = c->stats_device_rx_bytes;
+    hostiothread_usr_data->stats_device_rx_errors = c->stats_device_rx_errors;
+    hostiothread_usr_data->stats_device_rx_reads = c->stats_device_rx_reads;
+    hostiothread_usr_data->stats = c->stats;
+    hostiothread_usr_data->stats_device_tx_packets =
+        stats_counter(c->stats, "device.tx_packets");
+    hostiothread_usr_data->stats_device_tx_bytes =
+        stats_counter(c->stats, "device.tx_bytes");
+    hostiothread_usr_data->stats_device_tx_errors =
+        stats_counter(c->stats, "device.tx_errors");
+    hostiothread_usr_data->stats_device_tx_writes =
+        stats_counter(c->stats, "device.tx_writes");
+    hostiothread_usr_data->stats_device_tx_batch =
+        stats_hist(c->stats, "device.tx_batch");
+    hostiothread_usr_data->stats_host_tx_packets =
+        stats_counter(c->stats, "host.tx_packets");
+    hostiothread_usr_data->stats_host_tx_summaries =
+        stats_counter(c->stats, "host.tx_summaries");
+    hostiothread_usr_data->stats_host_compress_in_bytes =
+        stats_counter(c->stats, "host.compress_in_bytes");
+    hostiothread_usr_data->stats_host_compress_out_bytes =
+        stats_counter(c->stats, "host.compress_out_bytes");
+    hostiothread_usr_data->stats_host_compress_ns =
+        stats_counter(c->stats, "host.compress_ns");
 
     rv = worker_new(&c->ioworker_ctx, log_ctx, hostiothread_init,
                     hostiothread_destroy, hostiothread_handle_inproc_request,
@@ -520,6 +2933,35 @@ osd_result osd_gateway_new(struct osd_gateway_ctx **ctx,
     return OSD_OK;
 }
 
+API_EXPORT
+osd_result osd_gateway_new(struct osd_gateway_ctx **ctx,
+                           struct osd_log_ctx *log_ctx,
+                           const char *host_controller_address,
+                           uint16_t device_subnet_addr,
+                           packet_read_fn packet_read,
+                           packet_write_fn packet_write,
+                           void *cb_arg)
+{
+    assert(packet_write);
+    return gateway_new(ctx, log_ctx, host_controller_address,
+                       device_subnet_addr, packet_read, packet_write, NULL,
+                       NULL, cb_arg);
+}
+
+API_EXPORT
+osd_result osd_gateway_new_batched(struct osd_gateway_ctx **ctx,
+                                   struct osd_log_ctx *log_ctx,
+                                   const char *host_controller_address,
+                                   uint16_t device_subnet_addr,
+                                   const struct osd_gateway_device_ops *ops,
+                                   void *cb_arg)
+{
+    assert(ops && ops->write_batch);
+    return gateway_new(ctx, log_ctx, host_controller_address,
+                       device_subnet_addr, NULL, NULL, ops->read_batch,
+                       ops->write_batch, cb_arg);
+}
+
 static osd_result connect_to_hostctrl(struct osd_gateway_ctx *ctx)
 {
     osd_result rv;
@@ -544,14 +2986,74 @@ static osd_result connect_to_hostctrl(struct osd_gateway_ctx *ctx)
     return OSD_OK;
 }
 
+/**
+ * Connect to a pollable device: read it in the I/O thread
+ */
+static osd_result connect_to_device_fd(struct osd_gateway_ctx *ctx)
+{
+    osd_result rv;
+
+    struct device_fd_attach attach = {
+        .fd = ctx->device_fd,
+        .packet_read_nonblocking = ctx->packet_read_nonblocking,
+    };
+    if (!ctx->packet_read_nonblocking) {
+        ctx->devicerx_read_pool =
+            bufpool_new(DEVICERX_READ_BUF_WORDS * sizeof(uint16_t),
+                        DEVICERX_READ_POOL_SIZE);
+        attach.packet_read_batch = ctx->packet_read_batch;
+        attach.read_pool = ctx->devicerx_read_pool;
+    }
+    worker_send_data(ctx->ioworker_ctx->inproc_socket, "I-ATTACH-DEVICE-FD",
+                     &attach, sizeof(attach));
+    int retval;
+    rv = worker_wait_for_status(ctx->ioworker_ctx->inproc_socket,
+                                "I-ATTACH-DEVICE-FD-DONE", &retval);
+    if (OSD_FAILED(rv) || OSD_FAILED(retval)) {
+        bufpool_free(&ctx->devicerx_read_pool);
+        return OSD_FAILED(rv) ? rv : retval;
+    }
+
+    ctx->is_connected_to_device = true;
+
+    return OSD_OK;
+}
+
 static osd_result connect_to_device(struct osd_gateway_ctx *ctx)
 {
     int irv;
 
+    if (ctx->device_fd != -1) {
+        return connect_to_device_fd(ctx);
+    }
+
     // prepare device RX thread to read data from the device and forward it to
-    // the I/O thread. Forwarding is done through a inproc socket.
-    ctx->device_rx_socket = zsock_new_pair("@inproc://devicerx");
-    assert(ctx->device_rx_socket);
+    // the I/O thread. Forwarding is done through inproc sockets, one per
+    // traffic class.
+    for (int c = 0; c < OSD_TCLASS_COUNT; c++) {
+        ctx->device_rx_socket[c] = zsock_new(ZMQ_PAIR);
+        assert(ctx->device_rx_socket[c]);
+        irv = zsock_bind(ctx->device_rx_socket[c], "%s", devicerx_endpoints[c]);
+        assert(irv == 0);
+    }
+
+    // batched devices forward the packets of a read without batching them
+    // again
+    struct devicerx_batch *batch = &ctx->devicerx_batch;
+    if (batch->max_bytes && !ctx->packet_read_batch) {
+        batch->pool = bufpool_new(batch->max_bytes, DEVICERX_BUF_POOL_SIZE);
+        devicerx_batch_new_buf(batch);
+    }
+    batch->last_rx_ns = 0;
+    batch->sock = ctx->device_rx_socket[OSD_TCLASS_BULK];
+
+    if (ctx->packet_read_batch) {
+        ctx->devicerx_read_pool =
+            bufpool_new(DEVICERX_READ_BUF_WORDS * sizeof(uint16_t),
+                        DEVICERX_READ_POOL_SIZE);
+        ctx->devicerx_read_buf = devicerx_read_buf_get(
+            ctx->devicerx_read_pool, batch->stats_buf_allocs);
+    }
 
     irv = pthread_create(&ctx->devicerxthread, NULL, devicerxthread_main,
                          (void *)ctx);
@@ -622,6 +3124,23 @@ static osd_result disconnect_from_device(struct osd_gateway_ctx *ctx)
         return OSD_OK;
     }
 
+    if (ctx->device_fd != -1) {
+        worker_send_status(ctx->ioworker_ctx->inproc_socket,
+                           "I-DETACH-DEVICE-FD", 0);
+        int retval;
+        osd_result rv = worker_wait_for_status(
+            ctx->ioworker_ctx->inproc_socket, "I-DETACH-DEVICE-FD-DONE",
+            &retval);
+        if (OSD_FAILED(rv)) {
+            return rv;
+        }
+        // batches still on their way to the host controller hold on to the
+        // pool until they are sent
+        bufpool_free(&ctx->devicerx_read_pool);
+        ctx->is_connected_to_device = false;
+        return OSD_OK;
+    }
+
     // end device RX thread and associated ZeroMQ socket
     pthread_cancel(ctx->devicerxthread);
     void *retval;
@@ -635,7 +3154,36 @@ static osd_result disconnect_from_device(struct osd_gateway_ctx *ctx)
             "connection was dropped.");
     }
 
-    zsock_destroy(&ctx->device_rx_socket);
+    // forward the packets still waiting in the batch if possible
+    struct devicerx_batch *batch = &ctx->devicerx_batch;
+    pthread_mutex_lock(&batch->lock);
+    if (devicerx_batch_flush(batch, ZFRAME_DONTWAIT) != 0) {
+        err(ctx->log_ctx, "Dropped %u packets read from the device.",
+            batch->packets);
+    }
+    batch->sock = NULL;
+    if (batch->pool) {
+        // batches still on their way to the host controller hold on to the
+        // pool until they are sent
+        bufpool_put(batch->buf, batch->pool);
+        bufpool_free(&batch->pool);
+    }
+    batch->buf = NULL;
+    batch->len = 0;
+    batch->packets = 0;
+    pthread_mutex_unlock(&batch->lock);
+
+    if (ctx->devicerx_read_pool) {
+        if (ctx->devicerx_read_buf) {
+            bufpool_put(ctx->devicerx_read_buf, ctx->devicerx_read_pool);
+            ctx->devicerx_read_buf = NULL;
+        }
+        bufpool_free(&ctx->devicerx_read_pool);
+    }
+
+    for (int c = 0; c < OSD_TCLASS_COUNT; c++) {
+        zsock_destroy(&ctx->device_rx_socket[c]);
+    }
 
     ctx->is_connected_to_device = false;
 
@@ -651,6 +3199,179 @@ osd_result osd_gateway_disconnect(struct osd_gateway_ctx *ctx)
     return OSD_OK;
 }
 
+API_EXPORT
+osd_result osd_gateway_set_tclass_weight(struct osd_gateway_ctx *ctx,
+                                         unsigned int control_weight)
+{
+    osd_result rv;
+    assert(ctx);
+
+    worker_send_status(ctx->ioworker_ctx->inproc_socket,
+                       "I-SET-TCLASS-WEIGHT", control_weight);
+    int retval;
+    rv = worker_wait_for_status(ctx->ioworker_ctx->inproc_socket,
+                                "I-SET-TCLASS-WEIGHT-DONE", &retval);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+    return retval;
+}
+
+API_EXPORT
+osd_result osd_gateway_set_device_fd(struct osd_gateway_ctx *ctx, int fd,
+                                     packet_read_fn packet_read_nonblocking)
+{
+    assert(ctx);
+    assert(fd == -1 || packet_read_nonblocking || ctx->packet_read_batch);
+
+    if (ctx->is_connected_to_device) {
+        err(ctx->log_ctx, "Set the device file descriptor before connecting.");
+        return OSD_ERROR_FAILURE;
+    }
+
+    ctx->device_fd = fd;
+    ctx->packet_read_nonblocking = packet_read_nonblocking;
+    return OSD_OK;
+}
+
+API_EXPORT
+osd_result osd_gateway_set_packet_write_batch(
+    struct osd_gateway_ctx *ctx, packet_write_batch_fn packet_write_batch)
+{
+    osd_result rv;
+    assert(ctx);
+
+    worker_send_data(ctx->ioworker_ctx->inproc_socket,
+                     "I-SET-PACKET-WRITE-BATCH", &packet_write_batch,
+                     sizeof(packet_write_batch));
+    int retval;
+    rv = worker_wait_for_status(ctx->ioworker_ctx->inproc_socket,
+                                "I-SET-PACKET-WRITE-BATCH-DONE", &retval);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+    return retval;
+}
+
+API_EXPORT
+osd_result osd_gateway_set_rx_batch(struct osd_gateway_ctx *ctx,
+                                    size_t max_bytes, unsigned int max_delay_ms)
+{
+    assert(ctx);
+    assert(max_delay_ms > 0);
+
+    if (ctx->is_connected_to_device) {
+        err(ctx->log_ctx, "Set the RX batching before connecting.");
+        return OSD_ERROR_FAILURE;
+    }
+
+    pthread_mutex_lock(&ctx->devicerx_batch.lock);
+    ctx->devicerx_batch.max_bytes = max_bytes;
+    ctx->devicerx_batch.max_delay_ms = max_delay_ms;
+    pthread_mutex_unlock(&ctx->devicerx_batch.lock);
+    return OSD_OK;
+}
+
+API_EXPORT
+osd_result osd_gateway_set_compression(struct osd_gateway_ctx *ctx,
+                                       bool enable)
+{
+    osd_result rv;
+    assert(ctx);
+
+    if (ctx->is_connected_to_hostctrl) {
+        err(ctx->log_ctx, "Set the compression before connecting.");
+        return OSD_ERROR_FAILURE;
+    }
+
+    int enable_int = enable;
+    worker_send_data(ctx->ioworker_ctx->inproc_socket, "I-SET-COMPRESSION",
+                     &enable_int, sizeof(enable_int));
+    int retval;
+    rv = worker_wait_for_status(ctx->ioworker_ctx->inproc_socket,
+                                "I-SET-COMPRESSION-DONE", &retval);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+    return retval;
+}
+
+API_EXPORT
+osd_result osd_gateway_set_rx_filter(struct osd_gateway_ctx *ctx,
+                                     const char *rules)
+{
+    osd_result rv;
+    assert(ctx);
+    assert(rules);
+
+    worker_send_data(ctx->ioworker_ctx->inproc_socket, "I-SET-RX-FILTER",
+                     rules, strlen(rules));
+    int retval;
+    rv = worker_wait_for_status(ctx->ioworker_ctx->inproc_socket,
+                                "I-SET-RX-FILTER-DONE", &retval);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+    return retval;
+}
+
+API_EXPORT
+osd_result osd_gateway_add_subnet(struct osd_gateway_ctx *ctx,
+                                  uint16_t subnet_addr)
+{
+    osd_result rv;
+    assert(ctx);
+
+    if (ctx->is_connected_to_hostctrl) {
+        err(ctx->log_ctx, "Add subnets before connecting.");
+        return OSD_ERROR_FAILURE;
+    }
+
+    worker_send_data(ctx->ioworker_ctx->inproc_socket, "I-ADD-SUBNET",
+                     &subnet_addr, sizeof(subnet_addr));
+    int retval;
+    rv = worker_wait_for_status(ctx->ioworker_ctx->inproc_socket,
+                                "I-ADD-SUBNET-DONE", &retval);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+    return retval;
+}
+
+API_EXPORT
+osd_result osd_gateway_set_stats_endpoint(struct osd_gateway_ctx *ctx,
+                                          const char *endpoint)
+{
+    osd_result rv;
+    assert(ctx);
+    assert(endpoint);
+
+    worker_send_data(ctx->ioworker_ctx->inproc_socket, "I-SET-STATS-ENDPOINT",
+                     endpoint, strlen(endpoint));
+    int retval;
+    rv = worker_wait_for_status(ctx->ioworker_ctx->inproc_socket,
+                                "I-SET-STATS-ENDPOINT-DONE", &retval);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+    return retval;
+}
+
+API_EXPORT
+void osd_gateway_get_flowctrl_stats(struct osd_gateway_ctx *ctx,
+                                    struct osd_flowctrl_stats *stats)
+{
+    assert(ctx);
+    assert(stats);
+    flowctrl_stats_get(&ctx->flowctrl_stats, stats);
+}
+
+struct stats_registry *gateway_get_stats(struct osd_gateway_ctx *ctx)
+{
+    assert(ctx);
+    return ctx->stats;
+}
+
 API_EXPORT
 void osd_gateway_free(struct osd_gateway_ctx **ctx_p)
 {
@@ -669,6 +3390,10 @@ void osd_gateway_free(struct osd_gateway_ctx **ctx_p)
     }
 
     worker_free(&ctx->ioworker_ctx);
+    stats_free(&ctx->stats);
+    pthread_mutex_destroy(&ctx->devicerx_batch.lock);
+    rxfilter_free(&ctx->devicerx_filter.filter);
+    pthread_mutex_destroy(&ctx->devicerx_filter.lock);
 
     free(ctx);
     *ctx_p = NULL;
@@ -16,12 +16,123 @@
 #include <osd/gateway.h>
 #include <osd/gateway_glip.h>
 #include "osd-private.h"
+#include "stats.h"
 
 #include <assert.h>
 #include <byteswap.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <string.h>
+#include <time.h>
+
+/**
+ * Packets read from all channels which wait to be read by the gateway
+ *
+ * Once the queue is full, the channel RX threads stop reading from the
+ * device, which passes the flow control of the gateway on to the device.
+ */
+#define CHANNEL_RX_QUEUE_MAX 1024
+
+/**
+ * Size of the transmit buffer of a channel (words)
+ *
+ * Large enough to hold the largest possible DTD.
+ */
+#define CHANNEL_TX_BUF_WORDS (64 * 1024 + 1)
+
+/** device_read(): only read the words which are available right away */
+#define DEVICE_READ_NONBLOCKING 1
+
+struct osd_gateway_glip_ctx;
+struct glip_device;
+
+/**
+ * A GLIP channel used in parallel to other channels
+ *
+ * Every channel has its own RX thread, which reads packets from the channel
+ * and queues them for the gateway, and its own TX thread, which writes the
+ * packets assigned to the channel.
+ */
+struct glip_channel {
+    /** Device the channel belongs to */
+    struct glip_device *dev;
+
+    /** GLIP channel number */
+    unsigned int index;
+
+    /** Thread reading from the channel */
+    pthread_t rxthread;
+
+    /** Thread writing to the channel */
+    pthread_t txthread;
+
+    /** Lock protecting the transmit buffer and tx_error */
+    pthread_mutex_t tx_lock;
+
+    /** Signalled when the transmit buffer was filled or emptied */
+    pthread_cond_t tx_cond;
+
+    /** DTDs waiting to be written to the channel */
+    uint16_t *tx_buf;
+
+    /** Number of words in @p tx_buf */
+    size_t tx_buf_words;
+
+    /** Number of DTDs in @p tx_buf */
+    size_t tx_buf_packets;
+
+    /** Buffer written by the TX thread while @p tx_buf is filled */
+    uint16_t *tx_buf_writing;
+
+    /** Error of the last write to the channel, returned to the gateway */
+    osd_result tx_error;
+
+    /** Statistics, each only updated by the RX or the TX thread */
+    uint64_t *stats_rx_packets;
+    uint64_t *stats_rx_bytes;
+    uint64_t *stats_tx_packets;
+    uint64_t *stats_tx_bytes;
+};
+
+/**
+ * A device (e.g. one FPGA board) connected through GLIP
+ */
+struct glip_device {
+    /** GLIP gateway the device belongs to */
+    struct osd_gateway_glip_ctx *gw_ctx;
+
+    /** Subnet address of the device */
+    uint16_t subnet;
+
+    /** GLIP context object */
+    struct glip_ctx *glip_ctx;
+
+    /** Number of GLIP channels used */
+    unsigned int channels_len;
+
+    /** Assignment of packets written to the device to channels */
+    enum osd_gateway_glip_stripe stripe;
+
+    /** Channels (only used if the device is accessed by channel threads) */
+    struct glip_channel *channels;
+
+    /** CPUs the channel threads run on */
+    cpu_set_t cpus;
+
+    /** Are the channel threads pinned to @p cpus? */
+    bool cpus_pinned;
+
+    /** No more packets are read from the device (protected by rx_lock) */
+    bool rx_closed;
+
+    /** CPU time of channel threads which have ended (ns) */
+    uint64_t cpu_ns_stopped;
+
+    /** Prefix of the names of the channel statistics */
+    char stats_prefix[32];
+};
 
 /**
  * GLIP gateway context
@@ -30,11 +141,55 @@ struct osd_gateway_glip_ctx {
     /** Logging context */
     struct osd_log_ctx *log_ctx;
 
-    /** GLIP context object */
-    struct glip_ctx *glip_ctx;
-
     /** OSD gateway context object */
     struct osd_gateway_ctx *gw_ctx;
+
+    /**
+     * Devices in the order they were added. The first device is the one
+     * passed to osd_gateway_glip_new().
+     */
+    struct glip_device *devices[OSD_DIADDR_SUBNET_MAX + 1];
+
+    /** Number of entries in @p devices */
+    unsigned int devices_len;
+
+    /** Devices by their subnet address (NULL if the subnet isn't served) */
+    struct glip_device *devices_by_subnet[OSD_DIADDR_SUBNET_MAX + 1];
+
+    /**
+     * The devices are accessed by channel threads. This is the case with
+     * more than one device or channel, or if the threads are pinned to CPUs;
+     * otherwise the gateway reads and writes the single device directly.
+     */
+    bool threaded;
+
+    /** The channel threads are running */
+    bool channels_running;
+
+    /** Lock protecting the RX queue */
+    pthread_mutex_t rx_lock;
+
+    /** Signalled when a packet was added to or taken from the RX queue */
+    pthread_cond_t rx_cond;
+
+    /** Packets read from all channels (struct osd_packet) */
+    zlist_t *rx_queue;
+
+    /** Number of devices packets are still read from */
+    unsigned int rx_devices_open;
+
+    /** All devices were closed, no more packets will be read */
+    bool rx_closed;
+
+    /**
+     * The size word of the next packet was read from the device already, but
+     * the packet didn't fit into the buffer of the last read (only used if
+     * the device isn't accessed by channel threads)
+     */
+    bool rx_size_pending;
+
+    /** Size of the next packet if @p rx_size_pending is set */
+    uint16_t rx_size;
 };
 
 /**
@@ -66,34 +221,40 @@ static void glip_log_handler(struct glip_ctx *ctx, int priority,
 /**
  * Read data from the device
  *
+ * @param channel the GLIP channel to read from
  * @param buf a preallocated buffer for the read data
  * @param size_words number of uint16_t words to read from the device
- * @param flags currently unused, set to 0
+ * @param flags DEVICE_READ_NONBLOCKING to read only the words which are
+ *              available right away (possibly none), 0 to wait for all
+ *              @p size_words words
  *
  * @return the number of uint16_t words read
  * @return -ENOTCONN if the connection was closed during the read
  * @return any other negative value indicates an error
  */
-static ssize_t device_read(struct glip_ctx *glip_ctx, uint16_t *buf,
-                           size_t size_words, int flags)
+static ssize_t device_read(struct glip_ctx *glip_ctx, uint32_t channel,
+                           uint16_t *buf, size_t size_words, int flags)
 {
     int rv;
     size_t words_read;
     size_t bytes_read;
 
-    uint16_t *buf_be;
-#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-    buf_be = malloc(size_words * sizeof(uint16_t));
-    if (!buf_be) {
-        return -1;
+    // read straight into the packet and convert from big endian in place
+    if (flags & DEVICE_READ_NONBLOCKING) {
+        rv = glip_read(glip_ctx, channel, size_words * sizeof(uint16_t),
+                       (uint8_t *)buf, &bytes_read);
+        if (rv == 0 && bytes_read % sizeof(uint16_t)) {
+            // the rest of a partially read word follows right away
+            size_t rest_read;
+            rv = glip_read_b(glip_ctx, channel, 1, (uint8_t *)buf + bytes_read,
+                             &rest_read, 0 /* timeout [ms]; 0 == never */);
+            bytes_read += rest_read;
+        }
+    } else {
+        rv = glip_read_b(glip_ctx, channel, size_words * sizeof(uint16_t),
+                         (uint8_t *)buf, &bytes_read,
+                         0 /* timeout [ms]; 0 == never */);
     }
-#else
-    buf_be = buf;
-#endif
-
-    rv = glip_read_b(glip_ctx, 0, size_words * sizeof(uint16_t),
-                     (uint8_t *)buf_be, &bytes_read,
-                     0 /* timeout [ms]; 0 == never */);
     if (rv == -ENOTCONN) {
         return rv;
     } else if (rv != 0) {
@@ -103,9 +264,8 @@ static ssize_t device_read(struct glip_ctx *glip_ctx, uint16_t *buf,
 
 #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
     for (size_t w = 0; w < words_read; w++) {
-        buf[w] = bswap_16(buf_be[w]);
+        buf[w] = bswap_16(buf[w]);
     }
-    free(buf_be);
 #endif
 
     return words_read;
@@ -114,6 +274,7 @@ static ssize_t device_read(struct glip_ctx *glip_ctx, uint16_t *buf,
 /**
  * Write to the device
  *
+ * @param channel the GLIP channel to write to
  * @param buf data to write
  * @param size_words size of @p buf in uint16_t words
  * @param flags currently unused, set to 0
@@ -122,8 +283,8 @@ static ssize_t device_read(struct glip_ctx *glip_ctx, uint16_t *buf,
  * @return -ENOTCONN if the device is not connected
  * @return any other negative value indicates an error
  */
-static ssize_t device_write(struct glip_ctx *glip_ctx, const uint16_t *buf,
-                            size_t size_words, int flags)
+static ssize_t device_write(struct glip_ctx *glip_ctx, uint32_t channel,
+                            const uint16_t *buf, size_t size_words, int flags)
 {
     size_t bytes_written;
     int rv;
@@ -144,7 +305,7 @@ static ssize_t device_write(struct glip_ctx *glip_ctx, const uint16_t *buf,
     buf_be = buf;
 #endif
 
-    rv = glip_write_b(glip_ctx, 0, size_words * sizeof(uint16_t),
+    rv = glip_write_b(glip_ctx, channel, size_words * sizeof(uint16_t),
                       (uint8_t *)buf_be, &bytes_written,
                       0 /* timeout [ms]; 0 == never */);
 
@@ -197,72 +358,658 @@ static struct glip_ctx* init_glip(struct osd_log_ctx *log_ctx,
     return glip_ctx;
 }
 
-static osd_result packet_read_from_device(struct osd_packet **pkg, void *cb_arg)
+static void unlock_mutex(void *mutex)
 {
-    osd_result rv;
-    ssize_t s_rv;
+    pthread_mutex_unlock(mutex);
+}
 
-    struct osd_gateway_glip_ctx *gw_ctx = cb_arg;
-    assert(gw_ctx);
+static void free_packet(void *pkg_p)
+{
+    osd_packet_free(pkg_p);
+}
+
+/**
+ * Read one packet from a channel
+ *
+ * @return OSD_OK on success,
+ *         OSD_ERROR_NOT_CONNECTED if the channel was closed,
+ *         OSD_ERROR_FAILURE if reading failed
+ */
+static osd_result channel_read_packet(struct glip_channel *ch,
+                                      struct osd_packet **pkg)
+{
+    struct osd_gateway_glip_ctx *gw_ctx = ch->dev->gw_ctx;
+    ssize_t s_rv;
 
-    // read packet size, which is transmitted as first word in a DTD
     uint16_t pkg_size_words;
-    s_rv = device_read(gw_ctx->glip_ctx, &pkg_size_words, 1, 0);
+    s_rv = device_read(ch->dev->glip_ctx, ch->index, &pkg_size_words, 1, 0);
     if (s_rv == -ENOTCONN) {
         return OSD_ERROR_NOT_CONNECTED;
     } else if (s_rv != 1) {
-        err(gw_ctx->log_ctx, "Unable to read packet length from device (%zd).",
+        err(gw_ctx->log_ctx,
+            "Unable to read packet length from channel %u (%zd).", ch->index,
             s_rv);
         return OSD_ERROR_FAILURE;
     }
 
-    rv = osd_packet_new(pkg, pkg_size_words);
+    osd_result rv = osd_packet_new(pkg, pkg_size_words);
     assert(OSD_SUCCEEDED(rv));
 
-    // read packet data
-    s_rv = device_read(gw_ctx->glip_ctx, (*pkg)->data_raw, pkg_size_words, 0);
+    s_rv = device_read(ch->dev->glip_ctx, ch->index, (*pkg)->data_raw,
+                       pkg_size_words, 0);
     if (s_rv == -ENOTCONN) {
         return OSD_ERROR_NOT_CONNECTED;
     } else if (s_rv != pkg_size_words) {
-        err(gw_ctx->log_ctx, "Unable to read packet data from device (%zd).",
+        err(gw_ctx->log_ctx,
+            "Unable to read packet data from channel %u (%zd).", ch->index,
             s_rv);
         return OSD_ERROR_FAILURE;
     }
+    return OSD_OK;
+}
+
+/**
+ * Channel RX thread: read packets from the channel and queue them
+ *
+ * The thread is stopped by cancelling it.
+ */
+static void *channel_rxthread_main(void *ch_void)
+{
+    struct glip_channel *ch = ch_void;
+    struct glip_device *dev = ch->dev;
+    struct osd_gateway_glip_ctx *gw_ctx = dev->gw_ctx;
+
+    bool closed = false;
+    while (!closed) {
+        struct osd_packet *pkg = NULL;
+        pthread_cleanup_push(free_packet, &pkg);
+
+        osd_result rv = channel_read_packet(ch, &pkg);
+        if (rv == OSD_ERROR_NOT_CONNECTED) {
+            dbg(gw_ctx->log_ctx, "Channel %u of subnet %u was closed.",
+                ch->index, dev->subnet);
+            // the other devices are still read after a device was closed
+            pthread_mutex_lock(&gw_ctx->rx_lock);
+            if (!dev->rx_closed) {
+                dev->rx_closed = true;
+                assert(gw_ctx->rx_devices_open > 0);
+                gw_ctx->rx_devices_open--;
+                if (gw_ctx->rx_devices_open == 0) {
+                    gw_ctx->rx_closed = true;
+                }
+            }
+            pthread_cond_broadcast(&gw_ctx->rx_cond);
+            pthread_mutex_unlock(&gw_ctx->rx_lock);
+            closed = true;
+        } else if (OSD_SUCCEEDED(rv)) {
+            stats_counter_add(ch->stats_rx_packets, 1);
+            stats_counter_add(ch->stats_rx_bytes, osd_packet_sizeof(pkg));
+
+            pthread_mutex_lock(&gw_ctx->rx_lock);
+            pthread_cleanup_push(unlock_mutex, &gw_ctx->rx_lock);
+            while (zlist_size(gw_ctx->rx_queue) >= CHANNEL_RX_QUEUE_MAX) {
+                pthread_cond_wait(&gw_ctx->rx_cond, &gw_ctx->rx_lock);
+            }
+            zlist_append(gw_ctx->rx_queue, pkg);
+            pkg = NULL;
+            pthread_cond_broadcast(&gw_ctx->rx_cond);
+            pthread_cleanup_pop(1);
+        }
+
+        // frees the packet if it wasn't queued
+        pthread_cleanup_pop(1);
+    }
+    return NULL;
+}
+
+/**
+ * Channel TX thread: write the transmit buffer to the channel
+ *
+ * The thread is stopped by cancelling it.
+ */
+static void *channel_txthread_main(void *ch_void)
+{
+    struct glip_channel *ch = ch_void;
+    struct osd_gateway_glip_ctx *gw_ctx = ch->dev->gw_ctx;
+
+    while (1) {
+        size_t words, packets;
+
+        pthread_mutex_lock(&ch->tx_lock);
+        pthread_cleanup_push(unlock_mutex, &ch->tx_lock);
+        while (!ch->tx_buf_words) {
+            pthread_cond_wait(&ch->tx_cond, &ch->tx_lock);
+        }
+        // write the buffer while the gateway fills the other one
+        uint16_t *buf = ch->tx_buf;
+        ch->tx_buf = ch->tx_buf_writing;
+        ch->tx_buf_writing = buf;
+        words = ch->tx_buf_words;
+        packets = ch->tx_buf_packets;
+        ch->tx_buf_words = 0;
+        ch->tx_buf_packets = 0;
+        pthread_cond_broadcast(&ch->tx_cond);
+        pthread_cleanup_pop(1);
+
+        ssize_t s_rv = device_write(ch->dev->glip_ctx, ch->index,
+                                    ch->tx_buf_writing, words, 0);
+        if (s_rv < 0 || (size_t)s_rv != words) {
+            err(gw_ctx->log_ctx,
+                "Write of %zu words to channel %u of subnet %u failed (%zd).",
+                words, ch->index, ch->dev->subnet, s_rv);
+            pthread_mutex_lock(&ch->tx_lock);
+            ch->tx_error = (s_rv == -ENOTCONN) ? OSD_ERROR_NOT_CONNECTED
+                                               : OSD_ERROR_FAILURE;
+            pthread_mutex_unlock(&ch->tx_lock);
+            continue;
+        }
+        stats_counter_add(ch->stats_tx_packets, packets);
+        // the buffer contains one size word per packet
+        stats_counter_add(ch->stats_tx_bytes,
+                          (words - packets) * sizeof(uint16_t));
+    }
+    return NULL;
+}
+
+/**
+ * Get the channel a packet is written to
+ *
+ * Packets are written to the device serving the subnet of their
+ * destination. All packets to one destination module (and, when striping by
+ * traffic class, of one traffic class) use the same channel, which keeps
+ * them in order.
+ *
+ * @return the channel, or NULL if no device serves the destination
+ */
+static struct glip_channel *channel_for_packet(
+    struct osd_gateway_glip_ctx *ctx, const struct osd_packet *pkg)
+{
+    uint16_t dest = osd_packet_get_dest(pkg);
+    struct glip_device *dev = ctx->devices_by_subnet[osd_diaddr_subnet(dest)];
+    if (!dev) {
+        return NULL;
+    }
+    unsigned int local_addr = osd_diaddr_localaddr(dest);
+
+    if (dev->stripe == OSD_GATEWAY_GLIP_STRIPE_TCLASS) {
+        // register accesses use channel 0 exclusively
+        if (osd_packet_get_traffic_class(pkg) == OSD_TCLASS_CONTROL) {
+            return &dev->channels[0];
+        }
+        return &dev->channels[1 + local_addr % (dev->channels_len - 1)];
+    }
+    return &dev->channels[local_addr % dev->channels_len];
+}
+
+/**
+ * Queue a DTD to be written to its channel
+ *
+ * Waits if the transmit buffer of the channel is full.
+ */
+static osd_result channel_queue_dtd(struct osd_gateway_glip_ctx *ctx,
+                                    const uint16_t *dtd)
+{
+    size_t dtd_words = 1 + dtd[0];
+    struct glip_channel *ch =
+        channel_for_packet(ctx, (const struct osd_packet *)dtd);
+    if (!ch) {
+        err(ctx->log_ctx, "No device serves the destination 0x%04x.",
+            osd_packet_get_dest((const struct osd_packet *)dtd));
+        return OSD_ERROR_FAILURE;
+    }
+
+    osd_result rv = OSD_OK;
+    pthread_mutex_lock(&ch->tx_lock);
+    while (ctx->channels_running && !ch->tx_error &&
+           ch->tx_buf_words + dtd_words > CHANNEL_TX_BUF_WORDS) {
+        pthread_cond_wait(&ch->tx_cond, &ch->tx_lock);
+    }
+    if (ch->tx_error) {
+        rv = ch->tx_error;
+        ch->tx_error = OSD_OK;
+    } else if (!ctx->channels_running) {
+        rv = OSD_ERROR_NOT_CONNECTED;
+    } else {
+        memcpy(ch->tx_buf + ch->tx_buf_words, dtd,
+               dtd_words * sizeof(uint16_t));
+        ch->tx_buf_words += dtd_words;
+        ch->tx_buf_packets++;
+        pthread_cond_broadcast(&ch->tx_cond);
+    }
+    pthread_mutex_unlock(&ch->tx_lock);
+    return rv;
+}
+
+/**
+ * Write DTDs to their channels
+ */
+static osd_result channels_write(struct osd_gateway_glip_ctx *ctx,
+                                 const uint16_t *dtds, size_t size_words)
+{
+    size_t pos = 0;
+    while (pos < size_words) {
+        osd_result rv = channel_queue_dtd(ctx, dtds + pos);
+        if (OSD_FAILED(rv)) {
+            return rv;
+        }
+        pos += 1 + dtds[pos];
+    }
+    return OSD_OK;
+}
+
+/**
+ * Read the packets queued by the channel RX threads
+ *
+ * Blocks until a packet is available, then takes as many packets from the
+ * queue as fit into @p dtds. Packets read from one channel are returned in
+ * order.
+ */
+static osd_result channels_read_batch(struct osd_gateway_glip_ctx *ctx,
+                                      uint16_t *dtds, size_t max_words,
+                                      size_t *size_words)
+{
+    osd_result rv = OSD_OK;
+    size_t pos = 0;
+
+    // the gateway cancels the thread reading from the device while it waits
+    pthread_mutex_lock(&ctx->rx_lock);
+    pthread_cleanup_push(unlock_mutex, &ctx->rx_lock);
+    while (!zlist_size(ctx->rx_queue) && !ctx->rx_closed) {
+        pthread_cond_wait(&ctx->rx_cond, &ctx->rx_lock);
+    }
+    struct osd_packet *pkg;
+    while ((pkg = zlist_first(ctx->rx_queue)) &&
+           pos + 1 + pkg->data_size_words <= max_words) {
+        zlist_pop(ctx->rx_queue);
+        // a packet has the layout of a DTD
+        memcpy(dtds + pos, pkg,
+               (1 + pkg->data_size_words) * sizeof(uint16_t));
+        pos += 1 + pkg->data_size_words;
+        osd_packet_free(&pkg);
+    }
+    if (pos) {
+        pthread_cond_broadcast(&ctx->rx_cond);
+    } else {
+        rv = OSD_ERROR_NOT_CONNECTED;
+    }
+    pthread_cleanup_pop(1);
 
+    *size_words = pos;
+    return rv;
+}
+
+/**
+ * Get the CPU time used by a thread so far (ns)
+ */
+static uint64_t thread_cpu_ns(pthread_t thread)
+{
+    clockid_t clock_id;
+    struct timespec ts;
+
+    if (pthread_getcpuclockid(thread, &clock_id) != 0 ||
+        clock_gettime(clock_id, &ts) != 0) {
+        return 0;
+    }
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Allocate the channels of a device
+ */
+static void channels_alloc(struct glip_device *dev)
+{
+    int irv;
+
+    if (dev->channels) {
+        return;
+    }
+
+    // the device counters of the gateway hold the aggregate
+    struct stats_registry *stats = gateway_get_stats(dev->gw_ctx->gw_ctx);
+    dev->channels = calloc(dev->channels_len, sizeof(struct glip_channel));
+    assert(dev->channels);
+    for (unsigned int i = 0; i < dev->channels_len; i++) {
+        struct glip_channel *ch = &dev->channels[i];
+        ch->dev = dev;
+        ch->index = i;
+        irv = pthread_mutex_init(&ch->tx_lock, NULL);
+        assert(irv == 0);
+        irv = pthread_cond_init(&ch->tx_cond, NULL);
+        assert(irv == 0);
+        ch->tx_buf = malloc(CHANNEL_TX_BUF_WORDS * sizeof(uint16_t));
+        assert(ch->tx_buf);
+        ch->tx_buf_writing = malloc(CHANNEL_TX_BUF_WORDS * sizeof(uint16_t));
+        assert(ch->tx_buf_writing);
+
+        ch->stats_rx_packets = stats_counter(stats, "%s.channel%u.rx_packets",
+                                             dev->stats_prefix, i);
+        ch->stats_rx_bytes = stats_counter(stats, "%s.channel%u.rx_bytes",
+                                           dev->stats_prefix, i);
+        ch->stats_tx_packets = stats_counter(stats, "%s.channel%u.tx_packets",
+                                             dev->stats_prefix, i);
+        ch->stats_tx_bytes = stats_counter(stats, "%s.channel%u.tx_bytes",
+                                           dev->stats_prefix, i);
+    }
+}
+
+static void channels_free(struct glip_device *dev)
+{
+    if (!dev->channels) {
+        return;
+    }
+    for (unsigned int i = 0; i < dev->channels_len; i++) {
+        struct glip_channel *ch = &dev->channels[i];
+        pthread_cond_destroy(&ch->tx_cond);
+        pthread_mutex_destroy(&ch->tx_lock);
+        free(ch->tx_buf);
+        free(ch->tx_buf_writing);
+    }
+    free(dev->channels);
+    dev->channels = NULL;
+}
+
+/**
+ * Start the RX and TX threads of the channels of all devices
+ *
+ * The threads of a device are pinned to the CPUs set with
+ * osd_gateway_glip_set_device_cpus().
+ */
+static osd_result channels_start(struct osd_gateway_glip_ctx *ctx)
+{
+    int irv;
+
+    ctx->rx_closed = false;
+    ctx->rx_devices_open = ctx->devices_len;
+    ctx->channels_running = true;
+    for (unsigned int d = 0; d < ctx->devices_len; d++) {
+        struct glip_device *dev = ctx->devices[d];
+        channels_alloc(dev);
+        dev->rx_closed = false;
+
+        pthread_attr_t attr;
+        irv = pthread_attr_init(&attr);
+        assert(irv == 0);
+        if (dev->cpus_pinned) {
+            irv = pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t),
+                                              &dev->cpus);
+            assert(irv == 0);
+        }
+        for (unsigned int i = 0; i < dev->channels_len; i++) {
+            struct glip_channel *ch = &dev->channels[i];
+            ch->tx_error = OSD_OK;
+            irv = pthread_create(&ch->rxthread, &attr, channel_rxthread_main,
+                                 ch);
+            assert(irv == 0);
+            irv = pthread_create(&ch->txthread, &attr, channel_txthread_main,
+                                 ch);
+            assert(irv == 0);
+        }
+        pthread_attr_destroy(&attr);
+    }
     return OSD_OK;
 }
 
-static osd_result packet_write_to_device(const struct osd_packet *pkg,
-                                         void *cb_arg)
+/**
+ * Stop the RX and TX threads of the channels of all devices
+ *
+ * Packets which were read but not yet passed to the gateway, and packets
+ * which were not yet written, are dropped.
+ */
+static void channels_stop(struct osd_gateway_glip_ctx *ctx)
+{
+    for (unsigned int d = 0; d < ctx->devices_len; d++) {
+        struct glip_device *dev = ctx->devices[d];
+        for (unsigned int i = 0; i < dev->channels_len; i++) {
+            struct glip_channel *ch = &dev->channels[i];
+            pthread_mutex_lock(&ch->tx_lock);
+            ctx->channels_running = false;
+            pthread_cond_broadcast(&ch->tx_cond);
+            pthread_mutex_unlock(&ch->tx_lock);
+
+            // the CPU clock of a thread is gone once it was joined
+            dev->cpu_ns_stopped +=
+                thread_cpu_ns(ch->rxthread) + thread_cpu_ns(ch->txthread);
+
+            pthread_cancel(ch->rxthread);
+            pthread_join(ch->rxthread, NULL);
+            pthread_cancel(ch->txthread);
+            pthread_join(ch->txthread, NULL);
+
+            ch->tx_buf_words = 0;
+            ch->tx_buf_packets = 0;
+        }
+    }
+
+    struct osd_packet *pkg;
+    while ((pkg = zlist_pop(ctx->rx_queue))) {
+        osd_packet_free(&pkg);
+    }
+}
+
+/**
+ * Read packets from the device (packet_read_batch_fn)
+ *
+ * Blocks until the first packet is read. The following packets are read as
+ * long as their size word is available right away and they fit into
+ * @p dtds; the rest of a packet follows its size word without delay.
+ */
+static osd_result packet_read_batch_from_device(uint16_t *dtds,
+                                                size_t max_words,
+                                                size_t *size_words,
+                                                void *cb_arg)
 {
     ssize_t s_rv;
 
     struct osd_gateway_glip_ctx *gw_ctx = cb_arg;
     assert(gw_ctx);
 
-#ifdef DEBUG
-    dbg(gw_ctx->log_ctx, "Gateway: Writing packet to device.");
-    osd_packet_log(pkg, gw_ctx->log_ctx);
-#endif
+    if (gw_ctx->threaded) {
+        return channels_read_batch(gw_ctx, dtds, max_words, size_words);
+    }
+    struct glip_ctx *glip_ctx = gw_ctx->devices[0]->glip_ctx;
+
+    size_t pos = 0;
+    while (1) {
+        // read packet size, which is transmitted as first word in a DTD
+        uint16_t pkg_size_words;
+        if (gw_ctx->rx_size_pending) {
+            pkg_size_words = gw_ctx->rx_size;
+            gw_ctx->rx_size_pending = false;
+        } else {
+            s_rv = device_read(glip_ctx, 0, &pkg_size_words, 1,
+                               pos ? DEVICE_READ_NONBLOCKING : 0);
+            if (pos && s_rv != 1) {
+                break;  // errors are reported by the next read
+            } else if (s_rv == -ENOTCONN) {
+                return OSD_ERROR_NOT_CONNECTED;
+            } else if (s_rv != 1) {
+                err(gw_ctx->log_ctx,
+                    "Unable to read packet length from device (%zd).", s_rv);
+                return OSD_ERROR_FAILURE;
+            }
+        }
+        if (pos + 1 + pkg_size_words > max_words) {
+            gw_ctx->rx_size = pkg_size_words;
+            gw_ctx->rx_size_pending = true;
+            break;
+        }
 
-    uint16_t *pkg_dtd = (uint16_t *)pkg;
-    size_t pkg_dtd_size_words = 1 /* len */ + pkg->data_size_words;
+        // read packet data
+        dtds[pos] = pkg_size_words;
+        s_rv = device_read(glip_ctx, 0, &dtds[pos + 1], pkg_size_words, 0);
+        if (s_rv == -ENOTCONN) {
+            return OSD_ERROR_NOT_CONNECTED;
+        } else if (s_rv != pkg_size_words) {
+            err(gw_ctx->log_ctx,
+                "Unable to read packet data from device (%zd).", s_rv);
+            return OSD_ERROR_FAILURE;
+        }
+        pos += 1 + pkg_size_words;
+    }
 
-    s_rv = device_write(gw_ctx->glip_ctx, pkg_dtd, pkg_dtd_size_words, 0);
+    *size_words = pos;
+    return OSD_OK;
+}
+
+static osd_result packet_write_batch_to_device(const uint16_t *dtds,
+                                               size_t size_words,
+                                               void *cb_arg)
+{
+    ssize_t s_rv;
+
+    struct osd_gateway_glip_ctx *gw_ctx = cb_arg;
+    assert(gw_ctx);
+
+    if (gw_ctx->threaded) {
+        return channels_write(gw_ctx, dtds, size_words);
+    }
+
+    s_rv = device_write(gw_ctx->devices[0]->glip_ctx, 0, dtds, size_words, 0);
     if (s_rv == -ENOTCONN) {
         return OSD_ERROR_NOT_CONNECTED;
     } else if (s_rv < 0) {
-        err(gw_ctx->log_ctx, "Device write failed (%zu)", s_rv);
+        err(gw_ctx->log_ctx, "Device write failed (%zd)", s_rv);
         return OSD_ERROR_FAILURE;
-    } else if ((size_t)s_rv != pkg_dtd_size_words) {
+    } else if ((size_t)s_rv != size_words) {
         err(gw_ctx->log_ctx,
-            "Short write: requested device write of %zu bytes, wrote %zu bytes",
-            pkg_dtd_size_words, s_rv);
+            "Short write: requested device write of %zu words, wrote %zd "
+            "words",
+            size_words, s_rv);
         return OSD_ERROR_FAILURE;
     }
     return OSD_OK;
 }
 
+/**
+ * Create a device and add it to the gateway
+ *
+ * @return the device, or NULL if GLIP could not be initialized
+ */
+static struct glip_device *device_add(
+    struct osd_gateway_glip_ctx *ctx, uint16_t subnet,
+    const char *glip_backend_name,
+    const struct glip_option *glip_backend_options,
+    size_t glip_backend_options_len)
+{
+    assert(subnet <= OSD_DIADDR_SUBNET_MAX);
+    assert(!ctx->devices_by_subnet[subnet]);
+
+    struct glip_device *dev = calloc(1, sizeof(struct glip_device));
+    assert(dev);
+    dev->gw_ctx = ctx;
+    dev->subnet = subnet;
+    dev->channels_len = 1;
+
+    dev->glip_ctx = init_glip(ctx->log_ctx, glip_backend_name,
+                              glip_backend_options, glip_backend_options_len);
+    if (!dev->glip_ctx) {
+        err(ctx->log_ctx, "Unable to initialize GLIP for subnet %u", subnet);
+        free(dev);
+        return NULL;
+    }
+
+    // the first device keeps the statistics names of a single-device gateway
+    if (ctx->devices_len == 0) {
+        snprintf(dev->stats_prefix, sizeof(dev->stats_prefix), "device");
+    } else {
+        snprintf(dev->stats_prefix, sizeof(dev->stats_prefix),
+                 "device.subnet%u", subnet);
+    }
+
+    ctx->devices[ctx->devices_len++] = dev;
+    ctx->devices_by_subnet[subnet] = dev;
+    return dev;
+}
+
+static void device_free(struct glip_device **dev_p)
+{
+    struct glip_device *dev = *dev_p;
+    if (!dev) {
+        return;
+    }
+    glip_free(dev->glip_ctx);
+    channels_free(dev);
+    free(dev);
+    *dev_p = NULL;
+}
+
+/**
+ * Get a device by its subnet address
+ *
+ * @return the device, or NULL (with an error logged) if the subnet isn't
+ *         served by the gateway
+ */
+static struct glip_device *device_by_subnet(struct osd_gateway_glip_ctx *ctx,
+                                            uint16_t subnet)
+{
+    if (subnet > OSD_DIADDR_SUBNET_MAX || !ctx->devices_by_subnet[subnet]) {
+        err(ctx->log_ctx, "No device for subnet %u.", subnet);
+        return NULL;
+    }
+    return ctx->devices_by_subnet[subnet];
+}
+
+/**
+ * Open the GLIP connection to a device
+ */
+static osd_result device_open(struct glip_device *dev)
+{
+    struct osd_log_ctx *log_ctx = dev->gw_ctx->log_ctx;
+    int glip_rv;
+
+    dbg(log_ctx, "Connecting to device for subnet %u through GLIP",
+        dev->subnet);
+    glip_rv = glip_open(dev->glip_ctx, dev->channels_len);
+    if (glip_rv < 0) {
+        err(log_ctx, "Unable to open connection to device for subnet %u (%d)",
+            dev->subnet, glip_rv);
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+
+    if (dev->channels_len > 1 &&
+        glip_get_channel_count(dev->glip_ctx) < dev->channels_len) {
+        err(log_ctx, "The device for subnet %u provides only %u GLIP channels.",
+            dev->subnet, glip_get_channel_count(dev->glip_ctx));
+        glip_close(dev->glip_ctx);
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+    dbg(log_ctx, "Connected to device for subnet %u using %u GLIP channels.",
+        dev->subnet, dev->channels_len);
+    return OSD_OK;
+}
+
+/**
+ * Get the traffic of one channel of a device
+ */
+static void device_get_channel_stats(
+    struct osd_gateway_glip_ctx *ctx, struct glip_device *dev,
+    unsigned int channel, struct osd_gateway_glip_channel_stats *stats)
+{
+    struct stats_registry *reg = gateway_get_stats(ctx->gw_ctx);
+
+    if (!ctx->threaded) {
+        // a single channel carries all traffic of the gateway
+        stats->rx_packets =
+            stats_counter_get(stats_counter(reg, "device.rx_packets"));
+        stats->rx_bytes =
+            stats_counter_get(stats_counter(reg, "device.rx_bytes"));
+        stats->tx_packets =
+            stats_counter_get(stats_counter(reg, "device.tx_packets"));
+        stats->tx_bytes =
+            stats_counter_get(stats_counter(reg, "device.tx_bytes"));
+        return;
+    }
+
+    stats->rx_packets = stats_counter_get(stats_counter(
+        reg, "%s.channel%u.rx_packets", dev->stats_prefix, channel));
+    stats->rx_bytes = stats_counter_get(stats_counter(
+        reg, "%s.channel%u.rx_bytes", dev->stats_prefix, channel));
+    stats->tx_packets = stats_counter_get(stats_counter(
+        reg, "%s.channel%u.tx_packets", dev->stats_prefix, channel));
+    stats->tx_bytes = stats_counter_get(stats_counter(
+        reg, "%s.channel%u.tx_bytes", dev->stats_prefix, channel));
+}
+
 osd_result osd_gateway_glip_new(struct osd_gateway_glip_ctx **ctx,
                                 struct osd_log_ctx *log_ctx,
                                 const char *host_controller_address,
@@ -273,23 +1020,39 @@ osd_result osd_gateway_glip_new(struct osd_gateway_glip_ctx **ctx,
 {
     osd_result rv;
 
+    if (device_subnet_addr > OSD_DIADDR_SUBNET_MAX) {
+        err(log_ctx, "Invalid subnet %u.", device_subnet_addr);
+        return OSD_ERROR_FAILURE;
+    }
+
     struct osd_gateway_glip_ctx *c =
         calloc(1, sizeof(struct osd_gateway_glip_ctx));
     assert(c);
 
     c->log_ctx = log_ctx;
 
-    c->glip_ctx = init_glip(log_ctx, glip_backend_name, glip_backend_options,
-                            glip_backend_options_len);
-    if (!c->glip_ctx) {
+    int irv = pthread_mutex_init(&c->rx_lock, NULL);
+    assert(irv == 0);
+    irv = pthread_cond_init(&c->rx_cond, NULL);
+    assert(irv == 0);
+    c->rx_queue = zlist_new();
+    assert(c->rx_queue);
+
+    if (!device_add(c, device_subnet_addr, glip_backend_name,
+                    glip_backend_options, glip_backend_options_len)) {
         err(log_ctx, "Unable to initialize GLIP");
         return OSD_ERROR_FAILURE;
     }
 
+    // read all available packets and write all waiting packets with one
+    // GLIP access
+    const struct osd_gateway_device_ops ops = {
+        .read_batch = packet_read_batch_from_device,
+        .write_batch = packet_write_batch_to_device,
+    };
     dbg(log_ctx, "Creating gateway context.");
-    rv = osd_gateway_new(&c->gw_ctx, log_ctx, host_controller_address,
-                         device_subnet_addr, packet_read_from_device,
-                         packet_write_to_device, (void *)c);
+    rv = osd_gateway_new_batched(&c->gw_ctx, log_ctx, host_controller_address,
+                                 device_subnet_addr, &ops, (void *)c);
     if (OSD_FAILED(rv)) {
         return rv;
     }
@@ -300,24 +1063,88 @@ osd_result osd_gateway_glip_new(struct osd_gateway_glip_ctx **ctx,
     return OSD_OK;
 }
 
-osd_result osd_gateway_glip_connect(struct osd_gateway_glip_ctx *ctx)
+osd_result osd_gateway_glip_add_device(
+    struct osd_gateway_glip_ctx *ctx, uint16_t device_subnet_addr,
+    const char *glip_backend_name,
+    const struct glip_option *glip_backend_options,
+    size_t glip_backend_options_len)
+{
+    osd_result rv;
+    assert(ctx);
+
+    if (osd_gateway_is_connected(ctx->gw_ctx)) {
+        err(ctx->log_ctx, "Devices cannot be added while connected.");
+        return OSD_ERROR_FAILURE;
+    }
+    if (device_subnet_addr > OSD_DIADDR_SUBNET_MAX ||
+        ctx->devices_by_subnet[device_subnet_addr]) {
+        err(ctx->log_ctx, "Subnet %u is invalid or already served.",
+            device_subnet_addr);
+        return OSD_ERROR_FAILURE;
+    }
+
+    rv = osd_gateway_add_subnet(ctx->gw_ctx, device_subnet_addr);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+    if (!device_add(ctx, device_subnet_addr, glip_backend_name,
+                    glip_backend_options, glip_backend_options_len)) {
+        return OSD_ERROR_FAILURE;
+    }
+    return OSD_OK;
+}
+
+/**
+ * Close the connections to the first @p devices_len devices
+ */
+static void devices_close(struct osd_gateway_glip_ctx *ctx,
+                          unsigned int devices_len)
 {
     int glip_rv;
+
+    for (unsigned int d = 0; d < devices_len; d++) {
+        glip_rv = glip_close(ctx->devices[d]->glip_ctx);
+        if (glip_rv != 0) {
+            err(ctx->log_ctx,
+                "Unable to close connection to device for subnet %u. (%d)",
+                ctx->devices[d]->subnet, glip_rv);
+        }
+    }
+}
+
+osd_result osd_gateway_glip_connect(struct osd_gateway_glip_ctx *ctx)
+{
     osd_result rv;
 
-    dbg(ctx->log_ctx, "Connecting to device through GLIP");
-    glip_rv = glip_open(ctx->glip_ctx, 1);
-    if (glip_rv < 0) {
-        err(ctx->log_ctx, "Unable to open connection to device (%d)", glip_rv);
-        return OSD_ERROR_CONNECTION_FAILED;
+    for (unsigned int d = 0; d < ctx->devices_len; d++) {
+        rv = device_open(ctx->devices[d]);
+        if (OSD_FAILED(rv)) {
+            devices_close(ctx, d);
+            return rv;
+        }
+    }
+
+    struct glip_device *dev0 = ctx->devices[0];
+    ctx->threaded = ctx->devices_len > 1 || dev0->channels_len > 1 ||
+                    dev0->cpus_pinned;
+    ctx->rx_size_pending = false;
+    if (ctx->threaded) {
+        rv = channels_start(ctx);
+        if (OSD_FAILED(rv)) {
+            devices_close(ctx, ctx->devices_len);
+            return rv;
+        }
     }
-    dbg(ctx->log_ctx, "Connected to device.");
 
     // connect to host controller
     dbg(ctx->log_ctx, "Connecting to host controller");
     rv = osd_gateway_connect(ctx->gw_ctx);
     if (OSD_FAILED(rv)) {
         err(ctx->log_ctx, "Unable to connect to host controller (%d).", rv);
+        if (ctx->threaded) {
+            channels_stop(ctx);
+        }
+        devices_close(ctx, ctx->devices_len);
         return rv;
     }
     dbg(ctx->log_ctx, "Connected to host controller");
@@ -327,15 +1154,16 @@ osd_result osd_gateway_glip_connect(struct osd_gateway_glip_ctx *ctx)
 
 osd_result osd_gateway_glip_disconnect(struct osd_gateway_glip_ctx *ctx)
 {
-    int glip_rv;
     osd_result rv;
 
-    // disconnect from device
-    glip_rv = glip_close(ctx->glip_ctx);
-    if (glip_rv != 0) {
-        err(ctx->log_ctx, "Unable to close device connection. (%d)", glip_rv);
+    // the channel threads use the devices until they are stopped
+    if (ctx->threaded) {
+        channels_stop(ctx);
     }
 
+    // disconnect from devices
+    devices_close(ctx, ctx->devices_len);
+
     // disconnect gateway from host controller and from device
     rv = osd_gateway_disconnect(ctx->gw_ctx);
     if (OSD_FAILED(rv)) {
@@ -355,14 +1183,189 @@ void osd_gateway_glip_free(struct osd_gateway_glip_ctx **ctx_p)
     }
 
     osd_gateway_free(&ctx->gw_ctx);
-    glip_free(ctx->glip_ctx);
+    for (unsigned int d = 0; d < ctx->devices_len; d++) {
+        device_free(&ctx->devices[d]);
+    }
+
+    zlist_destroy(&ctx->rx_queue);
+    pthread_cond_destroy(&ctx->rx_cond);
+    pthread_mutex_destroy(&ctx->rx_lock);
 
     free(ctx);
-    ctx_p = NULL;
+    *ctx_p = NULL;
+}
+
+osd_result osd_gateway_glip_set_tclass_weight(
+    struct osd_gateway_glip_ctx *ctx, unsigned int control_weight)
+{
+    return osd_gateway_set_tclass_weight(ctx->gw_ctx, control_weight);
+}
+
+osd_result osd_gateway_glip_set_stats_endpoint(
+    struct osd_gateway_glip_ctx *ctx, const char *endpoint)
+{
+    return osd_gateway_set_stats_endpoint(ctx->gw_ctx, endpoint);
+}
+
+osd_result osd_gateway_glip_set_compression(struct osd_gateway_glip_ctx *ctx,
+                                            bool enable)
+{
+    return osd_gateway_set_compression(ctx->gw_ctx, enable);
+}
+
+osd_result osd_gateway_glip_set_rx_filter(struct osd_gateway_glip_ctx *ctx,
+                                          const char *rules)
+{
+    return osd_gateway_set_rx_filter(ctx->gw_ctx, rules);
 }
 
 bool osd_gateway_glip_is_connected(struct osd_gateway_glip_ctx *ctx)
 {
-    return osd_gateway_is_connected(ctx->gw_ctx) &&
-           glip_is_connected(ctx->glip_ctx);
+    if (!osd_gateway_is_connected(ctx->gw_ctx)) {
+        return false;
+    }
+    // the gateway keeps serving the remaining devices if one is lost
+    for (unsigned int d = 0; d < ctx->devices_len; d++) {
+        if (glip_is_connected(ctx->devices[d]->glip_ctx)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+osd_result osd_gateway_glip_set_channels(struct osd_gateway_glip_ctx *ctx,
+                                         unsigned int channels,
+                                         enum osd_gateway_glip_stripe stripe)
+{
+    assert(ctx);
+    return osd_gateway_glip_set_device_channels(ctx, ctx->devices[0]->subnet,
+                                                channels, stripe);
+}
+
+osd_result osd_gateway_glip_set_device_channels(
+    struct osd_gateway_glip_ctx *ctx, uint16_t device_subnet_addr,
+    unsigned int channels, enum osd_gateway_glip_stripe stripe)
+{
+    assert(ctx);
+
+    struct glip_device *dev = device_by_subnet(ctx, device_subnet_addr);
+    if (!dev) {
+        return OSD_ERROR_FAILURE;
+    }
+    if (osd_gateway_is_connected(ctx->gw_ctx)) {
+        err(ctx->log_ctx, "The channels cannot be changed while connected.");
+        return OSD_ERROR_FAILURE;
+    }
+    if (channels < 1 || channels > OSD_GATEWAY_GLIP_CHANNELS_MAX ||
+        (stripe == OSD_GATEWAY_GLIP_STRIPE_TCLASS && channels < 2)) {
+        err(ctx->log_ctx, "Invalid number of GLIP channels: %u", channels);
+        return OSD_ERROR_FAILURE;
+    }
+
+    // the channels are allocated again when connecting
+    channels_free(dev);
+    dev->channels_len = channels;
+    dev->stripe = stripe;
+    return OSD_OK;
+}
+
+osd_result osd_gateway_glip_set_device_cpus(struct osd_gateway_glip_ctx *ctx,
+                                            uint16_t device_subnet_addr,
+                                            const unsigned int *cpus,
+                                            size_t cpus_len)
+{
+    assert(ctx);
+
+    struct glip_device *dev = device_by_subnet(ctx, device_subnet_addr);
+    if (!dev) {
+        return OSD_ERROR_FAILURE;
+    }
+    if (osd_gateway_is_connected(ctx->gw_ctx)) {
+        err(ctx->log_ctx, "The CPUs cannot be changed while connected.");
+        return OSD_ERROR_FAILURE;
+    }
+
+    CPU_ZERO(&dev->cpus);
+    for (size_t i = 0; i < cpus_len; i++) {
+        if (cpus[i] >= CPU_SETSIZE) {
+            err(ctx->log_ctx, "Invalid CPU %u.", cpus[i]);
+            return OSD_ERROR_FAILURE;
+        }
+        CPU_SET(cpus[i], &dev->cpus);
+    }
+    dev->cpus_pinned = cpus_len > 0;
+    return OSD_OK;
+}
+
+unsigned int osd_gateway_glip_get_channels(struct osd_gateway_glip_ctx *ctx)
+{
+    assert(ctx);
+    return ctx->devices[0]->channels_len;
+}
+
+osd_result osd_gateway_glip_get_channel_stats(
+    struct osd_gateway_glip_ctx *ctx, unsigned int channel,
+    struct osd_gateway_glip_channel_stats *stats)
+{
+    assert(ctx);
+    assert(stats);
+
+    struct glip_device *dev = ctx->devices[0];
+    if (channel >= dev->channels_len) {
+        return OSD_ERROR_FAILURE;
+    }
+
+    device_get_channel_stats(ctx, dev, channel, stats);
+    return OSD_OK;
+}
+
+osd_result osd_gateway_glip_get_device_stats(
+    struct osd_gateway_glip_ctx *ctx, uint16_t device_subnet_addr,
+    struct osd_gateway_glip_device_stats *stats)
+{
+    assert(ctx);
+    assert(stats);
+
+    struct glip_device *dev = device_by_subnet(ctx, device_subnet_addr);
+    if (!dev) {
+        return OSD_ERROR_FAILURE;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    for (unsigned int i = 0; i < dev->channels_len; i++) {
+        struct osd_gateway_glip_channel_stats ch_stats;
+        device_get_channel_stats(ctx, dev, i, &ch_stats);
+        stats->rx_packets += ch_stats.rx_packets;
+        stats->rx_bytes += ch_stats.rx_bytes;
+        stats->tx_packets += ch_stats.tx_packets;
+        stats->tx_bytes += ch_stats.tx_bytes;
+        if (!ctx->threaded) {
+            break;
+        }
+    }
+
+    stats->mem_bytes = sizeof(struct glip_device);
+    if (dev->channels) {
+        stats->mem_bytes +=
+            dev->channels_len *
+            (sizeof(struct glip_channel) +
+             2 * CHANNEL_TX_BUF_WORDS * sizeof(uint16_t));
+    }
+
+    if (!ctx->threaded) {
+        // the threads of the gateway access the only device
+        struct timespec ts;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+        stats->cpu_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        return OSD_OK;
+    }
+
+    stats->cpu_ns = dev->cpu_ns_stopped;
+    if (ctx->channels_running) {
+        for (unsigned int i = 0; i < dev->channels_len; i++) {
+            stats->cpu_ns += thread_cpu_ns(dev->channels[i].rxthread) +
+                             thread_cpu_ns(dev->channels[i].txthread);
+        }
+    }
+    return OSD_OK;
 }
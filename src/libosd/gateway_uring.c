@@ -0,0 +1,798 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <osd/gateway.h>
+#include <osd/gateway_uring.h>
+#include "dtdstream.h"
+#include "osd-private.h"
+#include "stats.h"
+#include "uring.h"
+
+#include <assert.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+
+/** Maximum number of parts of the receive buffer */
+#define READS_MAX 64
+
+/** Smallest size of a read (bytes) */
+#define READ_SIZE_MIN 64
+
+/**
+ * One part of the receive buffer and the read into it
+ */
+struct read_slot {
+    /** Is the read submitted and not completed yet? */
+    bool in_flight;
+
+    /** Result of the completed read: bytes read, or a negative errno */
+    int32_t res;
+
+    /** Bytes of the completed read already parsed */
+    size_t pos;
+};
+
+/**
+ * io_uring gateway context
+ */
+struct osd_gateway_uring_ctx {
+    /** Logging context */
+    struct osd_log_ctx *log_ctx;
+
+    /** OSD gateway context object */
+    struct osd_gateway_ctx *gw_ctx;
+
+    /** Host and port of the TCP connection, NULL for a character device */
+    char *tcp_host;
+    char *tcp_port;
+
+    /** Path of the character device, NULL for a TCP connection */
+    char *dev_path;
+
+    /** Baud rate of a serial port (termios constant), 0 to leave it */
+    speed_t baudrate;
+
+    /**
+     * Number of parts of the receive buffer
+     *
+     * Only one read is in flight at a time: reads on a stream socket which
+     * are in flight together may complete in any order, which would lose
+     * the order of the data. The parts are filled in turn, the next read
+     * is submitted while the data of the previous ones is parsed.
+     */
+    unsigned int reads;
+
+    /** Size of a read (bytes) */
+    size_t read_size;
+
+    /** File descriptor of the device, -1 if not connected */
+    int fd;
+
+    /** Is the device a socket? */
+    bool is_socket;
+
+    /** The device closed the connection (accessed atomically) */
+    int closed;
+
+    /** The ring the device is read with */
+    struct uring *ring;
+
+    /** Signalled by the ring when a read completed */
+    int event_fd;
+
+    /** Receive buffer, @p reads parts of @p read_size bytes */
+    uint8_t *rx_buf;
+
+    /** Is @p rx_buf registered with the ring? */
+    bool rx_buf_registered;
+
+    /** The reads, one for each part of the receive buffer */
+    struct read_slot *slots;
+
+    /** Index of the oldest completed read which is not fully parsed yet */
+    unsigned int completed_head;
+
+    /**
+     * Number of completed reads which are not fully parsed yet, in the
+     * slots following @p completed_head
+     */
+    unsigned int completed_count;
+
+    /** Packets received from the device */
+    struct dtdstream parser;
+
+    /** Buffer for the packets written to the device (big endian) */
+    uint16_t *tx_buf;
+
+    /** Size of @p tx_buf (words) */
+    size_t tx_buf_words;
+
+    /** Statistics */
+    uint64_t *stats_rx_bytes;
+    uint64_t *stats_reads;
+    uint64_t *stats_submits;
+    uint64_t *stats_tx_bytes;
+    uint64_t *stats_rx_invalid;
+};
+
+/**
+ * Get the termios constant of a baud rate
+ *
+ * @return the constant, or 0 if the baud rate is not supported
+ */
+static speed_t baudrate_to_speed(unsigned int baudrate)
+{
+    switch (baudrate) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 921600: return B921600;
+    case 1000000: return B1000000;
+    case 2000000: return B2000000;
+    case 3000000: return B3000000;
+    case 4000000: return B4000000;
+    default: return 0;
+    }
+}
+
+/**
+ * Parse the device name
+ */
+static osd_result parse_device(struct osd_gateway_uring_ctx *ctx,
+                               const char *device)
+{
+    if (strncmp(device, "tcp://", 6)) {
+        ctx->dev_path = strdup(device);
+        assert(ctx->dev_path);
+        return OSD_OK;
+    }
+
+    const char *host = device + 6;
+    const char *colon = strrchr(host, ':');
+    if (!colon || colon == host || colon[1] == '\0') {
+        err(ctx->log_ctx, "Invalid device %s, expected tcp://<host>:<port>.",
+            device);
+        return OSD_ERROR_FAILURE;
+    }
+    ctx->tcp_host = strndup(host, colon - host);
+    assert(ctx->tcp_host);
+    ctx->tcp_port = strdup(colon + 1);
+    assert(ctx->tcp_port);
+    return OSD_OK;
+}
+
+/**
+ * Connect to the device over TCP
+ */
+static osd_result device_open_tcp(struct osd_gateway_uring_ctx *ctx)
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo *addrs;
+    int gai_rv = getaddrinfo(ctx->tcp_host, ctx->tcp_port, &hints, &addrs);
+    if (gai_rv != 0) {
+        err(ctx->log_ctx, "Unable to resolve %s: %s", ctx->tcp_host,
+            gai_strerror(gai_rv));
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+
+    int fd = -1;
+    for (struct addrinfo *a = addrs; a; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC,
+                    a->ai_protocol);
+        if (fd == -1) {
+            continue;
+        }
+        if (connect(fd, a->ai_addr, a->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addrs);
+    if (fd == -1) {
+        err(ctx->log_ctx, "Unable to connect to %s:%s: %s", ctx->tcp_host,
+            ctx->tcp_port, strerror(errno));
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+
+    // register accesses are small, don't hold them back
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    ctx->fd = fd;
+    ctx->is_socket = true;
+    return OSD_OK;
+}
+
+/**
+ * Open a character device, switching serial ports to raw mode
+ */
+static osd_result device_open_chardev(struct osd_gateway_uring_ctx *ctx)
+{
+    int fd = open(ctx->dev_path, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (fd == -1) {
+        err(ctx->log_ctx, "Unable to open %s: %s", ctx->dev_path,
+            strerror(errno));
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+
+    if (isatty(fd)) {
+        struct termios tio;
+        if (tcgetattr(fd, &tio) != 0) {
+            err(ctx->log_ctx, "Unable to configure %s: %s", ctx->dev_path,
+                strerror(errno));
+            close(fd);
+            return OSD_ERROR_CONNECTION_FAILED;
+        }
+        cfmakeraw(&tio);
+        tio.c_cflag |= CLOCAL | CREAD;
+        // return from a read as soon as data is available
+        tio.c_cc[VMIN] = 1;
+        tio.c_cc[VTIME] = 0;
+        if (ctx->baudrate) {
+            cfsetispeed(&tio, ctx->baudrate);
+            cfsetospeed(&tio, ctx->baudrate);
+        }
+        if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+            err(ctx->log_ctx, "Unable to configure %s: %s", ctx->dev_path,
+                strerror(errno));
+            close(fd);
+            return OSD_ERROR_CONNECTION_FAILED;
+        }
+        tcflush(fd, TCIOFLUSH);
+    }
+
+    ctx->fd = fd;
+    ctx->is_socket = false;
+    return OSD_OK;
+}
+
+/**
+ * Queue the read of a slot
+ */
+static void slot_queue_read(struct osd_gateway_uring_ctx *ctx,
+                            unsigned int index)
+{
+    struct read_slot *slot = &ctx->slots[index];
+    slot->in_flight = true;
+    slot->pos = 0;
+    // only one read is queued at a time
+    bool queued = uring_prep_read(ctx->ring, ctx->fd,
+                                  ctx->rx_buf + index * ctx->read_size,
+                                  ctx->read_size, ctx->rx_buf_registered,
+                                  index);
+    assert(queued);
+}
+
+/**
+ * Queue the read into the next part of the receive buffer
+ *
+ * Nothing is queued if a read is in flight already, or if all parts hold
+ * data which is not parsed yet.
+ */
+static void queue_next_read(struct osd_gateway_uring_ctx *ctx)
+{
+    if (ctx->completed_count == ctx->reads) {
+        return;
+    }
+    unsigned int index =
+        (ctx->completed_head + ctx->completed_count) % ctx->reads;
+    if (!ctx->slots[index].in_flight) {
+        slot_queue_read(ctx, index);
+    }
+}
+
+/**
+ * Submit the queued read
+ */
+static osd_result submit_reads(struct osd_gateway_uring_ctx *ctx)
+{
+    int rv = uring_submit(ctx->ring);
+    if (rv < 0) {
+        err(ctx->log_ctx, "Unable to submit reads from the device: %s",
+            strerror(-rv));
+        return OSD_ERROR_FAILURE;
+    }
+    if (rv > 0) {
+        stats_counter_add(ctx->stats_submits, 1);
+    }
+    return OSD_OK;
+}
+
+/**
+ * Take all completed reads from the ring
+ */
+static void reap_reads(struct osd_gateway_uring_ctx *ctx)
+{
+    uint64_t index;
+    int32_t res;
+    while (uring_pop_completion(ctx->ring, &index, &res)) {
+        // the parts are read in turn, one at a time
+        assert(index == (ctx->completed_head + ctx->completed_count) %
+                        ctx->reads);
+        assert(ctx->slots[index].in_flight);
+        ctx->slots[index].in_flight = false;
+        ctx->slots[index].res = res;
+        ctx->completed_count++;
+        stats_counter_add(ctx->stats_reads, 1);
+        if (res > 0) {
+            stats_counter_add(ctx->stats_rx_bytes, res);
+        }
+        queue_next_read(ctx);
+    }
+}
+
+/**
+ * Is the data of a completed read available?
+ *
+ * The eventfd is only cleared if no data is available, so that it stays
+ * readable (and the gateway keeps calling packet_read_from_device()) as long
+ * as completed reads are waiting to be parsed.
+ */
+static bool read_completed(struct osd_gateway_uring_ctx *ctx)
+{
+    if (ctx->completed_count) {
+        return true;
+    }
+    reap_reads(ctx);
+    if (ctx->completed_count) {
+        return true;
+    }
+
+    // Clear the eventfd and look again: a read completing from now on
+    // signals the eventfd again.
+    uint64_t count;
+    ssize_t s_rv = read(ctx->event_fd, &count, sizeof(count));
+    (void)s_rv;
+    reap_reads(ctx);
+    return ctx->completed_count != 0;
+}
+
+/**
+ * Read a packet from the device (called by the gateway I/O thread when the
+ * eventfd is readable)
+ */
+static osd_result packet_read_from_device(struct osd_packet **pkg,
+                                          void *cb_arg)
+{
+    struct osd_gateway_uring_ctx *ctx = cb_arg;
+    assert(ctx);
+    osd_result rv = OSD_OK;
+
+    *pkg = NULL;
+    while (!*pkg && read_completed(ctx)) {
+        unsigned int index = ctx->completed_head;
+        struct read_slot *slot = &ctx->slots[index];
+        if (slot->res == 0) {
+            info(ctx->log_ctx, "The device closed the connection.");
+            __atomic_store_n(&ctx->closed, 1, __ATOMIC_RELAXED);
+            return OSD_ERROR_NOT_CONNECTED;
+        } else if (slot->res < 0 && slot->res != -EINTR &&
+                   slot->res != -EAGAIN) {
+            err(ctx->log_ctx, "Unable to read from the device: %s",
+                strerror(-slot->res));
+            __atomic_store_n(&ctx->closed, 1, __ATOMIC_RELAXED);
+            return OSD_ERROR_NOT_CONNECTED;
+        }
+
+        if (slot->res > 0) {
+            uint64_t invalid = ctx->parser.invalid;
+            slot->pos += dtdstream_parse(
+                &ctx->parser,
+                ctx->rx_buf + index * ctx->read_size + slot->pos,
+                slot->res - slot->pos, pkg);
+            if (ctx->parser.invalid != invalid) {
+                stats_counter_add(ctx->stats_rx_invalid,
+                                  ctx->parser.invalid - invalid);
+            }
+            if (slot->pos < (size_t)slot->res) {
+                break;
+            }
+        }
+
+        // all data of the read is parsed: its part is free again
+        ctx->completed_head = (ctx->completed_head + 1) % ctx->reads;
+        ctx->completed_count--;
+        queue_next_read(ctx);
+    }
+
+    rv = submit_reads(ctx);
+    if (OSD_FAILED(rv)) {
+        osd_packet_free(pkg);
+        return rv;
+    }
+    return OSD_OK;
+}
+
+/**
+ * Write DTDs to the device
+ */
+static osd_result device_write(struct osd_gateway_uring_ctx *ctx,
+                               const uint16_t *dtds, size_t size_words)
+{
+    // the device expects big endian words
+    if (size_words > ctx->tx_buf_words) {
+        free(ctx->tx_buf);
+        ctx->tx_buf = malloc(size_words * sizeof(uint16_t));
+        assert(ctx->tx_buf);
+        ctx->tx_buf_words = size_words;
+    }
+    for (size_t w = 0; w < size_words; w++) {
+        ctx->tx_buf[w] = htobe16(dtds[w]);
+    }
+
+    const uint8_t *data = (const uint8_t *)ctx->tx_buf;
+    size_t len = size_words * sizeof(uint16_t);
+    while (len) {
+        ssize_t written;
+        if (ctx->is_socket) {
+            written = send(ctx->fd, data, len, MSG_NOSIGNAL);
+        } else {
+            written = write(ctx->fd, data, len);
+        }
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EPIPE || errno == ECONNRESET) {
+                return OSD_ERROR_NOT_CONNECTED;
+            }
+            err(ctx->log_ctx, "Device write failed: %s", strerror(errno));
+            return OSD_ERROR_FAILURE;
+        }
+        data += written;
+        len -= written;
+    }
+    stats_counter_add(ctx->stats_tx_bytes, size_words * sizeof(uint16_t));
+    return OSD_OK;
+}
+
+static osd_result packet_write_to_device(const struct osd_packet *pkg,
+                                         void *cb_arg)
+{
+    struct osd_gateway_uring_ctx *ctx = cb_arg;
+    assert(ctx);
+
+    return device_write(ctx, (const uint16_t *)pkg,
+                        1 /* len */ + pkg->data_size_words);
+}
+
+static osd_result packet_write_batch_to_device(const uint16_t *dtds,
+                                               size_t size_words,
+                                               void *cb_arg)
+{
+    struct osd_gateway_uring_ctx *ctx = cb_arg;
+    assert(ctx);
+
+    return device_write(ctx, dtds, size_words);
+}
+
+/**
+ * Close the device and tear down the ring
+ */
+static void device_close(struct osd_gateway_uring_ctx *ctx)
+{
+    // tearing down the ring cancels the reads in flight
+    uring_free(&ctx->ring);
+    if (ctx->event_fd != -1) {
+        close(ctx->event_fd);
+        ctx->event_fd = -1;
+    }
+    if (ctx->fd != -1) {
+        close(ctx->fd);
+        ctx->fd = -1;
+    }
+    free(ctx->rx_buf);
+    ctx->rx_buf = NULL;
+    free(ctx->slots);
+    ctx->slots = NULL;
+    dtdstream_reset(&ctx->parser);
+}
+
+/**
+ * Open the device, set up the ring and submit the first read
+ */
+static osd_result device_open(struct osd_gateway_uring_ctx *ctx)
+{
+    osd_result rv;
+
+    if (ctx->tcp_host) {
+        rv = device_open_tcp(ctx);
+    } else {
+        rv = device_open_chardev(ctx);
+    }
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+    __atomic_store_n(&ctx->closed, 0, __ATOMIC_RELAXED);
+
+    // one read is queued at a time
+    rv = uring_new(&ctx->ring, 1);
+    if (OSD_FAILED(rv)) {
+        err(ctx->log_ctx, "Unable to set up io_uring: %s", strerror(errno));
+        device_close(ctx);
+        return OSD_ERROR_FAILURE;
+    }
+
+    ctx->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ctx->event_fd == -1 ||
+        OSD_FAILED(uring_register_eventfd(ctx->ring, ctx->event_fd))) {
+        err(ctx->log_ctx, "Unable to set up io_uring completion events: %s",
+            strerror(errno));
+        device_close(ctx);
+        return OSD_ERROR_FAILURE;
+    }
+
+    size_t rx_buf_size = ctx->reads * ctx->read_size;
+    if (posix_memalign((void **)&ctx->rx_buf, sysconf(_SC_PAGESIZE),
+                       rx_buf_size) != 0) {
+        ctx->rx_buf = NULL;
+        err(ctx->log_ctx, "Unable to allocate %zu bytes receive buffer.",
+            rx_buf_size);
+        device_close(ctx);
+        return OSD_ERROR_OOM;
+    }
+    // registration counts against RLIMIT_MEMLOCK, read without it if needed
+    ctx->rx_buf_registered =
+        OSD_SUCCEEDED(uring_register_buffer(ctx->ring, ctx->rx_buf,
+                                            rx_buf_size));
+    if (!ctx->rx_buf_registered) {
+        info(ctx->log_ctx, "Unable to register the receive buffer (%s), "
+             "reading into an unregistered buffer.", strerror(errno));
+    }
+
+    ctx->slots = calloc(ctx->reads, sizeof(struct read_slot));
+    assert(ctx->slots);
+    ctx->completed_head = 0;
+    ctx->completed_count = 0;
+    dtdstream_init(&ctx->parser);
+    queue_next_read(ctx);
+    rv = submit_reads(ctx);
+    if (OSD_FAILED(rv)) {
+        device_close(ctx);
+        return rv;
+    }
+    return OSD_OK;
+}
+
+API_EXPORT
+osd_result osd_gateway_uring_new(struct osd_gateway_uring_ctx **ctx,
+                                 struct osd_log_ctx *log_ctx,
+                                 const char *host_controller_address,
+                                 uint16_t device_subnet_addr,
+                                 const char *device)
+{
+    osd_result rv;
+    assert(device);
+
+    struct osd_gateway_uring_ctx *c =
+        calloc(1, sizeof(struct osd_gateway_uring_ctx));
+    assert(c);
+
+    c->log_ctx = log_ctx;
+    c->fd = -1;
+    c->event_fd = -1;
+    c->read_size = OSD_GATEWAY_URING_READ_SIZE_DEFAULT;
+
+    rv = parse_device(c, device);
+    if (OSD_FAILED(rv)) {
+        osd_gateway_uring_free(&c);
+        return rv;
+    }
+    c->reads = OSD_GATEWAY_URING_READS_DEFAULT;
+
+    rv = osd_gateway_new(&c->gw_ctx, log_ctx, host_controller_address,
+                         device_subnet_addr, NULL, packet_write_to_device,
+                         (void *)c);
+    if (OSD_FAILED(rv)) {
+        osd_gateway_uring_free(&c);
+        return rv;
+    }
+
+    // write all waiting packets with one system call
+    rv = osd_gateway_set_packet_write_batch(c->gw_ctx,
+                                            packet_write_batch_to_device);
+    if (OSD_FAILED(rv)) {
+        osd_gateway_uring_free(&c);
+        return rv;
+    }
+
+    struct stats_registry *reg = gateway_get_stats(c->gw_ctx);
+    c->stats_rx_bytes = stats_counter(reg, "device.uring_rx_bytes");
+    c->stats_reads = stats_counter(reg, "device.uring_reads");
+    c->stats_submits = stats_counter(reg, "device.uring_submits");
+    c->stats_tx_bytes = stats_counter(reg, "device.uring_tx_bytes");
+    c->stats_rx_invalid = stats_counter(reg, "device.uring_rx_invalid");
+
+    *ctx = c;
+    return OSD_OK;
+}
+
+API_EXPORT
+void osd_gateway_uring_free(struct osd_gateway_uring_ctx **ctx_p)
+{
+    assert(ctx_p);
+    struct osd_gateway_uring_ctx *ctx = *ctx_p;
+    if (!ctx) {
+        return;
+    }
+
+    osd_gateway_free(&ctx->gw_ctx);
+    device_close(ctx);
+    free(ctx->tx_buf);
+    free(ctx->tcp_host);
+    free(ctx->tcp_port);
+    free(ctx->dev_path);
+
+    free(ctx);
+    *ctx_p = NULL;
+}
+
+API_EXPORT
+osd_result osd_gateway_uring_set_reads(struct osd_gateway_uring_ctx *ctx,
+                                       unsigned int reads, size_t read_size)
+{
+    assert(ctx);
+
+    if (ctx->fd != -1) {
+        err(ctx->log_ctx, "Reads cannot be changed while connected.");
+        return OSD_ERROR_FAILURE;
+    }
+    if (reads < 1 || reads > READS_MAX || read_size < READ_SIZE_MIN ||
+        read_size > UINT32_MAX) {
+        err(ctx->log_ctx, "Invalid number (%u) or size (%zu) of reads.",
+            reads, read_size);
+        return OSD_ERROR_FAILURE;
+    }
+    ctx->reads = reads;
+    ctx->read_size = read_size;
+    return OSD_OK;
+}
+
+API_EXPORT
+osd_result osd_gateway_uring_set_baudrate(struct osd_gateway_uring_ctx *ctx,
+                                          unsigned int baudrate)
+{
+    assert(ctx);
+
+    if (baudrate == 0) {
+        ctx->baudrate = 0;
+        return OSD_OK;
+    }
+    speed_t speed = baudrate_to_speed(baudrate);
+    if (!speed) {
+        err(ctx->log_ctx, "Unsupported baud rate %u.", baudrate);
+        return OSD_ERROR_FAILURE;
+    }
+    ctx->baudrate = speed;
+    return OSD_OK;
+}
+
+API_EXPORT
+osd_result osd_gateway_uring_connect(struct osd_gateway_uring_ctx *ctx)
+{
+    osd_result rv;
+    assert(ctx);
+
+    dbg(ctx->log_ctx, "Connecting to device %s%s%s",
+        ctx->tcp_host ? ctx->tcp_host : ctx->dev_path,
+        ctx->tcp_host ? ":" : "", ctx->tcp_host ? ctx->tcp_port : "");
+    rv = device_open(ctx);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+
+    // the gateway I/O thread parses the packets when a read completed
+    rv = osd_gateway_set_device_fd(ctx->gw_ctx, ctx->event_fd,
+                                   packet_read_from_device);
+    if (OSD_FAILED(rv)) {
+        device_close(ctx);
+        return rv;
+    }
+
+    dbg(ctx->log_ctx, "Connecting to host controller");
+    rv = osd_gateway_connect(ctx->gw_ctx);
+    if (OSD_FAILED(rv)) {
+        err(ctx->log_ctx, "Unable to connect to host controller (%d).", rv);
+        device_close(ctx);
+        return rv;
+    }
+    dbg(ctx->log_ctx, "Connected to host controller");
+
+    return OSD_OK;
+}
+
+API_EXPORT
+osd_result osd_gateway_uring_disconnect(struct osd_gateway_uring_ctx *ctx)
+{
+    osd_result rv;
+    assert(ctx);
+
+    // stop the I/O thread before the ring goes away
+    rv = osd_gateway_disconnect(ctx->gw_ctx);
+    if (OSD_FAILED(rv)) {
+        err(ctx->log_ctx, "Unable to disconnect from host controller (%d)", rv);
+    }
+    device_close(ctx);
+
+    return rv;
+}
+
+API_EXPORT
+bool osd_gateway_uring_is_connected(struct osd_gateway_uring_ctx *ctx)
+{
+    assert(ctx);
+    return osd_gateway_is_connected(ctx->gw_ctx) && ctx->fd != -1 &&
+           !__atomic_load_n(&ctx->closed, __ATOMIC_RELAXED);
+}
+
+API_EXPORT
+osd_result osd_gateway_uring_set_tclass_weight(
+    struct osd_gateway_uring_ctx *ctx, unsigned int control_weight)
+{
+    return osd_gateway_set_tclass_weight(ctx->gw_ctx, control_weight);
+}
+
+API_EXPORT
+osd_result osd_gateway_uring_set_stats_endpoint(
+    struct osd_gateway_uring_ctx *ctx, const char *endpoint)
+{
+    return osd_gateway_set_stats_endpoint(ctx->gw_ctx, endpoint);
+}
+
+API_EXPORT
+osd_result osd_gateway_uring_set_compression(
+    struct osd_gateway_uring_ctx *ctx, bool enable)
+{
+    return osd_gateway_set_compression(ctx->gw_ctx, enable);
+}
+
+API_EXPORT
+osd_result osd_gateway_uring_set_rx_filter(struct osd_gateway_uring_ctx *ctx,
+                                           const char *rules)
+{
+    return osd_gateway_set_rx_filter(ctx->gw_ctx, rules);
+}
+
+API_EXPORT
+void osd_gateway_uring_get_stats(struct osd_gateway_uring_ctx *ctx,
+                                 struct osd_gateway_uring_stats *stats)
+{
+    assert(ctx);
+    stats->rx_bytes = stats_counter_get(ctx->stats_rx_bytes);
+    stats->reads = stats_counter_get(ctx->stats_reads);
+    stats->submits = stats_counter_get(ctx->stats_submits);
+    stats->tx_bytes = stats_counter_get(ctx->stats_tx_bytes);
+    stats->rx_invalid = stats_counter_get(ctx->stats_rx_invalid);
+}
@@ -0,0 +1,96 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hdrhist.h"
+
+#include <assert.h>
+#include <string.h>
+
+#define SUB_BUCKETS (1ULL << HDRHIST_SUB_BUCKET_BITS)
+
+/**
+ * Get the bucket of a value
+ *
+ * Values below 2 * SUB_BUCKETS are their own bucket. A larger value with the
+ * most significant bit b is shifted right by e = b - HDRHIST_SUB_BUCKET_BITS
+ * bits, leaving a mantissa m in [SUB_BUCKETS, 2 * SUB_BUCKETS); its bucket is
+ * e * SUB_BUCKETS + m.
+ */
+static unsigned int bucket_index(uint64_t value)
+{
+    if (value < 2 * SUB_BUCKETS) {
+        return value;
+    }
+    unsigned int msb = 63 - __builtin_clzll(value);
+    unsigned int shift = msb - HDRHIST_SUB_BUCKET_BITS;
+    return shift * SUB_BUCKETS + (value >> shift);
+}
+
+/**
+ * Get the highest value counted in a bucket
+ */
+static uint64_t bucket_highest_value(unsigned int index)
+{
+    if (index < 2 * SUB_BUCKETS) {
+        return index;
+    }
+    unsigned int shift = index / SUB_BUCKETS - 1;
+    uint64_t mantissa = index - shift * SUB_BUCKETS;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void hdrhist_reset(struct hdrhist *hist)
+{
+    memset(hist, 0, sizeof(struct hdrhist));
+}
+
+void hdrhist_record(struct hdrhist *hist, uint64_t value)
+{
+    unsigned int index = bucket_index(value);
+    assert(index < HDRHIST_BUCKETS);
+    hist->buckets[index]++;
+
+    if (hist->count == 0 || value < hist->min) {
+        hist->min = value;
+    }
+    if (value > hist->max) {
+        hist->max = value;
+    }
+    hist->count++;
+    hist->sum += value;
+}
+
+uint64_t hdrhist_percentile(const struct hdrhist *hist, double percentile)
+{
+    if (hist->count == 0) {
+        return 0;
+    }
+
+    // rank of the percentile value, starting at 1
+    uint64_t rank = (uint64_t)(percentile / 100.0 * hist->count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < HDRHIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= rank) {
+            uint64_t value = bucket_highest_value(i);
+            return value < hist->max ? value : hist->max;
+        }
+    }
+    return hist->max;
+}
@@ -0,0 +1,74 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HDRHIST_H
+#define HDRHIST_H
+
+#include <stdint.h>
+
+/**
+ * High dynamic range histogram
+ *
+ * Records values over the full uint64_t range with a bounded relative error
+ * (log-linear buckets, as in HdrHistogram): values below
+ * 2^(HDRHIST_SUB_BUCKET_BITS + 1) are counted exactly, larger values in
+ * buckets of 2^HDRHIST_SUB_BUCKET_BITS equally sized sub-buckets per power
+ * of two. With 5 sub-bucket bits, percentiles are accurate to about 3%.
+ *
+ * Recording a value is a few arithmetic instructions and one increment, the
+ * histogram doesn't allocate memory. It is not thread-safe.
+ */
+
+/** Number of bits of a value resolved within a power of two */
+#define HDRHIST_SUB_BUCKET_BITS 5
+
+/** Number of buckets */
+#define HDRHIST_BUCKETS \
+    ((64 - HDRHIST_SUB_BUCKET_BITS + 1) << HDRHIST_SUB_BUCKET_BITS)
+
+struct hdrhist {
+    /** Number of recorded values */
+    uint64_t count;
+    /** Sum of all recorded values */
+    uint64_t sum;
+    /** Smallest recorded value (undefined if count is 0) */
+    uint64_t min;
+    /** Largest recorded value */
+    uint64_t max;
+    /** Number of values per bucket */
+    uint64_t buckets[HDRHIST_BUCKETS];
+};
+
+/**
+ * Remove all recorded values
+ */
+void hdrhist_reset(struct hdrhist *hist);
+
+/**
+ * Record a value
+ */
+void hdrhist_record(struct hdrhist *hist, uint64_t value);
+
+/**
+ * Get a percentile
+ *
+ * @param percentile the percentile (0..100)
+ * @return the highest value equivalent to the percentile value (i.e. in the
+ *         same bucket), capped by the largest recorded value, or 0 if no
+ *         values were recorded
+ */
+uint64_t hdrhist_percentile(const struct hdrhist *hist, double percentile);
+
+#endif  // HDRHIST_H
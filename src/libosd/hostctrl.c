@@ -16,11 +16,26 @@
 #include <osd/hostctrl.h>
 #include <osd/osd.h>
 #include <osd/packet.h>
+#include <osd/reg.h>
 #include "osd-private.h"
+#include "capture.h"
+#include "flightrec.h"
+#include "fq.h"
+#include "latency.h"
+#include "overload.h"
+#include "proto.h"
+#include "rxfilter.h"
+#include "shm.h"
+#include "stats.h"
+#include "tclass.h"
+#include "trace.h"
+#include "trigger.h"
 #include "worker.h"
+#include "wirecomp.h"
 
 #include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <string.h>
 
@@ -39,278 +54,1968 @@ struct osd_hostctrl_ctx {
 
     /** Is the router running? */
     bool is_running;
+
+    /** Flow control mode */
+    enum osd_flowctrl_mode flowctrl_mode;
+
+    /** Flow control statistics, summed up over all clients */
+    struct osd_flowctrl_stats flowctrl_stats;
+
+    /** Traffic statistics */
+    struct stats_registry *stats;
+};
+
+/**
+ * Maximum number of data messages from one source queued for a single client
+ * (per traffic class)
+ *
+ * Data messages are queued in the host controller if the ZeroMQ send queue
+ * to a client is full. If the client falls behind even further, new messages
+ * to it are dropped. Other clients are not affected by a slow client.
+ *
+ * The queue towards a client is shared fairly between the sources (see
+ * fq.h): a source flooding a client only fills its own part of the queue.
+ */
+#define PEER_TX_QUEUE_MAX 4096
+
+/**
+ * Flow control: stop granting credits to a source if more than this number
+ * of its messages are queued (lossless mode only)
+ */
+#define PEER_TX_QUEUE_HIGH (PEER_TX_QUEUE_MAX / 2)
+
+/**
+ * Flow control: start granting credits to a source again once less than
+ * this number of its messages are queued
+ */
+#define PEER_TX_QUEUE_LOW (PEER_TX_QUEUE_MAX / 4)
+
+/**
+ * Overload control: stall further trace modules each time this number of
+ * messages of a congested gateway were queued in addition
+ */
+#define PEER_TX_QUEUE_OVERLOAD_STEP \
+    ((PEER_TX_QUEUE_MAX - PEER_TX_QUEUE_HIGH) / 4)
+
+/** Overload control: maximum number of trace modules stalled at once */
+#define OVERLOAD_STALL_MAX 8
+
+/** Maximum size of a ZeroMQ identity (bytes) */
+#define HOSTADDR_MAX_SIZE 255
+
+/** Interval in which sending queued data messages is retried (ms) */
+#define PEER_TX_RETRY_INTERVAL_MS 1
+
+/** Maximum number of trace triggers */
+#define TRACE_TRIGGERS_MAX 16
+
+/**
+ * A data message payload shared between multiple receivers
+ *
+ * The frame is sent with ZFRAME_REUSE, which lets ZeroMQ reference count the
+ * message data instead of copying it for every receiver. (ZeroMQ still
+ * copies very small messages, which is cheaper than reference counting.)
+ */
+struct shared_frame {
+    /** The DI packet */
+    zframe_t *frame;
+
+    /** Trace record of the packet (see latency.h), or NULL */
+    zframe_t *trace;
+
+    /** Number of users of this object */
+    unsigned int refcount;
+};
+
+/**
+ * A client of the host controller (a host module or a gateway)
+ */
+struct peer {
+    /** ZeroMQ identity of the client */
+    zframe_t *hostaddr;
+
+    /** Protocol version spoken by the client */
+    int proto_version;
+
+    /** Sequence number of the next version 2 data message to the client */
+    uint32_t tx_seq;
+
+    /**
+     * Data messages waiting to be sent (struct shared_frame), one fair queue
+     * per traffic class. The source of the messages is the sending
+     * struct peer, or NULL for unregistered senders.
+     */
+    struct fq *tx_queue[OSD_TCLASS_COUNT];
+
+    /** Scheduler choosing the traffic class to send next */
+    struct tclass_sched tx_sched;
+
+    /** Number of data messages to this client dropped */
+    uint64_t tx_dropped;
+
+    /** Flow control: credits granted to the client */
+    struct proto_credit_rx rx_credit;
+
+    /** Flow control: has the client granted us credits? */
+    bool tx_flowctrl;
+
+    /** Flow control: credits for data messages to the client */
+    uint32_t tx_credits;
+
+    /** Flow control: start of the current stall (us), 0 if not stalled */
+    int64_t tx_stall_start_us;
+
+    /**
+     * Flow control: number of bulk messages from this client waiting in
+     * queues to other clients
+     */
+    size_t src_queued;
+
+    /**
+     * Flow control: are too many messages of this client queued? No credits
+     * are granted to the client in this state (lossless mode only).
+     */
+    bool is_congested;
+
+    /**
+     * Overload control: number of queued messages of this client (a
+     * gateway) at which the next trace modules are stalled
+     */
+    size_t overload_next_stall;
+
+    /** Statistics: data messages received from this client */
+    uint64_t *rx_packets;
+
+    /** Statistics: data bytes (DI packets) received from this client */
+    uint64_t *rx_bytes;
+
+    /** Statistics: data messages sent to this client */
+    uint64_t *tx_packets;
+
+    /** Statistics: data bytes (DI packets) sent to this client */
+    uint64_t *tx_bytes;
+
+    /** Statistics: data messages to this client which were dropped */
+    uint64_t *tx_dropped_total;
+
+    /**
+     * Number of subnets the client is registered as gateway for. All
+     * subnets of a gateway serving several devices share one client.
+     */
+    unsigned int gw_subnets;
+};
+
+/**
+ * Statistics of the router (see stats.h)
+ */
+struct router_stats {
+    /** Data messages received */
+    uint64_t *rx_packets;
+
+    /** Data bytes (DI packets) received */
+    uint64_t *rx_bytes;
+
+    /** Data messages without valid DI packet */
+    uint64_t *invalid_packets;
+
+    /** Data messages without registered destination */
+    uint64_t *route_miss;
+
+    /** Management requests received */
+    uint64_t *mgmt_requests;
+
+    /** Messages in the queue to a client when a message is queued */
+    struct stats_hist *tx_queue_depth;
+
+    /** Routed packets written to the capture file */
+    uint64_t *capture_records;
+
+    /** Routed packets not captured since the capture writer fell behind */
+    uint64_t *capture_dropped;
+
+    /** Flight recorder dumps started */
+    uint64_t *flightrec_dumps;
+
+    /** Trace triggers fired */
+    uint64_t *trace_triggers;
+
+    /** Compressed bytes of compressed data messages */
+    uint64_t *decompress_in_bytes;
+
+    /** Uncompressed bytes of compressed data messages */
+    uint64_t *decompress_out_bytes;
+
+    /** Time spent decompressing (ns) */
+    uint64_t *decompress_ns;
+
+    /** Trace modules stalled by the overload control */
+    uint64_t *overload_stalls;
+
+    /** Sum of the durations of all ended stalls of trace modules (us) */
+    uint64_t *overload_stall_time_us;
+
+    /** Data messages routed into each subnet (registered on first use) */
+    uint64_t *route_packets[OSD_DIADDR_SUBNET_MAX + 1];
+
+    /** Data bytes routed into each subnet (registered on first use) */
+    uint64_t *route_bytes[OSD_DIADDR_SUBNET_MAX + 1];
+};
+
+/**
+ * A trace trigger: a packet pattern arming a flight recorder window
+ */
+struct trace_trigger {
+    struct trigger *trigger;
+
+    /** Records before the trigger to dump (including the trigger) */
+    unsigned int pre_packets;
+
+    /** Records after the trigger to dump */
+    unsigned int post_packets;
 };
 
 struct iothread_usr_ctx {
     /** Host controller router socket */
     zsock_t *router_socket;
 
-    /** ZeroMQ address/URL this host controller is bound to */
-    char *router_address;
+    /** ZeroMQ address/URL this host controller is bound to */
+    char *router_address;
+
+    /** Shared-memory connections, if router_address is a shm:// URL */
+    struct shm_listener *shm_listener;
+
+    /** Our DI subnet address */
+    unsigned int subnet_addr;
+
+    /** Debug modules registered in this subnet */
+    struct peer **mods_in_subnet;
+
+    /** Gateways registered in this subnet */
+    struct peer **gateways;
+
+    /**
+     * Subscribers to EVENT packets (lists of struct peer), indexed by the
+     * local part of the DI address they subscribed to
+     */
+    zlist_t **subscribers;
+
+    /** ID of the timer retrying queued messages, -1 if not active */
+    int tx_retry_timer_id;
+
+    /** All clients, indexed by their ZeroMQ identity (see hostaddr_key()) */
+    zhash_t *peers_by_hostaddr;
+
+    /** Flow control mode */
+    enum osd_flowctrl_mode flowctrl_mode;
+
+    /** Flow control statistics (owned by struct osd_hostctrl_ctx) */
+    struct osd_flowctrl_stats *flowctrl_stats;
+
+    /** Traffic class scheduling: control weight for new clients */
+    unsigned int tclass_control_weight;
+
+    /** Statistics registry (owned by struct osd_hostctrl_ctx) */
+    struct stats_registry *stats;
+
+    /** Frequently updated statistics */
+    struct router_stats router_stats;
+
+    /** Stats endpoint socket, NULL if no endpoint is bound */
+    zsock_t *stats_socket;
+
+    /** Capture of all routed packets, NULL if not capturing */
+    struct capture_writer *capture;
+
+    /** Flight recorder, NULL if disabled */
+    struct flightrec *flightrec;
+
+    /** Trace triggers arming flight recorder windows */
+    struct trace_trigger trace_triggers[TRACE_TRIGGERS_MAX];
+    unsigned int trace_triggers_count;
+
+    /** Overload control, NULL if disabled */
+    struct overload *overload;
+};
+
+/**
+ * Configuration of a trace trigger, passed to the I/O thread
+ */
+struct trace_trigger_config {
+    /** The pattern (see trigger.h) */
+    const char *pattern;
+
+    /** Packets before the trigger to dump */
+    unsigned int pre_packets;
+
+    /** Packets after the trigger to dump */
+    unsigned int post_packets;
+};
+
+/**
+ * Configuration of the flight recorder, passed to the I/O thread
+ */
+struct flightrec_config {
+    /** Size of the flight recorder (bytes), 0 to disable it */
+    size_t size;
+
+    /** Base name of the dump files */
+    const char *dump_filename;
+};
+
+/**
+ * A management request received from a client
+ */
+struct mgmt_req {
+    /** Sender of the request */
+    const zframe_t *src;
+
+    /** Protocol version the request was sent in */
+    int proto_version;
+
+    /** Sequence number of the request (protocol version 2 only) */
+    uint32_t seq;
+};
+
+/**
+ * Create a shared frame
+ *
+ * @param frame_p the frame to share. Ownership is passed on to the new object.
+ */
+static struct shared_frame *shared_frame_new(zframe_t **frame_p)
+{
+    assert(frame_p && *frame_p);
+
+    struct shared_frame *sf = calloc(1, sizeof(struct shared_frame));
+    assert(sf);
+    sf->frame = *frame_p;
+    sf->refcount = 1;
+    *frame_p = NULL;
+    return sf;
+}
+
+static struct shared_frame *shared_frame_ref(struct shared_frame *sf)
+{
+    assert(sf);
+    sf->refcount++;
+    return sf;
+}
+
+static void shared_frame_unref(struct shared_frame **sf_p)
+{
+    assert(sf_p);
+    struct shared_frame *sf = *sf_p;
+    if (!sf) {
+        return;
+    }
+
+    assert(sf->refcount > 0);
+    sf->refcount--;
+    if (sf->refcount == 0) {
+        zframe_destroy(&sf->frame);
+        zframe_destroy(&sf->trace);
+        free(sf);
+    }
+    *sf_p = NULL;
+}
+
+static size_t shared_frame_size(const void *sf_void)
+{
+    const struct shared_frame *sf = sf_void;
+    return zframe_size(sf->frame);
+}
+
+static struct peer *peer_new(const zframe_t *hostaddr, int proto_version)
+{
+    struct peer *p = calloc(1, sizeof(struct peer));
+    assert(p);
+    p->hostaddr = zframe_dup_c(hostaddr);
+    p->proto_version = proto_version;
+    for (int c = 0; c < OSD_TCLASS_COUNT; c++) {
+        p->tx_queue[c] = fq_new(shared_frame_size, PEER_TX_QUEUE_MAX);
+    }
+    tclass_sched_init(&p->tx_sched, OSD_TCLASS_WEIGHT_STRICT);
+    return p;
+}
+
+/**
+ * Account for a message removed from a queue
+ *
+ * @param src the source of the message (may be NULL)
+ */
+static void peer_src_dequeued(struct peer *src, enum osd_traffic_class tclass)
+{
+    if (src && tclass == OSD_TCLASS_BULK) {
+        assert(src->src_queued > 0);
+        src->src_queued--;
+    }
+}
+
+/**
+ * Drop all data messages queued for a client
+ *
+ * @return the number of dropped messages
+ */
+static size_t peer_tx_queue_clear(struct peer *p)
+{
+    size_t dropped = 0;
+    for (int c = 0; c < OSD_TCLASS_COUNT; c++) {
+        const void *src;
+        struct shared_frame *sf;
+        while ((sf = fq_pop_any(p->tx_queue[c], &src))) {
+            peer_src_dequeued((struct peer *)src, c);
+            shared_frame_unref(&sf);
+            dropped++;
+        }
+    }
+    p->tx_dropped += dropped;
+    stats_counter_add(p->tx_dropped_total, dropped);
+    return dropped;
+}
+
+/**
+ * Free a client
+ *
+ * Messages still queued for the client are dropped without updating the
+ * accounting of their sources, use peer_remove() for clients in use.
+ */
+static void peer_free(struct peer **peer_p)
+{
+    assert(peer_p);
+    struct peer *p = *peer_p;
+    if (!p) {
+        return;
+    }
+
+    for (int c = 0; c < OSD_TCLASS_COUNT; c++) {
+        struct shared_frame *sf;
+        while ((sf = fq_pop_any(p->tx_queue[c], NULL))) {
+            shared_frame_unref(&sf);
+        }
+        fq_free(&p->tx_queue[c]);
+    }
+    zframe_destroy(&p->hostaddr);
+    free(p);
+    *peer_p = NULL;
+}
+
+/**
+ * Get a string representation of a ZeroMQ identity usable as hash key
+ */
+static void hostaddr_key(const zframe_t *hostaddr,
+                         char key[2 * HOSTADDR_MAX_SIZE + 1])
+{
+    static const char hex_chars[] = "0123456789ABCDEF";
+
+    size_t size = zframe_size((zframe_t *)hostaddr);
+    assert(size <= HOSTADDR_MAX_SIZE);
+    const byte *data = zframe_data((zframe_t *)hostaddr);
+    for (size_t i = 0; i < size; i++) {
+        key[2 * i] = hex_chars[data[i] >> 4];
+        key[2 * i + 1] = hex_chars[data[i] & 0xf];
+    }
+    key[2 * size] = '\0';
+}
+
+/**
+ * Find a client by its ZeroMQ identity
+ *
+ * @return the client, or NULL if no client with this identity is registered
+ */
+static struct peer *find_peer_by_hostaddr(struct iothread_usr_ctx *usrctx,
+                                          const zframe_t *hostaddr)
+{
+    char key[2 * HOSTADDR_MAX_SIZE + 1];
+    hostaddr_key(hostaddr, key);
+    return zhash_lookup(usrctx->peers_by_hostaddr, key);
+}
+
+/**
+ * Find a client registered as gateway by its ZeroMQ identity
+ *
+ * @return the client, or NULL if no gateway with this identity is registered
+ */
+static struct peer *find_gateway_by_hostaddr(struct iothread_usr_ctx *usrctx,
+                                             const zframe_t *hostaddr)
+{
+    for (unsigned int i = 0; i <= OSD_DIADDR_SUBNET_MAX; i++) {
+        struct peer *p = usrctx->gateways[i];
+        if (p && zframe_eq_c(p->hostaddr, hostaddr)) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Is @p subnet the first subnet of the gateway registered for it?
+ *
+ * Used to visit gateways serving several subnets only once.
+ */
+static bool gateway_is_first_subnet(struct iothread_usr_ctx *usrctx,
+                                    unsigned int subnet)
+{
+    for (unsigned int i = 0; i < subnet; i++) {
+        if (usrctx->gateways[i] == usrctx->gateways[subnet]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Register a new client
+ *
+ * @param slot location in the routing tables to store the client in
+ * @param stats_prefix prefix of the names of the client's statistics. The
+ *                     statistics of a client re-using the name of an earlier
+ *                     client continue where the earlier client left off.
+ */
+static void peer_add(struct iothread_usr_ctx *usrctx, struct peer **slot,
+                     const zframe_t *hostaddr, int proto_version,
+                     const char *stats_prefix)
+{
+    assert(*slot == NULL);
+    *slot = peer_new(hostaddr, proto_version);
+    tclass_sched_init(&(*slot)->tx_sched, usrctx->tclass_control_weight);
+
+    struct peer *p = *slot;
+    p->rx_packets = stats_counter(usrctx->stats, "%s.rx_packets", stats_prefix);
+    p->rx_bytes = stats_counter(usrctx->stats, "%s.rx_bytes", stats_prefix);
+    p->tx_packets = stats_counter(usrctx->stats, "%s.tx_packets", stats_prefix);
+    p->tx_bytes = stats_counter(usrctx->stats, "%s.tx_bytes", stats_prefix);
+    p->tx_dropped_total =
+        stats_counter(usrctx->stats, "%s.tx_dropped", stats_prefix);
+
+    // A client registered multiple times (e.g. as host module and as
+    // gateway) is tracked with its first registration only.
+    char key[2 * HOSTADDR_MAX_SIZE + 1];
+    hostaddr_key(hostaddr, key);
+    zhash_insert(usrctx->peers_by_hostaddr, key, *slot);
+}
+
+/**
+ * Remove a client registered with peer_add()
+ */
+static void peer_remove(struct iothread_usr_ctx *usrctx, struct peer **slot)
+{
+    struct peer *p = *slot;
+    if (!p) {
+        return;
+    }
+
+    char key[2 * HOSTADDR_MAX_SIZE + 1];
+    hostaddr_key(p->hostaddr, key);
+    if (zhash_lookup(usrctx->peers_by_hostaddr, key) == p) {
+        zhash_delete(usrctx->peers_by_hostaddr, key);
+    }
+
+    // messages of the client queued for other clients are still delivered,
+    // but not accounted to the client any more
+    for (unsigned int i = 0; i <= OSD_DIADDR_LOCAL_MAX; i++) {
+        struct peer *other = usrctx->mods_in_subnet[i];
+        for (int c = 0; other && c < OSD_TCLASS_COUNT; c++) {
+            fq_forget_src(other->tx_queue[c], p);
+        }
+    }
+    for (unsigned int i = 0; i <= OSD_DIADDR_SUBNET_MAX; i++) {
+        struct peer *other = usrctx->gateways[i];
+        for (int c = 0; other && c < OSD_TCLASS_COUNT; c++) {
+            fq_forget_src(other->tx_queue[c], p);
+        }
+    }
+
+    stats_counter_add(&usrctx->flowctrl_stats->dropped,
+                      peer_tx_queue_clear(p));
+    if (p->tx_flowctrl) {
+        stats_counter_add(&usrctx->flowctrl_stats->tx_credits,
+                          -(int64_t)p->tx_credits);
+    }
+    if (p->tx_stall_start_us) {
+        stats_counter_add(&usrctx->flowctrl_stats->tx_stall_time_us,
+                          zclock_usecs() - p->tx_stall_start_us);
+    }
+
+    peer_free(slot);
+}
+
+/**
+ * Find the host module with a given ZeroMQ identity
+ *
+ * @param[out] localaddr local part of the DI address of the module. Set to NULL
+ *                       if not needed.
+ * @return the module, or NULL if no module with this identity is registered
+ */
+static struct peer *find_module_by_hostaddr(struct iothread_usr_ctx *usrctx,
+                                            const zframe_t *hostaddr,
+                                            unsigned int *localaddr)
+{
+    for (unsigned int i = 1; i <= OSD_DIADDR_LOCAL_MAX; i++) {
+        if (usrctx->mods_in_subnet[i] &&
+            zframe_eq_c(usrctx->mods_in_subnet[i]->hostaddr, hostaddr)) {
+            if (localaddr) {
+                *localaddr = i;
+            }
+            return usrctx->mods_in_subnet[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Send a message through the router socket without blocking
+ *
+ * The router socket is in ROUTER_MANDATORY mode: if the receive queue of the
+ * destination is full, the message is not silently dropped, but this function
+ * fails with errno set to EAGAIN. If the destination is not connected (any
+ * more), errno is set to EHOSTUNREACH.
+ *
+ * All frames are sent with ZFRAME_REUSE and remain owned by the caller.
+ *
+ * @param dest ZeroMQ identity of the receiver
+ * @param frames frames of the message following the identity frame
+ * @param frames_len number of entries in @p frames
+ * @return 0 if the message was sent, -1 otherwise
+ */
+static int router_send(zsock_t *sock, const zframe_t *dest, zframe_t **frames,
+                       size_t frames_len)
+{
+    int zmq_rv;
+
+    zframe_t *dest_frame = (zframe_t *)dest;
+    zmq_rv = zframe_send(&dest_frame, sock,
+                         ZFRAME_MORE | ZFRAME_REUSE | ZFRAME_DONTWAIT);
+    if (zmq_rv != 0) {
+        return -1;
+    }
+
+    // once the identity frame has been accepted, the rest of the message is
+    // accepted as well
+    for (size_t i = 0; i < frames_len; i++) {
+        int flags = ZFRAME_REUSE | ZFRAME_DONTWAIT;
+        if (i + 1 < frames_len) {
+            flags |= ZFRAME_MORE;
+        }
+        zmq_rv = zframe_send(&frames[i], sock, flags);
+        assert(zmq_rv == 0);
+    }
+
+    return 0;
+}
+
+/**
+ * Get an available address in the local subnet
+ */
+static osd_result get_available_diaddr(struct worker_thread_ctx *thread_ctx,
+                                       unsigned int *diaddr)
+{
+    assert(thread_ctx);
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    unsigned int localaddr;
+    for (localaddr = 1; localaddr <= OSD_DIADDR_LOCAL_MAX; localaddr++) {
+        if (usrctx->mods_in_subnet[localaddr] == NULL) {
+            *diaddr = osd_diaddr_build(usrctx->subnet_addr, localaddr);
+            return OSD_OK;
+        }
+    }
+
+    return OSD_ERROR_FAILURE;
+}
+
+/**
+ * Register a host address for a given DI address
+ */
+static osd_result register_diaddr(struct worker_thread_ctx *thread_ctx,
+                                  const zframe_t *hostaddr, unsigned int diaddr,
+                                  int proto_version)
+{
+    assert(thread_ctx);
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    unsigned int localaddr = osd_diaddr_localaddr(diaddr);
+    if (usrctx->mods_in_subnet[localaddr] != NULL) {
+        return OSD_ERROR_FAILURE;
+    }
+    char stats_prefix[32];
+    snprintf(stats_prefix, sizeof(stats_prefix), "client.%u", diaddr);
+    peer_add(usrctx, &usrctx->mods_in_subnet[localaddr], hostaddr,
+             proto_version, stats_prefix);
+
+#ifdef DEBUG
+    char *hostaddr_str = zframe_strhex((zframe_t *)hostaddr);
+    dbg(thread_ctx->log_ctx,
+        "Registered diaddr %u.%u (%u) for host module %s "
+        "(protocol version %d)",
+        osd_diaddr_subnet(diaddr), osd_diaddr_localaddr(diaddr), diaddr,
+        hostaddr_str, proto_version);
+    free(hostaddr_str);
+#endif
+
+    return OSD_OK;
+}
+
+/**
+ * Send a management message to a client
+ *
+ * @param msg the message without the destination frame. Ownership of the
+ *            message is passed on to this function.
+ */
+static void mgmt_send(struct worker_thread_ctx *thread_ctx,
+                      const zframe_t *dest, zmsg_t **msg)
+{
+    assert(thread_ctx);
+    assert(dest);
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    zframe_t *frames[2];
+    size_t frames_len = 0;
+    for (zframe_t *f = zmsg_first(*msg); f; f = zmsg_next(*msg)) {
+        assert(frames_len < sizeof(frames) / sizeof(frames[0]));
+        frames[frames_len++] = f;
+    }
+
+    int zmq_rv = router_send(usrctx->router_socket, dest, frames, frames_len);
+    if (zmq_rv != 0) {
+        err(thread_ctx->log_ctx, "Unable to send management message: %s (%d)",
+            strerror(errno), errno);
+    }
+    zmsg_destroy(msg);
+}
+
+/**
+ * Send a management response of a given status ("ACK" or "NACK")
+ */
+static void mgmt_send_status(struct worker_thread_ctx *thread_ctx,
+                             const struct mgmt_req *req, bool success)
+{
+    zmsg_t *msg;
+    if (req->proto_version == PROTO_VERSION_2) {
+        msg = proto_msg_new(success ? PROTO_OP_ACK : PROTO_OP_NACK, req->seq);
+    } else {
+        msg = zmsg_new();
+        assert(msg);
+        zmsg_addstr(msg, "M");
+        zmsg_addstr(msg, success ? "ACK" : "NACK");
+    }
+    mgmt_send(thread_ctx, req->src, &msg);
+}
+
+static void mgmt_send_ack(struct worker_thread_ctx *thread_ctx,
+                          const struct mgmt_req *req)
+{
+    mgmt_send_status(thread_ctx, req, true);
+}
+
+static void mgmt_send_nack(struct worker_thread_ctx *thread_ctx,
+                           const struct mgmt_req *req)
+{
+    mgmt_send_status(thread_ctx, req, false);
+}
+
+/**
+ * Flow control: grant credits to a client if needed
+ *
+ * Credits are granted to all clients speaking protocol version 2. In lossless
+ * mode no credits are granted to a client while too many of its messages are
+ * queued; the client stalls until the receivers caught up.
+ */
+static void peer_grant_credits(struct worker_thread_ctx *thread_ctx,
+                               struct peer *p)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    if (p->proto_version != PROTO_VERSION_2) {
+        return;
+    }
+    if (p->is_congested && usrctx->flowctrl_mode == OSD_FLOWCTRL_LOSSLESS) {
+        return;
+    }
+
+    uint32_t credits = proto_credit_rx_refill(&p->rx_credit);
+    if (credits == 0) {
+        return;
+    }
+
+    zmsg_t *msg = proto_msg_new_u32(PROTO_OP_CREDIT, p->tx_seq++, credits);
+    mgmt_send(thread_ctx, p->hostaddr, &msg);
+}
+
+static void send_data_to_peer(struct worker_thread_ctx *thread_ctx,
+                              struct peer *src, struct peer *dest,
+                              struct shared_frame *payload,
+                              enum osd_traffic_class tclass);
+
+/**
+ * Get the subnets a gateway is registered for (bit N for subnet N)
+ */
+static uint64_t gateway_subnets(struct iothread_usr_ctx *usrctx,
+                                const struct peer *gw)
+{
+    uint64_t subnets = 0;
+    for (unsigned int i = 0; i <= OSD_DIADDR_SUBNET_MAX; i++) {
+        if (usrctx->gateways[i] == gw) {
+            subnets |= 1ULL << i;
+        }
+    }
+    return subnets;
+}
+
+/**
+ * Overload control: stall or resume a trace module
+ *
+ * The control and status register of the module is written with a request
+ * from the (never assigned) local address 0 of our subnet. The response is
+ * consumed in process_data_msg().
+ */
+static void overload_write_cs(struct worker_thread_ctx *thread_ctx,
+                              uint16_t diaddr, bool active)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    struct peer *gw = usrctx->gateways[osd_diaddr_subnet(diaddr)];
+    if (!gw) {
+        return;
+    }
+
+    struct osd_packet *pkg;
+    osd_result rv =
+        osd_packet_new(&pkg, osd_packet_get_data_size_words_from_payload(2));
+    assert(OSD_SUCCEEDED(rv));
+    osd_packet_set_header(pkg, diaddr,
+                          osd_diaddr_build(usrctx->subnet_addr, 0),
+                          OSD_PACKET_TYPE_REG, REQ_WRITE_REG_16);
+    pkg->data.payload[0] = OSD_REG_BASE_MOD_CS;
+    pkg->data.payload[1] = active ? OSD_REG_BASE_MOD_CS_ACTIVE : 0;
+
+    zframe_t *frame = zframe_new(pkg->data_raw, osd_packet_sizeof(pkg));
+    assert(frame);
+    osd_packet_free(&pkg);
+
+    struct shared_frame *payload = shared_frame_new(&frame);
+    send_data_to_peer(thread_ctx, NULL, gw, payload, OSD_TCLASS_CONTROL);
+    shared_frame_unref(&payload);
+}
+
+/**
+ * Overload control: stall the trace modules behind a gateway which sent the
+ * most trace packets recently
+ */
+static void overload_stall_noisiest(struct worker_thread_ctx *thread_ctx,
+                                    struct peer *gw)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    uint16_t diaddrs[OVERLOAD_STALL_MAX];
+    size_t count = overload_select(usrctx->overload,
+                                   gateway_subnets(usrctx, gw), diaddrs,
+                                   OVERLOAD_STALL_MAX);
+    if (count == 0) {
+        dbg(thread_ctx->log_ctx, "Overload, but no trace module to stall.");
+        return;
+    }
+
+    int64_t now_us = zclock_usecs();
+    for (size_t i = 0; i < count; i++) {
+        overload_stall(usrctx->overload, diaddrs[i], now_us);
+        overload_write_cs(thread_ctx, diaddrs[i], false);
+        stats_counter_add(usrctx->router_stats.overload_stalls, 1);
+        info(thread_ctx->log_ctx,
+             "Overload: stalling trace module %u.%u, its trace data is "
+             "missing until the stall ends.",
+             osd_diaddr_subnet(diaddrs[i]), osd_diaddr_localaddr(diaddrs[i]));
+    }
+}
+
+/**
+ * Overload control: end the stalls of all trace modules in some subnets
+ *
+ * @param subnets the subnets (bit N for subnet N)
+ * @param resume resume the modules (false if the gateway is gone)
+ */
+static void overload_end_stalls(struct worker_thread_ctx *thread_ctx,
+                                uint64_t subnets, bool resume)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    uint16_t diaddr;
+    int64_t now_us = zclock_usecs();
+    while (overload_find_stalled(usrctx->overload, subnets, &diaddr)) {
+        int64_t stall_start_us = overload_resume(usrctx->overload, diaddr);
+        if (resume) {
+            overload_write_cs(thread_ctx, diaddr, true);
+        }
+        stats_counter_add(usrctx->router_stats.overload_stall_time_us,
+                          now_us - stall_start_us);
+        info(thread_ctx->log_ctx,
+             "Overload: stall of trace module %u.%u ended, its trace data "
+             "of the last %.3f ms is missing.",
+             osd_diaddr_subnet(diaddr), osd_diaddr_localaddr(diaddr),
+             (now_us - stall_start_us) / 1000.0);
+    }
+}
+
+/**
+ * Flow control: leave the congested state for a client once few enough of
+ * its messages are queued
+ *
+ * Trace modules stalled by the overload control behind a gateway are resumed
+ * at the same time.
+ */
+static void peer_update_congestion(struct worker_thread_ctx *thread_ctx,
+                                   struct peer *p)
+{
+    if (!p || !p->is_congested || p->src_queued > PEER_TX_QUEUE_LOW) {
+        return;
+    }
+
+    dbg(thread_ctx->log_ctx, "Queues drained, granting credits again.");
+    p->is_congested = false;
+    peer_grant_credits(thread_ctx, p);
+
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    if (usrctx->overload && p->gw_subnets) {
+        overload_end_stalls(thread_ctx, gateway_subnets(usrctx, p), true);
+    }
+}
+
+/**
+ * Flow control: leave the congested state for all clients whose messages
+ * have been sent
+ */
+static void update_congestion(struct worker_thread_ctx *thread_ctx)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    for (unsigned int i = 0; i <= OSD_DIADDR_LOCAL_MAX; i++) {
+        peer_update_congestion(thread_ctx, usrctx->mods_in_subnet[i]);
+    }
+    for (unsigned int i = 0; i <= OSD_DIADDR_SUBNET_MAX; i++) {
+        peer_update_congestion(thread_ctx, usrctx->gateways[i]);
+    }
+}
+
+/**
+ * Answer a protocol version negotiation request
+ */
+static void mgmt_proto_hello(struct worker_thread_ctx *thread_ctx,
+                             const struct mgmt_req *req, const char *params)
+{
+    char *end;
+    long int client_version = strtol(params, &end, 10);
+    if (*end || client_version < PROTO_VERSION_1) {
+        err(thread_ctx->log_ctx, "Invalid protocol version '%s' requested.",
+            params);
+        return mgmt_send_nack(thread_ctx, req);
+    }
+
+    int version = PROTO_VERSION_MAX;
+    if (client_version < version) {
+        version = client_version;
+    }
+
+    zmsg_t *msg = zmsg_new();
+    assert(msg);
+    zmsg_addstr(msg, "M");
+    zmsg_addstrf(msg, "%s %d", PROTO_HELLO_RESPONSE, version);
+    mgmt_send(thread_ctx, req->src, &msg);
+}
+
+/**
+ * Assign a new DI address to a host module in our subnet
+ */
+static void mgmt_diaddr_request(struct worker_thread_ctx *thread_ctx,
+                                const struct mgmt_req *req)
+{
+    assert(thread_ctx);
+    assert(req);
+
+    osd_result rv;
+    unsigned int diaddr;
+    rv = get_available_diaddr(thread_ctx, &diaddr);
+    // XXX: Return error to host module instead of failing hard
+    assert(OSD_SUCCEEDED(rv));
+
+    rv = register_diaddr(thread_ctx, req->src, diaddr, req->proto_version);
+    assert(OSD_SUCCEEDED(rv));
+
+    zmsg_t *msg;
+    if (req->proto_version == PROTO_VERSION_2) {
+        msg = proto_msg_new_u16(PROTO_OP_DIADDR_RESPONSE, req->seq, diaddr);
+    } else {
+        msg = zmsg_new();
+        assert(msg);
+        zmsg_addstr(msg, "M");
+        zmsg_addstrf(msg, "%u", diaddr);
+    }
+    mgmt_send(thread_ctx, req->src, &msg);
+
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    peer_grant_credits(thread_ctx,
+                       usrctx->mods_in_subnet[osd_diaddr_localaddr(diaddr)]);
+}
+
+static void mgmt_diaddr_release(struct worker_thread_ctx *thread_ctx,
+                                const struct mgmt_req *req)
+{
+    assert(thread_ctx);
+    assert(req);
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    unsigned int localaddr;
+    struct peer *mod = find_module_by_hostaddr(usrctx, req->src, &localaddr);
+    if (!mod) {
+        err(thread_ctx->log_ctx,
+            "Trying to release address for host which "
+            "isn't registered.");
+        return mgmt_send_nack(thread_ctx, req);
+    }
+
+    // end all subscriptions of the module
+    for (unsigned int i = 0; i <= OSD_DIADDR_LOCAL_MAX; i++) {
+        if (usrctx->subscribers[i]) {
+            zlist_remove(usrctx->subscribers[i], mod);
+            if (zlist_size(usrctx->subscribers[i]) == 0) {
+                zlist_destroy(&usrctx->subscribers[i]);
+            }
+        }
+    }
+
+    if (mod->tx_dropped) {
+        info(thread_ctx->log_ctx,
+             "%" PRIu64 " data messages to host module %u were dropped.",
+             mod->tx_dropped, localaddr);
+    }
+
+    peer_remove(usrctx, &usrctx->mods_in_subnet[localaddr]);
+    update_congestion(thread_ctx);
+
+#ifdef DEBUG
+    char *hostaddr_str = zframe_strhex((zframe_t *)req->src);
+    dbg(thread_ctx->log_ctx, "Releasing address %u for host module %s\n",
+        localaddr, hostaddr_str);
+    free(hostaddr_str);
+#endif
+
+    return mgmt_send_ack(thread_ctx, req);
+}
+
+static void mgmt_gw_register(struct worker_thread_ctx *thread_ctx,
+                             const struct mgmt_req *req, unsigned int subnet)
+{
+    assert(thread_ctx);
+    assert(req);
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    if (subnet > OSD_DIADDR_SUBNET_MAX) {
+        err(thread_ctx->log_ctx, "Invalid subnet %u.", subnet);
+        return mgmt_send_nack(thread_ctx, req);
+    }
+
+    if (usrctx->gateways[subnet] != NULL) {
+        err(thread_ctx->log_ctx,
+            "A gateway for subnet %u is already "
+            "registered.",
+            subnet);
+        return mgmt_send_nack(thread_ctx, req);
+    }
+
+    // A gateway serving several devices registers each subnet over the same
+    // connection. The subnets share one client, and with it the credits.
+    struct peer *gw = find_gateway_by_hostaddr(usrctx, req->src);
+    if (gw) {
+        usrctx->gateways[subnet] = gw;
+        gw->gw_subnets++;
+        dbg(thread_ctx->log_ctx,
+            "Added subnet %u to gateway (now serving %u subnets)", subnet,
+            gw->gw_subnets);
+        return mgmt_send_ack(thread_ctx, req);
+    }
+
+    char stats_prefix[32];
+    snprintf(stats_prefix, sizeof(stats_prefix), "gateway.%u", subnet);
+    peer_add(usrctx, &usrctx->gateways[subnet], req->src, req->proto_version,
+             stats_prefix);
+    usrctx->gateways[subnet]->gw_subnets = 1;
+
+#ifdef DEBUG
+    char *hostaddr_str = zframe_strhex((zframe_t *)req->src);
+    dbg(thread_ctx->log_ctx,
+        "Registered gateway %s for subnet %u (protocol version %d)",
+        hostaddr_str, subnet, req->proto_version);
+    free(hostaddr_str);
+#endif
+
+    mgmt_send_ack(thread_ctx, req);
+    peer_grant_credits(thread_ctx, usrctx->gateways[subnet]);
+}
+
+static void mgmt_gw_unregister(struct worker_thread_ctx *thread_ctx,
+                               const struct mgmt_req *req, unsigned int subnet)
+{
+    assert(thread_ctx);
+    assert(req);
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    if (subnet > OSD_DIADDR_SUBNET_MAX) {
+        err(thread_ctx->log_ctx, "Invalid subnet %u.", subnet);
+        return mgmt_send_nack(thread_ctx, req);
+    }
+
+    if (usrctx->gateways[subnet] == NULL) {
+        err(thread_ctx->log_ctx, "No gateway registered for subnet %d.",
+            subnet);
+        return mgmt_send_nack(thread_ctx, req);
+    }
+
+    if (!zframe_eq_c(usrctx->gateways[subnet]->hostaddr, req->src)) {
+        char *hostaddr_str = zframe_strhex((zframe_t *)req->src);
+        err(thread_ctx->log_ctx,
+            "Host address %s is not registered as gateway "
+            "for subnet %u.",
+            hostaddr_str, subnet);
+        free(hostaddr_str);
+        return mgmt_send_nack(thread_ctx, req);
+    }
+
+    if (usrctx->overload) {
+        overload_end_stalls(thread_ctx, 1ULL << subnet, false);
+    }
+
+    struct peer *gw = usrctx->gateways[subnet];
+    if (gw->gw_subnets > 1) {
+        // the gateway still serves other subnets
+        gw->gw_subnets--;
+        usrctx->gateways[subnet] = NULL;
+    } else {
+        if (gw->tx_dropped) {
+            info(thread_ctx->log_ctx,
+                 "%" PRIu64 " data messages to gateway for subnet %u were "
+                 "dropped.",
+                 gw->tx_dropped, subnet);
+        }
+
+        peer_remove(usrctx, &usrctx->gateways[subnet]);
+        update_congestion(thread_ctx);
+    }
+
+#ifdef DEBUG
+    char *hostaddr_str = zframe_strhex((zframe_t *)req->src);
+    dbg(thread_ctx->log_ctx, "Unregistered gateway %s for subnet %u",
+        hostaddr_str, subnet);
+    free(hostaddr_str);
+#endif
+
+    mgmt_send_ack(thread_ctx, req);
+}
+
+/**
+ * Subscribe the sender to EVENT packets sent to a DI address
+ *
+ * The sender must be a host module with a DI address. Only addresses in our
+ * own subnet can be subscribed to; the addresses do not need to be assigned to
+ * a host module.
+ */
+static void mgmt_subscribe(struct worker_thread_ctx *thread_ctx,
+                           const struct mgmt_req *req, unsigned int diaddr)
+{
+    assert(thread_ctx);
+    assert(req);
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    struct peer *subscriber = find_module_by_hostaddr(usrctx, req->src, NULL);
+    if (!subscriber) {
+        err(thread_ctx->log_ctx,
+            "Only host modules with a DI address can subscribe.");
+        return mgmt_send_nack(thread_ctx, req);
+    }
+
+    if (osd_diaddr_subnet(diaddr) != usrctx->subnet_addr) {
+        err(thread_ctx->log_ctx,
+            "Unable to subscribe to DI address %u.%u outside of subnet %u.",
+            osd_diaddr_subnet(diaddr), osd_diaddr_localaddr(diaddr),
+            usrctx->subnet_addr);
+        return mgmt_send_nack(thread_ctx, req);
+    }
+
+    unsigned int localaddr = osd_diaddr_localaddr(diaddr);
+    if (!usrctx->subscribers[localaddr]) {
+        usrctx->subscribers[localaddr] = zlist_new();
+        assert(usrctx->subscribers[localaddr]);
+    }
+    if (!zlist_exists(usrctx->subscribers[localaddr], subscriber)) {
+        zlist_append(usrctx->subscribers[localaddr], subscriber);
+    }
+
+    dbg(thread_ctx->log_ctx, "Subscribed to EVENT packets sent to %u.%u (%u)",
+        osd_diaddr_subnet(diaddr), localaddr, diaddr);
+
+    mgmt_send_ack(thread_ctx, req);
+}
+
+static void mgmt_unsubscribe(struct worker_thread_ctx *thread_ctx,
+                             const struct mgmt_req *req, unsigned int diaddr)
+{
+    assert(thread_ctx);
+    assert(req);
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    struct peer *subscriber = find_module_by_hostaddr(usrctx, req->src, NULL);
+    unsigned int localaddr = osd_diaddr_localaddr(diaddr);
+    zlist_t *subscribers = usrctx->subscribers[localaddr];
+    if (!subscriber || osd_diaddr_subnet(diaddr) != usrctx->subnet_addr ||
+        !subscribers || !zlist_exists(subscribers, subscriber)) {
+        err(thread_ctx->log_ctx, "No subscription to DI address %u found.",
+            diaddr);
+        return mgmt_send_nack(thread_ctx, req);
+    }
 
-    /** Our DI subnet address */
-    unsigned int subnet_addr;
+    zlist_remove(subscribers, subscriber);
+    if (zlist_size(subscribers) == 0) {
+        zlist_destroy(&usrctx->subscribers[localaddr]);
+    }
 
-    /** Debug modules registered in this subnet */
-    zframe_t **mods_in_subnet;
+    dbg(thread_ctx->log_ctx, "Unsubscribed from EVENT packets sent to %u",
+        diaddr);
 
-    /** Gateways registered in this subnet */
-    zframe_t **gateways;
-};
+    mgmt_send_ack(thread_ctx, req);
+}
 
 /**
- * Get an available address in the local subnet
+ * Answer a statistics request with all statistics of the host controller
  */
-static osd_result get_available_diaddr(struct worker_thread_ctx *thread_ctx,
-                                       unsigned int *diaddr)
+static void mgmt_stats(struct worker_thread_ctx *thread_ctx,
+                       const struct mgmt_req *req)
 {
-    assert(thread_ctx);
     struct iothread_usr_ctx *usrctx = thread_ctx->usr;
     assert(usrctx);
 
-    unsigned int localaddr;
-    for (localaddr = 1; localaddr <= OSD_DIADDR_LOCAL_MAX; localaddr++) {
-        if (usrctx->mods_in_subnet[localaddr] == NULL) {
-            *diaddr = osd_diaddr_build(usrctx->subnet_addr, localaddr);
-            return OSD_OK;
-        }
+    char *text = stats_dump(usrctx->stats);
+    zmsg_t *msg;
+    if (req->proto_version == PROTO_VERSION_2) {
+        msg = proto_msg_new(PROTO_OP_STATS_RESPONSE, req->seq);
+        zmsg_addmem(msg, text, strlen(text));
+    } else {
+        msg = zmsg_new();
+        assert(msg);
+        zmsg_addstr(msg, "M");
+        zmsg_addstr(msg, text);
     }
-
-    return OSD_ERROR_FAILURE;
+    free(text);
+    mgmt_send(thread_ctx, req->src, &msg);
 }
 
 /**
- * Register a host address for a given DI address
+ * Dump the flight recorder
+ *
+ * @return OSD_OK if the dump was started,
+ *         OSD_ERROR_FAILURE if the flight recorder is disabled or still busy
+ *         with the previous dump
  */
-static osd_result register_diaddr(struct worker_thread_ctx *thread_ctx,
-                                  const zframe_t *hostaddr, unsigned int diaddr)
+static osd_result flightrec_trigger(struct worker_thread_ctx *thread_ctx,
+                                    const char *reason)
 {
-    assert(thread_ctx);
     struct iothread_usr_ctx *usrctx = thread_ctx->usr;
     assert(usrctx);
 
-    unsigned int localaddr = osd_diaddr_localaddr(diaddr);
-    if (usrctx->mods_in_subnet[localaddr] != NULL) {
+    if (!usrctx->flightrec) {
+        err(thread_ctx->log_ctx, "Flight recorder dump requested (%s), but "
+            "the flight recorder is disabled.", reason);
         return OSD_ERROR_FAILURE;
     }
-    usrctx->mods_in_subnet[localaddr] = zframe_dup_c(hostaddr);
 
-#ifdef DEBUG
-    char *hostaddr_str = zframe_strhex((zframe_t *)hostaddr);
-    dbg(thread_ctx->log_ctx, "Registered diaddr %u.%u (%u) for host module %s",
-        osd_diaddr_subnet(diaddr), osd_diaddr_localaddr(diaddr), diaddr,
-        hostaddr_str);
-    free(hostaddr_str);
-#endif
-
-    return OSD_OK;
+    info(thread_ctx->log_ctx, "Dumping flight recorder (%s).", reason);
+    osd_result rv = flightrec_dump(usrctx->flightrec);
+    if (OSD_SUCCEEDED(rv)) {
+        stats_counter_add(usrctx->router_stats.flightrec_dumps, 1);
+    }
+    return rv;
 }
 
-static void mgmt_send_ack(struct worker_thread_ctx *thread_ctx,
-                          const zframe_t *dest)
+/**
+ * Evaluate the trace triggers on a routed packet, arm the flight recorder
+ * window of a trigger which fires
+ */
+static void trace_triggers_eval(struct worker_thread_ctx *thread_ctx,
+                                const struct osd_packet *pkg)
 {
-    assert(thread_ctx);
-    assert(dest);
     struct iothread_usr_ctx *usrctx = thread_ctx->usr;
-    assert(usrctx);
+    assert(usrctx->flightrec);
 
-    zmsg_t *msg = zmsg_new();
-    zmsg_add(msg, zframe_dup_c(dest));
-    zmsg_addstr(msg, "M");
-    zmsg_addstr(msg, "ACK");
-    zmsg_send(&msg, usrctx->router_socket);
+    for (unsigned int i = 0; i < usrctx->trace_triggers_count; i++) {
+        struct trace_trigger *tt = &usrctx->trace_triggers[i];
+        if (!trigger_eval(tt->trigger, pkg)) {
+            continue;
+        }
+
+        stats_counter_add(usrctx->router_stats.trace_triggers, 1);
+        if (OSD_FAILED(flightrec_arm(usrctx->flightrec, tt->pre_packets,
+                                     tt->post_packets))) {
+            dbg(thread_ctx->log_ctx, "Trace trigger %u fired, but the window "
+                "of a previous trigger is not complete yet.", i);
+            continue;
+        }
+        info(thread_ctx->log_ctx, "Trace trigger %u fired.", i);
+        if (!tt->post_packets) {
+            flightrec_trigger(thread_ctx, "trace trigger");
+        }
+    }
 }
 
-static void mgmt_send_nack(struct worker_thread_ctx *thread_ctx,
-                           const zframe_t *dest)
+/**
+ * Remove all trace triggers
+ */
+static void trace_triggers_free(struct iothread_usr_ctx *usrctx)
+{
+    for (unsigned int i = 0; i < usrctx->trace_triggers_count; i++) {
+        trigger_free(&usrctx->trace_triggers[i].trigger);
+    }
+    usrctx->trace_triggers_count = 0;
+}
+
+/**
+ * Management request: dump the flight recorder
+ */
+static void mgmt_flightrec_dump(struct worker_thread_ctx *thread_ctx,
+                                const struct mgmt_req *req)
+{
+    osd_result rv = flightrec_trigger(thread_ctx, "management request");
+    if (OSD_SUCCEEDED(rv)) {
+        mgmt_send_ack(thread_ctx, req);
+    } else {
+        mgmt_send_nack(thread_ctx, req);
+    }
+}
+
+/**
+ * Management request: send compressed data messages from now on
+ *
+ * Compressed data messages are accepted from every client, the request only
+ * checks if the codec is supported.
+ */
+static void mgmt_compress(struct worker_thread_ctx *thread_ctx,
+                          const struct mgmt_req *req, uint16_t codec)
+{
+    if (codec != WIRECOMP_CODEC_DELTA_LZ) {
+        err(thread_ctx->log_ctx, "Unsupported compression codec %u.", codec);
+        return mgmt_send_nack(thread_ctx, req);
+    }
+    mgmt_send_ack(thread_ctx, req);
+}
+
+/**
+ * Management request: set the filter rules of the gateway serving a subnet
+ *
+ * The rules are checked and forwarded to the gateway, which does not answer.
+ * Gateways speaking protocol version 1 don't support filters. The filter of
+ * a gateway applies to all subnets it serves: gateways serving more than one
+ * subnet are not sent filters, a filter for one of the subnets would change
+ * the traffic of the others.
+ */
+static void mgmt_gw_filter(struct worker_thread_ctx *thread_ctx,
+                           const struct mgmt_req *req, unsigned int subnet,
+                           const char *rules)
 {
-    assert(thread_ctx);
-    assert(dest);
     struct iothread_usr_ctx *usrctx = thread_ctx->usr;
     assert(usrctx);
 
-    zmsg_t *msg = zmsg_new();
-    zmsg_add(msg, zframe_dup_c(dest));
-    zmsg_addstr(msg, "M");
-    zmsg_addstr(msg, "NACK");
-    zmsg_send(&msg, usrctx->router_socket);
+    if (subnet > OSD_DIADDR_SUBNET_MAX || !usrctx->gateways[subnet]) {
+        err(thread_ctx->log_ctx, "No gateway registered for subnet %u.",
+            subnet);
+        return mgmt_send_nack(thread_ctx, req);
+    }
+
+    struct rxfilter *filter;
+    osd_result rv = rxfilter_new(&filter, rules);
+    if (OSD_FAILED(rv)) {
+        err(thread_ctx->log_ctx, "Invalid gateway filter rules '%s'.", rules);
+        return mgmt_send_nack(thread_ctx, req);
+    }
+    rxfilter_free(&filter);
+
+    struct peer *gw = usrctx->gateways[subnet];
+    if (gw->proto_version != PROTO_VERSION_2) {
+        err(thread_ctx->log_ctx,
+            "Gateway for subnet %u doesn't support filters.", subnet);
+        return mgmt_send_nack(thread_ctx, req);
+    }
+    if (gw->gw_subnets > 1) {
+        err(thread_ctx->log_ctx,
+            "Gateway for subnet %u serves %u subnets, not setting a filter "
+            "for all of them.", subnet, gw->gw_subnets);
+        return mgmt_send_nack(thread_ctx, req);
+    }
+
+    zmsg_t *msg =
+        proto_msg_new_u16_str(PROTO_OP_GW_FILTER, gw->tx_seq++, subnet, rules);
+    mgmt_send(thread_ctx, gw->hostaddr, &msg);
+
+    info(thread_ctx->log_ctx, "Set filter of gateway for subnet %u to '%s'.",
+         subnet, rules);
+    mgmt_send_ack(thread_ctx, req);
 }
 
 /**
- * Assign a new DI address to a host module in our subnet
+ * Parse a numeric parameter of a text management request
+ *
+ * @param params the parameter string (decimal)
+ * @param max the largest valid value
+ * @param[out] value the parsed value
+ * @return OSD_OK if @p params is a valid number not larger than @p max,
+ *         OSD_ERROR_FAILURE otherwise
  */
-static void mgmt_diaddr_request(struct worker_thread_ctx *thread_ctx,
-                                const zframe_t *hostaddr)
+static osd_result parse_uint_param(const char *params, unsigned int max,
+                                   unsigned int *value)
+{
+    char *end;
+    long int v = strtol(params, &end, 10);
+    if (*end || end == params || v < 0 || v > max) {
+        return OSD_ERROR_FAILURE;
+    }
+    *value = v;
+    return OSD_OK;
+}
+
+/**
+ * Process an incoming management message in the text protocol (version 1)
+ */
+static void process_mgmt_msg_v1(struct worker_thread_ctx *thread_ctx,
+                                const zframe_t *src,
+                                const zframe_t *payload_frame)
 {
     assert(thread_ctx);
-    assert(hostaddr);
+    assert(src);
+
+    struct mgmt_req req = {
+        .src = src, .proto_version = PROTO_VERSION_1, .seq = 0,
+    };
+
+    if (!payload_frame) {
+        err(thread_ctx->log_ctx, "Ignoring empty management message.");
+        return;
+    }
+
     struct iothread_usr_ctx *usrctx = thread_ctx->usr;
     assert(usrctx);
+    stats_counter_add(usrctx->router_stats.mgmt_requests, 1);
 
-    osd_result rv;
-    unsigned int diaddr;
-    rv = get_available_diaddr(thread_ctx, &diaddr);
-    // XXX: Return error to host module instead of failing hard
-    assert(OSD_SUCCEEDED(rv));
+    char *request = zframe_strdup((zframe_t *)payload_frame);
+    dbg(thread_ctx->log_ctx, "Received management message %s", request);
 
-    rv = register_diaddr(thread_ctx, hostaddr, diaddr);
-    assert(OSD_SUCCEEDED(rv));
+    unsigned int subnet, diaddr;
+    if (!strcmp(request, "DIADDR_REQUEST")) {
+        mgmt_diaddr_request(thread_ctx, &req);
+    } else if (!strcmp(request, "DIADDR_RELEASE")) {
+        mgmt_diaddr_release(thread_ctx, &req);
+    } else if (!strncmp(request, "GW_REGISTER ", strlen("GW_REGISTER "))) {
+        if (OSD_FAILED(parse_uint_param(request + strlen("GW_REGISTER "),
+                                        OSD_DIADDR_SUBNET_MAX, &subnet))) {
+            mgmt_send_nack(thread_ctx, &req);
+        } else {
+            mgmt_gw_register(thread_ctx, &req, subnet);
+        }
+    } else if (!strncmp(request, "GW_UNREGISTER ",
+                        strlen("GW_UNREGISTER "))) {
+        if (OSD_FAILED(parse_uint_param(request + strlen("GW_UNREGISTER "),
+                                        OSD_DIADDR_SUBNET_MAX, &subnet))) {
+            mgmt_send_nack(thread_ctx, &req);
+        } else {
+            mgmt_gw_unregister(thread_ctx, &req, subnet);
+        }
+    } else if (!strncmp(request, "SUBSCRIBE ", strlen("SUBSCRIBE "))) {
+        if (OSD_FAILED(parse_uint_param(request + strlen("SUBSCRIBE "),
+                                        UINT16_MAX, &diaddr))) {
+            mgmt_send_nack(thread_ctx, &req);
+        } else {
+            mgmt_subscribe(thread_ctx, &req, diaddr);
+        }
+    } else if (!strncmp(request, "UNSUBSCRIBE ", strlen("UNSUBSCRIBE "))) {
+        if (OSD_FAILED(parse_uint_param(request + strlen("UNSUBSCRIBE "),
+                                        UINT16_MAX, &diaddr))) {
+            mgmt_send_nack(thread_ctx, &req);
+        } else {
+            mgmt_unsubscribe(thread_ctx, &req, diaddr);
+        }
+    } else if (!strncmp(request, "GW_FILTER ", strlen("GW_FILTER "))) {
+        // GW_FILTER <subnet> <rules>
+        char *params = request + strlen("GW_FILTER ");
+        char *rules = strchr(params, ' ');
+        if (rules) {
+            *rules++ = '\0';
+        } else {
+            rules = params + strlen(params);
+        }
+        if (OSD_FAILED(parse_uint_param(params, OSD_DIADDR_SUBNET_MAX,
+                                        &subnet))) {
+            mgmt_send_nack(thread_ctx, &req);
+        } else {
+            mgmt_gw_filter(thread_ctx, &req, subnet, rules);
+        }
+    } else if (!strcmp(request, STATS_REQUEST)) {
+        mgmt_stats(thread_ctx, &req);
+    } else if (!strcmp(request, "FLIGHTREC_DUMP")) {
+        mgmt_flightrec_dump(thread_ctx, &req);
+    } else if (!strncmp(request, PROTO_HELLO_REQUEST " ",
+                        strlen(PROTO_HELLO_REQUEST " "))) {
+        mgmt_proto_hello(thread_ctx, &req,
+                         request + strlen(PROTO_HELLO_REQUEST " "));
+    } else {
+        mgmt_send_ack(thread_ctx, &req);
+    }
 
-    zmsg_t *msg = zmsg_new();
-    zmsg_add(msg, zframe_dup_c(hostaddr));
-    zmsg_addstr(msg, "M");
-    zmsg_addstrf(msg, "%u", diaddr);
-    zmsg_send(&msg, usrctx->router_socket);
+    free(request);
 }
 
-static void mgmt_diaddr_release(struct worker_thread_ctx *thread_ctx,
-                                const zframe_t *hostaddr)
+/**
+ * Process an incoming management message in the binary protocol (version 2)
+ */
+static void process_mgmt_msg_v2(struct worker_thread_ctx *thread_ctx,
+                                const zframe_t *src,
+                                const struct proto_hdr *hdr,
+                                const zframe_t *payload_frame)
 {
     assert(thread_ctx);
-    assert(hostaddr);
+    assert(src);
+    assert(hdr);
+
+    struct mgmt_req req = {
+        .src = src, .proto_version = PROTO_VERSION_2, .seq = hdr->seq,
+    };
+
+    dbg(thread_ctx->log_ctx, "Received management message 0x%02x (seq %u)",
+        hdr->opcode, hdr->seq);
+
     struct iothread_usr_ctx *usrctx = thread_ctx->usr;
     assert(usrctx);
+    stats_counter_add(usrctx->router_stats.mgmt_requests, 1);
 
-    unsigned int i, localaddr;
-    int found = 0;
-    for (i = 1; i < OSD_DIADDR_SUBNET_MAX; i++) {
-        if (zframe_eq_c(usrctx->mods_in_subnet[i], hostaddr)) {
-            localaddr = i;
-            found = 1;
-            break;
+    osd_result rv;
+    uint16_t subnet, diaddr, codec;
+    char *rules;
+    switch (hdr->opcode) {
+    case PROTO_OP_DIADDR_REQUEST:
+        mgmt_diaddr_request(thread_ctx, &req);
+        break;
+    case PROTO_OP_DIADDR_RELEASE:
+        mgmt_diaddr_release(thread_ctx, &req);
+        break;
+    case PROTO_OP_GW_REGISTER:
+        rv = proto_body_get_u16(payload_frame, &subnet);
+        if (OSD_FAILED(rv)) {
+            mgmt_send_nack(thread_ctx, &req);
+        } else {
+            mgmt_gw_register(thread_ctx, &req, subnet);
+        }
+        break;
+    case PROTO_OP_GW_UNREGISTER:
+        rv = proto_body_get_u16(payload_frame, &subnet);
+        if (OSD_FAILED(rv)) {
+            mgmt_send_nack(thread_ctx, &req);
+        } else {
+            mgmt_gw_unregister(thread_ctx, &req, subnet);
+        }
+        break;
+    case PROTO_OP_SUBSCRIBE:
+        rv = proto_body_get_u16(payload_frame, &diaddr);
+        if (OSD_FAILED(rv)) {
+            mgmt_send_nack(thread_ctx, &req);
+        } else {
+            mgmt_subscribe(thread_ctx, &req, diaddr);
+        }
+        break;
+    case PROTO_OP_UNSUBSCRIBE:
+        rv = proto_body_get_u16(payload_frame, &diaddr);
+        if (OSD_FAILED(rv)) {
+            mgmt_send_nack(thread_ctx, &req);
+        } else {
+            mgmt_unsubscribe(thread_ctx, &req, diaddr);
+        }
+        break;
+    case PROTO_OP_STATS_REQUEST:
+        mgmt_stats(thread_ctx, &req);
+        break;
+    case PROTO_OP_FLIGHTREC_DUMP:
+        mgmt_flightrec_dump(thread_ctx, &req);
+        break;
+    case PROTO_OP_COMPRESS:
+        rv = proto_body_get_u16(payload_frame, &codec);
+        if (OSD_FAILED(rv)) {
+            mgmt_send_nack(thread_ctx, &req);
+        } else {
+            mgmt_compress(thread_ctx, &req, codec);
+        }
+        break;
+    case PROTO_OP_GW_FILTER:
+        rv = proto_body_get_u16_str(payload_frame, &subnet, &rules);
+        if (OSD_FAILED(rv)) {
+            mgmt_send_nack(thread_ctx, &req);
+        } else {
+            mgmt_gw_filter(thread_ctx, &req, subnet, rules);
+            free(rules);
         }
+        break;
+    default:
+        err(thread_ctx->log_ctx, "Unknown management request 0x%02x.",
+            hdr->opcode);
+        mgmt_send_nack(thread_ctx, &req);
     }
-    if (!found) {
-        err(thread_ctx->log_ctx,
-            "Trying to release address for host which "
-            "isn't registered.");
-        return mgmt_send_nack(thread_ctx, hostaddr);
+}
+
+/**
+ * Try to send a data message to a client without blocking
+ *
+ * Only bulk traffic is subject to flow control, control messages are sent
+ * regardless of the credits.
+ *
+ * @return 0 if the message was sent, -1 otherwise (see router_send()). errno
+ *         is set to EAGAIN if the client has no credits left.
+ */
+static int peer_try_send_data(struct iothread_usr_ctx *usrctx,
+                              struct peer *dest, struct shared_frame *payload,
+                              enum osd_traffic_class tclass)
+{
+    bool use_credit = dest->tx_flowctrl && tclass == OSD_TCLASS_BULK;
+    if (use_credit && dest->tx_credits == 0) {
+        if (!dest->tx_stall_start_us) {
+            dest->tx_stall_start_us = zclock_usecs();
+            stats_counter_add(&usrctx->flowctrl_stats->tx_stalls, 1);
+        }
+        errno = EAGAIN;
+        return -1;
     }
 
-    zframe_destroy(&usrctx->mods_in_subnet[localaddr]);
+    zframe_t *type_frame;
+    size_t frames_len = 2;
+    if (dest->proto_version == PROTO_VERSION_2) {
+        uint16_t flags = 0;
+        if (payload->trace) {
+            flags |= PROTO_FLAG_TRACE;
+            frames_len = 3;
+        }
+        type_frame = proto_hdr_frame_new(PROTO_OP_DATA, flags, dest->tx_seq);
+    } else {
+        type_frame = zframe_new("D", 1);
+        assert(type_frame);
+    }
 
-#ifdef DEBUG
-    char *hostaddr_str = zframe_strhex((zframe_t *)hostaddr);
-    dbg(thread_ctx->log_ctx, "Releasing address %u for host module %s\n",
-        localaddr, hostaddr_str);
-    free(hostaddr_str);
-#endif
+    zframe_t *frames[] = {type_frame, payload->frame, payload->trace};
+    int zmq_rv = router_send(usrctx->router_socket, dest->hostaddr, frames,
+                             frames_len);
+    int send_errno = errno;
+    zframe_destroy(&type_frame);
+
+    if (zmq_rv == 0) {
+        TRACE_PACKET_FRAME(router_egress, payload->frame);
+        stats_counter_add(dest->tx_packets, 1);
+        stats_counter_add(dest->tx_bytes, zframe_size(payload->frame));
+        if (dest->proto_version == PROTO_VERSION_2) {
+            dest->tx_seq++;
+        }
+        if (use_credit) {
+            dest->tx_credits--;
+            stats_counter_add(&usrctx->flowctrl_stats->tx_credits, -1);
+        }
+    }
+    errno = send_errno;
+    return zmq_rv;
+}
 
-    return mgmt_send_ack(thread_ctx, hostaddr);
+/**
+ * Is a client waiting for credits before more messages can be sent to it?
+ */
+static bool peer_is_credit_stalled(const struct peer *p)
+{
+    return p->tx_flowctrl && p->tx_credits == 0;
 }
 
-static void mgmt_gw_register(struct worker_thread_ctx *thread_ctx,
-                             const zframe_t *hostaddr, const char *params)
+/**
+ * Are messages queued for a client which can be sent as soon as the ZeroMQ
+ * queue has space?
+ */
+static bool peer_tx_pending(const struct peer *p)
 {
+    return fq_size(p->tx_queue[OSD_TCLASS_CONTROL]) ||
+           (fq_size(p->tx_queue[OSD_TCLASS_BULK]) &&
+            !peer_is_credit_stalled(p));
+}
+
+/**
+ * Send as many queued data messages to a client as possible
+ *
+ * The traffic class scheduler of the client decides which queue is served
+ * next; within a queue the sources are served in turn (deficit round robin).
+ *
+ * @return true if no message which could be sent is left in the queues
+ */
+static bool peer_flush_tx_queue(struct iothread_usr_ctx *usrctx,
+                                struct peer *dest)
+{
+    int tclass;
+    while ((tclass = tclass_sched_next(
+                &dest->tx_sched,
+                fq_size(dest->tx_queue[OSD_TCLASS_CONTROL]) != 0,
+                fq_size(dest->tx_queue[OSD_TCLASS_BULK]) != 0 &&
+                    !peer_is_credit_stalled(dest))) != -1) {
+        const void *src;
+        struct shared_frame *payload = fq_peek(dest->tx_queue[tclass], &src);
+        if (peer_try_send_data(usrctx, dest, payload, tclass) != 0) {
+            if (errno == EAGAIN) {
+                return false;
+            }
+            // the client is gone, nobody will pick up the messages
+            stats_counter_add(&usrctx->flowctrl_stats->dropped,
+                              peer_tx_queue_clear(dest));
+            return true;
+        }
+        fq_dequeue(dest->tx_queue[tclass], NULL);
+        peer_src_dequeued((struct peer *)src, tclass);
+        shared_frame_unref(&payload);
+    }
+    return true;
+}
+
+/**
+ * Timer handler: retry sending queued data messages
+ *
+ * The timer is only active as long as messages are queued for clients which
+ * are not waiting for credits. Clients waiting for credits are served when
+ * the credits arrive, see mgmt_credit().
+ */
+static int iothread_tx_retry(zloop_t *loop, int timer_id,
+                             void *thread_ctx_void)
+{
+    struct worker_thread_ctx *thread_ctx = thread_ctx_void;
     assert(thread_ctx);
-    assert(hostaddr);
     struct iothread_usr_ctx *usrctx = thread_ctx->usr;
     assert(usrctx);
 
-    char *end;
-
-    unsigned int subnet = strtol(params, &end, 10);
-    assert(!*end);
-    assert(subnet <= OSD_DIADDR_SUBNET_MAX);
+    bool all_done = true;
+    for (unsigned int i = 0; i <= OSD_DIADDR_LOCAL_MAX; i++) {
+        struct peer *p = usrctx->mods_in_subnet[i];
+        if (p && peer_tx_pending(p)) {
+            peer_flush_tx_queue(usrctx, p);
+            all_done &= !peer_tx_pending(p);
+        }
+    }
+    for (unsigned int i = 0; i <= OSD_DIADDR_SUBNET_MAX; i++) {
+        struct peer *p = usrctx->gateways[i];
+        if (p && gateway_is_first_subnet(usrctx, i) && peer_tx_pending(p)) {
+            peer_flush_tx_queue(usrctx, p);
+            all_done &= !peer_tx_pending(p);
+        }
+    }
 
-    if (usrctx->gateways[subnet] != NULL) {
-        err(thread_ctx->log_ctx,
-            "A gateway for subnet %u is already "
-            "registered.",
-            subnet);
-        return mgmt_send_nack(thread_ctx, hostaddr);
+    if (all_done) {
+        zloop_timer_end(loop, timer_id);
+        usrctx->tx_retry_timer_id = -1;
     }
 
-    usrctx->gateways[subnet] = zframe_dup_c(hostaddr);
+    update_congestion(thread_ctx);
 
-#ifdef DEBUG
-    char *hostaddr_str = zframe_strhex((zframe_t *)hostaddr);
-    dbg(thread_ctx->log_ctx, "Registered gateway %s for subnet %u",
-        hostaddr_str, subnet);
-    free(hostaddr_str);
-#endif
+    return 0;
+}
+
+/**
+ * Start the timer retrying queued data messages (if it isn't running yet)
+ */
+static void tx_retry_timer_start(struct worker_thread_ctx *thread_ctx)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
 
-    mgmt_send_ack(thread_ctx, hostaddr);
+    if (usrctx->tx_retry_timer_id != -1) {
+        return;
+    }
+    usrctx->tx_retry_timer_id =
+        zloop_timer(thread_ctx->zloop, PEER_TX_RETRY_INTERVAL_MS, 0,
+                    iothread_tx_retry, thread_ctx);
+    assert(usrctx->tx_retry_timer_id != -1);
 }
 
-static void mgmt_gw_unregister(struct worker_thread_ctx *thread_ctx,
-                               const zframe_t *hostaddr, const char *params)
+/**
+ * Send a data message to a client
+ *
+ * The message is sent immediately if possible. If the client cannot keep up
+ * (no credits left, or the ZeroMQ queue is full) the message is queued. If
+ * the part of the queue available to the sender is full, the newest message
+ * is dropped in lossless mode (which only happens if a sender ignores flow
+ * control), and the oldest message of the sender is dropped in lossy mode.
+ *
+ * Messages of different traffic classes are queued separately: a control
+ * message overtakes bulk messages waiting for the same client.
+ *
+ * If the overload control is enabled, trace modules behind a congested
+ * gateway are stalled (see overload_stall_noisiest()).
+ *
+ * @param src the sender of the message, or NULL if it is not registered
+ * @param payload the DI packet. A new reference is taken if the message is
+ *                queued.
+ * @param tclass traffic class of the packet
+ */
+static void send_data_to_peer(struct worker_thread_ctx *thread_ctx,
+                              struct peer *src, struct peer *dest,
+                              struct shared_frame *payload,
+                              enum osd_traffic_class tclass)
 {
-    assert(thread_ctx);
-    assert(hostaddr);
     struct iothread_usr_ctx *usrctx = thread_ctx->usr;
     assert(usrctx);
 
-    char *end;
+    struct fq *queue = dest->tx_queue[tclass];
 
-    unsigned int subnet = strtol(params, &end, 10);
-    assert(!*end);
-    assert(subnet <= OSD_DIADDR_SUBNET_MAX);
+    // keep the message order: only send directly if nothing is queued
+    if (fq_size(queue) == 0) {
+        if (peer_try_send_data(usrctx, dest, payload, tclass) == 0) {
+            return;
+        }
+        if (errno != EAGAIN) {
+            dbg(thread_ctx->log_ctx, "Unable to send data message: %s (%d)",
+                strerror(errno), errno);
+            dest->tx_dropped++;
+            stats_counter_add(dest->tx_dropped_total, 1);
+            stats_counter_add(&usrctx->flowctrl_stats->dropped, 1);
+            return;
+        }
+    }
 
-    if (usrctx->gateways[subnet] == NULL) {
-        err(thread_ctx->log_ctx, "No gateway registered for subnet %d.",
-            subnet);
-        return mgmt_send_nack(thread_ctx, hostaddr);
+    if (fq_src_size(queue, src) >= PEER_TX_QUEUE_MAX) {
+        if (dest->tx_dropped == 0) {
+            err(thread_ctx->log_ctx,
+                "Client is not keeping up, dropping data messages.");
+        }
+        dest->tx_dropped++;
+        stats_counter_add(dest->tx_dropped_total, 1);
+        stats_counter_add(&usrctx->flowctrl_stats->dropped, 1);
+
+        if (usrctx->flowctrl_mode == OSD_FLOWCTRL_LOSSLESS) {
+            return;
+        }
+        struct shared_frame *oldest = fq_drop_oldest(queue, src);
+        peer_src_dequeued(src, tclass);
+        shared_frame_unref(&oldest);
     }
 
-    if (!zframe_eq_c(usrctx->gateways[subnet], hostaddr)) {
-        char *hostaddr_str = zframe_strhex((zframe_t *)hostaddr);
-        err(thread_ctx->log_ctx,
-            "Host address %s is not registered as gateway "
-            "for subnet %u.",
-            hostaddr_str, subnet);
-        free(hostaddr_str);
-        return mgmt_send_nack(thread_ctx, hostaddr);
+    int fq_rv = fq_enqueue(queue, src, shared_frame_ref(payload));
+    assert(fq_rv == 0);
+    stats_hist_record(usrctx->router_stats.tx_queue_depth, fq_size(queue));
+
+    if (src && tclass == OSD_TCLASS_BULK) {
+        src->src_queued++;
+        if (src->src_queued >= PEER_TX_QUEUE_HIGH && !src->is_congested) {
+            dbg(thread_ctx->log_ctx,
+                "Queue is filling up, withholding credits from sender.");
+            src->is_congested = true;
+            src->overload_next_stall = src->src_queued;
+        }
+
+        // overload control: stall trace modules when a gateway becomes
+        // congested, and more of them if the queues keep growing
+        if (usrctx->overload && src->gw_subnets && src->is_congested &&
+            src->src_queued >= src->overload_next_stall) {
+            overload_stall_noisiest(thread_ctx, src);
+            src->overload_next_stall =
+                src->src_queued + PEER_TX_QUEUE_OVERLOAD_STEP;
+        }
+    }
+
+    if (peer_tx_pending(dest)) {
+        tx_retry_timer_start(thread_ctx);
+    }
+}
+
+/**
+ * Flow control: a client granted us credits for sending data messages to it
+ */
+static void mgmt_credit(struct worker_thread_ctx *thread_ctx,
+                        const zframe_t *src, const zframe_t *payload_frame)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    uint32_t credits;
+    if (OSD_FAILED(proto_body_get_u32(payload_frame, &credits))) {
+        err(thread_ctx->log_ctx, "Ignoring malformed CREDIT message.");
+        return;
     }
 
-    zframe_destroy(&usrctx->gateways[subnet]);
-    usrctx->gateways[subnet] = NULL;
+    struct peer *p = find_peer_by_hostaddr(usrctx, src);
+    if (!p) {
+        err(thread_ctx->log_ctx, "Ignoring CREDIT from unregistered client.");
+        return;
+    }
 
-#ifdef DEBUG
-    char *hostaddr_str = zframe_strhex((zframe_t *)hostaddr);
-    dbg(thread_ctx->log_ctx, "Unregistered gateway %s for subnet %u",
-        hostaddr_str, subnet);
-    free(hostaddr_str);
-#endif
+    p->tx_flowctrl = true;
+    p->tx_credits += credits;
+    stats_counter_add(&usrctx->flowctrl_stats->tx_credits, credits);
 
-    mgmt_send_ack(thread_ctx, hostaddr);
+    if (p->tx_stall_start_us) {
+        stats_counter_add(&usrctx->flowctrl_stats->tx_stall_time_us,
+                          zclock_usecs() - p->tx_stall_start_us);
+        p->tx_stall_start_us = 0;
+    }
+
+    if (!peer_flush_tx_queue(usrctx, p) && peer_tx_pending(p)) {
+        // ZeroMQ queue full, retry later
+        tx_retry_timer_start(thread_ctx);
+    }
+
+    update_congestion(thread_ctx);
 }
 
 /**
- * Process an incoming management message (from the host modules)
+ * Record a routed packet in the capture file and the flight recorder (if
+ * enabled)
  */
-static void process_mgmt_msg(struct worker_thread_ctx *thread_ctx,
-                             zframe_t *src, zframe_t *payload_frame)
+static void record_routed_packet(struct worker_thread_ctx *thread_ctx,
+                                 const zframe_t *src, const struct peer *dest,
+                                 const struct shared_frame *payload)
 {
-    assert(thread_ctx);
-    assert(src);
-    assert(payload_frame);
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
 
-    char *request = zframe_strdup(payload_frame);
-    dbg(thread_ctx->log_ctx, "Received management message %s", request);
+    if (usrctx->flightrec &&
+        flightrec_record(usrctx->flightrec, src, dest->hostaddr,
+                         payload->frame)) {
+        flightrec_trigger(thread_ctx, "trace trigger window complete");
+    }
 
-    if (!strcmp(request, "DIADDR_REQUEST")) {
-        mgmt_diaddr_request(thread_ctx, src);
-    } else if (!strcmp(request, "DIADDR_RELEASE")) {
-        mgmt_diaddr_release(thread_ctx, src);
-    } else if (!strncmp(request, "GW_REGISTER", strlen("GW_REGISTER"))) {
-        mgmt_gw_register(thread_ctx, src, request + strlen("GW_REGISTER "));
-    } else if (!strncmp(request, "GW_UNREGISTER", strlen("GW_UNREGISTER"))) {
-        mgmt_gw_unregister(thread_ctx, src, request + strlen("GW_UNREGISTER "));
-    } else {
-        mgmt_send_ack(thread_ctx, src);
+    if (!usrctx->capture) {
+        return;
     }
 
-    zframe_destroy(&src);
-    free(request);
-    free(payload_frame);
+    osd_result rv = capture_writer_record(usrctx->capture, src, dest->hostaddr,
+                                          payload->frame);
+    if (OSD_SUCCEEDED(rv)) {
+        stats_counter_add(usrctx->router_stats.capture_records, 1);
+    } else {
+        stats_counter_add(usrctx->router_stats.capture_dropped, 1);
+    }
 }
 
 /**
  * Route a DI data message to its destination
+ *
+ * EVENT packets are additionally sent to all subscribers of the destination
+ * address. All receivers share the same payload frame.
+ *
+ * @param payload_frame the DI packet. Ownership of the frame is passed on
+ *                      to this function.
+ * @param trace_frame the trace record of the packet, or NULL. Ownership of
+ *                    the frame is passed on to this function.
  */
 static void process_data_msg(struct worker_thread_ctx *thread_ctx,
-                             zframe_t *src, zframe_t *payload_frame)
+                             const zframe_t *src, zframe_t **payload_frame,
+                             zframe_t **trace_frame)
 {
     assert(thread_ctx);
     assert(src);
@@ -322,12 +2027,35 @@ static void process_data_msg(struct worker_thread_ctx *thread_ctx,
     osd_result rv;
 
     struct osd_packet *pkg = NULL;
-    rv = osd_packet_new_from_zframe(&pkg, payload_frame);
+    struct shared_frame *payload = NULL;
+    enum osd_traffic_class tclass = tclass_from_frame(*payload_frame);
+
+    struct router_stats *stats = &usrctx->router_stats;
+    size_t payload_size = *payload_frame ? zframe_size(*payload_frame) : 0;
+    stats_counter_add(stats->rx_packets, 1);
+    stats_counter_add(stats->rx_bytes, payload_size);
+
+    struct peer *sender = find_peer_by_hostaddr(usrctx, src);
+    if (sender) {
+        stats_counter_add(sender->rx_packets, 1);
+        stats_counter_add(sender->rx_bytes, payload_size);
+    }
+
+    if (!*payload_frame ||
+        zframe_size(*payload_frame) < 3 * sizeof(uint16_t)) {
+        err(thread_ctx->log_ctx, "Dropping invalid data packet.");
+        stats_counter_add(stats->invalid_packets, 1);
+        goto free_return;
+    }
+    rv = osd_packet_new_from_zframe(&pkg, *payload_frame);
     if (OSD_FAILED(rv)) {
         err(thread_ctx->log_ctx, "Dropping invalid data packet (%d)", rv);
+        stats_counter_add(stats->invalid_packets, 1);
         goto free_return;
     }
 
+    TRACE_PACKET_PKG(router_ingress, pkg);
+
     unsigned int dest_diaddr_subnet =
         osd_diaddr_subnet(osd_packet_get_dest(pkg));
     unsigned int dest_diaddr_local =
@@ -337,26 +2065,50 @@ static void process_data_msg(struct worker_thread_ctx *thread_ctx,
         "Routing lookup for packet with destination %u.%u. Local subnet is %u.",
         dest_diaddr_subnet, dest_diaddr_local, usrctx->subnet_addr);
 
-    const zframe_t *dest_hostaddr;
+    if (usrctx->overload && sender && sender->gw_subnets &&
+        tclass == OSD_TCLASS_BULK &&
+        osd_packet_get_type(pkg) == OSD_PACKET_TYPE_EVENT) {
+        overload_count(usrctx->overload, osd_packet_get_src(pkg));
+    }
+
+    // responses to the register writes of the overload control
+    if (dest_diaddr_subnet == usrctx->subnet_addr && dest_diaddr_local == 0 &&
+        osd_packet_get_type(pkg) == OSD_PACKET_TYPE_REG) {
+        if (osd_packet_get_type_sub(pkg) == RESP_WRITE_REG_ERROR) {
+            err(thread_ctx->log_ctx,
+                "Overload: unable to stall or resume trace module %u.%u.",
+                osd_diaddr_subnet(osd_packet_get_src(pkg)),
+                osd_diaddr_localaddr(osd_packet_get_src(pkg)));
+        }
+        goto free_return;
+    }
+
+    struct peer *dest;
+    zlist_t *subscribers = NULL;
     if (dest_diaddr_subnet == usrctx->subnet_addr) {
         // routing inside our subnet
-        dest_hostaddr = usrctx->mods_in_subnet[dest_diaddr_local];
-        if (dest_hostaddr == NULL) {
+        dest = usrctx->mods_in_subnet[dest_diaddr_local];
+        if (osd_packet_get_type(pkg) == OSD_PACKET_TYPE_EVENT) {
+            subscribers = usrctx->subscribers[dest_diaddr_local];
+        }
+        if (dest == NULL && subscribers == NULL) {
             err(thread_ctx->log_ctx,
                 "No destination module registered for "
                 "DI address %u.%u",
                 dest_diaddr_subnet, dest_diaddr_local);
+            stats_counter_add(stats->route_miss, 1);
             goto free_return;
         }
         dbg(thread_ctx->log_ctx,
             "Destination address is local, routing directly to destination.");
     } else {
         // routing through a gateway
-        dest_hostaddr = usrctx->gateways[dest_diaddr_subnet];
-        if (dest_hostaddr == NULL) {
+        dest = usrctx->gateways[dest_diaddr_subnet];
+        if (dest == NULL) {
             err(thread_ctx->log_ctx,
                 "No gateway for subnet %u registered to route di address %u.%u",
                 dest_diaddr_subnet, dest_diaddr_subnet, dest_diaddr_local);
+            stats_counter_add(stats->route_miss, 1);
             goto free_return;
         }
         dbg(thread_ctx->log_ctx,
@@ -364,32 +2116,124 @@ static void process_data_msg(struct worker_thread_ctx *thread_ctx,
             "subnet, routing through gateway.");
     }
 
-#ifdef DEBUG
-    char *dest_hostaddr_str = zframe_strhex((zframe_t *)dest_hostaddr);
-    dbg(thread_ctx->log_ctx, "Routing data packet to %s", dest_hostaddr_str);
-    free(dest_hostaddr_str);
-#endif
+    if (!stats->route_packets[dest_diaddr_subnet]) {
+        stats->route_packets[dest_diaddr_subnet] = stats_counter(
+            usrctx->stats, "route.%u.packets", dest_diaddr_subnet);
+        stats->route_bytes[dest_diaddr_subnet] =
+            stats_counter(usrctx->stats, "route.%u.bytes", dest_diaddr_subnet);
+    }
+    stats_counter_add(stats->route_packets[dest_diaddr_subnet], 1);
+    stats_counter_add(stats->route_bytes[dest_diaddr_subnet], payload_size);
+
+    payload = shared_frame_new(payload_frame);
+
+    // The same trace record passes the router twice: for the request and for
+    // the response.
+    struct latency_trace trace;
+    if (*trace_frame &&
+        OSD_SUCCEEDED(latency_trace_from_frame(*trace_frame, &trace))) {
+        latency_frame_stamp(*trace_frame,
+                            trace.ts_ns[LATENCY_STAGE_ROUTER_REQ]
+                                ? LATENCY_STAGE_ROUTER_RESP
+                                : LATENCY_STAGE_ROUTER_REQ);
+        payload->trace = *trace_frame;
+        *trace_frame = NULL;
+    }
 
-    int zmq_rv;
-    zmsg_t *msg = zmsg_new();
-    assert(msg);
-    zframe_t *dest_hostaddr_dup = zframe_dup_c(dest_hostaddr);
-    zmq_rv = zmsg_append(msg, &dest_hostaddr_dup);
-    assert(zmq_rv == 0);
-    zmq_rv = zmsg_addstr(msg, "D");
-    assert(zmq_rv == 0);
-    zmsg_append(msg, &payload_frame);
-    assert(zmq_rv == 0);
-    zmq_rv = zmsg_send(&msg, usrctx->router_socket);
-    assert(zmq_rv == 0);
+    if (dest) {
+        record_routed_packet(thread_ctx, src, dest, payload);
+        send_data_to_peer(thread_ctx, sender, dest, payload, tclass);
+    }
+
+    if (subscribers) {
+        struct peer *subscriber;
+        for (subscriber = zlist_first(subscribers); subscriber;
+             subscriber = zlist_next(subscribers)) {
+            if (subscriber != dest) {
+                record_routed_packet(thread_ctx, src, subscriber, payload);
+                send_data_to_peer(thread_ctx, sender, subscriber, payload,
+                                  tclass);
+            }
+        }
+    }
+
+    if (usrctx->flightrec && flightrec_is_trigger(usrctx->flightrec, pkg)) {
+        flightrec_trigger(thread_ctx, "trigger packet");
+    }
+    if (usrctx->trace_triggers_count) {
+        trace_triggers_eval(thread_ctx, pkg);
+    }
 
 free_return:
+    shared_frame_unref(&payload);
+    zframe_destroy(payload_frame);
+    zframe_destroy(trace_frame);
     osd_packet_free(&pkg);
+
+    // flow control: the sender used a credit (bulk traffic only)
+    if (sender && tclass == OSD_TCLASS_BULK) {
+        proto_credit_rx_use(&sender->rx_credit);
+        peer_grant_credits(thread_ctx, sender);
+    }
+}
+
+/**
+ * Process a compressed data message
+ *
+ * The message is decompressed and all packets in it are processed as if they
+ * were received in separate data messages.
+ *
+ * @param payload_frame the compressed packets (see wirecomp.h)
+ */
+static void process_data_compressed_msg(struct worker_thread_ctx *thread_ctx,
+                                        const zframe_t *src,
+                                        const zframe_t *payload_frame)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+    struct router_stats *stats = &usrctx->router_stats;
+
+    if (!payload_frame) {
+        err(thread_ctx->log_ctx, "Dropping empty compressed data message.");
+        stats_counter_add(stats->invalid_packets, 1);
+        return;
+    }
+
+    uint16_t *dtds;
+    size_t size_words;
+    size_t size = zframe_size((zframe_t *)payload_frame);
+    uint64_t start_ns = latency_now_ns();
+    osd_result rv = wirecomp_decode(zframe_data((zframe_t *)payload_frame),
+                                    size, &dtds, &size_words);
+    stats_counter_add(stats->decompress_ns, latency_now_ns() - start_ns);
+    if (OSD_FAILED(rv)) {
+        err(thread_ctx->log_ctx, "Dropping invalid compressed data message.");
+        stats_counter_add(stats->invalid_packets, 1);
+        return;
+    }
+    stats_counter_add(stats->decompress_in_bytes, size);
+    stats_counter_add(stats->decompress_out_bytes,
+                      size_words * sizeof(uint16_t));
+
+    size_t pos = 0;
+    while (pos < size_words) {
+        size_t len = dtds[pos];
+        zframe_t *packet_frame =
+            zframe_new(&dtds[pos + 1], len * sizeof(uint16_t));
+        assert(packet_frame);
+        zframe_t *trace_frame = NULL;
+        process_data_msg(thread_ctx, src, &packet_frame, &trace_frame);
+        pos += 1 + len;
+    }
+    free(dtds);
 }
 
 /**
  * Process incoming messages
  *
+ * Messages in both protocol versions are accepted. The version is detected
+ * based on the first frame after the sender identity.
+ *
  * @return 0 if the message was processed, -1 if @p loop should be terminated
  */
 static int iothread_handle_ext_msg(zloop_t *loop, zsock_t *reader,
@@ -409,22 +2253,40 @@ static int iothread_handle_ext_msg(zloop_t *loop, zsock_t *reader,
 
     zframe_t *src_frame = zmsg_pop(msg);
     zframe_t *type_frame = zmsg_pop(msg);
-    char *type_str = zframe_strdup(type_frame);
-
-    if (type_str[0] == 'M') {
-        zframe_t *payload_frame = zmsg_pop(msg);
-        process_mgmt_msg(thread_ctx, src_frame, payload_frame);
-    } else if (type_str[0] == 'D') {
-        zframe_t *payload_frame = zmsg_pop(msg);
-        process_data_msg(thread_ctx, src_frame, payload_frame);
+    zframe_t *payload_frame = zmsg_pop(msg);
+    zframe_t *trace_frame = NULL;
+
+    struct proto_hdr hdr;
+    if (!type_frame) {
+        err(thread_ctx->log_ctx, "Ignoring message without type.");
+    } else if (OSD_SUCCEEDED(proto_hdr_parse(type_frame, &hdr))) {
+        if (hdr.opcode == PROTO_OP_DATA) {
+            if (hdr.flags & PROTO_FLAG_TRACE) {
+                trace_frame = zmsg_pop(msg);
+            }
+            process_data_msg(thread_ctx, src_frame, &payload_frame,
+                             &trace_frame);
+        } else if (hdr.opcode == PROTO_OP_DATA_COMPRESSED) {
+            process_data_compressed_msg(thread_ctx, src_frame, payload_frame);
+        } else if (hdr.opcode == PROTO_OP_CREDIT) {
+            mgmt_credit(thread_ctx, src_frame, payload_frame);
+        } else {
+            process_mgmt_msg_v2(thread_ctx, src_frame, &hdr, payload_frame);
+        }
+    } else if (zframe_streq(type_frame, "M")) {
+        process_mgmt_msg_v1(thread_ctx, src_frame, payload_frame);
+    } else if (zframe_streq(type_frame, "D")) {
+        process_data_msg(thread_ctx, src_frame, &payload_frame, &trace_frame);
     } else {
+        char *type_str = zframe_strdup(type_frame);
         err(thread_ctx->log_ctx, "Ignoring message of unknown type '%s'.",
             type_str);
-        zframe_destroy(&src_frame);
+        free(type_str);
     }
 
-    free(type_str);
+    zframe_destroy(&src_frame);
     zframe_destroy(&type_frame);
+    zframe_destroy(&payload_frame);
     zmsg_destroy(&msg);
 
     return 0;
@@ -445,16 +2307,37 @@ static void iothread_router_start(struct worker_thread_ctx *thread_ctx)
 
     osd_result retval;
 
-    // create new ROUTER socket for host controller
-    usrctx->router_socket = zsock_new_router(usrctx->router_address);
+    // create new ROUTER socket for host controller. Shared-memory
+    // connections are forwarded to it through an inproc endpoint.
+    char shm_endpoint[64];
+    const char *router_endpoint = usrctx->router_address;
+    if (shm_is_url(usrctx->router_address)) {
+        snprintf(shm_endpoint, sizeof(shm_endpoint),
+                 "inproc://osd-hostctrl-%p", (void *)usrctx);
+        router_endpoint = shm_endpoint;
+    }
+    usrctx->router_socket = zsock_new_router(router_endpoint);
     if (!usrctx->router_socket) {
         err(thread_ctx->log_ctx, "Unable to bind to %s",
             usrctx->router_address);
         retval = OSD_ERROR_CONNECTION_FAILED;
         goto free_return;
     }
+    if (shm_is_url(usrctx->router_address)) {
+        retval = shm_listener_new(&usrctx->shm_listener, thread_ctx->log_ctx,
+                                  thread_ctx->zloop, usrctx->router_address,
+                                  router_endpoint);
+        if (OSD_FAILED(retval)) {
+            zsock_destroy(&usrctx->router_socket);
+            goto free_return;
+        }
+    }
     zsock_set_rcvtimeo(usrctx->router_socket, ZMQ_RCV_TIMEOUT);
 
+    // Report full send queues instead of silently dropping messages. We
+    // queue messages to slow clients ourselves, see send_data_to_peer().
+    zsock_set_router_mandatory(usrctx->router_socket, 1);
+
     // register event handler for incoming messages
     int zmq_rv;
     zmq_rv = zloop_reader(thread_ctx->zloop, usrctx->router_socket,
@@ -477,6 +2360,12 @@ static void iothread_router_stop(struct worker_thread_ctx *thread_ctx)
 
     osd_result retval;
 
+    if (usrctx->tx_retry_timer_id != -1) {
+        zloop_timer_end(thread_ctx->zloop, usrctx->tx_retry_timer_id);
+        usrctx->tx_retry_timer_id = -1;
+    }
+
+    shm_listener_free(&usrctx->shm_listener);
     zloop_reader_end(thread_ctx->zloop, usrctx->router_socket);
     zsock_destroy(&usrctx->router_socket);
 
@@ -485,25 +2374,219 @@ static void iothread_router_stop(struct worker_thread_ctx *thread_ctx)
     worker_send_status(thread_ctx->inproc_socket, "I-STOP-DONE", retval);
 }
 
+/**
+ * Change the traffic class scheduling of all (current and future) clients
+ */
+static void iothread_set_tclass_weight(struct worker_thread_ctx *thread_ctx,
+                                       unsigned int control_weight)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    usrctx->tclass_control_weight = control_weight;
+    for (unsigned int i = 0; i <= OSD_DIADDR_LOCAL_MAX; i++) {
+        if (usrctx->mods_in_subnet[i]) {
+            tclass_sched_init(&usrctx->mods_in_subnet[i]->tx_sched,
+                              control_weight);
+        }
+    }
+    for (unsigned int i = 0; i <= OSD_DIADDR_SUBNET_MAX; i++) {
+        if (usrctx->gateways[i]) {
+            tclass_sched_init(&usrctx->gateways[i]->tx_sched, control_weight);
+        }
+    }
+}
+
+static void client_stats_fill(const struct peer *p, uint16_t addr,
+                              bool is_gateway,
+                              struct osd_hostctrl_client_stats *stats)
+{
+    stats->addr = addr;
+    stats->is_gateway = is_gateway;
+    stats->packets = stats_counter_get(p->rx_packets);
+    stats->bytes = stats_counter_get(p->rx_bytes);
+    stats->tx_dropped = p->tx_dropped;
+    stats->tx_queued = p->src_queued;
+}
+
+/**
+ * Send the traffic statistics of all clients to the main thread
+ */
+static void iothread_get_client_stats(struct worker_thread_ctx *thread_ctx)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    size_t count = 0;
+    struct osd_hostctrl_client_stats *stats =
+        calloc(OSD_DIADDR_LOCAL_MAX + OSD_DIADDR_SUBNET_MAX + 2,
+               sizeof(struct osd_hostctrl_client_stats));
+    assert(stats);
+
+    for (unsigned int i = 0; i <= OSD_DIADDR_LOCAL_MAX; i++) {
+        if (usrctx->mods_in_subnet[i]) {
+            client_stats_fill(usrctx->mods_in_subnet[i],
+                              osd_diaddr_build(usrctx->subnet_addr, i), false,
+                              &stats[count++]);
+        }
+    }
+    for (unsigned int i = 0; i <= OSD_DIADDR_SUBNET_MAX; i++) {
+        // a gateway serving several subnets is listed with its first subnet
+        if (usrctx->gateways[i] && gateway_is_first_subnet(usrctx, i)) {
+            client_stats_fill(usrctx->gateways[i], i, true, &stats[count++]);
+        }
+    }
+
+    worker_send_data(thread_ctx->inproc_socket, "I-GET-CLIENT-STATS-DONE",
+                     stats, count * sizeof(struct osd_hostctrl_client_stats));
+    free(stats);
+}
+
 static osd_result iothread_handle_inproc_msg(
     struct worker_thread_ctx *thread_ctx, const char *name, zmsg_t *msg)
 {
-    struct thread_ctx_usr *usrctx = thread_ctx->usr;
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
     assert(usrctx);
 
-    // we don't use |msg|, but we gained ownership -- destroy it!
-    zmsg_destroy(&msg);
-
     if (!strcmp(name, "I-START")) {
+        // the flow control mode is passed as value of the I-START message
+        zframe_t *value_frame = zmsg_next(msg);
+        assert(value_frame && zframe_size(value_frame) == sizeof(int));
+        int mode;
+        memcpy(&mode, zframe_data(value_frame), sizeof(int));
+        usrctx->flowctrl_mode = mode;
         iothread_router_start(thread_ctx);
 
     } else if (!strcmp(name, "I-STOP")) {
         iothread_router_stop(thread_ctx);
 
+    } else if (!strcmp(name, "I-SET-TCLASS-WEIGHT")) {
+        zframe_t *value_frame = zmsg_next(msg);
+        assert(value_frame && zframe_size(value_frame) == sizeof(int));
+        int weight;
+        memcpy(&weight, zframe_data(value_frame), sizeof(int));
+        iothread_set_tclass_weight(thread_ctx, weight);
+        worker_send_status(thread_ctx->inproc_socket,
+                           "I-SET-TCLASS-WEIGHT-DONE", OSD_OK);
+
+    } else if (!strcmp(name, "I-GET-CLIENT-STATS")) {
+        iothread_get_client_stats(thread_ctx);
+
+    } else if (!strcmp(name, "I-SET-STATS-ENDPOINT")) {
+        char *endpoint = zframe_strdup(zmsg_next(msg));
+        osd_result rv = stats_endpoint_bind(thread_ctx->zloop, usrctx->stats,
+                                            endpoint, &usrctx->stats_socket);
+        if (OSD_FAILED(rv)) {
+            err(thread_ctx->log_ctx, "Unable to bind stats endpoint %s",
+                endpoint);
+        }
+        free(endpoint);
+        worker_send_status(thread_ctx->inproc_socket,
+                           "I-SET-STATS-ENDPOINT-DONE", rv);
+
+    } else if (!strcmp(name, "I-SET-CAPTURE")) {
+        // no file name stops the capture
+        zframe_t *filename_frame = zmsg_next(msg);
+        osd_result rv = OSD_OK;
+        capture_writer_free(&usrctx->capture);
+        if (filename_frame) {
+            char *filename = zframe_strdup(filename_frame);
+            rv = capture_writer_new(&usrctx->capture, thread_ctx->log_ctx,
+                                    filename);
+            free(filename);
+        }
+        worker_send_status(thread_ctx->inproc_socket, "I-SET-CAPTURE-DONE",
+                           rv);
+
+    } else if (!strcmp(name, "I-SET-FLIGHTREC")) {
+        zframe_t *config_frame = zmsg_next(msg);
+        assert(config_frame &&
+               zframe_size(config_frame) == sizeof(struct flightrec_config));
+        struct flightrec_config config;
+        memcpy(&config, zframe_data(config_frame), sizeof(config));
+
+        osd_result rv = OSD_OK;
+        trace_triggers_free(usrctx);
+        flightrec_free(&usrctx->flightrec);
+        if (config.size) {
+            rv = flightrec_new(&usrctx->flightrec, thread_ctx->log_ctx,
+                               config.size, config.dump_filename);
+        }
+        worker_send_status(thread_ctx->inproc_socket, "I-SET-FLIGHTREC-DONE",
+                           rv);
+
+    } else if (!strcmp(name, "I-ADD-FLIGHTREC-TRIGGER")) {
+        // the trigger is passed as value (type << 4 | type_sub)
+        zframe_t *value_frame = zmsg_next(msg);
+        assert(value_frame && zframe_size(value_frame) == sizeof(int));
+        int trigger;
+        memcpy(&trigger, zframe_data(value_frame), sizeof(int));
+
+        osd_result rv = OSD_ERROR_FAILURE;
+        if (usrctx->flightrec) {
+            flightrec_add_trigger(usrctx->flightrec, trigger >> 4,
+                                  trigger & 0xf);
+            rv = OSD_OK;
+        }
+        worker_send_status(thread_ctx->inproc_socket,
+                           "I-ADD-FLIGHTREC-TRIGGER-DONE", rv);
+
+    } else if (!strcmp(name, "I-ADD-TRACE-TRIGGER")) {
+        zframe_t *config_frame = zmsg_next(msg);
+        assert(config_frame && zframe_size(config_frame) ==
+                                   sizeof(struct trace_trigger_config));
+        struct trace_trigger_config config;
+        memcpy(&config, zframe_data(config_frame), sizeof(config));
+
+        osd_result rv = OSD_ERROR_FAILURE;
+        struct trace_trigger *tt =
+            &usrctx->trace_triggers[usrctx->trace_triggers_count];
+        if (!usrctx->flightrec) {
+            err(thread_ctx->log_ctx, "Trace triggers require the flight "
+                "recorder.");
+        } else if (usrctx->trace_triggers_count == TRACE_TRIGGERS_MAX) {
+            err(thread_ctx->log_ctx, "Too many trace triggers (at most %d).",
+                TRACE_TRIGGERS_MAX);
+        } else if (OSD_FAILED(trigger_new(&tt->trigger, config.pattern))) {
+            err(thread_ctx->log_ctx, "Invalid trace trigger pattern: %s",
+                config.pattern);
+        } else {
+            tt->pre_packets = config.pre_packets;
+            tt->post_packets = config.post_packets;
+            usrctx->trace_triggers_count++;
+            rv = OSD_OK;
+        }
+        worker_send_status(thread_ctx->inproc_socket,
+                           "I-ADD-TRACE-TRIGGER-DONE", rv);
+
+    } else if (!strcmp(name, "I-DUMP-FLIGHTREC")) {
+        osd_result rv = flightrec_trigger(thread_ctx, "API request");
+        worker_send_status(thread_ctx->inproc_socket, "I-DUMP-FLIGHTREC-DONE",
+                           rv);
+
+    } else if (!strcmp(name, "I-SET-OVERLOAD-CONTROL")) {
+        zframe_t *value_frame = zmsg_next(msg);
+        assert(value_frame && zframe_size(value_frame) == sizeof(int));
+        int enable;
+        memcpy(&enable, zframe_data(value_frame), sizeof(int));
+
+        if (enable && !usrctx->overload) {
+            usrctx->overload = overload_new();
+        } else if (!enable && usrctx->overload) {
+            // don't leave modules stalled which nobody resumes any more
+            overload_end_stalls(thread_ctx, UINT64_MAX, true);
+            overload_free(&usrctx->overload);
+        }
+        worker_send_status(thread_ctx->inproc_socket,
+                           "I-SET-OVERLOAD-CONTROL-DONE", OSD_OK);
+
     } else {
         assert(0 && "Received unknown message from main thread.");
     }
 
+    // we gained ownership of |msg| -- destroy it!
+    zmsg_destroy(&msg);
+
     return OSD_OK;
 }
 
@@ -513,9 +2596,32 @@ static osd_result iothread_destroy(struct worker_thread_ctx *thread_ctx)
     struct iothread_usr_ctx *usrctx = thread_ctx->usr;
     assert(usrctx);
 
+    stats_endpoint_close(thread_ctx->zloop, &usrctx->stats_socket);
+    capture_writer_free(&usrctx->capture);
+    trace_triggers_free(usrctx);
+    flightrec_free(&usrctx->flightrec);
+    overload_free(&usrctx->overload);
+
+    zhash_destroy(&usrctx->peers_by_hostaddr);
+    for (unsigned int i = 0; i <= OSD_DIADDR_LOCAL_MAX; i++) {
+        zlist_destroy(&usrctx->subscribers[i]);
+        peer_free(&usrctx->mods_in_subnet[i]);
+    }
+    for (unsigned int i = 0; i <= OSD_DIADDR_SUBNET_MAX; i++) {
+        // a gateway serving several subnets is freed with its first subnet
+        for (unsigned int j = i + 1;
+             usrctx->gateways[i] && j <= OSD_DIADDR_SUBNET_MAX; j++) {
+            if (usrctx->gateways[j] == usrctx->gateways[i]) {
+                usrctx->gateways[j] = NULL;
+            }
+        }
+        peer_free(&usrctx->gateways[i]);
+    }
+
     free(usrctx->router_address);
     free(usrctx->mods_in_subnet);
     free(usrctx->gateways);
+    free(usrctx->subscribers);
     free(usrctx);
     thread_ctx->usr = NULL;
 
@@ -549,12 +2655,53 @@ osd_result osd_hostctrl_new(struct osd_hostctrl_ctx **ctx,
     // allocate routing lookup tables
     // mods_in_subnet is 1024 * 8B = 8 kB
     iothread_usr_data->mods_in_subnet =
-        calloc(OSD_DIADDR_LOCAL_MAX + 1, sizeof(zframe_t *));
+        calloc(OSD_DIADDR_LOCAL_MAX + 1, sizeof(struct peer *));
     assert(iothread_usr_data->mods_in_subnet);
     // gateways is 64 * 8B = 1 kB
     iothread_usr_data->gateways =
-        calloc(OSD_DIADDR_SUBNET_MAX + 1, sizeof(zframe_t *));
+        calloc(OSD_DIADDR_SUBNET_MAX + 1, sizeof(struct peer *));
     assert(iothread_usr_data->gateways);
+    // subscribers is 1024 * 8B = 8 kB
+    iothread_usr_data->subscribers =
+        calloc(OSD_DIADDR_LOCAL_MAX + 1, sizeof(zlist_t *));
+    assert(iothread_usr_data->subscribers);
+
+    iothread_usr_data->tx_retry_timer_id = -1;
+
+    iothread_usr_data->peers_by_hostaddr = zhash_new();
+    assert(iothread_usr_data->peers_by_hostaddr);
+    iothread_usr_data->flowctrl_stats = &c->flowctrl_stats;
+
+    c->stats = stats_new();
+    iothread_usr_data->stats = c->stats;
+    struct router_stats *router_stats = &iothread_usr_data->router_stats;
+    router_stats->rx_packets = stats_counter(c->stats, "router.rx_packets");
+    router_stats->rx_bytes = stats_counter(c->stats, "router.rx_bytes");
+    router_stats->invalid_packets =
+        stats_counter(c->stats, "router.invalid_packets");
+    router_stats->route_miss = stats_counter(c->stats, "router.route_miss");
+    router_stats->mgmt_requests =
+        stats_counter(c->stats, "router.mgmt_requests");
+    router_stats->tx_queue_depth =
+        stats_hist(c->stats, "router.tx_queue_depth");
+    router_stats->capture_records =
+        stats_counter(c->stats, "router.capture_records");
+    router_stats->capture_dropped =
+        stats_counter(c->stats, "router.capture_dropped");
+    router_stats->flightrec_dumps =
+        stats_counter(c->stats, "router.flightrec_dumps");
+    router_stats->trace_triggers =
+        stats_counter(c->stats, "router.trace_triggers");
+    router_stats->decompress_in_bytes =
+        stats_counter(c->stats, "router.decompress_in_bytes");
+    router_stats->decompress_out_bytes =
+        stats_counter(c->stats, "router.decompress_out_bytes");
+    router_stats->decompress_ns =
+        stats_counter(c->stats, "router.decompress_ns");
+    router_stats->overload_stalls =
+        stats_counter(c->stats, "router.overload_stalls");
+    router_stats->overload_stall_time_us =
+        stats_counter(c->stats, "router.overload_stall_time_us");
 
     rv = worker_new(&c->ioworker_ctx, log_ctx, NULL, iothread_destroy,
                     iothread_handle_inproc_msg, iothread_usr_data);
@@ -579,6 +2726,7 @@ void osd_hostctrl_free(struct osd_hostctrl_ctx **ctx_p)
     assert(!ctx->is_running);
 
     worker_free(&ctx->ioworker_ctx);
+    stats_free(&ctx->stats);
 
     free(ctx);
     *ctx_p = NULL;
@@ -591,7 +2739,8 @@ osd_result osd_hostctrl_start(struct osd_hostctrl_ctx *ctx)
     assert(ctx);
     assert(!ctx->is_running);
 
-    worker_send_status(ctx->ioworker_ctx->inproc_socket, "I-START", 0);
+    worker_send_status(ctx->ioworker_ctx->inproc_socket, "I-START",
+                       ctx->flowctrl_mode);
     int retval;
     rv = worker_wait_for_status(ctx->ioworker_ctx->inproc_socket,
                                 "I-START-DONE", &retval);
@@ -639,3 +2788,232 @@ bool osd_hostctrl_is_running(struct osd_hostctrl_ctx *ctx)
 {
     return ctx->is_running;
 }
+
+API_EXPORT
+osd_result osd_hostctrl_set_flowctrl_mode(struct osd_hostctrl_ctx *ctx,
+                                          enum osd_flowctrl_mode mode)
+{
+    assert(ctx);
+
+    if (ctx->is_running) {
+        err(ctx->log_ctx,
+            "The flow control mode can only be changed while the host "
+            "controller is stopped.");
+        return OSD_ERROR_FAILURE;
+    }
+
+    ctx->flowctrl_mode = mode;
+    return OSD_OK;
+}
+
+API_EXPORT
+osd_result osd_hostctrl_set_tclass_weight(struct osd_hostctrl_ctx *ctx,
+                                          unsigned int control_weight)
+{
+    osd_result rv;
+    assert(ctx);
+
+    worker_send_status(ctx->ioworker_ctx->inproc_socket,
+                       "I-SET-TCLASS-WEIGHT", control_weight);
+    int retval;
+    rv = worker_wait_for_status(ctx->ioworker_ctx->inproc_socket,
+                                "I-SET-TCLASS-WEIGHT-DONE", &retval);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+    return retval;
+}
+
+API_EXPORT
+void osd_hostctrl_get_flowctrl_stats(struct osd_hostctrl_ctx *ctx,
+                                     struct osd_flowctrl_stats *stats)
+{
+    assert(ctx);
+    assert(stats);
+    flowctrl_stats_get(&ctx->flowctrl_stats, stats);
+}
+
+API_EXPORT
+osd_result osd_hostctrl_get_client_stats(
+    struct osd_hostctrl_ctx *ctx, struct osd_hostctrl_client_stats **stats,
+    size_t *count)
+{
+    assert(ctx);
+    assert(stats);
+    assert(count);
+
+    zsock_t *sock = ctx->ioworker_ctx->inproc_socket;
+    worker_send_status(sock, "I-GET-CLIENT-STATS", 0);
+
+    zmsg_t *msg = zmsg_recv(sock);
+    if (!msg) {
+        return OSD_ERROR_FAILURE;
+    }
+    char *name = zmsg_popstr(msg);
+    if (!name || strcmp(name, "I-GET-CLIENT-STATS-DONE")) {
+        err(ctx->log_ctx, "Unexpected response from I/O thread: %s", name);
+        free(name);
+        zmsg_destroy(&msg);
+        return OSD_ERROR_FAILURE;
+    }
+    free(name);
+
+    *stats = NULL;
+    *count = 0;
+    zframe_t *data_frame = zmsg_pop(msg);
+    if (data_frame) {
+        size_t size = zframe_size(data_frame);
+        assert(size % sizeof(struct osd_hostctrl_client_stats) == 0);
+        *stats = malloc(size);
+        assert(*stats);
+        memcpy(*stats, zframe_data(data_frame), size);
+        *count = size / sizeof(struct osd_hostctrl_client_stats);
+        zframe_destroy(&data_frame);
+    }
+    zmsg_destroy(&msg);
+
+    return OSD_OK;
+}
+
+API_EXPORT
+osd_result osd_hostctrl_set_stats_endpoint(struct osd_hostctrl_ctx *ctx,
+                                           const char *endpoint)
+{
+    osd_result rv;
+    assert(ctx);
+    assert(endpoint);
+
+    worker_send_data(ctx->ioworker_ctx->inproc_socket, "I-SET-STATS-ENDPOINT",
+                     endpoint, strlen(endpoint));
+    int retval;
+    rv = worker_wait_for_status(ctx->ioworker_ctx->inproc_socket,
+                                "I-SET-STATS-ENDPOINT-DONE", &retval);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+    return retval;
+}
+
+API_EXPORT
+osd_result osd_hostctrl_set_capture(struct osd_hostctrl_ctx *ctx,
+                                    const char *filename)
+{
+    osd_result rv;
+    assert(ctx);
+
+    worker_send_data(ctx->ioworker_ctx->inproc_socket, "I-SET-CAPTURE",
+                     filename, filename ? strlen(filename) : 0);
+    int retval;
+    rv = worker_wait_for_status(ctx->ioworker_ctx->inproc_socket,
+                                "I-SET-CAPTURE-DONE", &retval);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+    return retval;
+}
+
+API_EXPORT
+osd_result osd_hostctrl_set_flightrec(struct osd_hostctrl_ctx *ctx,
+                                      size_t size, const char *dump_filename)
+{
+    osd_result rv;
+    assert(ctx);
+    assert(!size || dump_filename);
+
+    // The I/O thread copies the file name before we return.
+    struct flightrec_config config = {
+        .size = size, .dump_filename = dump_filename,
+    };
+    worker_send_data(ctx->ioworker_ctx->inproc_socket, "I-SET-FLIGHTREC",
+                     &config, sizeof(config));
+    int retval;
+    rv = worker_wait_for_status(ctx->ioworker_ctx->inproc_socket,
+                                "I-SET-FLIGHTREC-DONE", &retval);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+    return retval;
+}
+
+API_EXPORT
+osd_result osd_hostctrl_add_flightrec_trigger(struct osd_hostctrl_ctx *ctx,
+                                              unsigned int type,
+                                              unsigned int type_sub)
+{
+    osd_result rv;
+    assert(ctx);
+    assert(type <= OSD_PACKET_TYPE_RES);
+    assert(type_sub <= 0xf);
+
+    worker_send_status(ctx->ioworker_ctx->inproc_socket,
+                       "I-ADD-FLIGHTREC-TRIGGER", type << 4 | type_sub);
+    int retval;
+    rv = worker_wait_for_status(ctx->ioworker_ctx->inproc_socket,
+                                "I-ADD-FLIGHTREC-TRIGGER-DONE", &retval);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+    return retval;
+}
+
+API_EXPORT
+osd_result osd_hostctrl_add_trace_trigger(struct osd_hostctrl_ctx *ctx,
+                                          const char *pattern,
+                                          unsigned int pre_packets,
+                                          unsigned int post_packets)
+{
+    osd_result rv;
+    assert(ctx);
+    assert(pattern);
+
+    // The I/O thread compiles the pattern before we return.
+    struct trace_trigger_config config = {
+        .pattern = pattern,
+        .pre_packets = pre_packets,
+        .post_packets = post_packets,
+    };
+    worker_send_data(ctx->ioworker_ctx->inproc_socket, "I-ADD-TRACE-TRIGGER",
+                     &config, sizeof(config));
+    int retval;
+    rv = worker_wait_for_status(ctx->ioworker_ctx->inproc_socket,
+                                "I-ADD-TRACE-TRIGGER-DONE", &retval);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+    return retval;
+}
+
+API_EXPORT
+osd_result osd_hostctrl_dump_flightrec(struct osd_hostctrl_ctx *ctx)
+{
+    osd_result rv;
+    assert(ctx);
+
+    worker_send_status(ctx->ioworker_ctx->inproc_socket, "I-DUMP-FLIGHTREC",
+                       0);
+    int retval;
+    rv = worker_wait_for_status(ctx->ioworker_ctx->inproc_socket,
+                                "I-DUMP-FLIGHTREC-DONE", &retval);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+    return retval;
+}
+
+API_EXPORT
+osd_result osd_hostctrl_set_overload_control(struct osd_hostctrl_ctx *ctx,
+                                             bool enable)
+{
+    osd_result rv;
+    assert(ctx);
+
+    worker_send_status(ctx->ioworker_ctx->inproc_socket,
+                       "I-SET-OVERLOAD-CONTROL", enable);
+    int retval;
+    rv = worker_wait_for_status(ctx->ioworker_ctx->inproc_socket,
+                                "I-SET-OVERLOAD-CONTROL-DONE", &retval);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+    return retval;
+}
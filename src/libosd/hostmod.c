@@ -19,12 +19,34 @@
 #include <osd/reg.h>
 
 #include "osd-private.h"
+#include "hdrhist.h"
+#include "latency.h"
+#include "proto.h"
+#include "shm.h"
+#include "stats.h"
+#include "tclass.h"
+#include "trace.h"
 #include "worker.h"
 
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 #include <string.h>
 
+/**
+ * Latency statistics of one kind of register accesses to one subnet
+ */
+struct reg_stats {
+    /** Time between sending the request and receiving the response (ns) */
+    struct hdrhist latency_ns;
+
+    /** Number of failed accesses */
+    uint64_t errors;
+};
+
+/** Number of register widths (16, 32, 64 and 128 bit) */
+#define REG_WIDTHS 4
+
 /**
  * Host module context
  */
@@ -40,6 +62,37 @@ struct osd_hostmod_ctx {
 
     /** I/O worker */
     struct worker_ctx *ioworker_ctx;
+
+    /**
+     * Data messages from the I/O thread which arrived while waiting for the
+     * status of a request to the I/O thread
+     */
+    zlist_t *rx_queue;
+
+    /** Flow control statistics (updated by the I/O thread) */
+    struct osd_flowctrl_stats flowctrl_stats;
+
+    /** Traffic statistics */
+    struct stats_registry *stats;
+
+    /** Is latency tracing of register accesses enabled? */
+    bool latency_tracing;
+
+    /** Completed latency traces, NULL if tracing was never enabled */
+    struct latency_recorder *latency_recorder;
+
+    /** Sequence number of the next latency trace */
+    uint64_t latency_trace_seq;
+
+    /** Protects reg_stats */
+    pthread_mutex_t reg_stats_lock;
+
+    /**
+     * Register access statistics, indexed by access type (read: 0, write: 1),
+     * register width (log2(width / 16)) and destination subnet. Allocated on
+     * first use.
+     */
+    struct reg_stats *reg_stats[2][REG_WIDTHS][OSD_DIADDR_SUBNET_MAX + 1];
 };
 
 /**
@@ -52,6 +105,64 @@ struct iothread_usr_ctx {
     /** ZeroMQ address/URL of the host controller */
     char *host_controller_address;
 
+    /** Shared-memory connection, if host_controller_address is a shm:// URL */
+    struct shm_client *shm_client;
+
+    /** Protocol version negotiated with the host controller */
+    int proto_version;
+
+    /** Sequence number of the next version 2 message */
+    uint32_t tx_seq;
+
+    /**
+     * Status message sent to the main thread when the response to the
+     * outstanding management request arrives, or NULL if no request is
+     * outstanding
+     */
+    const char *mgmt_done_msg;
+
+    /** Flow control: credits granted to the host controller */
+    struct proto_credit_rx rx_credit;
+
+    /** Flow control: has the host controller granted us credits? */
+    bool tx_flowctrl;
+
+    /** Flow control: credits for data messages to the host controller */
+    uint32_t tx_credits;
+
+    /** Flow control: start of the current stall (us), 0 if not stalled */
+    int64_t tx_stall_start_us;
+
+    /** Flow control: data messages waiting for credits */
+    zlist_t *tx_queue;
+
+    /** Flow control statistics (owned by struct osd_hostmod_ctx) */
+    struct osd_flowctrl_stats *flowctrl_stats;
+
+    /** Statistics registry (owned by struct osd_hostmod_ctx) */
+    struct stats_registry *stats;
+
+    /** Statistics: data messages sent to the host controller */
+    uint64_t *stats_tx_packets;
+
+    /** Statistics: data bytes (DI packets) sent to the host controller */
+    uint64_t *stats_tx_bytes;
+
+    /** Statistics: data messages received from the host controller */
+    uint64_t *stats_rx_packets;
+
+    /** Statistics: data bytes (DI packets) received from the host controller */
+    uint64_t *stats_rx_bytes;
+
+    /** Statistics: EVENT packets passed to the event handler */
+    uint64_t *stats_rx_events;
+
+    /** Statistics: EVENT packets dropped (no handler, or handler failed) */
+    uint64_t *stats_rx_events_dropped;
+
+    /** Stats endpoint socket, NULL if no endpoint is bound */
+    zsock_t *stats_socket;
+
     /** Event packet handler function */
     osd_hostmod_event_handler_fn event_handler;
 
@@ -59,6 +170,227 @@ struct iothread_usr_ctx {
     void *event_handler_arg;
 };
 
+/**
+ * Handle the response to a management request sent by
+ * iothread_send_mgmt_req()
+ *
+ * @param success was the request acknowledged (ACK) by the host controller?
+ */
+static void iothread_handle_mgmt_resp(struct worker_thread_ctx *thread_ctx,
+                                      bool success)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    if (!usrctx->mgmt_done_msg) {
+        err(thread_ctx->log_ctx, "Ignoring unexpected management message.");
+        return;
+    }
+
+    worker_send_status(thread_ctx->inproc_socket, usrctx->mgmt_done_msg,
+                       success ? OSD_OK : OSD_ERROR_FAILURE);
+    usrctx->mgmt_done_msg = NULL;
+}
+
+/**
+ * Send a management request with a DI address (or subnet) as parameter
+ *
+ * Other than during the connection setup, data messages can arrive at any
+ * time. The response to the request is therefore not waited for, but handled
+ * in iothread_rcv_from_hostctrl(), which then sends @p done_msg to the main
+ * thread.
+ *
+ * @param opcode request opcode in protocol version 2
+ * @param command request string in protocol version 1
+ * @param diaddr parameter of the request
+ * @param text second (text) parameter of the request, or NULL
+ * @param done_msg name of the status message sent to the main thread when
+ *                 the response arrives
+ */
+static void iothread_send_mgmt_req(struct worker_thread_ctx *thread_ctx,
+                                   uint8_t opcode, const char *command,
+                                   uint16_t diaddr, const char *text,
+                                   const char *done_msg)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    int zmq_rv;
+
+    if (usrctx->mgmt_done_msg) {
+        err(thread_ctx->log_ctx, "Another management request is outstanding.");
+        worker_send_status(thread_ctx->inproc_socket, done_msg,
+                           OSD_ERROR_FAILURE);
+        return;
+    }
+
+    zmsg_t *msg;
+    if (usrctx->proto_version == PROTO_VERSION_2 && text) {
+        msg = proto_msg_new_u16_str(opcode, usrctx->tx_seq++, diaddr, text);
+    } else if (usrctx->proto_version == PROTO_VERSION_2) {
+        msg = proto_msg_new_u16(opcode, usrctx->tx_seq++, diaddr);
+    } else {
+        msg = zmsg_new();
+        assert(msg);
+        zmq_rv = zmsg_addstr(msg, "M");
+        assert(zmq_rv == 0);
+        if (text) {
+            zmq_rv = zmsg_addstrf(msg, "%s %u %s", command, diaddr, text);
+        } else {
+            zmq_rv = zmsg_addstrf(msg, "%s %u", command, diaddr);
+        }
+        assert(zmq_rv == 0);
+    }
+
+    zmq_rv = zmsg_send(&msg, usrctx->hostctrl_socket);
+    if (zmq_rv != 0) {
+        err(thread_ctx->log_ctx, "Unable to send %s request.", command);
+        zmsg_destroy(&msg);
+        worker_send_status(thread_ctx->inproc_socket, done_msg,
+                           OSD_ERROR_CONNECTION_FAILED);
+        return;
+    }
+
+    usrctx->mgmt_done_msg = done_msg;
+}
+
+/**
+ * Flow control: grant credits to the host controller if needed
+ */
+static void iothread_grant_credits(struct worker_thread_ctx *thread_ctx)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    if (usrctx->proto_version != PROTO_VERSION_2) {
+        return;
+    }
+
+    uint32_t credits = proto_credit_rx_refill(&usrctx->rx_credit);
+    if (credits == 0) {
+        return;
+    }
+
+    zmsg_t *msg = proto_msg_new_u32(PROTO_OP_CREDIT, usrctx->tx_seq++, credits);
+    int zmq_rv = zmsg_send(&msg, usrctx->hostctrl_socket);
+    if (zmq_rv != 0) {
+        err(thread_ctx->log_ctx, "Unable to grant credits to host controller.");
+        zmsg_destroy(&msg);
+    }
+}
+
+/**
+ * Send a data message to the host controller
+ *
+ * If the host controller has not granted us enough credits the message is
+ * queued until credits arrive. Control messages (register accesses) are not
+ * subject to flow control and always sent right away.
+ *
+ * @param msg the message, using the internal "D" type frame. Ownership is
+ *            passed on to this function.
+ */
+static void iothread_send_data(struct worker_thread_ctx *thread_ctx,
+                               zmsg_t **msg)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    int rv;
+
+    // message from the main thread: "D", packet data[, trace record]
+    zmsg_first(*msg);
+    zframe_t *data_frame = zmsg_next(*msg);
+    zframe_t *trace_frame = zmsg_next(*msg);
+    assert(data_frame);
+
+    size_t data_size = zframe_size(data_frame);
+    bool use_credit = usrctx->tx_flowctrl &&
+                      tclass_from_frame(data_frame) == OSD_TCLASS_BULK;
+    if (use_credit && usrctx->tx_credits == 0) {
+        if (!usrctx->tx_stall_start_us) {
+            usrctx->tx_stall_start_us = zclock_usecs();
+            stats_counter_add(&usrctx->flowctrl_stats->tx_stalls, 1);
+        }
+        rv = zlist_append(usrctx->tx_queue, *msg);
+        assert(rv == 0);
+        *msg = NULL;
+        return;
+    }
+
+    if (usrctx->proto_version == PROTO_VERSION_2) {
+        uint16_t flags = 0;
+        if (trace_frame) {
+            latency_frame_stamp(trace_frame, LATENCY_STAGE_HOSTMOD_TX);
+            flags |= PROTO_FLAG_TRACE;
+        }
+        zframe_t *type_frame = zmsg_pop(*msg);
+        zframe_destroy(&type_frame);
+        zframe_t *hdr_frame =
+            proto_hdr_frame_new(PROTO_OP_DATA, flags, usrctx->tx_seq++);
+        rv = zmsg_prepend(*msg, &hdr_frame);
+        assert(rv == 0);
+    } else if (trace_frame) {
+        // the text protocol cannot carry trace records
+        zmsg_remove(*msg, trace_frame);
+        zframe_destroy(&trace_frame);
+    }
+    TRACE_PACKET_FRAME(hostmod_send, data_frame);
+    rv = zmsg_send(msg, usrctx->hostctrl_socket);
+    assert(rv == 0);
+    stats_counter_add(usrctx->stats_tx_packets, 1);
+    stats_counter_add(usrctx->stats_tx_bytes, data_size);
+
+    if (use_credit) {
+        usrctx->tx_credits--;
+        stats_counter_add(&usrctx->flowctrl_stats->tx_credits, -1);
+    }
+}
+
+/**
+ * Flow control: the host controller granted us credits
+ */
+static void iothread_handle_credit(struct worker_thread_ctx *thread_ctx,
+                                   const zframe_t *body)
+{
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    uint32_t credits;
+    if (OSD_FAILED(proto_body_get_u32(body, &credits))) {
+        err(thread_ctx->log_ctx, "Ignoring malformed CREDIT message.");
+        return;
+    }
+
+    usrctx->tx_flowctrl = true;
+    usrctx->tx_credits += credits;
+    stats_counter_add(&usrctx->flowctrl_stats->tx_credits, credits);
+
+    if (usrctx->tx_stall_start_us) {
+        stats_counter_add(&usrctx->flowctrl_stats->tx_stall_time_us,
+                          zclock_usecs() - usrctx->tx_stall_start_us);
+        usrctx->tx_stall_start_us = 0;
+    }
+
+    zmsg_t *msg;
+    while (usrctx->tx_credits > 0 && (msg = zlist_pop(usrctx->tx_queue))) {
+        iothread_send_data(thread_ctx, &msg);
+    }
+}
+
+/**
+ * Get the integer value of a status message sent by worker_send_status()
+ */
+static int inproc_msg_get_value(zmsg_t *msg)
+{
+    int value;
+    zframe_t *name_frame = zmsg_first(msg);
+    assert(name_frame);
+    zframe_t *value_frame = zmsg_next(msg);
+    assert(value_frame && zframe_size(value_frame) == sizeof(int));
+    memcpy(&value, zframe_data(value_frame), sizeof(int));
+    return value;
+}
+
 /**
  * Process incoming messages from the host controller
  *
@@ -84,22 +416,76 @@ static int iothread_rcv_from_hostctrl(zloop_t *loop, zsock_t *reader,
 
     zframe_t *type_frame = zmsg_first(msg);
     assert(type_frame);
+
+    struct proto_hdr hdr;
+    if (OSD_SUCCEEDED(proto_hdr_parse(type_frame, &hdr))) {
+        if (hdr.opcode == PROTO_OP_ACK || hdr.opcode == PROTO_OP_NACK) {
+            iothread_handle_mgmt_resp(thread_ctx, hdr.opcode == PROTO_OP_ACK);
+            zmsg_destroy(&msg);
+            return 0;
+        }
+        if (hdr.opcode == PROTO_OP_CREDIT) {
+            zmsg_first(msg);
+            iothread_handle_credit(thread_ctx, zmsg_next(msg));
+            zmsg_destroy(&msg);
+            return 0;
+        }
+        if (hdr.opcode != PROTO_OP_DATA) {
+            err(thread_ctx->log_ctx,
+                "Ignoring unexpected management message 0x%02x.", hdr.opcode);
+            zmsg_destroy(&msg);
+            return 0;
+        }
+
+        // Data messages are processed right away, the host controller can
+        // send the next one. Only bulk traffic is subject to flow control.
+        if (tclass_from_frame(zmsg_next(msg)) == OSD_TCLASS_BULK) {
+            proto_credit_rx_use(&usrctx->rx_credit);
+            iothread_grant_credits(thread_ctx);
+        }
+
+        // Internally (between the I/O thread and the main thread) data
+        // messages always use the "D" type frame, followed by the packet and
+        // the trace record (if any).
+        zframe_t *hdr_frame = zmsg_pop(msg);
+        zframe_destroy(&hdr_frame);
+        rv = zmsg_pushstr(msg, "D");
+        assert(rv == 0);
+        if (hdr.flags & PROTO_FLAG_TRACE) {
+            latency_frame_stamp(zmsg_last(msg), LATENCY_STAGE_HOSTMOD_RX);
+        }
+        type_frame = zmsg_first(msg);
+    }
+
     if (zframe_streq(type_frame, "D")) {
         zframe_t *data_frame = zmsg_next(msg);
         assert(data_frame);
+        stats_counter_add(usrctx->stats_rx_packets, 1);
+        stats_counter_add(usrctx->stats_rx_bytes, zframe_size(data_frame));
 
         struct osd_packet *pkg;
         osd_rv = osd_packet_new_from_zframe(&pkg, data_frame);
         assert(OSD_SUCCEEDED(osd_rv));
+        TRACE_PACKET_PKG(hostmod_recv, pkg);
 
         // Forward EVENT packets to handler function.
         // Ownership of |pkg| is transferred to the event handler.
         if (osd_packet_get_type(pkg) == OSD_PACKET_TYPE_EVENT) {
             zmsg_destroy(&msg);
+            if (!usrctx->event_handler) {
+                err(thread_ctx->log_ctx,
+                    "No event handler set, dropping EVENT packet.");
+                stats_counter_add(usrctx->stats_rx_events_dropped, 1);
+                osd_packet_free(&pkg);
+                return 0;
+            }
+            stats_counter_add(usrctx->stats_rx_events, 1);
+            TRACE_PACKET_PKG(event_dispatch, pkg);
             osd_rv = usrctx->event_handler(usrctx->event_handler_arg, pkg);
             if (OSD_FAILED(osd_rv)) {
                 err(thread_ctx->log_ctx, "Handling EVENT packet failed: %d",
                     osd_rv);
+                stats_counter_add(usrctx->stats_rx_events_dropped, 1);
             }
             return 0;
         }
@@ -111,7 +497,10 @@ static int iothread_rcv_from_hostctrl(zloop_t *loop, zsock_t *reader,
         assert(rv == 0);
 
     } else if (zframe_streq(type_frame, "M")) {
-        assert(0 && "TODO: Handle incoming management messages.");
+        zframe_t *status_frame = zmsg_next(msg);
+        iothread_handle_mgmt_resp(thread_ctx,
+                                  status_frame && zframe_streq(status_frame, "ACK"));
+        zmsg_destroy(&msg);
 
     } else {
         assert(0 && "Message of unknown type received.");
@@ -121,10 +510,48 @@ static int iothread_rcv_from_hostctrl(zloop_t *loop, zsock_t *reader,
 }
 
 /**
- * Obtain a DI address for this host debug module from the host controller
+ * Obtain a DI address using the binary protocol (version 2)
  */
-static osd_result iothread_obtain_diaddr(struct worker_thread_ctx *thread_ctx,
-                                         uint16_t *di_addr)
+static osd_result iothread_obtain_diaddr_v2(
+    struct worker_thread_ctx *thread_ctx, uint16_t *di_addr)
+{
+    osd_result rv;
+
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    struct proto_hdr resp_hdr;
+    zframe_t *resp_body = NULL;
+    rv = proto_request(usrctx->hostctrl_socket, thread_ctx->log_ctx,
+                       PROTO_OP_DIADDR_REQUEST, usrctx->tx_seq++, NULL, 0,
+                       &resp_hdr, &resp_body);
+    if (OSD_FAILED(rv)) {
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+
+    if (resp_hdr.opcode != PROTO_OP_DIADDR_RESPONSE) {
+        err(thread_ctx->log_ctx,
+            "Host controller did not assign a DI address (response 0x%02x)",
+            resp_hdr.opcode);
+        zframe_destroy(&resp_body);
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+
+    rv = proto_body_get_u16(resp_body, di_addr);
+    zframe_destroy(&resp_body);
+    if (OSD_FAILED(rv)) {
+        err(thread_ctx->log_ctx, "Malformed DI address response received.");
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+
+    return OSD_OK;
+}
+
+/**
+ * Obtain a DI address using the text protocol (version 1)
+ */
+static osd_result iothread_obtain_diaddr_v1(
+    struct worker_thread_ctx *thread_ctx, uint16_t *di_addr)
 {
     int rv;
 
@@ -173,6 +600,29 @@ static osd_result iothread_obtain_diaddr(struct worker_thread_ctx *thread_ctx,
 
     zmsg_destroy(&msg_resp);
 
+    return OSD_OK;
+}
+
+/**
+ * Obtain a DI address for this host debug module from the host controller
+ */
+static osd_result iothread_obtain_diaddr(struct worker_thread_ctx *thread_ctx,
+                                         uint16_t *di_addr)
+{
+    osd_result rv;
+
+    struct iothread_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    if (usrctx->proto_version == PROTO_VERSION_2) {
+        rv = iothread_obtain_diaddr_v2(thread_ctx, di_addr);
+    } else {
+        rv = iothread_obtain_diaddr_v1(thread_ctx, di_addr);
+    }
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+
     dbg(thread_ctx->log_ctx,
         "Obtained DI address %u.%u (%u) from host controller.",
         osd_diaddr_subnet(*di_addr), osd_diaddr_localaddr(*di_addr), *di_addr);
@@ -198,8 +648,19 @@ static void iothread_connect_to_hostctrl(struct worker_thread_ctx *thread_ctx)
     osd_result retval;
     osd_result osd_rv;
 
-    // create new DIALER socket to connect with the host controller
-    usrctx->hostctrl_socket = zsock_new_dealer(usrctx->host_controller_address);
+    // create new DIALER socket to connect with the host controller. A
+    // shared-memory connection is reached through an inproc endpoint.
+    const char *hostctrl_endpoint = usrctx->host_controller_address;
+    if (shm_is_url(usrctx->host_controller_address)) {
+        osd_rv = shm_client_new(&usrctx->shm_client, thread_ctx->log_ctx,
+                                usrctx->host_controller_address);
+        if (OSD_FAILED(osd_rv)) {
+            retval = -1;
+            goto free_return;
+        }
+        hostctrl_endpoint = shm_client_get_endpoint(usrctx->shm_client);
+    }
+    usrctx->hostctrl_socket = zsock_new_dealer(hostctrl_endpoint);
     if (!usrctx->hostctrl_socket) {
         err(thread_ctx->log_ctx, "Unable to connect to %s",
             usrctx->host_controller_address);
@@ -208,6 +669,14 @@ static void iothread_connect_to_hostctrl(struct worker_thread_ctx *thread_ctx)
     }
     zsock_set_rcvtimeo(usrctx->hostctrl_socket, ZMQ_RCV_TIMEOUT);
 
+    // Agree on a protocol version with the host controller
+    osd_rv = proto_negotiate(usrctx->hostctrl_socket, thread_ctx->log_ctx,
+                             &usrctx->proto_version);
+    if (OSD_FAILED(osd_rv)) {
+        retval = -1;
+        goto free_return;
+    }
+
     // Get our DI address
     uint16_t di_addr;
     osd_rv = iothread_obtain_diaddr(thread_ctx, &di_addr);
@@ -217,6 +686,12 @@ static void iothread_connect_to_hostctrl(struct worker_thread_ctx *thread_ctx)
     }
     retval = di_addr;
 
+    // Allow the host controller to send data to us
+    usrctx->rx_credit.outstanding = 0;
+    usrctx->tx_flowctrl = false;
+    usrctx->tx_credits = 0;
+    iothread_grant_credits(thread_ctx);
+
     // register handler for messages coming from the host controller
     int zmq_rv;
     zmq_rv = zloop_reader(thread_ctx->zloop, usrctx->hostctrl_socket,
@@ -227,6 +702,7 @@ static void iothread_connect_to_hostctrl(struct worker_thread_ctx *thread_ctx)
 free_return:
     if (retval == -1) {
         zsock_destroy(&usrctx->hostctrl_socket);
+        shm_client_free(&usrctx->shm_client);
     }
     worker_send_status(thread_ctx->inproc_socket, "I-CONNECT-DONE", retval);
 }
@@ -248,6 +724,23 @@ static void iothread_disconnect_from_hostctrl(
 
     zloop_reader_end(thread_ctx->zloop, usrctx->hostctrl_socket);
     zsock_destroy(&usrctx->hostctrl_socket);
+    shm_client_free(&usrctx->shm_client);
+
+    // messages still waiting for credits are lost
+    zmsg_t *queued_msg;
+    while ((queued_msg = zlist_pop(usrctx->tx_queue))) {
+        zmsg_destroy(&queued_msg);
+        stats_counter_add(&usrctx->flowctrl_stats->dropped, 1);
+    }
+    if (usrctx->tx_flowctrl) {
+        stats_counter_add(&usrctx->flowctrl_stats->tx_credits,
+                          -(int64_t)usrctx->tx_credits);
+    }
+    if (usrctx->tx_stall_start_us) {
+        stats_counter_add(&usrctx->flowctrl_stats->tx_stall_time_us,
+                          zclock_usecs() - usrctx->tx_stall_start_us);
+        usrctx->tx_stall_start_us = 0;
+    }
 
     retval = OSD_OK;
 
@@ -260,18 +753,57 @@ static osd_result iothread_handle_inproc_request(
     struct iothread_usr_ctx *usrctx = thread_ctx->usr;
     assert(usrctx);
 
-    int rv;
-
     if (!strcmp(name, "I-CONNECT")) {
         iothread_connect_to_hostctrl(thread_ctx);
 
     } else if (!strcmp(name, "I-DISCONNECT")) {
         iothread_disconnect_from_hostctrl(thread_ctx);
 
+    } else if (!strcmp(name, "I-SUBSCRIBE")) {
+        iothread_send_mgmt_req(thread_ctx, PROTO_OP_SUBSCRIBE, "SUBSCRIBE",
+                               inproc_msg_get_value(msg), NULL,
+                               "I-SUBSCRIBE-DONE");
+
+    } else if (!strcmp(name, "I-UNSUBSCRIBE")) {
+        iothread_send_mgmt_req(thread_ctx, PROTO_OP_UNSUBSCRIBE, "UNSUBSCRIBE",
+                               inproc_msg_get_value(msg), NULL,
+                               "I-UNSUBSCRIBE-DONE");
+
+    } else if (!strcmp(name, "I-SET-GATEWAY-FILTER")) {
+        // uint16_t subnet, followed by the rules (not NUL terminated)
+        zframe_t *value_frame = zmsg_next(msg);
+        assert(value_frame && zframe_size(value_frame) >= sizeof(uint16_t));
+        uint16_t subnet;
+        memcpy(&subnet, zframe_data(value_frame), sizeof(uint16_t));
+        char *rules =
+            strndup((char *)zframe_data(value_frame) + sizeof(uint16_t),
+                    zframe_size(value_frame) - sizeof(uint16_t));
+        assert(rules);
+        iothread_send_mgmt_req(thread_ctx, PROTO_OP_GW_FILTER, "GW_FILTER",
+                               subnet, rules, "I-SET-GATEWAY-FILTER-DONE");
+        free(rules);
+
+    } else if (!strcmp(name, "I-MGMT-CANCEL")) {
+        // the main thread gave up waiting; a late response is ignored
+        usrctx->mgmt_done_msg = NULL;
+        worker_send_status(thread_ctx->inproc_socket, "I-MGMT-CANCEL-DONE",
+                           OSD_OK);
+
+    } else if (!strcmp(name, "I-SET-STATS-ENDPOINT")) {
+        char *endpoint = zframe_strdup(zmsg_next(msg));
+        osd_result rv = stats_endpoint_bind(thread_ctx->zloop, usrctx->stats,
+                                            endpoint, &usrctx->stats_socket);
+        if (OSD_FAILED(rv)) {
+            err(thread_ctx->log_ctx, "Unable to bind stats endpoint %s",
+                endpoint);
+        }
+        free(endpoint);
+        worker_send_status(thread_ctx->inproc_socket,
+                           "I-SET-STATS-ENDPOINT-DONE", rv);
+
     } else if (!strcmp(name, "D")) {
         // Forward data packet to the host controller
-        rv = zmsg_send(&msg, usrctx->hostctrl_socket);
-        assert(rv == 0);
+        iothread_send_data(thread_ctx, &msg);
 
     } else {
         assert(0 && "Received unknown message from main thread.");
@@ -288,6 +820,14 @@ static osd_result iothread_destroy(struct worker_thread_ctx *thread_ctx)
     struct iothread_usr_ctx *usrctx = thread_ctx->usr;
     assert(usrctx);
 
+    stats_endpoint_close(thread_ctx->zloop, &usrctx->stats_socket);
+
+    zmsg_t *queued_msg;
+    while ((queued_msg = zlist_pop(usrctx->tx_queue))) {
+        zmsg_destroy(&queued_msg);
+    }
+    zlist_destroy(&usrctx->tx_queue);
+
     free(usrctx->host_controller_address);
     free(usrctx);
     thread_ctx->usr = NULL;
@@ -300,8 +840,9 @@ static osd_result iothread_destroy(struct worker_thread_ctx *thread_ctx)
  *
  * The actual sending is done through the I/O worker.
  */
-static osd_result osd_hostmod_send_packet(struct osd_hostmod_ctx *ctx,
-                                          struct osd_packet *packet)
+API_EXPORT
+osd_result osd_hostmod_send_packet(struct osd_hostmod_ctx *ctx,
+                                   const struct osd_packet *packet)
 {
     assert(ctx);
     assert(ctx->ioworker_ctx);
@@ -316,6 +857,18 @@ static osd_result osd_hostmod_send_packet(struct osd_hostmod_ctx *ctx,
     rv = zmsg_addmem(msg, packet->data_raw, osd_packet_sizeof(packet));
     assert(rv == 0);
 
+    // only register access requests are traced, their responses complete the
+    // trace
+    if (ctx->latency_tracing &&
+        osd_packet_get_type(packet) == OSD_PACKET_TYPE_REG) {
+        struct latency_trace trace = {0};
+        trace.id = ((uint64_t)ctx->diaddr << 48) | ctx->latency_trace_seq++;
+        latency_stamp(&trace, LATENCY_STAGE_HOSTMOD_SEND);
+        zframe_t *trace_frame = latency_trace_frame_new(&trace);
+        rv = zmsg_append(msg, &trace_frame);
+        assert(rv == 0);
+    }
+
     rv = zmsg_send(&msg, ctx->ioworker_ctx->inproc_socket);
     if (rv != 0) {
         return OSD_ERROR_COM;
@@ -324,6 +877,85 @@ static osd_result osd_hostmod_send_packet(struct osd_hostmod_ctx *ctx,
     return OSD_OK;
 }
 
+/**
+ * Drop the data messages queued by hostmod_wait_for_status()
+ */
+static void hostmod_rx_queue_flush(struct osd_hostmod_ctx *ctx)
+{
+    zmsg_t *msg;
+    while ((msg = zlist_pop(ctx->rx_queue))) {
+        zmsg_destroy(&msg);
+    }
+}
+
+/**
+ * Wait for a status message from the I/O thread
+ *
+ * Data messages can arrive at any time; the ones arriving before the status
+ * message are queued for osd_hostmod_receive_packet(). Status messages of
+ * earlier requests which were given up on are dropped.
+ *
+ * @return OSD_OK if the status message was received,
+ *         OSD_ERROR_TIMEDOUT if it didn't arrive in time,
+ *         any other value indicates an error
+ */
+static osd_result hostmod_wait_for_status(struct osd_hostmod_ctx *ctx,
+                                          const char *name, int *retvalue)
+{
+    int64_t deadline = zclock_mono() + 1.5 * ZMQ_RCV_TIMEOUT;
+
+    while (zclock_mono() < deadline) {
+        errno = 0;
+        zmsg_t *msg = zmsg_recv(ctx->ioworker_ctx->inproc_socket);
+        if (!msg) {
+            return errno == EAGAIN ? OSD_ERROR_TIMEDOUT : OSD_ERROR_FAILURE;
+        }
+
+        zframe_t *name_frame = zmsg_first(msg);
+        if (zframe_streq(name_frame, "D")) {
+            zlist_append(ctx->rx_queue, msg);
+            continue;
+        }
+        if (!zframe_streq(name_frame, name)) {
+            char *stale_name = zframe_strdup(name_frame);
+            dbg(ctx->log_ctx, "Dropping stale %s message.", stale_name);
+            free(stale_name);
+            zmsg_destroy(&msg);
+            continue;
+        }
+
+        zframe_t *data_frame = zmsg_next(msg);
+        assert(data_frame && zframe_size(data_frame) == sizeof(int));
+        memcpy(retvalue, zframe_data(data_frame), sizeof(int));
+        zmsg_destroy(&msg);
+        return OSD_OK;
+    }
+    return OSD_ERROR_TIMEDOUT;
+}
+
+/**
+ * Wait for the status of a management request sent by the I/O thread
+ *
+ * If the host controller doesn't respond in time the request is cancelled,
+ * which makes room for the next request.
+ */
+static osd_result hostmod_wait_for_mgmt_status(struct osd_hostmod_ctx *ctx,
+                                               const char *name,
+                                               int *retvalue)
+{
+    osd_result rv = hostmod_wait_for_status(ctx, name, retvalue);
+    if (rv != OSD_ERROR_TIMEDOUT) {
+        return rv;
+    }
+
+    err(ctx->log_ctx, "No response from the host controller, cancelling "
+        "the request.");
+    worker_send_status(ctx->ioworker_ctx->inproc_socket, "I-MGMT-CANCEL", 0);
+    int cancel_retval;
+    hostmod_wait_for_status(ctx, "I-MGMT-CANCEL-DONE", &cancel_retval);
+    return OSD_ERROR_TIMEDOUT;
+}
+
 /**
  * Receive a DI Packet
  *
@@ -336,19 +968,26 @@ static osd_result osd_hostmod_receive_packet(struct osd_hostmod_ctx *ctx,
 {
     osd_result osd_rv;
 
-    errno = 0;
-    zmsg_t *msg = zmsg_recv(ctx->ioworker_ctx->inproc_socket);
-    if (!msg && errno == EAGAIN) {
-        return OSD_ERROR_TIMEDOUT;
+    zmsg_t *msg = zlist_pop(ctx->rx_queue);
+    while (!msg) {
+        errno = 0;
+        msg = zmsg_recv(ctx->ioworker_ctx->inproc_socket);
+        if (!msg && errno == EAGAIN) {
+            return OSD_ERROR_TIMEDOUT;
+        }
+        assert(msg);
+
+        // status messages of requests which were given up on are dropped
+        if (!zframe_streq(zmsg_first(msg), "D")) {
+            char *name = zframe_strdup(zmsg_first(msg));
+            dbg(ctx->log_ctx, "Dropping stale %s message.", name);
+            free(name);
+            zmsg_destroy(&msg);
+        }
     }
-    assert(msg);
 
-    // ensure that the message we got from the I/O thread is packet data
-    // XXX: possibly extend to hand off non-packet messages to their appropriate
-    // handler
     zframe_t *type_frame = zmsg_pop(msg);
     assert(type_frame);
-    assert(zframe_streq(type_frame, "D"));
     zframe_destroy(&type_frame);
 
     // get osd_packet from frame data
@@ -358,6 +997,16 @@ static osd_result osd_hostmod_receive_packet(struct osd_hostmod_ctx *ctx,
     osd_rv = osd_packet_new_from_zframe(&p, data_frame);
     assert(OSD_SUCCEEDED(osd_rv));
 
+    // a traced request is complete once its response has been received
+    zframe_t *trace_frame = zmsg_pop(msg);
+    struct latency_trace trace;
+    if (trace_frame && ctx->latency_recorder &&
+        OSD_SUCCEEDED(latency_trace_from_frame(trace_frame, &trace))) {
+        latency_stamp(&trace, LATENCY_STAGE_HOSTMOD_RECV);
+        latency_recorder_add(ctx->latency_recorder, &trace);
+    }
+
+    zframe_destroy(&trace_frame);
     zframe_destroy(&data_frame);
     zmsg_destroy(&msg);
 
@@ -390,6 +1039,25 @@ osd_result osd_hostmod_new(struct osd_hostmod_ctx **ctx,
     iothread_usr_data->event_handler_arg = event_handler_arg;
     iothread_usr_data->host_controller_address =
         strdup(host_controller_address);
+    iothread_usr_data->tx_queue = zlist_new();
+    assert(iothread_usr_data->tx_queue);
+    iothread_usr_data->flowctrl_stats = &c->flowctrl_stats;
+
+    int pthread_rv = pthread_mutex_init(&c->reg_stats_lock, NULL);
+    assert(pthread_rv == 0);
+
+    c->stats = stats_new();
+    iothread_usr_data->stats = c->stats;
+    iothread_usr_data->stats_tx_packets = stats_counter(c->stats, "tx_packets");
+    iothread_usr_data->stats_tx_bytes = stats_counter(c->stats, "tx_bytes");
+    iothread_usr_data->stats_rx_packets = stats_counter(c->stats, "rx_packets");
+    iothread_usr_data->stats_rx_bytes = stats_counter(c->stats, "rx_bytes");
+    iothread_usr_data->stats_rx_events = stats_counter(c->stats, "rx_events");
+    iothread_usr_data->stats_rx_events_dropped =
+        stats_counter(c->stats, "rx_events_dropped");
+
+    c->rx_queue = zlist_new();
+    assert(c->rx_queue);
 
     rv = worker_new(&c->ioworker_ctx, log_ctx, NULL, iothread_destroy,
                     iothread_handle_inproc_request, iothread_usr_data);
@@ -454,8 +1122,7 @@ osd_result osd_hostmod_disconnect(struct osd_hostmod_ctx *ctx)
 
     worker_send_status(ctx->ioworker_ctx->inproc_socket, "I-DISCONNECT", 0);
     osd_result retval;
-    rv = worker_wait_for_status(ctx->ioworker_ctx->inproc_socket,
-                                "I-DISCONNECT-DONE", &retval);
+    rv = hostmod_wait_for_status(ctx, "I-DISCONNECT-DONE", &retval);
     if (OSD_FAILED(rv)) {
         return rv;
     }
@@ -463,11 +1130,220 @@ osd_result osd_hostmod_disconnect(struct osd_hostmod_ctx *ctx)
         return retval;
     }
 
+    // packets from the old connection are not received any more
+    hostmod_rx_queue_flush(ctx);
     ctx->is_connected = false;
 
     return OSD_OK;
 }
 
+/**
+ * Send a subscription request through the I/O thread and wait for the result
+ */
+static osd_result hostmod_subscription_req(struct osd_hostmod_ctx *ctx,
+                                           const char *req_msg,
+                                           const char *done_msg,
+                                           uint16_t diaddr)
+{
+    osd_result rv;
+
+    assert(ctx);
+
+    if (!ctx->is_connected) {
+        return OSD_ERROR_NOT_CONNECTED;
+    }
+
+    worker_send_status(ctx->ioworker_ctx->inproc_socket, req_msg, diaddr);
+    int retval;
+    rv = hostmod_wait_for_mgmt_status(ctx, done_msg, &retval);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+    return retval;
+}
+
+API_EXPORT
+osd_result osd_hostmod_subscribe(struct osd_hostmod_ctx *ctx, uint16_t diaddr)
+{
+    osd_result rv;
+    rv = hostmod_subscription_req(ctx, "I-SUBSCRIBE", "I-SUBSCRIBE-DONE",
+                                  diaddr);
+    if (OSD_FAILED(rv)) {
+        err(ctx->log_ctx, "Unable to subscribe to EVENT packets to %u (%d)",
+            diaddr, rv);
+    }
+    return rv;
+}
+
+API_EXPORT
+osd_result osd_hostmod_unsubscribe(struct osd_hostmod_ctx *ctx,
+                                   uint16_t diaddr)
+{
+    osd_result rv;
+    rv = hostmod_subscription_req(ctx, "I-UNSUBSCRIBE", "I-UNSUBSCRIBE-DONE",
+                                  diaddr);
+    if (OSD_FAILED(rv)) {
+        err(ctx->log_ctx, "Unable to unsubscribe from EVENT packets to %u (%d)",
+            diaddr, rv);
+    }
+    return rv;
+}
+
+API_EXPORT
+osd_result osd_hostmod_set_gateway_filter(struct osd_hostmod_ctx *ctx,
+                                          uint16_t subnet, const char *rules)
+{
+    osd_result rv;
+    assert(ctx);
+    assert(rules);
+
+    if (!ctx->is_connected) {
+        return OSD_ERROR_NOT_CONNECTED;
+    }
+
+    size_t rules_len = strlen(rules);
+    uint8_t *data = malloc(sizeof(uint16_t) + rules_len);
+    assert(data);
+    memcpy(data, &subnet, sizeof(uint16_t));
+    memcpy(data + sizeof(uint16_t), rules, rules_len);
+    worker_send_data(ctx->ioworker_ctx->inproc_socket, "I-SET-GATEWAY-FILTER",
+                     data, sizeof(uint16_t) + rules_len);
+    free(data);
+
+    int retval;
+    rv = hostmod_wait_for_mgmt_status(ctx, "I-SET-GATEWAY-FILTER-DONE",
+                                      &retval);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+    if (OSD_FAILED(retval)) {
+        err(ctx->log_ctx, "Unable to set the filter of subnet %u (%d)", subnet,
+            retval);
+    }
+    return retval;
+}
+
+API_EXPORT
+osd_result osd_hostmod_set_stats_endpoint(struct osd_hostmod_ctx *ctx,
+                                          const char *endpoint)
+{
+    osd_result rv;
+    assert(ctx);
+    assert(endpoint);
+
+    worker_send_data(ctx->ioworker_ctx->inproc_socket, "I-SET-STATS-ENDPOINT",
+                     endpoint, strlen(endpoint));
+    int retval;
+    rv = hostmod_wait_for_status(ctx, "I-SET-STATS-ENDPOINT-DONE", &retval);
+    if (OSD_FAILED(rv)) {
+        return rv;
+    }
+    return retval;
+}
+
+API_EXPORT
+osd_result osd_hostmod_set_latency_tracing(struct osd_hostmod_ctx *ctx,
+                                           bool enable)
+{
+    assert(ctx);
+
+    if (enable && !ctx->latency_recorder) {
+        ctx->latency_recorder = latency_recorder_new(ctx->stats);
+    }
+    ctx->latency_tracing = enable;
+    return OSD_OK;
+}
+
+API_EXPORT
+osd_result osd_hostmod_write_latency_trace(struct osd_hostmod_ctx *ctx,
+                                           const char *filename)
+{
+    osd_result rv;
+    assert(ctx);
+    assert(filename);
+
+    if (!ctx->latency_recorder) {
+        err(ctx->log_ctx, "Latency tracing was never enabled.");
+        return OSD_ERROR_FAILURE;
+    }
+
+    FILE *f = fopen(filename, "w");
+    if (!f) {
+        err(ctx->log_ctx, "Unable to open %s: %s", filename, strerror(errno));
+        return OSD_ERROR_FAILURE;
+    }
+    rv = latency_recorder_write_json(ctx->latency_recorder, f);
+    if (fclose(f) != 0) {
+        rv = OSD_ERROR_FAILURE;
+    }
+    if (OSD_FAILED(rv)) {
+        err(ctx->log_ctx, "Unable to write latency trace to %s", filename);
+    }
+    return rv;
+}
+
+API_EXPORT
+osd_result osd_hostmod_get_stats(struct osd_hostmod_ctx *ctx,
+                                 struct osd_hostmod_reg_stats **stats,
+                                 size_t *count, int flags)
+{
+    assert(ctx);
+    assert(stats);
+    assert(count);
+
+    *stats = NULL;
+    *count = 0;
+    size_t stats_size = 0;
+
+    pthread_mutex_lock(&ctx->reg_stats_lock);
+    for (int w = 0; w < 2; w++) {
+        for (int s = 0; s < REG_WIDTHS; s++) {
+            for (int n = 0; n <= OSD_DIADDR_SUBNET_MAX; n++) {
+                struct reg_stats *rs = ctx->reg_stats[w][s][n];
+                if (!rs || (rs->latency_ns.count == 0 && rs->errors == 0)) {
+                    continue;
+                }
+
+                if (*count == stats_size) {
+                    stats_size = stats_size ? stats_size * 2 : 8;
+                    *stats = realloc(*stats, stats_size * sizeof(**stats));
+                    assert(*stats);
+                }
+                struct osd_hostmod_reg_stats *e = &(*stats)[(*count)++];
+                const struct hdrhist *h = &rs->latency_ns;
+                e->subnet = n;
+                e->is_write = w;
+                e->reg_size_bit = 16 << s;
+                e->count = h->count;
+                e->errors = rs->errors;
+                e->min_ns = h->count ? h->min : 0;
+                e->mean_ns = h->count ? h->sum / h->count : 0;
+                e->p50_ns = hdrhist_percentile(h, 50);
+                e->p99_ns = hdrhist_percentile(h, 99);
+                e->p999_ns = hdrhist_percentile(h, 99.9);
+                e->max_ns = h->max;
+
+                if (flags & OSD_HOSTMOD_STATS_RESET) {
+                    hdrhist_reset(&rs->latency_ns);
+                    rs->errors = 0;
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&ctx->reg_stats_lock);
+
+    return OSD_OK;
+}
+
+API_EXPORT
+void osd_hostmod_get_flowctrl_stats(struct osd_hostmod_ctx *ctx,
+                                    struct osd_flowctrl_stats *stats)
+{
+    assert(ctx);
+    assert(stats);
+    flowctrl_stats_get(&ctx->flowctrl_stats, stats);
+}
+
 API_EXPORT
 void osd_hostmod_free(struct osd_hostmod_ctx **ctx_p)
 {
@@ -480,11 +1356,59 @@ void osd_hostmod_free(struct osd_hostmod_ctx **ctx_p)
     assert(!ctx->is_connected);
 
     worker_free(&ctx->ioworker_ctx);
+    hostmod_rx_queue_flush(ctx);
+    zlist_destroy(&ctx->rx_queue);
+    latency_recorder_free(&ctx->latency_recorder);
+    stats_free(&ctx->stats);
+
+    for (int w = 0; w < 2; w++) {
+        for (int s = 0; s < REG_WIDTHS; s++) {
+            for (int n = 0; n <= OSD_DIADDR_SUBNET_MAX; n++) {
+                free(ctx->reg_stats[w][s][n]);
+            }
+        }
+    }
+    pthread_mutex_destroy(&ctx->reg_stats_lock);
 
     free(ctx);
     *ctx_p = NULL;
 }
 
+/**
+ * Account for a register access in the register access statistics
+ *
+ * @param subtype_req the subtype of the request packet
+ * @param answered has a response been received?
+ * @param latency_ns time between sending the request and receiving the
+ *                   response (only valid if @p answered is true)
+ * @param result the result of the access
+ */
+static void reg_stats_record(struct osd_hostmod_ctx *ctx, uint16_t module_addr,
+                             enum osd_packet_type_reg_subtype subtype_req,
+                             bool answered, uint64_t latency_ns,
+                             osd_result result)
+{
+    // request subtypes: bit 2 is set for writes, bits 1:0 encode the width
+    int is_write = (subtype_req >> 2) & 1;
+    int width = subtype_req & 0b11;
+    unsigned int subnet = osd_diaddr_subnet(module_addr);
+
+    pthread_mutex_lock(&ctx->reg_stats_lock);
+    struct reg_stats *stats = ctx->reg_stats[is_write][width][subnet];
+    if (!stats) {
+        stats = calloc(1, sizeof(struct reg_stats));
+        assert(stats);
+        ctx->reg_stats[is_write][width][subnet] = stats;
+    }
+    if (answered) {
+        hdrhist_record(&stats->latency_ns, latency_ns);
+    }
+    if (OSD_FAILED(result)) {
+        stats->errors++;
+    }
+    pthread_mutex_unlock(&ctx->reg_stats_lock);
+}
+
 static osd_result osd_hostmod_regaccess(
     struct osd_hostmod_ctx *ctx, uint16_t module_addr, uint16_t reg_addr,
     enum osd_packet_type_reg_subtype subtype_req,
@@ -499,6 +1423,9 @@ static osd_result osd_hostmod_regaccess(
     *response = NULL;
     osd_result retval = OSD_ERROR_FAILURE;
     osd_result rv;
+    bool answered = false;
+    uint64_t start_ns = latency_now_ns();
+    uint64_t latency_ns = 0;
 
     // block register read indefinitely until response has been received
     bool do_block = (flags & OSD_HOSTMOD_BLOCKING);
@@ -536,6 +1463,8 @@ static osd_result osd_hostmod_regaccess(
         retval = rv;
         goto err_free_req;
     }
+    latency_ns = latency_now_ns() - start_ns;
+    answered = true;
 
     // parse response
     assert(osd_packet_get_type(pkg_resp) == OSD_PACKET_TYPE_REG);
@@ -568,6 +1497,9 @@ err_free_resp:
 err_free_req:
     free(pkg_req);
 
+    reg_stats_record(ctx, module_addr, subtype_req, answered, latency_ns,
+                     retval);
+
     return retval;
 }
 
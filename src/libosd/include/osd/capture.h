@@ -0,0 +1,122 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OSD_CAPTURE_H
+#define OSD_CAPTURE_H
+
+#include <osd/osd.h>
+#include <osd/packet.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup libosd-capture Capture Files
+ * @ingroup libosd
+ *
+ * Read traffic captured by a host controller (see osd_hostctrl_set_capture())
+ *
+ * A capture file starts with the 8 byte magic OSD_CAPTURE_MAGIC, followed by
+ * one record per routed packet. A record consists of a 12 byte header
+ * (uint64 timestamp in ns since the start of the capture, uint16 packet size
+ * in bytes, uint8 source identity length, uint8 destination identity length,
+ * all little endian), the ZeroMQ identities of the sending and the receiving
+ * client, and the DI packet. Packets routed to multiple receivers (EVENT
+ * packets with subscribers) result in one record per receiver.
+ *
+ * @{
+ */
+
+/** Magic bytes at the start of a capture file (version 1 of the format) */
+#define OSD_CAPTURE_MAGIC "OSDCAP\0\1"
+
+/** Size of OSD_CAPTURE_MAGIC (bytes) */
+#define OSD_CAPTURE_MAGIC_SIZE 8
+
+/** Maximum length of a ZeroMQ identity in a capture record */
+#define OSD_CAPTURE_IDENTITY_MAX 255
+
+/**
+ * A packet routed by the host controller
+ */
+struct osd_capture_record {
+    /** Time the packet was routed (ns since the start of the capture) */
+    uint64_t timestamp_ns;
+
+    /** ZeroMQ identity of the client which sent the packet */
+    uint8_t src_identity[OSD_CAPTURE_IDENTITY_MAX];
+    /** Length of src_identity (bytes) */
+    size_t src_identity_len;
+
+    /** ZeroMQ identity of the client the packet was routed to */
+    uint8_t dest_identity[OSD_CAPTURE_IDENTITY_MAX];
+    /** Length of dest_identity (bytes) */
+    size_t dest_identity_len;
+
+    /**
+     * The packet, or NULL at the end of the capture. The caller takes
+     * ownership of the packet.
+     */
+    struct osd_packet *packet;
+};
+
+struct osd_capture_reader;
+
+/**
+ * Open a capture file for reading
+ *
+ * @param ctx the reader context
+ * @param log_ctx the log context to be used. Set to NULL to disable logging
+ * @param filename the capture file
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if the file cannot be opened or is no capture file
+ */
+osd_result osd_capture_reader_new(struct osd_capture_reader **ctx,
+                                  struct osd_log_ctx *log_ctx,
+                                  const char *filename);
+
+/**
+ * Read the next record
+ *
+ * @param ctx the reader context
+ * @param[out] record the record. record->packet is NULL at the end of the
+ *                    capture.
+ * @return OSD_OK if a record was read or the end of the capture was reached,
+ *         OSD_ERROR_FAILURE if the file is corrupt
+ */
+osd_result osd_capture_reader_next(struct osd_capture_reader *ctx,
+                                   struct osd_capture_record *record);
+
+/**
+ * Start reading from the first record again
+ */
+osd_result osd_capture_reader_rewind(struct osd_capture_reader *ctx);
+
+/**
+ * Close the capture file and free all resources
+ */
+void osd_capture_reader_free(struct osd_capture_reader **ctx_p);
+
+/**@}*/ /* end of doxygen group libosd-capture */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // OSD_CAPTURE_H
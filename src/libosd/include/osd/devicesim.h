@@ -0,0 +1,203 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OSD_DEVICESIM_H
+#define OSD_DEVICESIM_H
+
+#include <osd/osd.h>
+#include <osd/packet.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup libosd-devicesim Device Simulator
+ * @ingroup libosd
+ *
+ * A simulated OSD device in software
+ *
+ * The simulator plugs into a gateway in place of a real device: pass
+ * osd_devicesim_packet_read() and osd_devicesim_packet_write() as
+ * callbacks to osd_gateway_new(), with the simulator context as callback
+ * argument.
+ *
+ * The simulated debug subnet contains the following modules:
+ *
+ * - A Subnet Control Module (SCM) at local address 0.
+ * - A Memory Access Module (MAM) at local address 1, if the simulated memory
+ *   has a size larger than 0.
+ * - A configurable number of System Trace Modules (STM), followed by a
+ *   configurable number of Core Trace Modules (CTM). Once activated (bit
+ *   OSD_REG_BASE_MOD_CS_ACTIVE in register OSD_REG_BASE_MOD_CS) each trace
+ *   module emits EVENT packets to the address in OSD_REG_BASE_MOD_EVENT_DEST
+ *   at a configurable rate. The first payload word of each EVENT packet is a
+ *   sequence number (per module), which allows a receiver to detect lost
+ *   packets.
+ *
+ * All modules implement the base register map with 16 bit register
+ * accesses. Accesses to unknown registers are answered with an error.
+ *
+ * The MAM gives access to the simulated memory with a simplified transfer
+ * protocol: a PLAIN packet to the MAM has the payload
+ * - word 0: bit 15: write (1) or read (0), bit 14: acknowledge a write,
+ *   bits 13..0: number of 16 bit data words to transfer
+ * - word 1 and 2: byte address (high word first)
+ * - for writes: the data words
+ *
+ * A read is answered with PLAIN packets containing the data words, a write
+ * with an empty PLAIN packet if an acknowledgement was requested.
+ *
+ * A configurable latency delays all packets between host and device, as on
+ * a real link.
+ *
+ * @{
+ */
+
+/**
+ * Configuration of a simulated device
+ */
+struct osd_devicesim_config {
+    /** Subnet address of the device */
+    unsigned int subnet_addr;
+
+    /** Size of the memory behind the MAM (bytes), 0 for no MAM */
+    size_t mem_size;
+
+    /** Number of System Trace Modules */
+    unsigned int stm_count;
+
+    /** Number of Core Trace Modules */
+    unsigned int ctm_count;
+
+    /** EVENT packets per second emitted by each active trace module */
+    unsigned int event_rate;
+
+    /**
+     * Smallest payload of an EVENT packet (words, at least 1)
+     *
+     * The payload sizes are uniformly distributed between event_payload_min
+     * and event_payload_max.
+     */
+    unsigned int event_payload_min;
+
+    /** Largest payload of an EVENT packet (words) */
+    unsigned int event_payload_max;
+
+    /** One-way latency of the link between host and device (us) */
+    unsigned int link_latency_us;
+
+    /** Seed of the random number generator choosing the payload sizes */
+    unsigned int seed;
+};
+
+/**
+ * Statistics of a simulated device
+ */
+struct osd_devicesim_stats {
+    /** EVENT packets read from the device */
+    uint64_t events_sent;
+
+    /**
+     * EVENT packets dropped since they weren't read from the device in time
+     * (the trace buffer of the module overflowed)
+     */
+    uint64_t events_dropped;
+
+    /** Register accesses answered by the device */
+    uint64_t reg_accesses;
+
+    /** Bytes read and written by the MAM */
+    uint64_t mem_bytes;
+};
+
+/**
+ * Opaque context object
+ *
+ * Create and initialize a new object with osd_devicesim_new() and delete it
+ * with osd_devicesim_free().
+ */
+struct osd_devicesim_ctx;
+
+/**
+ * Fill a configuration with the default values
+ *
+ * The default device has 1 MB of memory, one STM and one CTM emitting
+ * 10000 EVENT packets per second each with 1 to 8 payload words, and a link
+ * latency of 0.
+ */
+void osd_devicesim_config_init(struct osd_devicesim_config *config);
+
+/**
+ * Create a new simulated device
+ *
+ * @param ctx the context object
+ * @param log_ctx the log context to be used. Set to NULL to disable logging
+ * @param config the configuration of the device
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if the configuration is invalid,
+ *         OSD_ERROR_OOM if the memory cannot be allocated
+ */
+osd_result osd_devicesim_new(struct osd_devicesim_ctx **ctx,
+                             struct osd_log_ctx *log_ctx,
+                             const struct osd_devicesim_config *config);
+
+/**
+ * Free the simulated device
+ *
+ * Disconnect the gateway using the device first.
+ */
+void osd_devicesim_free(struct osd_devicesim_ctx **ctx_p);
+
+/**
+ * Read a packet from the device (packet_read_fn)
+ *
+ * Blocks until the next packet is available.
+ *
+ * @param pkg the read packet
+ * @param cb_arg the simulator context (struct osd_devicesim_ctx)
+ * @return OSD_OK
+ */
+osd_result osd_devicesim_packet_read(struct osd_packet **pkg, void *cb_arg);
+
+/**
+ * Write a packet to the device (packet_write_fn)
+ *
+ * @param pkg the packet to write
+ * @param cb_arg the simulator context (struct osd_devicesim_ctx)
+ * @return OSD_OK
+ */
+osd_result osd_devicesim_packet_write(const struct osd_packet *pkg,
+                                      void *cb_arg);
+
+/**
+ * Get the statistics of the device
+ *
+ * @param ctx the context object
+ * @param[out] stats the statistics
+ */
+void osd_devicesim_get_stats(struct osd_devicesim_ctx *ctx,
+                             struct osd_devicesim_stats *stats);
+
+/**@}*/ /* end of doxygen group libosd-devicesim */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // OSD_DEVICESIM_H
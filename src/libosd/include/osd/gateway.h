@@ -63,14 +63,84 @@ typedef osd_result (*packet_read_fn)(struct osd_packet **pkg, void *cb_arg);
 typedef osd_result (*packet_write_fn)(const struct osd_packet *pkg,
         void *cb_arg);
 
+/**
+ * Write a stream of packets to the device
+ *
+ * The packets are passed as consecutive Debug Transport Datagrams (DTDs):
+ * each packet is preceded by its size in uint16_t words, the same layout as
+ * struct osd_packet. All words are in native endianness.
+ *
+ * @param dtds the packets
+ * @param size_words size of @p dtds in uint16_t words
+ * @param cb_arg an user-defined callback argument
+ * @return OSD_ERROR_NOT_CONNECTED if the not connected to the device
+ * @return OSD_OK if successful
+ *
+ * @see osd_gateway_set_packet_write_batch()
+ */
+typedef osd_result (*packet_write_batch_fn)(const uint16_t *dtds,
+        size_t size_words, void *cb_arg);
+
+/**
+ * Minimum size of the buffer passed to packet_read_batch_fn (uint16_t words)
+ *
+ * The buffer holds at least one packet of the maximum size.
+ */
+#define OSD_GATEWAY_READ_BATCH_MIN_WORDS (1 + UINT16_MAX)
+
+/**
+ * Read a stream of packets from the device
+ *
+ * The packets are returned as consecutive Debug Transport Datagrams (DTDs)
+ * in native endianness, the layout used by packet_write_batch_fn. Only
+ * complete DTDs are returned: a packet which doesn't fit into @p dtds any
+ * more is returned by the next call.
+ *
+ * The function blocks until at least one packet is available, and returns
+ * all packets which are available at that time (and fit). If the device is
+ * read through a file descriptor (see osd_gateway_set_device_fd()) it must
+ * not block and sets @p size_words to 0 if no packet is available.
+ *
+ * @param dtds buffer to read to, owned by the gateway
+ * @param max_words size of @p dtds in uint16_t words, at least
+ *                  OSD_GATEWAY_READ_BATCH_MIN_WORDS
+ * @param[out] size_words number of words read to @p dtds
+ * @param cb_arg an user-defined callback argument
+ * @return OSD_ERROR_NOT_CONNECTED if the not connected to the device
+ * @return OSD_OK if successful
+ *
+ * @see osd_gateway_new_batched()
+ */
+typedef osd_result (*packet_read_batch_fn)(uint16_t *dtds, size_t max_words,
+        size_t *size_words, void *cb_arg);
+
+/**
+ * Device access of a gateway created with osd_gateway_new_batched()
+ */
+struct osd_gateway_device_ops {
+    /**
+     * Read packets from the device. Can be NULL if the device is read
+     * through a file descriptor with a packet_read_fn callback, see
+     * osd_gateway_set_device_fd().
+     */
+    packet_read_batch_fn read_batch;
+
+    /** Write packets to the device */
+    packet_write_batch_fn write_batch;
+};
+
 /**
  * Create new osd_gateway instance
  *
  * @param[out] ctx the osd_gateway_ctx context to be created
  * @param[in] log_ctx the log context to be used. Set to NULL to disable logging
- * @param[in] host_controller_address ZeroMQ endpoint of the host controller
+ * @param[in] host_controller_address ZeroMQ endpoint of the host controller,
+ *                                    or shm://<path> to connect through shared
+ *                                    memory
  * @param[in] device_subnet_addr Subnet address of the device
- * @param[in] packet_read callback function to perform a read from the device
+ * @param[in] packet_read callback function to perform a read from the device.
+ *                        Can be NULL if the device is read through a file
+ *                        descriptor, see osd_gateway_set_device_fd().
  * @param[in] packet_write callback function to perform a write to the device
  * @param[in] cb_arg an user-defined pointer passed to all callback functions,
  *                   such as packet_read and packet_write. Can be used to pass
@@ -90,6 +160,41 @@ osd_result osd_gateway_new(struct osd_gateway_ctx **ctx,
                            packet_write_fn packet_write,
                            void *cb_arg);
 
+/**
+ * Create new osd_gateway instance for a device accessed in batches
+ *
+ * Like osd_gateway_new(), but the device is read and written with one call
+ * for many packets (see struct osd_gateway_device_ops). The gateway reads
+ * into buffers of its own and passes the bulk packets of a read (e.g. trace
+ * data) on to the host controller without copying them. This amortizes the
+ * cost of device accesses (e.g. system calls) and of memory allocations over
+ * all packets transferred at once. The counter "device.rx_reads" of the
+ * gateway statistics counts the reads which returned data.
+ *
+ * Gateways created with osd_gateway_new() access the device one packet at a
+ * time; on the way to the device the packets are written from a buffer of
+ * the gateway as well, without allocating memory.
+ *
+ * @param[out] ctx the osd_gateway_ctx context to be created
+ * @param[in] log_ctx the log context to be used. Set to NULL to disable logging
+ * @param[in] host_controller_address ZeroMQ endpoint of the host controller,
+ *                                    or shm://<path> to connect through shared
+ *                                    memory
+ * @param[in] device_subnet_addr Subnet address of the device
+ * @param[in] ops callbacks accessing the device (copied)
+ * @param[in] cb_arg an user-defined pointer passed to all callback functions,
+ *                   see osd_gateway_new()
+ * @return OSD_OK on success, any other value indicates an error
+ *
+ * @see osd_gateway_free()
+ */
+osd_result osd_gateway_new_batched(struct osd_gateway_ctx **ctx,
+                                   struct osd_log_ctx *log_ctx,
+                                   const char *host_controller_address,
+                                   uint16_t device_subnet_addr,
+                                   const struct osd_gateway_device_ops *ops,
+                                   void *cb_arg);
+
 /**
  * Free and NULL a communication API context object
  *
@@ -130,6 +235,259 @@ osd_result osd_gateway_disconnect(struct osd_gateway_ctx *ctx);
  */
 bool osd_gateway_is_connected(struct osd_gateway_ctx *ctx);
 
+/**
+ * Set the scheduling of traffic classes
+ *
+ * Packets from the device and packets to the device are sorted into traffic
+ * classes (see enum osd_traffic_class) if they queue up in the gateway. With
+ * OSD_TCLASS_WEIGHT_STRICT (the default) control packets (register accesses)
+ * are always forwarded first. With a weight N > 0, up to N control packets
+ * are forwarded for every bulk packet if both classes have packets waiting.
+ *
+ * @param ctx the context object
+ * @param control_weight control packets per bulk packet, or
+ *                       OSD_TCLASS_WEIGHT_STRICT
+ * @return OSD_OK on success, any other value indicates an error
+ */
+osd_result osd_gateway_set_tclass_weight(struct osd_gateway_ctx *ctx,
+                                         unsigned int control_weight);
+
+/**
+ * Read from a pollable device in the I/O thread of the gateway
+ *
+ * By default the gateway reads from the device in a separate thread with
+ * the blocking packet_read callback passed to osd_gateway_new(), and passes
+ * the packets on to the thread talking to the host controller. Devices
+ * which provide a file descriptor can instead be read by the latter thread
+ * directly: the file descriptor is polled together with the connection to
+ * the host controller, and @p packet_read_nonblocking is called whenever it
+ * is readable. Reading from the device, writing to it and talking to the
+ * host controller then happens on one thread, which saves a thread switch
+ * and a message per packet.
+ *
+ * @p packet_read_nonblocking has the signature of packet_read, but must not
+ * block: if no packet is available it returns OSD_OK and sets the packet to
+ * NULL. The file descriptor must be readable as long as packets are
+ * available.
+ *
+ * Gateways created with osd_gateway_new_batched() can pass NULL as
+ * @p packet_read_nonblocking: the read_batch callback is then called
+ * whenever the file descriptor is readable, and must not block.
+ *
+ * While the gateway waits for credits from the host controller (see
+ * osd_gateway_get_flowctrl_stats()) control packets are still read from the
+ * device, bulk packets are held back in the gateway up to a limit. Devices
+ * read with read_batch aren't read any more until credits arrive.
+ *
+ * This function must be called before osd_gateway_connect().
+ *
+ * @param ctx the context object
+ * @param fd file descriptor which is readable while packets are available
+ *           from the device, or -1 to read the device in a separate thread
+ * @param packet_read_nonblocking callback reading a packet from the device
+ *                                without blocking, or NULL to use the
+ *                                read_batch callback of a batched gateway
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if the gateway is already connected to the device
+ */
+osd_result osd_gateway_set_device_fd(struct osd_gateway_ctx *ctx, int fd,
+                                     packet_read_fn packet_read_nonblocking);
+
+/**
+ * Write packets to the device in batches
+ *
+ * All packets waiting to be written to the device are passed to
+ * @p packet_write_batch in one call instead of calling the packet_write
+ * callback passed to osd_gateway_new() for each packet. This reduces the
+ * number of device accesses if many packets are sent to the device at once,
+ * e.g. bursts of register writes.
+ *
+ * The callback is called from the same thread as packet_write.
+ *
+ * @param ctx the context object
+ * @param packet_write_batch callback writing a stream of packets to the
+ *                           device, or NULL to write every packet with
+ *                           packet_write
+ * @return OSD_OK on success, any other value indicates an error
+ */
+osd_result osd_gateway_set_packet_write_batch(
+    struct osd_gateway_ctx *ctx, packet_write_batch_fn packet_write_batch);
+
+/**
+ * Set the batching of packets read from the device
+ *
+ * Bulk packets read from the device (e.g. trace data) are passed from the
+ * thread reading from the device to the thread talking to the host
+ * controller in batches, which makes the reading thread cheaper per packet.
+ * A batch is forwarded once it holds @p max_bytes, or at the latest
+ * @p max_delay_ms after it was started. The first packet after a pause in the
+ * packet stream is forwarded right away. Control packets (register accesses)
+ * are never batched.
+ *
+ * By default batches of up to 16 kB are formed with a maximum delay of 1 ms.
+ * The batch sizes are recorded in the histogram "device.rx_batch" (see
+ * osd_gateway_set_stats_endpoint()).
+ *
+ * Batching copies the packets into the batch, all other packets are
+ * forwarded to the host controller without copying. The counter
+ * "device.rx_copy_bytes" counts the copied bytes, "device.rx_buf_allocs" the
+ * allocated batch buffers (batch buffers are reused once their packets are
+ * sent).
+ *
+ * Gateways created with osd_gateway_new_batched() forward the bulk packets
+ * of every read from the device as one batch, without copying them and
+ * without holding them back; the settings of this function don't apply to
+ * them.
+ *
+ * @param ctx the context object
+ * @param max_bytes maximum size of a batch in bytes, 0 to disable batching
+ * @param max_delay_ms maximum time a packet is held back in a batch (ms, > 0)
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if the gateway is already connected to the device
+ */
+osd_result osd_gateway_set_rx_batch(struct osd_gateway_ctx *ctx,
+                                    size_t max_bytes,
+                                    unsigned int max_delay_ms);
+
+/**
+ * Compress the data sent to the host controller
+ *
+ * Compression is meant for remote host controllers, where the network
+ * bandwidth is the bottleneck. It applies to bulk packets read from the
+ * device in batches (see osd_gateway_set_rx_batch()): all packets of a batch
+ * are sent in one compressed message. Packet headers are delta coded before
+ * the stream is compressed with a fast LZ77 codec.
+ *
+ * Compression is negotiated with the host controller when connecting. Host
+ * controllers without support for compression receive uncompressed data.
+ *
+ * The compression is recorded in the counters "host.compress_in_bytes",
+ * "host.compress_out_bytes" (the compression ratio is in/out) and
+ * "host.compress_ns" (CPU time spent compressing), see
+ * osd_gateway_set_stats_endpoint().
+ *
+ * @param ctx the context object
+ * @param enable compress data to the host controller
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if the gateway is already connected to the host
+ *         controller
+ */
+osd_result osd_gateway_set_compression(struct osd_gateway_ctx *ctx,
+                                       bool enable);
+
+/**
+ * Serve an additional subnet
+ *
+ * A gateway connected to several devices (e.g. a rack of FPGA boards) serves
+ * the subnets of all of them over one connection to the host controller.
+ * The gateway registers for the subnet passed to osd_gateway_new() and for
+ * all subnets added with this function. Packets from the host controller to
+ * any of the subnets are passed to the write callbacks, which route them to
+ * the device by the subnet of their destination.
+ *
+ * @param ctx the context object
+ * @param subnet_addr address of the subnet
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if the subnet is invalid or already served, or
+ *         if the gateway is already connected to the host controller
+ */
+osd_result osd_gateway_add_subnet(struct osd_gateway_ctx *ctx,
+                                  uint16_t subnet_addr);
+
+/**
+ * TYPE_SUB of the summary packets of aggregated sources
+ *
+ * See osd_gateway_set_rx_filter()
+ */
+#define OSD_GATEWAY_SUMMARY_TYPE_SUB 0xf
+
+/** Number of buckets in the payload size histogram of a summary packet */
+#define OSD_GATEWAY_SUMMARY_HIST_BUCKETS 8
+
+/** Payload size of a summary packet in uint16_t words */
+#define OSD_GATEWAY_SUMMARY_PAYLOAD_WORDS \
+    (6 + 2 * OSD_GATEWAY_SUMMARY_HIST_BUCKETS)
+
+/**
+ * Filter and aggregate the bulk packets read from the device
+ *
+ * The filter drops or aggregates trace packets next to the device, before
+ * they are sent to the host controller. It consists of rules separated by
+ * ';'. Each rule has an action and optional conditions:
+ *
+ * - "drop": drop the packets
+ * - "sample <N>": forward every N-th packet of each source
+ * - "aggregate <ms>": forward a summary of the packets of each source every
+ *   <ms> milliseconds instead of the packets
+ * - "src=<subnet>.<local>" (or "src=<diaddr>"): the packet is sent by this
+ *   module
+ * - "type_sub=<N>": the packet has this subtype
+ *
+ * The first rule whose conditions all match decides about a packet; packets
+ * no rule matches are forwarded. Register accesses are never filtered.
+ *
+ * Example: drop the packets of module 1.5, and only count the packets of all
+ * other modules, reported every second
+ *
+ * @code{.c}
+ * osd_gateway_set_rx_filter(ctx, "drop src=1.5; aggregate 1000");
+ * @endcode
+ *
+ * A summary is an EVENT packet with TYPE_SUB OSD_GATEWAY_SUMMARY_TYPE_SUB
+ * from the aggregated module to the destination of its last packet. Its
+ * payload consists of OSD_GATEWAY_SUMMARY_PAYLOAD_WORDS words, forming 32 bit
+ * values with the lower word first:
+ *
+ * - number of aggregated packets
+ * - sum of their payload sizes (uint16_t words)
+ * - duration of the aggregation interval (ms)
+ * - OSD_GATEWAY_SUMMARY_HIST_BUCKETS packet counts by payload size:
+ *   bucket 0 counts packets without payload, bucket N packets with
+ *   2^(N-1) to 2^N - 1 words of payload. The last bucket counts all larger
+ *   packets as well.
+ *
+ * Sources without packets in an interval send no summary. The filter
+ * applies to the packets of all subnets the gateway serves. The rules of a
+ * gateway serving a single subnet can also be set by a host module through
+ * the host controller (see osd_hostmod_set_gateway_filter()). Dropped packets are counted in the
+ * counter "device.rx_filtered", aggregated packets in
+ * "device.rx_aggregated" and sent summaries in "host.tx_summaries".
+ *
+ * @param ctx the context object
+ * @param rules the filter rules, or an empty string to forward all packets
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if the rules are invalid
+ */
+osd_result osd_gateway_set_rx_filter(struct osd_gateway_ctx *ctx,
+                                     const char *rules);
+
+/**
+ * Serve the statistics of the gateway on a local endpoint
+ *
+ * The endpoint answers the request "STATS" with the packet counters of the
+ * gateway as text (see osd_hostctrl_set_stats_endpoint()).
+ *
+ * @param ctx the context object
+ * @param endpoint ZeroMQ endpoint to bind to, e.g. ipc:///tmp/osd-gateway
+ * @return OSD_OK on success,
+ *         OSD_ERROR_CONNECTION_FAILED if binding to @p endpoint failed
+ */
+osd_result osd_gateway_set_stats_endpoint(struct osd_gateway_ctx *ctx,
+                                          const char *endpoint);
+
+/**
+ * Get flow control statistics
+ *
+ * The statistics cover data messages sent from the device to the host
+ * controller. While the gateway has no credits left reading from the device
+ * is paused; tx_stalls and tx_stall_time_us count these pauses.
+ *
+ * @param ctx the context object
+ * @param[out] stats the statistics
+ */
+void osd_gateway_get_flowctrl_stats(struct osd_gateway_ctx *ctx,
+                                    struct osd_flowctrl_stats *stats);
+
 /**@}*/ /* end of doxygen group libosd-gateway */
 
 #ifdef __cplusplus
@@ -37,6 +37,73 @@ extern "C" {
 
 struct osd_gateway_glip_ctx;
 
+/** Maximum number of GLIP channels used by one gateway */
+#define OSD_GATEWAY_GLIP_CHANNELS_MAX 16
+
+/**
+ * Assignment of packets written to the device to GLIP channels
+ *
+ * Packets from the device are read from all channels. The device is expected
+ * to send all packets of one source module over the same channel.
+ */
+enum osd_gateway_glip_stripe {
+    /**
+     * Assign packets to channels by the local address of their destination
+     *
+     * All packets to one module are sent over the same channel and stay in
+     * order.
+     */
+    OSD_GATEWAY_GLIP_STRIPE_DEST = 0,
+
+    /**
+     * Send register accesses over channel 0, and all other packets over the
+     * remaining channels, assigned by their destination
+     *
+     * Register accesses don't queue up behind bulk traffic. Packets to one
+     * module stay in order only within one traffic class.
+     */
+    OSD_GATEWAY_GLIP_STRIPE_TCLASS = 1,
+};
+
+/**
+ * Traffic of one GLIP channel
+ */
+struct osd_gateway_glip_channel_stats {
+    /** Packets read from the channel */
+    uint64_t rx_packets;
+    /** Bytes read from the channel (excluding the length words) */
+    uint64_t rx_bytes;
+    /** Packets written to the channel */
+    uint64_t tx_packets;
+    /** Bytes written to the channel (excluding the length words) */
+    uint64_t tx_bytes;
+};
+
+/**
+ * Traffic and resource use of one device
+ */
+struct osd_gateway_glip_device_stats {
+    /** Packets read from the device */
+    uint64_t rx_packets;
+    /** Bytes read from the device (excluding the length words) */
+    uint64_t rx_bytes;
+    /** Packets written to the device */
+    uint64_t tx_packets;
+    /** Bytes written to the device (excluding the length words) */
+    uint64_t tx_bytes;
+    /**
+     * CPU time spent reading from and writing to the device (ns). If the
+     * gateway accesses a single device without channel threads, this is the
+     * CPU time of the whole process.
+     */
+    uint64_t cpu_ns;
+    /**
+     * Memory allocated by the gateway for the device (bytes), excluding the
+     * memory used by the GLIP backend
+     */
+    size_t mem_bytes;
+};
+
 /**
  * Create new osd_gateway_glip instance
  *
@@ -44,7 +111,11 @@ struct osd_gateway_glip_ctx;
  * @param[in] log_ctx the log context to be used. Set to NULL to disable logging
  * @param[in] host_controller_address ZeroMQ endpoint of the host controller
  * @param[in] device_subnet_addr Subnet address of the device
- * xxx
+ * @param[in] glip_backend_name name of the GLIP backend used to connect to
+ *                              the device
+ * @param[in] glip_backend_options options of the GLIP backend
+ * @param[in] glip_backend_options_len number of entries in
+ *                                     @p glip_backend_options
  * @return OSD_OK on success, any other value indicates an error
  *
  * @see osd_gateway_new()
@@ -58,6 +129,39 @@ osd_result osd_gateway_glip_new(struct osd_gateway_glip_ctx **ctx,
                                 const struct glip_option *glip_backend_options,
                                 size_t glip_backend_options_len);
 
+/**
+ * Serve another device through the same gateway
+ *
+ * One gateway process can serve several devices, e.g. a rack of FPGA boards,
+ * each in its own subnet. All devices share one connection to the host
+ * controller and its I/O thread (see osd_gateway_add_subnet()). Every device
+ * has its own GLIP context and its own channel threads, which can be pinned
+ * to CPUs with osd_gateway_glip_set_device_cpus(). Packets to the device are
+ * routed to it by the subnet of their destination.
+ *
+ * The channels of an added device are counted in the statistics
+ * "device.subnet<S>.channel<N>.{rx,tx}_{packets,bytes}"; the "device.*"
+ * statistics of the gateway hold the aggregate of all devices.
+ *
+ * Must be called before osd_gateway_glip_connect().
+ *
+ * @param ctx the context object
+ * @param device_subnet_addr subnet address of the device
+ * @param glip_backend_name name of the GLIP backend used to connect to the
+ *                          device
+ * @param glip_backend_options options of the GLIP backend
+ * @param glip_backend_options_len number of entries in
+ *                                 @p glip_backend_options
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if the subnet is invalid or already served,
+ *         GLIP could not be initialized or the gateway is connected
+ */
+osd_result osd_gateway_glip_add_device(
+    struct osd_gateway_glip_ctx *ctx, uint16_t device_subnet_addr,
+    const char *glip_backend_name,
+    const struct glip_option *glip_backend_options,
+    size_t glip_backend_options_len);
+
 /**
  * @copydoc osd_gateway_free()
  */
@@ -73,11 +177,127 @@ osd_result osd_gateway_glip_connect(struct osd_gateway_glip_ctx *ctx);
  */
 osd_result osd_gateway_glip_disconnect(struct osd_gateway_glip_ctx *ctx);
 
+/**
+ * @copydoc osd_gateway_set_tclass_weight()
+ */
+osd_result osd_gateway_glip_set_tclass_weight(
+    struct osd_gateway_glip_ctx *ctx, unsigned int control_weight);
+
+/**
+ * @copydoc osd_gateway_set_stats_endpoint()
+ */
+osd_result osd_gateway_glip_set_stats_endpoint(
+    struct osd_gateway_glip_ctx *ctx, const char *endpoint);
+
+/**
+ * @copydoc osd_gateway_set_compression()
+ */
+osd_result osd_gateway_glip_set_compression(struct osd_gateway_glip_ctx *ctx,
+                                            bool enable);
+
+/**
+ * @copydoc osd_gateway_set_rx_filter()
+ */
+osd_result osd_gateway_glip_set_rx_filter(struct osd_gateway_glip_ctx *ctx,
+                                          const char *rules);
+
 /**
  * @copydoc osd_is_connected()
  */
 bool osd_gateway_glip_is_connected(struct osd_gateway_glip_ctx *ctx);
 
+/**
+ * Use several GLIP channels in parallel
+ *
+ * By default the gateway uses GLIP channel 0 only. With more than one
+ * channel, every channel is read and written by its own pair of threads,
+ * and packets written to the device are distributed over the channels
+ * according to @p stripe. The traffic of every channel is counted in the
+ * statistics "device.channel<N>.{rx,tx}_{packets,bytes}"; the "device.*"
+ * statistics of the gateway hold the aggregate.
+ *
+ * This function configures the device passed to osd_gateway_glip_new(), see
+ * osd_gateway_glip_set_device_channels() for other devices.
+ *
+ * Must be called before osd_gateway_glip_connect().
+ *
+ * @param ctx the context object
+ * @param channels number of channels, 1 to OSD_GATEWAY_GLIP_CHANNELS_MAX
+ *                 (at least 2 when striping by traffic class)
+ * @param stripe assignment of packets to channels
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if the number of channels is invalid or the
+ *         gateway is connected
+ */
+osd_result osd_gateway_glip_set_channels(struct osd_gateway_glip_ctx *ctx,
+                                         unsigned int channels,
+                                         enum osd_gateway_glip_stripe stripe);
+
+/**
+ * Use several GLIP channels in parallel for one device
+ *
+ * Same as osd_gateway_glip_set_channels(), for the device serving the subnet
+ * @p device_subnet_addr (see osd_gateway_glip_add_device()).
+ */
+osd_result osd_gateway_glip_set_device_channels(
+    struct osd_gateway_glip_ctx *ctx, uint16_t device_subnet_addr,
+    unsigned int channels, enum osd_gateway_glip_stripe stripe);
+
+/**
+ * Pin the threads accessing a device to CPUs
+ *
+ * The RX and TX threads of all channels of the device run on the given CPUs
+ * only. Pinning the threads of each device to its own CPUs keeps the devices
+ * of a gateway from competing for CPU time and caches. A device with pinned
+ * threads is always accessed by channel threads, even if only one channel
+ * is used.
+ *
+ * Must be called before osd_gateway_glip_connect().
+ *
+ * @param ctx the context object
+ * @param device_subnet_addr subnet address of the device
+ * @param cpus numbers of the CPUs to run on
+ * @param cpus_len number of entries in @p cpus, 0 to run on all CPUs
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if the subnet isn't served, a CPU number is
+ *         invalid or the gateway is connected
+ */
+osd_result osd_gateway_glip_set_device_cpus(struct osd_gateway_glip_ctx *ctx,
+                                            uint16_t device_subnet_addr,
+                                            const unsigned int *cpus,
+                                            size_t cpus_len);
+
+/**
+ * Get the number of GLIP channels used for the first device
+ */
+unsigned int osd_gateway_glip_get_channels(struct osd_gateway_glip_ctx *ctx);
+
+/**
+ * Get the traffic of one GLIP channel of the first device
+ *
+ * @param ctx the context object
+ * @param channel the channel number
+ * @param[out] stats the traffic counters of the channel
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if the channel isn't used
+ */
+osd_result osd_gateway_glip_get_channel_stats(
+    struct osd_gateway_glip_ctx *ctx, unsigned int channel,
+    struct osd_gateway_glip_channel_stats *stats);
+
+/**
+ * Get the traffic and the resource use of one device
+ *
+ * @param ctx the context object
+ * @param device_subnet_addr subnet address of the device
+ * @param[out] stats the traffic and resource use of the device
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if the subnet isn't served by the gateway
+ */
+osd_result osd_gateway_glip_get_device_stats(
+    struct osd_gateway_glip_ctx *ctx, uint16_t device_subnet_addr,
+    struct osd_gateway_glip_device_stats *stats);
+
 /**@}*/ /* end of doxygen group libosd-gateway_glip */
 
 #ifdef __cplusplus
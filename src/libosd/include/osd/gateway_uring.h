@@ -0,0 +1,192 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OSD_GATEWAY_URING_H
+#define OSD_GATEWAY_URING_H
+
+#include <osd/osd.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup libosd-gateway_uring Gateway to a device on a TCP connection or
+ *                                a character device
+ * @ingroup libosd
+ *
+ * A native alternative to the GLIP gateway (see osd/gateway_glip.h) for
+ * devices which send their packets over a byte stream: simulations and FPGA
+ * boards reachable over TCP, and boards connected through a UART. The
+ * stream carries Debug Transport Datagrams (DTDs), every packet preceded by
+ * its size, all words in big endian; this is the data stream of the GLIP
+ * TCP backend.
+ *
+ * The device is read with io_uring: large reads fill the parts of a
+ * registered buffer in turn, the next read is in flight while the gateway
+ * processes the data of the previous ones. The I/O thread of the gateway
+ * parses the packets straight out of the completed reads (see
+ * osd_gateway_set_device_fd()), without a thread of its own.
+ *
+ * @{
+ */
+
+struct osd_gateway_uring_ctx;
+
+/** Default number of parts of the receive buffer */
+#define OSD_GATEWAY_URING_READS_DEFAULT 4
+
+/** Default size of a read (bytes) */
+#define OSD_GATEWAY_URING_READ_SIZE_DEFAULT (64 * 1024)
+
+/**
+ * Create new osd_gateway_uring instance
+ *
+ * @param[out] ctx the context object to be created
+ * @param[in] log_ctx the log context to be used. Set to NULL to disable logging
+ * @param[in] host_controller_address ZeroMQ endpoint of the host controller
+ * @param[in] device_subnet_addr Subnet address of the device
+ * @param[in] device the device: "tcp://<host>:<port>" for a TCP connection,
+ *                   or the path of a character device, e.g. /dev/ttyUSB0
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if @p device is invalid, any other value
+ *         indicates an error
+ *
+ * @see osd_gateway_new()
+ * @see osd_gateway_uring_free()
+ */
+osd_result osd_gateway_uring_new(struct osd_gateway_uring_ctx **ctx,
+                                 struct osd_log_ctx *log_ctx,
+                                 const char *host_controller_address,
+                                 uint16_t device_subnet_addr,
+                                 const char *device);
+
+/**
+ * @copydoc osd_gateway_free()
+ */
+void osd_gateway_uring_free(struct osd_gateway_uring_ctx **ctx_p);
+
+/**
+ * Set the number and size of the reads
+ *
+ * The receive buffer is split into @p reads parts of @p read_size bytes,
+ * which are read into in turn. Only one read is in flight at a time, so
+ * that the data is received in stream order; more parts let the device
+ * continue sending while the gateway processes the data of the previous
+ * reads.
+ *
+ * Must be called before osd_gateway_uring_connect().
+ *
+ * @param ctx the context object
+ * @param reads number of parts of the receive buffer (1 to 64)
+ * @param read_size maximum size of a read (bytes, at least 64)
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if a value is invalid or the gateway is
+ *         connected
+ */
+osd_result osd_gateway_uring_set_reads(struct osd_gateway_uring_ctx *ctx,
+                                       unsigned int reads, size_t read_size);
+
+/**
+ * Set the baud rate of a serial port
+ *
+ * The serial port is switched to raw mode (8 data bits, no parity) when the
+ * gateway connects. By default, the baud rate is left unchanged.
+ *
+ * Must be called before osd_gateway_uring_connect().
+ *
+ * @param ctx the context object
+ * @param baudrate the baud rate, e.g. 115200, or 0 to leave it unchanged
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if the baud rate is not supported
+ */
+osd_result osd_gateway_uring_set_baudrate(struct osd_gateway_uring_ctx *ctx,
+                                          unsigned int baudrate);
+
+/**
+ * @copydoc osd_gateway_connect()
+ */
+osd_result osd_gateway_uring_connect(struct osd_gateway_uring_ctx *ctx);
+
+/**
+ * @copydoc osd_gateway_disconnect()
+ */
+osd_result osd_gateway_uring_disconnect(struct osd_gateway_uring_ctx *ctx);
+
+/**
+ * @copydoc osd_gateway_is_connected()
+ */
+bool osd_gateway_uring_is_connected(struct osd_gateway_uring_ctx *ctx);
+
+/**
+ * @copydoc osd_gateway_set_tclass_weight()
+ */
+osd_result osd_gateway_uring_set_tclass_weight(
+    struct osd_gateway_uring_ctx *ctx, unsigned int control_weight);
+
+/**
+ * @copydoc osd_gateway_set_stats_endpoint()
+ */
+osd_result osd_gateway_uring_set_stats_endpoint(
+    struct osd_gateway_uring_ctx *ctx, const char *endpoint);
+
+/**
+ * @copydoc osd_gateway_set_compression()
+ */
+osd_result osd_gateway_uring_set_compression(
+    struct osd_gateway_uring_ctx *ctx, bool enable);
+
+/**
+ * @copydoc osd_gateway_set_rx_filter()
+ */
+osd_result osd_gateway_uring_set_rx_filter(struct osd_gateway_uring_ctx *ctx,
+                                           const char *rules);
+
+/**
+ * Traffic of the device
+ */
+struct osd_gateway_uring_stats {
+    /** Bytes read from the device */
+    uint64_t rx_bytes;
+    /** Completed reads */
+    uint64_t reads;
+    /** System calls submitting reads */
+    uint64_t submits;
+    /** Bytes written to the device */
+    uint64_t tx_bytes;
+    /** Invalid DTDs (shorter than a packet header) skipped */
+    uint64_t rx_invalid;
+};
+
+/**
+ * Get the traffic of the device
+ *
+ * The counters are also available as statistics "device.uring_*" (see
+ * osd_gateway_set_stats_endpoint()).
+ */
+void osd_gateway_uring_get_stats(struct osd_gateway_uring_ctx *ctx,
+                                 struct osd_gateway_uring_stats *stats);
+
+/**@}*/ /* end of doxygen group libosd-gateway_uring */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // OSD_GATEWAY_URING_H
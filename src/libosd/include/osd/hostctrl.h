@@ -17,6 +17,7 @@
 #define OSD_HOSTCTRL_H
 
 #include <osd/osd.h>
+#include <osd/packet.h>
 
 #include <czmq.h>
 #include <stdlib.h>
@@ -42,7 +43,9 @@ struct osd_hostctrl_ctx;
  *
  * @param ctx context object
  * @param log_ctx logging context
- * @param router_address ZeroMQ endpoint/URL the host controller will listen on
+ * @param router_address ZeroMQ endpoint/URL the host controller will listen on,
+ *                       or shm://<path> to accept connections through shared
+ *                       memory from components on the same machine
  * @return OSD_OK if initialization was successful,
  *         any other return code indicates an error
  */
@@ -78,6 +81,265 @@ void osd_hostctrl_free(struct osd_hostctrl_ctx **ctx_p);
  */
 bool osd_hostctrl_is_running(struct osd_hostctrl_ctx *ctx);
 
+/**
+ * Set the flow control mode
+ *
+ * In lossless mode (the default) senders are stalled if a receiver does not
+ * keep up, up to the device. In lossy mode senders are never stalled; the
+ * oldest data messages queued for a receiver which does not keep up are
+ * dropped instead.
+ *
+ * The mode can only be changed while the host controller is stopped.
+ *
+ * @param ctx the context object
+ * @param mode the flow control mode
+ * @return OSD_OK on success, any other value indicates an error
+ */
+osd_result osd_hostctrl_set_flowctrl_mode(struct osd_hostctrl_ctx *ctx,
+                                          enum osd_flowctrl_mode mode);
+
+/**
+ * Set the scheduling of traffic classes
+ *
+ * Data messages waiting for a client are queued per traffic class (see
+ * enum osd_traffic_class). With OSD_TCLASS_WEIGHT_STRICT (the default)
+ * control messages (register accesses) are always sent first. With a weight
+ * N > 0, up to N control messages are sent for every bulk message if both
+ * classes have messages waiting.
+ *
+ * The setting can be changed at any time.
+ *
+ * @param ctx the context object
+ * @param control_weight control messages per bulk message, or
+ *                       OSD_TCLASS_WEIGHT_STRICT
+ * @return OSD_OK on success, any other value indicates an error
+ */
+osd_result osd_hostctrl_set_tclass_weight(struct osd_hostctrl_ctx *ctx,
+                                          unsigned int control_weight);
+
+/**
+ * Get flow control statistics
+ *
+ * The statistics are summed up over all clients of the host controller.
+ * Stalls which are still ongoing are not included in tx_stall_time_us.
+ *
+ * @param ctx the context object
+ * @param[out] stats the statistics
+ */
+void osd_hostctrl_get_flowctrl_stats(struct osd_hostctrl_ctx *ctx,
+                                     struct osd_flowctrl_stats *stats);
+
+/**
+ * Data traffic statistics of a client of the host controller
+ */
+struct osd_hostctrl_client_stats {
+    /**
+     * DI address of the client (host modules), or subnet address (gateways)
+     */
+    uint16_t addr;
+
+    /** Is the client a gateway? */
+    bool is_gateway;
+
+    /** Number of data messages received from the client */
+    uint64_t packets;
+
+    /** Number of data bytes (DI packets) received from the client */
+    uint64_t bytes;
+
+    /** Number of data messages to the client which were dropped */
+    uint64_t tx_dropped;
+
+    /** Number of messages of the client currently queued for other clients */
+    uint64_t tx_queued;
+};
+
+/**
+ * Get data traffic statistics for all registered clients
+ *
+ * The statistics show how the host controller shares its bandwidth between
+ * the clients. Clients are reported in no particular order.
+ *
+ * @param ctx the context object
+ * @param[out] stats array of statistics, one entry per client. Free the array
+ *                   with free() after use. Set to NULL if no clients are
+ *                   registered.
+ * @param[out] count number of entries in @p stats
+ * @return OSD_OK on success, any other value indicates an error
+ */
+osd_result osd_hostctrl_get_client_stats(
+    struct osd_hostctrl_ctx *ctx, struct osd_hostctrl_client_stats **stats,
+    size_t *count);
+
+/**
+ * Serve the statistics of the host controller on a local endpoint
+ *
+ * The endpoint is a ZeroMQ REP socket answering the request "STATS" with all
+ * counters and histograms of the host controller as text, one
+ * "<name> <value>" pair per line. The same text is returned by the STATS
+ * management request on the host controller socket. The osd-top tool
+ * displays the statistics.
+ *
+ * @param ctx the context object
+ * @param endpoint ZeroMQ endpoint to bind to, e.g. ipc:///tmp/osd-hostctrl
+ * @return OSD_OK on success,
+ *         OSD_ERROR_CONNECTION_FAILED if binding to @p endpoint failed
+ */
+osd_result osd_hostctrl_set_stats_endpoint(struct osd_hostctrl_ctx *ctx,
+                                           const char *endpoint);
+
+/**
+ * Capture all routed packets to a file
+ *
+ * Every packet routed from now on is written to @p filename, together with
+ * a timestamp and the ZeroMQ identities of its sender and receiver. See
+ * osd/capture.h for the file format and for reading the file, and the
+ * osd-replay tool to replay a capture.
+ *
+ * The file is written by a separate thread. If the thread cannot keep up
+ * with the traffic, packets are missing in the capture (counted in the
+ * statistic router.capture_dropped).
+ *
+ * @param ctx the host controller context object
+ * @param filename the capture file (overwritten if it exists), or NULL to
+ *                 stop capturing
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if the capture file cannot be created
+ */
+osd_result osd_hostctrl_set_capture(struct osd_hostctrl_ctx *ctx,
+                                    const char *filename);
+
+/**
+ * Keep the most recently routed packets in memory (flight recorder)
+ *
+ * The flight recorder continuously records all routed packets into a ring
+ * buffer of @p size bytes in memory, overwriting the oldest packets. On a
+ * dump, the recorded packets are written to a new capture file
+ * <dump_filename>.<N> (N = 0, 1, ...) in the format of
+ * osd_hostctrl_set_capture(). A dump is triggered by
+ * osd_hostctrl_dump_flightrec(), by the management request FLIGHTREC_DUMP,
+ * or by a trigger packet (see osd_hostctrl_add_flightrec_trigger()).
+ *
+ * The dump is written by a separate thread. Triggers while a dump is being
+ * written are ignored.
+ *
+ * Calling this function again replaces the flight recorder; all recorded
+ * packets and triggers are discarded.
+ *
+ * @param ctx the host controller context object
+ * @param size size of the ring buffer in bytes (at least 64 kB), or 0 to
+ *             disable the flight recorder
+ * @param dump_filename base name of the dump files
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if @p size is too small,
+ *         OSD_ERROR_OOM if the ring buffer cannot be allocated
+ */
+osd_result osd_hostctrl_set_flightrec(struct osd_hostctrl_ctx *ctx,
+                                      size_t size, const char *dump_filename);
+
+/**
+ * Dump the flight recorder whenever a packet of a given type is routed
+ *
+ * Example: dump the flight recorder on failed register reads
+ *
+ * @code{.c}
+ * osd_hostctrl_add_flightrec_trigger(ctx, OSD_PACKET_TYPE_REG,
+ *                                    RESP_READ_REG_ERROR);
+ * @endcode
+ *
+ * @param ctx the host controller context object
+ * @param type the packet type (see enum osd_packet_type)
+ * @param type_sub the packet subtype
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if the flight recorder is disabled
+ */
+osd_result osd_hostctrl_add_flightrec_trigger(struct osd_hostctrl_ctx *ctx,
+                                              unsigned int type,
+                                              unsigned int type_sub);
+
+/**
+ * Dump a window of the flight recorder when a packet pattern is routed
+ *
+ * The pattern is a sequence of steps, each matching one packet; the trigger
+ * fires once packets matching all steps have been routed in this order.
+ * Steps are separated by "then", optionally followed by "within <N>" to
+ * require the next step to match one of the following N packets. A step
+ * consists of conditions on the packet, separated by spaces:
+ * "type=<event|plain|reg|N>", "type_sub=<N>", "src=<subnet>.<local>",
+ * "dest=<subnet>.<local>", and "word<I>=<V>[/<mask>]" for payload word I
+ * (0 to 7).
+ *
+ * When the trigger fires, the flight recorder keeps recording until
+ * @p post_packets further packets are recorded, and then dumps only the
+ * @p pre_packets packets before (and including) the trigger packet and the
+ * @p post_packets packets after it. A packet routed to several clients is
+ * recorded (and counted) once for each client. While the window of a trigger
+ * is being recorded, other triggers are ignored.
+ *
+ * Example: dump the 1000 packets before and after an event of the module 1.5
+ * with the subtype 2 which is followed within 100 packets by an event of the
+ * module 1.6 with the first payload word 0x42:
+ *
+ * @code{.c}
+ * osd_hostctrl_add_trace_trigger(ctx, "type=event src=1.5 type_sub=2 "
+ *                                "then within 100 type=event src=1.6 "
+ *                                "word0=0x42", 1000, 1000);
+ * @endcode
+ *
+ * Trace triggers are discarded with the flight recorder (see
+ * osd_hostctrl_set_flightrec()).
+ *
+ * @param ctx the host controller context object
+ * @param pattern the packet pattern
+ * @param pre_packets number of packets up to the trigger to dump
+ * @param post_packets number of packets after the trigger to dump
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if the flight recorder is disabled, the pattern
+ *         is invalid, or too many triggers have been added
+ */
+osd_result osd_hostctrl_add_trace_trigger(struct osd_hostctrl_ctx *ctx,
+                                          const char *pattern,
+                                          unsigned int pre_packets,
+                                          unsigned int post_packets);
+
+/**
+ * Dump the flight recorder now
+ *
+ * @param ctx the host controller context object
+ * @return OSD_OK if the dump was started,
+ *         OSD_ERROR_FAILURE if the flight recorder is disabled or a dump is
+ *         still being written
+ */
+osd_result osd_hostctrl_dump_flightrec(struct osd_hostctrl_ctx *ctx);
+
+/**
+ * Stall the noisiest trace modules if the host cannot keep up (overload
+ * control)
+ *
+ * Without overload control, trace data which the host cannot keep up with
+ * is lost somewhere between the trace modules and the receivers. With
+ * overload control, the trace packets sent by every module on the devices
+ * are counted. Once the messages of a gateway queued in the host controller
+ * exceed the high watermark of the flow control, the modules which sent at
+ * least half of the recent trace packets are stalled by clearing
+ * OSD_REG_BASE_MOD_CS_ACTIVE in their control and status register. If the
+ * queues keep growing, further modules are stalled. All modules are
+ * resumed once the queues drained below the low watermark.
+ *
+ * The start and end of every stall is logged (info level): the trace data
+ * of a module is missing exactly for the logged interval. The stalls are
+ * counted in the statistics router.overload_stalls and
+ * router.overload_stall_time_us.
+ *
+ * Disabling the overload control resumes all stalled modules.
+ *
+ * @param ctx the host controller context object
+ * @param enable enable (true) or disable (false) the overload control
+ * @return OSD_OK on success, any other value indicates an error
+ */
+osd_result osd_hostctrl_set_overload_control(struct osd_hostctrl_ctx *ctx,
+                                             bool enable);
+
 /**@}*/ /* end of doxygen group libosd-hostctrl */
 
 #ifdef __cplusplus
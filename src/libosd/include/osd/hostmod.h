@@ -37,6 +37,9 @@ extern "C" {
 /** Flag: fully blocking operation (i.e. wait forever) */
 #define OSD_HOSTMOD_BLOCKING 1
 
+/** Flag for osd_hostmod_get_stats(): reset the statistics after reading */
+#define OSD_HOSTMOD_STATS_RESET 1
+
 /**
  * Opaque context object
  *
@@ -58,7 +61,9 @@ typedef osd_result (*osd_hostmod_event_handler_fn)(
  *
  * @param[out] ctx the osd_hostmod_ctx context to be created
  * @param[in] log_ctx the log context to be used. Set to NULL to disable logging
- * @param[in] host_controller_address ZeroMQ endpoint of the host controller
+ * @param[in] host_controller_address ZeroMQ endpoint of the host controller,
+ *                                    or shm://<path> to connect through shared
+ *                                    memory
  * @param[in] event_handler function called when a new event packet is received
  * @param[in] event_handler_arg argument passed to the event handler callback
  * @return OSD_OK on success, any other value indicates an error
@@ -172,6 +177,204 @@ osd_result osd_hostmod_reg_write(struct osd_hostmod_ctx *ctx,
  */
 uint16_t osd_hostmod_get_diaddr(struct osd_hostmod_ctx *ctx);
 
+/**
+ * Subscribe to EVENT packets sent to a DI address
+ *
+ * After subscribing, all EVENT packets sent to @p diaddr are delivered to the
+ * event handler of this host module, in addition to the module @p diaddr is
+ * assigned to (if any). Any number of host modules can subscribe to the same
+ * address, e.g. to display, record and analyze a trace stream at the same
+ * time. The host controller queues packets for each subscriber individually:
+ * a slow subscriber does not slow down others, but it might lose packets.
+ *
+ * @param ctx the osd_hostmod_ctx context object
+ * @param diaddr the DI address to subscribe to. The address must be in the
+ *               subnet of the host controller.
+ * @return OSD_OK on success, any other value indicates an error
+ *
+ * @see osd_hostmod_unsubscribe()
+ */
+osd_result osd_hostmod_subscribe(struct osd_hostmod_ctx *ctx, uint16_t diaddr);
+
+/**
+ * End a subscription to EVENT packets sent to a DI address
+ *
+ * @param ctx the osd_hostmod_ctx context object
+ * @param diaddr the DI address
+ * @return OSD_OK on success, any other value indicates an error
+ *
+ * @see osd_hostmod_subscribe()
+ */
+osd_result osd_hostmod_unsubscribe(struct osd_hostmod_ctx *ctx,
+                                   uint16_t diaddr);
+
+/**
+ * Set the filter rules of the gateway serving a subnet
+ *
+ * The gateway filters and aggregates the trace packets read from its devices
+ * before they are sent to the host controller, see
+ * osd_gateway_set_rx_filter() for the rules. The rules replace the current
+ * rules of the gateway, an empty string removes all rules.
+ *
+ * The request is passed on by the host controller, which checks the rules.
+ * The filter of a gateway applies to all subnets it serves: the host
+ * controller rejects the request if the gateway serves more than one subnet
+ * (see osd_gateway_add_subnet()).
+ *
+ * @param ctx the osd_hostmod_ctx context object
+ * @param subnet the subnet of the device
+ * @param rules the filter rules
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if the rules are invalid, no gateway serving
+ *         @p subnet is registered, or the gateway serves several subnets,
+ *         OSD_ERROR_NOT_CONNECTED if the host module is not connected,
+ *         OSD_ERROR_TIMEDOUT if the host controller didn't respond
+ */
+osd_result osd_hostmod_set_gateway_filter(struct osd_hostmod_ctx *ctx,
+                                          uint16_t subnet, const char *rules);
+
+/**
+ * Send a DI packet
+ *
+ * The packet is sent as-is, i.e. the source address is not changed to the DI
+ * address of this host module. Responses to the packet are delivered to the
+ * module at the source address of the packet. This is mainly useful to inject
+ * recorded traffic (see osd_capture_reader_next()); use the register access
+ * functions to communicate with debug modules.
+ *
+ * @param ctx the osd_hostmod_ctx context object
+ * @param packet the packet to send. The caller keeps ownership of the packet.
+ * @return OSD_OK on success,
+ *         OSD_ERROR_COM if the packet could not be passed to the I/O thread
+ */
+osd_result osd_hostmod_send_packet(struct osd_hostmod_ctx *ctx,
+                                   const struct osd_packet *packet);
+
+/**
+ * Serve the statistics of the host module on a local endpoint
+ *
+ * The endpoint answers the request "STATS" with the packet counters of the
+ * host module as text (see osd_hostctrl_set_stats_endpoint()).
+ *
+ * @param ctx the context object
+ * @param endpoint ZeroMQ endpoint to bind to, e.g. ipc:///tmp/osd-hostmod
+ * @return OSD_OK on success,
+ *         OSD_ERROR_CONNECTION_FAILED if binding to @p endpoint failed
+ */
+osd_result osd_hostmod_set_stats_endpoint(struct osd_hostmod_ctx *ctx,
+                                          const char *endpoint);
+
+/**
+ * Latency statistics of register accesses
+ *
+ * One entry covers all register accesses of the same type (read or write)
+ * and register width to modules in one subnet. Latencies are measured from
+ * sending the request to receiving the response, with a relative error of
+ * about 3%.
+ */
+struct osd_hostmod_reg_stats {
+    /** Subnet of the accessed modules */
+    uint16_t subnet;
+
+    /** Write (true) or read (false) accesses */
+    bool is_write;
+
+    /** Register width in bit (16, 32, 64 or 128) */
+    unsigned int reg_size_bit;
+
+    /** Number of accesses answered by the module */
+    uint64_t count;
+
+    /**
+     * Number of failed accesses (timeouts, error responses and invalid
+     * responses)
+     */
+    uint64_t errors;
+
+    /** Minimum latency (ns) */
+    uint64_t min_ns;
+    /** Mean latency (ns) */
+    uint64_t mean_ns;
+    /** Median latency (ns) */
+    uint64_t p50_ns;
+    /** 99th percentile latency (ns) */
+    uint64_t p99_ns;
+    /** 99.9th percentile latency (ns) */
+    uint64_t p999_ns;
+    /** Maximum latency (ns) */
+    uint64_t max_ns;
+};
+
+/**
+ * Get register access latency statistics
+ *
+ * The statistics are always collected and cover all register accesses since
+ * the context was created, or since the last reset. This function can be
+ * called from any thread.
+ *
+ * @param ctx the osd_hostmod_ctx context object
+ * @param[out] stats array of statistics, one entry per subnet, access type
+ *                   and register width with accesses. Free the array with
+ *                   free() after use. Set to NULL if no accesses were made.
+ * @param[out] count number of entries in @p stats
+ * @param flags set OSD_HOSTMOD_STATS_RESET to reset the statistics after
+ *              reading them, e.g. to report them periodically
+ * @return OSD_OK on success, any other value indicates an error
+ */
+osd_result osd_hostmod_get_stats(struct osd_hostmod_ctx *ctx,
+                                 struct osd_hostmod_reg_stats **stats,
+                                 size_t *count, int flags);
+
+/**
+ * Enable or disable latency tracing of register accesses
+ *
+ * While enabled, every register access request carries a trace record which
+ * is stamped with the current time at every stage the request and its
+ * response pass: the host module, the host controller, the gateway and the
+ * device. The time spent between two stages is recorded in histograms,
+ * available as latency.<stage> from the stats endpoint (see
+ * osd_hostmod_set_stats_endpoint()). The individual traces can be written
+ * to a file with osd_hostmod_write_latency_trace().
+ *
+ * All components must use protocol version 2 and run on the same machine
+ * for the trace to be complete.
+ *
+ * @param ctx the osd_hostmod_ctx context object
+ * @param enable enable (true) or disable (false) tracing
+ * @return OSD_OK on success, any other value indicates an error
+ */
+osd_result osd_hostmod_set_latency_tracing(struct osd_hostmod_ctx *ctx,
+                                           bool enable);
+
+/**
+ * Write the most recent latency traces to a file
+ *
+ * The file is written in the Trace Event Format (JSON) and can be loaded into
+ * trace viewers such as chrome://tracing or Perfetto.
+ *
+ * @param ctx the osd_hostmod_ctx context object
+ * @param filename the file to write to
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if tracing was never enabled or the file could
+ *         not be written
+ *
+ * @see osd_hostmod_set_latency_tracing()
+ */
+osd_result osd_hostmod_write_latency_trace(struct osd_hostmod_ctx *ctx,
+                                           const char *filename);
+
+/**
+ * Get flow control statistics
+ *
+ * The statistics cover data messages sent from this host module to the host
+ * controller.
+ *
+ * @param ctx the osd_hostmod_ctx context object
+ * @param[out] stats the statistics
+ */
+void osd_hostmod_get_flowctrl_stats(struct osd_hostmod_ctx *ctx,
+                                    struct osd_flowctrl_stats *stats);
+
 /**
  * Get the description fields of a debug module (type, vendor, version)
  */
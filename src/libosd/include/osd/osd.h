@@ -260,6 +260,53 @@ unsigned int osd_diaddr_subnet(unsigned int diaddr);
 unsigned int osd_diaddr_localaddr(unsigned int diaddr);
 unsigned int osd_diaddr_build(unsigned int subnet, unsigned int local_diaddr);
 
+/**
+ * @defgroup libosd-flowctrl Flow control
+ * @ingroup libosd
+ *
+ * Data messages between gateways, the host controller and host modules are
+ * subject to credit-based flow control: a receiver grants credits to the
+ * sender, and the sender only sends as many data messages as it has credits
+ * for. If a receiver cannot keep up, the senders stall, up to the device.
+ *
+ * @{
+ */
+
+/**
+ * Flow control mode of the host controller
+ */
+enum osd_flowctrl_mode {
+    /**
+     * Never drop data messages, stall the senders instead (default)
+     */
+    OSD_FLOWCTRL_LOSSLESS = 0,
+
+    /**
+     * Never stall the senders, drop the oldest queued data messages to a
+     * receiver which doesn't keep up instead
+     */
+    OSD_FLOWCTRL_LOSSY = 1,
+};
+
+/**
+ * Flow control statistics
+ */
+struct osd_flowctrl_stats {
+    /** Credits available for sending data messages */
+    uint64_t tx_credits;
+
+    /** Number of times sending stalled since no credits were available */
+    uint64_t tx_stalls;
+
+    /** Total time sending was stalled (in microseconds) */
+    uint64_t tx_stall_time_us;
+
+    /** Number of dropped data messages */
+    uint64_t dropped;
+};
+
+/**@}*/ /* end of doxygen group libosd-flowctrl */
+
 #ifdef __cplusplus
 }
 #endif
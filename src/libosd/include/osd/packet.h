@@ -59,6 +59,31 @@ enum osd_packet_type {
     OSD_PACKET_TYPE_RES = 3     //< Reserved (will be discarded)
 };
 
+/**
+ * Traffic classes
+ *
+ * Packets are assigned to traffic classes based on their type. Where packets
+ * queue up (in the host controller and in gateways), control traffic is
+ * preferred over bulk traffic.
+ */
+enum osd_traffic_class {
+    /** Register accesses (OSD_PACKET_TYPE_REG) */
+    OSD_TCLASS_CONTROL = 0,
+    /** Trace data and other packets (OSD_PACKET_TYPE_EVENT and _PLAIN) */
+    OSD_TCLASS_BULK = 1,
+};
+
+/** Number of traffic classes */
+#define OSD_TCLASS_COUNT 2
+
+/**
+ * Control weight: serve control traffic with strict priority
+ *
+ * @see osd_hostctrl_set_tclass_weight()
+ * @see osd_gateway_set_tclass_weight()
+ */
+#define OSD_TCLASS_WEIGHT_STRICT 0
+
 /**
  * Values of the TYPE_SUB field in if TYPE == OSD_PACKET_TYPE_REG
  */
@@ -139,6 +164,12 @@ unsigned int osd_packet_get_type(const struct osd_packet *packet);
  */
 unsigned int osd_packet_get_type_sub(const struct osd_packet *packet);
 
+/**
+ * Get the traffic class of a packet (derived from the TYPE field)
+ */
+enum osd_traffic_class osd_packet_get_traffic_class(
+    const struct osd_packet *packet);
+
 /**
  * Populate the header of a osd_packet
  *
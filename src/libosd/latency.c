@@ -0,0 +1,195 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "latency.h"
+
+#include <assert.h>
+#include <endian.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "osd-private.h"
+
+static const char *const stage_names[LATENCY_STAGE_COUNT] = {
+        [LATENCY_STAGE_HOSTMOD_SEND] = "hostmod_send",
+        [LATENCY_STAGE_HOSTMOD_TX] = "hostmod_tx",
+        [LATENCY_STAGE_ROUTER_REQ] = "router_req",
+        [LATENCY_STAGE_GATEWAY_RX] = "gateway_rx",
+        [LATENCY_STAGE_DEVICE_WRITE] = "device_write",
+        [LATENCY_STAGE_DEVICE_WRITE_DONE] = "device_write_done",
+        [LATENCY_STAGE_DEVICE_RX] = "device_rx",
+        [LATENCY_STAGE_GATEWAY_TX] = "gateway_tx",
+        [LATENCY_STAGE_ROUTER_RESP] = "router_resp",
+        [LATENCY_STAGE_HOSTMOD_RX] = "hostmod_rx",
+        [LATENCY_STAGE_HOSTMOD_RECV] = "hostmod_recv",
+};
+
+const char *latency_stage_name(enum latency_stage stage)
+{
+    assert(stage < LATENCY_STAGE_COUNT);
+    return stage_names[stage];
+}
+
+uint64_t latency_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void latency_stamp(struct latency_trace *trace, enum latency_stage stage)
+{
+    assert(stage < LATENCY_STAGE_COUNT);
+    trace->ts_ns[stage] = latency_now_ns();
+}
+
+zframe_t *latency_trace_frame_new(const struct latency_trace *trace)
+{
+    uint64_t buf[1 + LATENCY_STAGE_COUNT];
+    buf[0] = htole64(trace->id);
+    for (int s = 0; s < LATENCY_STAGE_COUNT; s++) {
+        buf[1 + s] = htole64(trace->ts_ns[s]);
+    }
+
+    zframe_t *frame = zframe_new(buf, sizeof(buf));
+    assert(frame);
+    return frame;
+}
+
+osd_result latency_trace_from_frame(const zframe_t *frame,
+                                    struct latency_trace *trace)
+{
+    if (!frame || zframe_size((zframe_t *)frame) != LATENCY_TRACE_FRAME_SIZE) {
+        return OSD_ERROR_FAILURE;
+    }
+
+    uint64_t buf[1 + LATENCY_STAGE_COUNT];
+    memcpy(buf, zframe_data((zframe_t *)frame), sizeof(buf));
+    trace->id = le64toh(buf[0]);
+    for (int s = 0; s < LATENCY_STAGE_COUNT; s++) {
+        trace->ts_ns[s] = le64toh(buf[1 + s]);
+    }
+
+    return OSD_OK;
+}
+
+osd_result latency_frame_stamp(zframe_t *frame, enum latency_stage stage)
+{
+    assert(stage < LATENCY_STAGE_COUNT);
+    if (!frame || zframe_size(frame) != LATENCY_TRACE_FRAME_SIZE) {
+        return OSD_ERROR_FAILURE;
+    }
+
+    uint64_t ts_le = htole64(latency_now_ns());
+    memcpy(zframe_data(frame) + 8 * (1 + stage), &ts_le, sizeof(ts_le));
+    return OSD_OK;
+}
+
+struct latency_recorder *latency_recorder_new(struct stats_registry *stats)
+{
+    struct latency_recorder *rec = calloc(1, sizeof(struct latency_recorder));
+    assert(rec);
+
+    for (int s = 0; s < LATENCY_STAGE_COUNT; s++) {
+        rec->stage_ns[s] = stats_hist(stats, "latency.%s", stage_names[s]);
+    }
+    rec->total_ns = stats_hist(stats, "latency.total");
+
+    rec->traces = calloc(LATENCY_RECORDER_TRACES, sizeof(struct latency_trace));
+    assert(rec->traces);
+
+    return rec;
+}
+
+void latency_recorder_free(struct latency_recorder **rec_p)
+{
+    assert(rec_p);
+    struct latency_recorder *rec = *rec_p;
+    if (!rec) {
+        return;
+    }
+
+    free(rec->traces);
+    free(rec);
+    *rec_p = NULL;
+}
+
+void latency_recorder_add(struct latency_recorder *rec,
+                          const struct latency_trace *trace)
+{
+    // Stages can be missing, e.g. if a component speaks protocol version 1
+    // or the response didn't come from the device. The time is then
+    // accounted to the next stage which was passed.
+    uint64_t first_ns = 0;
+    uint64_t prev_ns = 0;
+    for (int s = 0; s < LATENCY_STAGE_COUNT; s++) {
+        uint64_t ts = trace->ts_ns[s];
+        if (!ts) {
+            continue;
+        }
+        if (prev_ns) {
+            stats_hist_record(rec->stage_ns[s], ts > prev_ns ? ts - prev_ns : 0);
+        } else {
+            first_ns = ts;
+        }
+        prev_ns = ts;
+    }
+    if (first_ns) {
+        stats_hist_record(rec->total_ns, prev_ns - first_ns);
+    }
+
+    rec->traces[rec->traces_count % LATENCY_RECORDER_TRACES] = *trace;
+    rec->traces_count++;
+}
+
+osd_result latency_recorder_write_json(struct latency_recorder *rec, FILE *f)
+{
+    uint64_t first = 0;
+    if (rec->traces_count > LATENCY_RECORDER_TRACES) {
+        first = rec->traces_count - LATENCY_RECORDER_TRACES;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    bool first_event = true;
+    for (uint64_t i = first; i < rec->traces_count; i++) {
+        const struct latency_trace *trace =
+            &rec->traces[i % LATENCY_RECORDER_TRACES];
+        uint64_t prev_ns = 0;
+        for (int s = 0; s < LATENCY_STAGE_COUNT; s++) {
+            uint64_t ts = trace->ts_ns[s];
+            if (!ts) {
+                continue;
+            }
+            if (prev_ns && ts >= prev_ns) {
+                // timestamps are in microseconds
+                fprintf(f,
+                        "%s\n{\"name\":\"%s\",\"cat\":\"osd\",\"ph\":\"X\","
+                        "\"pid\":0,\"tid\":%" PRIu64
+                        ",\"ts\":%.3f,\"dur\":%.3f}",
+                        first_event ? "" : ",", stage_names[s], trace->id,
+                        prev_ns / 1000.0, (ts - prev_ns) / 1000.0);
+                first_event = false;
+            }
+            prev_ns = ts;
+        }
+    }
+    fprintf(f, "\n]}\n");
+
+    if (ferror(f)) {
+        return OSD_ERROR_FAILURE;
+    }
+    return OSD_OK;
+}
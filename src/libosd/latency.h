@@ -0,0 +1,182 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <czmq.h>
+#include <osd/osd.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "stats.h"
+
+/**
+ * End-to-end latency tracing of register accesses
+ *
+ * If latency tracing is enabled in a host module (see
+ * osd_hostmod_set_latency_tracing()), every register access request it
+ * sends carries a trace record: a trace ID and a timestamp for every stage
+ * the request and its response pass through. The record travels as an
+ * additional frame next to the packet, marked with PROTO_FLAG_TRACE in the
+ * version 2 header. Components speaking protocol version 1 drop it.
+ *
+ * The device itself cannot carry the record: the gateway keeps the record of
+ * every request written to the device and attaches it to the response (the
+ * packet with source and destination swapped). Register accesses of a host
+ * module to a debug module are serialized, which makes this match
+ * unambiguous.
+ *
+ * All timestamps are taken from CLOCK_MONOTONIC and are therefore only
+ * comparable if all components run on the same machine.
+ */
+
+/**
+ * Stages of a register access
+ *
+ * The stages are listed in the order a request and its response pass them.
+ */
+enum latency_stage {
+    /** Request sent by the host module (osd_hostmod_send_packet()) */
+    LATENCY_STAGE_HOSTMOD_SEND,
+    /** Request sent to the host controller by the host module I/O thread */
+    LATENCY_STAGE_HOSTMOD_TX,
+    /** Request routed by the host controller (process_data_msg()) */
+    LATENCY_STAGE_ROUTER_REQ,
+    /** Request received by the gateway (hostiothread_rcv_from_hostctrl()) */
+    LATENCY_STAGE_GATEWAY_RX,
+    /** Request about to be written to the device (packet_write_fn) */
+    LATENCY_STAGE_DEVICE_WRITE,
+    /** Request written to the device */
+    LATENCY_STAGE_DEVICE_WRITE_DONE,
+    /** Response read from the device (devicerxthread_main()) */
+    LATENCY_STAGE_DEVICE_RX,
+    /** Response forwarded to the host controller by the gateway */
+    LATENCY_STAGE_GATEWAY_TX,
+    /** Response routed by the host controller (process_data_msg()) */
+    LATENCY_STAGE_ROUTER_RESP,
+    /** Response received by the host module I/O thread */
+    LATENCY_STAGE_HOSTMOD_RX,
+    /** Response received by the host module (osd_hostmod_receive_packet()) */
+    LATENCY_STAGE_HOSTMOD_RECV,
+
+    LATENCY_STAGE_COUNT
+};
+
+/**
+ * Trace record of a register access
+ */
+struct latency_trace {
+    /** Trace ID, unique per host module */
+    uint64_t id;
+
+    /** Timestamp of each stage (ns, CLOCK_MONOTONIC), 0 if not passed */
+    uint64_t ts_ns[LATENCY_STAGE_COUNT];
+};
+
+/** Size of an encoded trace record (bytes) */
+#define LATENCY_TRACE_FRAME_SIZE (8 * (1 + LATENCY_STAGE_COUNT))
+
+/**
+ * Number of completed traces kept for latency_recorder_write_json()
+ */
+#define LATENCY_RECORDER_TRACES 1024
+
+/**
+ * Get the name of a stage
+ */
+const char *latency_stage_name(enum latency_stage stage);
+
+/**
+ * Get the current time in the clock of the timestamps (ns)
+ */
+uint64_t latency_now_ns(void);
+
+/**
+ * Record the current time as timestamp of @p stage
+ */
+void latency_stamp(struct latency_trace *trace, enum latency_stage stage);
+
+/**
+ * Encode a trace record into a new frame
+ */
+zframe_t *latency_trace_frame_new(const struct latency_trace *trace);
+
+/**
+ * Decode a trace record
+ *
+ * @return OSD_OK if @p frame is a valid trace record,
+ *         OSD_ERROR_FAILURE otherwise
+ */
+osd_result latency_trace_from_frame(const zframe_t *frame,
+                                    struct latency_trace *trace);
+
+/**
+ * Add a timestamp to an encoded trace record
+ *
+ * @return OSD_OK if @p frame is a valid trace record,
+ *         OSD_ERROR_FAILURE otherwise
+ */
+osd_result latency_frame_stamp(zframe_t *frame, enum latency_stage stage);
+
+/**
+ * Collection of completed traces
+ */
+struct latency_recorder {
+    /**
+     * Time between the previous stage and the stage (ns), one histogram per
+     * stage
+     */
+    struct stats_hist *stage_ns[LATENCY_STAGE_COUNT];
+
+    /** Time between the first and the last stage of a trace (ns) */
+    struct stats_hist *total_ns;
+
+    /** Most recently completed traces (ring buffer) */
+    struct latency_trace *traces;
+
+    /** Number of completed traces, including the ones overwritten */
+    uint64_t traces_count;
+};
+
+/**
+ * Create a recorder
+ *
+ * The histograms are registered in @p stats as latency.<stage> and
+ * latency.total.
+ */
+struct latency_recorder *latency_recorder_new(struct stats_registry *stats);
+
+/**
+ * Free a recorder
+ */
+void latency_recorder_free(struct latency_recorder **rec_p);
+
+/**
+ * Add a completed trace
+ */
+void latency_recorder_add(struct latency_recorder *rec,
+                          const struct latency_trace *trace);
+
+/**
+ * Write the recorded traces in the Trace Event Format (JSON)
+ *
+ * The output can be loaded into trace viewers such as chrome://tracing or
+ * Perfetto. Every trace is shown as one row with one slice per stage.
+ */
+osd_result latency_recorder_write_json(struct latency_recorder *rec,
+                                       FILE *f);
+
+#endif  // LATENCY_H
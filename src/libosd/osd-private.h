@@ -152,4 +152,46 @@ inline bool zframe_eq_c(const zframe_t *self, const zframe_t *other)
     return zframe_eq((zframe_t*)self, (zframe_t*)other);
 }
 
+/**
+ * Add a value to a statistics counter
+ *
+ * Statistics counters are updated by the I/O threads and read by the main
+ * thread without further locking.
+ */
+static inline void stats_counter_add(uint64_t *counter, int64_t value)
+{
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+/**
+ * Read a statistics counter
+ */
+static inline uint64_t stats_counter_get(const uint64_t *counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/**
+ * Take a snapshot of flow control statistics updated by another thread
+ */
+static inline void flowctrl_stats_get(const struct osd_flowctrl_stats *src,
+                                      struct osd_flowctrl_stats *dst)
+{
+    dst->tx_credits = stats_counter_get(&src->tx_credits);
+    dst->tx_stalls = stats_counter_get(&src->tx_stalls);
+    dst->tx_stall_time_us = stats_counter_get(&src->tx_stall_time_us);
+    dst->dropped = stats_counter_get(&src->dropped);
+}
+
+struct osd_gateway_ctx;
+struct stats_registry;
+
+/**
+ * Get the statistics registry of a gateway
+ *
+ * Used by device-specific gateways (e.g. the GLIP gateway) to register their
+ * own metrics, which are then served together with the gateway statistics.
+ */
+struct stats_registry *gateway_get_stats(struct osd_gateway_ctx *ctx);
+
 #endif // OSD_OSD_PRIVATE_H
@@ -0,0 +1,192 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "overload.h"
+
+#include <osd/osd.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The modules of one subnet
+ */
+struct overload_subnet {
+    /** Packets sent by each module in the current window */
+    uint32_t packets[OSD_DIADDR_LOCAL_MAX + 1];
+
+    /** Start of the stall of each module (us), 0 if not stalled */
+    int64_t stall_start_us[OSD_DIADDR_LOCAL_MAX + 1];
+
+    /** Number of stalled modules */
+    unsigned int stalled;
+};
+
+struct overload {
+    /** All subnets, NULL until the first packet of a subnet is counted */
+    struct overload_subnet *subnets[OSD_DIADDR_SUBNET_MAX + 1];
+};
+
+struct overload *overload_new(void)
+{
+    struct overload *ol = calloc(1, sizeof(struct overload));
+    assert(ol);
+    return ol;
+}
+
+void overload_free(struct overload **ol_p)
+{
+    assert(ol_p);
+    struct overload *ol = *ol_p;
+    if (!ol) {
+        return;
+    }
+
+    for (unsigned int i = 0; i <= OSD_DIADDR_SUBNET_MAX; i++) {
+        free(ol->subnets[i]);
+    }
+    free(ol);
+    *ol_p = NULL;
+}
+
+/**
+ * Get a subnet, allocating it on first use
+ */
+static struct overload_subnet *subnet_get(struct overload *ol,
+                                          unsigned int subnet)
+{
+    if (!ol->subnets[subnet]) {
+        ol->subnets[subnet] = calloc(1, sizeof(struct overload_subnet));
+        assert(ol->subnets[subnet]);
+    }
+    return ol->subnets[subnet];
+}
+
+void overload_count(struct overload *ol, uint16_t src)
+{
+    struct overload_subnet *sn = subnet_get(ol, osd_diaddr_subnet(src));
+    uint32_t *packets = &sn->packets[osd_diaddr_localaddr(src)];
+    if (*packets < UINT32_MAX) {
+        (*packets)++;
+    }
+}
+
+size_t overload_select(struct overload *ol, uint64_t subnets,
+                       uint16_t *diaddrs, size_t max)
+{
+    uint64_t total = 0;
+    for (unsigned int s = 0; s <= OSD_DIADDR_SUBNET_MAX; s++) {
+        struct overload_subnet *sn = ol->subnets[s];
+        if (!sn || !(subnets & (1ULL << s))) {
+            continue;
+        }
+        for (unsigned int l = 0; l <= OSD_DIADDR_LOCAL_MAX; l++) {
+            if (!sn->stall_start_us[l]) {
+                total += sn->packets[l];
+            }
+        }
+    }
+
+    // Selected modules have their counter cleared, which takes them out of
+    // the following rounds.
+    size_t count = 0;
+    uint64_t covered = 0;
+    while (count < max && covered * 2 < total) {
+        unsigned int max_subnet = 0, max_local = 0;
+        uint32_t max_packets = 0;
+        for (unsigned int s = 0; s <= OSD_DIADDR_SUBNET_MAX; s++) {
+            struct overload_subnet *sn = ol->subnets[s];
+            if (!sn || !(subnets & (1ULL << s))) {
+                continue;
+            }
+            for (unsigned int l = 0; l <= OSD_DIADDR_LOCAL_MAX; l++) {
+                if (!sn->stall_start_us[l] && sn->packets[l] > max_packets) {
+                    max_packets = sn->packets[l];
+                    max_subnet = s;
+                    max_local = l;
+                }
+            }
+        }
+        if (max_packets == 0) {
+            break;
+        }
+
+        diaddrs[count++] = osd_diaddr_build(max_subnet, max_local);
+        covered += max_packets;
+        ol->subnets[max_subnet]->packets[max_local] = 0;
+    }
+
+    for (unsigned int s = 0; s <= OSD_DIADDR_SUBNET_MAX; s++) {
+        if (ol->subnets[s] && (subnets & (1ULL << s))) {
+            memset(ol->subnets[s]->packets, 0,
+                   sizeof(ol->subnets[s]->packets));
+        }
+    }
+
+    return count;
+}
+
+void overload_stall(struct overload *ol, uint16_t diaddr, int64_t now_us)
+{
+    assert(now_us > 0);
+
+    struct overload_subnet *sn = subnet_get(ol, osd_diaddr_subnet(diaddr));
+    int64_t *start = &sn->stall_start_us[osd_diaddr_localaddr(diaddr)];
+    if (!*start) {
+        *start = now_us;
+        sn->stalled++;
+    }
+}
+
+bool overload_is_stalled(struct overload *ol, uint16_t diaddr)
+{
+    struct overload_subnet *sn = ol->subnets[osd_diaddr_subnet(diaddr)];
+    return sn && sn->stall_start_us[osd_diaddr_localaddr(diaddr)];
+}
+
+int64_t overload_resume(struct overload *ol, uint16_t diaddr)
+{
+    struct overload_subnet *sn = ol->subnets[osd_diaddr_subnet(diaddr)];
+    if (!sn) {
+        return 0;
+    }
+
+    int64_t *start = &sn->stall_start_us[osd_diaddr_localaddr(diaddr)];
+    int64_t stall_start_us = *start;
+    if (stall_start_us) {
+        *start = 0;
+        sn->stalled--;
+    }
+    return stall_start_us;
+}
+
+bool overload_find_stalled(struct overload *ol, uint64_t subnets,
+                           uint16_t *diaddr)
+{
+    for (unsigned int s = 0; s <= OSD_DIADDR_SUBNET_MAX; s++) {
+        struct overload_subnet *sn = ol->subnets[s];
+        if (!sn || !sn->stalled || !(subnets & (1ULL << s))) {
+            continue;
+        }
+        for (unsigned int l = 0; l <= OSD_DIADDR_LOCAL_MAX; l++) {
+            if (sn->stall_start_us[l]) {
+                *diaddr = osd_diaddr_build(s, l);
+                return true;
+            }
+        }
+    }
+    return false;
+}
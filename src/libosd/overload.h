@@ -0,0 +1,106 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OVERLOAD_H
+#define OVERLOAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Overload control: bookkeeping of the trace modules to stall
+ *
+ * The trace packets of all modules are counted in a window. If the host
+ * cannot keep up with the trace data, the noisiest modules in the window are
+ * selected to be stalled (see overload_select()) and the window starts anew.
+ * Stalled modules are tracked with the time their stall started, until they
+ * are resumed.
+ *
+ * Subnets are selected with a bit mask (bit N for subnet N). The counters of
+ * a subnet are allocated once the first packet of the subnet is counted.
+ *
+ * The object is not locked; it is used by the I/O thread of the host
+ * controller only. Sending the register writes which actually stall and
+ * resume the modules is left to the caller.
+ */
+
+struct overload;
+
+/**
+ * Create an overload controller without any counted packets
+ */
+struct overload *overload_new(void);
+
+/**
+ * Free an overload controller
+ */
+void overload_free(struct overload **ol_p);
+
+/**
+ * Count a trace packet
+ *
+ * @param src DI address of the module which sent the packet
+ */
+void overload_count(struct overload *ol, uint16_t src);
+
+/**
+ * Select the modules to stall and start a new window
+ *
+ * The modules not stalled yet are selected by the number of packets they
+ * sent in the window, the noisiest first, until they sent at least half of
+ * the packets of all modules in @p subnets. Modules which did not send any
+ * packets are never selected.
+ *
+ * @param subnets the subnets to select from (bit mask)
+ * @param[out] diaddrs the DI addresses of the selected modules
+ * @param max maximum number of modules to select (size of @p diaddrs)
+ * @return the number of selected modules
+ */
+size_t overload_select(struct overload *ol, uint64_t subnets,
+                       uint16_t *diaddrs, size_t max);
+
+/**
+ * Mark a module as stalled
+ *
+ * @param now_us the current time (us, see zclock_usecs())
+ */
+void overload_stall(struct overload *ol, uint16_t diaddr, int64_t now_us);
+
+/**
+ * Is a module stalled?
+ */
+bool overload_is_stalled(struct overload *ol, uint16_t diaddr);
+
+/**
+ * Mark a stalled module as running again
+ *
+ * @return the time the stall of the module started (us), 0 if the module was
+ *         not stalled
+ */
+int64_t overload_resume(struct overload *ol, uint16_t diaddr);
+
+/**
+ * Find a stalled module
+ *
+ * @param subnets the subnets to search in (bit mask)
+ * @param[out] diaddr the DI address of the module
+ * @return true if a stalled module was found, false if no module in
+ *         @p subnets is stalled
+ */
+bool overload_find_stalled(struct overload *ol, uint64_t subnets,
+                           uint16_t *diaddr);
+
+#endif  // OVERLOAD_H
@@ -102,6 +102,16 @@ unsigned int osd_packet_get_type(const struct osd_packet *packet)
     return (packet->data.flags >> DP_HEADER_TYPE_SHIFT) & DP_HEADER_TYPE_MASK;
 }
 
+API_EXPORT
+enum osd_traffic_class osd_packet_get_traffic_class(
+    const struct osd_packet *packet)
+{
+    if (osd_packet_get_type(packet) == OSD_PACKET_TYPE_REG) {
+        return OSD_TCLASS_CONTROL;
+    }
+    return OSD_TCLASS_BULK;
+}
+
 API_EXPORT
 unsigned int osd_packet_get_type_sub(const struct osd_packet *packet)
 {
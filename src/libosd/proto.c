@@ -0,0 +1,323 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "proto.h"
+
+#include <assert.h>
+#include <endian.h>
+#include <errno.h>
+#include <osd/osd.h>
+#include <stdlib.h>
+#include <string.h>
+#include "osd-private.h"
+
+zframe_t *proto_hdr_frame_new(uint8_t opcode, uint16_t flags, uint32_t seq)
+{
+    uint8_t buf[PROTO_HDR_SIZE];
+    uint16_t flags_le = htole16(flags);
+    uint32_t seq_le = htole32(seq);
+
+    buf[0] = PROTO_VERSION_2;
+    buf[1] = opcode;
+    memcpy(&buf[2], &flags_le, sizeof(flags_le));
+    memcpy(&buf[4], &seq_le, sizeof(seq_le));
+
+    zframe_t *frame = zframe_new(buf, PROTO_HDR_SIZE);
+    assert(frame);
+    return frame;
+}
+
+bool proto_is_hdr_frame(const zframe_t *frame)
+{
+    if (!frame || zframe_size((zframe_t *)frame) != PROTO_HDR_SIZE) {
+        return false;
+    }
+    return zframe_data((zframe_t *)frame)[0] == PROTO_VERSION_2;
+}
+
+osd_result proto_hdr_parse(const zframe_t *frame, struct proto_hdr *hdr)
+{
+    if (!proto_is_hdr_frame(frame)) {
+        return OSD_ERROR_FAILURE;
+    }
+
+    const uint8_t *buf = zframe_data((zframe_t *)frame);
+    uint16_t flags_le;
+    uint32_t seq_le;
+    memcpy(&flags_le, &buf[2], sizeof(flags_le));
+    memcpy(&seq_le, &buf[4], sizeof(seq_le));
+
+    hdr->version = buf[0];
+    hdr->opcode = buf[1];
+    hdr->flags = le16toh(flags_le);
+    hdr->seq = le32toh(seq_le);
+
+    return OSD_OK;
+}
+
+zmsg_t *proto_msg_new(uint8_t opcode, uint32_t seq)
+{
+    int zmq_rv;
+
+    zmsg_t *msg = zmsg_new();
+    assert(msg);
+    zframe_t *hdr_frame = proto_hdr_frame_new(opcode, 0, seq);
+    zmq_rv = zmsg_append(msg, &hdr_frame);
+    assert(zmq_rv == 0);
+
+    return msg;
+}
+
+zmsg_t *proto_msg_new_u16(uint8_t opcode, uint32_t seq, uint16_t value)
+{
+    int zmq_rv;
+
+    zmsg_t *msg = proto_msg_new(opcode, seq);
+    uint16_t value_le = htole16(value);
+    zmq_rv = zmsg_addmem(msg, &value_le, sizeof(value_le));
+    assert(zmq_rv == 0);
+
+    return msg;
+}
+
+osd_result proto_body_get_u16(const zframe_t *body, uint16_t *value)
+{
+    if (!body || zframe_size((zframe_t *)body) != sizeof(uint16_t)) {
+        return OSD_ERROR_FAILURE;
+    }
+
+    uint16_t value_le;
+    memcpy(&value_le, zframe_data((zframe_t *)body), sizeof(value_le));
+    *value = le16toh(value_le);
+
+    return OSD_OK;
+}
+
+zmsg_t *proto_msg_new_u32(uint8_t opcode, uint32_t seq, uint32_t value)
+{
+    int zmq_rv;
+
+    zmsg_t *msg = proto_msg_new(opcode, seq);
+    uint32_t value_le = htole32(value);
+    zmq_rv = zmsg_addmem(msg, &value_le, sizeof(value_le));
+    assert(zmq_rv == 0);
+
+    return msg;
+}
+
+osd_result proto_body_get_u32(const zframe_t *body, uint32_t *value)
+{
+    if (!body || zframe_size((zframe_t *)body) != sizeof(uint32_t)) {
+        return OSD_ERROR_FAILURE;
+    }
+
+    uint32_t value_le;
+    memcpy(&value_le, zframe_data((zframe_t *)body), sizeof(value_le));
+    *value = le32toh(value_le);
+
+    return OSD_OK;
+}
+
+zmsg_t *proto_msg_new_u16_str(uint8_t opcode, uint32_t seq, uint16_t value,
+                              const char *str)
+{
+    int zmq_rv;
+
+    zmsg_t *msg = proto_msg_new(opcode, seq);
+    size_t str_len = strlen(str);
+    zframe_t *body = zframe_new(NULL, sizeof(uint16_t) + str_len);
+    assert(body);
+    uint16_t value_le = htole16(value);
+    memcpy(zframe_data(body), &value_le, sizeof(value_le));
+    memcpy(zframe_data(body) + sizeof(value_le), str, str_len);
+    zmq_rv = zmsg_append(msg, &body);
+    assert(zmq_rv == 0);
+
+    return msg;
+}
+
+osd_result proto_body_get_u16_str(const zframe_t *body, uint16_t *value,
+                                  char **str)
+{
+    if (!body || zframe_size((zframe_t *)body) < sizeof(uint16_t)) {
+        return OSD_ERROR_FAILURE;
+    }
+
+    const uint8_t *data = zframe_data((zframe_t *)body);
+    size_t str_len = zframe_size((zframe_t *)body) - sizeof(uint16_t);
+
+    uint16_t value_le;
+    memcpy(&value_le, data, sizeof(value_le));
+    *value = le16toh(value_le);
+
+    *str = malloc(str_len + 1);
+    assert(*str);
+    memcpy(*str, data + sizeof(value_le), str_len);
+    (*str)[str_len] = '\0';
+
+    return OSD_OK;
+}
+
+void proto_credit_rx_use(struct proto_credit_rx *credit)
+{
+    // A sender not (yet) knowing about flow control doesn't use credits
+    if (credit->outstanding > 0) {
+        credit->outstanding--;
+    }
+}
+
+uint32_t proto_credit_rx_refill(struct proto_credit_rx *credit)
+{
+    if (credit->outstanding >= PROTO_CREDIT_WINDOW / 2) {
+        return 0;
+    }
+
+    uint32_t grant = PROTO_CREDIT_WINDOW - credit->outstanding;
+    credit->outstanding = PROTO_CREDIT_WINDOW;
+    return grant;
+}
+
+osd_result proto_negotiate(zsock_t *sock, struct osd_log_ctx *log_ctx,
+                           int *version)
+{
+    int zmq_rv;
+
+    // request
+    zmsg_t *msg_req = zmsg_new();
+    assert(msg_req);
+    zmq_rv = zmsg_addstr(msg_req, "M");
+    assert(zmq_rv == 0);
+    zmq_rv = zmsg_addstrf(msg_req, "%s %d", PROTO_HELLO_REQUEST,
+                          PROTO_VERSION_MAX);
+    assert(zmq_rv == 0);
+    zmq_rv = zmsg_send(&msg_req, sock);
+    if (zmq_rv != 0) {
+        err(log_ctx, "Unable to send %s request to host controller",
+            PROTO_HELLO_REQUEST);
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+
+    // response
+    errno = 0;
+    zmsg_t *msg_resp = zmsg_recv(sock);
+    if (!msg_resp) {
+        err(log_ctx, "No response to %s received from host controller: %s (%d)",
+            PROTO_HELLO_REQUEST, strerror(errno), errno);
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+
+    zframe_t *type_frame = zmsg_first(msg_resp);
+    zframe_t *status_frame = zmsg_next(msg_resp);
+    if (!type_frame || !zframe_streq(type_frame, "M") || !status_frame) {
+        err(log_ctx, "Malformed response to %s received.",
+            PROTO_HELLO_REQUEST);
+        zmsg_destroy(&msg_resp);
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+
+    // A host controller only speaking version 1 acknowledges all unknown
+    // management requests.
+    int negotiated_version = PROTO_VERSION_1;
+    char *status_str = zframe_strdup(status_frame);
+    size_t prefix_len = strlen(PROTO_HELLO_RESPONSE " ");
+    if (!strncmp(status_str, PROTO_HELLO_RESPONSE " ", prefix_len)) {
+        char *end;
+        long int remote_version = strtol(status_str + prefix_len, &end, 10);
+        if (*end || remote_version < PROTO_VERSION_1) {
+            err(log_ctx, "Invalid protocol version '%s' received.",
+                status_str);
+        } else if (remote_version < PROTO_VERSION_MAX) {
+            negotiated_version = remote_version;
+        } else {
+            negotiated_version = PROTO_VERSION_MAX;
+        }
+    }
+    free(status_str);
+    zmsg_destroy(&msg_resp);
+
+    dbg(log_ctx, "Using protocol version %d to talk to the host controller.",
+        negotiated_version);
+
+    *version = negotiated_version;
+    return OSD_OK;
+}
+
+osd_result proto_request(zsock_t *sock, struct osd_log_ctx *log_ctx,
+                         uint8_t opcode, uint32_t seq, const void *body,
+                         size_t body_size, struct proto_hdr *resp_hdr,
+                         zframe_t **resp_body)
+{
+    int zmq_rv;
+    osd_result rv;
+
+    // request
+    zmsg_t *msg_req = proto_msg_new(opcode, seq);
+    if (body) {
+        zmq_rv = zmsg_addmem(msg_req, body, body_size);
+        assert(zmq_rv == 0);
+    }
+    zmq_rv = zmsg_send(&msg_req, sock);
+    if (zmq_rv != 0) {
+        err(log_ctx, "Unable to send request 0x%02x to host controller",
+            opcode);
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+
+    // response
+    zmsg_t *msg_resp;
+    while (1) {
+        errno = 0;
+        msg_resp = zmsg_recv(sock);
+        if (!msg_resp) {
+            err(log_ctx,
+                "No response to request 0x%02x received from host "
+                "controller: %s (%d)",
+                opcode, strerror(errno), errno);
+            return OSD_ERROR_CONNECTION_FAILED;
+        }
+
+        zframe_t *hdr_frame = zmsg_pop(msg_resp);
+        rv = proto_hdr_parse(hdr_frame, resp_hdr);
+        zframe_destroy(&hdr_frame);
+        if (OSD_FAILED(rv)) {
+            err(log_ctx, "Malformed response to request 0x%02x received.",
+                opcode);
+            zmsg_destroy(&msg_resp);
+            return OSD_ERROR_FAILURE;
+        }
+
+        if (resp_hdr->opcode != PROTO_OP_DATA &&
+            resp_hdr->opcode != PROTO_OP_CREDIT) {
+            break;
+        }
+        dbg(log_ctx, "Discarding message 0x%02x while waiting for response.",
+            resp_hdr->opcode);
+        zmsg_destroy(&msg_resp);
+    }
+    if (resp_hdr->seq != seq) {
+        err(log_ctx,
+            "Response to request 0x%02x has sequence number %u, expected %u.",
+            opcode, resp_hdr->seq, seq);
+        zmsg_destroy(&msg_resp);
+        return OSD_ERROR_FAILURE;
+    }
+
+    if (resp_body) {
+        *resp_body = zmsg_pop(msg_resp);
+    }
+    zmsg_destroy(&msg_resp);
+
+    return OSD_OK;
+}
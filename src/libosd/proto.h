@@ -0,0 +1,290 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PROTO_H
+#define PROTO_H
+
+#include <czmq.h>
+#include <osd/osd.h>
+#include <stdbool.h>
+
+/**
+ * Host communication protocol
+ *
+ * Host modules, gateways and the host controller exchange ZeroMQ messages.
+ * Two versions of the protocol exist:
+ *
+ * - Version 1 (text protocol): the first frame of a message is a type string,
+ *   "D" for data and "M" for management messages. Management requests and
+ *   responses are strings, such as "GW_REGISTER 1" or "ACK".
+ * - Version 2 (binary protocol): the first frame of a message is a header of
+ *   fixed size (PROTO_HDR_SIZE bytes) with a one-byte opcode and a sequence
+ *   number. An optional second frame carries the body: a DI packet for data
+ *   messages, or fixed-width fields for management messages.
+ *
+ * The version is negotiated when a client connects: the client sends the text
+ * management request "PROTO_HELLO <max. version>", which is answered with
+ * "PROTO <version>". Host controllers which only speak version 1 respond to
+ * unknown management requests with "ACK". In this case the client falls back
+ * to version 1.
+ *
+ * All multi-byte fields in headers and management bodies are little endian.
+ * Data bodies contain the DI packet in the same representation as in version
+ * 1 data messages (osd_packet.data_raw).
+ */
+
+/** Protocol version 1: text protocol */
+#define PROTO_VERSION_1 1
+/** Protocol version 2: binary protocol */
+#define PROTO_VERSION_2 2
+/** Highest protocol version supported by this library */
+#define PROTO_VERSION_MAX PROTO_VERSION_2
+
+/** Management request used to negotiate the protocol version */
+#define PROTO_HELLO_REQUEST "PROTO_HELLO"
+/** Response to PROTO_HELLO_REQUEST */
+#define PROTO_HELLO_RESPONSE "PROTO"
+
+/** Size of the header frame in a version 2 message (bytes) */
+#define PROTO_HDR_SIZE 8
+
+/**
+ * Opcodes in version 2 messages
+ */
+enum proto_opcode {
+    /** DI packet (body: packet data) */
+    PROTO_OP_DATA = 0x01,
+    /**
+     * Compressed DI packets (body: stream of DTDs, compressed with the codec
+     * negotiated with PROTO_OP_COMPRESS, see wirecomp.h)
+     */
+    PROTO_OP_DATA_COMPRESSED = 0x02,
+
+    /** Request successful (no body) */
+    PROTO_OP_ACK = 0x10,
+    /** Request failed (no body) */
+    PROTO_OP_NACK = 0x11,
+
+    /** Request a DI address (no body) */
+    PROTO_OP_DIADDR_REQUEST = 0x20,
+    /** Assigned DI address (body: uint16 diaddr) */
+    PROTO_OP_DIADDR_RESPONSE = 0x21,
+    /** Release the DI address of the sender (no body) */
+    PROTO_OP_DIADDR_RELEASE = 0x22,
+    /** Register as gateway (body: uint16 subnet) */
+    PROTO_OP_GW_REGISTER = 0x23,
+    /** Unregister as gateway (body: uint16 subnet) */
+    PROTO_OP_GW_UNREGISTER = 0x24,
+    /** Subscribe to EVENT packets sent to a DI address (body: uint16 diaddr) */
+    PROTO_OP_SUBSCRIBE = 0x25,
+    /** End a subscription (body: uint16 diaddr) */
+    PROTO_OP_UNSUBSCRIBE = 0x26,
+    /**
+     * Flow control: grant credits for data messages to the receiver
+     * (body: uint32 credits, not answered)
+     */
+    PROTO_OP_CREDIT = 0x27,
+    /** Request statistics (no body) */
+    PROTO_OP_STATS_REQUEST = 0x28,
+    /** Statistics (body: text, see stats.h) */
+    PROTO_OP_STATS_RESPONSE = 0x29,
+    /** Dump the flight recorder of the host controller (no body) */
+    PROTO_OP_FLIGHTREC_DUMP = 0x2a,
+    /**
+     * Send data messages compressed from now on (body: uint16 codec).
+     * Answered with PROTO_OP_NACK if the receiver doesn't support the codec.
+     */
+    PROTO_OP_COMPRESS = 0x2b,
+    /**
+     * Set the filter rules of the gateway serving a subnet (body: uint16
+     * subnet, followed by the rules as text, see osd_gateway_set_rx_filter()).
+     * Forwarded by the host controller to the gateway, which doesn't answer.
+     */
+    PROTO_OP_GW_FILTER = 0x2c,
+};
+
+/**
+ * Header flag of data messages: the message carries a trace record (see
+ * latency.h) in a third frame, after the DI packet
+ */
+#define PROTO_FLAG_TRACE 0x0001
+
+/**
+ * Number of data messages a receiver allows to be in flight
+ *
+ * Flow control is enabled for a direction of a connection as soon as the
+ * receiver sends its first PROTO_OP_CREDIT message. From then on the sender
+ * only sends data messages it has credits for. Credits are granted in
+ * batches: whenever less than half of the window is left, the receiver grants
+ * credits to fill up the window again.
+ *
+ * Only data messages in the bulk traffic class are subject to flow control;
+ * control messages (register accesses) neither need nor use credits.
+ */
+#define PROTO_CREDIT_WINDOW 1000
+
+/**
+ * Credit accounting on the receiver side of a connection
+ */
+struct proto_credit_rx {
+    /** Credits granted to the sender and not used yet */
+    uint32_t outstanding;
+};
+
+/**
+ * Decoded header of a version 2 message
+ */
+struct proto_hdr {
+    /** Protocol version, always PROTO_VERSION_2 */
+    uint8_t version;
+    /** Opcode, one of enum proto_opcode */
+    uint8_t opcode;
+    /** Flags, PROTO_FLAG_* or 0 */
+    uint16_t flags;
+    /**
+     * Sequence number
+     *
+     * Incremented by the sender with every message it sends. Responses to
+     * management requests carry the sequence number of the request.
+     */
+    uint32_t seq;
+};
+
+/**
+ * Create a new header frame for a version 2 message
+ */
+zframe_t *proto_hdr_frame_new(uint8_t opcode, uint16_t flags, uint32_t seq);
+
+/**
+ * Is @p frame the header frame of a version 2 message?
+ *
+ * The check is cheap and can be used on the first frame of any message to
+ * tell the protocol version apart: version 1 type frames are one byte long.
+ */
+bool proto_is_hdr_frame(const zframe_t *frame);
+
+/**
+ * Decode a version 2 header frame
+ *
+ * @return OSD_OK if @p frame is a valid header,
+ *         OSD_ERROR_FAILURE otherwise
+ */
+osd_result proto_hdr_parse(const zframe_t *frame, struct proto_hdr *hdr);
+
+/**
+ * Create a new version 2 message without body
+ */
+zmsg_t *proto_msg_new(uint8_t opcode, uint32_t seq);
+
+/**
+ * Create a new version 2 message with a uint16 body
+ */
+zmsg_t *proto_msg_new_u16(uint8_t opcode, uint32_t seq, uint16_t value);
+
+/**
+ * Decode a uint16 body
+ *
+ * @return OSD_OK if @p body has the right size,
+ *         OSD_ERROR_FAILURE otherwise
+ */
+osd_result proto_body_get_u16(const zframe_t *body, uint16_t *value);
+
+/**
+ * Create a new version 2 message with a uint32 body
+ */
+zmsg_t *proto_msg_new_u32(uint8_t opcode, uint32_t seq, uint32_t value);
+
+/**
+ * Decode a uint32 body
+ *
+ * @return OSD_OK if @p body has the right size,
+ *         OSD_ERROR_FAILURE otherwise
+ */
+osd_result proto_body_get_u32(const zframe_t *body, uint32_t *value);
+
+/**
+ * Create a new version 2 message with a uint16 and a text body
+ */
+zmsg_t *proto_msg_new_u16_str(uint8_t opcode, uint32_t seq, uint16_t value,
+                              const char *str);
+
+/**
+ * Decode a body consisting of a uint16 and a text
+ *
+ * @param[out] str the text (NUL terminated). Free it with free() after use.
+ * @return OSD_OK if @p body is large enough,
+ *         OSD_ERROR_FAILURE otherwise
+ */
+osd_result proto_body_get_u16_str(const zframe_t *body, uint16_t *value,
+                                  char **str);
+
+/**
+ * Account for a data message received from the sender
+ */
+void proto_credit_rx_use(struct proto_credit_rx *credit);
+
+/**
+ * Get the number of credits to grant to the sender
+ *
+ * The credits are accounted as granted; send them to the sender in a
+ * PROTO_OP_CREDIT message.
+ *
+ * @return the number of credits to grant, or 0 if no credits need to be
+ *         granted at this point
+ */
+uint32_t proto_credit_rx_refill(struct proto_credit_rx *credit);
+
+/**
+ * Negotiate the protocol version with the host controller
+ *
+ * Call this function directly after connecting @p sock, before any other
+ * message is sent.
+ *
+ * @param sock DEALER socket connected to the host controller
+ * @param log_ctx the log context
+ * @param[out] version the negotiated protocol version
+ * @return OSD_OK on success,
+ *         OSD_ERROR_CONNECTION_FAILED if the host controller did not respond
+ */
+osd_result proto_negotiate(zsock_t *sock, struct osd_log_ctx *log_ctx,
+                           int *version);
+
+/**
+ * Send a version 2 management request and wait for the response
+ *
+ * Data messages and credit grants received while waiting for the response
+ * are discarded. Only use this function when no data is expected.
+ *
+ * @param sock DEALER socket connected to the host controller
+ * @param log_ctx the log context
+ * @param opcode opcode of the request
+ * @param seq sequence number of the request
+ * @param body body of the request, or NULL if the request has no body
+ * @param body_size size of @p body in bytes
+ * @param[out] resp_hdr header of the response
+ * @param[out] resp_body body of the response, or NULL if the response has no
+ *                       body. The caller takes ownership of the frame. Set
+ *                       the pointer to NULL if the body is not needed.
+ * @return OSD_OK if a response with matching sequence number was received,
+ *         OSD_ERROR_CONNECTION_FAILED if the request could not be sent or no
+ *         response was received,
+ *         OSD_ERROR_FAILURE if the response was malformed.
+ */
+osd_result proto_request(zsock_t *sock, struct osd_log_ctx *log_ctx,
+                         uint8_t opcode, uint32_t seq, const void *body,
+                         size_t body_size, struct proto_hdr *resp_hdr,
+                         zframe_t **resp_body);
+
+#endif  // PROTO_H
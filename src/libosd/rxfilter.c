@@ -0,0 +1,351 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rxfilter.h"
+#include "util.h"
+
+#include <osd/gateway.h>
+#include <osd/osd.h>
+#include <osd/packet.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum rxfilter_action {
+    ACTION_DROP,
+    ACTION_SAMPLE,
+    ACTION_AGGREGATE,
+};
+
+struct rxfilter_rule {
+    enum rxfilter_action action;
+    /** Sampling rate (ACTION_SAMPLE) or interval in ms (ACTION_AGGREGATE) */
+    uint32_t arg;
+
+    bool match_src;
+    uint16_t src;
+    bool match_type_sub;
+    unsigned int type_sub;
+};
+
+/**
+ * State of a source (module)
+ */
+struct rxfilter_src {
+    /** Packets seen by sampling rules */
+    uint32_t sampled;
+
+    /** Aggregated packets in the current interval */
+    uint32_t events;
+    /** Sum of their payload sizes (words) */
+    uint32_t payload_words;
+    /** Packet counts by payload size */
+    uint32_t hist[OSD_GATEWAY_SUMMARY_HIST_BUCKETS];
+    /** Destination of the last aggregated packet */
+    uint16_t dest;
+    /** Length of the aggregation interval (ms) */
+    uint32_t interval_ms;
+    /** Start of the current interval (ns), 0 if no interval is running */
+    uint64_t interval_start_ns;
+};
+
+struct rxfilter_subnet {
+    struct rxfilter_src srcs[OSD_DIADDR_LOCAL_MAX + 1];
+    /** Number of sources with a running interval */
+    unsigned int aggregating;
+};
+
+struct rxfilter {
+    struct rxfilter_rule rules[RXFILTER_RULES_MAX];
+    unsigned int rules_count;
+    bool aggregates;
+
+    /** All subnets, NULL until the first packet of a subnet is counted */
+    struct rxfilter_subnet *subnets[OSD_DIADDR_SUBNET_MAX + 1];
+};
+
+/**
+ * Parse a single rule (modified in place)
+ *
+ * @return OSD_OK on success, OSD_ERROR_FAILURE if the rule is invalid
+ */
+static osd_result parse_rule(char *str, struct rxfilter_rule *rule)
+{
+    const char *delim = " \t\r";
+    char *saveptr;
+    char *word = strtok_r(str, delim, &saveptr);
+    assert(word);
+
+    memset(rule, 0, sizeof(struct rxfilter_rule));
+
+    unsigned long value;
+    if (!strcmp(word, "drop")) {
+        rule->action = ACTION_DROP;
+    } else if (!strcmp(word, "sample") || !strcmp(word, "aggregate")) {
+        rule->action = word[0] == 's' ? ACTION_SAMPLE : ACTION_AGGREGATE;
+        word = strtok_r(NULL, delim, &saveptr);
+        if (!word || !util_parse_uint(word, UINT32_MAX, &value) || value == 0) {
+            return OSD_ERROR_FAILURE;
+        }
+        rule->arg = value;
+    } else {
+        return OSD_ERROR_FAILURE;
+    }
+
+    while ((word = strtok_r(NULL, delim, &saveptr))) {
+        if (!strncmp(word, "src=", 4)) {
+            if (!util_parse_diaddr(word + 4, &rule->src)) {
+                return OSD_ERROR_FAILURE;
+            }
+            rule->match_src = true;
+        } else if (!strncmp(word, "type_sub=", 9)) {
+            if (!util_parse_uint(word + 9, DP_HEADER_TYPE_SUB_MASK, &value)) {
+                return OSD_ERROR_FAILURE;
+            }
+            rule->type_sub = value;
+            rule->match_type_sub = true;
+        } else {
+            return OSD_ERROR_FAILURE;
+        }
+    }
+
+    return OSD_OK;
+}
+
+osd_result rxfilter_new(struct rxfilter **f_p, const char *rules)
+{
+    assert(rules);
+
+    struct rxfilter *f = calloc(1, sizeof(struct rxfilter));
+    assert(f);
+
+    char *rules_copy = strdup(rules);
+    assert(rules_copy);
+
+    osd_result rv = OSD_OK;
+    char *saveptr;
+    for (char *rule_str = strtok_r(rules_copy, ";\n", &saveptr); rule_str;
+         rule_str = strtok_r(NULL, ";\n", &saveptr)) {
+        if (strspn(rule_str, " \t\r") == strlen(rule_str)) {
+            continue;  // empty rule
+        }
+        if (f->rules_count == RXFILTER_RULES_MAX) {
+            rv = OSD_ERROR_FAILURE;
+            break;
+        }
+        struct rxfilter_rule *rule = &f->rules[f->rules_count++];
+        rv = parse_rule(rule_str, rule);
+        if (OSD_FAILED(rv)) {
+            break;
+        }
+        if (rule->action == ACTION_AGGREGATE) {
+            f->aggregates = true;
+        }
+    }
+    free(rules_copy);
+
+    if (OSD_FAILED(rv)) {
+        free(f);
+        return rv;
+    }
+
+    *f_p = f;
+    return OSD_OK;
+}
+
+void rxfilter_free(struct rxfilter **f_p)
+{
+    assert(f_p);
+    struct rxfilter *f = *f_p;
+    if (!f) {
+        return;
+    }
+
+    for (unsigned int i = 0; i <= OSD_DIADDR_SUBNET_MAX; i++) {
+        free(f->subnets[i]);
+    }
+    free(f);
+    *f_p = NULL;
+}
+
+unsigned int rxfilter_rules_count(const struct rxfilter *f)
+{
+    return f->rules_count;
+}
+
+bool rxfilter_aggregates(const struct rxfilter *f)
+{
+    return f->aggregates;
+}
+
+/**
+ * Get the state of a source, allocating its subnet on first use
+ */
+static struct rxfilter_src *src_get(struct rxfilter *f, uint16_t diaddr,
+                                    struct rxfilter_subnet **sn_p)
+{
+    unsigned int subnet = osd_diaddr_subnet(diaddr);
+    if (!f->subnets[subnet]) {
+        f->subnets[subnet] = calloc(1, sizeof(struct rxfilter_subnet));
+        assert(f->subnets[subnet]);
+    }
+    *sn_p = f->subnets[subnet];
+    return &f->subnets[subnet]->srcs[osd_diaddr_localaddr(diaddr)];
+}
+
+/**
+ * Histogram bucket of a payload size
+ */
+static unsigned int hist_bucket(unsigned int payload_words)
+{
+    unsigned int bucket = 0;
+    while (payload_words && bucket < OSD_GATEWAY_SUMMARY_HIST_BUCKETS - 1) {
+        payload_words >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static void aggregate(struct rxfilter *f, const struct rxfilter_rule *rule,
+                      const struct osd_packet *pkg, uint64_t now_ns)
+{
+    struct rxfilter_subnet *sn;
+    struct rxfilter_src *src = src_get(f, osd_packet_get_src(pkg), &sn);
+
+    if (!src->interval_start_ns) {
+        // now_ns is never 0 in practice, but 0 marks an idle source
+        src->interval_start_ns = now_ns ? now_ns : 1;
+        src->interval_ms = rule->arg;
+        sn->aggregating++;
+    }
+
+    unsigned int payload_words = pkg->data_size_words - 3;
+    if (src->events < UINT32_MAX) {
+        src->events++;
+        src->hist[hist_bucket(payload_words)]++;
+    }
+    if (src->payload_words <= UINT32_MAX - payload_words) {
+        src->payload_words += payload_words;
+    }
+    src->dest = osd_packet_get_dest(pkg);
+}
+
+enum rxfilter_verdict rxfilter_apply(struct rxfilter *f,
+                                     const struct osd_packet *pkg,
+                                     uint64_t now_ns)
+{
+    if (osd_packet_get_traffic_class(pkg) != OSD_TCLASS_BULK) {
+        return RXFILTER_PASS;
+    }
+
+    uint16_t src_addr = osd_packet_get_src(pkg);
+    unsigned int type_sub = osd_packet_get_type_sub(pkg);
+
+    for (unsigned int i = 0; i < f->rules_count; i++) {
+        const struct rxfilter_rule *rule = &f->rules[i];
+        if ((rule->match_src && rule->src != src_addr) ||
+            (rule->match_type_sub && rule->type_sub != type_sub)) {
+            continue;
+        }
+
+        struct rxfilter_subnet *sn;
+        struct rxfilter_src *src;
+        switch (rule->action) {
+            case ACTION_DROP:
+                return RXFILTER_DROP;
+            case ACTION_SAMPLE:
+                src = src_get(f, src_addr, &sn);
+                return (src->sampled++ % rule->arg) == 0 ? RXFILTER_PASS
+                                                         : RXFILTER_DROP;
+            case ACTION_AGGREGATE:
+                aggregate(f, rule, pkg, now_ns);
+                return RXFILTER_AGGREGATE;
+        }
+    }
+
+    return RXFILTER_PASS;
+}
+
+static void put_u32(uint16_t *words, uint32_t value)
+{
+    words[0] = value & 0xffff;
+    words[1] = value >> 16;
+}
+
+/**
+ * Create the summary packet of a source and start a new interval
+ */
+static struct osd_packet *summary_new(struct rxfilter_src *src,
+                                      uint16_t diaddr, uint64_t now_ns)
+{
+    struct osd_packet *pkg;
+    osd_result rv = osd_packet_new(
+        &pkg, osd_packet_get_data_size_words_from_payload(
+                  OSD_GATEWAY_SUMMARY_PAYLOAD_WORDS));
+    assert(OSD_SUCCEEDED(rv));
+    rv = osd_packet_set_header(pkg, src->dest, diaddr, OSD_PACKET_TYPE_EVENT,
+                               OSD_GATEWAY_SUMMARY_TYPE_SUB);
+    assert(OSD_SUCCEEDED(rv));
+
+    uint64_t duration_ms = (now_ns - src->interval_start_ns) / 1000000;
+    uint16_t *payload = pkg->data.payload;
+    put_u32(&payload[0], src->events);
+    put_u32(&payload[2], src->payload_words);
+    put_u32(&payload[4], duration_ms > UINT32_MAX ? UINT32_MAX : duration_ms);
+    for (unsigned int i = 0; i < OSD_GATEWAY_SUMMARY_HIST_BUCKETS; i++) {
+        put_u32(&payload[6 + 2 * i], src->hist[i]);
+    }
+
+    src->events = 0;
+    src->payload_words = 0;
+    memset(src->hist, 0, sizeof(src->hist));
+    src->interval_start_ns = now_ns ? now_ns : 1;
+    return pkg;
+}
+
+size_t rxfilter_flush(struct rxfilter *f, uint64_t now_ns, bool all,
+                      struct osd_packet **pkgs, size_t max)
+{
+    size_t count = 0;
+    for (unsigned int s = 0; s <= OSD_DIADDR_SUBNET_MAX; s++) {
+        struct rxfilter_subnet *sn = f->subnets[s];
+        if (!sn || !sn->aggregating) {
+            continue;
+        }
+        for (unsigned int l = 0; l <= OSD_DIADDR_LOCAL_MAX; l++) {
+            struct rxfilter_src *src = &sn->srcs[l];
+            if (!src->interval_start_ns) {
+                continue;
+            }
+            uint64_t interval_ns = (uint64_t)src->interval_ms * 1000000;
+            if (!all && now_ns - src->interval_start_ns < interval_ns) {
+                continue;
+            }
+
+            if (!src->events) {
+                // idle source: end the interval until the next packet
+                src->interval_start_ns = 0;
+                sn->aggregating--;
+                continue;
+            }
+            if (count == max) {
+                return count;
+            }
+            pkgs[count++] = summary_new(src, osd_diaddr_build(s, l), now_ns);
+        }
+    }
+    return count;
+}
@@ -0,0 +1,118 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RXFILTER_H
+#define RXFILTER_H
+
+#include <osd/osd.h>
+#include <osd/packet.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Filter and aggregation of trace packets read from a device
+ *
+ * A filter is a list of rules, given as text: rules are separated by ';' or
+ * newlines, the words of a rule by spaces. A rule has an action, optionally
+ * followed by conditions, all of which must match:
+ *
+ * - "drop": drop the packet
+ * - "sample <N>": forward every N-th packet of each source, drop the others
+ * - "aggregate <ms>": replace the packets of each source by a summary packet
+ *   every <ms> milliseconds (see osd_gateway_set_rx_filter())
+ * - condition "src=<diaddr>": the packet was sent by this module. The address
+ *   is given as "<subnet>.<local>" or as a number.
+ * - condition "type_sub=<N>": the packet has this subtype
+ *
+ * The first matching rule decides about a packet; packets no rule matches are
+ * forwarded. Only bulk packets (EVENT and PLAIN) are filtered.
+ *
+ * The object is not locked. The state of the sources is allocated per
+ * subnet once the first packet of the subnet is aggregated or sampled.
+ */
+
+/** Maximum number of rules in a filter */
+#define RXFILTER_RULES_MAX 32
+
+/**
+ * What to do with a packet
+ */
+enum rxfilter_verdict {
+    /** Forward the packet */
+    RXFILTER_PASS,
+    /** Drop the packet (dropped by a rule, or not sampled) */
+    RXFILTER_DROP,
+    /** Drop the packet, it is accounted in the summary of its source */
+    RXFILTER_AGGREGATE,
+};
+
+struct rxfilter;
+
+/**
+ * Create a filter from its rules
+ *
+ * @param rules the rules (see above). An empty string creates a filter
+ *              without rules.
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if the rules are invalid
+ */
+osd_result rxfilter_new(struct rxfilter **f, const char *rules);
+
+/**
+ * Free a filter
+ */
+void rxfilter_free(struct rxfilter **f_p);
+
+/**
+ * Number of rules in a filter
+ */
+unsigned int rxfilter_rules_count(const struct rxfilter *f);
+
+/**
+ * Does a filter aggregate packets, i.e. does rxfilter_flush() need to be
+ * called periodically?
+ */
+bool rxfilter_aggregates(const struct rxfilter *f);
+
+/**
+ * Apply the filter to a packet
+ *
+ * @param now_ns the current time (ns, see latency_now_ns())
+ */
+enum rxfilter_verdict rxfilter_apply(struct rxfilter *f,
+                                     const struct osd_packet *pkg,
+                                     uint64_t now_ns);
+
+/**
+ * Create the summary packets of all sources whose aggregation interval
+ * is over
+ *
+ * The summaries are EVENT packets from the aggregated source to the
+ * destination of its last aggregated packet, see
+ * OSD_GATEWAY_SUMMARY_TYPE_SUB.
+ *
+ * @param now_ns the current time (ns)
+ * @param all create the summaries of all sources with aggregated packets,
+ *            even if their interval is not over yet
+ * @param[out] pkgs the summary packets. The caller frees them.
+ * @param max maximum number of packets to create (size of @p pkgs). The
+ *            other summaries are created in a later call.
+ * @return the number of summary packets created
+ */
+size_t rxfilter_flush(struct rxfilter *f, uint64_t now_ns, bool all,
+                      struct osd_packet **pkgs, size_t max);
+
+#endif  // RXFILTER_H
@@ -0,0 +1,1179 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shm.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "osd-private.h"
+#include "worker.h"
+
+/** Magic number in the ring header ("OSDR") */
+#define SHM_RING_MAGIC 0x5244534f
+
+/** Record size value marking the rest of the data area as unused */
+#define SHM_RECORD_WRAP UINT32_MAX
+
+/** Number of file descriptors passed by the client in the handshake */
+#define SHM_HANDSHAKE_CLIENT_FDS 3
+
+/** Seals of a ring memfd: its size can't change while it is mapped */
+#define SHM_RING_SEALS (F_SEAL_SHRINK | F_SEAL_GROW)
+
+/**
+ * Header of a ring buffer, at the start of the shared memory
+ *
+ * The fields written by the producer and the consumer are placed in separate
+ * cache lines.
+ */
+struct shm_ring_hdr {
+    /** SHM_RING_MAGIC */
+    uint32_t magic;
+    /** Size of the data area (bytes) */
+    uint32_t size;
+
+    /** Bytes written since the ring was created (producer) */
+    uint64_t head __attribute__((aligned(64)));
+    /** The producer waits for free space and needs a wakeup (producer) */
+    uint32_t producer_waiting;
+
+    /** Bytes read since the ring was created (consumer) */
+    uint64_t tail __attribute__((aligned(64)));
+    /** The consumer waits for data and needs a wakeup (consumer) */
+    uint32_t consumer_waiting;
+};
+
+/**
+ * Header of a record (one message) in the data area
+ *
+ * The header is followed by one (uint32 size, data) pair per frame. Records
+ * are padded to a multiple of 8 bytes and never wrap around the end of the
+ * data area.
+ */
+struct shm_record_hdr {
+    /** Size of the record without header and padding, or SHM_RECORD_WRAP */
+    uint32_t size;
+    /** Number of frames in the message */
+    uint32_t frames;
+};
+
+struct shm_ring {
+    /** memfd backing the ring */
+    int fd;
+    /** Mapped header */
+    struct shm_ring_hdr *hdr;
+    /** Mapped data area */
+    uint8_t *data;
+    /** Size of the data area (bytes) */
+    size_t size;
+    /** Producer: tail seen when the ring was found to be full */
+    uint64_t tail_seen;
+    /** Consumer: a malformed record was found, nothing is read any more */
+    bool corrupt;
+};
+
+/**
+ * One shared-memory connection, bridged into a ZeroMQ socket
+ */
+struct shm_conn {
+    struct osd_log_ctx *log_ctx;
+
+    /** Event loop handling the connection, NULL if not started */
+    zloop_t *loop;
+
+    /** UNIX domain socket used for the handshake and to detect hangups */
+    int sock_fd;
+
+    /** eventfd the other side signals to wake us up */
+    int wake_fd;
+
+    /** eventfd we signal to wake up the other side */
+    int peer_wake_fd;
+
+    /** Ring for messages to the other side */
+    struct shm_ring *tx_ring;
+
+    /** Ring for messages from the other side */
+    struct shm_ring *rx_ring;
+
+    /** ZeroMQ socket the connection is bridged into */
+    zsock_t *zsock;
+
+    /** Message waiting for space in tx_ring */
+    zmsg_t *tx_pending;
+
+    /** Listener this connection belongs to (host controller side only) */
+    struct shm_listener *listener;
+
+    /**
+     * The handshake is not done yet: only the UNIX domain socket is handled
+     * in the event loop (host controller side only)
+     */
+    bool handshake;
+};
+
+struct shm_listener {
+    struct osd_log_ctx *log_ctx;
+    zloop_t *loop;
+
+    /** Path of the listening socket */
+    char *path;
+
+    /** Endpoint of the host controller ROUTER socket */
+    char *router_endpoint;
+
+    /** Listening UNIX domain socket */
+    int listen_fd;
+
+    /** Open connections (struct shm_conn) */
+    zlist_t *conns;
+};
+
+struct shm_client {
+    /** Connection thread */
+    struct worker_ctx *worker;
+
+    /** Inproc endpoint served by the connection thread */
+    char endpoint[64];
+};
+
+/**
+ * User context of the client connection thread
+ */
+struct shm_client_usr_ctx {
+    /** shm:// URL of the host controller */
+    char *url;
+
+    /** Inproc endpoint to serve */
+    char *endpoint;
+
+    /** The connection */
+    struct shm_conn *conn;
+};
+
+static int conn_wake_rcv(zloop_t *loop, zmq_pollitem_t *item, void *conn_void);
+static int conn_zsock_rcv(zloop_t *loop, zsock_t *reader, void *conn_void);
+
+bool shm_is_url(const char *url)
+{
+    return !strncmp(url, SHM_URL_SCHEME, strlen(SHM_URL_SCHEME));
+}
+
+static size_t record_size_padded(size_t size)
+{
+    return (sizeof(struct shm_record_hdr) + size + 7) & ~(size_t)7;
+}
+
+osd_result shm_ring_new(struct shm_ring **ring, size_t size)
+{
+    assert(size >= 64 && (size & (size - 1)) == 0);
+
+    int fd = memfd_create("osd-shm-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1) {
+        return OSD_ERROR_FAILURE;
+    }
+    if (ftruncate(fd, sizeof(struct shm_ring_hdr) + size) == -1) {
+        close(fd);
+        return OSD_ERROR_FAILURE;
+    }
+
+    // A new memfd is zero-filled: only the constant fields need to be set.
+    struct shm_ring_hdr *hdr =
+        mmap(NULL, sizeof(struct shm_ring_hdr), PROT_READ | PROT_WRITE,
+             MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED) {
+        close(fd);
+        return OSD_ERROR_FAILURE;
+    }
+    hdr->magic = SHM_RING_MAGIC;
+    hdr->size = size;
+    munmap(hdr, sizeof(struct shm_ring_hdr));
+
+    if (fcntl(fd, F_ADD_SEALS, SHM_RING_SEALS) == -1) {
+        close(fd);
+        return OSD_ERROR_FAILURE;
+    }
+
+    return shm_ring_map(ring, fd);
+}
+
+osd_result shm_ring_map(struct shm_ring **ring, int fd)
+{
+    // Without the seals the other side could truncate the memfd while it is
+    // mapped, and accessing the mapping would raise SIGBUS.
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (seals == -1 || (seals & SHM_RING_SEALS) != SHM_RING_SEALS) {
+        close(fd);
+        return OSD_ERROR_FAILURE;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 ||
+        (size_t)st.st_size <= sizeof(struct shm_ring_hdr)) {
+        close(fd);
+        return OSD_ERROR_FAILURE;
+    }
+
+    void *mem = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                     0);
+    if (mem == MAP_FAILED) {
+        close(fd);
+        return OSD_ERROR_FAILURE;
+    }
+
+    struct shm_ring_hdr *hdr = mem;
+    size_t size = st.st_size - sizeof(struct shm_ring_hdr);
+    if (hdr->magic != SHM_RING_MAGIC || hdr->size != size ||
+        (size & (size - 1)) != 0) {
+        munmap(mem, st.st_size);
+        close(fd);
+        return OSD_ERROR_FAILURE;
+    }
+
+    struct shm_ring *r = calloc(1, sizeof(struct shm_ring));
+    assert(r);
+    r->fd = fd;
+    r->hdr = hdr;
+    r->data = (uint8_t *)mem + sizeof(struct shm_ring_hdr);
+    r->size = size;
+
+    *ring = r;
+    return OSD_OK;
+}
+
+void shm_ring_free(struct shm_ring **ring_p)
+{
+    assert(ring_p);
+    struct shm_ring *ring = *ring_p;
+    if (!ring) {
+        return;
+    }
+
+    munmap(ring->hdr, sizeof(struct shm_ring_hdr) + ring->size);
+    close(ring->fd);
+    free(ring);
+    *ring_p = NULL;
+}
+
+int shm_ring_get_fd(struct shm_ring *ring)
+{
+    return ring->fd;
+}
+
+osd_result shm_ring_write(struct shm_ring *ring, zmsg_t *msg)
+{
+    struct shm_ring_hdr *hdr = ring->hdr;
+
+    size_t payload_size = 0;
+    for (zframe_t *f = zmsg_first(msg); f; f = zmsg_next(msg)) {
+        payload_size += sizeof(uint32_t) + zframe_size(f);
+    }
+    size_t rec_size = record_size_padded(payload_size);
+
+    // Half of the ring is the largest size which can always be written
+    // without deadlocking on the wrap-around.
+    if (rec_size > ring->size / 2) {
+        return OSD_ERROR_FAILURE;
+    }
+
+    uint64_t head = hdr->head;
+    uint64_t tail = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+    size_t pos = head & (ring->size - 1);
+    size_t contiguous = ring->size - pos;
+
+    size_t needed = rec_size;
+    if (rec_size > contiguous) {
+        needed += contiguous;
+    }
+    if (needed > ring->size - (head - tail)) {
+        ring->tail_seen = tail;
+        return OSD_ERROR_COM;
+    }
+
+    if (rec_size > contiguous) {
+        struct shm_record_hdr wrap = {.size = SHM_RECORD_WRAP};
+        memcpy(ring->data + pos, &wrap, sizeof(wrap));
+        head += contiguous;
+        pos = 0;
+    }
+
+    uint8_t *p = ring->data + pos;
+    struct shm_record_hdr rec = {.size = payload_size,
+                                 .frames = zmsg_size(msg)};
+    memcpy(p, &rec, sizeof(rec));
+    p += sizeof(rec);
+    for (zframe_t *f = zmsg_first(msg); f; f = zmsg_next(msg)) {
+        uint32_t frame_size = zframe_size(f);
+        memcpy(p, &frame_size, sizeof(frame_size));
+        p += sizeof(frame_size);
+        memcpy(p, zframe_data(f), frame_size);
+        p += frame_size;
+    }
+
+    __atomic_store_n(&hdr->head, head + rec_size, __ATOMIC_RELEASE);
+    return OSD_OK;
+}
+
+zmsg_t *shm_ring_read(struct shm_ring *ring)
+{
+    struct shm_ring_hdr *hdr = ring->hdr;
+
+    if (ring->corrupt) {
+        return NULL;
+    }
+
+    uint64_t tail = hdr->tail;
+    uint64_t head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+    if (tail == head) {
+        return NULL;
+    }
+
+    size_t pos = tail & (ring->size - 1);
+    struct shm_record_hdr rec;
+    memcpy(&rec, ring->data + pos, sizeof(rec));
+    if (rec.size == SHM_RECORD_WRAP) {
+        tail += ring->size - pos;
+        pos = 0;
+        memcpy(&rec, ring->data, sizeof(rec));
+    }
+
+    // The other side is not trusted to write valid records: never read
+    // outside of the data area. A malformed record can't be skipped, the
+    // position of the next one is unknown.
+    size_t rec_size = record_size_padded(rec.size);
+    if (rec.size == SHM_RECORD_WRAP || rec_size > ring->size - pos) {
+        ring->corrupt = true;
+        return NULL;
+    }
+
+    zmsg_t *msg = zmsg_new();
+    assert(msg);
+    const uint8_t *p = ring->data + pos + sizeof(rec);
+    const uint8_t *end = p + rec.size;
+    for (uint32_t i = 0; i < rec.frames; i++) {
+        uint32_t frame_size;
+        if ((size_t)(end - p) < sizeof(frame_size)) {
+            zmsg_destroy(&msg);
+            ring->corrupt = true;
+            return NULL;
+        }
+        memcpy(&frame_size, p, sizeof(frame_size));
+        p += sizeof(frame_size);
+        if ((size_t)(end - p) < frame_size) {
+            zmsg_destroy(&msg);
+            ring->corrupt = true;
+            return NULL;
+        }
+        int zmq_rv = zmsg_addmem(msg, p, frame_size);
+        assert(zmq_rv == 0);
+        p += frame_size;
+    }
+
+    __atomic_store_n(&hdr->tail, tail + rec_size, __ATOMIC_RELEASE);
+    return msg;
+}
+
+bool shm_ring_is_corrupt(struct shm_ring *ring)
+{
+    return ring->corrupt;
+}
+
+bool shm_ring_consumer_sleep(struct shm_ring *ring)
+{
+    struct shm_ring_hdr *hdr = ring->hdr;
+
+    __atomic_store_n(&hdr->consumer_waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE) != hdr->tail) {
+        __atomic_store_n(&hdr->consumer_waiting, 0, __ATOMIC_RELAXED);
+        return false;
+    }
+    return true;
+}
+
+bool shm_ring_producer_sleep(struct shm_ring *ring)
+{
+    struct shm_ring_hdr *hdr = ring->hdr;
+
+    __atomic_store_n(&hdr->producer_waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE) != ring->tail_seen) {
+        __atomic_store_n(&hdr->producer_waiting, 0, __ATOMIC_RELAXED);
+        return false;
+    }
+    return true;
+}
+
+bool shm_ring_consumer_needs_wakeup(struct shm_ring *ring)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&ring->hdr->consumer_waiting, __ATOMIC_RELAXED)) {
+        return false;
+    }
+    return __atomic_exchange_n(&ring->hdr->consumer_waiting, 0,
+                               __ATOMIC_RELAXED);
+}
+
+bool shm_ring_producer_needs_wakeup(struct shm_ring *ring)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&ring->hdr->producer_waiting, __ATOMIC_RELAXED)) {
+        return false;
+    }
+    return __atomic_exchange_n(&ring->hdr->producer_waiting, 0,
+                               __ATOMIC_RELAXED);
+}
+
+/**
+ * Get the path of the UNIX domain socket from a shm:// URL
+ */
+static osd_result url_to_sockaddr(const char *url, struct sockaddr_un *addr)
+{
+    const char *path = url + strlen(SHM_URL_SCHEME);
+    if (!*path || strlen(path) >= sizeof(addr->sun_path)) {
+        return OSD_ERROR_FAILURE;
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    return OSD_OK;
+}
+
+/**
+ * Send file descriptors over a UNIX domain socket
+ */
+static osd_result send_fds(int sock_fd, const int *fds, unsigned int fd_count)
+{
+    char buf[CMSG_SPACE(sizeof(int) * SHM_HANDSHAKE_CLIENT_FDS)];
+    memset(buf, 0, sizeof(buf));
+    assert(fd_count <= SHM_HANDSHAKE_CLIENT_FDS);
+
+    char tag = 'S';
+    struct iovec iov = {.iov_base = &tag, .iov_len = 1};
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = buf,
+        .msg_controllen = CMSG_SPACE(sizeof(int) * fd_count),
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_count);
+
+    if (sendmsg(sock_fd, &msg, MSG_NOSIGNAL) != 1) {
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+    return OSD_OK;
+}
+
+/**
+ * Receive exactly @p fd_count file descriptors over a UNIX domain socket
+ *
+ * @return OSD_OK on success,
+ *         OSD_ERROR_TIMEDOUT if nothing was received (yet),
+ *         OSD_ERROR_CONNECTION_FAILED if the handshake failed
+ */
+static osd_result recv_fds(int sock_fd, int *fds, unsigned int fd_count)
+{
+    char buf[CMSG_SPACE(sizeof(int) * SHM_HANDSHAKE_CLIENT_FDS)];
+    memset(buf, 0, sizeof(buf));
+    assert(fd_count <= SHM_HANDSHAKE_CLIENT_FDS);
+
+    char tag;
+    struct iovec iov = {.iov_base = &tag, .iov_len = 1};
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = buf,
+        .msg_controllen = sizeof(buf),
+    };
+    ssize_t received_bytes = recvmsg(sock_fd, &msg, MSG_CMSG_CLOEXEC);
+    if (received_bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return OSD_ERROR_TIMEDOUT;
+    }
+    if (received_bytes != 1) {
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS) {
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+    unsigned int received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * received);
+    if (received != fd_count) {
+        for (unsigned int i = 0; i < received; i++) {
+            close(fds[i]);
+        }
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+    return OSD_OK;
+}
+
+/**
+ * Set a receive timeout on a UNIX domain socket used for the handshake
+ */
+static void set_sock_timeout(int sock_fd)
+{
+    struct timeval tv = {.tv_sec = ZMQ_RCV_TIMEOUT / 1000,
+                         .tv_usec = (ZMQ_RCV_TIMEOUT % 1000) * 1000};
+    setsockopt(sock_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+static struct shm_conn *conn_new(struct osd_log_ctx *log_ctx)
+{
+    struct shm_conn *conn = calloc(1, sizeof(struct shm_conn));
+    assert(conn);
+    conn->log_ctx = log_ctx;
+    conn->sock_fd = -1;
+    conn->wake_fd = -1;
+    conn->peer_wake_fd = -1;
+    return conn;
+}
+
+/**
+ * Stop handling the connection in the event loop
+ */
+static void conn_stop(struct shm_conn *conn)
+{
+    if (!conn->loop) {
+        return;
+    }
+
+    zmq_pollitem_t sock_item = {.fd = conn->sock_fd, .events = ZMQ_POLLIN};
+    zloop_poller_end(conn->loop, &sock_item);
+    if (!conn->handshake) {
+        zmq_pollitem_t wake_item = {.fd = conn->wake_fd, .events = ZMQ_POLLIN};
+        zloop_poller_end(conn->loop, &wake_item);
+        if (!conn->tx_pending) {
+            zloop_reader_end(conn->loop, conn->zsock);
+        }
+    }
+    conn->handshake = false;
+    conn->loop = NULL;
+}
+
+static void conn_free(struct shm_conn **conn_p)
+{
+    assert(conn_p);
+    struct shm_conn *conn = *conn_p;
+    if (!conn) {
+        return;
+    }
+
+    conn_stop(conn);
+    zsock_destroy(&conn->zsock);
+    zmsg_destroy(&conn->tx_pending);
+    shm_ring_free(&conn->tx_ring);
+    shm_ring_free(&conn->rx_ring);
+    if (conn->sock_fd != -1) {
+        close(conn->sock_fd);
+    }
+    if (conn->wake_fd != -1) {
+        close(conn->wake_fd);
+    }
+    if (conn->peer_wake_fd != -1) {
+        close(conn->peer_wake_fd);
+    }
+
+    free(conn);
+    *conn_p = NULL;
+}
+
+static void conn_wake_peer(struct shm_conn *conn)
+{
+    uint64_t one = 1;
+    ssize_t rv = write(conn->peer_wake_fd, &one, sizeof(one));
+    (void)rv;  // the eventfd counter can't overflow in practice
+}
+
+/**
+ * Write a message to the other side
+ *
+ * @return true if the message was written (or dropped), false if the ring
+ *         is full and the message is kept as pending message
+ */
+static bool conn_tx(struct shm_conn *conn, zmsg_t *msg)
+{
+    while (1) {
+        osd_result rv = shm_ring_write(conn->tx_ring, msg);
+        if (rv == OSD_OK) {
+            zmsg_destroy(&msg);
+            return true;
+        }
+        if (rv != OSD_ERROR_COM) {
+            err(conn->log_ctx, "Message of %zu bytes too large for shared "
+                "memory ring, dropping it.", zmsg_content_size(msg));
+            zmsg_destroy(&msg);
+            return true;
+        }
+
+        // Ring is full: wait for the other side to make space.
+        if (shm_ring_producer_sleep(conn->tx_ring)) {
+            conn->tx_pending = msg;
+            return false;
+        }
+    }
+}
+
+/**
+ * Forward messages from the ZeroMQ socket to the other side
+ */
+static void conn_forward_tx(struct shm_conn *conn)
+{
+    bool written = false;
+
+    if (conn->tx_pending) {
+        zmsg_t *msg = conn->tx_pending;
+        conn->tx_pending = NULL;
+        if (!conn_tx(conn, msg)) {
+            return;
+        }
+        written = true;
+
+        // resume reading from the socket
+        int zmq_rv = zloop_reader(conn->loop, conn->zsock, conn_zsock_rcv,
+                                  conn);
+        assert(zmq_rv == 0);
+        zloop_reader_set_tolerant(conn->loop, conn->zsock);
+    }
+
+    // The socket has a receive timeout of 0: read everything available.
+    zmsg_t *msg;
+    while ((msg = zmsg_recv(conn->zsock))) {
+        if (!conn_tx(conn, msg)) {
+            zloop_reader_end(conn->loop, conn->zsock);
+            break;
+        }
+        written = true;
+    }
+
+    if (written && shm_ring_consumer_needs_wakeup(conn->tx_ring)) {
+        conn_wake_peer(conn);
+    }
+}
+
+/**
+ * Forward messages from the other side to the ZeroMQ socket
+ *
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if the other side wrote a malformed message; the
+ *         connection must be closed
+ */
+static osd_result conn_forward_rx(struct shm_conn *conn)
+{
+    do {
+        zmsg_t *msg;
+        while ((msg = shm_ring_read(conn->rx_ring))) {
+            int zmq_rv = zmsg_send(&msg, conn->zsock);
+            if (zmq_rv != 0) {
+                err(conn->log_ctx, "Unable to forward message from shared "
+                    "memory ring, dropping it.");
+                zmsg_destroy(&msg);
+            }
+        }
+        if (shm_ring_is_corrupt(conn->rx_ring)) {
+            err(conn->log_ctx, "Malformed message in shared memory ring, "
+                "closing the connection.");
+            return OSD_ERROR_FAILURE;
+        }
+        if (shm_ring_producer_needs_wakeup(conn->rx_ring)) {
+            conn_wake_peer(conn);
+        }
+    } while (!shm_ring_consumer_sleep(conn->rx_ring));
+    return OSD_OK;
+}
+
+/**
+ * Close a connection from its event handlers
+ *
+ * On the host controller side the connection is freed, which the client
+ * notices as hangup. On the client side the connection is only stopped;
+ * requests to the host controller time out from then on.
+ */
+static void conn_close(struct shm_conn *conn)
+{
+    if (conn->listener) {
+        zlist_remove(conn->listener->conns, conn);
+        conn_free(&conn);
+    } else {
+        conn_stop(conn);
+    }
+}
+
+/**
+ * Event handler: the other side woke us up
+ */
+static int conn_wake_rcv(zloop_t *loop, zmq_pollitem_t *item, void *conn_void)
+{
+    struct shm_conn *conn = conn_void;
+
+    uint64_t count;
+    ssize_t rv = read(conn->wake_fd, &count, sizeof(count));
+    (void)rv;  // EAGAIN on spurious wakeups is fine
+
+    if (OSD_FAILED(conn_forward_rx(conn))) {
+        conn_close(conn);
+        return 0;
+    }
+    if (conn->tx_pending) {
+        conn_forward_tx(conn);
+    }
+    return 0;
+}
+
+/**
+ * Event handler: message from the ZeroMQ socket
+ */
+static int conn_zsock_rcv(zloop_t *loop, zsock_t *reader, void *conn_void)
+{
+    struct shm_conn *conn = conn_void;
+    conn_forward_tx(conn);
+    return 0;
+}
+
+/**
+ * Create the DEALER socket a connection is bridged into
+ *
+ * The socket must be bound or connected after this call: the options only
+ * apply to connections established afterwards.
+ */
+static zsock_t *conn_zsock_new(void)
+{
+    zsock_t *zsock = zsock_new(ZMQ_DEALER);
+    assert(zsock);
+
+    // Never block the event loop when forwarding messages: the ZeroMQ side
+    // of the bridge is only bounded by the flow control of the host protocol
+    // and the size of the rings.
+    zsock_set_rcvtimeo(zsock, 0);
+    zsock_set_sndtimeo(zsock, 0);
+    zsock_set_sndhwm(zsock, 0);
+
+    return zsock;
+}
+
+/**
+ * Start handling the connection in an event loop
+ *
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if the other side already wrote a malformed
+ *         message; the connection must be freed
+ */
+static osd_result conn_start(struct shm_conn *conn, zloop_t *loop,
+                       zloop_fn *sock_handler, void *sock_handler_arg)
+{
+    int zmq_rv;
+
+    conn->loop = loop;
+
+    zmq_pollitem_t wake_item = {.fd = conn->wake_fd, .events = ZMQ_POLLIN};
+    zmq_rv = zloop_poller(loop, &wake_item, conn_wake_rcv, conn);
+    assert(zmq_rv == 0);
+    zloop_poller_set_tolerant(loop, &wake_item);
+
+    zmq_pollitem_t sock_item = {.fd = conn->sock_fd, .events = ZMQ_POLLIN};
+    zmq_rv = zloop_poller(loop, &sock_item, sock_handler, sock_handler_arg);
+    assert(zmq_rv == 0);
+
+    zmq_rv = zloop_reader(loop, conn->zsock, conn_zsock_rcv, conn);
+    assert(zmq_rv == 0);
+    zloop_reader_set_tolerant(loop, conn->zsock);
+
+    // pick up everything the other side sent before we were ready
+    return conn_forward_rx(conn);
+}
+
+/**
+ * Has the other side closed the UNIX domain socket?
+ */
+static bool conn_sock_closed(struct shm_conn *conn)
+{
+    char buf;
+    ssize_t rv = recv(conn->sock_fd, &buf, sizeof(buf), MSG_DONTWAIT);
+    return rv == 0 || (rv == -1 && errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+/**
+ * Event handler (host controller side): the client closed the connection
+ */
+static int listener_conn_sock_rcv(zloop_t *loop, zmq_pollitem_t *item,
+                                  void *conn_void)
+{
+    struct shm_conn *conn = conn_void;
+
+    if (!conn_sock_closed(conn)) {
+        return 0;
+    }
+
+    dbg(conn->log_ctx, "Shared memory client disconnected.");
+    conn_close(conn);
+    return 0;
+}
+
+/**
+ * Event handler (host controller side): handshake with a new client
+ *
+ * The client sends its rings and its eventfd directly after connecting. The
+ * socket is non-blocking: a client which connects but doesn't send anything
+ * doesn't hold up the event loop.
+ */
+static int listener_handshake_rcv(zloop_t *loop, zmq_pollitem_t *item,
+                                  void *conn_void)
+{
+    struct shm_conn *conn = conn_void;
+    struct shm_listener *listener = conn->listener;
+    osd_result rv;
+
+    int fds[SHM_HANDSHAKE_CLIENT_FDS];
+    rv = recv_fds(conn->sock_fd, fds, SHM_HANDSHAKE_CLIENT_FDS);
+    if (rv == OSD_ERROR_TIMEDOUT) {
+        return 0;
+    }
+
+    // the connection is handled by conn_start() from now on
+    conn_stop(conn);
+
+    if (OSD_FAILED(rv)) {
+        err(listener->log_ctx, "Shared memory handshake failed.");
+        conn_close(conn);
+        return 0;
+    }
+    conn->peer_wake_fd = fds[2];
+    rv = shm_ring_map(&conn->rx_ring, fds[0]);
+    if (OSD_FAILED(rv)) {
+        close(fds[1]);
+        err(listener->log_ctx, "Invalid shared memory ring received.");
+        conn_close(conn);
+        return 0;
+    }
+    rv = shm_ring_map(&conn->tx_ring, fds[1]);
+    if (OSD_FAILED(rv)) {
+        err(listener->log_ctx, "Invalid shared memory ring received.");
+        conn_close(conn);
+        return 0;
+    }
+
+    conn->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    assert(conn->wake_fd != -1);
+    rv = send_fds(conn->sock_fd, &conn->wake_fd, 1);
+    if (OSD_FAILED(rv)) {
+        err(listener->log_ctx, "Shared memory handshake failed.");
+        conn_close(conn);
+        return 0;
+    }
+
+    conn->zsock = conn_zsock_new();
+    if (zsock_connect(conn->zsock, "%s", listener->router_endpoint) == -1) {
+        err(listener->log_ctx, "Unable to connect to %s",
+            listener->router_endpoint);
+        conn_close(conn);
+        return 0;
+    }
+
+    rv = conn_start(conn, listener->loop, listener_conn_sock_rcv, conn);
+    if (OSD_FAILED(rv)) {
+        conn_close(conn);
+        return 0;
+    }
+
+    dbg(listener->log_ctx, "Shared memory client connected.");
+    return 0;
+}
+
+/**
+ * Event handler (host controller side): accept a new connection
+ */
+static int listener_accept(zloop_t *loop, zmq_pollitem_t *item,
+                           void *listener_void)
+{
+    struct shm_listener *listener = listener_void;
+
+    int sock_fd = accept4(listener->listen_fd, NULL, NULL,
+                          SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (sock_fd == -1) {
+        err(listener->log_ctx, "Unable to accept shared memory client: %s",
+            strerror(errno));
+        return 0;
+    }
+
+    struct shm_conn *conn = conn_new(listener->log_ctx);
+    conn->sock_fd = sock_fd;
+    conn->listener = listener;
+    conn->loop = listener->loop;
+    conn->handshake = true;
+    zlist_append(listener->conns, conn);
+
+    zmq_pollitem_t sock_item = {.fd = sock_fd, .events = ZMQ_POLLIN};
+    int zmq_rv = zloop_poller(listener->loop, &sock_item,
+                              listener_handshake_rcv, conn);
+    assert(zmq_rv == 0);
+    return 0;
+}
+
+osd_result shm_listener_new(struct shm_listener **listener,
+                            struct osd_log_ctx *log_ctx, zloop_t *loop,
+                            const char *url, const char *router_endpoint)
+{
+    struct sockaddr_un addr;
+    osd_result rv = url_to_sockaddr(url, &addr);
+    if (OSD_FAILED(rv)) {
+        err(log_ctx, "Invalid shared memory URL %s", url);
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd == -1) {
+        err(log_ctx, "Unable to create socket: %s", strerror(errno));
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+
+    // a socket file left behind by a previous run would block the bind
+    unlink(addr.sun_path);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(listen_fd, SOMAXCONN) == -1) {
+        err(log_ctx, "Unable to listen on %s: %s", addr.sun_path,
+            strerror(errno));
+        close(listen_fd);
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+
+    struct shm_listener *l = calloc(1, sizeof(struct shm_listener));
+    assert(l);
+    l->log_ctx = log_ctx;
+    l->loop = loop;
+    l->path = strdup(addr.sun_path);
+    l->router_endpoint = strdup(router_endpoint);
+    l->listen_fd = listen_fd;
+    l->conns = zlist_new();
+    assert(l->conns);
+
+    zmq_pollitem_t item = {.fd = listen_fd, .events = ZMQ_POLLIN};
+    int zmq_rv = zloop_poller(loop, &item, listener_accept, l);
+    assert(zmq_rv == 0);
+    zloop_poller_set_tolerant(loop, &item);
+
+    *listener = l;
+    return OSD_OK;
+}
+
+void shm_listener_free(struct shm_listener **listener_p)
+{
+    assert(listener_p);
+    struct shm_listener *listener = *listener_p;
+    if (!listener) {
+        return;
+    }
+
+    zmq_pollitem_t item = {.fd = listener->listen_fd, .events = ZMQ_POLLIN};
+    zloop_poller_end(listener->loop, &item);
+    close(listener->listen_fd);
+    unlink(listener->path);
+
+    struct shm_conn *conn;
+    while ((conn = zlist_pop(listener->conns))) {
+        conn_free(&conn);
+    }
+    zlist_destroy(&listener->conns);
+
+    free(listener->path);
+    free(listener->router_endpoint);
+    free(listener);
+    *listener_p = NULL;
+}
+
+/**
+ * Event handler (client side): the host controller closed the connection
+ */
+static int client_conn_sock_rcv(zloop_t *loop, zmq_pollitem_t *item,
+                                void *conn_void)
+{
+    struct shm_conn *conn = conn_void;
+
+    if (!conn_sock_closed(conn)) {
+        return 0;
+    }
+
+    // Requests to the host controller will time out from now on.
+    err(conn->log_ctx, "Shared memory connection to host controller lost.");
+    conn_stop(conn);
+    return 0;
+}
+
+/**
+ * Establish the connection to the host controller (client side)
+ */
+static osd_result client_connect(struct shm_conn *conn, const char *url)
+{
+    osd_result rv;
+
+    struct sockaddr_un addr;
+    rv = url_to_sockaddr(url, &addr);
+    if (OSD_FAILED(rv)) {
+        err(conn->log_ctx, "Invalid shared memory URL %s", url);
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+
+    conn->sock_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (conn->sock_fd == -1) {
+        err(conn->log_ctx, "Unable to create socket: %s", strerror(errno));
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+    if (connect(conn->sock_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        err(conn->log_ctx, "Unable to connect to %s: %s", addr.sun_path,
+            strerror(errno));
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+    set_sock_timeout(conn->sock_fd);
+
+    rv = shm_ring_new(&conn->tx_ring, SHM_RING_SIZE);
+    if (OSD_FAILED(rv)) {
+        err(conn->log_ctx, "Unable to create shared memory ring: %s",
+            strerror(errno));
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+    rv = shm_ring_new(&conn->rx_ring, SHM_RING_SIZE);
+    if (OSD_FAILED(rv)) {
+        err(conn->log_ctx, "Unable to create shared memory ring: %s",
+            strerror(errno));
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+    conn->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    assert(conn->wake_fd != -1);
+
+    int fds[SHM_HANDSHAKE_CLIENT_FDS] = {shm_ring_get_fd(conn->tx_ring),
+                                         shm_ring_get_fd(conn->rx_ring),
+                                         conn->wake_fd};
+    rv = send_fds(conn->sock_fd, fds, SHM_HANDSHAKE_CLIENT_FDS);
+    if (OSD_SUCCEEDED(rv)) {
+        rv = recv_fds(conn->sock_fd, &conn->peer_wake_fd, 1);
+    }
+    if (OSD_FAILED(rv)) {
+        err(conn->log_ctx, "Shared memory handshake with %s failed.",
+            addr.sun_path);
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+
+    return OSD_OK;
+}
+
+static osd_result client_thread_init(struct worker_thread_ctx *thread_ctx)
+{
+    struct shm_client_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    osd_result rv;
+
+    usrctx->conn = conn_new(thread_ctx->log_ctx);
+    rv = client_connect(usrctx->conn, usrctx->url);
+    if (OSD_FAILED(rv)) {
+        goto err_free;
+    }
+
+    usrctx->conn->zsock = conn_zsock_new();
+    if (zsock_bind(usrctx->conn->zsock, "%s", usrctx->endpoint) == -1) {
+        err(thread_ctx->log_ctx, "Unable to bind to %s", usrctx->endpoint);
+        rv = OSD_ERROR_FAILURE;
+        goto err_free;
+    }
+
+    rv = conn_start(usrctx->conn, thread_ctx->zloop, client_conn_sock_rcv,
+                    usrctx->conn);
+    if (OSD_FAILED(rv)) {
+        rv = OSD_ERROR_CONNECTION_FAILED;
+        goto err_free;
+    }
+    return OSD_OK;
+
+err_free:
+    // the worker does not call the destroy function if the init fails
+    conn_free(&usrctx->conn);
+    free(usrctx->url);
+    free(usrctx->endpoint);
+    free(usrctx);
+    thread_ctx->usr = NULL;
+    return rv;
+}
+
+static osd_result client_thread_destroy(struct worker_thread_ctx *thread_ctx)
+{
+    struct shm_client_usr_ctx *usrctx = thread_ctx->usr;
+    assert(usrctx);
+
+    conn_free(&usrctx->conn);
+    free(usrctx->url);
+    free(usrctx->endpoint);
+    free(usrctx);
+    thread_ctx->usr = NULL;
+
+    return OSD_OK;
+}
+
+osd_result shm_client_new(struct shm_client **client,
+                          struct osd_log_ctx *log_ctx, const char *url)
+{
+    osd_result rv;
+
+    struct shm_client *c = calloc(1, sizeof(struct shm_client));
+    assert(c);
+    snprintf(c->endpoint, sizeof(c->endpoint), "inproc://osd-shm-%p",
+             (void *)c);
+
+    struct shm_client_usr_ctx *usrctx =
+        calloc(1, sizeof(struct shm_client_usr_ctx));
+    assert(usrctx);
+    usrctx->url = strdup(url);
+    usrctx->endpoint = strdup(c->endpoint);
+
+    rv = worker_new(&c->worker, log_ctx, client_thread_init,
+                    client_thread_destroy, NULL, usrctx);
+    if (OSD_FAILED(rv)) {
+        free(c);
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+
+    *client = c;
+    return OSD_OK;
+}
+
+const char *shm_client_get_endpoint(struct shm_client *client)
+{
+    return client->endpoint;
+}
+
+void shm_client_free(struct shm_client **client_p)
+{
+    assert(client_p);
+    struct shm_client *client = *client_p;
+    if (!client) {
+        return;
+    }
+
+    worker_free(&client->worker);
+    free(client);
+    *client_p = NULL;
+}
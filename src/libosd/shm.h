@@ -0,0 +1,222 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SHM_H
+#define SHM_H
+
+#include <czmq.h>
+#include <osd/osd.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Shared-memory transport
+ *
+ * Components running on the same machine can talk to the host controller
+ * through shared memory instead of a ZeroMQ transport. The host controller
+ * address is then given as "shm://<path>", where <path> is the file system
+ * path of a UNIX domain socket, similar to ZeroMQ ipc:// addresses.
+ *
+ * The UNIX domain socket is only used to set up a connection: the client
+ * creates two single-producer single-consumer ring buffers in memfd-backed
+ * shared memory (one per direction) and an eventfd for wakeups, and passes
+ * the file descriptors to the host controller, which answers with its own
+ * wakeup eventfd. All messages are then exchanged through the rings. The
+ * socket stays open for the lifetime of the connection to detect if the other
+ * side goes away.
+ *
+ * A side only writes the eventfd of the other side if it has announced in the
+ * ring header that it is about to sleep (waiting for data or for free space).
+ * Under load messages are passed without any system call.
+ *
+ * The transport is bridged into the ZeroMQ sockets the host controller and
+ * its clients use anyways:
+ *
+ * - The host controller binds its ROUTER socket additionally to an inproc
+ *   endpoint. Every shm:// connection is served by a DEALER socket connected
+ *   to this endpoint (see shm_listener_new()). The connections are handled
+ *   in the host controller I/O thread.
+ * - Clients connect their DEALER socket to an inproc endpoint served by a
+ *   connection thread (see shm_client_new()).
+ */
+
+/** URL scheme of the shared-memory transport */
+#define SHM_URL_SCHEME "shm://"
+
+/** Size of the data area of a ring buffer (bytes, power of two) */
+#define SHM_RING_SIZE (1024 * 1024)
+
+/**
+ * Single-producer single-consumer ring buffer in shared memory
+ *
+ * The ring transports ZeroMQ messages (including all frames). Both sides map
+ * the same memfd; the opaque struct only describes the local mapping.
+ */
+struct shm_ring;
+
+/**
+ * Shared-memory transport: host controller side
+ */
+struct shm_listener;
+
+/**
+ * Shared-memory transport: client side
+ */
+struct shm_client;
+
+/**
+ * Is @p url an address of the shared-memory transport?
+ */
+bool shm_is_url(const char *url);
+
+/**
+ * Create a new ring buffer in a new memfd
+ *
+ * The memfd is sealed against shrinking and growing.
+ *
+ * @param ring the ring buffer
+ * @param size size of the data area in bytes. Must be a power of two.
+ * @return OSD_OK on success, OSD_ERROR_FAILURE if the shared memory could
+ *         not be created
+ */
+osd_result shm_ring_new(struct shm_ring **ring, size_t size);
+
+/**
+ * Map a ring buffer created by shm_ring_new() (in this or another process)
+ *
+ * Memfds without the seals set by shm_ring_new() are rejected: the other
+ * side could otherwise truncate the memory while it is mapped.
+ *
+ * @param ring the ring buffer
+ * @param fd file descriptor of the memfd. The ring takes ownership of it.
+ * @return OSD_OK on success, OSD_ERROR_FAILURE if @p fd is not a valid ring
+ */
+osd_result shm_ring_map(struct shm_ring **ring, int fd);
+
+/**
+ * Unmap a ring buffer and close its file descriptor
+ */
+void shm_ring_free(struct shm_ring **ring_p);
+
+/**
+ * Get the file descriptor of the shared memory backing the ring
+ */
+int shm_ring_get_fd(struct shm_ring *ring);
+
+/**
+ * Write a message to the ring (producer side)
+ *
+ * @param ring the ring buffer
+ * @param msg the message. The message is copied into the ring; the caller
+ *            keeps ownership.
+ * @return OSD_OK if the message was written,
+ *         OSD_ERROR_COM if the ring is full (retry later),
+ *         OSD_ERROR_FAILURE if the message is too large for the ring
+ */
+osd_result shm_ring_write(struct shm_ring *ring, zmsg_t *msg);
+
+/**
+ * Read a message from the ring (consumer side)
+ *
+ * @return the message, or NULL if the ring is empty or corrupt (see
+ *         shm_ring_is_corrupt()). The caller takes ownership of the message.
+ */
+zmsg_t *shm_ring_read(struct shm_ring *ring);
+
+/**
+ * Consumer side: has the producer written a malformed record?
+ *
+ * Nothing is read from a corrupt ring any more; the connection using it
+ * must be closed.
+ */
+bool shm_ring_is_corrupt(struct shm_ring *ring);
+
+/**
+ * Consumer side: announce that the consumer is about to sleep
+ *
+ * @return true if the ring is still empty and the consumer can wait for a
+ *         wakeup, false if data arrived in the meantime
+ */
+bool shm_ring_consumer_sleep(struct shm_ring *ring);
+
+/**
+ * Producer side: announce that the producer waits for free space
+ *
+ * @return true if the ring is still full and the producer can wait for a
+ *         wakeup, false if space became available in the meantime
+ */
+bool shm_ring_producer_sleep(struct shm_ring *ring);
+
+/**
+ * Producer side: does the consumer need a wakeup after a write?
+ */
+bool shm_ring_consumer_needs_wakeup(struct shm_ring *ring);
+
+/**
+ * Consumer side: does the producer need a wakeup after a read?
+ */
+bool shm_ring_producer_needs_wakeup(struct shm_ring *ring);
+
+/**
+ * Accept shared-memory connections for a host controller
+ *
+ * @param listener the listener
+ * @param log_ctx the log context
+ * @param loop event loop of the host controller I/O thread. All connections
+ *             are handled in this loop.
+ * @param url shm:// URL to listen on
+ * @param router_endpoint endpoint of the host controller ROUTER socket the
+ *                        connections are forwarded to (an inproc endpoint)
+ * @return OSD_OK on success,
+ *         OSD_ERROR_CONNECTION_FAILED if the listening socket could not be
+ *         created
+ */
+osd_result shm_listener_new(struct shm_listener **listener,
+                            struct osd_log_ctx *log_ctx, zloop_t *loop,
+                            const char *url, const char *router_endpoint);
+
+/**
+ * Close all connections and stop listening
+ */
+void shm_listener_free(struct shm_listener **listener_p);
+
+/**
+ * Connect to a host controller through shared memory
+ *
+ * A connection thread is started which forwards all messages between the
+ * shared-memory rings and an inproc endpoint. Connect the DEALER socket
+ * talking to the host controller to the endpoint returned by
+ * shm_client_get_endpoint().
+ *
+ * @param client the client
+ * @param log_ctx the log context
+ * @param url shm:// URL of the host controller
+ * @return OSD_OK on success,
+ *         OSD_ERROR_CONNECTION_FAILED if no connection could be established
+ */
+osd_result shm_client_new(struct shm_client **client,
+                          struct osd_log_ctx *log_ctx, const char *url);
+
+/**
+ * Get the inproc endpoint to connect the DEALER socket to
+ */
+const char *shm_client_get_endpoint(struct shm_client *client);
+
+/**
+ * Close the connection
+ */
+void shm_client_free(struct shm_client **client_p);
+
+#endif  // SHM_H
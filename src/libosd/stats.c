@@ -0,0 +1,287 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "stats.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "osd-private.h"
+
+/** Maximum length of a metric name (including the terminating NUL) */
+#define STATS_NAME_MAX 64
+
+/**
+ * Cache line size: metrics are aligned to it to avoid false sharing between
+ * metrics updated by different threads
+ */
+#define STATS_CACHELINE 64
+
+enum stats_type { STATS_TYPE_COUNTER, STATS_TYPE_HIST };
+
+struct stats_entry {
+    /** Value of the metric, accessed from the owning thread */
+    union {
+        uint64_t counter;
+        struct stats_hist hist;
+    } value;
+
+    enum stats_type type;
+    char name[STATS_NAME_MAX];
+};
+
+struct stats_registry {
+    /** Protects the metric lists, not the values of the metrics */
+    pthread_mutex_t lock;
+
+    /** Metrics (struct stats_entry) in registration order */
+    zlist_t *entries;
+
+    /** Metrics by name */
+    zhash_t *entries_by_name;
+};
+
+struct stats_registry *stats_new(void)
+{
+    int rv;
+
+    struct stats_registry *reg = calloc(1, sizeof(struct stats_registry));
+    assert(reg);
+    rv = pthread_mutex_init(&reg->lock, NULL);
+    assert(rv == 0);
+    reg->entries = zlist_new();
+    assert(reg->entries);
+    reg->entries_by_name = zhash_new();
+    assert(reg->entries_by_name);
+
+    return reg;
+}
+
+void stats_free(struct stats_registry **reg_p)
+{
+    assert(reg_p);
+    struct stats_registry *reg = *reg_p;
+    if (!reg) {
+        return;
+    }
+
+    struct stats_entry *entry;
+    while ((entry = zlist_pop(reg->entries))) {
+        free(entry);
+    }
+    zlist_destroy(&reg->entries);
+    zhash_destroy(&reg->entries_by_name);
+    pthread_mutex_destroy(&reg->lock);
+
+    free(reg);
+    *reg_p = NULL;
+}
+
+/**
+ * Find a metric by name, or register it
+ */
+static struct stats_entry *stats_entry_get(struct stats_registry *reg,
+                                           enum stats_type type,
+                                           const char *fmt, va_list args)
+{
+    int rv;
+    char name[STATS_NAME_MAX];
+    vsnprintf(name, sizeof(name), fmt, args);
+
+    pthread_mutex_lock(&reg->lock);
+    struct stats_entry *entry = zhash_lookup(reg->entries_by_name, name);
+    if (!entry) {
+        rv = posix_memalign((void **)&entry, STATS_CACHELINE,
+                            sizeof(struct stats_entry));
+        assert(rv == 0);
+        memset(entry, 0, sizeof(struct stats_entry));
+        entry->type = type;
+        strcpy(entry->name, name);
+
+        rv = zhash_insert(reg->entries_by_name, name, entry);
+        assert(rv == 0);
+        rv = zlist_append(reg->entries, entry);
+        assert(rv == 0);
+    }
+    pthread_mutex_unlock(&reg->lock);
+
+    assert(entry->type == type && "Metric registered with a different type");
+    return entry;
+}
+
+uint64_t *stats_counter(struct stats_registry *reg, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    struct stats_entry *entry =
+        stats_entry_get(reg, STATS_TYPE_COUNTER, fmt, args);
+    va_end(args);
+    return &entry->value.counter;
+}
+
+struct stats_hist *stats_hist(struct stats_registry *reg, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    struct stats_entry *entry =
+        stats_entry_get(reg, STATS_TYPE_HIST, fmt, args);
+    va_end(args);
+    return &entry->value.hist;
+}
+
+static unsigned int stats_hist_bucket(uint64_t value)
+{
+    if (value == 0) {
+        return 0;
+    }
+    return 64 - __builtin_clzll(value);
+}
+
+void stats_hist_record(struct stats_hist *hist, uint64_t value)
+{
+    stats_counter_add(&hist->buckets[stats_hist_bucket(value)], 1);
+    stats_counter_add(&hist->sum, value);
+    if (value > stats_counter_get(&hist->max)) {
+        __atomic_store_n(&hist->max, value, __ATOMIC_RELAXED);
+    }
+    // count last: readers never see more values in the buckets than counted
+    __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELEASE);
+}
+
+uint64_t stats_hist_percentile(const struct stats_hist *hist,
+                               double percentile)
+{
+    uint64_t count = __atomic_load_n(&hist->count, __ATOMIC_ACQUIRE);
+    if (count == 0) {
+        return 0;
+    }
+
+    // rank of the percentile value, starting at 1
+    uint64_t rank = (uint64_t)(percentile / 100.0 * count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (unsigned int b = 0; b < STATS_HIST_BUCKETS; b++) {
+        seen += stats_counter_get(&hist->buckets[b]);
+        if (seen >= rank) {
+            if (b == 0) {
+                return 0;
+            }
+            uint64_t upper = (b == 64) ? UINT64_MAX : (1ULL << b) - 1;
+            // the bucket bound is not more precise than the maximum
+            uint64_t max = stats_counter_get(&hist->max);
+            return upper < max ? upper : max;
+        }
+    }
+    return stats_counter_get(&hist->max);
+}
+
+char *stats_dump(struct stats_registry *reg)
+{
+    char *buf = NULL;
+    size_t buf_size = 0;
+    FILE *f = open_memstream(&buf, &buf_size);
+    assert(f);
+
+    pthread_mutex_lock(&reg->lock);
+    struct stats_entry *entry;
+    for (entry = zlist_first(reg->entries); entry;
+         entry = zlist_next(reg->entries)) {
+        if (entry->type == STATS_TYPE_COUNTER) {
+            fprintf(f, "%s %" PRIu64 "\n", entry->name,
+                    stats_counter_get(&entry->value.counter));
+        } else {
+            const struct stats_hist *hist = &entry->value.hist;
+            fprintf(f, "%s.count %" PRIu64 "\n", entry->name,
+                    __atomic_load_n(&hist->count, __ATOMIC_ACQUIRE));
+            fprintf(f, "%s.sum %" PRIu64 "\n", entry->name,
+                    stats_counter_get(&hist->sum));
+            fprintf(f, "%s.p50 %" PRIu64 "\n", entry->name,
+                    stats_hist_percentile(hist, 50));
+            fprintf(f, "%s.p99 %" PRIu64 "\n", entry->name,
+                    stats_hist_percentile(hist, 99));
+            fprintf(f, "%s.max %" PRIu64 "\n", entry->name,
+                    stats_counter_get(&hist->max));
+        }
+    }
+    pthread_mutex_unlock(&reg->lock);
+
+    fclose(f);
+    return buf;
+}
+
+/**
+ * Handler: request on a stats endpoint received
+ */
+static int stats_endpoint_rcv(zloop_t *loop, zsock_t *reader, void *reg_void)
+{
+    struct stats_registry *reg = reg_void;
+    assert(reg);
+
+    char *request = zstr_recv(reader);
+    if (!request) {
+        return 0;
+    }
+
+    // a REP socket must answer every request
+    if (!strcmp(request, STATS_REQUEST)) {
+        char *text = stats_dump(reg);
+        zstr_send(reader, text);
+        free(text);
+    } else {
+        zstr_send(reader, "");
+    }
+    zstr_free(&request);
+
+    return 0;
+}
+
+osd_result stats_endpoint_bind(zloop_t *loop, struct stats_registry *reg,
+                               const char *endpoint, zsock_t **sock_p)
+{
+    int zmq_rv;
+
+    stats_endpoint_close(loop, sock_p);
+
+    zsock_t *sock = zsock_new(ZMQ_REP);
+    assert(sock);
+    zmq_rv = zsock_bind(sock, "%s", endpoint);
+    if (zmq_rv == -1) {
+        zsock_destroy(&sock);
+        return OSD_ERROR_CONNECTION_FAILED;
+    }
+
+    zmq_rv = zloop_reader(loop, sock, stats_endpoint_rcv, reg);
+    assert(zmq_rv == 0);
+    zloop_reader_set_tolerant(loop, sock);
+
+    *sock_p = sock;
+    return OSD_OK;
+}
+
+void stats_endpoint_close(zloop_t *loop, zsock_t **sock_p)
+{
+    if (!*sock_p) {
+        return;
+    }
+    zloop_reader_end(loop, *sock_p);
+    zsock_destroy(sock_p);
+}
@@ -0,0 +1,148 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <czmq.h>
+#include <osd/osd.h>
+#include <stdint.h>
+
+/**
+ * Statistics registry
+ *
+ * A registry holds named counters and histograms of a component (host
+ * controller, gateway or host module). Each metric is only ever updated by a
+ * single thread (the thread which owns it) using relaxed atomic operations;
+ * updating a metric therefore needs neither locks nor contended cache lines.
+ * Only registering a new metric and reading the registry (stats_dump())
+ * take a lock, which keeps the fast path free of it.
+ *
+ * Metrics are exported as text, one "<name> <value>" pair per line.
+ * Histograms are exported as the lines <name>.count, <name>.sum,
+ * <name>.p50, <name>.p99 and <name>.max. The text is served in response to a
+ * "STATS" request on a stats endpoint (see stats_endpoint_bind()) and, in
+ * the host controller, to the STATS management request.
+ */
+
+/** Request string to query a stats endpoint */
+#define STATS_REQUEST "STATS"
+
+/**
+ * Number of histogram buckets
+ *
+ * Bucket 0 counts the value 0, bucket i (i > 0) counts values in the range
+ * [2^(i-1), 2^i).
+ */
+#define STATS_HIST_BUCKETS 65
+
+/**
+ * Histogram with logarithmic buckets
+ */
+struct stats_hist {
+    /** Number of recorded values */
+    uint64_t count;
+    /** Sum of all recorded values */
+    uint64_t sum;
+    /** Largest recorded value */
+    uint64_t max;
+    /** Number of values per bucket */
+    uint64_t buckets[STATS_HIST_BUCKETS];
+};
+
+struct stats_registry;
+
+/**
+ * Create a new registry
+ */
+struct stats_registry *stats_new(void);
+
+/**
+ * Free a registry and all of its metrics
+ *
+ * No thread may update a metric of the registry any more.
+ */
+void stats_free(struct stats_registry **reg_p);
+
+/**
+ * Get a counter, registering it if it doesn't exist yet
+ *
+ * The counter stays valid until the registry is freed. Update it with
+ * stats_counter_add().
+ *
+ * @param fmt printf-style format of the counter name
+ */
+uint64_t *stats_counter(struct stats_registry *reg, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/**
+ * Get a histogram, registering it if it doesn't exist yet
+ *
+ * The histogram stays valid until the registry is freed.
+ *
+ * @param fmt printf-style format of the histogram name
+ */
+struct stats_hist *stats_hist(struct stats_registry *reg, const char *fmt,
+                              ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * Record a value in a histogram
+ *
+ * Only the thread owning the histogram may record values.
+ */
+void stats_hist_record(struct stats_hist *hist, uint64_t value);
+
+/**
+ * Estimate a percentile from a histogram
+ *
+ * @param percentile the percentile (0..100)
+ * @return the upper bound of the bucket containing the percentile, or 0 if
+ *         no values were recorded
+ */
+uint64_t stats_hist_percentile(const struct stats_hist *hist,
+                               double percentile);
+
+/**
+ * Export all metrics of a registry as text
+ *
+ * This function can be called from any thread.
+ *
+ * @return the metrics. Free the string with free() after use.
+ */
+char *stats_dump(struct stats_registry *reg);
+
+/**
+ * Bind a stats endpoint and serve it from a zloop
+ *
+ * The endpoint is a ZeroMQ REP socket which answers STATS_REQUEST with the
+ * output of stats_dump().
+ *
+ * @param loop the zloop to serve the endpoint from
+ * @param reg the registry to export
+ * @param endpoint ZeroMQ endpoint to bind to, e.g. ipc:///tmp/osd-stats
+ * @param[out] sock_p the endpoint socket. If an endpoint is already bound it
+ *                    is closed first.
+ * @return OSD_OK on success,
+ *         OSD_ERROR_CONNECTION_FAILED if binding to @p endpoint failed
+ */
+osd_result stats_endpoint_bind(zloop_t *loop, struct stats_registry *reg,
+                               const char *endpoint, zsock_t **sock_p);
+
+/**
+ * Close a stats endpoint bound with stats_endpoint_bind()
+ */
+void stats_endpoint_close(zloop_t *loop, zsock_t **sock_p);
+
+#endif  // STATS_H
@@ -0,0 +1,64 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tclass.h"
+
+#include <assert.h>
+#include <string.h>
+
+void tclass_sched_init(struct tclass_sched *sched, unsigned int control_weight)
+{
+    assert(sched);
+    sched->control_weight = control_weight;
+    sched->control_run = 0;
+}
+
+int tclass_sched_next(struct tclass_sched *sched, bool control_ready,
+                      bool bulk_ready)
+{
+    assert(sched);
+
+    if (!control_ready && !bulk_ready) {
+        return -1;
+    }
+
+    if (control_ready && bulk_ready &&
+        sched->control_weight != OSD_TCLASS_WEIGHT_STRICT &&
+        sched->control_run >= sched->control_weight) {
+        // the bulk class is due
+        control_ready = false;
+    }
+
+    if (control_ready) {
+        sched->control_run++;
+        return OSD_TCLASS_CONTROL;
+    }
+    sched->control_run = 0;
+    return OSD_TCLASS_BULK;
+}
+
+enum osd_traffic_class tclass_from_frame(const zframe_t *frame)
+{
+    if (!frame || zframe_size((zframe_t *)frame) < 3 * sizeof(uint16_t)) {
+        return OSD_TCLASS_BULK;
+    }
+
+    uint16_t flags;
+    memcpy(&flags, zframe_data((zframe_t *)frame) + 2 * sizeof(uint16_t),
+           sizeof(flags));
+    unsigned int type = (flags >> DP_HEADER_TYPE_SHIFT) & DP_HEADER_TYPE_MASK;
+
+    return type == OSD_PACKET_TYPE_REG ? OSD_TCLASS_CONTROL : OSD_TCLASS_BULK;
+}
@@ -0,0 +1,72 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TCLASS_H
+#define TCLASS_H
+
+#include <czmq.h>
+#include <osd/osd.h>
+#include <osd/packet.h>
+#include <stdbool.h>
+
+/**
+ * Traffic class scheduling
+ *
+ * Data messages are sorted into traffic classes (see enum
+ * osd_traffic_class). Wherever messages queue up, a scheduler decides which
+ * class is served next:
+ *
+ * - Strict priority (control weight OSD_TCLASS_WEIGHT_STRICT): control
+ *   messages are always served first.
+ * - Weighted: if both classes have messages waiting, up to control weight
+ *   control messages are served for every bulk message. A steady stream of
+ *   register accesses can therefore not starve trace data completely.
+ */
+
+/**
+ * Scheduler state
+ */
+struct tclass_sched {
+    /** Control messages served per bulk message, or OSD_TCLASS_WEIGHT_STRICT */
+    unsigned int control_weight;
+
+    /** Control messages served since the last bulk message */
+    unsigned int control_run;
+};
+
+/**
+ * Initialize a scheduler
+ */
+void tclass_sched_init(struct tclass_sched *sched, unsigned int control_weight);
+
+/**
+ * Pick the traffic class to serve next
+ *
+ * @param control_ready a control message is waiting and can be sent
+ * @param bulk_ready a bulk message is waiting and can be sent
+ * @return the traffic class to serve, or -1 if nothing is ready
+ */
+int tclass_sched_next(struct tclass_sched *sched, bool control_ready,
+                      bool bulk_ready);
+
+/**
+ * Get the traffic class of a DI packet stored in a frame
+ *
+ * The frame contains the packet data as in osd_packet.data_raw. Frames too
+ * short to hold a packet header are classified as bulk traffic.
+ */
+enum osd_traffic_class tclass_from_frame(const zframe_t *frame);
+
+#endif  // TCLASS_H
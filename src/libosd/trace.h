@@ -0,0 +1,82 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/**
+ * Static tracepoints
+ *
+ * Every hop a DI packet passes through is marked with a USDT probe (as
+ * defined by sys/sdt.h) in the provider "libosd". A probe compiles to a
+ * single nop instruction; it only costs anything while a tracer such as perf
+ * or bpftrace is attached to it. Probes are only built in if sys/sdt.h is
+ * available and USDT support is enabled (configure --enable-usdt, enabled by
+ * default if possible); otherwise the macros expand to nothing and their
+ * arguments are not evaluated.
+ *
+ * The probes are:
+ *
+ * - device_rx: gateway, packet read from the device
+ * - gateway_tx: gateway, packet about to be written to the device
+ * - router_ingress: host controller, packet received from a client
+ * - router_egress: host controller, packet sent to a client
+ * - hostmod_send: host module, packet sent to the host controller
+ * - hostmod_recv: host module, packet received from the host controller
+ * - event_dispatch: host module, EVENT packet about to be passed to the
+ *   event handler
+ *
+ * All probes have the same arguments, taken from the packet header:
+ *
+ * - arg0: destination DI address
+ * - arg1: source DI address
+ * - arg2: flags (type, type_sub)
+ * - arg3: size of the packet data in 16 bit words
+ *
+ * For example, the time a packet spends between two hops can be measured by
+ * matching on the addresses and flags of a packet in bpftrace.
+ */
+
+#ifdef USE_USDT
+#include <sys/sdt.h>
+
+/**
+ * Trace a packet given as raw data (osd_packet.data_raw)
+ */
+#define TRACE_PACKET(probe, data_raw, size_words)                             \
+    DTRACE_PROBE4(libosd, probe, (data_raw)[0], (data_raw)[1], (data_raw)[2], \
+                  (size_words))
+#else
+#define TRACE_PACKET(probe, data_raw, size_words) \
+    do {                                          \
+    } while (0)
+#endif
+
+/**
+ * Trace a packet in a zframe
+ *
+ * The frame must contain at least the packet header.
+ */
+#define TRACE_PACKET_FRAME(probe, frame)                           \
+    TRACE_PACKET(probe, (const uint16_t *)zframe_data(frame),      \
+                 zframe_size(frame) / sizeof(uint16_t))
+
+/**
+ * Trace a packet given as struct osd_packet
+ */
+#define TRACE_PACKET_PKG(probe, pkg) \
+    TRACE_PACKET(probe, (pkg)->data_raw, (pkg)->data_size_words)
+
+#endif  // TRACE_H
@@ -0,0 +1,245 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "trigger.h"
+#include "util.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Packet words a step can match: the header and the payload */
+#define STEP_WORDS_MAX (3 + TRIGGER_PAYLOAD_WORDS_MAX)
+
+/** Index of the header word with the type and subtype */
+#define WORD_FLAGS 2
+
+/**
+ * A step: packet word i matches if (word & mask[i]) == value[i]
+ */
+struct trigger_step {
+    uint16_t mask[STEP_WORDS_MAX];
+    uint16_t value[STEP_WORDS_MAX];
+
+    /** Number of words to compare (the packet has at least as many) */
+    unsigned int words;
+
+    /**
+     * Number of packets after the previous step within which this step
+     * must match, 0 for no limit
+     */
+    uint32_t within;
+};
+
+struct trigger {
+    struct trigger_step steps[TRIGGER_STEPS_MAX];
+    unsigned int steps_count;
+
+    /** The next step to match */
+    unsigned int state;
+
+    /** Packets since the previous step matched */
+    uint32_t since;
+};
+
+/**
+ * Add a condition on (a part of) a packet word to a step
+ *
+ * @return false if the condition contradicts a previous condition
+ */
+static bool step_add(struct trigger_step *step, unsigned int word,
+                     uint16_t mask, uint16_t value)
+{
+    assert(word < STEP_WORDS_MAX);
+    value &= mask;
+    uint16_t common = step->mask[word] & mask;
+    if ((step->value[word] & common) != (value & common)) {
+        return false;
+    }
+    step->mask[word] |= mask;
+    step->value[word] |= value;
+    if (word + 1 > step->words) {
+        step->words = word + 1;
+    }
+    return true;
+}
+
+/**
+ * Parse a condition of a step
+ */
+static bool parse_cond(struct trigger_step *step, char *cond)
+{
+    char *value_str = strchr(cond, '=');
+    if (!value_str) {
+        return false;
+    }
+    *value_str++ = '\0';
+
+    unsigned long value;
+    if (!strcmp(cond, "type")) {
+        if (!strcmp(value_str, "event")) {
+            value = OSD_PACKET_TYPE_EVENT;
+        } else if (!strcmp(value_str, "plain")) {
+            value = OSD_PACKET_TYPE_PLAIN;
+        } else if (!strcmp(value_str, "reg")) {
+            value = OSD_PACKET_TYPE_REG;
+        } else if (!util_parse_uint(value_str, DP_HEADER_TYPE_MASK, &value)) {
+            return false;
+        }
+        return step_add(step, WORD_FLAGS,
+                        DP_HEADER_TYPE_MASK << DP_HEADER_TYPE_SHIFT,
+                        value << DP_HEADER_TYPE_SHIFT);
+    } else if (!strcmp(cond, "type_sub")) {
+        if (!util_parse_uint(value_str, DP_HEADER_TYPE_SUB_MASK, &value)) {
+            return false;
+        }
+        return step_add(step, WORD_FLAGS,
+                        DP_HEADER_TYPE_SUB_MASK << DP_HEADER_TYPE_SUB_SHIFT,
+                        value << DP_HEADER_TYPE_SUB_SHIFT);
+    } else if (!strcmp(cond, "dest") || !strcmp(cond, "src")) {
+        uint16_t diaddr;
+        if (!util_parse_diaddr(value_str, &diaddr)) {
+            return false;
+        }
+        return step_add(step, cond[0] == 'd' ? 0 : 1, 0xffff, diaddr);
+    } else if (!strncmp(cond, "word", 4)) {
+        unsigned long word;
+        if (!util_parse_uint(cond + 4, TRIGGER_PAYLOAD_WORDS_MAX - 1, &word)) {
+            return false;
+        }
+        unsigned long mask = 0xffff;
+        char *mask_str = strchr(value_str, '/');
+        if (mask_str) {
+            *mask_str++ = '\0';
+            if (!util_parse_uint(mask_str, UINT16_MAX, &mask)) {
+                return false;
+            }
+        }
+        if (!util_parse_uint(value_str, UINT16_MAX, &value)) {
+            return false;
+        }
+        return step_add(step, 3 + word, mask, value);
+    }
+    return false;
+}
+
+osd_result trigger_new(struct trigger **t_p, const char *pattern)
+{
+    assert(pattern);
+
+    struct trigger *t = calloc(1, sizeof(struct trigger));
+    assert(t);
+
+    char *pattern_copy = strdup(pattern);
+    assert(pattern_copy);
+
+    // A step starts with the first condition after "then [within N]".
+    bool ok = true;
+    bool step_empty = true;
+    struct trigger_step *step = &t->steps[0];
+    t->steps_count = 1;
+    char *saveptr;
+    for (char *word = strtok_r(pattern_copy, " \t\r\n", &saveptr);
+         word && ok; word = strtok_r(NULL, " \t\r\n", &saveptr)) {
+        if (!strcmp(word, "then")) {
+            if (step_empty || t->steps_count == TRIGGER_STEPS_MAX) {
+                ok = false;
+                break;
+            }
+            step = &t->steps[t->steps_count++];
+            step_empty = true;
+        } else if (!strcmp(word, "within")) {
+            unsigned long within;
+            word = strtok_r(NULL, " \t\r\n", &saveptr);
+            if (!step_empty || step == &t->steps[0] || step->within ||
+                !word || !util_parse_uint(word, UINT32_MAX, &within) ||
+                within == 0) {
+                ok = false;
+                break;
+            }
+            step->within = within;
+        } else {
+            ok = parse_cond(step, word);
+            step_empty = false;
+        }
+    }
+    free(pattern_copy);
+
+    if (!ok || step_empty) {
+        free(t);
+        return OSD_ERROR_FAILURE;
+    }
+
+    *t_p = t;
+    return OSD_OK;
+}
+
+void trigger_free(struct trigger **t_p)
+{
+    assert(t_p);
+    struct trigger *t = *t_p;
+    if (!t) {
+        return;
+    }
+
+    free(t);
+    *t_p = NULL;
+}
+
+static bool step_match(const struct trigger_step *step,
+                       const struct osd_packet *pkg)
+{
+    if (pkg->data_size_words < step->words) {
+        return false;
+    }
+    for (unsigned int i = 0; i < step->words; i++) {
+        if ((pkg->data_raw[i] & step->mask[i]) != step->value[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool trigger_eval(struct trigger *t, const struct osd_packet *pkg)
+{
+    if (t->state > 0) {
+        t->since++;
+        uint32_t within = t->steps[t->state].within;
+        if (within && t->since > within) {
+            t->state = 0;
+        }
+    }
+
+    if (t->state > 0 && step_match(&t->steps[t->state], pkg)) {
+        t->state++;
+    } else if (step_match(&t->steps[0], pkg)) {
+        t->state = 1;
+    } else {
+        return false;
+    }
+    t->since = 0;
+
+    if (t->state == t->steps_count) {
+        t->state = 0;
+        return true;
+    }
+    return false;
+}
+
+void trigger_reset(struct trigger *t)
+{
+    t->state = 0;
+    t->since = 0;
+}
@@ -0,0 +1,92 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TRIGGER_H
+#define TRIGGER_H
+
+#include <osd/osd.h>
+#include <osd/packet.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Trace triggers: packet patterns matched by a state machine
+ *
+ * A trigger is a sequence of steps, each matching a single packet. The
+ * trigger fires once packets matching all steps were seen in order. Steps
+ * are separated by "then", optionally followed by "within <N>": the next
+ * step must match one of the N packets following the packet which matched
+ * the previous step. Otherwise the sequence starts over.
+ *
+ * A step consists of conditions separated by spaces, all of which must
+ * match:
+ *
+ * - "type=<event|plain|reg|N>": the packet type
+ * - "type_sub=<N>": the packet subtype
+ * - "src=<diaddr>", "dest=<diaddr>": the source or destination, given as
+ *   "<subnet>.<local>" or as a number
+ * - "word<I>=<V>[/<M>]": payload word I (0-7) is V (after applying the mask
+ *   M, if given)
+ *
+ * Example: an event of the module 1.5 with subtype 2, followed within 100
+ * packets by an event of the module 1.6 with the first payload word 0x42:
+ *
+ *     type=event src=1.5 type_sub=2 then within 100 type=event src=1.6
+ *     word0=0x42
+ *
+ * The steps are compiled into masks over the packet words, evaluating a
+ * step costs one compare per matched word. While a sequence is in progress,
+ * a packet matching the first step (but not the next) starts the sequence
+ * over, so that the window of the following step is as large as possible.
+ *
+ * The object is not locked.
+ */
+
+/** Maximum number of steps of a trigger */
+#define TRIGGER_STEPS_MAX 8
+
+/** Maximum number of payload words a step can match */
+#define TRIGGER_PAYLOAD_WORDS_MAX 8
+
+struct trigger;
+
+/**
+ * Compile a trigger
+ *
+ * @param pattern the pattern (see above)
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if the pattern is invalid
+ */
+osd_result trigger_new(struct trigger **t, const char *pattern);
+
+/**
+ * Free a trigger
+ */
+void trigger_free(struct trigger **t_p);
+
+/**
+ * Evaluate a trigger on the next packet of the stream
+ *
+ * @return true if the packet completed the pattern. The trigger starts over
+ *         with the next packet.
+ */
+bool trigger_eval(struct trigger *t, const struct osd_packet *pkg);
+
+/**
+ * Start over: forget a sequence in progress
+ */
+void trigger_reset(struct trigger *t);
+
+#endif  // TRIGGER_H
@@ -0,0 +1,246 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "uring.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+struct uring {
+    /** File descriptor of the ring */
+    int fd;
+
+    /** Mapping of the submission queue ring */
+    void *sq_ptr;
+    size_t sq_ptr_len;
+
+    /** Mapping of the completion queue ring (may be the same as sq_ptr) */
+    void *cq_ptr;
+    size_t cq_ptr_len;
+
+    /** Submission queue entries */
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+
+    /** Submission queue, shared with the kernel */
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_array;
+    unsigned int sq_mask;
+    unsigned int sq_entries;
+
+    /** Completion queue, shared with the kernel */
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    struct io_uring_cqe *cqes;
+    unsigned int cq_mask;
+
+    /** Entries queued since the last submission */
+    unsigned int sq_queued;
+};
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit,
+                              unsigned int min_complete, unsigned int flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                   NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned int opcode, void *arg,
+                                 unsigned int nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+osd_result uring_new(struct uring **ring, unsigned int entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    int fd = sys_io_uring_setup(entries, &p);
+    if (fd < 0) {
+        return OSD_ERROR_FAILURE;
+    }
+
+    struct uring *r = calloc(1, sizeof(struct uring));
+    assert(r);
+    r->fd = fd;
+
+    r->sq_ptr_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    r->cq_ptr_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_ptr_len > r->sq_ptr_len) {
+            r->sq_ptr_len = r->cq_ptr_len;
+        }
+        r->cq_ptr_len = r->sq_ptr_len;
+    }
+
+    r->sq_ptr = mmap(NULL, r->sq_ptr_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) {
+        goto err_close;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->cq_ptr = mmap(NULL, r->cq_ptr_len, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED) {
+            goto err_unmap_sq;
+        }
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        goto err_unmap_cq;
+    }
+
+    uint8_t *sq = r->sq_ptr;
+    r->sq_head = (unsigned int *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+    r->sq_array = (unsigned int *)(sq + p.sq_off.array);
+    r->sq_mask = *(unsigned int *)(sq + p.sq_off.ring_mask);
+    r->sq_entries = p.sq_entries;
+
+    uint8_t *cq = r->cq_ptr;
+    r->cq_head = (unsigned int *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->cq_mask = *(unsigned int *)(cq + p.cq_off.ring_mask);
+
+    *ring = r;
+    return OSD_OK;
+
+err_unmap_cq:
+    if (r->cq_ptr != r->sq_ptr) {
+        munmap(r->cq_ptr, r->cq_ptr_len);
+    }
+err_unmap_sq:
+    munmap(r->sq_ptr, r->sq_ptr_len);
+err_close:
+    close(fd);
+    free(r);
+    return OSD_ERROR_FAILURE;
+}
+
+void uring_free(struct uring **ring_p)
+{
+    assert(ring_p);
+    struct uring *r = *ring_p;
+    if (!r) {
+        return;
+    }
+
+    munmap(r->sqes, r->sqes_len);
+    if (r->cq_ptr != r->sq_ptr) {
+        munmap(r->cq_ptr, r->cq_ptr_len);
+    }
+    munmap(r->sq_ptr, r->sq_ptr_len);
+    close(r->fd);
+
+    free(r);
+    *ring_p = NULL;
+}
+
+osd_result uring_register_buffer(struct uring *ring, void *buf, size_t len)
+{
+    struct iovec iov = {.iov_base = buf, .iov_len = len};
+    if (sys_io_uring_register(ring->fd, IORING_REGISTER_BUFFERS, &iov, 1) <
+        0) {
+        return OSD_ERROR_FAILURE;
+    }
+    return OSD_OK;
+}
+
+osd_result uring_register_eventfd(struct uring *ring, int event_fd)
+{
+    if (sys_io_uring_register(ring->fd, IORING_REGISTER_EVENTFD, &event_fd,
+                              1) < 0) {
+        return OSD_ERROR_FAILURE;
+    }
+    return OSD_OK;
+}
+
+bool uring_prep_read(struct uring *ring, int fd, void *buf, unsigned int len,
+                     bool fixed, uint64_t user_data)
+{
+    // only we write the tail, the kernel moves the head
+    unsigned int tail = *ring->sq_tail;
+    unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head >= ring->sq_entries) {
+        return false;
+    }
+
+    unsigned int index = tail & ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = (uint64_t)-1;  // current file position, or a stream
+    sqe->buf_index = 0;
+    sqe->user_data = user_data;
+
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->sq_queued++;
+    return true;
+}
+
+int uring_submit(struct uring *ring)
+{
+    if (!ring->sq_queued) {
+        return 0;
+    }
+    int rv;
+    do {
+        rv = sys_io_uring_enter(ring->fd, ring->sq_queued, 0, 0);
+    } while (rv < 0 && errno == EINTR);
+    if (rv < 0) {
+        return -errno;
+    }
+    ring->sq_queued -= rv;
+    return rv;
+}
+
+bool uring_pop_completion(struct uring *ring, uint64_t *user_data,
+                          int32_t *res)
+{
+    // only we write the head, the kernel moves the tail
+    unsigned int head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
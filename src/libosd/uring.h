@@ -0,0 +1,108 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <osd/osd.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Minimal io_uring wrapper: reads into registered buffers
+ *
+ * The ring is set up with the io_uring system calls directly (no liburing).
+ * Reads are queued with uring_prep_read() and submitted together with
+ * uring_submit(), which costs one system call for all queued reads.
+ * Completions are taken from the completion queue without a system call;
+ * an eventfd registered with uring_register_eventfd() becomes readable
+ * whenever a read completes, which lets a zloop poll the ring.
+ *
+ * The object is not locked.
+ */
+
+struct uring;
+
+/**
+ * Set up a ring
+ *
+ * @param entries number of submission queue entries, i.e. the maximum number
+ *                of reads queued between two calls to uring_submit()
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if the kernel does not support io_uring (errno
+ *         is set)
+ */
+osd_result uring_new(struct uring **ring, unsigned int entries);
+
+/**
+ * Tear down a ring, cancelling all reads in flight
+ */
+void uring_free(struct uring **ring_p);
+
+/**
+ * Register a buffer all reads are done into
+ *
+ * Registering the buffer saves mapping it into the kernel for every read.
+ * Reads into a registered buffer are queued with @p fixed set in
+ * uring_prep_read().
+ *
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if the buffer could not be registered (e.g. due
+ *         to RLIMIT_MEMLOCK, errno is set)
+ */
+osd_result uring_register_buffer(struct uring *ring, void *buf, size_t len);
+
+/**
+ * Signal completions through an eventfd
+ *
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if the eventfd could not be registered
+ */
+osd_result uring_register_eventfd(struct uring *ring, int event_fd);
+
+/**
+ * Queue a read from the current position of a file
+ *
+ * @param fd the file to read from
+ * @param buf the buffer to read into (within the registered buffer if
+ *            @p fixed is set)
+ * @param len maximum number of bytes to read
+ * @param fixed is @p buf within the registered buffer?
+ * @param user_data value returned with the completion
+ * @return false if the submission queue is full
+ */
+bool uring_prep_read(struct uring *ring, int fd, void *buf, unsigned int len,
+                     bool fixed, uint64_t user_data);
+
+/**
+ * Submit all queued reads
+ *
+ * @return the number of submitted reads, or a negative errno value
+ */
+int uring_submit(struct uring *ring);
+
+/**
+ * Take the next completion from the completion queue
+ *
+ * @param[out] user_data the user_data of the completed read
+ * @param[out] res the result of the read: the number of bytes read, or a
+ *                 negative errno value
+ * @return false if no read has completed
+ */
+bool uring_pop_completion(struct uring *ring, uint64_t *user_data,
+                          int32_t *res);
+
+#endif  // URING_H
@@ -13,8 +13,13 @@
  * limitations under the License.
  */
 
+#include "util.h"
+
 #include <assert.h>
+#include <errno.h>
 #include <osd/osd.h>
+#include <stdlib.h>
+#include <string.h>
 #include "osd-private.h"
 
 static const struct osd_version osd_version_internal = {
@@ -62,3 +67,44 @@ unsigned int osd_diaddr_build(unsigned int subnet, unsigned int local_diaddr)
 
     return subnet << OSD_DIADDR_LOCAL_BITS | local_diaddr;
 }
+
+bool util_parse_uint(const char *str, unsigned long max, unsigned long *value)
+{
+    char *end;
+    errno = 0;
+    unsigned long v = strtoul(str, &end, 0);
+    if (errno || end == str || *end != '\0' || *str == '-' || v > max) {
+        return false;
+    }
+    *value = v;
+    return true;
+}
+
+bool util_parse_diaddr(const char *str, uint16_t *diaddr)
+{
+    unsigned long value;
+    const char *dot = strchr(str, '.');
+    if (!dot) {
+        if (!util_parse_uint(str, UINT16_MAX, &value)) {
+            return false;
+        }
+        *diaddr = value;
+        return true;
+    }
+
+    char subnet_str[8];
+    size_t len = dot - str;
+    if (len >= sizeof(subnet_str)) {
+        return false;
+    }
+    memcpy(subnet_str, str, len);
+    subnet_str[len] = '\0';
+
+    unsigned long subnet, local;
+    if (!util_parse_uint(subnet_str, OSD_DIADDR_SUBNET_MAX, &subnet) ||
+        !util_parse_uint(dot + 1, OSD_DIADDR_LOCAL_MAX, &local)) {
+        return false;
+    }
+    *diaddr = osd_diaddr_build(subnet, local);
+    return true;
+}
@@ -0,0 +1,41 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Parse an unsigned number (decimal, or hex with 0x prefix)
+ *
+ * @param str the string to parse, no other characters may follow the number
+ * @param max the largest valid value
+ * @param[out] value the parsed number
+ * @return true on success, false if @p str is not a number up to @p max
+ */
+bool util_parse_uint(const char *str, unsigned long max, unsigned long *value);
+
+/**
+ * Parse a DI address, either "<subnet>.<local>" or a number
+ *
+ * @param str the string to parse
+ * @param[out] diaddr the parsed address
+ * @return true on success, false if @p str is not a valid address
+ */
+bool util_parse_diaddr(const char *str, uint16_t *diaddr);
+
+#endif  // UTIL_H
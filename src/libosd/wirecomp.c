@@ -0,0 +1,351 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wirecomp.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Number of words at the start of a packet which are delta coded */
+#define DELTA_WORDS 8
+
+/** Number of sources the previous packet is remembered for */
+#define DELTA_SLOTS 64
+
+/** Position of the source address in the packet data */
+#define SRC_WORD 1
+
+/** Size of the LZ77 hash table (log2) */
+#define LZ_HASH_BITS 12
+
+/** Largest distance of a back reference (bytes) */
+#define LZ_MAX_OFFSET 0xffff
+
+/** Size of the header of the compressed stream (bytes) */
+#define HDR_SIZE 4
+
+/**
+ * State of the header delta coding
+ */
+struct delta_state {
+    /** Source address of the previous packet */
+    uint16_t prev_src;
+
+    /** First words of the previous packet of a source, by source address */
+    uint16_t prev[DELTA_SLOTS][DELTA_WORDS];
+};
+
+/**
+ * Delta code or decode one packet
+ *
+ * @param state the coding state, updated with the packet
+ * @param in the packet data (without length word)
+ * @param out the coded packet data, may be the same as @p in
+ * @param len packet size (words)
+ * @param encode true to encode, false to decode
+ */
+static void delta_packet(struct delta_state *state, const uint16_t *in,
+                         uint16_t *out, size_t len, bool encode)
+{
+    if (len <= SRC_WORD) {
+        memmove(out, in, len * sizeof(uint16_t));
+        return;
+    }
+
+    // the source is needed to find the previous packet: code it first
+    uint16_t src;
+    if (encode) {
+        src = in[SRC_WORD];
+        out[SRC_WORD] = src - state->prev_src;
+    } else {
+        src = in[SRC_WORD] + state->prev_src;
+        out[SRC_WORD] = src;
+    }
+    state->prev_src = src;
+
+    uint16_t *prev = state->prev[src % DELTA_SLOTS];
+    for (size_t i = 0; i < len && i < DELTA_WORDS; i++) {
+        if (i == SRC_WORD) {
+            continue;
+        }
+        uint16_t word;
+        if (encode) {
+            word = in[i];
+            out[i] = word - prev[i];
+        } else {
+            word = in[i] + prev[i];
+            out[i] = word;
+        }
+        prev[i] = word;
+    }
+    if (len > DELTA_WORDS && out != in) {
+        memcpy(out + DELTA_WORDS, in + DELTA_WORDS,
+               (len - DELTA_WORDS) * sizeof(uint16_t));
+    }
+}
+
+static uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static unsigned int lz_hash(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * Write a length which doesn't fit into a token nibble
+ */
+static uint8_t *lz_write_len(uint8_t *out, size_t len)
+{
+    while (len >= 255) {
+        *out++ = 255;
+        len -= 255;
+    }
+    *out++ = len;
+    return out;
+}
+
+/**
+ * Write a sequence: a literal run followed by a back reference
+ *
+ * @param match_len length of the back reference, 0 for the last sequence
+ */
+static uint8_t *lz_write_sequence(uint8_t *out, const uint8_t *literals,
+                                  size_t literals_len, size_t offset,
+                                  size_t match_len)
+{
+    uint8_t *token = out++;
+    *token = (literals_len < 15 ? literals_len : 15) << 4;
+    if (literals_len >= 15) {
+        out = lz_write_len(out, literals_len - 15);
+    }
+    memcpy(out, literals, literals_len);
+    out += literals_len;
+
+    if (!match_len) {
+        return out;
+    }
+
+    *out++ = offset & 0xff;
+    *out++ = offset >> 8;
+    size_t len = match_len - WIRECOMP_LZ_MIN_MATCH;
+    *token |= len < 15 ? len : 15;
+    if (len >= 15) {
+        out = lz_write_len(out, len - 15);
+    }
+    return out;
+}
+
+static size_t lz_encode(const uint8_t *in, size_t size, uint8_t *out)
+{
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0xff, sizeof(table));
+
+    uint8_t *out_start = out;
+    size_t anchor = 0;
+    size_t pos = 0;
+    while (pos + WIRECOMP_LZ_MIN_MATCH <= size) {
+        uint32_t v = read32(in + pos);
+        unsigned int h = lz_hash(v);
+        uint32_t ref = table[h];
+        table[h] = pos;
+
+        if (ref == UINT32_MAX || pos - ref > LZ_MAX_OFFSET ||
+            read32(in + ref) != v) {
+            pos++;
+            continue;
+        }
+
+        size_t match_len = WIRECOMP_LZ_MIN_MATCH;
+        while (pos + match_len < size &&
+               in[ref + match_len] == in[pos + match_len]) {
+            match_len++;
+        }
+        out = lz_write_sequence(out, in + anchor, pos - anchor, pos - ref,
+                                match_len);
+        pos += match_len;
+        anchor = pos;
+    }
+    out = lz_write_sequence(out, in + anchor, size - anchor, 0, 0);
+    return out - out_start;
+}
+
+/**
+ * Read a length continued after a token nibble
+ *
+ * @return false if the input ended
+ */
+static bool lz_read_len(const uint8_t **in, const uint8_t *in_end,
+                        size_t *len)
+{
+    uint8_t b;
+    do {
+        if (*in == in_end) {
+            return false;
+        }
+        b = *(*in)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+static osd_result lz_decode(const uint8_t *in, size_t size, uint8_t *out,
+                            size_t out_size)
+{
+    const uint8_t *in_end = in + size;
+    size_t pos = 0;
+
+    while (in < in_end) {
+        uint8_t token = *in++;
+
+        size_t literals_len = token >> 4;
+        if (literals_len == 15 && !lz_read_len(&in, in_end, &literals_len)) {
+            return OSD_ERROR_FAILURE;
+        }
+        if (literals_len > (size_t)(in_end - in) ||
+            literals_len > out_size - pos) {
+            return OSD_ERROR_FAILURE;
+        }
+        memcpy(out + pos, in, literals_len);
+        in += literals_len;
+        pos += literals_len;
+
+        if (in == in_end) {
+            break;  // last sequence
+        }
+
+        if (in_end - in < 2) {
+            return OSD_ERROR_FAILURE;
+        }
+        size_t offset = in[0] | in[1] << 8;
+        in += 2;
+        size_t match_len = token & 0xf;
+        if (match_len == 15 && !lz_read_len(&in, in_end, &match_len)) {
+            return OSD_ERROR_FAILURE;
+        }
+        match_len += WIRECOMP_LZ_MIN_MATCH;
+        if (offset == 0 || offset > pos || match_len > out_size - pos) {
+            return OSD_ERROR_FAILURE;
+        }
+        if (offset >= match_len) {
+            memcpy(out + pos, out + pos - offset, match_len);
+        } else {
+            // the reference overlaps the output: copy byte by byte
+            for (size_t i = 0; i < match_len; i++) {
+                out[pos + i] = out[pos - offset + i];
+            }
+        }
+        pos += match_len;
+    }
+
+    return pos == out_size ? OSD_OK : OSD_ERROR_FAILURE;
+}
+
+size_t wirecomp_bound(size_t size_words)
+{
+    size_t size = size_words * sizeof(uint16_t);
+    return HDR_SIZE + 1 + size + size / 255 + 1;
+}
+
+size_t wirecomp_encode(const uint16_t *dtds, size_t size_words, uint8_t *out)
+{
+    assert(size_words <= UINT32_MAX);
+
+    uint16_t *coded = malloc(size_words * sizeof(uint16_t) + 1);
+    assert(coded);
+
+    struct delta_state *state = calloc(1, sizeof(struct delta_state));
+    assert(state);
+    size_t pos = 0;
+    while (pos < size_words) {
+        size_t len = dtds[pos];
+        assert(pos + 1 + len <= size_words);
+        coded[pos] = len;
+        delta_packet(state, dtds + pos + 1, coded + pos + 1, len, true);
+        pos += 1 + len;
+    }
+    free(state);
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    for (size_t i = 0; i < size_words; i++) {
+        coded[i] = __builtin_bswap16(coded[i]);
+    }
+#endif
+
+    out[0] = size_words & 0xff;
+    out[1] = (size_words >> 8) & 0xff;
+    out[2] = (size_words >> 16) & 0xff;
+    out[3] = (size_words >> 24) & 0xff;
+    size_t size = HDR_SIZE + lz_encode((const uint8_t *)coded,
+                                       size_words * sizeof(uint16_t),
+                                       out + HDR_SIZE);
+    free(coded);
+    return size;
+}
+
+osd_result wirecomp_decode(const uint8_t *in, size_t size, uint16_t **dtds,
+                           size_t *size_words)
+{
+    if (size < HDR_SIZE) {
+        return OSD_ERROR_FAILURE;
+    }
+    size_t words = in[0] | in[1] << 8 | in[2] << 16 | (size_t)in[3] << 24;
+    if (words > WIRECOMP_DECODE_MAX_WORDS) {
+        return OSD_ERROR_FAILURE;
+    }
+
+    uint16_t *out = malloc(words * sizeof(uint16_t) + 1);
+    assert(out);
+    osd_result rv = lz_decode(in + HDR_SIZE, size - HDR_SIZE, (uint8_t *)out,
+                              words * sizeof(uint16_t));
+    if (OSD_FAILED(rv)) {
+        free(out);
+        return rv;
+    }
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    for (size_t i = 0; i < words; i++) {
+        out[i] = __builtin_bswap16(out[i]);
+    }
+#endif
+
+    struct delta_state *state = calloc(1, sizeof(struct delta_state));
+    assert(state);
+    size_t pos = 0;
+    while (pos < words) {
+        size_t len = out[pos];
+        if (pos + 1 + len > words) {
+            rv = OSD_ERROR_FAILURE;
+            break;
+        }
+        delta_packet(state, out + pos + 1, out + pos + 1, len, false);
+        pos += 1 + len;
+    }
+    free(state);
+    if (OSD_FAILED(rv)) {
+        free(out);
+        return rv;
+    }
+
+    *dtds = out;
+    *size_words = words;
+    return OSD_OK;
+}
@@ -0,0 +1,93 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WIRECOMP_H
+#define WIRECOMP_H
+
+#include <osd/osd.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Compression of DI packet streams on the wire
+ *
+ * A stream of DTDs (a length word followed by the packet data, see
+ * osd_gateway_set_packet_write_batch()) is compressed in two steps:
+ *
+ * 1. Header delta coding: the source address of a packet is coded as the
+ *    difference to the source of the previous packet. The destination, the
+ *    flags and the first payload words are coded as the difference to the
+ *    same word of the previous packet from the same source. Trace streams
+ *    repeat their headers and carry slowly changing timestamps, which turns
+ *    most of these words into zeros or small values.
+ * 2. LZ77 compression of the resulting bytes (a byte-oriented format in the
+ *    style of LZ4: literal runs and back references of at least
+ *    WIRECOMP_LZ_MIN_MATCH bytes within the last 64 kB).
+ *
+ * The compressed data is self-contained: every stream is coded
+ * independently, messages can be lost or reordered without affecting
+ * others. The encoded format is
+ *
+ * - uint32 (little endian): number of words in the uncompressed stream
+ * - the LZ77-compressed delta-coded stream, words in little endian
+ */
+
+/** Codec identifier, negotiated with PROTO_OP_COMPRESS */
+#define WIRECOMP_CODEC_DELTA_LZ 1
+
+/** Shortest back reference (bytes) */
+#define WIRECOMP_LZ_MIN_MATCH 4
+
+/**
+ * Largest uncompressed stream accepted by wirecomp_decode() (words)
+ *
+ * Bounds the memory a corrupted or malicious message can allocate.
+ */
+#define WIRECOMP_DECODE_MAX_WORDS (1024 * 1024)
+
+/**
+ * Get the maximum size of a compressed stream
+ *
+ * @param size_words number of words in the uncompressed stream
+ * @return the size of the buffer needed by wirecomp_encode() (bytes)
+ */
+size_t wirecomp_bound(size_t size_words);
+
+/**
+ * Compress a stream of DTDs
+ *
+ * @param dtds the stream of DTDs
+ * @param size_words number of words in @p dtds
+ * @param[out] out buffer for the compressed stream, at least
+ *                 wirecomp_bound(size_words) bytes
+ * @return the size of the compressed stream (bytes)
+ */
+size_t wirecomp_encode(const uint16_t *dtds, size_t size_words, uint8_t *out);
+
+/**
+ * Decompress a stream of DTDs
+ *
+ * @param in the compressed stream
+ * @param size size of @p in (bytes)
+ * @param[out] dtds the decompressed stream of DTDs. The caller must free()
+ *                  it.
+ * @param[out] size_words number of words in @p dtds
+ * @return OSD_OK on success,
+ *         OSD_ERROR_FAILURE if @p in isn't a valid compressed stream
+ */
+osd_result wirecomp_decode(const uint8_t *in, size_t size, uint16_t **dtds,
+                           size_t *size_words);
+
+#endif  // WIRECOMP_H
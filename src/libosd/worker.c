@@ -213,12 +213,16 @@ osd_result worker_new(struct worker_ctx **ctx, struct osd_log_ctx *log_ctx,
 
     // wait for thread setup to be completed
     int retval;
-    worker_wait_for_status(c->inproc_socket, "I-THREADINIT-DONE", &retval);
+    osd_result osd_rv = worker_wait_for_status(
+        c->inproc_socket, "I-THREADINIT-DONE", &retval);
+    if (OSD_FAILED(osd_rv)) {
+        retval = osd_rv;
+    }
     if (OSD_FAILED(retval)) {
         pthread_join(c->thread, NULL);
         zsock_destroy(&c->inproc_socket);
         free(c);
-        return rv;
+        return retval;
     }
 
     *ctx = c;
@@ -21,27 +21,82 @@
 #define CLI_TOOL_SHORTDESC "Open SoC Debug device gateway"
 
 #include <osd/gateway_glip.h>
+#ifdef USE_IO_URING
+#include <osd/gateway_uring.h>
+#endif
 #include "../cli-util.h"
 
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
 /**
  * Default GLIP backend to be used when connecting to a device
  */
 #define GLIP_DEFAULT_BACKEND "tcp"
 
 /**
- * Subnet address of the device. Currently static and must be 0.
+ * Backend name selecting the native io_uring backend instead of GLIP
+ */
+#define URING_BACKEND "uring"
+
+/**
+ * Default TCP port of the io_uring backend (the data port of the GLIP TCP
+ * backend)
+ */
+#define URING_DEFAULT_PORT "23000"
+
+/**
+ * Subnet address of the device if no devices are configured in the
+ * configuration file
  */
 #define DEVICE_SUBNET_ADDRESS 0
 
 /**
- * GLIP library context
+ * Prefix of the sections in the configuration file describing a device
  */
-struct glip_ctx *glip_ctx;
+#define DEVICE_SECTION_PREFIX "device."
+
+/**
+ * A device served by the gateway
+ */
+struct device_cfg {
+    /** Subnet address of the device */
+    unsigned int subnet;
+
+    /** GLIP backend name */
+    const char *glip_backend;
+
+    /** GLIP backend options (option1=value1,option2=value2,...), or NULL */
+    const char *glip_backend_options;
+
+    /** Number of GLIP channels */
+    int channels;
+
+    /** Assignment of packets to channels ("dest" or "tclass") */
+    const char *stripe;
+
+    /** CPUs the threads of the device are pinned to */
+    unsigned int *cpus;
+
+    /** Number of entries in @p cpus (0: not pinned) */
+    size_t cpus_len;
+
+    /** Growth of the resident memory while adding the device (bytes) */
+    size_t rss_bytes;
+};
 
 // command line arguments
 struct arg_str *a_glip_backend;
 struct arg_str *a_glip_backend_options;
 struct arg_str *a_hostctrl_ep;
+struct arg_int *a_control_weight;
+struct arg_str *a_stats_ep;
+struct arg_int *a_channels;
+struct arg_str *a_stripe;
+struct arg_lit *a_compress;
+struct arg_str *a_rx_filter;
 
 osd_result setup(void)
 {
@@ -52,7 +107,9 @@ osd_result setup(void)
     osd_tool_add_arg(a_hostctrl_ep);
 
     a_glip_backend =
-        arg_str0("b", "glip-backend", "<name>", "GLIP backend name");
+        arg_str0("b", "glip-backend", "<name>",
+                 "GLIP backend name, or \"" URING_BACKEND "\" for the "
+                 "native io_uring backend (TCP or character device)");
     a_glip_backend->sval[0] = GLIP_DEFAULT_BACKEND;
     osd_tool_add_arg(a_glip_backend);
 
@@ -61,9 +118,436 @@ osd_result setup(void)
                  "<option1=value1,option2=value2,...>", "GLIP backend options");
     osd_tool_add_arg(a_glip_backend_options);
 
+    a_control_weight =
+        arg_int0(NULL, "control-weight", "<N>",
+                 "forward up to N register access packets for every trace "
+                 "packet (default: 0, always prefer register accesses)");
+    a_control_weight->ival[0] = OSD_TCLASS_WEIGHT_STRICT;
+    osd_tool_add_arg(a_control_weight);
+
+    a_stats_ep = arg_str0(NULL, "stats-endpoint", "<URL>",
+                          "ZeroMQ endpoint to serve statistics on (see "
+                          "osd-top)");
+    osd_tool_add_arg(a_stats_ep);
+
+    a_channels = arg_int0(NULL, "channels", "<N>",
+                          "number of GLIP channels to use in parallel "
+                          "(default: 1)");
+    a_channels->ival[0] = 1;
+    osd_tool_add_arg(a_channels);
+
+    a_stripe = arg_str0(NULL, "stripe", "<dest|tclass>",
+                        "assign packets to channels by destination module, "
+                        "or register accesses to channel 0 and all other "
+                        "packets by destination module to the remaining "
+                        "channels (default: dest)");
+    a_stripe->sval[0] = "dest";
+    osd_tool_add_arg(a_stripe);
+
+    a_compress = arg_lit0(NULL, "compress",
+                          "compress trace data sent to the host controller "
+                          "(for remote host controllers)");
+    osd_tool_add_arg(a_compress);
+
+    a_rx_filter = arg_str0(NULL, "rx-filter", "<rules>",
+                           "drop, sample or aggregate trace packets before "
+                           "sending them to the host controller, e.g. "
+                           "\"drop src=1.5; aggregate 1000\"");
+    osd_tool_add_arg(a_rx_filter);
+
+    return OSD_OK;
+}
+
+/**
+ * Parse a list of CPUs, e.g. "0-3,6"
+ */
+static osd_result parse_cpus(const char *str, unsigned int **cpus,
+                             size_t *cpus_len)
+{
+    *cpus = NULL;
+    *cpus_len = 0;
+
+    const char *pos = str;
+    while (*pos) {
+        char *end;
+        unsigned long first = strtoul(pos, &end, 10);
+        unsigned long last = first;
+        if (end == pos) {
+            return OSD_ERROR_FAILURE;
+        }
+        if (*end == '-') {
+            pos = end + 1;
+            last = strtoul(pos, &end, 10);
+            if (end == pos || last < first) {
+                return OSD_ERROR_FAILURE;
+            }
+        }
+        for (unsigned long cpu = first; cpu <= last; cpu++) {
+            *cpus = realloc(*cpus, (*cpus_len + 1) * sizeof(unsigned int));
+            assert(*cpus);
+            (*cpus)[(*cpus_len)++] = cpu;
+        }
+        if (*end == ',') {
+            end++;
+        } else if (*end != '\0') {
+            return OSD_ERROR_FAILURE;
+        }
+        pos = end;
+    }
+    return OSD_OK;
+}
+
+/**
+ * Read the devices from the configuration file
+ *
+ * Every section [device.<name>] describes one device. The strings in
+ * @p devices point into @p ini.
+ */
+static osd_result read_device_cfgs(dictionary *ini,
+                                   struct device_cfg *devices,
+                                   unsigned int *devices_len)
+{
+    char key[128];
+    *devices_len = 0;
+
+    for (int i = 0; ini && i < iniparser_getnsec(ini); i++) {
+        const char *sec = iniparser_getsecname(ini, i);
+        if (strncmp(sec, DEVICE_SECTION_PREFIX,
+                    strlen(DEVICE_SECTION_PREFIX))) {
+            continue;
+        }
+        if (*devices_len > OSD_DIADDR_SUBNET_MAX) {
+            fatal("Too many devices configured.");
+            return OSD_ERROR_FAILURE;
+        }
+        struct device_cfg *dev = &devices[(*devices_len)++];
+        memset(dev, 0, sizeof(*dev));
+
+        snprintf(key, sizeof(key), "%s:subnet", sec);
+        int subnet = iniparser_getint(ini, key, -1);
+        if (subnet < 0 || subnet > OSD_DIADDR_SUBNET_MAX) {
+            fatal("Invalid or missing subnet of [%s].", sec);
+            return OSD_ERROR_FAILURE;
+        }
+        dev->subnet = subnet;
+
+        snprintf(key, sizeof(key), "%s:glip_backend", sec);
+        dev->glip_backend =
+            iniparser_getstring(ini, key, GLIP_DEFAULT_BACKEND);
+        if (!strcmp(dev->glip_backend, URING_BACKEND)) {
+            fatal("The %s backend serves a single device given on the "
+                  "command line, not in [%s].", URING_BACKEND, sec);
+            return OSD_ERROR_FAILURE;
+        }
+        snprintf(key, sizeof(key), "%s:glip_backend_options", sec);
+        dev->glip_backend_options = iniparser_getstring(ini, key, NULL);
+        snprintf(key, sizeof(key), "%s:channels", sec);
+        dev->channels = iniparser_getint(ini, key, 1);
+        snprintf(key, sizeof(key), "%s:stripe", sec);
+        dev->stripe = iniparser_getstring(ini, key, "dest");
+
+        snprintf(key, sizeof(key), "%s:cpus", sec);
+        const char *cpus = iniparser_getstring(ini, key, NULL);
+        if (cpus && OSD_FAILED(parse_cpus(cpus, &dev->cpus, &dev->cpus_len))) {
+            fatal("Invalid CPU list '%s' of [%s].", cpus, sec);
+            return OSD_ERROR_FAILURE;
+        }
+    }
+    return OSD_OK;
+}
+
+/**
+ * Get the resident memory of the process (bytes)
+ */
+static size_t rss_bytes(void)
+{
+    size_t pages_total, pages_resident;
+
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) {
+        return 0;
+    }
+    int rv = fscanf(f, "%zu %zu", &pages_total, &pages_resident);
+    fclose(f);
+    if (rv != 2) {
+        return 0;
+    }
+    return pages_resident * sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * Create the gateway for the first device, or add a further device to it
+ */
+static osd_result add_device(struct osd_gateway_glip_ctx **gateway_glip_ctx,
+                             struct osd_log_ctx *osd_log_ctx,
+                             struct device_cfg *dev)
+{
+    osd_result rv;
+
+    // GLIP options
+    struct glip_option *glip_backend_options;
+    size_t glip_backend_options_len;
+    rv = glip_parse_option_string(dev->glip_backend_options,
+                                  &glip_backend_options,
+                                  &glip_backend_options_len);
+    if (rv != 0) {
+        fatal("Unable to parse GLIP backend options of subnet %u.",
+              dev->subnet);
+        return OSD_ERROR_FAILURE;
+    }
+
+    size_t rss_before = rss_bytes();
+    if (!*gateway_glip_ctx) {
+        rv = osd_gateway_glip_new(gateway_glip_ctx, osd_log_ctx,
+                                  a_hostctrl_ep->sval[0], dev->subnet,
+                                  dev->glip_backend, glip_backend_options,
+                                  glip_backend_options_len);
+    } else {
+        rv = osd_gateway_glip_add_device(*gateway_glip_ctx, dev->subnet,
+                                         dev->glip_backend,
+                                         glip_backend_options,
+                                         glip_backend_options_len);
+    }
+    if (OSD_FAILED(rv)) {
+        fatal("Unable to create gateway for subnet %u.", dev->subnet);
+        return rv;
+    }
+    dev->rss_bytes = rss_bytes() - rss_before;
+
+    enum osd_gateway_glip_stripe stripe;
+    if (!strcmp(dev->stripe, "dest")) {
+        stripe = OSD_GATEWAY_GLIP_STRIPE_DEST;
+    } else if (!strcmp(dev->stripe, "tclass")) {
+        stripe = OSD_GATEWAY_GLIP_STRIPE_TCLASS;
+    } else {
+        fatal("Unknown channel assignment %s.", dev->stripe);
+        return OSD_ERROR_FAILURE;
+    }
+    if (dev->channels < 1) {
+        fatal("At least one GLIP channel is needed.");
+        return OSD_ERROR_FAILURE;
+    }
+    rv = osd_gateway_glip_set_device_channels(*gateway_glip_ctx, dev->subnet,
+                                              dev->channels, stripe);
+    if (OSD_FAILED(rv)) {
+        fatal("Unable to use %d GLIP channels.", dev->channels);
+        return rv;
+    }
+
+    if (dev->cpus_len) {
+        rv = osd_gateway_glip_set_device_cpus(*gateway_glip_ctx, dev->subnet,
+                                              dev->cpus, dev->cpus_len);
+        if (OSD_FAILED(rv)) {
+            fatal("Unable to pin the threads of subnet %u.", dev->subnet);
+            return rv;
+        }
+    }
     return OSD_OK;
 }
 
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Log the traffic of all channels and in total
+ */
+static void log_channel_stats(struct osd_gateway_glip_ctx *gateway_glip_ctx,
+                              uint64_t duration_ns)
+{
+    struct osd_gateway_glip_channel_stats total = {0};
+    double duration_s = duration_ns / 1e9;
+    unsigned int channels = osd_gateway_glip_get_channels(gateway_glip_ctx);
+
+    for (unsigned int i = 0; i < channels; i++) {
+        struct osd_gateway_glip_channel_stats stats;
+        osd_result rv =
+            osd_gateway_glip_get_channel_stats(gateway_glip_ctx, i, &stats);
+        assert(OSD_SUCCEEDED(rv));
+        info("Channel %u: RX %" PRIu64 " bytes (%.0f bytes/s), TX %" PRIu64
+             " bytes (%.0f bytes/s)",
+             i, stats.rx_bytes, stats.rx_bytes / duration_s, stats.tx_bytes,
+             stats.tx_bytes / duration_s);
+        total.rx_bytes += stats.rx_bytes;
+        total.tx_bytes += stats.tx_bytes;
+    }
+    info("Total: RX %" PRIu64 " bytes (%.0f bytes/s), TX %" PRIu64
+         " bytes (%.0f bytes/s)",
+         total.rx_bytes, total.rx_bytes / duration_s, total.tx_bytes,
+         total.tx_bytes / duration_s);
+}
+
+/**
+ * Log the traffic and the resource use of every device
+ */
+static void log_device_stats(struct osd_gateway_glip_ctx *gateway_glip_ctx,
+                             const struct device_cfg *devices,
+                             unsigned int devices_len, uint64_t duration_ns)
+{
+    double duration_s = duration_ns / 1e9;
+
+    for (unsigned int i = 0; i < devices_len; i++) {
+        struct osd_gateway_glip_device_stats stats;
+        osd_result rv = osd_gateway_glip_get_device_stats(
+            gateway_glip_ctx, devices[i].subnet, &stats);
+        assert(OSD_SUCCEEDED(rv));
+        info("Subnet %u: RX %" PRIu64 " bytes (%.0f bytes/s), TX %" PRIu64
+             " bytes (%.0f bytes/s), CPU %.2f s (%.1f %%), "
+             "memory %zu kB (buffers %zu kB)",
+             devices[i].subnet, stats.rx_bytes, stats.rx_bytes / duration_s,
+             stats.tx_bytes, stats.tx_bytes / duration_s, stats.cpu_ns / 1e9,
+             100.0 * stats.cpu_ns / duration_ns,
+             (devices[i].rss_bytes + stats.mem_bytes) / 1024,
+             stats.mem_bytes / 1024);
+    }
+}
+
+#ifdef USE_IO_URING
+/**
+ * Serve a device through the native io_uring backend
+ *
+ * The backend options (-o) are "hostname" and "port" to connect over TCP, or
+ * "device" (the path of a character device) and "baud", as well as "reads"
+ * and "read_size" to set the number and size of the reads.
+ */
+static int run_uring(struct osd_log_ctx *osd_log_ctx)
+{
+    osd_result rv;
+    int exitcode = 1;
+    struct osd_gateway_uring_ctx *gateway_uring_ctx = NULL;
+
+    struct glip_option *options;
+    size_t options_len;
+    rv = glip_parse_option_string(a_glip_backend_options->sval[0], &options,
+                                  &options_len);
+    if (rv != 0) {
+        fatal("Unable to parse backend options.");
+        return 1;
+    }
+    const char *hostname = "localhost";
+    const char *port = URING_DEFAULT_PORT;
+    const char *chardev = NULL;
+    unsigned long baud = 0, reads = 0, read_size = 0;
+    for (size_t i = 0; i < options_len; i++) {
+        const char *name = options[i].name;
+        const char *value = options[i].value;
+        if (!strcmp(name, "hostname")) {
+            hostname = value;
+        } else if (!strcmp(name, "port")) {
+            port = value;
+        } else if (!strcmp(name, "device")) {
+            chardev = value;
+        } else if (!strcmp(name, "baud")) {
+            baud = strtoul(value, NULL, 0);
+        } else if (!strcmp(name, "reads")) {
+            reads = strtoul(value, NULL, 0);
+        } else if (!strcmp(name, "read_size")) {
+            read_size = strtoul(value, NULL, 0);
+        } else {
+            fatal("Unknown backend option %s.", name);
+            return 1;
+        }
+    }
+
+    char device[256];
+    if (chardev) {
+        snprintf(device, sizeof(device), "%s", chardev);
+    } else {
+        snprintf(device, sizeof(device), "tcp://%s:%s", hostname, port);
+    }
+
+    rv = osd_gateway_uring_new(&gateway_uring_ctx, osd_log_ctx,
+                               a_hostctrl_ep->sval[0], DEVICE_SUBNET_ADDRESS,
+                               device);
+    if (OSD_FAILED(rv)) {
+        fatal("Unable to create gateway for %s.", device);
+        return 1;
+    }
+
+    if (reads || read_size) {
+        rv = osd_gateway_uring_set_reads(
+            gateway_uring_ctx,
+            reads ? reads : OSD_GATEWAY_URING_READS_DEFAULT,
+            read_size ? read_size : OSD_GATEWAY_URING_READ_SIZE_DEFAULT);
+        if (OSD_FAILED(rv)) {
+            fatal("Invalid number or size of reads.");
+            goto free_return;
+        }
+    }
+
+    rv = osd_gateway_uring_set_baudrate(gateway_uring_ctx, baud);
+    if (OSD_FAILED(rv)) {
+        fatal("Unsupported baud rate %lu.", baud);
+        goto free_return;
+    }
+
+    rv = osd_gateway_uring_set_tclass_weight(gateway_uring_ctx,
+                                             a_control_weight->ival[0]);
+    if (OSD_FAILED(rv)) {
+        fatal("Unable to set traffic class scheduling.");
+        goto free_return;
+    }
+
+    rv = osd_gateway_uring_set_compression(gateway_uring_ctx,
+                                           a_compress->count > 0);
+    if (OSD_FAILED(rv)) {
+        fatal("Unable to set compression.");
+        goto free_return;
+    }
+
+    if (a_rx_filter->count) {
+        rv = osd_gateway_uring_set_rx_filter(gateway_uring_ctx,
+                                             a_rx_filter->sval[0]);
+        if (OSD_FAILED(rv)) {
+            fatal("Invalid filter rules '%s'.", a_rx_filter->sval[0]);
+            goto free_return;
+        }
+    }
+
+    if (a_stats_ep->count) {
+        rv = osd_gateway_uring_set_stats_endpoint(gateway_uring_ctx,
+                                                  a_stats_ep->sval[0]);
+        if (OSD_FAILED(rv)) {
+            fatal("Unable to serve statistics on %s.", a_stats_ep->sval[0]);
+            goto free_return;
+        }
+    }
+
+    rv = osd_gateway_uring_connect(gateway_uring_ctx);
+    if (OSD_FAILED(rv)) {
+        fatal("Unable to connect to host controller and to device.");
+        goto free_return;
+    }
+
+    uint64_t start_ns = now_ns();
+    while (!zsys_interrupted) {
+        pause();
+    }
+    info("Shutdown signal received, cleaning up.");
+    double duration_s = (now_ns() - start_ns) / 1e9;
+
+    struct osd_gateway_uring_stats stats;
+    osd_gateway_uring_get_stats(gateway_uring_ctx, &stats);
+    info("RX %" PRIu64 " bytes (%.0f bytes/s) in %" PRIu64 " reads, %" PRIu64
+         " submissions, TX %" PRIu64 " bytes (%.0f bytes/s)",
+         stats.rx_bytes, stats.rx_bytes / duration_s, stats.reads,
+         stats.submits, stats.tx_bytes, stats.tx_bytes / duration_s);
+
+    rv = osd_gateway_uring_disconnect(gateway_uring_ctx);
+    if (OSD_FAILED(rv)) {
+        err("Unable to cleanly shut down gateway. (%d)", rv);
+    }
+
+    exitcode = 0;
+free_return:
+    osd_gateway_uring_free(&gateway_uring_ctx);
+    return exitcode;
+}
+#endif
+
 int run(void)
 {
     osd_result rv;
@@ -76,29 +560,88 @@ int run(void)
     rv = osd_log_new(&osd_log_ctx, cfg.log_level, &osd_log_handler);
     assert(OSD_SUCCEEDED(rv));
 
-    // GLIP options
-    struct glip_option *glip_backend_options;
-    size_t glip_backend_options_len;
-    rv = glip_parse_option_string(a_glip_backend_options->sval[0],
-                                  &glip_backend_options,
-                                  &glip_backend_options_len);
-    if (rv != 0) {
-        fatal("Unable to parse GLIP backend options.\n");
+    struct osd_gateway_glip_ctx *gateway_glip_ctx = NULL;
+    dictionary *ini = NULL;
+    struct device_cfg *devices =
+        calloc(OSD_DIADDR_SUBNET_MAX + 1, sizeof(struct device_cfg));
+    assert(devices);
+    unsigned int devices_len;
+
+    // Devices configured in the configuration file replace the device
+    // given on the command line
+    ini = iniparser_load(a_config_file->filename[0]);
+    rv = read_device_cfgs(ini, devices, &devices_len);
+    if (OSD_FAILED(rv)) {
+        exitcode = 1;
+        goto free_return;
+    }
+    if (devices_len == 0 && !strcmp(a_glip_backend->sval[0], URING_BACKEND)) {
+#ifdef USE_IO_URING
+        exitcode = run_uring(osd_log_ctx);
+#else
+        fatal("The %s backend is not available in this build.",
+              URING_BACKEND);
         exitcode = 1;
+#endif
         goto free_return;
     }
+    if (devices_len == 0) {
+        devices[0].subnet = DEVICE_SUBNET_ADDRESS;
+        devices[0].glip_backend = a_glip_backend->sval[0];
+        devices[0].glip_backend_options = a_glip_backend_options->sval[0];
+        devices[0].channels = a_channels->ival[0];
+        devices[0].stripe = a_stripe->sval[0];
+        devices_len = 1;
+    } else {
+        info("Serving %u devices configured in %s.", devices_len,
+             a_config_file->filename[0]);
+    }
 
-    struct osd_gateway_glip_ctx *gateway_glip_ctx;
-    rv = osd_gateway_glip_new(&gateway_glip_ctx, osd_log_ctx,
-                              a_hostctrl_ep->sval[0], DEVICE_SUBNET_ADDRESS,
-                              a_glip_backend->sval[0], glip_backend_options,
-                              glip_backend_options_len);
+    size_t rss_start = rss_bytes();
+    for (unsigned int i = 0; i < devices_len; i++) {
+        rv = add_device(&gateway_glip_ctx, osd_log_ctx, &devices[i]);
+        if (OSD_FAILED(rv)) {
+            exitcode = 1;
+            goto free_return;
+        }
+    }
+    assert(gateway_glip_ctx);
+
+    rv = osd_gateway_glip_set_tclass_weight(gateway_glip_ctx,
+                                            a_control_weight->ival[0]);
     if (OSD_FAILED(rv)) {
-        fatal("Unable to create gateway.");
+        fatal("Unable to set traffic class scheduling.");
+        exitcode = 1;
+        goto free_return;
+    }
+
+    rv = osd_gateway_glip_set_compression(gateway_glip_ctx,
+                                          a_compress->count > 0);
+    if (OSD_FAILED(rv)) {
+        fatal("Unable to set compression.");
         exitcode = 1;
         goto free_return;
     }
-    assert(gateway_glip_ctx);
+
+    if (a_rx_filter->count) {
+        rv = osd_gateway_glip_set_rx_filter(gateway_glip_ctx,
+                                            a_rx_filter->sval[0]);
+        if (OSD_FAILED(rv)) {
+            fatal("Invalid filter rules '%s'.", a_rx_filter->sval[0]);
+            exitcode = 1;
+            goto free_return;
+        }
+    }
+
+    if (a_stats_ep->count) {
+        rv = osd_gateway_glip_set_stats_endpoint(gateway_glip_ctx,
+                                                 a_stats_ep->sval[0]);
+        if (OSD_FAILED(rv)) {
+            fatal("Unable to serve statistics on %s.", a_stats_ep->sval[0]);
+            exitcode = 1;
+            goto free_return;
+        }
+    }
 
     rv = osd_gateway_glip_connect(gateway_glip_ctx);
     if (OSD_FAILED(rv)) {
@@ -107,10 +650,21 @@ int run(void)
         goto free_return;
     }
 
+    size_t rss_connected = rss_bytes();
+    info("Resident memory for %u device(s): %zu kB (%zu kB per device)",
+         devices_len, (rss_connected - rss_start) / 1024,
+         (rss_connected - rss_start) / devices_len / 1024);
+
+    uint64_t start_ns = now_ns();
     while (!zsys_interrupted) {
         pause();
     }
     info("Shutdown signal received, cleaning up.");
+    uint64_t duration_ns = now_ns() - start_ns;
+    if (devices_len == 1) {
+        log_channel_stats(gateway_glip_ctx, duration_ns);
+    }
+    log_device_stats(gateway_glip_ctx, devices, devices_len, duration_ns);
 
     rv = osd_gateway_glip_disconnect(gateway_glip_ctx);
     if (OSD_FAILED(rv)) {
@@ -120,6 +674,13 @@ int run(void)
     exitcode = 0;
 free_return:
     osd_gateway_glip_free(&gateway_glip_ctx);
+    for (unsigned int i = 0; i < OSD_DIADDR_SUBNET_MAX + 1; i++) {
+        free(devices[i].cpus);
+    }
+    free(devices);
+    if (ini) {
+        iniparser_freedict(ini);
+    }
     osd_log_free(&osd_log_ctx);
     return exitcode;
 }
@@ -0,0 +1,208 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Open SoC Debug device simulator
+ *
+ * Connects a simulated device (see osd/devicesim.h) through a gateway to a
+ * host controller. The simulated device can be used in place of real hardware
+ * to test and load-test the host software.
+ */
+
+#define CLI_TOOL_PROGNAME "osd-device-sim"
+#define CLI_TOOL_SHORTDESC "Open SoC Debug device simulator"
+
+#include <osd/devicesim.h>
+#include <osd/gateway.h>
+#include "../cli-util.h"
+
+#include <inttypes.h>
+
+// command line arguments
+struct arg_str *a_hostctrl_ep;
+struct arg_int *a_subnet;
+struct arg_int *a_mem_size;
+struct arg_int *a_stm_count;
+struct arg_int *a_ctm_count;
+struct arg_int *a_event_rate;
+struct arg_int *a_event_payload_min;
+struct arg_int *a_event_payload_max;
+struct arg_int *a_link_latency;
+struct arg_str *a_stats_ep;
+struct arg_lit *a_compress;
+
+osd_result setup(void)
+{
+    struct osd_devicesim_config defaults;
+    osd_devicesim_config_init(&defaults);
+
+    a_hostctrl_ep = arg_str0("e", "hostctrl", "<URL>",
+                             "ZeroMQ endpoint of the host controller "
+                             "(default: " DEFAULT_HOSTCTRL_EP ")");
+    a_hostctrl_ep->sval[0] = DEFAULT_HOSTCTRL_EP;
+    osd_tool_add_arg(a_hostctrl_ep);
+
+    a_subnet = arg_int0("s", "subnet", "<N>",
+                        "subnet address of the device (default: 0)");
+    a_subnet->ival[0] = 0;
+    osd_tool_add_arg(a_subnet);
+
+    a_mem_size = arg_int0(NULL, "mem-size", "<bytes>",
+                          "size of the memory behind the MAM, 0 for no MAM "
+                          "(default: 1048576)");
+    a_mem_size->ival[0] = defaults.mem_size;
+    osd_tool_add_arg(a_mem_size);
+
+    a_stm_count = arg_int0(NULL, "stm", "<N>",
+                           "number of System Trace Modules (default: 1)");
+    a_stm_count->ival[0] = defaults.stm_count;
+    osd_tool_add_arg(a_stm_count);
+
+    a_ctm_count = arg_int0(NULL, "ctm", "<N>",
+                           "number of Core Trace Modules (default: 1)");
+    a_ctm_count->ival[0] = defaults.ctm_count;
+    osd_tool_add_arg(a_ctm_count);
+
+    a_event_rate = arg_int0("r", "event-rate", "<N>",
+                            "EVENT packets per second of each active trace "
+                            "module (default: 10000)");
+    a_event_rate->ival[0] = defaults.event_rate;
+    osd_tool_add_arg(a_event_rate);
+
+    a_event_payload_min = arg_int0(NULL, "event-payload-min", "<words>",
+                                   "smallest EVENT payload (default: 1)");
+    a_event_payload_min->ival[0] = defaults.event_payload_min;
+    osd_tool_add_arg(a_event_payload_min);
+
+    a_event_payload_max = arg_int0(NULL, "event-payload-max", "<words>",
+                                   "largest EVENT payload (default: 8)");
+    a_event_payload_max->ival[0] = defaults.event_payload_max;
+    osd_tool_add_arg(a_event_payload_max);
+
+    a_link_latency = arg_int0("l", "link-latency", "<us>",
+                              "one-way latency between host and device "
+                              "(default: 0)");
+    a_link_latency->ival[0] = defaults.link_latency_us;
+    osd_tool_add_arg(a_link_latency);
+
+    a_stats_ep = arg_str0(NULL, "stats-endpoint", "<URL>",
+                          "ZeroMQ endpoint to serve gateway statistics on "
+                          "(see osd-top)");
+    osd_tool_add_arg(a_stats_ep);
+
+    a_compress = arg_lit0(NULL, "compress",
+                          "compress trace data sent to the host controller");
+    osd_tool_add_arg(a_compress);
+
+    return OSD_OK;
+}
+
+int run(void)
+{
+    osd_result rv;
+    int exitcode;
+    struct osd_log_ctx *osd_log_ctx = NULL;
+    struct osd_devicesim_ctx *devicesim_ctx = NULL;
+    struct osd_gateway_ctx *gateway_ctx = NULL;
+
+    zsys_init();
+
+    rv = osd_log_new(&osd_log_ctx, cfg.log_level, &osd_log_handler);
+    assert(OSD_SUCCEEDED(rv));
+
+    if (a_subnet->ival[0] < 0 || a_mem_size->ival[0] < 0 ||
+        a_stm_count->ival[0] < 0 || a_ctm_count->ival[0] < 0 ||
+        a_event_rate->ival[0] < 0 || a_event_payload_min->ival[0] < 0 ||
+        a_event_payload_max->ival[0] < 0 || a_link_latency->ival[0] < 0) {
+        fatal("Negative values are not allowed.");
+        exitcode = 1;
+        goto free_return;
+    }
+
+    struct osd_devicesim_config config;
+    osd_devicesim_config_init(&config);
+    config.subnet_addr = a_subnet->ival[0];
+    config.mem_size = a_mem_size->ival[0];
+    config.stm_count = a_stm_count->ival[0];
+    config.ctm_count = a_ctm_count->ival[0];
+    config.event_rate = a_event_rate->ival[0];
+    config.event_payload_min = a_event_payload_min->ival[0];
+    config.event_payload_max = a_event_payload_max->ival[0];
+    config.link_latency_us = a_link_latency->ival[0];
+
+    rv = osd_devicesim_new(&devicesim_ctx, osd_log_ctx, &config);
+    if (OSD_FAILED(rv)) {
+        fatal("Unable to create simulated device.");
+        exitcode = 1;
+        goto free_return;
+    }
+
+    rv = osd_gateway_new(&gateway_ctx, osd_log_ctx, a_hostctrl_ep->sval[0],
+                         config.subnet_addr, osd_devicesim_packet_read,
+                         osd_devicesim_packet_write, devicesim_ctx);
+    if (OSD_FAILED(rv)) {
+        fatal("Unable to create gateway.");
+        exitcode = 1;
+        goto free_return;
+    }
+
+    rv = osd_gateway_set_compression(gateway_ctx, a_compress->count > 0);
+    if (OSD_FAILED(rv)) {
+        fatal("Unable to set compression.");
+        exitcode = 1;
+        goto free_return;
+    }
+
+    if (a_stats_ep->count) {
+        rv = osd_gateway_set_stats_endpoint(gateway_ctx, a_stats_ep->sval[0]);
+        if (OSD_FAILED(rv)) {
+            fatal("Unable to serve statistics on %s.", a_stats_ep->sval[0]);
+            exitcode = 1;
+            goto free_return;
+        }
+    }
+
+    rv = osd_gateway_connect(gateway_ctx);
+    if (OSD_FAILED(rv)) {
+        fatal("Unable to connect to host controller at %s.",
+              a_hostctrl_ep->sval[0]);
+        exitcode = 1;
+        goto free_return;
+    }
+
+    while (!zsys_interrupted) {
+        pause();
+    }
+    info("Shutdown signal received, cleaning up.");
+
+    rv = osd_gateway_disconnect(gateway_ctx);
+    if (OSD_FAILED(rv)) {
+        err("Unable to cleanly shut down gateway. (%d)", rv);
+    }
+
+    struct osd_devicesim_stats stats;
+    osd_devicesim_get_stats(devicesim_ctx, &stats);
+    info("EVENT packets sent: %" PRIu64 ", dropped: %" PRIu64
+         "; register accesses: %" PRIu64 "; memory bytes transferred: %" PRIu64,
+         stats.events_sent, stats.events_dropped, stats.reg_accesses,
+         stats.mem_bytes);
+
+    exitcode = 0;
+free_return:
+    osd_gateway_free(&gateway_ctx);
+    osd_devicesim_free(&devicesim_ctx);
+    osd_log_free(&osd_log_ctx);
+    return exitcode;
+}
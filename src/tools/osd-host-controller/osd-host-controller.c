@@ -24,10 +24,31 @@
 #include <osd/packet.h>
 #include "../cli-util.h"
 
+#include <inttypes.h>
+#include <signal.h>
 #include <unistd.h>
 
 // command line arguments
 struct arg_str *a_bind_ep;
+struct arg_lit *a_lossy;
+struct arg_int *a_control_weight;
+struct arg_str *a_stats_ep;
+struct arg_file *a_capture;
+struct arg_file *a_flightrec;
+struct arg_int *a_flightrec_size;
+struct arg_lit *a_flightrec_on_error;
+struct arg_str *a_trigger;
+struct arg_int *a_trigger_pre;
+struct arg_int *a_trigger_post;
+struct arg_lit *a_overload_control;
+
+/** Flight recorder dump requested with SIGUSR1 */
+static volatile sig_atomic_t flightrec_dump_requested;
+
+static void sigusr1_handler(int signum)
+{
+    flightrec_dump_requested = 1;
+}
 
 osd_result setup(void)
 {
@@ -37,6 +58,69 @@ osd_result setup(void)
     a_bind_ep->sval[0] = DEFAULT_HOSTCTRL_BIND_EP;
     osd_tool_add_arg(a_bind_ep);
 
+    a_lossy = arg_lit0(NULL, "lossy",
+                       "drop the oldest queued packets if a receiver is too "
+                       "slow, instead of stalling the sender");
+    osd_tool_add_arg(a_lossy);
+
+    a_control_weight =
+        arg_int0(NULL, "control-weight", "<N>",
+                 "send up to N register access packets for every trace "
+                 "packet (default: 0, always prefer register accesses)");
+    a_control_weight->ival[0] = OSD_TCLASS_WEIGHT_STRICT;
+    osd_tool_add_arg(a_control_weight);
+
+    a_stats_ep = arg_str0(NULL, "stats-endpoint", "<URL>",
+                          "ZeroMQ endpoint to serve statistics on (see "
+                          "osd-top)");
+    osd_tool_add_arg(a_stats_ep);
+
+    a_capture = arg_file0(NULL, "capture", "<file>",
+                          "write all routed packets to a capture file (see "
+                          "osd-replay)");
+    osd_tool_add_arg(a_capture);
+
+    a_flightrec = arg_file0(NULL, "flightrec", "<file>",
+                            "keep the most recently routed packets in memory "
+                            "and dump them to <file>.<N> on SIGUSR1 or a "
+                            "FLIGHTREC_DUMP request");
+    osd_tool_add_arg(a_flightrec);
+
+    a_flightrec_size = arg_int0(NULL, "flightrec-size", "<MiB>",
+                                "memory used by the flight recorder "
+                                "(default: 16 MiB)");
+    a_flightrec_size->ival[0] = 16;
+    osd_tool_add_arg(a_flightrec_size);
+
+    a_flightrec_on_error = arg_lit0(NULL, "flightrec-on-error",
+                                    "with --flightrec: also dump the flight "
+                                    "recorder on failed register accesses");
+    osd_tool_add_arg(a_flightrec_on_error);
+
+    a_trigger = arg_strn(NULL, "trigger", "<pattern>", 0, 16,
+                         "with --flightrec: dump a window of the flight "
+                         "recorder around packets matching <pattern>, e.g. "
+                         "\"type=event src=1.5 then within 100 src=1.6 "
+                         "word0=0x42\"");
+    osd_tool_add_arg(a_trigger);
+
+    a_trigger_pre = arg_int0(NULL, "trigger-pre", "<N>",
+                             "packets up to a trigger to dump "
+                             "(default: 1000)");
+    a_trigger_pre->ival[0] = 1000;
+    osd_tool_add_arg(a_trigger_pre);
+
+    a_trigger_post = arg_int0(NULL, "trigger-post", "<N>",
+                              "packets after a trigger to dump "
+                              "(default: 1000)");
+    a_trigger_post->ival[0] = 1000;
+    osd_tool_add_arg(a_trigger_post);
+
+    a_overload_control = arg_lit0(NULL, "overload-control",
+                                  "stall the noisiest trace modules if the "
+                                  "host cannot keep up with the trace data");
+    osd_tool_add_arg(a_overload_control);
+
     return OSD_OK;
 }
 
@@ -45,6 +129,13 @@ int run(void)
     osd_result rv;
     int exitcode;
 
+    // the triggers dump the flight recorder
+    if (!a_flightrec->count &&
+        (a_flightrec_on_error->count || a_trigger->count)) {
+        fatal("--flightrec-on-error and --trigger require --flightrec.");
+        return 1;
+    }
+
     zsys_init();
 
     struct osd_log_ctx *osd_log_ctx;
@@ -59,6 +150,11 @@ int run(void)
         goto free_return;
     }
 
+    if (a_lossy->count) {
+        rv = osd_hostctrl_set_flowctrl_mode(hostctrl_ctx, OSD_FLOWCTRL_LOSSY);
+        assert(OSD_SUCCEEDED(rv));
+    }
+
     rv = osd_hostctrl_start(hostctrl_ctx);
     if (OSD_FAILED(rv)) {
         fatal("Unable to start host controller (%d)", rv);
@@ -66,13 +162,105 @@ int run(void)
         goto free_return;
     }
 
+    rv = osd_hostctrl_set_tclass_weight(hostctrl_ctx,
+                                        a_control_weight->ival[0]);
+    if (OSD_FAILED(rv)) {
+        fatal("Unable to set traffic class scheduling (%d)", rv);
+        exitcode = 1;
+        goto free_return;
+    }
+
+    if (a_stats_ep->count) {
+        rv = osd_hostctrl_set_stats_endpoint(hostctrl_ctx,
+                                             a_stats_ep->sval[0]);
+        if (OSD_FAILED(rv)) {
+            fatal("Unable to serve statistics on %s (%d)",
+                  a_stats_ep->sval[0], rv);
+            exitcode = 1;
+            goto free_return;
+        }
+    }
+
+    if (a_capture->count) {
+        rv = osd_hostctrl_set_capture(hostctrl_ctx, a_capture->filename[0]);
+        if (OSD_FAILED(rv)) {
+            fatal("Unable to capture to %s (%d)", a_capture->filename[0], rv);
+            exitcode = 1;
+            goto free_return;
+        }
+    }
+
+    if (a_flightrec->count) {
+        rv = osd_hostctrl_set_flightrec(
+            hostctrl_ctx, (size_t)a_flightrec_size->ival[0] * 1024 * 1024,
+            a_flightrec->filename[0]);
+        if (OSD_FAILED(rv)) {
+            fatal("Unable to set up the flight recorder (%d)", rv);
+            exitcode = 1;
+            goto free_return;
+        }
+        if (a_flightrec_on_error->count) {
+            osd_hostctrl_add_flightrec_trigger(
+                hostctrl_ctx, OSD_PACKET_TYPE_REG, RESP_READ_REG_ERROR);
+            osd_hostctrl_add_flightrec_trigger(
+                hostctrl_ctx, OSD_PACKET_TYPE_REG, RESP_WRITE_REG_ERROR);
+        }
+        for (int i = 0; i < a_trigger->count; i++) {
+            rv = osd_hostctrl_add_trace_trigger(
+                hostctrl_ctx, a_trigger->sval[i], a_trigger_pre->ival[0],
+                a_trigger_post->ival[0]);
+            if (OSD_FAILED(rv)) {
+                fatal("Unable to add trace trigger \"%s\" (%d)",
+                      a_trigger->sval[i], rv);
+                exitcode = 1;
+                goto free_return;
+            }
+        }
+        signal(SIGUSR1, sigusr1_handler);
+    }
+
+    if (a_overload_control->count) {
+        rv = osd_hostctrl_set_overload_control(hostctrl_ctx, true);
+        if (OSD_FAILED(rv)) {
+            fatal("Unable to enable the overload control (%d)", rv);
+            exitcode = 1;
+            goto free_return;
+        }
+    }
+
     info("Host controller up and running, listening at %s for connections",
          a_bind_ep->sval[0]);
     while (!zsys_interrupted) {
         pause();
+        if (flightrec_dump_requested) {
+            flightrec_dump_requested = 0;
+            osd_hostctrl_dump_flightrec(hostctrl_ctx);
+        }
     }
     info("Shutdown signal received, cleaning up.");
 
+    struct osd_flowctrl_stats flowctrl_stats;
+    osd_hostctrl_get_flowctrl_stats(hostctrl_ctx, &flowctrl_stats);
+    info("Flow control: %" PRIu64 " stalls (%" PRIu64 " us), %" PRIu64
+         " packets dropped",
+         flowctrl_stats.tx_stalls, flowctrl_stats.tx_stall_time_us,
+         flowctrl_stats.dropped);
+
+    struct osd_hostctrl_client_stats *client_stats;
+    size_t client_count;
+    rv = osd_hostctrl_get_client_stats(hostctrl_ctx, &client_stats,
+                                       &client_count);
+    if (OSD_SUCCEEDED(rv)) {
+        for (size_t i = 0; i < client_count; i++) {
+            struct osd_hostctrl_client_stats *c = &client_stats[i];
+            info("%s %u: %" PRIu64 " packets (%" PRIu64 " bytes) sent, %" PRIu64
+                 " packets to it dropped",
+                 c->is_gateway ? "Gateway for subnet" : "Host module",
+                 c->addr, c->packets, c->bytes, c->tx_dropped);
+        }
+        free(client_stats);
+    }
+
     rv = osd_hostctrl_stop(hostctrl_ctx);
     if (OSD_FAILED(rv)) {
         fatal("Unable to stop host controller (%d)", rv);
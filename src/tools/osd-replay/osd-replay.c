@@ -0,0 +1,242 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Open SoC Debug replay: inject captured traffic into a host controller
+ *
+ * Reads a capture file written by a host controller (osd-host-controller
+ * --capture) and sends all recorded packets to a host controller again,
+ * either with the original timing or as fast as possible. Replaying a capture
+ * flat out makes a reproducible throughput benchmark of the host components.
+ */
+
+#define CLI_TOOL_PROGNAME "osd-replay"
+#define CLI_TOOL_SHORTDESC "Replay traffic captured by a host controller"
+
+#include <osd/capture.h>
+#include <osd/hostmod.h>
+#include "../cli-util.h"
+
+#include <czmq.h>
+#include <inttypes.h>
+#include <time.h>
+
+// command line arguments
+struct arg_str *a_hostctrl_ep;
+struct arg_file *a_capture_file;
+struct arg_lit *a_flat_out;
+struct arg_int *a_loop;
+struct arg_lit *a_dump;
+
+osd_result setup(void)
+{
+    a_hostctrl_ep = arg_str0("e", "hostctrl", "<URL>",
+                             "ZeroMQ endpoint of the host controller "
+                             "(default: " DEFAULT_HOSTCTRL_EP ")");
+    a_hostctrl_ep->sval[0] = DEFAULT_HOSTCTRL_EP;
+    osd_tool_add_arg(a_hostctrl_ep);
+
+    a_capture_file = arg_file1(NULL, NULL, "<capture file>",
+                               "capture file to replay");
+    osd_tool_add_arg(a_capture_file);
+
+    a_flat_out = arg_lit0(NULL, "flat-out",
+                          "send packets as fast as possible instead of with "
+                          "the original timing");
+    osd_tool_add_arg(a_flat_out);
+
+    a_loop = arg_int0("n", "loop", "<N>",
+                      "replay the capture N times (default: 1)");
+    a_loop->ival[0] = 1;
+    osd_tool_add_arg(a_loop);
+
+    a_dump = arg_lit0(NULL, "dump",
+                      "print the records of the capture file instead of "
+                      "replaying them");
+    osd_tool_add_arg(a_dump);
+
+    return OSD_OK;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Sleep until @p deadline_ns (CLOCK_MONOTONIC)
+ */
+static void sleep_until(uint64_t deadline_ns)
+{
+    struct timespec ts = {
+        .tv_sec = deadline_ns / 1000000000ULL,
+        .tv_nsec = deadline_ns % 1000000000ULL,
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+        if (zsys_interrupted) {
+            return;
+        }
+    }
+}
+
+static void print_identity(const uint8_t *identity, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        printf("%02x", identity[i]);
+    }
+}
+
+/**
+ * Print all records of the capture
+ */
+static int dump(struct osd_capture_reader *reader)
+{
+    osd_result rv;
+    struct osd_capture_record record;
+
+    while (1) {
+        rv = osd_capture_reader_next(reader, &record);
+        if (OSD_FAILED(rv)) {
+            return 1;
+        }
+        if (!record.packet) {
+            return 0;
+        }
+
+        char *str;
+        osd_packet_to_string(record.packet, &str);
+        printf("%12" PRIu64 " ns  ", record.timestamp_ns);
+        print_identity(record.src_identity, record.src_identity_len);
+        printf(" -> ");
+        print_identity(record.dest_identity, record.dest_identity_len);
+        printf("\n%s\n", str);
+        free(str);
+        osd_packet_free(&record.packet);
+    }
+}
+
+/**
+ * Send all records of the capture once
+ *
+ * @return OSD_OK on success, any other value indicates an error
+ */
+static osd_result replay(struct osd_capture_reader *reader,
+                         struct osd_hostmod_ctx *hostmod_ctx,
+                         uint64_t *packets, uint64_t *bytes)
+{
+    osd_result rv;
+    struct osd_capture_record record;
+    uint64_t start_ns = now_ns();
+
+    while (!zsys_interrupted) {
+        rv = osd_capture_reader_next(reader, &record);
+        if (OSD_FAILED(rv)) {
+            return rv;
+        }
+        if (!record.packet) {
+            return OSD_OK;
+        }
+
+        if (!a_flat_out->count) {
+            sleep_until(start_ns + record.timestamp_ns);
+        }
+
+        rv = osd_hostmod_send_packet(hostmod_ctx, record.packet);
+        if (OSD_FAILED(rv)) {
+            err("Unable to send packet (%d)", rv);
+            osd_packet_free(&record.packet);
+            return rv;
+        }
+        (*packets)++;
+        *bytes += osd_packet_sizeof(record.packet);
+        osd_packet_free(&record.packet);
+    }
+    return OSD_OK;
+}
+
+int run(void)
+{
+    osd_result rv;
+    int exitcode;
+    struct osd_log_ctx *osd_log_ctx = NULL;
+    struct osd_capture_reader *reader = NULL;
+    struct osd_hostmod_ctx *hostmod_ctx = NULL;
+
+    zsys_init();
+
+    rv = osd_log_new(&osd_log_ctx, cfg.log_level, &osd_log_handler);
+    assert(OSD_SUCCEEDED(rv));
+
+    rv = osd_capture_reader_new(&reader, osd_log_ctx,
+                                a_capture_file->filename[0]);
+    if (OSD_FAILED(rv)) {
+        fatal("Unable to read capture file %s (%d)",
+              a_capture_file->filename[0], rv);
+        exitcode = 1;
+        goto free_return;
+    }
+
+    if (a_dump->count) {
+        exitcode = dump(reader);
+        goto free_return;
+    }
+
+    rv = osd_hostmod_new(&hostmod_ctx, osd_log_ctx, a_hostctrl_ep->sval[0],
+                         NULL, NULL);
+    if (OSD_FAILED(rv)) {
+        fatal("Unable to create host module (%d)", rv);
+        exitcode = 1;
+        goto free_return;
+    }
+    rv = osd_hostmod_connect(hostmod_ctx);
+    if (OSD_FAILED(rv)) {
+        fatal("Unable to connect to host controller at %s (%d)",
+              a_hostctrl_ep->sval[0], rv);
+        exitcode = 1;
+        goto free_return;
+    }
+
+    uint64_t packets = 0, bytes = 0;
+    uint64_t start_ns = now_ns();
+    exitcode = 0;
+    for (int i = 0; i < a_loop->ival[0] && !zsys_interrupted; i++) {
+        rv = osd_capture_reader_rewind(reader);
+        if (OSD_SUCCEEDED(rv)) {
+            rv = replay(reader, hostmod_ctx, &packets, &bytes);
+        }
+        if (OSD_FAILED(rv)) {
+            exitcode = 1;
+            break;
+        }
+    }
+    uint64_t duration_ns = now_ns() - start_ns;
+
+    if (duration_ns) {
+        info("Replayed %" PRIu64 " packets (%" PRIu64 " bytes) in %.3f s: "
+             "%.0f packets/s, %.0f bytes/s",
+             packets, bytes, duration_ns / 1e9, packets * 1e9 / duration_ns,
+             bytes * 1e9 / duration_ns);
+    }
+
+    osd_hostmod_disconnect(hostmod_ctx);
+
+free_return:
+    osd_hostmod_free(&hostmod_ctx);
+    osd_capture_reader_free(&reader);
+    osd_log_free(&osd_log_ctx);
+    return exitcode;
+}
@@ -0,0 +1,318 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Open SoC Debug top: live statistics of the host components
+ *
+ * Periodically queries the statistics of a host controller (using the STATS
+ * management request) and of any number of stats endpoints (see
+ * osd_hostctrl_set_stats_endpoint()), and shows the values together with
+ * their rates.
+ */
+
+#define CLI_TOOL_PROGNAME "osd-top"
+#define CLI_TOOL_SHORTDESC "Show live statistics of Open SoC Debug components"
+
+#include <czmq.h>
+#include "../cli-util.h"
+
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+
+/** Request string of the stats endpoints and the STATS management request */
+#define STATS_REQUEST "STATS"
+
+/** Maximum number of stats endpoints */
+#define ENDPOINTS_MAX 16
+
+/**
+ * Statistics of one component, as last queried
+ */
+struct source {
+    /** ZeroMQ endpoint */
+    const char *endpoint;
+
+    /** Is the source a host controller (instead of a stats endpoint)? */
+    bool is_hostctrl;
+
+    /** Socket to query the statistics with */
+    zsock_t *sock;
+
+    /** Values of the last query (name -> uint64_t *) */
+    zhash_t *values;
+
+    /** Time of the last query (ms) */
+    int64_t time_ms;
+};
+
+/**
+ * Rates of the metrics of a client or route (one row in the output)
+ */
+struct row {
+    uint64_t rx_packets;
+    uint64_t rx_bytes;
+    uint64_t tx_packets;
+    uint64_t tx_bytes;
+    uint64_t tx_dropped;
+};
+
+// command line arguments
+struct arg_str *a_hostctrl_ep;
+struct arg_str *a_stats_ep;
+struct arg_int *a_interval;
+struct arg_int *a_iterations;
+
+osd_result setup(void)
+{
+    a_hostctrl_ep = arg_str0("e", "hostctrl", "<URL>",
+                             "ZeroMQ endpoint of the host controller "
+                             "(default: " DEFAULT_HOSTCTRL_EP ")");
+    a_hostctrl_ep->sval[0] = DEFAULT_HOSTCTRL_EP;
+    osd_tool_add_arg(a_hostctrl_ep);
+
+    a_stats_ep = arg_strn("s", "stats-endpoint", "<URL>", 0, ENDPOINTS_MAX,
+                          "stats endpoint of a host controller, gateway or "
+                          "host module (can be given multiple times)");
+    osd_tool_add_arg(a_stats_ep);
+
+    a_interval = arg_int0("i", "interval", "<ms>",
+                          "update interval (default: 1000 ms)");
+    a_interval->ival[0] = 1000;
+    osd_tool_add_arg(a_interval);
+
+    a_iterations = arg_int0("n", "iterations", "<N>",
+                            "exit after N updates (default: 0, run until "
+                            "interrupted)");
+    a_iterations->ival[0] = 0;
+    osd_tool_add_arg(a_iterations);
+
+    return OSD_OK;
+}
+
+static void source_connect(struct source *src)
+{
+    zsock_destroy(&src->sock);
+    src->sock = zsock_new(src->is_hostctrl ? ZMQ_DEALER : ZMQ_REQ);
+    assert(src->sock);
+    zsock_set_rcvtimeo(src->sock, a_interval->ival[0]);
+    zsock_set_linger(src->sock, 0);
+    int rv = zsock_connect(src->sock, "%s", src->endpoint);
+    if (rv != 0) {
+        err("Unable to connect to %s", src->endpoint);
+    }
+}
+
+/**
+ * Query the statistics of a component
+ *
+ * @return the statistics text, or NULL if the component didn't respond
+ */
+static char *source_query(struct source *src)
+{
+    if (src->is_hostctrl) {
+        zstr_sendx(src->sock, "M", STATS_REQUEST, NULL);
+    } else {
+        zstr_send(src->sock, STATS_REQUEST);
+    }
+
+    zmsg_t *msg = zmsg_recv(src->sock);
+    if (!msg) {
+        // a REQ socket without answer cannot send any more
+        source_connect(src);
+        return NULL;
+    }
+    if (src->is_hostctrl) {
+        zframe_t *type_frame = zmsg_pop(msg);
+        zframe_destroy(&type_frame);
+    }
+    char *text = zmsg_popstr(msg);
+    zmsg_destroy(&msg);
+    return text;
+}
+
+/**
+ * Get the rate of change of a metric since the last query
+ */
+static uint64_t rate_per_sec(uint64_t prev, uint64_t cur, int64_t interval_ms)
+{
+    if (cur < prev || interval_ms <= 0) {
+        return 0;
+    }
+    return (cur - prev) * 1000 / interval_ms;
+}
+
+/**
+ * Is the metric name of the form "<kind>.<id>.<metric>" with a kind shown
+ * as table (clients, gateways and routes)?
+ */
+static bool is_row_metric(const char *name)
+{
+    return !strncmp(name, "client.", strlen("client.")) ||
+           !strncmp(name, "gateway.", strlen("gateway.")) ||
+           !strncmp(name, "route.", strlen("route."));
+}
+
+static void row_set(struct row *row, const char *metric, uint64_t rate)
+{
+    if (!strcmp(metric, "rx_packets") || !strcmp(metric, "packets")) {
+        row->rx_packets = rate;
+    } else if (!strcmp(metric, "rx_bytes") || !strcmp(metric, "bytes")) {
+        row->rx_bytes = rate;
+    } else if (!strcmp(metric, "tx_packets")) {
+        row->tx_packets = rate;
+    } else if (!strcmp(metric, "tx_bytes")) {
+        row->tx_bytes = rate;
+    } else if (!strcmp(metric, "tx_dropped")) {
+        row->tx_dropped = rate;
+    }
+}
+
+static void row_free(void *row)
+{
+    free(row);
+}
+
+/**
+ * Update the statistics of a component and print them
+ */
+static void source_update(struct source *src)
+{
+    char *text = source_query(src);
+    int64_t now_ms = zclock_mono();
+    int64_t interval_ms = now_ms - src->time_ms;
+
+    printf("%s%s\n", src->endpoint, text ? "" : " (not responding)");
+    if (!text) {
+        return;
+    }
+
+    zhash_t *values = zhash_new();
+    assert(values);
+    zhash_t *rows = zhash_new();
+    assert(rows);
+    zlist_t *row_names = zlist_new();
+    assert(row_names);
+
+    printf("  %-40s %20s %16s\n", "METRIC", "VALUE", "PER SECOND");
+    char *saveptr;
+    for (char *line = strtok_r(text, "\n", &saveptr); line;
+         line = strtok_r(NULL, "\n", &saveptr)) {
+        char name[128];
+        uint64_t value;
+        if (sscanf(line, "%127s %" SCNu64, name, &value) != 2) {
+            continue;
+        }
+
+        uint64_t *value_p = malloc(sizeof(uint64_t));
+        assert(value_p);
+        *value_p = value;
+        zhash_insert(values, name, value_p);
+        zhash_freefn(values, name, free);
+
+        uint64_t *prev = zhash_lookup(src->values, name);
+        uint64_t rate = prev ? rate_per_sec(*prev, value, interval_ms) : 0;
+
+        if (!is_row_metric(name)) {
+            printf("  %-40s %20" PRIu64 " %16" PRIu64 "\n", name, value, rate);
+            continue;
+        }
+
+        // group the metrics of a client or route into one row
+        char *metric = strrchr(name, '.');
+        *metric++ = '\0';
+        struct row *row = zhash_lookup(rows, name);
+        if (!row) {
+            row = calloc(1, sizeof(struct row));
+            assert(row);
+            zhash_insert(rows, name, row);
+            zhash_freefn(rows, name, row_free);
+            zlist_append(row_names, strdup(name));
+        }
+        row_set(row, metric, rate);
+    }
+
+    if (zlist_size(row_names)) {
+        printf("\n  %-20s %12s %14s %12s %14s %12s\n", "CLIENT/ROUTE",
+               "RX PKT/S", "RX BYTES/S", "TX PKT/S", "TX BYTES/S", "DROPS/S");
+        char *row_name;
+        while ((row_name = zlist_pop(row_names))) {
+            struct row *row = zhash_lookup(rows, row_name);
+            printf("  %-20s %12" PRIu64 " %14" PRIu64 " %12" PRIu64
+                   " %14" PRIu64 " %12" PRIu64 "\n",
+                   row_name, row->rx_packets, row->rx_bytes, row->tx_packets,
+                   row->tx_bytes, row->tx_dropped);
+            free(row_name);
+        }
+    }
+    printf("\n");
+
+    zlist_destroy(&row_names);
+    zhash_destroy(&rows);
+    zhash_destroy(&src->values);
+    src->values = values;
+    src->time_ms = now_ms;
+    free(text);
+}
+
+int run(void)
+{
+    zsys_init();
+
+    struct source sources[ENDPOINTS_MAX + 1];
+    size_t sources_len = 0;
+
+    // the host controller is queried unless only stats endpoints are given
+    if (a_hostctrl_ep->count || !a_stats_ep->count) {
+        sources[sources_len++] = (struct source){
+            .endpoint = a_hostctrl_ep->sval[0], .is_hostctrl = true,
+        };
+    }
+    for (int i = 0; i < a_stats_ep->count; i++) {
+        sources[sources_len++] = (struct source){
+            .endpoint = a_stats_ep->sval[i], .is_hostctrl = false,
+        };
+    }
+    for (size_t i = 0; i < sources_len; i++) {
+        sources[i].values = zhash_new();
+        assert(sources[i].values);
+        sources[i].time_ms = zclock_mono();
+        source_connect(&sources[i]);
+    }
+
+    bool is_tty = isatty(STDOUT_FILENO);
+    for (int iteration = 0; !zsys_interrupted; iteration++) {
+        if (a_iterations->ival[0] && iteration >= a_iterations->ival[0]) {
+            break;
+        }
+        zclock_sleep(a_interval->ival[0]);
+
+        if (is_tty) {
+            // clear screen, cursor to the top left
+            printf("\x1b[H\x1b[2J");
+        }
+        for (size_t i = 0; i < sources_len; i++) {
+            source_update(&sources[i]);
+        }
+        fflush(stdout);
+    }
+
+    for (size_t i = 0; i < sources_len; i++) {
+        zsock_destroy(&sources[i].sock);
+        zhash_destroy(&sources[i].values);
+    }
+
+    return 0;
+}
@@ -0,0 +1,236 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Benchmark: resource use of a gateway per attached device
+ *
+ * Several simulated devices stream trace packets to a host module. They are
+ * served either by one gateway per device, each with its own connection to
+ * the host controller, or by one gateway serving the subnets of all devices
+ * (see osd_gateway_add_subnet()). The threads, resident memory and CPU time
+ * per device are reported along with the throughput.
+ */
+
+#include "benchutil.h"
+
+#include <assert.h>
+#include <czmq.h>
+#include <osd/gateway.h>
+#include <osd/hostctrl.h>
+#include <osd/hostmod.h>
+#include <osd/osd.h>
+#include <osd/packet.h>
+#include <string.h>
+#include <unistd.h>
+
+#define HOSTCTRL_EP "tcp://127.0.0.1:9540"
+#define DEVICES 8
+#define FIRST_SUBNET 2
+#define TRACE_PACKETS_PER_DEVICE 50000
+#define TRACE_PAYLOAD_WORDS 8
+
+/** Simulated devices: trace packets still to be generated */
+static uint64_t device_trace_remaining[DEVICES];
+
+/** Destination of the trace data */
+static volatile uint16_t device_trace_dest;
+
+/** Number of trace packets received by the sink */
+static uint64_t trace_count;
+
+/** Device read next by a gateway serving all devices */
+static unsigned int shared_read_next;
+
+static osd_result trace_sink_handler(void *arg, struct osd_packet *pkg)
+{
+    __atomic_add_fetch(&trace_count, 1, __ATOMIC_RELAXED);
+    osd_packet_free(&pkg);
+    return OSD_OK;
+}
+
+static osd_result device_packet_write(const struct osd_packet *pkg,
+                                      void *cb_arg)
+{
+    return OSD_OK;
+}
+
+/**
+ * Generate a trace packet of a simulated device, if it has any left
+ */
+static bool device_trace_packet(unsigned int dev, struct osd_packet **pkg)
+{
+    uint64_t remaining =
+        __atomic_load_n(&device_trace_remaining[dev], __ATOMIC_RELAXED);
+    if (remaining == 0) {
+        return false;
+    }
+    __atomic_sub_fetch(&device_trace_remaining[dev], 1, __ATOMIC_RELAXED);
+
+    osd_result rv = osd_packet_new(
+        pkg, osd_packet_get_data_size_words_from_payload(TRACE_PAYLOAD_WORDS));
+    assert(OSD_SUCCEEDED(rv));
+    osd_packet_set_header(*pkg, device_trace_dest,
+                          osd_diaddr_build(FIRST_SUBNET + dev, 2),
+                          OSD_PACKET_TYPE_EVENT, 0);
+    return true;
+}
+
+/**
+ * Read callback of a gateway serving one device (cb_arg: device index)
+ */
+static osd_result device_packet_read(struct osd_packet **pkg, void *cb_arg)
+{
+    unsigned int dev = (uintptr_t)cb_arg;
+    while (!device_trace_packet(dev, pkg)) {
+        usleep(1);
+    }
+    return OSD_OK;
+}
+
+/**
+ * Read callback of a gateway serving all devices: read them in turn
+ */
+static osd_result shared_packet_read(struct osd_packet **pkg, void *cb_arg)
+{
+    while (1) {
+        for (unsigned int i = 0; i < DEVICES; i++) {
+            unsigned int dev = shared_read_next;
+            shared_read_next = (shared_read_next + 1) % DEVICES;
+            if (device_trace_packet(dev, pkg)) {
+                return OSD_OK;
+            }
+        }
+        usleep(1);
+    }
+}
+
+/**
+ * Get a value from /proc/self/status (e.g. "Threads:")
+ */
+static long proc_status_value(const char *name)
+{
+    char line[256];
+    long value = -1;
+
+    FILE *f = fopen("/proc/self/status", "r");
+    assert(f);
+    while (fgets(line, sizeof(line), f)) {
+        if (!strncmp(line, name, strlen(name))) {
+            value = strtol(line + strlen(name), NULL, 10);
+            break;
+        }
+    }
+    fclose(f);
+    return value;
+}
+
+static uint64_t process_cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_devices(struct osd_log_ctx *log_ctx, bool shared)
+{
+    osd_result rv;
+    struct osd_gateway_ctx *gateway_ctx[DEVICES] = {NULL};
+    unsigned int gateways = shared ? 1 : DEVICES;
+
+    long threads_start = proc_status_value("Threads:");
+    long rss_start_kb = proc_status_value("VmRSS:");
+
+    for (unsigned int i = 0; i < gateways; i++) {
+        rv = osd_gateway_new(&gateway_ctx[i], log_ctx, HOSTCTRL_EP,
+                             FIRST_SUBNET + i,
+                             shared ? shared_packet_read : device_packet_read,
+                             device_packet_write, (void *)(uintptr_t)i);
+        assert(OSD_SUCCEEDED(rv));
+    }
+    if (shared) {
+        for (unsigned int i = 1; i < DEVICES; i++) {
+            rv = osd_gateway_add_subnet(gateway_ctx[0], FIRST_SUBNET + i);
+            assert(OSD_SUCCEEDED(rv));
+        }
+    }
+    for (unsigned int i = 0; i < gateways; i++) {
+        rv = osd_gateway_connect(gateway_ctx[i]);
+        assert(OSD_SUCCEEDED(rv));
+    }
+
+    long threads = proc_status_value("Threads:") - threads_start;
+    long rss_kb = proc_status_value("VmRSS:") - rss_start_kb;
+
+    __atomic_store_n(&trace_count, 0, __ATOMIC_RELAXED);
+    uint64_t cpu_start = process_cpu_ns();
+    uint64_t start = benchutil_now_ns();
+    for (unsigned int i = 0; i < DEVICES; i++) {
+        __atomic_store_n(&device_trace_remaining[i], TRACE_PACKETS_PER_DEVICE,
+                         __ATOMIC_RELAXED);
+    }
+    while (__atomic_load_n(&trace_count, __ATOMIC_RELAXED) <
+           DEVICES * TRACE_PACKETS_PER_DEVICE) {
+        usleep(100);
+    }
+    uint64_t duration = benchutil_now_ns() - start;
+    uint64_t cpu_ns = process_cpu_ns() - cpu_start;
+
+    const char *name = shared ? "one gateway, 8 subnets" : "8 gateways";
+    benchutil_report(name, DEVICES * TRACE_PACKETS_PER_DEVICE, duration);
+    printf("%-40s %8.1f threads %8.1f kB RSS %10.1f ms CPU per device\n",
+           name, (double)threads / DEVICES, (double)rss_kb / DEVICES,
+           cpu_ns / 1e6 / DEVICES);
+
+    for (unsigned int i = 0; i < gateways; i++) {
+        osd_gateway_disconnect(gateway_ctx[i]);
+        osd_gateway_free(&gateway_ctx[i]);
+    }
+}
+
+int main(void)
+{
+    osd_result rv;
+
+    zsys_init();
+
+    struct osd_log_ctx *log_ctx;
+    rv = osd_log_new(&log_ctx, LOG_ERR, NULL);
+    assert(OSD_SUCCEEDED(rv));
+
+    struct osd_hostctrl_ctx *hostctrl_ctx;
+    rv = osd_hostctrl_new(&hostctrl_ctx, log_ctx, HOSTCTRL_EP);
+    assert(OSD_SUCCEEDED(rv));
+    rv = osd_hostctrl_start(hostctrl_ctx);
+    assert(OSD_SUCCEEDED(rv));
+
+    struct osd_hostmod_ctx *sink_ctx;
+    rv = osd_hostmod_new(&sink_ctx, log_ctx, HOSTCTRL_EP, trace_sink_handler,
+                         NULL);
+    assert(OSD_SUCCEEDED(rv));
+    rv = osd_hostmod_connect(sink_ctx);
+    assert(OSD_SUCCEEDED(rv));
+    device_trace_dest = osd_hostmod_get_diaddr(sink_ctx);
+
+    bench_devices(log_ctx, false);
+    bench_devices(log_ctx, true);
+
+    osd_hostmod_disconnect(sink_ctx);
+    osd_hostmod_free(&sink_ctx);
+    osd_hostctrl_stop(hostctrl_ctx);
+    osd_hostctrl_free(&hostctrl_ctx);
+    osd_log_free(&log_ctx);
+
+    return 0;
+}
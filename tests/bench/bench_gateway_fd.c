@@ -0,0 +1,198 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Benchmark: reading the device in a separate thread or in the I/O thread
+ *
+ * A simulated device answers register reads through a pipe, which signals
+ * waiting responses. The gateway reads the device either in its device RX
+ * thread with a blocking read, or in its I/O thread by polling the pipe (see
+ * osd_gateway_set_device_fd()). The register read latency is measured for
+ * both.
+ */
+
+#include "benchutil.h"
+
+#include <assert.h>
+#include <czmq.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <osd/gateway.h>
+#include <osd/hostctrl.h>
+#include <osd/hostmod.h>
+#include <osd/osd.h>
+#include <osd/packet.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#define HOSTCTRL_EP "inproc://bench_gateway_fd"
+#define DEVICE_SUBNET 2
+#define REG_READS 5000
+
+/** Simulated device: register read responses waiting to be read */
+static zlist_t *device_responses;
+static pthread_mutex_t device_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Simulated device: one byte per waiting response */
+static int device_pipe[2];
+
+/**
+ * Simulated device: answer register read requests
+ */
+static osd_result device_packet_write(const struct osd_packet *pkg,
+                                      void *cb_arg)
+{
+    if (osd_packet_get_type(pkg) != OSD_PACKET_TYPE_REG ||
+        osd_packet_get_type_sub(pkg) != REQ_READ_REG_16) {
+        return OSD_OK;
+    }
+
+    struct osd_packet *resp;
+    osd_result rv =
+        osd_packet_new(&resp, osd_packet_get_data_size_words_from_payload(1));
+    assert(OSD_SUCCEEDED(rv));
+    osd_packet_set_header(resp, osd_packet_get_src(pkg),
+                          osd_packet_get_dest(pkg), OSD_PACKET_TYPE_REG,
+                          RESP_READ_REG_SUCCESS_16);
+    resp->data.payload[0] = 0x1234;
+
+    pthread_mutex_lock(&device_lock);
+    zlist_append(device_responses, resp);
+    pthread_mutex_unlock(&device_lock);
+
+    ssize_t written = write(device_pipe[1], "r", 1);
+    assert(written == 1);
+
+    return OSD_OK;
+}
+
+static struct osd_packet *device_pop_response(void)
+{
+    pthread_mutex_lock(&device_lock);
+    struct osd_packet *resp = zlist_pop(device_responses);
+    pthread_mutex_unlock(&device_lock);
+    assert(resp);
+    return resp;
+}
+
+/**
+ * Simulated device: wait for a response (device RX thread)
+ */
+static osd_result device_packet_read(struct osd_packet **pkg, void *cb_arg)
+{
+    char c;
+    while (read(device_pipe[0], &c, 1) != 1) {
+        // the pipe is non-blocking for device_packet_read_nonblocking()
+        usleep(1);
+    }
+    *pkg = device_pop_response();
+    return OSD_OK;
+}
+
+/**
+ * Simulated device: return a waiting response, if any (I/O thread)
+ */
+static osd_result device_packet_read_nonblocking(struct osd_packet **pkg,
+                                                 void *cb_arg)
+{
+    char c;
+    if (read(device_pipe[0], &c, 1) != 1) {
+        assert(errno == EAGAIN);
+        *pkg = NULL;
+        return OSD_OK;
+    }
+    *pkg = device_pop_response();
+    return OSD_OK;
+}
+
+static void bench_reg_reads(struct osd_log_ctx *log_ctx,
+                            struct osd_hostmod_ctx *reg_ctx, bool use_fd)
+{
+    osd_result rv;
+    static uint64_t samples[REG_READS];
+
+    struct osd_gateway_ctx *gateway_ctx;
+    rv = osd_gateway_new(&gateway_ctx, log_ctx, HOSTCTRL_EP, DEVICE_SUBNET,
+                         device_packet_read, device_packet_write, NULL);
+    assert(OSD_SUCCEEDED(rv));
+    if (use_fd) {
+        rv = osd_gateway_set_device_fd(gateway_ctx, device_pipe[0],
+                                       device_packet_read_nonblocking);
+        assert(OSD_SUCCEEDED(rv));
+    }
+    rv = osd_gateway_connect(gateway_ctx);
+    assert(OSD_SUCCEEDED(rv));
+
+    for (int i = 0; i < REG_READS; i++) {
+        uint16_t value;
+        uint64_t start = benchutil_now_ns();
+        rv = osd_hostmod_reg_read(reg_ctx, &value,
+                                  osd_diaddr_build(DEVICE_SUBNET, 1), 0x200,
+                                  16, 0);
+        samples[i] = benchutil_now_ns() - start;
+        assert(OSD_SUCCEEDED(rv) && value == 0x1234);
+    }
+    benchutil_report_latency(use_fd ? "reg read, device read in I/O thread"
+                                    : "reg read, device RX thread",
+                             samples, REG_READS);
+
+    osd_gateway_disconnect(gateway_ctx);
+    osd_gateway_free(&gateway_ctx);
+}
+
+int main(void)
+{
+    osd_result rv;
+    int irv;
+
+    zsys_init();
+    device_responses = zlist_new();
+    irv = pipe(device_pipe);
+    assert(irv == 0);
+    irv = fcntl(device_pipe[0], F_SETFL, O_NONBLOCK);
+    assert(irv == 0);
+
+    struct osd_log_ctx *log_ctx;
+    rv = osd_log_new(&log_ctx, LOG_ERR, NULL);
+    assert(OSD_SUCCEEDED(rv));
+
+    struct osd_hostctrl_ctx *hostctrl_ctx;
+    rv = osd_hostctrl_new(&hostctrl_ctx, log_ctx, HOSTCTRL_EP);
+    assert(OSD_SUCCEEDED(rv));
+    rv = osd_hostctrl_start(hostctrl_ctx);
+    assert(OSD_SUCCEEDED(rv));
+
+    struct osd_hostmod_ctx *reg_ctx;
+    rv = osd_hostmod_new(&reg_ctx, log_ctx, HOSTCTRL_EP, NULL, NULL);
+    assert(OSD_SUCCEEDED(rv));
+    rv = osd_hostmod_connect(reg_ctx);
+    assert(OSD_SUCCEEDED(rv));
+
+    bench_reg_reads(log_ctx, reg_ctx, false);
+    bench_reg_reads(log_ctx, reg_ctx, true);
+
+    osd_hostmod_disconnect(reg_ctx);
+    osd_hostmod_free(&reg_ctx);
+    osd_hostctrl_stop(hostctrl_ctx);
+    osd_hostctrl_free(&hostctrl_ctx);
+    osd_log_free(&log_ctx);
+
+    close(device_pipe[0]);
+    close(device_pipe[1]);
+    zlist_destroy(&device_responses);
+
+    return 0;
+}
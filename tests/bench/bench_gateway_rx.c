@@ -0,0 +1,214 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Benchmark: batching of packets read from the device in the gateway
+ *
+ * A simulated device streams trace packets as fast as possible through a
+ * gateway and a host controller to a host module. The throughput is measured
+ * without batching and with different maximum batch sizes (see
+ * osd_gateway_set_rx_batch()), and with a device which is read in batches
+ * (see osd_gateway_new_batched()).
+ */
+
+#include "benchutil.h"
+
+#include <assert.h>
+#include <czmq.h>
+#include <osd/gateway.h>
+#include <osd/hostctrl.h>
+#include <osd/hostmod.h>
+#include <osd/osd.h>
+#include <osd/packet.h>
+#include <unistd.h>
+
+#define HOSTCTRL_EP "tcp://127.0.0.1:9539"
+#define DEVICE_SUBNET 2
+#define TRACE_PACKETS 500000
+#define TRACE_PAYLOAD_WORDS 8
+
+/** Simulated device: trace packets still to be generated */
+static volatile uint64_t device_trace_remaining;
+
+/** Destination of the trace data */
+static volatile uint16_t device_trace_dest;
+
+/** Number of trace packets received by the sink */
+static volatile uint64_t trace_count;
+
+static osd_result trace_sink_handler(void *arg, struct osd_packet *pkg)
+{
+    trace_count++;
+    osd_packet_free(&pkg);
+    return OSD_OK;
+}
+
+static osd_result device_packet_write(const struct osd_packet *pkg,
+                                      void *cb_arg)
+{
+    return OSD_OK;
+}
+
+/**
+ * Simulated device: return trace packets as long as requested
+ */
+static osd_result device_packet_read(struct osd_packet **pkg, void *cb_arg)
+{
+    while (device_trace_remaining == 0) {
+        usleep(1);
+    }
+    device_trace_remaining--;
+
+    osd_result rv = osd_packet_new(
+        pkg, osd_packet_get_data_size_words_from_payload(TRACE_PAYLOAD_WORDS));
+    assert(OSD_SUCCEEDED(rv));
+    osd_packet_set_header(*pkg, device_trace_dest,
+                          osd_diaddr_build(DEVICE_SUBNET, 2),
+                          OSD_PACKET_TYPE_EVENT, 0);
+    return OSD_OK;
+}
+
+/**
+ * Simulated batched device: return as many requested trace packets as fit
+ */
+static osd_result device_read_batch(uint16_t *dtds, size_t max_words,
+                                    size_t *size_words, void *cb_arg)
+{
+    while (device_trace_remaining == 0) {
+        usleep(1);
+    }
+
+    uint16_t pkg_words =
+        osd_packet_get_data_size_words_from_payload(TRACE_PAYLOAD_WORDS);
+    uint64_t packets = max_words / (1 + pkg_words);
+    if (packets > device_trace_remaining) {
+        packets = device_trace_remaining;
+    }
+    device_trace_remaining -= packets;
+
+    uint16_t *dtd = dtds;
+    for (uint64_t i = 0; i < packets; i++) {
+        dtd[0] = pkg_words;
+        osd_packet_set_header((struct osd_packet *)dtd, device_trace_dest,
+                              osd_diaddr_build(DEVICE_SUBNET, 2),
+                              OSD_PACKET_TYPE_EVENT, 0);
+        dtd += 1 + pkg_words;
+    }
+    *size_words = dtd - dtds;
+    return OSD_OK;
+}
+
+static osd_result device_write_batch(const uint16_t *dtds, size_t size_words,
+                                     void *cb_arg)
+{
+    return OSD_OK;
+}
+
+static void wait_for_trace(const char *name)
+{
+    trace_count = 0;
+    uint64_t start = benchutil_now_ns();
+    device_trace_remaining = TRACE_PACKETS;
+    while (trace_count < TRACE_PACKETS) {
+        usleep(100);
+    }
+    benchutil_report(name, TRACE_PACKETS, benchutil_now_ns() - start);
+}
+
+static void bench_trace_stream(struct osd_log_ctx *log_ctx, size_t max_bytes)
+{
+    osd_result rv;
+    char name[64];
+
+    struct osd_gateway_ctx *gateway_ctx;
+    rv = osd_gateway_new(&gateway_ctx, log_ctx, HOSTCTRL_EP, DEVICE_SUBNET,
+                         device_packet_read, device_packet_write, NULL);
+    assert(OSD_SUCCEEDED(rv));
+    rv = osd_gateway_set_rx_batch(gateway_ctx, max_bytes, 1);
+    assert(OSD_SUCCEEDED(rv));
+    rv = osd_gateway_connect(gateway_ctx);
+    assert(OSD_SUCCEEDED(rv));
+
+    if (max_bytes) {
+        snprintf(name, sizeof(name), "trace stream, batch %zu bytes",
+                 max_bytes);
+    } else {
+        snprintf(name, sizeof(name), "trace stream, no batching");
+    }
+    wait_for_trace(name);
+
+    osd_gateway_disconnect(gateway_ctx);
+    osd_gateway_free(&gateway_ctx);
+}
+
+static void bench_trace_stream_batched(struct osd_log_ctx *log_ctx)
+{
+    osd_result rv;
+
+    const struct osd_gateway_device_ops ops = {
+        .read_batch = device_read_batch,
+        .write_batch = device_write_batch,
+    };
+    struct osd_gateway_ctx *gateway_ctx;
+    rv = osd_gateway_new_batched(&gateway_ctx, log_ctx, HOSTCTRL_EP,
+                                 DEVICE_SUBNET, &ops, NULL);
+    assert(OSD_SUCCEEDED(rv));
+    rv = osd_gateway_connect(gateway_ctx);
+    assert(OSD_SUCCEEDED(rv));
+
+    wait_for_trace("trace stream, batched device reads");
+
+    osd_gateway_disconnect(gateway_ctx);
+    osd_gateway_free(&gateway_ctx);
+}
+
+int main(void)
+{
+    osd_result rv;
+
+    zsys_init();
+
+    struct osd_log_ctx *log_ctx;
+    rv = osd_log_new(&log_ctx, LOG_ERR, NULL);
+    assert(OSD_SUCCEEDED(rv));
+
+    struct osd_hostctrl_ctx *hostctrl_ctx;
+    rv = osd_hostctrl_new(&hostctrl_ctx, log_ctx, HOSTCTRL_EP);
+    assert(OSD_SUCCEEDED(rv));
+    rv = osd_hostctrl_start(hostctrl_ctx);
+    assert(OSD_SUCCEEDED(rv));
+
+    struct osd_hostmod_ctx *sink_ctx;
+    rv = osd_hostmod_new(&sink_ctx, log_ctx, HOSTCTRL_EP, trace_sink_handler,
+                         NULL);
+    assert(OSD_SUCCEEDED(rv));
+    rv = osd_hostmod_connect(sink_ctx);
+    assert(OSD_SUCCEEDED(rv));
+    device_trace_dest = osd_hostmod_get_diaddr(sink_ctx);
+
+    const size_t batch_sizes[] = {0, 1024, 4 * 1024, 16 * 1024, 64 * 1024};
+    for (size_t i = 0; i < sizeof(batch_sizes) / sizeof(batch_sizes[0]); i++) {
+        bench_trace_stream(log_ctx, batch_sizes[i]);
+    }
+    bench_trace_stream_batched(log_ctx);
+
+    osd_hostmod_disconnect(sink_ctx);
+    osd_hostmod_free(&sink_ctx);
+    osd_hostctrl_stop(hostctrl_ctx);
+    osd_hostctrl_free(&hostctrl_ctx);
+    osd_log_free(&log_ctx);
+
+    return 0;
+}
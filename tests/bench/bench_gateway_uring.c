@@ -0,0 +1,283 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Benchmark: io_uring gateway backend compared to the GLIP TCP backend
+ *
+ * A device on TCP loopback streams trace packets as fast as possible through
+ * a gateway and a host controller to a host module. The throughput is
+ * measured with the io_uring backend (see osd_gateway_uring_new()) with
+ * different numbers of parts of the receive buffer, and with the GLIP TCP
+ * backend if GLIP is available.
+ */
+
+#include "benchutil.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <czmq.h>
+#include <netinet/in.h>
+#include <osd/gateway_uring.h>
+#include <osd/hostctrl.h>
+#include <osd/hostmod.h>
+#include <osd/osd.h>
+#include <osd/packet.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#ifdef USE_GLIP
+#include <osd/gateway_glip.h>
+#endif
+
+#define HOSTCTRL_EP "tcp://127.0.0.1:9539"
+#define DEVICE_SUBNET 2
+#define DEVICE_PORT 23400
+#define TRACE_PAYLOAD_WORDS 8
+
+/** Packets in the buffer the device sends repeatedly */
+#define STREAM_PACKETS 1024
+
+/** Packets sent by the device per connection */
+#define TRACE_PACKETS (STREAM_PACKETS * 2048)
+
+/** Size of a packet in the stream, including the size word (bytes) */
+#define STREAM_PACKET_BYTES ((3 + TRACE_PAYLOAD_WORDS + 1) * 2)
+
+/** Trace packets as sent by the device (big endian DTDs) */
+static uint8_t stream[STREAM_PACKETS * STREAM_PACKET_BYTES];
+
+/** Number of trace packets received by the sink */
+static volatile uint64_t trace_count;
+
+static osd_result trace_sink_handler(void *arg, struct osd_packet *pkg)
+{
+    trace_count++;
+    osd_packet_free(&pkg);
+    return OSD_OK;
+}
+
+/**
+ * Build the trace stream of the device
+ */
+static void build_stream(uint16_t dest)
+{
+    uint16_t words[3 + TRACE_PAYLOAD_WORDS + 1];
+    words[0] = 3 + TRACE_PAYLOAD_WORDS;
+    words[1] = dest;
+    words[2] = osd_diaddr_build(DEVICE_SUBNET, 2);
+    words[3] = OSD_PACKET_TYPE_EVENT << DP_HEADER_TYPE_SHIFT;
+
+    for (int p = 0; p < STREAM_PACKETS; p++) {
+        for (int w = 0; w < TRACE_PAYLOAD_WORDS; w++) {
+            words[4 + w] = p + w;
+        }
+        for (size_t w = 0; w < sizeof(words) / sizeof(words[0]); w++) {
+            stream[p * STREAM_PACKET_BYTES + 2 * w] = words[w] >> 8;
+            stream[p * STREAM_PACKET_BYTES + 2 * w + 1] = words[w] & 0xff;
+        }
+    }
+}
+
+static int listen_tcp(uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(fd != -1);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    int rv = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    assert(rv == 0);
+    rv = listen(fd, 4);
+    assert(rv == 0);
+    return fd;
+}
+
+/**
+ * Device: send TRACE_PACKETS packets to every connection, and wait for the
+ * gateway to close it
+ */
+static void *device_data_thread(void *arg)
+{
+    int listen_fd = *(int *)arg;
+    while (1) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd == -1) {
+            return NULL;
+        }
+        for (unsigned int p = 0; p < TRACE_PACKETS; p += STREAM_PACKETS) {
+            size_t len = sizeof(stream);
+            const uint8_t *data = stream;
+            while (len) {
+                ssize_t written = write(fd, data, len);
+                if (written <= 0) {
+                    break;
+                }
+                data += written;
+                len -= written;
+            }
+        }
+        uint8_t buf[256];
+        while (read(fd, buf, sizeof(buf)) > 0) {
+        }
+        close(fd);
+    }
+}
+
+/**
+ * Device: accept the control connection of the GLIP TCP backend and ignore
+ * its contents
+ */
+static void *device_control_thread(void *arg)
+{
+    int listen_fd = *(int *)arg;
+    while (1) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd == -1) {
+            return NULL;
+        }
+        uint8_t buf[256];
+        while (read(fd, buf, sizeof(buf)) > 0) {
+        }
+        close(fd);
+    }
+}
+
+static void wait_for_trace(const char *name, uint64_t start)
+{
+    while (trace_count < TRACE_PACKETS) {
+        usleep(100);
+    }
+    benchutil_report(name, TRACE_PACKETS, benchutil_now_ns() - start);
+}
+
+static void bench_uring(struct osd_log_ctx *log_ctx, unsigned int reads)
+{
+    osd_result rv;
+    char name[64];
+    char device[64];
+
+    snprintf(device, sizeof(device), "tcp://127.0.0.1:%u", DEVICE_PORT);
+    struct osd_gateway_uring_ctx *gateway_ctx;
+    rv = osd_gateway_uring_new(&gateway_ctx, log_ctx, HOSTCTRL_EP,
+                               DEVICE_SUBNET, device);
+    assert(OSD_SUCCEEDED(rv));
+    rv = osd_gateway_uring_set_reads(gateway_ctx, reads,
+                                     OSD_GATEWAY_URING_READ_SIZE_DEFAULT);
+    assert(OSD_SUCCEEDED(rv));
+
+    trace_count = 0;
+    uint64_t start = benchutil_now_ns();
+    rv = osd_gateway_uring_connect(gateway_ctx);
+    assert(OSD_SUCCEEDED(rv));
+    snprintf(name, sizeof(name), "io_uring backend, %u read buffer(s)",
+             reads);
+    wait_for_trace(name, start);
+
+    struct osd_gateway_uring_stats stats;
+    osd_gateway_uring_get_stats(gateway_ctx, &stats);
+    printf("%-40s %12.1f kB/read %8.2f reads/submission\n", "",
+           stats.rx_bytes / 1024.0 / stats.reads,
+           (double)stats.reads / stats.submits);
+
+    osd_gateway_uring_disconnect(gateway_ctx);
+    osd_gateway_uring_free(&gateway_ctx);
+}
+
+#ifdef USE_GLIP
+static void bench_glip(struct osd_log_ctx *log_ctx)
+{
+    osd_result rv;
+    char port[16];
+
+    snprintf(port, sizeof(port), "%u", DEVICE_PORT);
+    struct glip_option options[] = {
+        {.name = "hostname", .value = "127.0.0.1"},
+        {.name = "port", .value = port},
+    };
+    struct osd_gateway_glip_ctx *gateway_ctx;
+    rv = osd_gateway_glip_new(&gateway_ctx, log_ctx, HOSTCTRL_EP,
+                              DEVICE_SUBNET, "tcp", options,
+                              sizeof(options) / sizeof(options[0]));
+    assert(OSD_SUCCEEDED(rv));
+
+    trace_count = 0;
+    uint64_t start = benchutil_now_ns();
+    rv = osd_gateway_glip_connect(gateway_ctx);
+    assert(OSD_SUCCEEDED(rv));
+    wait_for_trace("GLIP TCP backend", start);
+
+    osd_gateway_glip_disconnect(gateway_ctx);
+    osd_gateway_glip_free(&gateway_ctx);
+}
+#endif
+
+int main(void)
+{
+    osd_result rv;
+
+    zsys_init();
+
+    struct osd_log_ctx *log_ctx;
+    rv = osd_log_new(&log_ctx, LOG_ERR, NULL);
+    assert(OSD_SUCCEEDED(rv));
+
+    struct osd_hostctrl_ctx *hostctrl_ctx;
+    rv = osd_hostctrl_new(&hostctrl_ctx, log_ctx, HOSTCTRL_EP);
+    assert(OSD_SUCCEEDED(rv));
+    rv = osd_hostctrl_start(hostctrl_ctx);
+    assert(OSD_SUCCEEDED(rv));
+
+    struct osd_hostmod_ctx *sink_ctx;
+    rv = osd_hostmod_new(&sink_ctx, log_ctx, HOSTCTRL_EP, trace_sink_handler,
+                         NULL);
+    assert(OSD_SUCCEEDED(rv));
+    rv = osd_hostmod_connect(sink_ctx);
+    assert(OSD_SUCCEEDED(rv));
+    build_stream(osd_hostmod_get_diaddr(sink_ctx));
+
+    // the GLIP TCP backend connects to the data port and the port above it
+    int data_fd = listen_tcp(DEVICE_PORT);
+    int control_fd = listen_tcp(DEVICE_PORT + 1);
+    pthread_t data_thread, control_thread;
+    pthread_create(&data_thread, NULL, device_data_thread, &data_fd);
+    pthread_create(&control_thread, NULL, device_control_thread, &control_fd);
+
+    const unsigned int reads[] = {1, 4, 8};
+    for (size_t i = 0; i < sizeof(reads) / sizeof(reads[0]); i++) {
+        bench_uring(log_ctx, reads[i]);
+    }
+#ifdef USE_GLIP
+    bench_glip(log_ctx);
+#endif
+
+    shutdown(data_fd, SHUT_RDWR);
+    shutdown(control_fd, SHUT_RDWR);
+    pthread_join(data_thread, NULL);
+    pthread_join(control_thread, NULL);
+    close(data_fd);
+    close(control_fd);
+
+    osd_hostmod_disconnect(sink_ctx);
+    osd_hostmod_free(&sink_ctx);
+    osd_hostctrl_stop(hostctrl_ctx);
+    osd_hostctrl_free(&hostctrl_ctx);
+    osd_log_free(&log_ctx);
+
+    return 0;
+}
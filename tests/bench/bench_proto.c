@@ -0,0 +1,127 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Benchmark: cost of parsing host protocol messages
+ *
+ * Compares the parsing of management and data messages in the text protocol
+ * (version 1) with the binary protocol (version 2). The version 1 parser
+ * mirrors the code used in the host controller before version 2 was
+ * introduced.
+ */
+
+#include "benchutil.h"
+
+#include <czmq.h>
+#include <osd/osd.h>
+#include <stdlib.h>
+#include <string.h>
+#include "proto.h"
+
+#define ITERATIONS 2000000
+
+// prevent the compiler from optimizing away the parsing results
+static volatile unsigned long sink;
+
+static void bench_mgmt_v1(void)
+{
+    zframe_t *type_frame = zframe_new("M", 1);
+    zframe_t *payload_frame = zframe_from("GW_REGISTER 12");
+
+    uint64_t start = benchutil_now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        char *type = zframe_strdup(type_frame);
+        if (type[0] == 'M') {
+            char *request = zframe_strdup(payload_frame);
+            if (!strncmp(request, "GW_REGISTER ", strlen("GW_REGISTER "))) {
+                sink += strtol(request + strlen("GW_REGISTER "), NULL, 10);
+            }
+            free(request);
+        }
+        free(type);
+    }
+    benchutil_report("mgmt GW_REGISTER, v1 (text)", ITERATIONS,
+                     benchutil_now_ns() - start);
+
+    zframe_destroy(&type_frame);
+    zframe_destroy(&payload_frame);
+}
+
+static void bench_mgmt_v2(void)
+{
+    zmsg_t *msg = proto_msg_new_u16(PROTO_OP_GW_REGISTER, 1, 12);
+    zframe_t *hdr_frame = zmsg_first(msg);
+    zframe_t *body_frame = zmsg_next(msg);
+
+    uint64_t start = benchutil_now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        struct proto_hdr hdr;
+        uint16_t subnet;
+        if (OSD_SUCCEEDED(proto_hdr_parse(hdr_frame, &hdr)) &&
+            hdr.opcode == PROTO_OP_GW_REGISTER &&
+            OSD_SUCCEEDED(proto_body_get_u16(body_frame, &subnet))) {
+            sink += subnet;
+        }
+    }
+    benchutil_report("mgmt GW_REGISTER, v2 (binary)", ITERATIONS,
+                     benchutil_now_ns() - start);
+
+    zmsg_destroy(&msg);
+}
+
+static void bench_data_v1(void)
+{
+    zframe_t *type_frame = zframe_new("D", 1);
+
+    uint64_t start = benchutil_now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        char *type = zframe_strdup(type_frame);
+        if (type[0] == 'D') {
+            sink++;
+        }
+        free(type);
+    }
+    benchutil_report("data type detection, v1 (text)", ITERATIONS,
+                     benchutil_now_ns() - start);
+
+    zframe_destroy(&type_frame);
+}
+
+static void bench_data_v2(void)
+{
+    zframe_t *hdr_frame = proto_hdr_frame_new(PROTO_OP_DATA, 0, 1);
+
+    uint64_t start = benchutil_now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        struct proto_hdr hdr;
+        if (OSD_SUCCEEDED(proto_hdr_parse(hdr_frame, &hdr)) &&
+            hdr.opcode == PROTO_OP_DATA) {
+            sink += hdr.seq;
+        }
+    }
+    benchutil_report("data type detection, v2 (binary)", ITERATIONS,
+                     benchutil_now_ns() - start);
+
+    zframe_destroy(&hdr_frame);
+}
+
+int main(void)
+{
+    bench_mgmt_v1();
+    bench_mgmt_v2();
+    bench_data_v1();
+    bench_data_v2();
+    return 0;
+}
@@ -0,0 +1,219 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Benchmark: transports between co-located components
+ *
+ * A host controller, a gateway with a simulated device and two host modules
+ * are connected through different transports: TCP loopback, ZeroMQ IPC and
+ * shared memory. For each transport the latency of register reads from the
+ * device and the throughput of a trace stream from the device to a host
+ * module is measured.
+ */
+
+#include "benchutil.h"
+
+#include <assert.h>
+#include <czmq.h>
+#include <osd/gateway.h>
+#include <osd/hostctrl.h>
+#include <osd/hostmod.h>
+#include <osd/osd.h>
+#include <osd/packet.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#define DEVICE_SUBNET 2
+#define REG_READS 5000
+#define TRACE_PACKETS 200000
+#define TRACE_PAYLOAD_WORDS 8
+
+/** Simulated device: register read responses waiting to be read */
+static zlist_t *device_responses;
+static pthread_mutex_t device_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Simulated device: trace packets still to be generated */
+static volatile uint64_t device_trace_remaining;
+
+/** Destination of the trace data */
+static volatile uint16_t device_trace_dest;
+
+/** Number of trace packets received by the sink */
+static volatile uint64_t trace_count;
+
+static osd_result trace_sink_handler(void *arg, struct osd_packet *pkg)
+{
+    trace_count++;
+    osd_packet_free(&pkg);
+    return OSD_OK;
+}
+
+/**
+ * Simulated device: answer register read requests
+ */
+static osd_result device_packet_write(const struct osd_packet *pkg,
+                                      void *cb_arg)
+{
+    if (osd_packet_get_type(pkg) != OSD_PACKET_TYPE_REG ||
+        osd_packet_get_type_sub(pkg) != REQ_READ_REG_16) {
+        return OSD_OK;
+    }
+
+    struct osd_packet *resp;
+    osd_result rv =
+        osd_packet_new(&resp, osd_packet_get_data_size_words_from_payload(1));
+    assert(OSD_SUCCEEDED(rv));
+    osd_packet_set_header(resp, osd_packet_get_src(pkg),
+                          osd_packet_get_dest(pkg), OSD_PACKET_TYPE_REG,
+                          RESP_READ_REG_SUCCESS_16);
+    resp->data.payload[0] = 0x1234;
+
+    pthread_mutex_lock(&device_lock);
+    zlist_append(device_responses, resp);
+    pthread_mutex_unlock(&device_lock);
+
+    return OSD_OK;
+}
+
+/**
+ * Simulated device: return register responses, otherwise trace data
+ */
+static osd_result device_packet_read(struct osd_packet **pkg, void *cb_arg)
+{
+    while (1) {
+        pthread_mutex_lock(&device_lock);
+        struct osd_packet *resp = zlist_pop(device_responses);
+        pthread_mutex_unlock(&device_lock);
+        if (resp) {
+            *pkg = resp;
+            return OSD_OK;
+        }
+
+        if (device_trace_remaining > 0) {
+            device_trace_remaining--;
+            break;
+        }
+        usleep(1);
+    }
+
+    osd_result rv = osd_packet_new(
+        pkg, osd_packet_get_data_size_words_from_payload(TRACE_PAYLOAD_WORDS));
+    assert(OSD_SUCCEEDED(rv));
+    osd_packet_set_header(*pkg, device_trace_dest,
+                          osd_diaddr_build(DEVICE_SUBNET, 2),
+                          OSD_PACKET_TYPE_EVENT, 0);
+    return OSD_OK;
+}
+
+static void bench_reg_reads(const char *name, struct osd_hostmod_ctx *reg_ctx)
+{
+    static uint64_t samples[REG_READS];
+
+    for (int i = 0; i < REG_READS; i++) {
+        uint16_t value;
+        uint64_t start = benchutil_now_ns();
+        osd_result rv =
+            osd_hostmod_reg_read(reg_ctx, &value,
+                                 osd_diaddr_build(DEVICE_SUBNET, 1), 0x200,
+                                 16, 0);
+        samples[i] = benchutil_now_ns() - start;
+        assert(OSD_SUCCEEDED(rv) && value == 0x1234);
+    }
+    benchutil_report_latency(name, samples, REG_READS);
+}
+
+static void bench_trace_stream(const char *name)
+{
+    trace_count = 0;
+
+    uint64_t start = benchutil_now_ns();
+    device_trace_remaining = TRACE_PACKETS;
+    while (trace_count < TRACE_PACKETS) {
+        usleep(100);
+    }
+    benchutil_report(name, TRACE_PACKETS, benchutil_now_ns() - start);
+}
+
+static void bench_transport(const char *transport, const char *endpoint)
+{
+    osd_result rv;
+    char name[64];
+
+    struct osd_log_ctx *log_ctx;
+    rv = osd_log_new(&log_ctx, LOG_ERR, NULL);
+    assert(OSD_SUCCEEDED(rv));
+
+    struct osd_hostctrl_ctx *hostctrl_ctx;
+    rv = osd_hostctrl_new(&hostctrl_ctx, log_ctx, endpoint);
+    assert(OSD_SUCCEEDED(rv));
+    rv = osd_hostctrl_start(hostctrl_ctx);
+    assert(OSD_SUCCEEDED(rv));
+
+    struct osd_hostmod_ctx *sink_ctx;
+    rv = osd_hostmod_new(&sink_ctx, log_ctx, endpoint, trace_sink_handler,
+                         NULL);
+    assert(OSD_SUCCEEDED(rv));
+    rv = osd_hostmod_connect(sink_ctx);
+    assert(OSD_SUCCEEDED(rv));
+    device_trace_dest = osd_hostmod_get_diaddr(sink_ctx);
+
+    struct osd_hostmod_ctx *reg_ctx;
+    rv = osd_hostmod_new(&reg_ctx, log_ctx, endpoint, NULL, NULL);
+    assert(OSD_SUCCEEDED(rv));
+    rv = osd_hostmod_connect(reg_ctx);
+    assert(OSD_SUCCEEDED(rv));
+
+    struct osd_gateway_ctx *gateway_ctx;
+    rv = osd_gateway_new(&gateway_ctx, log_ctx, endpoint, DEVICE_SUBNET,
+                         device_packet_read, device_packet_write, NULL);
+    assert(OSD_SUCCEEDED(rv));
+    rv = osd_gateway_connect(gateway_ctx);
+    assert(OSD_SUCCEEDED(rv));
+
+    snprintf(name, sizeof(name), "%s: reg read", transport);
+    bench_reg_reads(name, reg_ctx);
+
+    snprintf(name, sizeof(name), "%s: trace stream", transport);
+    bench_trace_stream(name);
+
+    osd_gateway_disconnect(gateway_ctx);
+    osd_gateway_free(&gateway_ctx);
+    osd_hostmod_disconnect(reg_ctx);
+    osd_hostmod_free(&reg_ctx);
+    osd_hostmod_disconnect(sink_ctx);
+    osd_hostmod_free(&sink_ctx);
+    osd_hostctrl_stop(hostctrl_ctx);
+    osd_hostctrl_free(&hostctrl_ctx);
+    osd_log_free(&log_ctx);
+}
+
+int main(void)
+{
+    zsys_init();
+    device_responses = zlist_new();
+
+    bench_transport("tcp", "tcp://127.0.0.1:9538");
+    bench_transport("ipc", "ipc:///tmp/osd-bench-transport.ipc");
+    bench_transport("shm", "shm:///tmp/osd-bench-transport.shm");
+
+    struct osd_packet *resp;
+    while ((resp = zlist_pop(device_responses))) {
+        osd_packet_free(&resp);
+    }
+    zlist_destroy(&device_responses);
+
+    return 0;
+}
@@ -0,0 +1,116 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Benchmark: evaluation of trace triggers in the host controller
+ *
+ * Evaluates 1, 4 and 16 triggers on a stream of EVENT packets of four trace
+ * modules, as done for every routed packet while trace triggers are set (see
+ * osd_hostctrl_add_trace_trigger()). The triggers are two-step patterns
+ * whose first step matches every fourth packet, so that the state machines
+ * keep advancing and starting over. Reports the time per packet.
+ */
+
+#include "benchutil.h"
+
+#include <osd/osd.h>
+#include <osd/packet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "trigger.h"
+
+#define ITERATIONS 5000000
+
+/** Number of packets in the stream (evaluated round-robin) */
+#define STREAM_PACKETS 256
+
+#define TRIGGERS_MAX 16
+
+static struct osd_packet *stream[STREAM_PACKETS];
+
+/**
+ * Create EVENT packets from four trace modules, with a timestamp, a
+ * sequence number and a few data words
+ */
+static void stream_new(void)
+{
+    for (unsigned int i = 0; i < STREAM_PACKETS; i++) {
+        unsigned int payload_words = 2 + i % 7;
+        osd_result rv = osd_packet_new(
+            &stream[i],
+            osd_packet_get_data_size_words_from_payload(payload_words));
+        if (OSD_FAILED(rv)) {
+            fprintf(stderr, "Unable to create packet.\n");
+            exit(1);
+        }
+        osd_packet_set_header(stream[i], 0x0005, 0x0402 + i % 4,
+                              OSD_PACKET_TYPE_EVENT, i % 3);
+        stream[i]->data.payload[0] = i * 37;
+        stream[i]->data.payload[1] = i / 4;
+        for (unsigned int j = 2; j < payload_words; j++) {
+            stream[i]->data.payload[j] = i % 4;
+        }
+    }
+}
+
+static void bench_triggers(unsigned int count)
+{
+    struct trigger *triggers[TRIGGERS_MAX];
+    char pattern[200];
+    unsigned int fired = 0;
+
+    for (unsigned int t = 0; t < count; t++) {
+        snprintf(pattern, sizeof(pattern),
+                 "type=event src=1.%u then within 8 type=event src=1.%u "
+                 "type_sub=2 word1=%u/0x3",
+                 2 + t % 4, 2 + (t + 1) % 4, t / 4 % 4);
+        if (OSD_FAILED(trigger_new(&triggers[t], pattern))) {
+            fprintf(stderr, "Invalid pattern: %s\n", pattern);
+            exit(1);
+        }
+    }
+
+    uint64_t start = benchutil_now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        const struct osd_packet *pkg = stream[i % STREAM_PACKETS];
+        for (unsigned int t = 0; t < count; t++) {
+            fired += trigger_eval(triggers[t], pkg);
+        }
+    }
+    uint64_t duration_ns = benchutil_now_ns() - start;
+
+    char name[100];
+    snprintf(name, sizeof(name), "eval, %u trigger%s (%u fired)", count,
+             count == 1 ? "" : "s", fired);
+    benchutil_report(name, ITERATIONS, duration_ns);
+
+    for (unsigned int t = 0; t < count; t++) {
+        trigger_free(&triggers[t]);
+    }
+}
+
+int main(void)
+{
+    stream_new();
+
+    bench_triggers(1);
+    bench_triggers(4);
+    bench_triggers(16);
+
+    for (unsigned int i = 0; i < STREAM_PACKETS; i++) {
+        osd_packet_free(&stream[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,108 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Benchmark: compression of trace data between gateway and host controller
+ *
+ * Compresses batches of the default batch size (see
+ * osd_gateway_set_rx_batch()) holding EVENT packets of a few trace modules,
+ * with repeating and with random payload. Reports the time per batch and the
+ * compression ratio.
+ */
+
+#include "benchutil.h"
+
+#include <osd/osd.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "wirecomp.h"
+
+#define ITERATIONS 20000
+
+/** Size of a batch (words): 16 kB, the default batch size of the gateway */
+#define BATCH_WORDS (16 * 1024 / 2)
+
+/**
+ * Fill a batch with EVENT packets from four trace modules
+ *
+ * The packets carry a timestamp, a sequence number and random data words.
+ */
+static size_t batch_events(uint16_t *dtds, bool random_payload)
+{
+    size_t pos = 0;
+    for (unsigned int i = 0; pos + 1 + 3 + 8 <= BATCH_WORDS; i++) {
+        unsigned int payload_words = 2 + i % 7;
+        dtds[pos++] = 3 + payload_words;
+        dtds[pos++] = 0x0005;
+        dtds[pos++] = 0x0402 + i % 4;
+        dtds[pos++] = 0x8000;
+        dtds[pos++] = i * 37;
+        dtds[pos++] = i / 4;
+        for (unsigned int j = 2; j < payload_words; j++) {
+            dtds[pos++] = random_payload ? rand() : i % 4;
+        }
+    }
+    return pos;
+}
+
+static void bench_batch(const char *name, const uint16_t *dtds,
+                        size_t size_words)
+{
+    uint8_t *data = malloc(wirecomp_bound(size_words));
+    size_t size = 0;
+    char bench_name[100];
+
+    uint64_t start = benchutil_now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        size = wirecomp_encode(dtds, size_words, data);
+    }
+    snprintf(bench_name, sizeof(bench_name), "encode, %s", name);
+    benchutil_report(bench_name, ITERATIONS, benchutil_now_ns() - start);
+
+    start = benchutil_now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        uint16_t *decoded;
+        size_t decoded_words;
+        osd_result rv = wirecomp_decode(data, size, &decoded, &decoded_words);
+        if (OSD_FAILED(rv)) {
+            fprintf(stderr, "Decoding failed.\n");
+            exit(1);
+        }
+        free(decoded);
+    }
+    snprintf(bench_name, sizeof(bench_name), "decode, %s", name);
+    benchutil_report(bench_name, ITERATIONS, benchutil_now_ns() - start);
+
+    printf("%-40s %12zu bytes -> %zu bytes (ratio %.2f)\n", name,
+           size_words * sizeof(uint16_t), size,
+           (double)(size_words * sizeof(uint16_t)) / size);
+    free(data);
+}
+
+int main(void)
+{
+    uint16_t *dtds = malloc(BATCH_WORDS * sizeof(uint16_t));
+    size_t size_words;
+
+    size_words = batch_events(dtds, false);
+    bench_batch("EVENT packets", dtds, size_words);
+
+    srand(42);
+    size_words = batch_events(dtds, true);
+    bench_batch("EVENT packets, random payload", dtds, size_words);
+
+    free(dtds);
+    return 0;
+}
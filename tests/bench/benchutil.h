@@ -0,0 +1,78 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BENCHUTIL_H
+#define BENCHUTIL_H
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * Monotonic time in nanoseconds
+ */
+static uint64_t benchutil_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Print the result of a benchmark run
+ *
+ * The output format is one line per result, which makes it easy to compare
+ * runs with standard text tools.
+ *
+ * @param name name of the measurement
+ * @param iterations number of operations performed
+ * @param duration_ns time needed for all operations
+ */
+static void benchutil_report(const char *name, uint64_t iterations,
+                             uint64_t duration_ns)
+{
+    double ns_per_op = (double)duration_ns / iterations;
+    double ops_per_s = iterations / ((double)duration_ns / 1e9);
+    printf("%-40s %12" PRIu64 " ops %10.1f ns/op %14.0f ops/s\n", name,
+           iterations, ns_per_op, ops_per_s);
+}
+
+static int benchutil_cmp_u64(const void *a, const void *b)
+{
+    uint64_t va = *(const uint64_t *)a;
+    uint64_t vb = *(const uint64_t *)b;
+    return (va > vb) - (va < vb);
+}
+
+/**
+ * Print the latency distribution of a benchmark run
+ *
+ * @param name name of the measurement
+ * @param samples_ns latency of each operation. The array is sorted in place.
+ * @param samples_len number of entries in @p samples_ns
+ */
+static void benchutil_report_latency(const char *name, uint64_t *samples_ns,
+                                     size_t samples_len)
+{
+    qsort(samples_ns, samples_len, sizeof(uint64_t), benchutil_cmp_u64);
+    printf("%-40s %12zu ops  p50 %10.1f us  p99 %10.1f us  max %10.1f us\n",
+           name, samples_len, samples_ns[samples_len / 2] / 1e3,
+           samples_ns[samples_len * 99 / 100] / 1e3,
+           samples_ns[samples_len - 1] / 1e3);
+}
+
+#endif  // BENCHUTIL_H
@@ -0,0 +1,138 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TEST_SUITE_NAME "check_bufpool"
+
+#include "testutil.h"
+
+#include <pthread.h>
+#include <string.h>
+#include "bufpool.h"
+
+START_TEST(test_bufpool_reuse)
+{
+    struct bufpool *pool = bufpool_new(64, 2);
+    ck_assert_ptr_ne(pool, NULL);
+
+    bool allocated;
+    void *buf1 = bufpool_get(pool, &allocated);
+    ck_assert(allocated);
+    memset(buf1, 0xab, 64);
+    void *buf2 = bufpool_get(pool, &allocated);
+    ck_assert(allocated);
+    ck_assert_ptr_ne(buf1, buf2);
+
+    // returned buffers are handed out again
+    bufpool_put(buf1, pool);
+    void *buf3 = bufpool_get(pool, &allocated);
+    ck_assert(!allocated);
+    ck_assert_ptr_eq(buf3, buf1);
+
+    // at most free_max buffers are kept
+    void *buf4 = bufpool_get(pool, NULL);
+    bufpool_put(buf2, pool);
+    bufpool_put(buf3, pool);
+    bufpool_put(buf4, pool);
+    buf1 = bufpool_get(pool, &allocated);
+    ck_assert(!allocated);
+    buf2 = bufpool_get(pool, &allocated);
+    ck_assert(!allocated);
+    buf3 = bufpool_get(pool, &allocated);
+    ck_assert(allocated);
+    bufpool_put(buf1, pool);
+    bufpool_put(buf2, pool);
+    bufpool_put(buf3, pool);
+
+    bufpool_free(&pool);
+    ck_assert_ptr_eq(pool, NULL);
+}
+END_TEST
+
+/**
+ * Buffers can be returned after the pool was freed
+ */
+START_TEST(test_bufpool_free_in_use)
+{
+    struct bufpool *pool = bufpool_new(64, 4);
+    struct bufpool *pool_ref = pool;
+
+    void *buf1 = bufpool_get(pool, NULL);
+    void *buf2 = bufpool_get(pool, NULL);
+    bufpool_put(buf1, pool);
+    bufpool_free(&pool);
+    ck_assert_ptr_eq(pool, NULL);
+
+    // the pool is destroyed with the last buffer (checked by valgrind)
+    memset(buf2, 0, 64);
+    bufpool_put(buf2, pool_ref);
+}
+END_TEST
+
+#define THREAD_BUFS 1000
+
+static void *put_thread(void *bufs_void)
+{
+    void **bufs = bufs_void;
+    for (int i = 0; i < THREAD_BUFS; i++) {
+        bufpool_put(bufs[i], bufs[THREAD_BUFS]);
+    }
+    return NULL;
+}
+
+/**
+ * Buffers are returned from other threads
+ */
+START_TEST(test_bufpool_threads)
+{
+    struct bufpool *pool = bufpool_new(16, 8);
+
+    void *bufs[2][THREAD_BUFS + 1];
+    for (int t = 0; t < 2; t++) {
+        for (int i = 0; i < THREAD_BUFS; i++) {
+            bufs[t][i] = bufpool_get(pool, NULL);
+        }
+        bufs[t][THREAD_BUFS] = pool;
+    }
+
+    pthread_t threads[2];
+    for (int t = 0; t < 2; t++) {
+        int rv = pthread_create(&threads[t], NULL, put_thread, bufs[t]);
+        ck_assert_int_eq(rv, 0);
+    }
+    for (int i = 0; i < THREAD_BUFS; i++) {
+        bufpool_put(bufpool_get(pool, NULL), pool);
+    }
+    bufpool_free(&pool);
+    for (int t = 0; t < 2; t++) {
+        pthread_join(threads[t], NULL);
+    }
+}
+END_TEST
+
+Suite *suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_bufpool_reuse);
+    tcase_add_test(tc_core, test_bufpool_free_in_use);
+    tcase_add_test(tc_core, test_bufpool_threads);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
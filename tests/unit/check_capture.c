@@ -0,0 +1,210 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TEST_SUITE_NAME "check_capture"
+
+#include "testutil.h"
+
+#include <czmq.h>
+#include <osd/capture.h>
+#include <osd/osd.h>
+#include <osd/packet.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "capture.h"
+
+static char capture_file[] = "/tmp/osd-check-capture-XXXXXX";
+
+/**
+ * Test fixture: create an empty capture file (called before each test)
+ */
+static void setup(void)
+{
+    int fd = mkstemp(capture_file);
+    ck_assert_int_ne(fd, -1);
+    close(fd);
+}
+
+/**
+ * Test fixture: remove the capture file (called after each test)
+ */
+static void teardown(void)
+{
+    unlink(capture_file);
+    strcpy(capture_file + strlen(capture_file) - 6, "XXXXXX");
+}
+
+static void write_file(const void *data, size_t size)
+{
+    FILE *f = fopen(capture_file, "wb");
+    ck_assert_ptr_ne(f, NULL);
+    ck_assert_uint_eq(fwrite(data, 1, size, f), size);
+    fclose(f);
+}
+
+static zframe_t *packet_frame_new(uint16_t dest, uint16_t src,
+                                  uint16_t payload)
+{
+    struct osd_packet *pkg;
+    osd_result rv =
+        osd_packet_new(&pkg, osd_packet_get_data_size_words_from_payload(1));
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_packet_set_header(pkg, dest, src, OSD_PACKET_TYPE_EVENT, 0);
+    pkg->data.payload[0] = payload;
+
+    zframe_t *frame = zframe_new(pkg->data_raw, osd_packet_sizeof(pkg));
+    osd_packet_free(&pkg);
+    return frame;
+}
+
+/**
+ * Records written by the host controller can be read back in order
+ */
+START_TEST(test_capture_roundtrip)
+{
+    osd_result rv;
+    struct capture_writer *writer;
+
+    rv = capture_writer_new(&writer, NULL, capture_file);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    zframe_t *src = zframe_new("src", 3);
+    zframe_t *dest = zframe_new("destination", 11);
+    for (uint16_t i = 0; i < 100; i++) {
+        zframe_t *packet = packet_frame_new(0x0001, 0x0102, i);
+        rv = capture_writer_record(writer, src, dest, packet);
+        ck_assert_int_eq(rv, OSD_OK);
+        zframe_destroy(&packet);
+    }
+    zframe_destroy(&src);
+    zframe_destroy(&dest);
+
+    // all queued records are written when the writer is freed
+    capture_writer_free(&writer);
+    ck_assert_ptr_eq(writer, NULL);
+
+    struct osd_capture_reader *reader;
+    rv = osd_capture_reader_new(&reader, NULL, capture_file);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    // read the capture twice to check rewinding
+    for (int pass = 0; pass < 2; pass++) {
+        struct osd_capture_record record;
+        uint64_t last_timestamp = 0;
+        for (uint16_t i = 0; i < 100; i++) {
+            rv = osd_capture_reader_next(reader, &record);
+            ck_assert_int_eq(rv, OSD_OK);
+            ck_assert_ptr_ne(record.packet, NULL);
+
+            ck_assert_uint_ge(record.timestamp_ns, last_timestamp);
+            last_timestamp = record.timestamp_ns;
+            ck_assert_uint_eq(record.src_identity_len, 3);
+            ck_assert_int_eq(memcmp(record.src_identity, "src", 3), 0);
+            ck_assert_uint_eq(record.dest_identity_len, 11);
+            ck_assert_int_eq(
+                memcmp(record.dest_identity, "destination", 11), 0);
+
+            ck_assert_uint_eq(osd_packet_get_dest(record.packet), 0x0001);
+            ck_assert_uint_eq(osd_packet_get_src(record.packet), 0x0102);
+            ck_assert_uint_eq(record.packet->data.payload[0], i);
+            osd_packet_free(&record.packet);
+        }
+
+        rv = osd_capture_reader_next(reader, &record);
+        ck_assert_int_eq(rv, OSD_OK);
+        ck_assert_ptr_eq(record.packet, NULL);
+
+        rv = osd_capture_reader_rewind(reader);
+        ck_assert_int_eq(rv, OSD_OK);
+    }
+
+    osd_capture_reader_free(&reader);
+    ck_assert_ptr_eq(reader, NULL);
+}
+END_TEST
+
+START_TEST(test_capture_reader_invalid_magic)
+{
+    osd_result rv;
+    struct osd_capture_reader *reader;
+
+    // empty file
+    rv = osd_capture_reader_new(&reader, NULL, capture_file);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    write_file("OSDCAP\0\2", 8);
+    rv = osd_capture_reader_new(&reader, NULL, capture_file);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    rv = osd_capture_reader_new(&reader, NULL, "/nonexistent/capture");
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+}
+END_TEST
+
+START_TEST(test_capture_reader_truncated)
+{
+    osd_result rv;
+    struct osd_capture_reader *reader;
+    struct osd_capture_record record;
+
+    // record header announcing a 6 byte packet and a 1 byte source identity,
+    // but only the identity and 2 bytes of the packet follow
+    const uint8_t data[] = {
+        'O', 'S', 'D', 'C', 'A', 'P', 0, 1,      // magic
+        0x10, 0, 0, 0, 0, 0, 0, 0, 6, 0, 1, 0,  // header
+        'a',                                    // source identity
+        0x01, 0x00,                             // packet
+    };
+    write_file(data, sizeof(data));
+
+    rv = osd_capture_reader_new(&reader, NULL, capture_file);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_capture_reader_next(reader, &record);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+    ck_assert_ptr_eq(record.packet, NULL);
+    osd_capture_reader_free(&reader);
+
+    // packet too small to hold the DI header
+    const uint8_t data_small[] = {
+        'O', 'S', 'D', 'C', 'A', 'P', 0, 1,
+        0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 0, 0,
+        0x01, 0x00,
+    };
+    write_file(data_small, sizeof(data_small));
+
+    rv = osd_capture_reader_new(&reader, NULL, capture_file);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_capture_reader_next(reader, &record);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+    osd_capture_reader_free(&reader);
+}
+END_TEST
+
+Suite *suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    tc_core = tcase_create("Core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_capture_roundtrip);
+    tcase_add_test(tc_core, test_capture_reader_invalid_magic);
+    tcase_add_test(tc_core, test_capture_reader_truncated);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
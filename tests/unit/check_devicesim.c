@@ -0,0 +1,244 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TEST_SUITE_NAME "check_devicesim"
+
+#include "testutil.h"
+
+#include <osd/devicesim.h>
+#include <osd/module.h>
+#include <osd/osd.h>
+#include <osd/packet.h>
+#include <osd/reg.h>
+
+#define DEVICE_SUBNET 1
+#define HOST_ADDR 0x0005
+
+static struct osd_devicesim_ctx *devicesim_ctx;
+
+/**
+ * Test fixture: setup (called before each test)
+ */
+static void setup(void)
+{
+    struct osd_devicesim_config config;
+    osd_devicesim_config_init(&config);
+    config.subnet_addr = DEVICE_SUBNET;
+    config.mem_size = 1024;
+    config.event_payload_min = 2;
+    config.event_payload_max = 4;
+
+    osd_result rv = osd_devicesim_new(&devicesim_ctx, NULL, &config);
+    ck_assert_int_eq(rv, OSD_OK);
+}
+
+/**
+ * Test fixture: teardown (called after each test)
+ */
+static void teardown(void)
+{
+    osd_devicesim_free(&devicesim_ctx);
+    ck_assert_ptr_eq(devicesim_ctx, NULL);
+}
+
+static void write_packet(unsigned int local_addr, unsigned int type,
+                         unsigned int type_sub, const uint16_t *payload,
+                         size_t payload_words)
+{
+    struct osd_packet *pkg;
+    osd_result rv = osd_packet_new(
+        &pkg, osd_packet_get_data_size_words_from_payload(payload_words));
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_packet_set_header(pkg, osd_diaddr_build(DEVICE_SUBNET, local_addr),
+                          HOST_ADDR, type, type_sub);
+    for (size_t i = 0; i < payload_words; i++) {
+        pkg->data.payload[i] = payload[i];
+    }
+
+    rv = osd_devicesim_packet_write(pkg, devicesim_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_packet_free(&pkg);
+}
+
+static struct osd_packet *read_packet(void)
+{
+    struct osd_packet *pkg;
+    osd_result rv = osd_devicesim_packet_read(&pkg, devicesim_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_ptr_ne(pkg, NULL);
+    return pkg;
+}
+
+static uint16_t reg_read(unsigned int local_addr, uint16_t reg_addr)
+{
+    write_packet(local_addr, OSD_PACKET_TYPE_REG, REQ_READ_REG_16, &reg_addr,
+                 1);
+
+    struct osd_packet *pkg = read_packet();
+    ck_assert_uint_eq(osd_packet_get_type(pkg), OSD_PACKET_TYPE_REG);
+    ck_assert_uint_eq(osd_packet_get_type_sub(pkg), RESP_READ_REG_SUCCESS_16);
+    ck_assert_uint_eq(osd_packet_get_dest(pkg), HOST_ADDR);
+    ck_assert_uint_eq(osd_packet_get_src(pkg),
+                      osd_diaddr_build(DEVICE_SUBNET, local_addr));
+    uint16_t value = pkg->data.payload[0];
+    osd_packet_free(&pkg);
+    return value;
+}
+
+static void reg_write(unsigned int local_addr, uint16_t reg_addr,
+                      uint16_t value)
+{
+    uint16_t payload[2] = {reg_addr, value};
+    write_packet(local_addr, OSD_PACKET_TYPE_REG, REQ_WRITE_REG_16, payload,
+                 2);
+
+    struct osd_packet *pkg = read_packet();
+    ck_assert_uint_eq(osd_packet_get_type_sub(pkg), RESP_WRITE_REG_SUCCESS);
+    osd_packet_free(&pkg);
+}
+
+START_TEST(test_devicesim_scm)
+{
+    ck_assert_uint_eq(reg_read(0, OSD_REG_BASE_MOD_VENDOR),
+                      OSD_MODULE_VENDOR_OSD);
+    ck_assert_uint_eq(reg_read(0, OSD_REG_BASE_MOD_TYPE),
+                      OSD_MODULE_TYPE_STD_SCM);
+    // SCM, MAM, STM, CTM
+    ck_assert_uint_eq(reg_read(0, OSD_REG_SCM_NUM_MOD), 4);
+    ck_assert_uint_eq(reg_read(0, OSD_REG_SCM_MAX_PKT_LEN), 64);
+
+    ck_assert_uint_eq(reg_read(1, OSD_REG_BASE_MOD_TYPE),
+                      OSD_MODULE_TYPE_STD_MAM);
+    ck_assert_uint_eq(reg_read(2, OSD_REG_BASE_MOD_TYPE),
+                      OSD_MODULE_TYPE_STD_STM);
+    ck_assert_uint_eq(reg_read(3, OSD_REG_BASE_MOD_TYPE),
+                      OSD_MODULE_TYPE_STD_CTM);
+}
+END_TEST
+
+START_TEST(test_devicesim_reg_error)
+{
+    uint16_t reg_addr = 0x0123;
+    write_packet(0, OSD_PACKET_TYPE_REG, REQ_READ_REG_16, &reg_addr, 1);
+    struct osd_packet *pkg = read_packet();
+    ck_assert_uint_eq(osd_packet_get_type_sub(pkg), RESP_READ_REG_ERROR);
+    osd_packet_free(&pkg);
+
+    // the SCM has no writable register at this address
+    uint16_t payload[2] = {OSD_REG_SCM_NUM_MOD, 1};
+    write_packet(0, OSD_PACKET_TYPE_REG, REQ_WRITE_REG_16, payload, 2);
+    pkg = read_packet();
+    ck_assert_uint_eq(osd_packet_get_type_sub(pkg), RESP_WRITE_REG_ERROR);
+    osd_packet_free(&pkg);
+
+    struct osd_devicesim_stats stats;
+    osd_devicesim_get_stats(devicesim_ctx, &stats);
+    ck_assert_uint_eq(stats.reg_accesses, 2);
+}
+END_TEST
+
+START_TEST(test_devicesim_mem)
+{
+    // acknowledged write of 3 words to address 0x10
+    uint16_t wr[] = {0x8000 | 0x4000 | 3, 0x0000, 0x0010,
+                     0x1234, 0x5678, 0x9abc};
+    write_packet(1, OSD_PACKET_TYPE_PLAIN, 0, wr, 6);
+    struct osd_packet *pkg = read_packet();
+    ck_assert_uint_eq(osd_packet_get_type(pkg), OSD_PACKET_TYPE_PLAIN);
+    ck_assert_uint_eq(pkg->data_size_words, 3);
+    osd_packet_free(&pkg);
+
+    // read back the last two words
+    uint16_t rd[] = {2, 0x0000, 0x0012};
+    write_packet(1, OSD_PACKET_TYPE_PLAIN, 0, rd, 3);
+    pkg = read_packet();
+    ck_assert_uint_eq(osd_packet_get_type(pkg), OSD_PACKET_TYPE_PLAIN);
+    ck_assert_uint_eq(pkg->data_size_words, 3 + 2);
+    ck_assert_uint_eq(pkg->data.payload[0], 0x5678);
+    ck_assert_uint_eq(pkg->data.payload[1], 0x9abc);
+    osd_packet_free(&pkg);
+
+    struct osd_devicesim_stats stats;
+    osd_devicesim_get_stats(devicesim_ctx, &stats);
+    ck_assert_uint_eq(stats.mem_bytes, 10);
+}
+END_TEST
+
+START_TEST(test_devicesim_trace)
+{
+    struct osd_packet *pkg;
+
+    // activate the STM
+    reg_write(2, OSD_REG_BASE_MOD_EVENT_DEST, HOST_ADDR);
+    reg_write(2, OSD_REG_BASE_MOD_CS, OSD_REG_BASE_MOD_CS_ACTIVE);
+
+    for (uint16_t i = 0; i < 10; i++) {
+        pkg = read_packet();
+        ck_assert_uint_eq(osd_packet_get_type(pkg), OSD_PACKET_TYPE_EVENT);
+        ck_assert_uint_eq(osd_packet_get_src(pkg),
+                          osd_diaddr_build(DEVICE_SUBNET, 2));
+        ck_assert_uint_eq(osd_packet_get_dest(pkg), HOST_ADDR);
+        ck_assert_uint_ge(pkg->data_size_words, 3 + 2);
+        ck_assert_uint_le(pkg->data_size_words, 3 + 4);
+        ck_assert_uint_eq(pkg->data.payload[0], i);
+        osd_packet_free(&pkg);
+    }
+
+    // register accesses are still answered while tracing
+    ck_assert_uint_eq(reg_read(2, OSD_REG_BASE_MOD_CS),
+                      OSD_REG_BASE_MOD_CS_ACTIVE);
+
+    struct osd_devicesim_stats stats;
+    osd_devicesim_get_stats(devicesim_ctx, &stats);
+    ck_assert_uint_ge(stats.events_sent, 10);
+}
+END_TEST
+
+START_TEST(test_devicesim_config)
+{
+    osd_result rv;
+    struct osd_devicesim_ctx *ctx;
+    struct osd_devicesim_config config;
+
+    osd_devicesim_config_init(&config);
+    config.event_payload_min = 0;
+    rv = osd_devicesim_new(&ctx, NULL, &config);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    osd_devicesim_config_init(&config);
+    config.event_payload_max = 62;
+    rv = osd_devicesim_new(&ctx, NULL, &config);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+}
+END_TEST
+
+Suite *suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    tc_core = tcase_create("Core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_devicesim_scm);
+    tcase_add_test(tc_core, test_devicesim_reg_error);
+    tcase_add_test(tc_core, test_devicesim_mem);
+    tcase_add_test(tc_core, test_devicesim_trace);
+    tcase_add_test(tc_core, test_devicesim_config);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,229 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TEST_SUITE_NAME "check_dtdstream"
+
+#include "testutil.h"
+
+#include <osd/osd.h>
+#include <osd/packet.h>
+#include "dtdstream.h"
+
+/** Number of packets in the test stream */
+#define STREAM_PACKETS 3
+
+/**
+ * Size of the test stream (bytes): packets with 1, 0 and 5 payload words,
+ * each preceded by its size
+ */
+#define STREAM_BYTES ((4 + 1) * 2 + (3 + 1) * 2 + (8 + 1) * 2)
+
+static const size_t stream_payload_words[STREAM_PACKETS] = {1, 0, 5};
+
+/**
+ * Build the test stream: the payload words are numbered consecutively
+ */
+static void build_stream(uint8_t *stream)
+{
+    size_t pos = 0;
+    uint16_t value = 0x1234;
+    for (int p = 0; p < STREAM_PACKETS; p++) {
+        uint16_t size = 3 + stream_payload_words[p];
+        stream[pos++] = size >> 8;
+        stream[pos++] = size & 0xff;
+        for (uint16_t w = 0; w < size; w++) {
+            stream[pos++] = value >> 8;
+            stream[pos++] = value & 0xff;
+            value += 0x0101;
+        }
+    }
+    ck_assert_uint_eq(pos, STREAM_BYTES);
+}
+
+/**
+ * Check the packets parsed from the test stream
+ */
+static void check_packets(struct osd_packet **pkgs)
+{
+    uint16_t value = 0x1234;
+    for (int p = 0; p < STREAM_PACKETS; p++) {
+        ck_assert_ptr_ne(pkgs[p], NULL);
+        ck_assert_uint_eq(pkgs[p]->data_size_words,
+                          3 + stream_payload_words[p]);
+        for (size_t w = 0; w < pkgs[p]->data_size_words; w++) {
+            ck_assert_uint_eq(pkgs[p]->data_raw[w], value);
+            value += 0x0101;
+        }
+        osd_packet_free(&pkgs[p]);
+    }
+}
+
+/**
+ * Parse a buffer completely, collecting the packets
+ */
+static void parse_all(struct dtdstream *s, const uint8_t *data, size_t len,
+                      struct osd_packet **pkgs, int *pkgs_count)
+{
+    size_t pos = 0;
+    while (pos < len) {
+        struct osd_packet *pkg;
+        size_t consumed = dtdstream_parse(s, data + pos, len - pos, &pkg);
+        ck_assert_uint_gt(consumed, 0);
+        pos += consumed;
+        if (pkg) {
+            ck_assert_int_lt(*pkgs_count, STREAM_PACKETS);
+            pkgs[(*pkgs_count)++] = pkg;
+        }
+    }
+}
+
+/**
+ * All packets are parsed from one buffer, one packet per call
+ */
+START_TEST(test_dtdstream_single_buffer)
+{
+    uint8_t stream[STREAM_BYTES];
+    build_stream(stream);
+
+    struct dtdstream s;
+    dtdstream_init(&s);
+
+    struct osd_packet *pkgs[STREAM_PACKETS];
+    size_t pos = 0;
+    for (int p = 0; p < STREAM_PACKETS; p++) {
+        size_t consumed =
+            dtdstream_parse(&s, stream + pos, STREAM_BYTES - pos, &pkgs[p]);
+        ck_assert_uint_eq(consumed, (3 + stream_payload_words[p] + 1) * 2);
+        pos += consumed;
+    }
+    ck_assert_uint_eq(pos, STREAM_BYTES);
+    check_packets(pkgs);
+    ck_assert_uint_eq(s.invalid, 0);
+    dtdstream_reset(&s);
+}
+END_TEST
+
+/**
+ * Packets split between two buffers at any byte are reassembled
+ */
+START_TEST(test_dtdstream_split)
+{
+    uint8_t stream[STREAM_BYTES];
+    build_stream(stream);
+
+    for (size_t split = 1; split < STREAM_BYTES; split++) {
+        struct dtdstream s;
+        dtdstream_init(&s);
+
+        struct osd_packet *pkgs[STREAM_PACKETS];
+        int pkgs_count = 0;
+        parse_all(&s, stream, split, pkgs, &pkgs_count);
+        parse_all(&s, stream + split, STREAM_BYTES - split, pkgs,
+                  &pkgs_count);
+        ck_assert_int_eq(pkgs_count, STREAM_PACKETS);
+        check_packets(pkgs);
+        dtdstream_reset(&s);
+    }
+}
+END_TEST
+
+/**
+ * The stream is parsed one byte at a time
+ */
+START_TEST(test_dtdstream_bytewise)
+{
+    uint8_t stream[STREAM_BYTES];
+    build_stream(stream);
+
+    struct dtdstream s;
+    dtdstream_init(&s);
+
+    struct osd_packet *pkgs[STREAM_PACKETS];
+    int pkgs_count = 0;
+    for (size_t pos = 0; pos < STREAM_BYTES; pos++) {
+        parse_all(&s, stream + pos, 1, pkgs, &pkgs_count);
+    }
+    ck_assert_int_eq(pkgs_count, STREAM_PACKETS);
+    check_packets(pkgs);
+    dtdstream_reset(&s);
+}
+END_TEST
+
+/**
+ * DTDs shorter than a packet header are skipped and counted
+ */
+START_TEST(test_dtdstream_invalid)
+{
+    uint8_t stream[8 + STREAM_BYTES];
+    // a DTD of two words, followed by an empty DTD
+    const uint8_t invalid[] = {0x00, 0x02, 0xab, 0xcd, 0xef, 0x01, 0x00, 0x00};
+    memcpy(stream, invalid, sizeof(invalid));
+    build_stream(stream + sizeof(invalid));
+
+    struct dtdstream s;
+    dtdstream_init(&s);
+
+    struct osd_packet *pkgs[STREAM_PACKETS];
+    int pkgs_count = 0;
+    parse_all(&s, stream, sizeof(invalid) + STREAM_BYTES, pkgs, &pkgs_count);
+    ck_assert_int_eq(pkgs_count, STREAM_PACKETS);
+    check_packets(pkgs);
+    ck_assert_uint_eq(s.invalid, 2);
+    dtdstream_reset(&s);
+}
+END_TEST
+
+/**
+ * A reset drops a partially received packet
+ */
+START_TEST(test_dtdstream_reset)
+{
+    uint8_t stream[STREAM_BYTES];
+    build_stream(stream);
+
+    struct dtdstream s;
+    dtdstream_init(&s);
+
+    struct osd_packet *pkg;
+    ck_assert_uint_eq(dtdstream_parse(&s, stream, 5, &pkg), 5);
+    ck_assert_ptr_eq(pkg, NULL);
+    dtdstream_reset(&s);
+
+    struct osd_packet *pkgs[STREAM_PACKETS];
+    int pkgs_count = 0;
+    parse_all(&s, stream, STREAM_BYTES, pkgs, &pkgs_count);
+    ck_assert_int_eq(pkgs_count, STREAM_PACKETS);
+    check_packets(pkgs);
+    dtdstream_reset(&s);
+}
+END_TEST
+
+Suite *suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_dtdstream_single_buffer);
+    tcase_add_test(tc_core, test_dtdstream_split);
+    tcase_add_test(tc_core, test_dtdstream_bytewise);
+    tcase_add_test(tc_core, test_dtdstream_invalid);
+    tcase_add_test(tc_core, test_dtdstream_reset);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,273 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TEST_SUITE_NAME "check_flightrec"
+
+#include "testutil.h"
+
+#include <czmq.h>
+#include <osd/capture.h>
+#include <osd/osd.h>
+#include <osd/packet.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "flightrec.h"
+
+#define DUMP_FILENAME "/tmp/osd-check-flightrec"
+
+static zframe_t *src_frame;
+static zframe_t *dest_frame;
+
+/**
+ * Test fixture: setup (called before each test)
+ */
+static void setup(void)
+{
+    src_frame = zframe_new("src", 3);
+    dest_frame = zframe_new("dest", 4);
+}
+
+/**
+ * Test fixture: teardown (called after each test)
+ */
+static void teardown(void)
+{
+    zframe_destroy(&src_frame);
+    zframe_destroy(&dest_frame);
+    unlink(DUMP_FILENAME ".0");
+    unlink(DUMP_FILENAME ".1");
+}
+
+static struct osd_packet *packet_new(unsigned int type, unsigned int type_sub,
+                                     uint16_t payload)
+{
+    struct osd_packet *pkg;
+    osd_result rv =
+        osd_packet_new(&pkg, osd_packet_get_data_size_words_from_payload(1));
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_packet_set_header(pkg, 0x0001, 0x0002, type, type_sub);
+    pkg->data.payload[0] = payload;
+    return pkg;
+}
+
+static bool record_packet(struct flightrec *fr, uint16_t payload)
+{
+    struct osd_packet *pkg = packet_new(OSD_PACKET_TYPE_EVENT, 0, payload);
+    zframe_t *frame = zframe_new(pkg->data_raw, osd_packet_sizeof(pkg));
+    bool window_complete = flightrec_record(fr, src_frame, dest_frame, frame);
+    zframe_destroy(&frame);
+    osd_packet_free(&pkg);
+    return window_complete;
+}
+
+/**
+ * Read a dump and check that it contains consecutive payloads ending with
+ * @p last_payload
+ *
+ * @return the number of records in the dump
+ */
+static unsigned int check_dump(const char *filename, uint16_t last_payload)
+{
+    osd_result rv;
+    struct osd_capture_reader *reader;
+    rv = osd_capture_reader_new(&reader, NULL, filename);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    unsigned int count = 0;
+    uint16_t payload = 0;
+    uint64_t last_timestamp = 0;
+    struct osd_capture_record record;
+    while (1) {
+        rv = osd_capture_reader_next(reader, &record);
+        ck_assert_int_eq(rv, OSD_OK);
+        if (!record.packet) {
+            break;
+        }
+
+        if (count == 0) {
+            ck_assert_uint_eq(record.timestamp_ns, 0);
+        } else {
+            ck_assert_uint_ge(record.timestamp_ns, last_timestamp);
+            ck_assert_uint_eq(record.packet->data.payload[0],
+                              (uint16_t)(payload + 1));
+        }
+        last_timestamp = record.timestamp_ns;
+        payload = record.packet->data.payload[0];
+        ck_assert_uint_eq(record.src_identity_len, 3);
+        ck_assert_uint_eq(record.dest_identity_len, 4);
+
+        osd_packet_free(&record.packet);
+        count++;
+    }
+    if (count) {
+        ck_assert_uint_eq(payload, last_payload);
+    }
+
+    osd_capture_reader_free(&reader);
+    return count;
+}
+
+START_TEST(test_flightrec_dump)
+{
+    osd_result rv;
+    struct flightrec *fr;
+
+    rv = flightrec_new(&fr, NULL, FLIGHTREC_SIZE_MIN, DUMP_FILENAME);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    // an empty flight recorder gives an empty dump
+    rv = flightrec_dump(fr);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    for (uint16_t i = 0; i < 10; i++) {
+        record_packet(fr, i);
+    }
+
+    // wait for the first dump to be written
+    while (flightrec_dump(fr) != OSD_OK) {
+        usleep(1000);
+    }
+    flightrec_free(&fr);
+    ck_assert_ptr_eq(fr, NULL);
+
+    ck_assert_uint_eq(check_dump(DUMP_FILENAME ".0", 0), 0);
+    ck_assert_uint_eq(check_dump(DUMP_FILENAME ".1", 9), 10);
+}
+END_TEST
+
+/**
+ * Once the ring is full, the oldest packets are overwritten
+ */
+START_TEST(test_flightrec_wrap)
+{
+    osd_result rv;
+    struct flightrec *fr;
+
+    rv = flightrec_new(&fr, NULL, FLIGHTREC_SIZE_MIN, DUMP_FILENAME);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    // every record is 12 + 3 + 4 + 8 = 27 bytes; record the buffer size
+    // more than 10 times
+    const uint16_t packets = 30000;
+    for (uint16_t i = 0; i < packets; i++) {
+        record_packet(fr, i);
+    }
+    rv = flightrec_dump(fr);
+    ck_assert_int_eq(rv, OSD_OK);
+    flightrec_free(&fr);
+
+    unsigned int count = check_dump(DUMP_FILENAME ".0", packets - 1);
+    ck_assert_uint_le(count * 27, FLIGHTREC_SIZE_MIN);
+    ck_assert_uint_gt(count * 27, FLIGHTREC_SIZE_MIN - 2 * 27);
+}
+END_TEST
+
+/**
+ * An armed window is dumped instead of the whole ring
+ */
+START_TEST(test_flightrec_window)
+{
+    osd_result rv;
+    struct flightrec *fr;
+
+    rv = flightrec_new(&fr, NULL, FLIGHTREC_SIZE_MIN, DUMP_FILENAME);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    for (uint16_t i = 0; i < 100; i++) {
+        ck_assert(!record_packet(fr, i));
+    }
+    ck_assert(!flightrec_is_armed(fr));
+    ck_assert_int_eq(flightrec_arm(fr, 5, 3), OSD_OK);
+    ck_assert(flightrec_is_armed(fr));
+    ck_assert_int_eq(flightrec_arm(fr, 5, 3), OSD_ERROR_FAILURE);
+    ck_assert(!record_packet(fr, 100));
+    ck_assert(!record_packet(fr, 101));
+    ck_assert(record_packet(fr, 102));
+
+    rv = flightrec_dump(fr);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert(!flightrec_is_armed(fr));
+
+    // a window in a wrapped ring, dumped without records after the trigger
+    for (uint16_t i = 0; i < 30000; i++) {
+        record_packet(fr, i);
+    }
+    ck_assert_int_eq(flightrec_arm(fr, 10, 0), OSD_OK);
+    while (flightrec_dump(fr) != OSD_OK) {
+        usleep(1000);
+    }
+    flightrec_free(&fr);
+
+    ck_assert_uint_eq(check_dump(DUMP_FILENAME ".0", 102), 8);
+    ck_assert_uint_eq(check_dump(DUMP_FILENAME ".1", 29999), 10);
+}
+END_TEST
+
+START_TEST(test_flightrec_trigger)
+{
+    osd_result rv;
+    struct flightrec *fr;
+
+    rv = flightrec_new(&fr, NULL, FLIGHTREC_SIZE_MIN, DUMP_FILENAME);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    struct osd_packet *read_error =
+        packet_new(OSD_PACKET_TYPE_REG, RESP_READ_REG_ERROR, 0);
+    struct osd_packet *read_success =
+        packet_new(OSD_PACKET_TYPE_REG, RESP_READ_REG_SUCCESS_16, 0);
+    struct osd_packet *event = packet_new(OSD_PACKET_TYPE_EVENT, 0, 0);
+
+    ck_assert(!flightrec_is_trigger(fr, read_error));
+
+    flightrec_add_trigger(fr, OSD_PACKET_TYPE_REG, RESP_READ_REG_ERROR);
+    ck_assert(flightrec_is_trigger(fr, read_error));
+    ck_assert(!flightrec_is_trigger(fr, read_success));
+    ck_assert(!flightrec_is_trigger(fr, event));
+
+    osd_packet_free(&read_error);
+    osd_packet_free(&read_success);
+    osd_packet_free(&event);
+    flightrec_free(&fr);
+}
+END_TEST
+
+START_TEST(test_flightrec_size)
+{
+    osd_result rv;
+    struct flightrec *fr;
+
+    rv = flightrec_new(&fr, NULL, FLIGHTREC_SIZE_MIN - 1, DUMP_FILENAME);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+}
+END_TEST
+
+Suite *suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    tc_core = tcase_create("Core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_flightrec_dump);
+    tcase_add_test(tc_core, test_flightrec_wrap);
+    tcase_add_test(tc_core, test_flightrec_window);
+    tcase_add_test(tc_core, test_flightrec_trigger);
+    tcase_add_test(tc_core, test_flightrec_size);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
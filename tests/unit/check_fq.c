@@ -0,0 +1,189 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TEST_SUITE_NAME "check_fq"
+
+#include "testutil.h"
+
+#include <czmq.h>
+#include "fq.h"
+
+/**
+ * Test items are the item sizes (in bytes)
+ */
+static size_t item_size(const void *item)
+{
+    return *(const size_t *)item;
+}
+
+static void fq_clear(struct fq *fq)
+{
+    while (fq_pop_any(fq, NULL)) {
+    }
+}
+
+START_TEST(test_fq_fifo)
+{
+    size_t items[10];
+    struct fq *fq = fq_new(item_size, 100);
+
+    ck_assert_ptr_eq(fq_peek(fq, NULL), NULL);
+    ck_assert_ptr_eq(fq_dequeue(fq, NULL), NULL);
+
+    for (int i = 0; i < 10; i++) {
+        items[i] = 1000;
+        ck_assert_int_eq(fq_enqueue(fq, NULL, &items[i]), 0);
+    }
+    ck_assert_uint_eq(fq_size(fq), 10);
+
+    // a single source gets all items in order, even if they are larger than
+    // the quantum
+    const void *src = &items;
+    for (int i = 0; i < 10; i++) {
+        ck_assert_ptr_eq(fq_peek(fq, NULL), &items[i]);
+        ck_assert_ptr_eq(fq_dequeue(fq, &src), &items[i]);
+        ck_assert_ptr_eq(src, NULL);
+    }
+    ck_assert_uint_eq(fq_size(fq), 0);
+
+    fq_free(&fq);
+    ck_assert_ptr_eq(fq, NULL);
+}
+END_TEST
+
+/**
+ * A source sending large items gets the same share of bytes as a source
+ * sending small items
+ */
+START_TEST(test_fq_drr_fairness)
+{
+    size_t items_a[50];
+    size_t items_b[500];
+    const char *src_a = "a";
+    const char *src_b = "b";
+    struct fq *fq = fq_new(item_size, 1000);
+
+    for (int i = 0; i < 50; i++) {
+        items_a[i] = 1000;
+        ck_assert_int_eq(fq_enqueue(fq, src_a, &items_a[i]), 0);
+    }
+    for (int i = 0; i < 500; i++) {
+        items_b[i] = 100;
+        ck_assert_int_eq(fq_enqueue(fq, src_b, &items_b[i]), 0);
+    }
+    ck_assert_uint_eq(fq_src_size(fq, src_a), 50);
+    ck_assert_uint_eq(fq_src_size(fq, src_b), 500);
+
+    size_t bytes_a = 0, bytes_b = 0;
+    while (bytes_a + bytes_b < 20000) {
+        const void *src;
+        size_t *item = fq_dequeue(fq, &src);
+        ck_assert_ptr_ne(item, NULL);
+        if (src == src_a) {
+            bytes_a += *item;
+        } else {
+            ck_assert_ptr_eq(src, src_b);
+            bytes_b += *item;
+        }
+    }
+
+    // the shares differ by at most one item plus one quantum
+    size_t diff = bytes_a > bytes_b ? bytes_a - bytes_b : bytes_b - bytes_a;
+    ck_assert_uint_le(diff, 1000 + FQ_QUANTUM);
+
+    fq_clear(fq);
+    fq_free(&fq);
+}
+END_TEST
+
+START_TEST(test_fq_flow_max)
+{
+    size_t items[5] = {1, 2, 3, 4, 5};
+    const char *src_a = "a";
+    const char *src_b = "b";
+    struct fq *fq = fq_new(item_size, 3);
+
+    for (int i = 0; i < 3; i++) {
+        ck_assert_int_eq(fq_enqueue(fq, src_a, &items[i]), 0);
+    }
+    // the flow of a is full, other sources are not affected
+    ck_assert_int_eq(fq_enqueue(fq, src_a, &items[3]), -1);
+    ck_assert_int_eq(fq_enqueue(fq, src_b, &items[4]), 0);
+    ck_assert_uint_eq(fq_size(fq), 4);
+
+    ck_assert_ptr_eq(fq_drop_oldest(fq, src_a), &items[0]);
+    ck_assert_int_eq(fq_enqueue(fq, src_a, &items[3]), 0);
+    ck_assert_uint_eq(fq_src_size(fq, src_a), 3);
+
+    ck_assert_ptr_eq(fq_drop_oldest(fq, src_b), &items[4]);
+    ck_assert_ptr_eq(fq_drop_oldest(fq, src_b), NULL);
+    ck_assert_uint_eq(fq_src_size(fq, src_b), 0);
+
+    fq_clear(fq);
+    ck_assert_uint_eq(fq_size(fq), 0);
+    fq_free(&fq);
+}
+END_TEST
+
+START_TEST(test_fq_forget_src)
+{
+    size_t items[4] = {10, 10, 10, 10};
+    const char *src_a = "a";
+    const char *src_b = "b";
+    struct fq *fq = fq_new(item_size, 100);
+
+    ck_assert_int_eq(fq_enqueue(fq, src_a, &items[0]), 0);
+    ck_assert_int_eq(fq_enqueue(fq, src_b, &items[1]), 0);
+
+    // no items of unknown senders queued yet
+    fq_forget_src(fq, src_a);
+    ck_assert_uint_eq(fq_src_size(fq, src_a), 0);
+    ck_assert_uint_eq(fq_src_size(fq, NULL), 1);
+
+    // merge into the flow of unknown senders
+    ck_assert_int_eq(fq_enqueue(fq, src_b, &items[2]), 0);
+    fq_forget_src(fq, src_b);
+    ck_assert_uint_eq(fq_src_size(fq, src_b), 0);
+    ck_assert_uint_eq(fq_src_size(fq, NULL), 3);
+    ck_assert_uint_eq(fq_size(fq), 3);
+
+    // the order within the merged flow is kept
+    const void *src = src_a;
+    ck_assert_ptr_eq(fq_dequeue(fq, &src), &items[0]);
+    ck_assert_ptr_eq(src, NULL);
+    ck_assert_ptr_eq(fq_dequeue(fq, NULL), &items[1]);
+    ck_assert_ptr_eq(fq_dequeue(fq, NULL), &items[2]);
+    ck_assert_ptr_eq(fq_dequeue(fq, NULL), NULL);
+
+    fq_free(&fq);
+}
+END_TEST
+
+Suite *suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_fq_fifo);
+    tcase_add_test(tc_core, test_fq_drr_fairness);
+    tcase_add_test(tc_core, test_fq_flow_max);
+    tcase_add_test(tc_core, test_fq_forget_src);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,604 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TEST_SUITE_NAME "check_gateway"
+
+#define TESTUTIL_STATS
+#include "testutil.h"
+
+#include <czmq.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <osd/gateway.h>
+#include <osd/hostctrl.h>
+#include <osd/hostmod.h>
+#include <osd/packet.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define HOSTCTRL_EP "inproc://testing"
+#define GATEWAY_STATS_EP "inproc://gateway-stats"
+#define DEVICE_SUBNET 1
+#define TRACE_PAYLOAD_WORDS 4
+
+/** Number of bursts of trace packets sent by the simulated device */
+#define TRACE_BURSTS 20
+
+/** Number of trace packets in a burst */
+#define TRACE_BURST_PACKETS 500
+
+struct osd_hostctrl_ctx *hostctrl_ctx;
+struct osd_hostmod_ctx *sink_ctx;
+struct osd_log_ctx *log_ctx;
+
+/** Simulated device: trace packets still to be generated */
+static unsigned int device_trace_remaining;
+
+/** Destination of the trace data */
+static uint16_t device_trace_dest;
+
+/** Number of trace packets received by the sink */
+static unsigned int trace_count;
+
+/** Bit mask of the subnets the simulated device was sent packets for */
+static uint64_t device_rx_subnets;
+
+/** Number of packets written to the simulated device */
+static unsigned int device_tx_packets;
+
+/** Time a batch write to the simulated device takes (us) */
+static unsigned int device_tx_delay_us;
+
+/**
+ * Simulated batched device read through a file descriptor: the pipe is
+ * readable while trace packets are waiting
+ */
+static int device_pipe[2] = {-1, -1};
+
+static osd_result trace_sink_handler(void *arg, struct osd_packet *pkg)
+{
+    __atomic_add_fetch(&trace_count, 1, __ATOMIC_RELAXED);
+    osd_packet_free(&pkg);
+    return OSD_OK;
+}
+
+static osd_result device_packet_write(const struct osd_packet *pkg,
+                                      void *cb_arg)
+{
+    unsigned int subnet = osd_diaddr_subnet(osd_packet_get_dest(pkg));
+    __atomic_or_fetch(&device_rx_subnets, 1ULL << subnet, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&device_tx_packets, 1, __ATOMIC_RELAXED);
+    return OSD_OK;
+}
+
+/**
+ * Simulated device: return trace packets as long as requested
+ */
+static osd_result device_packet_read(struct osd_packet **pkg, void *cb_arg)
+{
+    while (__atomic_load_n(&device_trace_remaining, __ATOMIC_RELAXED) == 0) {
+        usleep(100);
+    }
+    __atomic_sub_fetch(&device_trace_remaining, 1, __ATOMIC_RELAXED);
+
+    osd_result rv = osd_packet_new(
+        pkg, osd_packet_get_data_size_words_from_payload(TRACE_PAYLOAD_WORDS));
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_packet_set_header(*pkg, device_trace_dest,
+                          osd_diaddr_build(DEVICE_SUBNET, 2),
+                          OSD_PACKET_TYPE_EVENT, 0);
+    return OSD_OK;
+}
+
+/**
+ * Simulated device read through device_pipe: is a trace packet requested?
+ *
+ * If not, the pipe is emptied: trace packets requested from now on make it
+ * readable again.
+ */
+static bool device_pipe_trace_requested(void)
+{
+    if (__atomic_load_n(&device_trace_remaining, __ATOMIC_RELAXED)) {
+        return true;
+    }
+    char buf[16];
+    while (read(device_pipe[0], buf, sizeof(buf)) > 0) {
+    }
+    return __atomic_load_n(&device_trace_remaining, __ATOMIC_RELAXED) != 0;
+}
+
+/**
+ * Simulated device read through device_pipe: return a trace packet if one
+ * is requested, without blocking
+ */
+static osd_result device_packet_read_nonblocking(struct osd_packet **pkg,
+                                                 void *cb_arg)
+{
+    if (!device_pipe_trace_requested()) {
+        *pkg = NULL;
+        return OSD_OK;
+    }
+    return device_packet_read(pkg, cb_arg);
+}
+
+/**
+ * Simulated batched device: write a stream of packets
+ */
+static osd_result device_write_batch(const uint16_t *dtds, size_t size_words,
+                                     void *cb_arg)
+{
+    unsigned int delay_us =
+        __atomic_load_n(&device_tx_delay_us, __ATOMIC_RELAXED);
+    if (delay_us) {
+        usleep(delay_us);
+    }
+
+    size_t pos = 0;
+    while (pos < size_words) {
+        ck_assert_uint_ge(dtds[pos], 3);
+        device_packet_write((const struct osd_packet *)&dtds[pos], cb_arg);
+        pos += 1 + dtds[pos];
+    }
+    ck_assert_uint_eq(pos, size_words);
+    return OSD_OK;
+}
+
+/**
+ * Simulated batched device: return all requested trace packets which fit
+ *
+ * Blocks until trace packets are requested, unless the device is read
+ * through device_pipe.
+ */
+static osd_result device_read_batch(uint16_t *dtds, size_t max_words,
+                                    size_t *size_words, void *cb_arg)
+{
+    ck_assert_uint_ge(max_words, OSD_GATEWAY_READ_BATCH_MIN_WORDS);
+
+    unsigned int remaining;
+    while ((remaining = __atomic_load_n(&device_trace_remaining,
+                                        __ATOMIC_RELAXED)) == 0) {
+        if (device_pipe[0] != -1) {
+            if (device_pipe_trace_requested()) {
+                continue;
+            }
+            *size_words = 0;
+            return OSD_OK;
+        }
+        usleep(100);
+    }
+
+    uint16_t pkg_words =
+        osd_packet_get_data_size_words_from_payload(TRACE_PAYLOAD_WORDS);
+    unsigned int packets = max_words / (1 + pkg_words);
+    if (packets > remaining) {
+        packets = remaining;
+    }
+    __atomic_sub_fetch(&device_trace_remaining, packets, __ATOMIC_RELAXED);
+
+    uint16_t *dtd = dtds;
+    for (unsigned int i = 0; i < packets; i++) {
+        dtd[0] = pkg_words;
+        osd_packet_set_header((struct osd_packet *)dtd, device_trace_dest,
+                              osd_diaddr_build(DEVICE_SUBNET, 2),
+                              OSD_PACKET_TYPE_EVENT, 0);
+        memset(&dtd[4], 0, TRACE_PAYLOAD_WORDS * sizeof(uint16_t));
+        dtd += 1 + pkg_words;
+    }
+    *size_words = dtd - dtds;
+    return OSD_OK;
+}
+
+/**
+ * Let the simulated device send bursts of trace packets
+ *
+ * A burst is only started once the previous one arrived, which bounds the
+ * number of batches in flight.
+ */
+static void device_send_trace_bursts(void)
+{
+    unsigned int start = __atomic_load_n(&trace_count, __ATOMIC_RELAXED);
+    for (unsigned int i = 1; i <= TRACE_BURSTS; i++) {
+        __atomic_store_n(&device_trace_remaining, TRACE_BURST_PACKETS,
+                         __ATOMIC_RELAXED);
+        if (device_pipe[1] != -1) {
+            ssize_t written = write(device_pipe[1], "t", 1);
+            ck_assert_int_eq(written, 1);
+        }
+        while (__atomic_load_n(&trace_count, __ATOMIC_RELAXED) <
+               start + i * TRACE_BURST_PACKETS) {
+            usleep(100);
+        }
+    }
+}
+
+/**
+ * Send a packet to every subnet served by the gateway and wait for the
+ * simulated device to receive them
+ */
+static void device_check_tx(unsigned int subnets)
+{
+    osd_result rv;
+
+    __atomic_store_n(&device_rx_subnets, 0, __ATOMIC_RELAXED);
+    uint64_t expected = 0;
+    for (unsigned int subnet = DEVICE_SUBNET;
+         subnet < DEVICE_SUBNET + subnets; subnet++) {
+        struct osd_packet *pkg;
+        rv = osd_packet_new(&pkg,
+                            osd_packet_get_data_size_words_from_payload(1));
+        ck_assert_int_eq(rv, OSD_OK);
+        osd_packet_set_header(pkg, osd_diaddr_build(subnet, 2),
+                              device_trace_dest, OSD_PACKET_TYPE_EVENT, 0);
+        rv = osd_hostmod_send_packet(sink_ctx, pkg);
+        ck_assert_int_eq(rv, OSD_OK);
+        osd_packet_free(&pkg);
+        expected |= 1ULL << subnet;
+    }
+
+    while (__atomic_load_n(&device_rx_subnets, __ATOMIC_RELAXED) != expected) {
+        usleep(100);
+    }
+}
+
+/**
+ * Send numbered EVENT packets to the simulated device and wait until all of
+ * them were written
+ */
+static void device_send_tx_packets(unsigned int count)
+{
+    osd_result rv;
+
+    unsigned int start = __atomic_load_n(&device_tx_packets, __ATOMIC_RELAXED);
+    struct osd_packet *pkg;
+    rv = osd_packet_new(&pkg, osd_packet_get_data_size_words_from_payload(1));
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_packet_set_header(pkg, osd_diaddr_build(DEVICE_SUBNET, 2),
+                          device_trace_dest, OSD_PACKET_TYPE_EVENT, 0);
+    for (unsigned int i = 0; i < count; i++) {
+        pkg->data.payload[0] = i;
+        rv = osd_hostmod_send_packet(sink_ctx, pkg);
+        ck_assert_int_eq(rv, OSD_OK);
+    }
+    osd_packet_free(&pkg);
+
+    while (__atomic_load_n(&device_tx_packets, __ATOMIC_RELAXED) <
+           start + count) {
+        usleep(100);
+    }
+    ck_assert_uint_eq(__atomic_load_n(&device_tx_packets, __ATOMIC_RELAXED),
+                      start + count);
+}
+
+/**
+ * Create device_pipe, the simulated device read through a file descriptor
+ */
+static void device_pipe_open(void)
+{
+    int irv = pipe(device_pipe);
+    ck_assert_int_eq(irv, 0);
+    irv = fcntl(device_pipe[0], F_SETFL, O_NONBLOCK);
+    ck_assert_int_eq(irv, 0);
+}
+
+static void device_pipe_close(void)
+{
+    close(device_pipe[0]);
+    close(device_pipe[1]);
+    device_pipe[0] = device_pipe[1] = -1;
+}
+
+/**
+ * Test fixture: setup (called before each tests)
+ */
+void setup(void)
+{
+    osd_result rv;
+
+    log_ctx = testutil_get_log_ctx();
+
+    rv = osd_hostctrl_new(&hostctrl_ctx, log_ctx, HOSTCTRL_EP);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_hostctrl_start(hostctrl_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    rv = osd_hostmod_new(&sink_ctx, log_ctx, HOSTCTRL_EP, trace_sink_handler,
+                         NULL);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_hostmod_connect(sink_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+    device_trace_dest = osd_hostmod_get_diaddr(sink_ctx);
+}
+
+/**
+ * Test fixture: teardown (called after each test)
+ */
+void teardown(void)
+{
+    osd_hostmod_disconnect(sink_ctx);
+    osd_hostmod_free(&sink_ctx);
+    osd_hostctrl_stop(hostctrl_ctx);
+    osd_hostctrl_free(&hostctrl_ctx);
+    osd_log_free(&log_ctx);
+}
+
+/**
+ * Packets read from the device are copied at most once on their way to the
+ * host controller, and the batch buffers are reused
+ */
+START_TEST(test_gateway_rx_copies)
+{
+    osd_result rv;
+
+    struct osd_gateway_ctx *gateway_ctx;
+    rv = osd_gateway_new(&gateway_ctx, log_ctx, HOSTCTRL_EP, DEVICE_SUBNET,
+                         device_packet_read, device_packet_write, NULL);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_gateway_set_rx_batch(gateway_ctx, 1024, 1);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_gateway_set_stats_endpoint(gateway_ctx, GATEWAY_STATS_EP);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_gateway_connect(gateway_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    device_send_trace_bursts();
+
+    char *stats = testutil_get_stats(GATEWAY_STATS_EP);
+
+    uint64_t rx_packets = testutil_stats_value(stats, "device.rx_packets");
+    uint64_t rx_bytes = testutil_stats_value(stats, "device.rx_bytes");
+    uint64_t copy_bytes = testutil_stats_value(stats, "device.rx_copy_bytes");
+    uint64_t buf_allocs = testutil_stats_value(stats, "device.rx_buf_allocs");
+    uint64_t batches = testutil_stats_value(stats, "device.rx_batch.count");
+    uint64_t batched_packets =
+        testutil_stats_value(stats, "device.rx_batch.sum");
+    ck_assert_uint_eq(rx_packets, TRACE_BURSTS * TRACE_BURST_PACKETS);
+
+    // only batched packets are copied, each of them once
+    ck_assert_uint_gt(batched_packets, 0);
+    ck_assert_uint_eq(copy_bytes, batched_packets * rx_bytes / rx_packets);
+    ck_assert_uint_le(copy_bytes, rx_bytes);
+
+    // batch buffers are allocated for the first burst, then reused
+    ck_assert_uint_ge(batches, TRACE_BURSTS);
+    ck_assert_uint_ge(buf_allocs, 1);
+    ck_assert_uint_le(buf_allocs * 4, batches);
+
+    zstr_free(&stats);
+
+    osd_gateway_disconnect(gateway_ctx);
+    osd_gateway_free(&gateway_ctx);
+}
+END_TEST
+
+/**
+ * A gateway serving several subnets receives the packets to all of them
+ */
+START_TEST(test_gateway_subnets)
+{
+    osd_result rv;
+
+    struct osd_gateway_ctx *gateway_ctx;
+    rv = osd_gateway_new(&gateway_ctx, log_ctx, HOSTCTRL_EP, DEVICE_SUBNET,
+                         device_packet_read, device_packet_write, NULL);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_gateway_add_subnet(gateway_ctx, DEVICE_SUBNET + 1);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_gateway_add_subnet(gateway_ctx, DEVICE_SUBNET + 1);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+    rv = osd_gateway_connect(gateway_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    device_check_tx(2);
+
+    // adding subnets is only possible while disconnected
+    rv = osd_gateway_add_subnet(gateway_ctx, DEVICE_SUBNET + 2);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    osd_gateway_disconnect(gateway_ctx);
+    osd_gateway_free(&gateway_ctx);
+}
+END_TEST
+
+/**
+ * Packets queued for the device are written in one call, also after the
+ * timer flushing the device RX batches stopped in between
+ */
+START_TEST(test_gateway_tx_batch)
+{
+    osd_result rv;
+
+    struct osd_gateway_ctx *gateway_ctx;
+    rv = osd_gateway_new(&gateway_ctx, log_ctx, HOSTCTRL_EP, DEVICE_SUBNET,
+                         device_packet_read, device_packet_write, NULL);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_gateway_set_packet_write_batch(gateway_ctx, device_write_batch);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_gateway_set_rx_batch(gateway_ctx, 1024, 1);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_gateway_set_stats_endpoint(gateway_ctx, GATEWAY_STATS_EP);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_gateway_connect(gateway_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    // slow writes let the packets from the host controller queue up
+    __atomic_store_n(&device_tx_delay_us, 10000, __ATOMIC_RELAXED);
+    const unsigned int rounds = 3, tx_packets = 200;
+    for (unsigned int i = 0; i < rounds; i++) {
+        device_send_trace_bursts();
+        usleep(50000);  // the RX flush timer stops
+        device_send_tx_packets(tx_packets);
+    }
+    __atomic_store_n(&device_tx_delay_us, 0, __ATOMIC_RELAXED);
+
+    char *stats = testutil_get_stats(GATEWAY_STATS_EP);
+    uint64_t written = testutil_stats_value(stats, "device.tx_packets");
+    uint64_t writes = testutil_stats_value(stats, "device.tx_writes");
+    ck_assert_uint_eq(written, rounds * tx_packets);
+    ck_assert_uint_eq(testutil_stats_value(stats, "device.tx_batch.sum"),
+                      written);
+    ck_assert_uint_le(writes * 4, written);
+    ck_assert_uint_eq(testutil_stats_value(stats, "device.tx_errors"), 0);
+    zstr_free(&stats);
+
+    osd_gateway_disconnect(gateway_ctx);
+    osd_gateway_free(&gateway_ctx);
+}
+END_TEST
+
+/**
+ * A device read through a file descriptor is still read and written after
+ * it was idle for much longer than the maximum RX batching delay, after
+ * which the timer flushing the RX batches stops
+ */
+START_TEST(test_gateway_device_fd_idle)
+{
+    osd_result rv;
+
+    device_pipe_open();
+
+    struct osd_gateway_ctx *gateway_ctx;
+    rv = osd_gateway_new(&gateway_ctx, log_ctx, HOSTCTRL_EP, DEVICE_SUBNET,
+                         NULL, device_packet_write, NULL);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_gateway_set_device_fd(gateway_ctx, device_pipe[0],
+                                   device_packet_read_nonblocking);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_gateway_set_rx_batch(gateway_ctx, 1024, 1);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_gateway_set_stats_endpoint(gateway_ctx, GATEWAY_STATS_EP);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_gateway_connect(gateway_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    const unsigned int rounds = 3;
+    for (unsigned int i = 0; i < rounds; i++) {
+        device_send_trace_bursts();
+        usleep(50000);  // idle device
+        device_check_tx(1);
+    }
+
+    char *stats = testutil_get_stats(GATEWAY_STATS_EP);
+    ck_assert_uint_eq(testutil_stats_value(stats, "device.rx_packets"),
+                      rounds * TRACE_BURSTS * TRACE_BURST_PACKETS);
+    ck_assert_uint_eq(testutil_stats_value(stats, "device.tx_packets"), rounds);
+    ck_assert_uint_eq(testutil_stats_value(stats, "device.rx_errors"), 0);
+    zstr_free(&stats);
+
+    osd_gateway_disconnect(gateway_ctx);
+    osd_gateway_free(&gateway_ctx);
+
+    device_pipe_close();
+}
+END_TEST
+
+/**
+ * A batched device is read without copying the packets, and written through
+ * its batch callback
+ */
+static void check_batched(bool use_fd)
+{
+    osd_result rv;
+
+    if (use_fd) {
+        device_pipe_open();
+    }
+
+    const struct osd_gateway_device_ops ops = {
+        .read_batch = device_read_batch,
+        .write_batch = device_write_batch,
+    };
+    struct osd_gateway_ctx *gateway_ctx;
+    rv = osd_gateway_new_batched(&gateway_ctx, log_ctx, HOSTCTRL_EP,
+                                 DEVICE_SUBNET, &ops, NULL);
+    ck_assert_int_eq(rv, OSD_OK);
+    if (use_fd) {
+        rv = osd_gateway_set_device_fd(gateway_ctx, device_pipe[0], NULL);
+        ck_assert_int_eq(rv, OSD_OK);
+    }
+    // a batched device can't fall back to writing single packets
+    rv = osd_gateway_set_packet_write_batch(gateway_ctx, NULL);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+    rv = osd_gateway_set_stats_endpoint(gateway_ctx, GATEWAY_STATS_EP);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_gateway_connect(gateway_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    device_send_trace_bursts();
+    device_check_tx(1);
+
+    char *stats = testutil_get_stats(GATEWAY_STATS_EP);
+
+    uint64_t rx_packets = testutil_stats_value(stats, "device.rx_packets");
+    uint64_t rx_reads = testutil_stats_value(stats, "device.rx_reads");
+    uint64_t batched_packets =
+        testutil_stats_value(stats, "device.rx_batch.sum");
+    ck_assert_uint_eq(rx_packets, TRACE_BURSTS * TRACE_BURST_PACKETS);
+
+    // every read returns many packets, which are forwarded without copying
+    ck_assert_uint_le(rx_reads * 10, rx_packets);
+    ck_assert_uint_eq(batched_packets, rx_packets);
+    ck_assert_uint_eq(testutil_stats_value(stats, "device.rx_copy_bytes"), 0);
+    ck_assert_uint_eq(testutil_stats_value(stats, "device.rx_errors"), 0);
+    ck_assert_uint_eq(testutil_stats_value(stats, "device.tx_writes"), 1);
+
+    zstr_free(&stats);
+
+    osd_gateway_disconnect(gateway_ctx);
+    osd_gateway_free(&gateway_ctx);
+
+    if (use_fd) {
+        device_pipe_close();
+    }
+}
+
+/**
+ * A batched device is read by the device RX thread
+ */
+START_TEST(test_gateway_batched)
+{
+    check_batched(false);
+}
+END_TEST
+
+/**
+ * A batched device is read through a file descriptor in the I/O thread
+ */
+START_TEST(test_gateway_batched_fd)
+{
+    check_batched(true);
+}
+END_TEST
+
+Suite *suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    tc_core = tcase_create("Core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_set_timeout(tc_core, 30);
+    tcase_add_test(tc_core, test_gateway_rx_copies);
+    tcase_add_test(tc_core, test_gateway_subnets);
+    tcase_add_test(tc_core, test_gateway_tx_batch);
+    tcase_add_test(tc_core, test_gateway_device_fd_idle);
+    tcase_add_test(tc_core, test_gateway_batched);
+    tcase_add_test(tc_core, test_gateway_batched_fd);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,399 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TEST_SUITE_NAME "check_gateway_glip"
+
+#define TESTUTIL_STATS
+#include "testutil.h"
+#include "mock_glip.h"
+
+#include <czmq.h>
+#include <osd/gateway_glip.h>
+#include <osd/hostctrl.h>
+#include <osd/hostmod.h>
+#include <osd/packet.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define HOSTCTRL_EP "inproc://testing"
+#define GATEWAY_STATS_EP "inproc://gateway-glip-stats"
+#define DEVICE_SUBNET 1
+
+/** Local addresses of the simulated modules are 1 to DEVICE_MODULES */
+#define DEVICE_MODULES 5
+
+/** Number of EVENT packets sent to and from every module */
+#define MODULE_PACKETS 200
+
+/** Every REG_INTERVAL EVENT packets a register read is sent to a module */
+#define REG_INTERVAL 10
+
+/** Words of a packet with a payload of one word, including the size word */
+#define PACKET_WORDS (1 + 4)
+
+struct osd_hostctrl_ctx *hostctrl_ctx;
+struct osd_hostmod_ctx *hostmod_ctx;
+struct osd_log_ctx *log_ctx;
+
+/** Number of EVENT packets from the device received by the host module */
+static unsigned int rx_count;
+
+/** Number of EVENT packets from the device received out of order */
+static unsigned int rx_order_errors;
+
+/** Next sequence number expected from every module */
+static uint16_t rx_next_seq[DEVICE_MODULES + 1];
+
+static osd_result event_handler(void *arg, struct osd_packet *pkg)
+{
+    unsigned int local = osd_diaddr_localaddr(osd_packet_get_src(pkg));
+    if (local < 1 || local > DEVICE_MODULES ||
+        pkg->data.payload[0] != rx_next_seq[local]) {
+        __atomic_add_fetch(&rx_order_errors, 1, __ATOMIC_RELAXED);
+    } else {
+        rx_next_seq[local]++;
+    }
+    __atomic_add_fetch(&rx_count, 1, __ATOMIC_RELAXED);
+    osd_packet_free(&pkg);
+    return OSD_OK;
+}
+
+/**
+ * Get the channel packets to or from a module are expected on
+ */
+static unsigned int expected_channel(unsigned int local,
+                                     enum osd_traffic_class tclass,
+                                     unsigned int channels,
+                                     enum osd_gateway_glip_stripe stripe)
+{
+    if (stripe == OSD_GATEWAY_GLIP_STRIPE_TCLASS) {
+        if (tclass == OSD_TCLASS_CONTROL) {
+            return 0;
+        }
+        return 1 + local % (channels - 1);
+    }
+    return local % channels;
+}
+
+/**
+ * Send numbered EVENT packets and register reads from the host module to
+ * every simulated module
+ *
+ * @return the number of packets sent
+ */
+static unsigned int send_packets_to_device(void)
+{
+    osd_result rv;
+    unsigned int sent = 0;
+
+    uint16_t src = osd_hostmod_get_diaddr(hostmod_ctx);
+    struct osd_packet *pkg;
+    rv = osd_packet_new(&pkg, osd_packet_get_data_size_words_from_payload(1));
+    ck_assert_int_eq(rv, OSD_OK);
+    for (unsigned int i = 0; i < MODULE_PACKETS; i++) {
+        for (unsigned int local = 1; local <= DEVICE_MODULES; local++) {
+            uint16_t dest = osd_diaddr_build(DEVICE_SUBNET, local);
+            osd_packet_set_header(pkg, dest, src, OSD_PACKET_TYPE_EVENT, 0);
+            pkg->data.payload[0] = i;
+            rv = osd_hostmod_send_packet(hostmod_ctx, pkg);
+            ck_assert_int_eq(rv, OSD_OK);
+            sent++;
+
+            if (i % REG_INTERVAL == 0) {
+                osd_packet_set_header(pkg, dest, src, OSD_PACKET_TYPE_REG,
+                                      REQ_READ_REG_16);
+                pkg->data.payload[0] = i / REG_INTERVAL;
+                rv = osd_hostmod_send_packet(hostmod_ctx, pkg);
+                ck_assert_int_eq(rv, OSD_OK);
+                sent++;
+            }
+        }
+    }
+    osd_packet_free(&pkg);
+    return sent;
+}
+
+/**
+ * Let every simulated module send numbered EVENT packets to the host module
+ * over its channel
+ */
+static void send_packets_from_device(unsigned int channels,
+                                     enum osd_gateway_glip_stripe stripe)
+{
+    uint16_t dest = osd_hostmod_get_diaddr(hostmod_ctx);
+    uint16_t dtd[PACKET_WORDS];
+    dtd[0] = PACKET_WORDS - 1;
+    for (unsigned int i = 0; i < MODULE_PACKETS; i++) {
+        for (unsigned int local = 1; local <= DEVICE_MODULES; local++) {
+            osd_packet_set_header((struct osd_packet *)dtd, dest,
+                                  osd_diaddr_build(DEVICE_SUBNET, local),
+                                  OSD_PACKET_TYPE_EVENT, 0);
+            dtd[4] = i;
+            mock_glip_queue_rx(
+                expected_channel(local, OSD_TCLASS_BULK, channels, stripe),
+                dtd, PACKET_WORDS);
+        }
+    }
+}
+
+/**
+ * Check the packets written to one channel
+ *
+ * Every packet must be written to the channel of its destination and
+ * traffic class, in the order it was sent.
+ *
+ * @param next_seq next sequence number expected per traffic class and module
+ * @return the number of packets written to the channel
+ */
+static uint64_t check_channel_tx(unsigned int channel, unsigned int channels,
+                                 enum osd_gateway_glip_stripe stripe,
+                                 uint16_t next_seq[][DEVICE_MODULES + 1])
+{
+    size_t size_words = mock_glip_get_tx_words(channel);
+    uint16_t *words = malloc(size_words * sizeof(uint16_t));
+    ck_assert_ptr_ne(words, NULL);
+    ck_assert_uint_eq(mock_glip_get_tx(channel, words, size_words),
+                      size_words);
+
+    uint64_t packets = 0;
+    size_t pos = 0;
+    while (pos < size_words) {
+        ck_assert_uint_eq(words[pos], PACKET_WORDS - 1);
+        ck_assert_uint_le(pos + PACKET_WORDS, size_words);
+        const struct osd_packet *pkg = (const struct osd_packet *)&words[pos];
+
+        uint16_t dest = osd_packet_get_dest(pkg);
+        ck_assert_uint_eq(osd_diaddr_subnet(dest), DEVICE_SUBNET);
+        unsigned int local = osd_diaddr_localaddr(dest);
+        ck_assert_uint_ge(local, 1);
+        ck_assert_uint_le(local, DEVICE_MODULES);
+        enum osd_traffic_class tclass = osd_packet_get_traffic_class(pkg);
+        ck_assert_uint_eq(channel,
+                          expected_channel(local, tclass, channels, stripe));
+        ck_assert_uint_eq(pkg->data.payload[0], next_seq[tclass][local]);
+        next_seq[tclass][local]++;
+
+        packets++;
+        pos += PACKET_WORDS;
+    }
+    free(words);
+    return packets;
+}
+
+/**
+ * Test fixture: setup (called before each tests)
+ */
+void setup(void)
+{
+    osd_result rv;
+
+    log_ctx = testutil_get_log_ctx();
+
+    rv = osd_hostctrl_new(&hostctrl_ctx, log_ctx, HOSTCTRL_EP);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_hostctrl_start(hostctrl_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    rv = osd_hostmod_new(&hostmod_ctx, log_ctx, HOSTCTRL_EP, event_handler,
+                         NULL);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_hostmod_connect(hostmod_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+}
+
+/**
+ * Test fixture: teardown (called after each test)
+ */
+void teardown(void)
+{
+    osd_hostmod_disconnect(hostmod_ctx);
+    osd_hostmod_free(&hostmod_ctx);
+    osd_hostctrl_stop(hostctrl_ctx);
+    osd_hostctrl_free(&hostctrl_ctx);
+    osd_log_free(&log_ctx);
+}
+
+/**
+ * Exchange packets with a device over several GLIP channels and check the
+ * assignment of the packets to the channels and the channel statistics
+ */
+static void check_stripe(unsigned int channels,
+                         enum osd_gateway_glip_stripe stripe)
+{
+    osd_result rv;
+
+    struct osd_gateway_glip_ctx *gateway_ctx;
+    rv = osd_gateway_glip_new(&gateway_ctx, log_ctx, HOSTCTRL_EP,
+                              DEVICE_SUBNET, "mock", NULL, 0);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_gateway_glip_set_channels(gateway_ctx, channels, stripe);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_gateway_glip_set_stats_endpoint(gateway_ctx, GATEWAY_STATS_EP);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_gateway_glip_connect(gateway_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    // packets from one module arrive in order, whatever channels they share
+    send_packets_from_device(channels, stripe);
+    unsigned int rx_total = MODULE_PACKETS * DEVICE_MODULES;
+    while (__atomic_load_n(&rx_count, __ATOMIC_RELAXED) < rx_total) {
+        usleep(100);
+    }
+    ck_assert_uint_eq(__atomic_load_n(&rx_count, __ATOMIC_RELAXED), rx_total);
+    ck_assert_uint_eq(__atomic_load_n(&rx_order_errors, __ATOMIC_RELAXED), 0);
+
+    unsigned int tx_total = send_packets_to_device();
+    size_t tx_words;
+    do {
+        usleep(100);
+        tx_words = 0;
+        for (unsigned int ch = 0; ch < channels; ch++) {
+            tx_words += mock_glip_get_tx_words(ch);
+        }
+    } while (tx_words < tx_total * PACKET_WORDS);
+    ck_assert_uint_eq(tx_words, tx_total * PACKET_WORDS);
+
+    // every packet is written to the channel of its destination (and traffic
+    // class), in order
+    uint16_t next_seq[OSD_TCLASS_COUNT][DEVICE_MODULES + 1];
+    memset(next_seq, 0, sizeof(next_seq));
+    uint64_t channel_tx_packets[OSD_GATEWAY_GLIP_CHANNELS_MAX];
+    for (unsigned int ch = 0; ch < channels; ch++) {
+        channel_tx_packets[ch] =
+            check_channel_tx(ch, channels, stripe, next_seq);
+    }
+    for (unsigned int local = 1; local <= DEVICE_MODULES; local++) {
+        ck_assert_uint_eq(next_seq[OSD_TCLASS_BULK][local], MODULE_PACKETS);
+        ck_assert_uint_eq(next_seq[OSD_TCLASS_CONTROL][local],
+                          MODULE_PACKETS / REG_INTERVAL);
+    }
+
+    // the channel statistics add up to the device statistics of the gateway;
+    // both count the packets written only after the write returned
+    char *stats = NULL;
+    struct osd_gateway_glip_channel_stats sum;
+    do {
+        zstr_free(&stats);
+        usleep(100);
+        stats = testutil_get_stats(GATEWAY_STATS_EP);
+        memset(&sum, 0, sizeof(sum));
+        for (unsigned int ch = 0; ch < channels; ch++) {
+            struct osd_gateway_glip_channel_stats ch_stats;
+            rv = osd_gateway_glip_get_channel_stats(gateway_ctx, ch,
+                                                    &ch_stats);
+            ck_assert_int_eq(rv, OSD_OK);
+            sum.rx_packets += ch_stats.rx_packets;
+            sum.rx_bytes += ch_stats.rx_bytes;
+            sum.tx_packets += ch_stats.tx_packets;
+            sum.tx_bytes += ch_stats.tx_bytes;
+        }
+    } while (sum.tx_packets < tx_total ||
+             testutil_stats_value(stats, "device.tx_packets") < tx_total);
+
+    ck_assert_uint_eq(sum.rx_packets, rx_total);
+    ck_assert_uint_eq(sum.rx_packets,
+                      testutil_stats_value(stats, "device.rx_packets"));
+    ck_assert_uint_eq(sum.rx_bytes,
+                      testutil_stats_value(stats, "device.rx_bytes"));
+    ck_assert_uint_eq(sum.tx_packets, tx_total);
+    ck_assert_uint_eq(sum.tx_packets,
+                      testutil_stats_value(stats, "device.tx_packets"));
+    ck_assert_uint_eq(sum.tx_bytes,
+                      testutil_stats_value(stats, "device.tx_bytes"));
+    zstr_free(&stats);
+
+    for (unsigned int ch = 0; ch < channels; ch++) {
+        struct osd_gateway_glip_channel_stats ch_stats;
+        rv = osd_gateway_glip_get_channel_stats(gateway_ctx, ch, &ch_stats);
+        ck_assert_int_eq(rv, OSD_OK);
+        ck_assert_uint_eq(ch_stats.tx_packets, channel_tx_packets[ch]);
+    }
+    struct osd_gateway_glip_channel_stats ch_stats;
+    rv = osd_gateway_glip_get_channel_stats(gateway_ctx, channels, &ch_stats);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    struct osd_gateway_glip_device_stats dev_stats;
+    rv = osd_gateway_glip_get_device_stats(gateway_ctx, DEVICE_SUBNET,
+                                           &dev_stats);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(dev_stats.rx_packets, sum.rx_packets);
+    ck_assert_uint_eq(dev_stats.tx_packets, sum.tx_packets);
+
+    osd_gateway_glip_disconnect(gateway_ctx);
+    osd_gateway_glip_free(&gateway_ctx);
+}
+
+/**
+ * Striping by destination: all packets to one module use one channel
+ */
+START_TEST(test_gateway_glip_stripe_dest)
+{
+    check_stripe(3, OSD_GATEWAY_GLIP_STRIPE_DEST);
+}
+END_TEST
+
+/**
+ * Striping by traffic class: register accesses use channel 0 only
+ */
+START_TEST(test_gateway_glip_stripe_tclass)
+{
+    check_stripe(3, OSD_GATEWAY_GLIP_STRIPE_TCLASS);
+}
+END_TEST
+
+/**
+ * The gateway refuses to connect if the device has too few channels
+ */
+START_TEST(test_gateway_glip_channel_count)
+{
+    osd_result rv;
+
+    mock_glip_set_channel_count(2);
+
+    struct osd_gateway_glip_ctx *gateway_ctx;
+    rv = osd_gateway_glip_new(&gateway_ctx, log_ctx, HOSTCTRL_EP,
+                              DEVICE_SUBNET, "mock", NULL, 0);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_gateway_glip_set_channels(gateway_ctx, 1,
+                                       OSD_GATEWAY_GLIP_STRIPE_TCLASS);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+    rv = osd_gateway_glip_set_channels(gateway_ctx, 3,
+                                       OSD_GATEWAY_GLIP_STRIPE_DEST);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_gateway_glip_connect(gateway_ctx);
+    ck_assert_int_eq(rv, OSD_ERROR_CONNECTION_FAILED);
+
+    osd_gateway_glip_free(&gateway_ctx);
+}
+END_TEST
+
+Suite *suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    tc_core = tcase_create("Core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_set_timeout(tc_core, 30);
+    tcase_add_test(tc_core, test_gateway_glip_stripe_dest);
+    tcase_add_test(tc_core, test_gateway_glip_stripe_tclass);
+    tcase_add_test(tc_core, test_gateway_glip_channel_count);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,122 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TEST_SUITE_NAME "check_hdrhist"
+
+#include "testutil.h"
+
+#include <stdlib.h>
+#include "hdrhist.h"
+
+static struct hdrhist *hist_new(void)
+{
+    struct hdrhist *hist = malloc(sizeof(struct hdrhist));
+    ck_assert_ptr_ne(hist, NULL);
+    hdrhist_reset(hist);
+    return hist;
+}
+
+START_TEST(test_hdrhist_small_values_exact)
+{
+    struct hdrhist *hist = hist_new();
+
+    ck_assert_uint_eq(hdrhist_percentile(hist, 50), 0);
+
+    for (int v = 1; v <= 50; v++) {
+        hdrhist_record(hist, v);
+    }
+    ck_assert_uint_eq(hist->count, 50);
+    ck_assert_uint_eq(hist->sum, 50 * 51 / 2);
+    ck_assert_uint_eq(hist->min, 1);
+    ck_assert_uint_eq(hist->max, 50);
+
+    ck_assert_uint_eq(hdrhist_percentile(hist, 0), 1);
+    ck_assert_uint_eq(hdrhist_percentile(hist, 50), 25);
+    ck_assert_uint_eq(hdrhist_percentile(hist, 90), 45);
+    ck_assert_uint_eq(hdrhist_percentile(hist, 100), 50);
+
+    hdrhist_reset(hist);
+    ck_assert_uint_eq(hist->count, 0);
+    ck_assert_uint_eq(hdrhist_percentile(hist, 99), 0);
+
+    free(hist);
+}
+END_TEST
+
+/**
+ * Large values are resolved with a bounded relative error
+ */
+START_TEST(test_hdrhist_relative_error)
+{
+    struct hdrhist *hist = hist_new();
+
+    const uint64_t values[] = {100,        1000,          12345,
+                               999999,     123456789,     (1ULL << 40) + 7,
+                               UINT64_MAX};
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        hdrhist_reset(hist);
+        hdrhist_record(hist, values[i]);
+        hdrhist_record(hist, values[i] * 2 > values[i] ? values[i] * 2
+                                                        : UINT64_MAX);
+
+        uint64_t p = hdrhist_percentile(hist, 50);
+        ck_assert_uint_ge(p, values[i]);
+        ck_assert_uint_le(p - values[i], values[i] / 32);
+    }
+
+    free(hist);
+}
+END_TEST
+
+/**
+ * Tail percentiles are not hidden by the bulk of the values
+ */
+START_TEST(test_hdrhist_tail)
+{
+    struct hdrhist *hist = hist_new();
+
+    for (int i = 0; i < 9990; i++) {
+        hdrhist_record(hist, 20000);
+    }
+    for (int i = 0; i < 9; i++) {
+        hdrhist_record(hist, 500000);
+    }
+    hdrhist_record(hist, 9000000);
+
+    ck_assert_uint_le(hdrhist_percentile(hist, 50), 20000 * 33 / 32);
+    ck_assert_uint_le(hdrhist_percentile(hist, 99), 20000 * 33 / 32);
+    ck_assert_uint_ge(hdrhist_percentile(hist, 99.95), 500000);
+    ck_assert_uint_le(hdrhist_percentile(hist, 99.95), 500000 * 33 / 32);
+    ck_assert_uint_eq(hdrhist_percentile(hist, 100), 9000000);
+
+    free(hist);
+}
+END_TEST
+
+Suite *suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_hdrhist_small_values_exact);
+    tcase_add_test(tc_core, test_hdrhist_relative_error);
+    tcase_add_test(tc_core, test_hdrhist_tail);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
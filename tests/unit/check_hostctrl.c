@@ -18,9 +18,17 @@
 #include "testutil.h"
 
 #include <czmq.h>
+#include <endian.h>
+#include <osd/capture.h>
 #include <osd/hostctrl.h>
+#include <osd/hostmod.h>
 #include <osd/osd.h>
 #include <osd/packet.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "latency.h"
+#include "proto.h"
+#include "wirecomp.h"
 
 struct osd_hostctrl_ctx *hostctrl_ctx;
 struct osd_log_ctx *log_ctx;
@@ -68,6 +76,1101 @@ START_TEST(test_init_base)
 }
 END_TEST
 
+/**
+ * Send a management request in the text protocol and return the response
+ */
+static char *mgmt_request_v1(zsock_t *sock, const char *request)
+{
+    int rv;
+
+    zmsg_t *msg_req = zmsg_new();
+    ck_assert_ptr_ne(msg_req, NULL);
+    rv = zmsg_addstr(msg_req, "M");
+    ck_assert_int_eq(rv, 0);
+    rv = zmsg_addstr(msg_req, request);
+    ck_assert_int_eq(rv, 0);
+    rv = zmsg_send(&msg_req, sock);
+    ck_assert_int_eq(rv, 0);
+
+    zmsg_t *msg_resp = zmsg_recv(sock);
+    ck_assert_ptr_ne(msg_resp, NULL);
+    char *type = zmsg_popstr(msg_resp);
+    ck_assert_str_eq(type, "M");
+    free(type);
+    char *resp = zmsg_popstr(msg_resp);
+    ck_assert_ptr_ne(resp, NULL);
+    zmsg_destroy(&msg_resp);
+
+    return resp;
+}
+
+/**
+ * A host module negotiates the binary protocol and obtains a DI address
+ */
+START_TEST(test_core_hostmod_connect)
+{
+    osd_result rv;
+    struct osd_hostmod_ctx *hostmod_ctx;
+
+    rv = osd_hostmod_new(&hostmod_ctx, log_ctx, "inproc://testing", NULL,
+                         NULL);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    rv = osd_hostmod_connect(hostmod_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    // first address in the subnet of the host controller (1)
+    ck_assert_uint_eq(osd_hostmod_get_diaddr(hostmod_ctx),
+                      osd_diaddr_build(1, 1));
+
+    rv = osd_hostmod_disconnect(hostmod_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_hostmod_free(&hostmod_ctx);
+}
+END_TEST
+
+/**
+ * Clients speaking only the text protocol are still served
+ */
+START_TEST(test_core_v1_client)
+{
+    char *resp;
+
+    zsock_t *sock = zsock_new_dealer("inproc://testing");
+    ck_assert_ptr_ne(sock, NULL);
+    zsock_set_rcvtimeo(sock, 1000);
+
+    resp = mgmt_request_v1(sock, "DIADDR_REQUEST");
+    ck_assert_str_eq(resp, "1025");
+    free(resp);
+
+    resp = mgmt_request_v1(sock, "GW_REGISTER 3");
+    ck_assert_str_eq(resp, "ACK");
+    free(resp);
+
+    resp = mgmt_request_v1(sock, "GW_REGISTER 3");
+    ck_assert_str_eq(resp, "NACK");
+    free(resp);
+
+    resp = mgmt_request_v1(sock, "GW_UNREGISTER 3");
+    ck_assert_str_eq(resp, "ACK");
+    free(resp);
+
+    resp = mgmt_request_v1(sock, "PROTO_HELLO 2");
+    ck_assert_str_eq(resp, "PROTO 2");
+    free(resp);
+
+    resp = mgmt_request_v1(sock, "PROTO_HELLO 1");
+    ck_assert_str_eq(resp, "PROTO 1");
+    free(resp);
+
+    zsock_destroy(&sock);
+}
+END_TEST
+
+/**
+ * Gateway speaking the text protocol: answer a single register read request
+ */
+static void *v1_gateway_main(void *sock_void)
+{
+    zsock_t *sock = sock_void;
+    osd_result rv;
+
+    zmsg_t *msg_req = zmsg_recv(sock);
+    if (!msg_req) {
+        return NULL;
+    }
+    zframe_t *type_frame = zmsg_pop(msg_req);
+    assert(zframe_streq(type_frame, "D"));
+    zframe_destroy(&type_frame);
+
+    zframe_t *data_frame = zmsg_pop(msg_req);
+    struct osd_packet *pkg_req;
+    rv = osd_packet_new_from_zframe(&pkg_req, data_frame);
+    assert(OSD_SUCCEEDED(rv));
+    zframe_destroy(&data_frame);
+    zmsg_destroy(&msg_req);
+
+    struct osd_packet *pkg_resp;
+    rv = osd_packet_new(&pkg_resp,
+                        osd_packet_get_data_size_words_from_payload(1));
+    assert(OSD_SUCCEEDED(rv));
+    osd_packet_set_header(pkg_resp, osd_packet_get_src(pkg_req),
+                          osd_packet_get_dest(pkg_req), OSD_PACKET_TYPE_REG,
+                          RESP_READ_REG_SUCCESS_16);
+    pkg_resp->data.payload[0] = 0xbeef;
+
+    zmsg_t *msg_resp = zmsg_new();
+    zmsg_addstr(msg_resp, "D");
+    zmsg_addmem(msg_resp, pkg_resp->data_raw, osd_packet_sizeof(pkg_resp));
+    zmsg_send(&msg_resp, sock);
+
+    osd_packet_free(&pkg_req);
+    osd_packet_free(&pkg_resp);
+
+    return NULL;
+}
+
+/**
+ * Route packets between a binary protocol host module and a text protocol
+ * gateway
+ */
+START_TEST(test_core_route_mixed_versions)
+{
+    osd_result rv;
+    char *resp;
+
+    zsock_t *gw_sock = zsock_new_dealer("inproc://testing");
+    ck_assert_ptr_ne(gw_sock, NULL);
+    zsock_set_rcvtimeo(gw_sock, 2000);
+    resp = mgmt_request_v1(gw_sock, "GW_REGISTER 0");
+    ck_assert_str_eq(resp, "ACK");
+    free(resp);
+
+    pthread_t gw_thread;
+    int irv = pthread_create(&gw_thread, NULL, v1_gateway_main, gw_sock);
+    ck_assert_int_eq(irv, 0);
+
+    struct osd_hostmod_ctx *hostmod_ctx;
+    rv = osd_hostmod_new(&hostmod_ctx, log_ctx, "inproc://testing", NULL,
+                         NULL);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_hostmod_connect(hostmod_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    uint16_t reg_val;
+    rv = osd_hostmod_reg_read(hostmod_ctx, &reg_val, osd_diaddr_build(0, 5),
+                              0x0000, 16, 0);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(reg_val, 0xbeef);
+
+    pthread_join(gw_thread, NULL);
+
+    rv = osd_hostmod_disconnect(hostmod_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_hostmod_free(&hostmod_ctx);
+    zsock_destroy(&gw_sock);
+}
+END_TEST
+
+/**
+ * A gateway serving several subnets registers each of them over the same
+ * connection, and is sent the traffic of all of them
+ */
+START_TEST(test_core_gw_multi_subnet)
+{
+    osd_result rv;
+    char *resp;
+
+    zsock_t *gw_sock = zsock_new_dealer("inproc://testing");
+    ck_assert_ptr_ne(gw_sock, NULL);
+    zsock_set_rcvtimeo(gw_sock, 2000);
+    resp = mgmt_request_v1(gw_sock, "GW_REGISTER 2");
+    ck_assert_str_eq(resp, "ACK");
+    free(resp);
+    resp = mgmt_request_v1(gw_sock, "GW_REGISTER 3");
+    ck_assert_str_eq(resp, "ACK");
+    free(resp);
+
+    // a subnet is still served by one gateway only
+    zsock_t *other_sock = zsock_new_dealer("inproc://testing");
+    ck_assert_ptr_ne(other_sock, NULL);
+    zsock_set_rcvtimeo(other_sock, 2000);
+    resp = mgmt_request_v1(other_sock, "GW_REGISTER 3");
+    ck_assert_str_eq(resp, "NACK");
+    free(resp);
+
+    // unregistering one subnet leaves the others in place
+    resp = mgmt_request_v1(gw_sock, "GW_UNREGISTER 2");
+    ck_assert_str_eq(resp, "ACK");
+    free(resp);
+    resp = mgmt_request_v1(other_sock, "GW_REGISTER 2");
+    ck_assert_str_eq(resp, "ACK");
+    free(resp);
+
+    pthread_t gw_thread;
+    int irv = pthread_create(&gw_thread, NULL, v1_gateway_main, gw_sock);
+    ck_assert_int_eq(irv, 0);
+
+    struct osd_hostmod_ctx *hostmod_ctx;
+    rv = osd_hostmod_new(&hostmod_ctx, log_ctx, "inproc://testing", NULL,
+                         NULL);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_hostmod_connect(hostmod_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    uint16_t reg_val;
+    rv = osd_hostmod_reg_read(hostmod_ctx, &reg_val, osd_diaddr_build(3, 5),
+                              0x0000, 16, 0);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(reg_val, 0xbeef);
+
+    pthread_join(gw_thread, NULL);
+
+    rv = osd_hostmod_disconnect(hostmod_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_hostmod_free(&hostmod_ctx);
+
+    resp = mgmt_request_v1(gw_sock, "GW_UNREGISTER 3");
+    ck_assert_str_eq(resp, "ACK");
+    free(resp);
+    resp = mgmt_request_v1(other_sock, "GW_UNREGISTER 2");
+    ck_assert_str_eq(resp, "ACK");
+    free(resp);
+    zsock_destroy(&other_sock);
+    zsock_destroy(&gw_sock);
+}
+END_TEST
+
+/**
+ * Register or unregister a subnet as gateway speaking the binary protocol
+ */
+static void v2_gateway_subnet_cmd(zsock_t *sock, uint32_t *seq,
+                                  uint8_t opcode, uint16_t subnet)
+{
+    struct proto_hdr resp_hdr;
+    uint16_t subnet_le = htole16(subnet);
+    osd_result rv = proto_request(sock, log_ctx, opcode, (*seq)++, &subnet_le,
+                                  sizeof(subnet_le), &resp_hdr, NULL);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(resp_hdr.opcode, PROTO_OP_ACK);
+}
+
+/**
+ * Filter requests are only forwarded to gateways serving a single subnet:
+ * the filter of a gateway applies to all its subnets
+ */
+START_TEST(test_core_gw_filter_multi_subnet)
+{
+    osd_result rv;
+    uint32_t seq = 0;
+
+    zsock_t *gw_sock = zsock_new_dealer("inproc://testing");
+    ck_assert_ptr_ne(gw_sock, NULL);
+    zsock_set_rcvtimeo(gw_sock, 2000);
+    char *resp = mgmt_request_v1(gw_sock, "PROTO_HELLO 2");
+    ck_assert_str_eq(resp, "PROTO 2");
+    free(resp);
+    v2_gateway_subnet_cmd(gw_sock, &seq, PROTO_OP_GW_REGISTER, 2);
+
+    struct osd_hostmod_ctx *hostmod_ctx;
+    rv = osd_hostmod_new(&hostmod_ctx, log_ctx, "inproc://testing", NULL,
+                         NULL);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_hostmod_connect(hostmod_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    rv = osd_hostmod_set_gateway_filter(hostmod_ctx, 2, "drop src=2.5");
+    ck_assert_int_eq(rv, OSD_OK);
+    while (1) {
+        zmsg_t *msg = zmsg_recv(gw_sock);
+        ck_assert_ptr_ne(msg, NULL);
+        struct proto_hdr hdr;
+        rv = proto_hdr_parse(zmsg_first(msg), &hdr);
+        ck_assert_int_eq(rv, OSD_OK);
+        zmsg_destroy(&msg);
+        if (hdr.opcode != PROTO_OP_CREDIT) {
+            ck_assert_uint_eq(hdr.opcode, PROTO_OP_GW_FILTER);
+            break;
+        }
+    }
+
+    v2_gateway_subnet_cmd(gw_sock, &seq, PROTO_OP_GW_REGISTER, 3);
+    rv = osd_hostmod_set_gateway_filter(hostmod_ctx, 2, "drop src=2.5");
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+    rv = osd_hostmod_set_gateway_filter(hostmod_ctx, 3, "");
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    v2_gateway_subnet_cmd(gw_sock, &seq, PROTO_OP_GW_UNREGISTER, 3);
+    rv = osd_hostmod_set_gateway_filter(hostmod_ctx, 2, "");
+    ck_assert_int_eq(rv, OSD_OK);
+
+    rv = osd_hostmod_disconnect(hostmod_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_hostmod_free(&hostmod_ctx);
+
+    v2_gateway_subnet_cmd(gw_sock, &seq, PROTO_OP_GW_UNREGISTER, 2);
+    zsock_destroy(&gw_sock);
+}
+END_TEST
+
+/**
+ * Event handler counting the received EVENT packets
+ */
+static osd_result count_event_handler(void *count_void,
+                                      struct osd_packet *pkg)
+{
+    volatile int *count = count_void;
+    (*count)++;
+    osd_packet_free(&pkg);
+    return OSD_OK;
+}
+
+/**
+ * Wait until an event counter reached a given value (or time out)
+ */
+static void wait_for_event_count(volatile int *count, int expected)
+{
+    for (int i = 0; i < 5000 && *count < expected; i++) {
+        usleep(1000);
+    }
+    ck_assert_int_eq(*count, expected);
+}
+
+/**
+ * Send EVENT packets to a DI address as a device would do
+ *
+ * The first payload word of the packets counts up from @p first.
+ */
+static void send_event_packets_from(zsock_t *sock, uint16_t dest, int first,
+                                    int count)
+{
+    osd_result rv;
+    struct osd_packet *pkg;
+    rv = osd_packet_new(&pkg, osd_packet_get_data_size_words_from_payload(4));
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_packet_set_header(pkg, dest, osd_diaddr_build(0, 5),
+                          OSD_PACKET_TYPE_EVENT, 0);
+
+    for (int i = 0; i < count; i++) {
+        pkg->data.payload[0] = first + i;
+        zmsg_t *msg = zmsg_new();
+        zmsg_addstr(msg, "D");
+        zmsg_addmem(msg, pkg->data_raw, osd_packet_sizeof(pkg));
+        int zmq_rv = zmsg_send(&msg, sock);
+        ck_assert_int_eq(zmq_rv, 0);
+    }
+
+    osd_packet_free(&pkg);
+}
+
+static void send_event_packets(zsock_t *sock, uint16_t dest, int count)
+{
+    send_event_packets_from(sock, dest, 0, count);
+}
+
+/**
+ * EVENT packets are delivered to all subscribers
+ */
+START_TEST(test_core_subscribe_fanout)
+{
+    osd_result rv;
+    const uint16_t event_dest = osd_diaddr_build(1, 100);
+
+    volatile int count[3] = {0, 0, 0};
+    struct osd_hostmod_ctx *hostmod_ctx[3];
+    for (int i = 0; i < 3; i++) {
+        rv = osd_hostmod_new(&hostmod_ctx[i], log_ctx, "inproc://testing",
+                             count_event_handler, (void *)&count[i]);
+        ck_assert_int_eq(rv, OSD_OK);
+        rv = osd_hostmod_connect(hostmod_ctx[i]);
+        ck_assert_int_eq(rv, OSD_OK);
+    }
+
+    // host modules 0 and 1 subscribe, module 2 doesn't
+    rv = osd_hostmod_subscribe(hostmod_ctx[0], event_dest);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_hostmod_subscribe(hostmod_ctx[1], event_dest);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    // subscriptions are limited to the subnet of the host controller
+    rv = osd_hostmod_subscribe(hostmod_ctx[2], osd_diaddr_build(2, 100));
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    zsock_t *dev_sock = zsock_new_dealer("inproc://testing");
+    ck_assert_ptr_ne(dev_sock, NULL);
+
+    send_event_packets(dev_sock, event_dest, 10);
+    wait_for_event_count(&count[0], 10);
+    wait_for_event_count(&count[1], 10);
+
+    // packets sent to a subscribed address also reach the address owner
+    rv = osd_hostmod_subscribe(hostmod_ctx[0],
+                               osd_hostmod_get_diaddr(hostmod_ctx[2]));
+    ck_assert_int_eq(rv, OSD_OK);
+    send_event_packets(dev_sock, osd_hostmod_get_diaddr(hostmod_ctx[2]), 5);
+    wait_for_event_count(&count[0], 15);
+    wait_for_event_count(&count[2], 5);
+
+    // no more packets after unsubscribing
+    rv = osd_hostmod_unsubscribe(hostmod_ctx[1], event_dest);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_hostmod_unsubscribe(hostmod_ctx[1], event_dest);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    send_event_packets(dev_sock, event_dest, 10);
+    wait_for_event_count(&count[0], 25);
+    ck_assert_int_eq(count[1], 10);
+    ck_assert_int_eq(count[2], 5);
+
+    zsock_destroy(&dev_sock);
+    for (int i = 0; i < 3; i++) {
+        rv = osd_hostmod_disconnect(hostmod_ctx[i]);
+        ck_assert_int_eq(rv, OSD_OK);
+        osd_hostmod_free(&hostmod_ctx[i]);
+    }
+}
+END_TEST
+
+/**
+ * A subscriber not reading its messages does not block other subscribers
+ */
+START_TEST(test_core_subscribe_slow_subscriber)
+{
+    osd_result rv;
+    char *resp;
+    const uint16_t event_dest = osd_diaddr_build(1, 100);
+    const int num_events = 3000;
+
+    // slow subscriber: a client which never reads its messages
+    zsock_t *slow_sock = zsock_new(ZMQ_DEALER);
+    ck_assert_ptr_ne(slow_sock, NULL);
+    zsock_set_rcvhwm(slow_sock, 10);
+    zsock_set_rcvtimeo(slow_sock, 1000);
+    ck_assert_int_eq(zsock_connect(slow_sock, "inproc://testing"), 0);
+    resp = mgmt_request_v1(slow_sock, "DIADDR_REQUEST");
+    free(resp);
+    resp = mgmt_request_v1(slow_sock, "SUBSCRIBE 1124");
+    ck_assert_str_eq(resp, "ACK");
+    free(resp);
+
+    volatile int count = 0;
+    struct osd_hostmod_ctx *hostmod_ctx;
+    rv = osd_hostmod_new(&hostmod_ctx, log_ctx, "inproc://testing",
+                         count_event_handler, (void *)&count);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_hostmod_connect(hostmod_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_hostmod_subscribe(hostmod_ctx, event_dest);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    zsock_t *dev_sock = zsock_new_dealer("inproc://testing");
+    ck_assert_ptr_ne(dev_sock, NULL);
+    send_event_packets(dev_sock, event_dest, num_events);
+
+    wait_for_event_count(&count, num_events);
+
+    zsock_destroy(&dev_sock);
+    rv = osd_hostmod_disconnect(hostmod_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_hostmod_free(&hostmod_ctx);
+    zsock_destroy(&slow_sock);
+}
+END_TEST
+
+/**
+ * Connect a client speaking the binary protocol, not granting any credits yet
+ *
+ * @return the DI address assigned to the client
+ */
+static uint16_t v2_client_connect(zsock_t *sock, uint32_t *seq)
+{
+    osd_result rv;
+
+    char *resp = mgmt_request_v1(sock, "PROTO_HELLO 2");
+    ck_assert_str_eq(resp, "PROTO 2");
+    free(resp);
+
+    struct proto_hdr resp_hdr;
+    zframe_t *resp_body = NULL;
+    rv = proto_request(sock, log_ctx, PROTO_OP_DIADDR_REQUEST, (*seq)++, NULL,
+                       0, &resp_hdr, &resp_body);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(resp_hdr.opcode, PROTO_OP_DIADDR_RESPONSE);
+
+    uint16_t diaddr;
+    rv = proto_body_get_u16(resp_body, &diaddr);
+    ck_assert_int_eq(rv, OSD_OK);
+    zframe_destroy(&resp_body);
+
+    return diaddr;
+}
+
+/**
+ * Grant credits to the host controller
+ */
+static void v2_client_grant_credits(zsock_t *sock, uint32_t *seq,
+                                    uint32_t credits)
+{
+    zmsg_t *msg = proto_msg_new_u32(PROTO_OP_CREDIT, (*seq)++, credits);
+    int zmq_rv = zmsg_send(&msg, sock);
+    ck_assert_int_eq(zmq_rv, 0);
+}
+
+/**
+ * Receive the next data message, skipping credit grants
+ *
+ * @return the first payload word of the packet, or -1 if no data message was
+ *         received before the receive timeout expired
+ */
+static int v2_client_recv_data(zsock_t *sock)
+{
+    osd_result rv;
+
+    while (1) {
+        zmsg_t *msg = zmsg_recv(sock);
+        if (!msg) {
+            return -1;
+        }
+
+        struct proto_hdr hdr;
+        rv = proto_hdr_parse(zmsg_first(msg), &hdr);
+        ck_assert_int_eq(rv, OSD_OK);
+        if (hdr.opcode == PROTO_OP_CREDIT) {
+            zmsg_destroy(&msg);
+            continue;
+        }
+        ck_assert_uint_eq(hdr.opcode, PROTO_OP_DATA);
+
+        struct osd_packet *pkg;
+        rv = osd_packet_new_from_zframe(&pkg, zmsg_next(msg));
+        ck_assert_int_eq(rv, OSD_OK);
+        int payload = pkg->data.payload[0];
+        osd_packet_free(&pkg);
+        zmsg_destroy(&msg);
+
+        return payload;
+    }
+}
+
+/**
+ * Wait until the host controller recorded a number of dropped messages
+ */
+static void wait_for_dropped_count(uint64_t expected)
+{
+    struct osd_flowctrl_stats stats;
+    for (int i = 0; i < 5000; i++) {
+        osd_hostctrl_get_flowctrl_stats(hostctrl_ctx, &stats);
+        if (stats.dropped >= expected) {
+            break;
+        }
+        usleep(1000);
+    }
+    ck_assert_uint_eq(stats.dropped, expected);
+}
+
+/**
+ * A receiver out of credits stalls the data flow, nothing is lost
+ */
+START_TEST(test_core_flowctrl_lossless)
+{
+    const int num_events = 50;
+    uint32_t seq = 0;
+
+    zsock_t *rcv_sock = zsock_new_dealer("inproc://testing");
+    ck_assert_ptr_ne(rcv_sock, NULL);
+    zsock_set_rcvtimeo(rcv_sock, 1000);
+    uint16_t rcv_diaddr = v2_client_connect(rcv_sock, &seq);
+    v2_client_grant_credits(rcv_sock, &seq, 10);
+
+    zsock_t *dev_sock = zsock_new_dealer("inproc://testing");
+    ck_assert_ptr_ne(dev_sock, NULL);
+    send_event_packets(dev_sock, rcv_diaddr, num_events);
+
+    for (int i = 0; i < 10; i++) {
+        ck_assert_int_eq(v2_client_recv_data(rcv_sock), i);
+    }
+
+    // no credits left: the remaining packets are held back
+    zsock_set_rcvtimeo(rcv_sock, 100);
+    ck_assert_int_eq(v2_client_recv_data(rcv_sock), -1);
+
+    struct osd_flowctrl_stats stats;
+    osd_hostctrl_get_flowctrl_stats(hostctrl_ctx, &stats);
+    ck_assert_uint_eq(stats.tx_stalls, 1);
+    ck_assert_uint_eq(stats.dropped, 0);
+
+    // and delivered in order after granting more credits
+    zsock_set_rcvtimeo(rcv_sock, 1000);
+    v2_client_grant_credits(rcv_sock, &seq, num_events - 10);
+    for (int i = 10; i < num_events; i++) {
+        ck_assert_int_eq(v2_client_recv_data(rcv_sock), i);
+    }
+
+    osd_hostctrl_get_flowctrl_stats(hostctrl_ctx, &stats);
+    ck_assert_uint_eq(stats.tx_credits, 0);
+    ck_assert_uint_eq(stats.dropped, 0);
+
+    zsock_destroy(&dev_sock);
+    zsock_destroy(&rcv_sock);
+}
+END_TEST
+
+/**
+ * In lossy mode the oldest messages to a stalled receiver are dropped
+ */
+START_TEST(test_core_flowctrl_lossy)
+{
+    osd_result rv;
+    const int num_events = 5000;
+    const int queue_size = 4096;  // PEER_TX_QUEUE_MAX in hostctrl.c
+    uint32_t seq = 0;
+
+    rv = osd_hostctrl_stop(hostctrl_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_hostctrl_set_flowctrl_mode(hostctrl_ctx, OSD_FLOWCTRL_LOSSY);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_hostctrl_start(hostctrl_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    zsock_t *rcv_sock = zsock_new_dealer("inproc://testing");
+    ck_assert_ptr_ne(rcv_sock, NULL);
+    zsock_set_rcvtimeo(rcv_sock, 1000);
+    uint16_t rcv_diaddr = v2_client_connect(rcv_sock, &seq);
+    v2_client_grant_credits(rcv_sock, &seq, 1);
+
+    zsock_t *dev_sock = zsock_new_dealer("inproc://testing");
+    ck_assert_ptr_ne(dev_sock, NULL);
+    send_event_packets(dev_sock, rcv_diaddr, num_events);
+
+    // one packet is sent, the queue keeps the newest ones
+    const int num_dropped = num_events - 1 - queue_size;
+    wait_for_dropped_count(num_dropped);
+    ck_assert_int_eq(v2_client_recv_data(rcv_sock), 0);
+
+    v2_client_grant_credits(rcv_sock, &seq, queue_size);
+    for (int i = 1 + num_dropped; i < num_events; i++) {
+        ck_assert_int_eq(v2_client_recv_data(rcv_sock), i);
+    }
+
+    zsock_destroy(&dev_sock);
+    zsock_destroy(&rcv_sock);
+}
+END_TEST
+
+/**
+ * Register accesses overtake queued trace data and ignore flow control
+ */
+START_TEST(test_core_tclass_control_first)
+{
+    osd_result rv;
+    const int num_events = 20;
+    uint32_t seq = 0;
+
+    zsock_t *rcv_sock = zsock_new_dealer("inproc://testing");
+    ck_assert_ptr_ne(rcv_sock, NULL);
+    zsock_set_rcvtimeo(rcv_sock, 1000);
+    uint16_t rcv_diaddr = v2_client_connect(rcv_sock, &seq);
+    v2_client_grant_credits(rcv_sock, &seq, 1);
+
+    zsock_t *dev_sock = zsock_new_dealer("inproc://testing");
+    ck_assert_ptr_ne(dev_sock, NULL);
+    send_event_packets(dev_sock, rcv_diaddr, num_events);
+
+    struct osd_packet *pkg;
+    rv = osd_packet_new(&pkg, osd_packet_get_data_size_words_from_payload(1));
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_packet_set_header(pkg, rcv_diaddr, osd_diaddr_build(0, 5),
+                          OSD_PACKET_TYPE_REG, RESP_READ_REG_SUCCESS_16);
+    pkg->data.payload[0] = 0xbeef;
+    zmsg_t *msg = zmsg_new();
+    zmsg_addstr(msg, "D");
+    zmsg_addmem(msg, pkg->data_raw, osd_packet_sizeof(pkg));
+    ck_assert_int_eq(zmsg_send(&msg, dev_sock), 0);
+    osd_packet_free(&pkg);
+
+    ck_assert_int_eq(v2_client_recv_data(rcv_sock), 0);
+    ck_assert_int_eq(v2_client_recv_data(rcv_sock), 0xbeef);
+
+    zsock_set_rcvtimeo(rcv_sock, 100);
+    ck_assert_int_eq(v2_client_recv_data(rcv_sock), -1);
+
+    zsock_set_rcvtimeo(rcv_sock, 1000);
+    v2_client_grant_credits(rcv_sock, &seq, num_events - 1);
+    for (int i = 1; i < num_events; i++) {
+        ck_assert_int_eq(v2_client_recv_data(rcv_sock), i);
+    }
+
+    zsock_destroy(&dev_sock);
+    zsock_destroy(&rcv_sock);
+}
+END_TEST
+
+/**
+ * Get the traffic statistics of a client once it sent a number of messages
+ */
+static struct osd_hostctrl_client_stats wait_for_client_packets(
+    uint16_t addr, uint64_t expected)
+{
+    osd_result rv;
+    struct osd_hostctrl_client_stats found = {0};
+    for (int i = 0; i < 5000; i++) {
+        struct osd_hostctrl_client_stats *stats;
+        size_t count;
+        rv = osd_hostctrl_get_client_stats(hostctrl_ctx, &stats, &count);
+        ck_assert_int_eq(rv, OSD_OK);
+        for (size_t c = 0; c < count; c++) {
+            if (!stats[c].is_gateway && stats[c].addr == addr) {
+                found = stats[c];
+            }
+        }
+        free(stats);
+        if (found.packets >= expected) {
+            break;
+        }
+        usleep(1000);
+    }
+    ck_assert_uint_eq(found.addr, addr);
+    ck_assert_uint_eq(found.packets, expected);
+    return found;
+}
+
+/**
+ * A client flooding a receiver doesn't delay the messages of other clients
+ * to the same receiver
+ */
+START_TEST(test_core_fair_queuing)
+{
+    const int num_heavy = 1000;
+    const int num_light = 10;
+    const int light_first = 0x8000;
+    uint32_t rcv_seq = 0, heavy_seq = 0, light_seq = 0;
+
+    zsock_t *rcv_sock = zsock_new_dealer("inproc://testing");
+    ck_assert_ptr_ne(rcv_sock, NULL);
+    zsock_set_rcvtimeo(rcv_sock, 1000);
+    uint16_t rcv_diaddr = v2_client_connect(rcv_sock, &rcv_seq);
+    v2_client_grant_credits(rcv_sock, &rcv_seq, 1);
+
+    zsock_t *heavy_sock = zsock_new_dealer("inproc://testing");
+    ck_assert_ptr_ne(heavy_sock, NULL);
+    uint16_t heavy_diaddr = v2_client_connect(heavy_sock, &heavy_seq);
+    zsock_t *light_sock = zsock_new_dealer("inproc://testing");
+    ck_assert_ptr_ne(light_sock, NULL);
+    uint16_t light_diaddr = v2_client_connect(light_sock, &light_seq);
+
+    // all messages except for the first one wait for credits
+    send_event_packets(heavy_sock, rcv_diaddr, num_heavy);
+    struct osd_hostctrl_client_stats heavy_stats =
+        wait_for_client_packets(heavy_diaddr, num_heavy);
+    send_event_packets_from(light_sock, rcv_diaddr, light_first, num_light);
+    struct osd_hostctrl_client_stats light_stats =
+        wait_for_client_packets(light_diaddr, num_light);
+
+    ck_assert_uint_eq(heavy_stats.tx_queued, num_heavy - 1);
+    ck_assert_uint_eq(light_stats.tx_queued, num_light);
+    ck_assert_uint_eq(light_stats.bytes * num_heavy,
+                      heavy_stats.bytes * num_light);
+
+    // the light client gets its share right away
+    v2_client_grant_credits(rcv_sock, &rcv_seq, num_heavy + num_light);
+    int light_received = 0;
+    int next_heavy = 0;
+    for (int i = 0; i < num_heavy + num_light; i++) {
+        int payload = v2_client_recv_data(rcv_sock);
+        if (payload >= light_first) {
+            ck_assert_int_eq(payload, light_first + light_received);
+            light_received++;
+        } else {
+            ck_assert_int_eq(payload, next_heavy);
+            next_heavy++;
+        }
+        if (i == 4 * num_light) {
+            ck_assert_int_eq(light_received, num_light);
+        }
+    }
+    ck_assert_int_eq(next_heavy, num_heavy);
+
+    heavy_stats = wait_for_client_packets(heavy_diaddr, num_heavy);
+    ck_assert_uint_eq(heavy_stats.tx_queued, 0);
+
+    zsock_destroy(&light_sock);
+    zsock_destroy(&heavy_sock);
+    zsock_destroy(&rcv_sock);
+}
+END_TEST
+
+/**
+ * Statistics are available through the STATS management request
+ */
+START_TEST(test_core_stats)
+{
+    char *resp;
+
+    zsock_t *sock = zsock_new_dealer("inproc://testing");
+    ck_assert_ptr_ne(sock, NULL);
+    zsock_set_rcvtimeo(sock, 1000);
+
+    resp = mgmt_request_v1(sock, "DIADDR_REQUEST");
+    ck_assert_str_eq(resp, "1025");
+    free(resp);
+
+    // no gateway is registered for subnet 7
+    send_event_packets(sock, osd_diaddr_build(7, 1), 2);
+
+    // requests of a client are processed in order: the packets are counted
+    resp = mgmt_request_v1(sock, "STATS");
+    ck_assert_ptr_ne(strstr(resp, "router.rx_packets 2\n"), NULL);
+    ck_assert_ptr_ne(strstr(resp, "router.route_miss 2\n"), NULL);
+    ck_assert_ptr_ne(strstr(resp, "client.1025.rx_packets 2\n"), NULL);
+    free(resp);
+
+    zsock_destroy(&sock);
+}
+END_TEST
+
+/**
+ * Trace records are forwarded with their packet and stamped by the router
+ */
+START_TEST(test_core_latency_trace)
+{
+    osd_result rv;
+    uint32_t seq = 0;
+
+    zsock_t *sock_a = zsock_new_dealer("inproc://testing");
+    ck_assert_ptr_ne(sock_a, NULL);
+    zsock_set_rcvtimeo(sock_a, 1000);
+    uint16_t diaddr_a = v2_client_connect(sock_a, &seq);
+
+    zsock_t *sock_b = zsock_new_dealer("inproc://testing");
+    ck_assert_ptr_ne(sock_b, NULL);
+    zsock_set_rcvtimeo(sock_b, 1000);
+    uint16_t diaddr_b = v2_client_connect(sock_b, &seq);
+
+    struct osd_packet *pkg;
+    rv = osd_packet_new(&pkg, osd_packet_get_data_size_words_from_payload(1));
+    ck_assert_int_eq(rv, OSD_OK);
+
+    struct latency_trace trace = {.id = 42};
+    trace.ts_ns[LATENCY_STAGE_HOSTMOD_SEND] = 1;
+
+    // request from a to b, response from b to a
+    zsock_t *socks[] = {sock_a, sock_b};
+    uint16_t diaddrs[] = {diaddr_a, diaddr_b};
+    for (int i = 0; i < 2; i++) {
+        osd_packet_set_header(pkg, diaddrs[1 - i], diaddrs[i],
+                              OSD_PACKET_TYPE_REG, REQ_READ_REG_16);
+        zmsg_t *msg = zmsg_new();
+        zframe_t *hdr_frame =
+            proto_hdr_frame_new(PROTO_OP_DATA, PROTO_FLAG_TRACE, seq++);
+        zmsg_append(msg, &hdr_frame);
+        zmsg_addmem(msg, pkg->data_raw, osd_packet_sizeof(pkg));
+        zframe_t *trace_frame = latency_trace_frame_new(&trace);
+        zmsg_append(msg, &trace_frame);
+        ck_assert_int_eq(zmsg_send(&msg, socks[i]), 0);
+
+        // skip credit grants
+        struct proto_hdr hdr;
+        while (1) {
+            msg = zmsg_recv(socks[1 - i]);
+            ck_assert_ptr_ne(msg, NULL);
+            rv = proto_hdr_parse(zmsg_first(msg), &hdr);
+            ck_assert_int_eq(rv, OSD_OK);
+            if (hdr.opcode != PROTO_OP_CREDIT) {
+                break;
+            }
+            zmsg_destroy(&msg);
+        }
+        ck_assert_uint_eq(hdr.opcode, PROTO_OP_DATA);
+        ck_assert_uint_eq(zmsg_size(msg), 3);
+        ck_assert_uint_eq(hdr.flags, PROTO_FLAG_TRACE);
+        zmsg_next(msg);
+        rv = latency_trace_from_frame(zmsg_next(msg), &trace);
+        ck_assert_int_eq(rv, OSD_OK);
+        zmsg_destroy(&msg);
+
+        ck_assert_uint_eq(trace.id, 42);
+        ck_assert_uint_eq(trace.ts_ns[LATENCY_STAGE_HOSTMOD_SEND], 1);
+    }
+    ck_assert_uint_gt(trace.ts_ns[LATENCY_STAGE_ROUTER_REQ], 0);
+    ck_assert_uint_ge(trace.ts_ns[LATENCY_STAGE_ROUTER_RESP],
+                      trace.ts_ns[LATENCY_STAGE_ROUTER_REQ]);
+
+    osd_packet_free(&pkg);
+    zsock_destroy(&sock_b);
+    zsock_destroy(&sock_a);
+}
+END_TEST
+
+/**
+ * Compressed data messages are unpacked and routed packet by packet
+ */
+START_TEST(test_core_compressed_data)
+{
+    osd_result rv;
+    uint32_t seq = 0;
+    const uint16_t event_dest = osd_diaddr_build(1, 100);
+    const int packets = 50;
+
+    volatile int count = 0;
+    struct osd_hostmod_ctx *hostmod_ctx;
+    rv = osd_hostmod_new(&hostmod_ctx, log_ctx, "inproc://testing",
+                         count_event_handler, (void *)&count);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_hostmod_connect(hostmod_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_hostmod_subscribe(hostmod_ctx, event_dest);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    zsock_t *sock = zsock_new_dealer("inproc://testing");
+    ck_assert_ptr_ne(sock, NULL);
+    zsock_set_rcvtimeo(sock, 1000);
+    v2_client_connect(sock, &seq);
+
+    // only the known codec is accepted
+    struct proto_hdr resp_hdr;
+    uint16_t codec_le = htole16(0xff);
+    rv = proto_request(sock, log_ctx, PROTO_OP_COMPRESS, seq++, &codec_le,
+                       sizeof(codec_le), &resp_hdr, NULL);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(resp_hdr.opcode, PROTO_OP_NACK);
+    codec_le = htole16(WIRECOMP_CODEC_DELTA_LZ);
+    rv = proto_request(sock, log_ctx, PROTO_OP_COMPRESS, seq++, &codec_le,
+                       sizeof(codec_le), &resp_hdr, NULL);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(resp_hdr.opcode, PROTO_OP_ACK);
+
+    // all packets in one message
+    const size_t pkg_words = osd_packet_get_data_size_words_from_payload(4);
+    size_t size_words = packets * (1 + pkg_words);
+    uint16_t *dtds = calloc(size_words, sizeof(uint16_t));
+    ck_assert_ptr_ne(dtds, NULL);
+    struct osd_packet *pkg;
+    rv = osd_packet_new(&pkg, pkg_words);
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_packet_set_header(pkg, event_dest, osd_diaddr_build(0, 5),
+                          OSD_PACKET_TYPE_EVENT, 0);
+    for (int i = 0; i < packets; i++) {
+        pkg->data.payload[0] = i;
+        dtds[i * (1 + pkg_words)] = pkg_words;
+        memcpy(&dtds[i * (1 + pkg_words) + 1], pkg->data_raw,
+               osd_packet_sizeof(pkg));
+    }
+    osd_packet_free(&pkg);
+
+    uint8_t *data = malloc(wirecomp_bound(size_words));
+    ck_assert_ptr_ne(data, NULL);
+    size_t size = wirecomp_encode(dtds, size_words, data);
+    ck_assert_uint_lt(size, size_words * sizeof(uint16_t));
+
+    zmsg_t *msg = zmsg_new();
+    zframe_t *hdr_frame =
+        proto_hdr_frame_new(PROTO_OP_DATA_COMPRESSED, 0, seq++);
+    zmsg_append(msg, &hdr_frame);
+    zmsg_addmem(msg, data, size);
+    ck_assert_int_eq(zmsg_send(&msg, sock), 0);
+    wait_for_event_count(&count, packets);
+
+    // a corrupted message is dropped as a whole
+    data[0]++;
+    msg = zmsg_new();
+    hdr_frame = proto_hdr_frame_new(PROTO_OP_DATA_COMPRESSED, 0, seq++);
+    zmsg_append(msg, &hdr_frame);
+    zmsg_addmem(msg, data, size);
+    ck_assert_int_eq(zmsg_send(&msg, sock), 0);
+
+    char *resp = mgmt_request_v1(sock, "STATS");
+    ck_assert_ptr_ne(strstr(resp, "router.rx_packets 50\n"), NULL);
+    ck_assert_ptr_ne(strstr(resp, "router.invalid_packets 1\n"), NULL);
+    ck_assert_ptr_ne(strstr(resp, "router.decompress_out_bytes "), NULL);
+    free(resp);
+    ck_assert_int_eq(count, packets);
+
+    free(data);
+    free(dtds);
+    zsock_destroy(&sock);
+    rv = osd_hostmod_disconnect(hostmod_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_hostmod_free(&hostmod_ctx);
+}
+END_TEST
+
+/**
+ * Read the first payload words of the packets in a flight recorder dump
+ *
+ * @return the number of packets read, or -1 if the dump is incomplete
+ */
+static int read_flightrec_dump(const char *filename, uint16_t *words,
+                               int max_packets)
+{
+    struct osd_capture_reader *reader;
+    if (OSD_FAILED(osd_capture_reader_new(&reader, log_ctx, filename))) {
+        return -1;
+    }
+
+    int packets = 0;
+    while (1) {
+        struct osd_capture_record record;
+        if (OSD_FAILED(osd_capture_reader_next(reader, &record))) {
+            packets = -1;
+            break;
+        }
+        if (!record.packet) {
+            break;
+        }
+        if (packets < max_packets) {
+            words[packets] = record.packet->data.payload[0];
+        }
+        packets++;
+        osd_packet_free(&record.packet);
+    }
+    osd_capture_reader_free(&reader);
+    return packets;
+}
+
+/**
+ * A trace trigger dumps the window of packets around a matching sequence
+ */
+START_TEST(test_core_trace_trigger)
+{
+    osd_result rv;
+
+    char dump_base[64], dump_file[80];
+    snprintf(dump_base, sizeof(dump_base), "/tmp/osd-check-flightrec-%d",
+             (int)getpid());
+    snprintf(dump_file, sizeof(dump_file), "%s.0", dump_base);
+
+    // trace triggers require the flight recorder
+    rv = osd_hostctrl_add_trace_trigger(hostctrl_ctx, "type=event", 1, 1);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    rv = osd_hostctrl_set_flightrec(hostctrl_ctx, 64 * 1024, dump_base);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_hostctrl_add_trace_trigger(hostctrl_ctx, "type=event bogus=1",
+                                        1, 1);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+    rv = osd_hostctrl_add_trace_trigger(
+        hostctrl_ctx, "type=event word0=10 then within 5 type=event word0=12",
+        5, 3);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    volatile int count = 0;
+    struct osd_hostmod_ctx *hostmod_ctx;
+    rv = osd_hostmod_new(&hostmod_ctx, log_ctx, "inproc://testing",
+                         count_event_handler, (void *)&count);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_hostmod_connect(hostmod_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    zsock_t *dev_sock = zsock_new_dealer("inproc://testing");
+    ck_assert_ptr_ne(dev_sock, NULL);
+
+    // the trigger fires on the packet 12: the dump holds the 5 packets up to
+    // it and the 3 packets after it
+    send_event_packets(dev_sock, osd_hostmod_get_diaddr(hostmod_ctx), 20);
+    wait_for_event_count(&count, 20);
+
+    uint16_t words[8];
+    int packets = -1;
+    for (int i = 0; i < 5000 && packets < 8; i++) {
+        packets = read_flightrec_dump(dump_file, words, 8);
+        if (packets < 8) {
+            usleep(1000);
+        }
+    }
+    ck_assert_int_eq(packets, 8);
+    for (int i = 0; i < 8; i++) {
+        ck_assert_uint_eq(words[i], 8 + i);
+    }
+    unlink(dump_file);
+
+    zsock_destroy(&dev_sock);
+    rv = osd_hostmod_disconnect(hostmod_ctx);
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_hostmod_free(&hostmod_ctx);
+}
+END_TEST
+
 Suite *suite(void)
 {
     Suite *s;
@@ -83,5 +1186,25 @@ Suite *suite(void)
     tcase_add_test(tc_init, test_init_base);
     suite_add_tcase(s, tc_init);
 
+    // Core functionality
+    tc_core = tcase_create("Core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_core_hostmod_connect);
+    tcase_add_test(tc_core, test_core_v1_client);
+    tcase_add_test(tc_core, test_core_route_mixed_versions);
+    tcase_add_test(tc_core, test_core_gw_multi_subnet);
+    tcase_add_test(tc_core, test_core_gw_filter_multi_subnet);
+    tcase_add_test(tc_core, test_core_subscribe_fanout);
+    tcase_add_test(tc_core, test_core_subscribe_slow_subscriber);
+    tcase_add_test(tc_core, test_core_flowctrl_lossless);
+    tcase_add_test(tc_core, test_core_flowctrl_lossy);
+    tcase_add_test(tc_core, test_core_tclass_control_first);
+    tcase_add_test(tc_core, test_core_fair_queuing);
+    tcase_add_test(tc_core, test_core_stats);
+    tcase_add_test(tc_core, test_core_latency_trace);
+    tcase_add_test(tc_core, test_core_compressed_data);
+    tcase_add_test(tc_core, test_core_trace_trigger);
+    suite_add_tcase(s, tc_core);
+
     return s;
 }
@@ -22,6 +22,7 @@
 #include <osd/hostmod.h>
 #include <osd/osd.h>
 #include <osd/packet.h>
+#include <unistd.h>
 
 struct osd_hostmod_ctx *hostmod_ctx;
 struct osd_log_ctx *log_ctx;
@@ -45,6 +46,8 @@ void setup_hostmod(void)
     ck_assert_int_eq(osd_hostmod_is_connected(hostmod_ctx), 0);
 
     // connect
+    // The mock host controller only speaks the text protocol (version 1).
+    mock_host_controller_expect_mgmt_req("PROTO_HELLO 2", "ACK");
     mock_host_controller_expect_diaddr_req(mock_hostmod_diaddr);
 
     rv = osd_hostmod_connect(hostmod_ctx);
@@ -167,6 +170,113 @@ START_TEST(test_core_read_register_timeout)
 }
 END_TEST
 
+/**
+ * Register accesses are accounted in the latency statistics
+ */
+START_TEST(test_core_reg_stats)
+{
+    osd_result rv;
+    uint16_t reg_read_result;
+    struct osd_hostmod_reg_stats *stats;
+    size_t count;
+
+    rv = osd_hostmod_get_stats(hostmod_ctx, &stats, &count, 0);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(count, 0);
+    ck_assert_ptr_eq(stats, NULL);
+
+    for (int i = 0; i < 3; i++) {
+        mock_host_controller_expect_reg_read(mock_hostmod_diaddr, 1, 0x0000,
+                                             0x0001);
+        rv = osd_hostmod_reg_read(hostmod_ctx, &reg_read_result, 1, 0x0000,
+                                  16, 0);
+        ck_assert_int_eq(rv, OSD_OK);
+    }
+
+    rv = osd_hostmod_get_stats(hostmod_ctx, &stats, &count,
+                               OSD_HOSTMOD_STATS_RESET);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(count, 1);
+    ck_assert_uint_eq(stats[0].subnet, 0);
+    ck_assert(!stats[0].is_write);
+    ck_assert_uint_eq(stats[0].reg_size_bit, 16);
+    ck_assert_uint_eq(stats[0].count, 3);
+    ck_assert_uint_eq(stats[0].errors, 0);
+    ck_assert_uint_gt(stats[0].max_ns, 0);
+    ck_assert_uint_le(stats[0].min_ns, stats[0].p50_ns);
+    ck_assert_uint_le(stats[0].p50_ns, stats[0].p99_ns);
+    ck_assert_uint_le(stats[0].p99_ns, stats[0].p999_ns);
+    ck_assert_uint_le(stats[0].p999_ns, stats[0].max_ns);
+    free(stats);
+
+    // the statistics were reset
+    rv = osd_hostmod_get_stats(hostmod_ctx, &stats, &count, 0);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(count, 0);
+}
+END_TEST
+
+/**
+ * A data packet which arrives while waiting for the response to a
+ * management request is kept
+ */
+START_TEST(test_core_subscribe_data_first)
+{
+    osd_result rv;
+    uint16_t reg_read_result;
+
+    // an unsolicited register read response reaches the host module first
+    struct osd_packet *pkg_resp;
+    rv = osd_packet_new(&pkg_resp,
+                        osd_packet_get_data_size_words_from_payload(1));
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_packet_set_header(pkg_resp, mock_hostmod_diaddr, 1,
+                          OSD_PACKET_TYPE_REG, RESP_READ_REG_SUCCESS_16);
+    pkg_resp->data.payload[0] = 0x1234;
+    mock_host_controller_queue_event_packet(pkg_resp);
+    osd_packet_free(&pkg_resp);
+    mock_host_controller_wait_for_event_tx();
+    usleep(50 * 1000);
+
+    mock_host_controller_expect_mgmt_req("SUBSCRIBE 1", "ACK");
+    rv = osd_hostmod_subscribe(hostmod_ctx, 1);
+    ck_assert_int_eq(rv, OSD_OK);
+
+    // the next register read receives the queued response
+    struct osd_packet *pkg_read_req;
+    rv = osd_packet_new(&pkg_read_req,
+                        osd_packet_get_data_size_words_from_payload(1));
+    ck_assert_int_eq(rv, OSD_OK);
+    osd_packet_set_header(pkg_read_req, 1, mock_hostmod_diaddr,
+                          OSD_PACKET_TYPE_REG, REQ_READ_REG_16);
+    pkg_read_req->data.payload[0] = 0x0000;
+    mock_host_controller_expect_data_req(pkg_read_req, NULL);
+    osd_packet_free(&pkg_read_req);
+
+    rv = osd_hostmod_reg_read(hostmod_ctx, &reg_read_result, 1, 0x0000, 16, 0);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(reg_read_result, 0x1234);
+}
+END_TEST
+
+/**
+ * A management request the host controller doesn't respond to doesn't
+ * block the following requests
+ */
+START_TEST(test_core_subscribe_timeout)
+{
+    osd_result rv;
+
+    mock_host_controller_expect_mgmt_req("SUBSCRIBE 2", NULL);
+    rv = osd_hostmod_subscribe(hostmod_ctx, 2);
+    ck_assert_int_eq(rv, OSD_ERROR_TIMEDOUT);
+
+    mock_host_controller_expect_mgmt_req("SUBSCRIBE 3", "ACK");
+    rv = osd_hostmod_subscribe(hostmod_ctx, 3);
+    ck_assert_int_eq(rv, OSD_OK);
+}
+END_TEST
+
 Suite *suite(void)
 {
     Suite *s;
@@ -188,6 +298,9 @@ Suite *suite(void)
     tcase_add_checked_fixture(tc_core, setup, teardown);
     tcase_add_test(tc_core, test_core_read_register);
     tcase_add_test(tc_core, test_core_read_register_timeout);
+    tcase_add_test(tc_core, test_core_reg_stats);
+    tcase_add_test(tc_core, test_core_subscribe_data_first);
+    tcase_add_test(tc_core, test_core_subscribe_timeout);
     suite_add_tcase(s, tc_core);
 
     return s;
@@ -0,0 +1,134 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TEST_SUITE_NAME "check_latency"
+
+#include "testutil.h"
+
+#include <czmq.h>
+#include <osd/osd.h>
+#include "latency.h"
+#include "stats.h"
+
+START_TEST(test_latency_frame_roundtrip)
+{
+    osd_result rv;
+
+    struct latency_trace trace = {.id = 0x0401000000000007ULL};
+    for (int s = 0; s < LATENCY_STAGE_COUNT; s++) {
+        trace.ts_ns[s] = 1000 + s;
+    }
+
+    zframe_t *frame = latency_trace_frame_new(&trace);
+    ck_assert_uint_eq(zframe_size(frame), LATENCY_TRACE_FRAME_SIZE);
+
+    struct latency_trace decoded;
+    rv = latency_trace_from_frame(frame, &decoded);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_int_eq(memcmp(&trace, &decoded, sizeof(trace)), 0);
+
+    // stamping in place changes only the stage
+    rv = latency_frame_stamp(frame, LATENCY_STAGE_ROUTER_REQ);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = latency_trace_from_frame(frame, &decoded);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(decoded.id, trace.id);
+    ck_assert_uint_gt(decoded.ts_ns[LATENCY_STAGE_ROUTER_REQ], 1000000);
+    ck_assert_uint_eq(decoded.ts_ns[LATENCY_STAGE_GATEWAY_RX],
+                      trace.ts_ns[LATENCY_STAGE_GATEWAY_RX]);
+
+    zframe_destroy(&frame);
+
+    // malformed records
+    zframe_t *short_frame = zframe_new("abc", 3);
+    ck_assert_int_eq(latency_trace_from_frame(short_frame, &decoded),
+                     OSD_ERROR_FAILURE);
+    ck_assert_int_eq(latency_frame_stamp(short_frame, LATENCY_STAGE_ROUTER_REQ),
+                     OSD_ERROR_FAILURE);
+    zframe_destroy(&short_frame);
+    ck_assert_int_eq(latency_trace_from_frame(NULL, &decoded),
+                     OSD_ERROR_FAILURE);
+}
+END_TEST
+
+START_TEST(test_latency_recorder)
+{
+    struct stats_registry *stats = stats_new();
+    struct latency_recorder *rec = latency_recorder_new(stats);
+    ck_assert_ptr_ne(rec, NULL);
+
+    // the device stages are missing: their time is accounted to the next
+    // stage which was passed
+    struct latency_trace trace = {.id = 1};
+    trace.ts_ns[LATENCY_STAGE_HOSTMOD_SEND] = 1000;
+    trace.ts_ns[LATENCY_STAGE_HOSTMOD_TX] = 1100;
+    trace.ts_ns[LATENCY_STAGE_ROUTER_REQ] = 1300;
+    trace.ts_ns[LATENCY_STAGE_ROUTER_RESP] = 5300;
+    trace.ts_ns[LATENCY_STAGE_HOSTMOD_RECV] = 5400;
+    latency_recorder_add(rec, &trace);
+
+    ck_assert_uint_eq(rec->traces_count, 1);
+    ck_assert_uint_eq(rec->stage_ns[LATENCY_STAGE_HOSTMOD_SEND]->count, 0);
+    ck_assert_uint_eq(rec->stage_ns[LATENCY_STAGE_HOSTMOD_TX]->sum, 100);
+    ck_assert_uint_eq(rec->stage_ns[LATENCY_STAGE_ROUTER_REQ]->sum, 200);
+    ck_assert_uint_eq(rec->stage_ns[LATENCY_STAGE_GATEWAY_RX]->count, 0);
+    ck_assert_uint_eq(rec->stage_ns[LATENCY_STAGE_ROUTER_RESP]->sum, 4000);
+    ck_assert_uint_eq(rec->stage_ns[LATENCY_STAGE_HOSTMOD_RECV]->sum, 100);
+    ck_assert_uint_eq(rec->total_ns->sum, 4400);
+
+    // the histograms are exported with the other statistics
+    char *text = stats_dump(stats);
+    ck_assert_ptr_ne(strstr(text, "latency.router_resp.max 4000\n"), NULL);
+    ck_assert_ptr_ne(strstr(text, "latency.total.count 1\n"), NULL);
+    free(text);
+
+    // one slice per stage passed after the first one
+    char *json = NULL;
+    size_t json_size = 0;
+    FILE *f = open_memstream(&json, &json_size);
+    ck_assert_int_eq(latency_recorder_write_json(rec, f), OSD_OK);
+    fclose(f);
+    ck_assert_ptr_ne(strstr(json, "\"traceEvents\":["), NULL);
+    ck_assert_ptr_ne(strstr(json, "{\"name\":\"router_resp\",\"cat\":\"osd\","
+                                  "\"ph\":\"X\",\"pid\":0,\"tid\":1,"
+                                  "\"ts\":1.300,\"dur\":4.000}"),
+                     NULL);
+    int slices = 0;
+    for (char *p = json; (p = strstr(p, "\"ph\":\"X\"")); p++) {
+        slices++;
+    }
+    ck_assert_int_eq(slices, 4);
+    free(json);
+
+    latency_recorder_free(&rec);
+    ck_assert_ptr_eq(rec, NULL);
+    stats_free(&stats);
+}
+END_TEST
+
+Suite *suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_latency_frame_roundtrip);
+    tcase_add_test(tc_core, test_latency_recorder);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
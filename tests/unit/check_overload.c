@@ -0,0 +1,144 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TEST_SUITE_NAME "check_overload"
+
+#include "testutil.h"
+
+#include <osd/osd.h>
+#include "overload.h"
+
+static void count_packets(struct overload *ol, uint16_t src, unsigned int n)
+{
+    for (unsigned int i = 0; i < n; i++) {
+        overload_count(ol, src);
+    }
+}
+
+/**
+ * The noisiest modules are selected until they cover half of the traffic
+ */
+START_TEST(test_overload_select_noisiest)
+{
+    struct overload *ol = overload_new();
+    uint16_t diaddrs[8];
+
+    // nothing counted: nothing to select
+    ck_assert_uint_eq(overload_select(ol, UINT64_MAX, diaddrs, 8), 0);
+
+    count_packets(ol, osd_diaddr_build(2, 5), 30);
+    count_packets(ol, osd_diaddr_build(2, 6), 25);
+    count_packets(ol, osd_diaddr_build(2, 7), 25);
+    count_packets(ol, osd_diaddr_build(2, 8), 20);
+
+    ck_assert_uint_eq(overload_select(ol, UINT64_MAX, diaddrs, 8), 2);
+    ck_assert_uint_eq(diaddrs[0], osd_diaddr_build(2, 5));
+    ck_assert(diaddrs[1] == osd_diaddr_build(2, 6) ||
+              diaddrs[1] == osd_diaddr_build(2, 7));
+
+    // the window starts anew
+    ck_assert_uint_eq(overload_select(ol, UINT64_MAX, diaddrs, 8), 0);
+
+    // a single module dominating the traffic is selected alone
+    count_packets(ol, osd_diaddr_build(2, 5), 100);
+    count_packets(ol, osd_diaddr_build(2, 6), 1);
+    ck_assert_uint_eq(overload_select(ol, UINT64_MAX, diaddrs, 8), 1);
+    ck_assert_uint_eq(diaddrs[0], osd_diaddr_build(2, 5));
+
+    // at most max modules are selected
+    for (unsigned int i = 1; i <= 10; i++) {
+        count_packets(ol, osd_diaddr_build(3, i), 10);
+    }
+    ck_assert_uint_eq(overload_select(ol, UINT64_MAX, diaddrs, 2), 2);
+
+    overload_free(&ol);
+    ck_assert_ptr_eq(ol, NULL);
+}
+END_TEST
+
+/**
+ * Only modules in the given subnets which aren't stalled yet are selected
+ */
+START_TEST(test_overload_select_subnets)
+{
+    struct overload *ol = overload_new();
+    uint16_t diaddrs[8];
+
+    count_packets(ol, osd_diaddr_build(2, 1), 100);
+    count_packets(ol, osd_diaddr_build(3, 1), 10);
+    ck_assert_uint_eq(overload_select(ol, 1ULL << 3, diaddrs, 8), 1);
+    ck_assert_uint_eq(diaddrs[0], osd_diaddr_build(3, 1));
+
+    // the window of other subnets is kept
+    overload_stall(ol, osd_diaddr_build(2, 1), 1000);
+    count_packets(ol, osd_diaddr_build(2, 2), 10);
+    ck_assert_uint_eq(overload_select(ol, 1ULL << 2, diaddrs, 8), 1);
+    ck_assert_uint_eq(diaddrs[0], osd_diaddr_build(2, 2));
+
+    overload_free(&ol);
+}
+END_TEST
+
+/**
+ * Stalled modules are tracked with the start of their stall
+ */
+START_TEST(test_overload_stall_resume)
+{
+    struct overload *ol = overload_new();
+    uint16_t diaddr;
+
+    ck_assert(!overload_find_stalled(ol, UINT64_MAX, &diaddr));
+    ck_assert_int_eq(overload_resume(ol, osd_diaddr_build(2, 1)), 0);
+
+    overload_stall(ol, osd_diaddr_build(2, 1), 1000);
+    overload_stall(ol, osd_diaddr_build(4, 3), 2000);
+    ck_assert(overload_is_stalled(ol, osd_diaddr_build(2, 1)));
+    ck_assert(!overload_is_stalled(ol, osd_diaddr_build(2, 2)));
+
+    // stalling again keeps the start of the stall
+    overload_stall(ol, osd_diaddr_build(2, 1), 1500);
+
+    ck_assert(!overload_find_stalled(ol, 1ULL << 3, &diaddr));
+    ck_assert(overload_find_stalled(ol, 1ULL << 4, &diaddr));
+    ck_assert_uint_eq(diaddr, osd_diaddr_build(4, 3));
+
+    ck_assert(overload_find_stalled(ol, UINT64_MAX, &diaddr));
+    ck_assert_uint_eq(diaddr, osd_diaddr_build(2, 1));
+    ck_assert_int_eq(overload_resume(ol, diaddr), 1000);
+    ck_assert(!overload_is_stalled(ol, diaddr));
+
+    ck_assert(overload_find_stalled(ol, UINT64_MAX, &diaddr));
+    ck_assert_int_eq(overload_resume(ol, diaddr), 2000);
+    ck_assert(!overload_find_stalled(ol, UINT64_MAX, &diaddr));
+
+    overload_free(&ol);
+}
+END_TEST
+
+Suite *suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_overload_select_noisiest);
+    tcase_add_test(tc_core, test_overload_select_subnets);
+    tcase_add_test(tc_core, test_overload_stall_resume);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -58,6 +58,27 @@ START_TEST(test_packet_header_set)
 }
 END_TEST
 
+START_TEST(test_packet_traffic_class)
+{
+    osd_result rv;
+    struct osd_packet *pkg;
+    rv = osd_packet_new(&pkg, osd_packet_get_data_size_words_from_payload(0));
+    ck_assert_int_eq(rv, OSD_OK);
+
+    osd_packet_set_header(pkg, 0x1ab, 0x157, OSD_PACKET_TYPE_REG,
+                          RESP_READ_REG_SUCCESS_16);
+    ck_assert_int_eq(osd_packet_get_traffic_class(pkg), OSD_TCLASS_CONTROL);
+
+    osd_packet_set_header(pkg, 0x1ab, 0x157, OSD_PACKET_TYPE_EVENT, 0);
+    ck_assert_int_eq(osd_packet_get_traffic_class(pkg), OSD_TCLASS_BULK);
+
+    osd_packet_set_header(pkg, 0x1ab, 0x157, OSD_PACKET_TYPE_PLAIN, 0);
+    ck_assert_int_eq(osd_packet_get_traffic_class(pkg), OSD_TCLASS_BULK);
+
+    osd_packet_free(&pkg);
+}
+END_TEST
+
 Suite *suite(void)
 {
     Suite *s;
@@ -70,6 +91,7 @@ Suite *suite(void)
 
     tcase_add_test(tc_core, test_packet_header_set);
     tcase_add_test(tc_core, test_packet_header_extractparts);
+    tcase_add_test(tc_core, test_packet_traffic_class);
     suite_add_tcase(s, tc_core);
 
     return s;
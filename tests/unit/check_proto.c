@@ -0,0 +1,188 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TEST_SUITE_NAME "check_proto"
+
+#include "testutil.h"
+
+#include <czmq.h>
+#include <osd/osd.h>
+#include "proto.h"
+
+START_TEST(test_proto_hdr_roundtrip)
+{
+    osd_result rv;
+
+    zframe_t *frame = proto_hdr_frame_new(PROTO_OP_GW_REGISTER, 0x1234,
+                                          0xdeadbeef);
+    ck_assert_ptr_ne(frame, NULL);
+    ck_assert_uint_eq(zframe_size(frame), PROTO_HDR_SIZE);
+    ck_assert(proto_is_hdr_frame(frame));
+
+    struct proto_hdr hdr;
+    rv = proto_hdr_parse(frame, &hdr);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(hdr.version, PROTO_VERSION_2);
+    ck_assert_uint_eq(hdr.opcode, PROTO_OP_GW_REGISTER);
+    ck_assert_uint_eq(hdr.flags, 0x1234);
+    ck_assert_uint_eq(hdr.seq, 0xdeadbeef);
+
+    // fields are encoded little endian
+    const uint8_t exp[PROTO_HDR_SIZE] = {PROTO_VERSION_2, PROTO_OP_GW_REGISTER,
+                                         0x34, 0x12, 0xef, 0xbe, 0xad, 0xde};
+    ck_assert_int_eq(memcmp(zframe_data(frame), exp, PROTO_HDR_SIZE), 0);
+
+    zframe_destroy(&frame);
+}
+END_TEST
+
+/**
+ * Version 1 type frames must not be mistaken for version 2 headers
+ */
+START_TEST(test_proto_hdr_v1_frames)
+{
+    struct proto_hdr hdr;
+
+    zframe_t *frame_d = zframe_new("D", 1);
+    ck_assert(!proto_is_hdr_frame(frame_d));
+    ck_assert_int_eq(proto_hdr_parse(frame_d, &hdr), OSD_ERROR_FAILURE);
+    zframe_destroy(&frame_d);
+
+    zframe_t *frame_m = zframe_new("M", 1);
+    ck_assert(!proto_is_hdr_frame(frame_m));
+    zframe_destroy(&frame_m);
+
+    // correct size, but wrong version
+    const uint8_t buf[PROTO_HDR_SIZE] = {0x01, PROTO_OP_DATA};
+    zframe_t *frame_v1 = zframe_new(buf, sizeof(buf));
+    ck_assert(!proto_is_hdr_frame(frame_v1));
+    zframe_destroy(&frame_v1);
+
+    ck_assert(!proto_is_hdr_frame(NULL));
+}
+END_TEST
+
+START_TEST(test_proto_msg_u16)
+{
+    osd_result rv;
+
+    zmsg_t *msg = proto_msg_new_u16(PROTO_OP_DIADDR_RESPONSE, 42, 0x0401);
+    ck_assert_uint_eq(zmsg_size(msg), 2);
+
+    struct proto_hdr hdr;
+    rv = proto_hdr_parse(zmsg_first(msg), &hdr);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(hdr.opcode, PROTO_OP_DIADDR_RESPONSE);
+    ck_assert_uint_eq(hdr.seq, 42);
+
+    uint16_t value;
+    rv = proto_body_get_u16(zmsg_next(msg), &value);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(value, 0x0401);
+
+    zmsg_destroy(&msg);
+
+    // body of wrong size
+    zframe_t *body = zframe_new("abc", 3);
+    rv = proto_body_get_u16(body, &value);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+    zframe_destroy(&body);
+
+    rv = proto_body_get_u16(NULL, &value);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+}
+END_TEST
+
+START_TEST(test_proto_msg_u16_str)
+{
+    osd_result rv;
+
+    zmsg_t *msg = proto_msg_new_u16_str(PROTO_OP_GW_FILTER, 7, 3, "drop");
+    ck_assert_uint_eq(zmsg_size(msg), 2);
+
+    struct proto_hdr hdr;
+    rv = proto_hdr_parse(zmsg_first(msg), &hdr);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(hdr.opcode, PROTO_OP_GW_FILTER);
+
+    uint16_t value;
+    char *str;
+    rv = proto_body_get_u16_str(zmsg_next(msg), &value, &str);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(value, 3);
+    ck_assert_str_eq(str, "drop");
+    free(str);
+
+    zmsg_destroy(&msg);
+
+    // empty text
+    msg = proto_msg_new_u16_str(PROTO_OP_GW_FILTER, 8, 4, "");
+    rv = proto_body_get_u16_str(zmsg_last(msg), &value, &str);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(value, 4);
+    ck_assert_str_eq(str, "");
+    free(str);
+    zmsg_destroy(&msg);
+
+    // body too short
+    zframe_t *body = zframe_new("a", 1);
+    rv = proto_body_get_u16_str(body, &value, &str);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+    zframe_destroy(&body);
+}
+END_TEST
+
+START_TEST(test_proto_credit_rx)
+{
+    struct proto_credit_rx credit = {0};
+
+    // initial grant fills the window
+    ck_assert_uint_eq(proto_credit_rx_refill(&credit), PROTO_CREDIT_WINDOW);
+    ck_assert_uint_eq(proto_credit_rx_refill(&credit), 0);
+
+    // no refill while more than half of the window is left
+    for (int i = 0; i < PROTO_CREDIT_WINDOW / 2; i++) {
+        proto_credit_rx_use(&credit);
+    }
+    ck_assert_uint_eq(proto_credit_rx_refill(&credit), 0);
+
+    proto_credit_rx_use(&credit);
+    ck_assert_uint_eq(proto_credit_rx_refill(&credit),
+                      PROTO_CREDIT_WINDOW / 2 + 1);
+
+    // messages from a sender ignoring flow control don't underflow
+    struct proto_credit_rx credit_none = {0};
+    proto_credit_rx_use(&credit_none);
+    ck_assert_uint_eq(credit_none.outstanding, 0);
+}
+END_TEST
+
+Suite *suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_proto_hdr_roundtrip);
+    tcase_add_test(tc_core, test_proto_hdr_v1_frames);
+    tcase_add_test(tc_core, test_proto_msg_u16);
+    tcase_add_test(tc_core, test_proto_msg_u16_str);
+    tcase_add_test(tc_core, test_proto_credit_rx);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
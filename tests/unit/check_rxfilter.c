@@ -0,0 +1,202 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TEST_SUITE_NAME "check_rxfilter"
+
+#include "testutil.h"
+
+#include <osd/gateway.h>
+#include <osd/osd.h>
+#include <osd/packet.h>
+#include "rxfilter.h"
+
+#define MS (1000ULL * 1000)
+
+static struct osd_packet *packet_new(uint16_t src, enum osd_packet_type type,
+                                     unsigned int type_sub,
+                                     unsigned int payload_words)
+{
+    struct osd_packet *pkg;
+    osd_result rv = osd_packet_new(
+        &pkg, osd_packet_get_data_size_words_from_payload(payload_words));
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_packet_set_header(pkg, osd_diaddr_build(0, 1), src, type,
+                               type_sub);
+    ck_assert_int_eq(rv, OSD_OK);
+    return pkg;
+}
+
+static enum rxfilter_verdict apply(struct rxfilter *f, uint16_t src,
+                                   unsigned int type_sub,
+                                   unsigned int payload_words,
+                                   uint64_t now_ns)
+{
+    struct osd_packet *pkg =
+        packet_new(src, OSD_PACKET_TYPE_EVENT, type_sub, payload_words);
+    enum rxfilter_verdict verdict = rxfilter_apply(f, pkg, now_ns);
+    osd_packet_free(&pkg);
+    return verdict;
+}
+
+static uint32_t get_u32(const struct osd_packet *pkg, unsigned int word)
+{
+    return pkg->data.payload[word] | (uint32_t)pkg->data.payload[word + 1]
+                                         << 16;
+}
+
+/**
+ * Rules are parsed, invalid rules are rejected
+ */
+START_TEST(test_rxfilter_parse)
+{
+    struct rxfilter *f;
+
+    ck_assert_int_eq(rxfilter_new(&f, ""), OSD_OK);
+    ck_assert_uint_eq(rxfilter_rules_count(f), 0);
+    rxfilter_free(&f);
+    ck_assert_ptr_eq(f, NULL);
+
+    ck_assert_int_eq(rxfilter_new(&f, "drop src=1.5 ; sample 10 type_sub=3;"
+                                      "\naggregate 100 src=0x402\n"),
+                     OSD_OK);
+    ck_assert_uint_eq(rxfilter_rules_count(f), 3);
+    ck_assert(rxfilter_aggregates(f));
+    rxfilter_free(&f);
+
+    ck_assert_int_eq(rxfilter_new(&f, "drop; sample 2"), OSD_OK);
+    ck_assert(!rxfilter_aggregates(f));
+    rxfilter_free(&f);
+
+    const char *invalid[] = {
+        "keep",           "sample",           "sample 0",
+        "aggregate -1",   "drop src=",        "drop src=1.",
+        "drop src=x.1",   "drop type_sub=16", "drop foo=1",
+        "drop src=70000",
+    };
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        f = NULL;
+        ck_assert_int_eq(rxfilter_new(&f, invalid[i]), OSD_ERROR_FAILURE);
+        ck_assert_ptr_eq(f, NULL);
+    }
+}
+END_TEST
+
+/**
+ * The first matching rule decides, register accesses are never filtered
+ */
+START_TEST(test_rxfilter_drop_sample)
+{
+    struct rxfilter *f;
+    uint16_t mod_a = osd_diaddr_build(1, 5);
+    uint16_t mod_b = osd_diaddr_build(1, 6);
+
+    ck_assert_int_eq(rxfilter_new(&f, "drop src=1.5; sample 3 type_sub=2"),
+                     OSD_OK);
+
+    ck_assert_int_eq(apply(f, mod_a, 2, 4, 0), RXFILTER_DROP);
+    ck_assert_int_eq(apply(f, mod_b, 1, 4, 0), RXFILTER_PASS);
+
+    struct osd_packet *reg = packet_new(mod_a, OSD_PACKET_TYPE_REG,
+                                        RESP_READ_REG_SUCCESS_16, 1);
+    ck_assert_int_eq(rxfilter_apply(f, reg, 0), RXFILTER_PASS);
+    osd_packet_free(&reg);
+
+    // every third packet is sampled, counted per source
+    enum rxfilter_verdict expected[] = {RXFILTER_PASS, RXFILTER_DROP,
+                                        RXFILTER_DROP, RXFILTER_PASS};
+    for (unsigned int i = 0; i < 4; i++) {
+        ck_assert_int_eq(apply(f, mod_b, 2, 4, 0), expected[i]);
+    }
+    ck_assert_int_eq(apply(f, osd_diaddr_build(2, 6), 2, 4, 0),
+                     RXFILTER_PASS);
+
+    rxfilter_free(&f);
+}
+END_TEST
+
+/**
+ * Aggregated sources are summarized once their interval is over
+ */
+START_TEST(test_rxfilter_aggregate)
+{
+    struct rxfilter *f;
+    struct osd_packet *pkgs[4];
+    uint16_t mod_a = osd_diaddr_build(1, 5);
+    uint16_t mod_b = osd_diaddr_build(3, 2);
+
+    ck_assert_int_eq(rxfilter_new(&f, "aggregate 10 src=1.5; aggregate 20"),
+                     OSD_OK);
+
+    ck_assert_int_eq(apply(f, mod_a, 0, 0, 1 * MS), RXFILTER_AGGREGATE);
+    ck_assert_int_eq(apply(f, mod_a, 0, 3, 2 * MS), RXFILTER_AGGREGATE);
+    ck_assert_int_eq(apply(f, mod_a, 0, 200, 3 * MS), RXFILTER_AGGREGATE);
+    ck_assert_int_eq(apply(f, mod_b, 0, 1, 5 * MS), RXFILTER_AGGREGATE);
+
+    ck_assert_uint_eq(rxfilter_flush(f, 10 * MS, false, pkgs, 4), 0);
+    ck_assert_uint_eq(rxfilter_flush(f, 11 * MS, false, pkgs, 4), 1);
+
+    struct osd_packet *pkg = pkgs[0];
+    ck_assert_uint_eq(pkg->data_size_words,
+                      osd_packet_get_data_size_words_from_payload(
+                          OSD_GATEWAY_SUMMARY_PAYLOAD_WORDS));
+    ck_assert_uint_eq(osd_packet_get_type(pkg), OSD_PACKET_TYPE_EVENT);
+    ck_assert_uint_eq(osd_packet_get_type_sub(pkg),
+                      OSD_GATEWAY_SUMMARY_TYPE_SUB);
+    ck_assert_uint_eq(osd_packet_get_src(pkg), mod_a);
+    ck_assert_uint_eq(osd_packet_get_dest(pkg), osd_diaddr_build(0, 1));
+    ck_assert_uint_eq(get_u32(pkg, 0), 3);
+    ck_assert_uint_eq(get_u32(pkg, 2), 203);
+    ck_assert_uint_eq(get_u32(pkg, 4), 10);
+    ck_assert_uint_eq(get_u32(pkg, 6), 1);   // 0 words
+    ck_assert_uint_eq(get_u32(pkg, 8), 0);   // 1 word
+    ck_assert_uint_eq(get_u32(pkg, 10), 1);  // 2..3 words
+    ck_assert_uint_eq(get_u32(pkg, 20), 1);  // 64 words and more
+    osd_packet_free(&pkgs[0]);
+
+    // a source without packets in its interval is not summarized
+    ck_assert_uint_eq(rxfilter_flush(f, 22 * MS, false, pkgs, 4), 0);
+    ck_assert_uint_eq(rxfilter_flush(f, 25 * MS, false, pkgs, 4), 1);
+    ck_assert_uint_eq(osd_packet_get_src(pkgs[0]), mod_b);
+    ck_assert_uint_eq(get_u32(pkgs[0], 0), 1);
+    osd_packet_free(&pkgs[0]);
+
+    // all pending summaries can be created at once
+    ck_assert_int_eq(apply(f, mod_a, 0, 1, 30 * MS), RXFILTER_AGGREGATE);
+    ck_assert_int_eq(apply(f, mod_b, 0, 1, 30 * MS), RXFILTER_AGGREGATE);
+    ck_assert_uint_eq(rxfilter_flush(f, 31 * MS, true, pkgs, 1), 1);
+    osd_packet_free(&pkgs[0]);
+    ck_assert_uint_eq(rxfilter_flush(f, 31 * MS, true, pkgs, 4), 1);
+    osd_packet_free(&pkgs[0]);
+    ck_assert_uint_eq(rxfilter_flush(f, 31 * MS, true, pkgs, 4), 0);
+
+    rxfilter_free(&f);
+}
+END_TEST
+
+Suite *suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_rxfilter_parse);
+    tcase_add_test(tc_core, test_rxfilter_drop_sample);
+    tcase_add_test(tc_core, test_rxfilter_aggregate);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
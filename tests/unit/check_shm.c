@@ -0,0 +1,321 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TEST_SUITE_NAME "check_shm"
+
+#include "testutil.h"
+
+#include <czmq.h>
+#include <osd/osd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "shm.h"
+
+/**
+ * Create a ring and a second mapping of it, as the other side would see it
+ */
+static void ring_pair_new(struct shm_ring **producer,
+                          struct shm_ring **consumer, size_t size)
+{
+    osd_result rv;
+
+    rv = shm_ring_new(producer, size);
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = shm_ring_map(consumer, dup(shm_ring_get_fd(*producer)));
+    ck_assert_int_eq(rv, OSD_OK);
+}
+
+static zmsg_t *msg_new_seq(uint32_t seq, size_t size)
+{
+    zmsg_t *msg = zmsg_new();
+    zmsg_addmem(msg, &seq, sizeof(seq));
+    uint8_t *buf = calloc(1, size + 1);
+    memset(buf, seq & 0xff, size);
+    zmsg_addmem(msg, buf, size);
+    free(buf);
+    return msg;
+}
+
+static void assert_msg_seq(zmsg_t *msg, uint32_t seq, size_t size)
+{
+    ck_assert_ptr_ne(msg, NULL);
+    ck_assert_uint_eq(zmsg_size(msg), 2);
+
+    zframe_t *seq_frame = zmsg_first(msg);
+    ck_assert_uint_eq(zframe_size(seq_frame), sizeof(seq));
+    ck_assert_int_eq(memcmp(zframe_data(seq_frame), &seq, sizeof(seq)), 0);
+
+    zframe_t *data_frame = zmsg_next(msg);
+    ck_assert_uint_eq(zframe_size(data_frame), size);
+    for (size_t i = 0; i < size; i++) {
+        ck_assert_uint_eq(zframe_data(data_frame)[i], seq & 0xff);
+    }
+}
+
+START_TEST(test_shm_ring_roundtrip)
+{
+    osd_result rv;
+    struct shm_ring *producer, *consumer;
+    ring_pair_new(&producer, &consumer, 4096);
+
+    ck_assert_ptr_eq(shm_ring_read(consumer), NULL);
+
+    zmsg_t *msg = msg_new_seq(1, 10);
+    rv = shm_ring_write(producer, msg);
+    ck_assert_int_eq(rv, OSD_OK);
+    zmsg_destroy(&msg);
+
+    // empty frames survive as well
+    msg = zmsg_new();
+    zmsg_addmem(msg, NULL, 0);
+    rv = shm_ring_write(producer, msg);
+    ck_assert_int_eq(rv, OSD_OK);
+    zmsg_destroy(&msg);
+
+    msg = shm_ring_read(consumer);
+    assert_msg_seq(msg, 1, 10);
+    zmsg_destroy(&msg);
+
+    msg = shm_ring_read(consumer);
+    ck_assert_ptr_ne(msg, NULL);
+    ck_assert_uint_eq(zmsg_size(msg), 1);
+    ck_assert_uint_eq(zframe_size(zmsg_first(msg)), 0);
+    zmsg_destroy(&msg);
+
+    ck_assert_ptr_eq(shm_ring_read(consumer), NULL);
+
+    shm_ring_free(&consumer);
+    shm_ring_free(&producer);
+    ck_assert_ptr_eq(producer, NULL);
+}
+END_TEST
+
+/**
+ * Messages keep their order and content when wrapping around the ring
+ */
+START_TEST(test_shm_ring_wrap)
+{
+    osd_result rv;
+    struct shm_ring *producer, *consumer;
+    ring_pair_new(&producer, &consumer, 512);
+
+    uint32_t seq_write = 0, seq_read = 0;
+    while (seq_read < 1000) {
+        // write until the ring is full
+        while (1) {
+            zmsg_t *msg = msg_new_seq(seq_write, seq_write % 37);
+            rv = shm_ring_write(producer, msg);
+            zmsg_destroy(&msg);
+            if (rv == OSD_ERROR_COM) {
+                break;
+            }
+            ck_assert_int_eq(rv, OSD_OK);
+            seq_write++;
+        }
+
+        // read some messages
+        for (int i = 0; i < 3; i++) {
+            zmsg_t *msg = shm_ring_read(consumer);
+            assert_msg_seq(msg, seq_read, seq_read % 37);
+            zmsg_destroy(&msg);
+            seq_read++;
+        }
+    }
+
+    shm_ring_free(&consumer);
+    shm_ring_free(&producer);
+}
+END_TEST
+
+START_TEST(test_shm_ring_too_large)
+{
+    osd_result rv;
+    struct shm_ring *producer, *consumer;
+    ring_pair_new(&producer, &consumer, 256);
+
+    zmsg_t *msg = msg_new_seq(1, 200);
+    rv = shm_ring_write(producer, msg);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+    zmsg_destroy(&msg);
+
+    ck_assert_ptr_eq(shm_ring_read(consumer), NULL);
+
+    shm_ring_free(&consumer);
+    shm_ring_free(&producer);
+}
+END_TEST
+
+/**
+ * Wakeups are only requested by a side which announced to sleep
+ */
+START_TEST(test_shm_ring_wakeup)
+{
+    osd_result rv;
+    zmsg_t *msg;
+    struct shm_ring *producer, *consumer;
+    ring_pair_new(&producer, &consumer, 256);
+
+    // no sleeping consumer: no wakeup
+    msg = msg_new_seq(1, 8);
+    rv = shm_ring_write(producer, msg);
+    ck_assert_int_eq(rv, OSD_OK);
+    zmsg_destroy(&msg);
+    ck_assert(!shm_ring_consumer_needs_wakeup(producer));
+
+    // the consumer must not sleep while data is available
+    ck_assert(!shm_ring_consumer_sleep(consumer));
+    msg = shm_ring_read(consumer);
+    zmsg_destroy(&msg);
+    ck_assert(shm_ring_consumer_sleep(consumer));
+
+    // the next write wakes up the consumer, but only once
+    msg = msg_new_seq(2, 8);
+    rv = shm_ring_write(producer, msg);
+    ck_assert_int_eq(rv, OSD_OK);
+    zmsg_destroy(&msg);
+    ck_assert(shm_ring_consumer_needs_wakeup(producer));
+    ck_assert(!shm_ring_consumer_needs_wakeup(producer));
+
+    // fill the ring; the producer waits for space
+    do {
+        msg = msg_new_seq(3, 8);
+        rv = shm_ring_write(producer, msg);
+        zmsg_destroy(&msg);
+    } while (rv == OSD_OK);
+    ck_assert_int_eq(rv, OSD_ERROR_COM);
+    ck_assert(shm_ring_producer_sleep(producer));
+
+    // reading makes space and wakes up the producer, but only once
+    msg = shm_ring_read(consumer);
+    zmsg_destroy(&msg);
+    ck_assert(shm_ring_producer_needs_wakeup(consumer));
+    ck_assert(!shm_ring_producer_needs_wakeup(consumer));
+
+    // space freed before the producer went to sleep: no sleep
+    do {
+        msg = msg_new_seq(4, 8);
+        rv = shm_ring_write(producer, msg);
+        zmsg_destroy(&msg);
+    } while (rv == OSD_OK);
+    msg = shm_ring_read(consumer);
+    zmsg_destroy(&msg);
+    ck_assert(!shm_ring_producer_sleep(producer));
+
+    shm_ring_free(&consumer);
+    shm_ring_free(&producer);
+}
+END_TEST
+
+/**
+ * A malformed record marks the ring as corrupt instead of being read again
+ * and again
+ */
+START_TEST(test_shm_ring_corrupt)
+{
+    osd_result rv;
+    struct shm_ring *producer, *consumer;
+    ring_pair_new(&producer, &consumer, 4096);
+
+    zmsg_t *msg = msg_new_seq(1, 10);
+    rv = shm_ring_write(producer, msg);
+    ck_assert_int_eq(rv, OSD_OK);
+    zmsg_destroy(&msg);
+
+    // overwrite the size in the record header with a size larger than the
+    // ring; the data area is at the end of the shared memory
+    int fd = shm_ring_get_fd(producer);
+    struct stat st;
+    ck_assert_int_eq(fstat(fd, &st), 0);
+    uint8_t *mem =
+        mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ck_assert_ptr_ne(mem, MAP_FAILED);
+    uint32_t bogus_size = 8192;
+    memcpy(mem + st.st_size - 4096, &bogus_size, sizeof(bogus_size));
+    munmap(mem, st.st_size);
+
+    ck_assert(!shm_ring_is_corrupt(consumer));
+    ck_assert_ptr_eq(shm_ring_read(consumer), NULL);
+    ck_assert(shm_ring_is_corrupt(consumer));
+    ck_assert_ptr_eq(shm_ring_read(consumer), NULL);
+
+    shm_ring_free(&consumer);
+    shm_ring_free(&producer);
+}
+END_TEST
+
+START_TEST(test_shm_ring_map_invalid)
+{
+    osd_result rv;
+    struct shm_ring *ring;
+
+    // not a ring
+    int fd = memfd_create("not-a-ring", 0);
+    ck_assert_int_ne(fd, -1);
+    ck_assert_int_eq(ftruncate(fd, 4096), 0);
+    rv = shm_ring_map(&ring, fd);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    // a ring in a memfd which can be resized
+    struct shm_ring *sealed;
+    rv = shm_ring_new(&sealed, 4096);
+    ck_assert_int_eq(rv, OSD_OK);
+    struct stat st;
+    ck_assert_int_eq(fstat(shm_ring_get_fd(sealed), &st), 0);
+    uint8_t *sealed_mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED,
+                               shm_ring_get_fd(sealed), 0);
+    ck_assert_ptr_ne(sealed_mem, MAP_FAILED);
+
+    fd = memfd_create("unsealed-ring", MFD_ALLOW_SEALING);
+    ck_assert_int_ne(fd, -1);
+    ck_assert_int_eq(ftruncate(fd, st.st_size), 0);
+    uint8_t *mem =
+        mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ck_assert_ptr_ne(mem, MAP_FAILED);
+    memcpy(mem, sealed_mem, st.st_size);
+    munmap(mem, st.st_size);
+    munmap(sealed_mem, st.st_size);
+    rv = shm_ring_map(&ring, fd);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    // the rings created by shm_ring_new() can't be resized
+    ck_assert_int_eq(ftruncate(shm_ring_get_fd(sealed), 0), -1);
+    ck_assert_int_eq(ftruncate(shm_ring_get_fd(sealed), 2 * st.st_size), -1);
+    shm_ring_free(&sealed);
+
+    ck_assert(shm_is_url("shm:///tmp/osd"));
+    ck_assert(!shm_is_url("tcp://localhost:9537"));
+    ck_assert(!shm_is_url("ipc:///tmp/osd"));
+}
+END_TEST
+
+Suite *suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_shm_ring_roundtrip);
+    tcase_add_test(tc_core, test_shm_ring_wrap);
+    tcase_add_test(tc_core, test_shm_ring_too_large);
+    tcase_add_test(tc_core, test_shm_ring_wakeup);
+    tcase_add_test(tc_core, test_shm_ring_corrupt);
+    tcase_add_test(tc_core, test_shm_ring_map_invalid);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,163 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TEST_SUITE_NAME "check_stats"
+
+#include "testutil.h"
+
+#include <czmq.h>
+#include <osd/osd.h>
+#include "osd-private.h"
+#include "stats.h"
+
+START_TEST(test_stats_counter)
+{
+    struct stats_registry *reg = stats_new();
+    ck_assert_ptr_ne(reg, NULL);
+
+    uint64_t *c1 = stats_counter(reg, "client.%u.rx_packets", 5);
+    ck_assert_ptr_ne(c1, NULL);
+    ck_assert_uint_eq(stats_counter_get(c1), 0);
+
+    // registering the same name again returns the same counter
+    uint64_t *c1_again = stats_counter(reg, "client.5.rx_packets");
+    ck_assert_ptr_eq(c1, c1_again);
+
+    uint64_t *c2 = stats_counter(reg, "route_miss");
+    ck_assert_ptr_ne(c1, c2);
+
+    stats_counter_add(c1, 3);
+    stats_counter_add(c1, 2);
+    stats_counter_add(c2, 1);
+    ck_assert_uint_eq(stats_counter_get(c1), 5);
+    ck_assert_uint_eq(stats_counter_get(c2), 1);
+
+    // counters of different threads don't share a cache line
+    ck_assert_uint_ge(labs((char *)c1 - (char *)c2), 64);
+
+    stats_free(&reg);
+    ck_assert_ptr_eq(reg, NULL);
+}
+END_TEST
+
+START_TEST(test_stats_hist)
+{
+    struct stats_registry *reg = stats_new();
+    struct stats_hist *hist = stats_hist(reg, "latency");
+
+    ck_assert_uint_eq(stats_hist_percentile(hist, 50), 0);
+
+    // 98 small values, two large ones
+    for (int i = 0; i < 98; i++) {
+        stats_hist_record(hist, 10);
+    }
+    stats_hist_record(hist, 1000);
+    stats_hist_record(hist, 5000);
+
+    ck_assert_uint_eq(hist->count, 100);
+    ck_assert_uint_eq(hist->sum, 98 * 10 + 1000 + 5000);
+    ck_assert_uint_eq(hist->max, 5000);
+
+    // 10 is in bucket [8, 16)
+    ck_assert_uint_eq(stats_hist_percentile(hist, 50), 15);
+    // 1000 is in bucket [512, 1024)
+    ck_assert_uint_eq(stats_hist_percentile(hist, 99), 1023);
+    // the bucket bound is capped by the maximum
+    ck_assert_uint_eq(stats_hist_percentile(hist, 100), 5000);
+
+    stats_hist_record(hist, 0);
+    ck_assert_uint_eq(stats_hist_percentile(hist, 0), 0);
+
+    stats_free(&reg);
+}
+END_TEST
+
+START_TEST(test_stats_dump)
+{
+    struct stats_registry *reg = stats_new();
+
+    stats_counter_add(stats_counter(reg, "rx_packets"), 42);
+    stats_hist_record(stats_hist(reg, "batch"), 4);
+    stats_counter(reg, "tx_packets");
+
+    char *text = stats_dump(reg);
+    ck_assert_str_eq(text,
+                     "rx_packets 42\n"
+                     "batch.count 1\n"
+                     "batch.sum 4\n"
+                     "batch.p50 4\n"
+                     "batch.p99 4\n"
+                     "batch.max 4\n"
+                     "tx_packets 0\n");
+    free(text);
+
+    stats_free(&reg);
+}
+END_TEST
+
+static int end_loop(zloop_t *loop, int timer_id, void *arg)
+{
+    return -1;
+}
+
+START_TEST(test_stats_endpoint)
+{
+    osd_result rv;
+
+    struct stats_registry *reg = stats_new();
+    stats_counter_add(stats_counter(reg, "rx_packets"), 7);
+
+    zloop_t *loop = zloop_new();
+    zsock_t *endpoint_sock = NULL;
+    rv = stats_endpoint_bind(loop, reg, "inproc://check-stats", &endpoint_sock);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_ptr_ne(endpoint_sock, NULL);
+
+    zsock_t *req = zsock_new_req("inproc://check-stats");
+    ck_assert_ptr_ne(req, NULL);
+    zstr_send(req, STATS_REQUEST);
+
+    // serve the request, then end the loop
+    zloop_timer(loop, 200, 1, end_loop, NULL);
+    zloop_start(loop);
+
+    char *response = zstr_recv(req);
+    ck_assert_str_eq(response, "rx_packets 7\n");
+    zstr_free(&response);
+
+    zsock_destroy(&req);
+    stats_endpoint_close(loop, &endpoint_sock);
+    ck_assert_ptr_eq(endpoint_sock, NULL);
+    zloop_destroy(&loop);
+    stats_free(&reg);
+}
+END_TEST
+
+Suite *suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_stats_counter);
+    tcase_add_test(tc_core, test_stats_hist);
+    tcase_add_test(tc_core, test_stats_dump);
+    tcase_add_test(tc_core, test_stats_endpoint);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
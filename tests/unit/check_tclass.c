@@ -0,0 +1,106 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TEST_SUITE_NAME "check_tclass"
+
+#include "testutil.h"
+
+#include <czmq.h>
+#include <osd/osd.h>
+#include <osd/packet.h>
+#include "tclass.h"
+
+START_TEST(test_tclass_sched_strict)
+{
+    struct tclass_sched sched;
+    tclass_sched_init(&sched, OSD_TCLASS_WEIGHT_STRICT);
+
+    ck_assert_int_eq(tclass_sched_next(&sched, false, false), -1);
+    ck_assert_int_eq(tclass_sched_next(&sched, false, true), OSD_TCLASS_BULK);
+
+    // control traffic always wins
+    for (int i = 0; i < 100; i++) {
+        ck_assert_int_eq(tclass_sched_next(&sched, true, true),
+                         OSD_TCLASS_CONTROL);
+    }
+}
+END_TEST
+
+START_TEST(test_tclass_sched_weighted)
+{
+    struct tclass_sched sched;
+    tclass_sched_init(&sched, 3);
+
+    // three control messages for every bulk message if both are waiting
+    for (int round = 0; round < 5; round++) {
+        for (int i = 0; i < 3; i++) {
+            ck_assert_int_eq(tclass_sched_next(&sched, true, true),
+                             OSD_TCLASS_CONTROL);
+        }
+        ck_assert_int_eq(tclass_sched_next(&sched, true, true),
+                         OSD_TCLASS_BULK);
+    }
+
+    // no bulk message waiting: control is served without limit
+    for (int i = 0; i < 10; i++) {
+        ck_assert_int_eq(tclass_sched_next(&sched, true, false),
+                         OSD_TCLASS_CONTROL);
+    }
+    ck_assert_int_eq(tclass_sched_next(&sched, true, true), OSD_TCLASS_BULK);
+}
+END_TEST
+
+START_TEST(test_tclass_from_frame)
+{
+    osd_result rv;
+    struct osd_packet *pkg;
+    rv = osd_packet_new(&pkg, osd_packet_get_data_size_words_from_payload(1));
+    ck_assert_int_eq(rv, OSD_OK);
+
+    osd_packet_set_header(pkg, 0x1ab, 0x157, OSD_PACKET_TYPE_REG,
+                          REQ_READ_REG_16);
+    zframe_t *frame = zframe_new(pkg->data_raw, osd_packet_sizeof(pkg));
+    ck_assert_int_eq(tclass_from_frame(frame), OSD_TCLASS_CONTROL);
+    zframe_destroy(&frame);
+
+    osd_packet_set_header(pkg, 0x1ab, 0x157, OSD_PACKET_TYPE_EVENT, 0);
+    frame = zframe_new(pkg->data_raw, osd_packet_sizeof(pkg));
+    ck_assert_int_eq(tclass_from_frame(frame), OSD_TCLASS_BULK);
+    zframe_destroy(&frame);
+
+    // too short for a header
+    frame = zframe_new(pkg->data_raw, 2);
+    ck_assert_int_eq(tclass_from_frame(frame), OSD_TCLASS_BULK);
+    zframe_destroy(&frame);
+
+    osd_packet_free(&pkg);
+}
+END_TEST
+
+Suite *suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_tclass_sched_strict);
+    tcase_add_test(tc_core, test_tclass_sched_weighted);
+    tcase_add_test(tc_core, test_tclass_from_frame);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
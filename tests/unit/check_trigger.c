@@ -0,0 +1,218 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TEST_SUITE_NAME "check_trigger"
+
+#include "testutil.h"
+
+#include <osd/osd.h>
+#include <osd/packet.h>
+#include "trigger.h"
+
+/**
+ * Evaluate a trigger on an EVENT packet to the host controller
+ */
+static bool eval(struct trigger *t, uint16_t src, unsigned int type_sub,
+                 uint16_t word0)
+{
+    struct osd_packet *pkg;
+    osd_result rv =
+        osd_packet_new(&pkg, osd_packet_get_data_size_words_from_payload(2));
+    ck_assert_int_eq(rv, OSD_OK);
+    rv = osd_packet_set_header(pkg, osd_diaddr_build(0, 1), src,
+                               OSD_PACKET_TYPE_EVENT, type_sub);
+    ck_assert_int_eq(rv, OSD_OK);
+    pkg->data.payload[0] = word0;
+    pkg->data.payload[1] = 0xffff;
+
+    bool fired = trigger_eval(t, pkg);
+    osd_packet_free(&pkg);
+    return fired;
+}
+
+/**
+ * Patterns are compiled, invalid patterns are rejected
+ */
+START_TEST(test_trigger_parse)
+{
+    struct trigger *t;
+
+    const char *valid[] = {
+        "type=event",
+        "src=1.5 type_sub=2 then within 10 src=0x406 word0=0x42/0xff",
+        "type=reg dest=1 then type=plain then within 1 type=3 word7=1",
+        " type=event\tsrc=1.5\n",
+    };
+    for (size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); i++) {
+        t = NULL;
+        ck_assert_int_eq(trigger_new(&t, valid[i]), OSD_OK);
+        ck_assert_ptr_ne(t, NULL);
+        trigger_free(&t);
+        ck_assert_ptr_eq(t, NULL);
+    }
+
+    const char *invalid[] = {
+        "",
+        "then",
+        "type=event then",
+        "then type=event",
+        "within 10 type=event",
+        "type=event then within 0 type=event",
+        "type=event then within type=event",
+        "type=event then within 5 within 5 type=event",
+        "type=event within 5",
+        "type=trace",
+        "type_sub=16",
+        "src=1.",
+        "src=x.1",
+        "src=70000",
+        "word8=1",
+        "word0=0x10000",
+        "word0=1/",
+        "foo=1",
+        "event",
+        "type=event type=reg",
+        "word0=0x12/0xff word0=0x13/0x0f",
+    };
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        t = NULL;
+        ck_assert_msg(trigger_new(&t, invalid[i]) == OSD_ERROR_FAILURE,
+                      "pattern \"%s\" was accepted", invalid[i]);
+        ck_assert_ptr_eq(t, NULL);
+    }
+
+    // at most TRIGGER_STEPS_MAX steps
+    ck_assert_int_eq(trigger_new(&t, "type=event then type=event then "
+                                     "type=event then type=event then "
+                                     "type=event then type=event then "
+                                     "type=event then type=event"),
+                     OSD_OK);
+    trigger_free(&t);
+    ck_assert_int_eq(trigger_new(&t, "type=event then type=event then "
+                                     "type=event then type=event then "
+                                     "type=event then type=event then "
+                                     "type=event then type=event then "
+                                     "type=event"),
+                     OSD_ERROR_FAILURE);
+}
+END_TEST
+
+/**
+ * All conditions of a step must match
+ */
+START_TEST(test_trigger_conditions)
+{
+    struct trigger *t;
+    uint16_t mod_a = osd_diaddr_build(1, 5);
+    uint16_t mod_b = osd_diaddr_build(1, 6);
+
+    ck_assert_int_eq(
+        trigger_new(&t, "type=event src=1.5 type_sub=2 word0=0x40/0xf0"),
+        OSD_OK);
+    ck_assert(!eval(t, mod_b, 2, 0x42));
+    ck_assert(!eval(t, mod_a, 3, 0x42));
+    ck_assert(!eval(t, mod_a, 2, 0x52));
+    ck_assert(eval(t, mod_a, 2, 0x42));
+    ck_assert(eval(t, mod_a, 2, 0x4f));
+    trigger_free(&t);
+
+    // other types and destinations
+    ck_assert_int_eq(trigger_new(&t, "type=reg"), OSD_OK);
+    ck_assert(!eval(t, mod_a, 2, 0));
+    trigger_free(&t);
+    ck_assert_int_eq(trigger_new(&t, "dest=0.1 type=2"), OSD_OK);
+    ck_assert(eval(t, mod_a, 2, 0));
+    trigger_free(&t);
+
+    // payload words beyond the end of the packet don't match
+    ck_assert_int_eq(trigger_new(&t, "word2=0/0"), OSD_OK);
+    ck_assert(!eval(t, mod_a, 2, 0));
+    trigger_free(&t);
+    ck_assert_int_eq(trigger_new(&t, "word1=0/0"), OSD_OK);
+    ck_assert(eval(t, mod_a, 2, 0));
+    trigger_free(&t);
+}
+END_TEST
+
+/**
+ * Sequences of steps, with and without a window
+ */
+START_TEST(test_trigger_sequence)
+{
+    struct trigger *t;
+    uint16_t mod_a = osd_diaddr_build(1, 5);
+    uint16_t mod_b = osd_diaddr_build(1, 6);
+    uint16_t mod_c = osd_diaddr_build(1, 7);
+
+    ck_assert_int_eq(trigger_new(&t, "src=1.5 then src=1.6 then src=1.7"),
+                     OSD_OK);
+    ck_assert(!eval(t, mod_b, 0, 0));
+    ck_assert(!eval(t, mod_a, 0, 0));
+    ck_assert(!eval(t, mod_c, 0, 0));
+    ck_assert(!eval(t, mod_b, 0, 0));
+    ck_assert(!eval(t, mod_b, 0, 0));
+    ck_assert(eval(t, mod_c, 0, 0));
+    // the trigger starts over after firing
+    ck_assert(!eval(t, mod_c, 0, 0));
+    ck_assert(!eval(t, mod_a, 0, 0));
+    ck_assert(!eval(t, mod_b, 0, 0));
+    trigger_reset(t);
+    ck_assert(!eval(t, mod_c, 0, 0));
+    trigger_free(&t);
+
+    ck_assert_int_eq(trigger_new(&t, "src=1.5 then within 2 src=1.6"),
+                     OSD_OK);
+    ck_assert(!eval(t, mod_a, 0, 0));
+    ck_assert(!eval(t, mod_c, 0, 0));
+    ck_assert(eval(t, mod_b, 0, 0));
+
+    // too late
+    ck_assert(!eval(t, mod_a, 0, 0));
+    ck_assert(!eval(t, mod_c, 0, 0));
+    ck_assert(!eval(t, mod_c, 0, 0));
+    ck_assert(!eval(t, mod_b, 0, 0));
+
+    // a repeated first step restarts the window
+    ck_assert(!eval(t, mod_a, 0, 0));
+    ck_assert(!eval(t, mod_c, 0, 0));
+    ck_assert(!eval(t, mod_a, 0, 0));
+    ck_assert(!eval(t, mod_c, 0, 0));
+    ck_assert(eval(t, mod_b, 0, 0));
+
+    // the packet closing a window can start a new sequence
+    ck_assert(!eval(t, mod_a, 0, 0));
+    ck_assert(!eval(t, mod_c, 0, 0));
+    ck_assert(!eval(t, mod_c, 0, 0));
+    ck_assert(!eval(t, mod_a, 0, 0));
+    ck_assert(eval(t, mod_b, 0, 0));
+    trigger_free(&t);
+}
+END_TEST
+
+Suite *suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_trigger_parse);
+    tcase_add_test(tc_core, test_trigger_conditions);
+    tcase_add_test(tc_core, test_trigger_sequence);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -18,6 +18,7 @@
 #include "testutil.h"
 
 #include <osd/osd.h>
+#include "util.h"
 
 START_TEST(test_util)
 {
@@ -30,6 +31,41 @@ START_TEST(test_util)
 }
 END_TEST
 
+START_TEST(test_util_parse_uint)
+{
+    unsigned long value;
+
+    ck_assert(util_parse_uint("42", 100, &value));
+    ck_assert_uint_eq(value, 42);
+    ck_assert(util_parse_uint("0x10", 100, &value));
+    ck_assert_uint_eq(value, 16);
+    ck_assert(util_parse_uint("100", 100, &value));
+    ck_assert_uint_eq(value, 100);
+
+    ck_assert(!util_parse_uint("101", 100, &value));
+    ck_assert(!util_parse_uint("", 100, &value));
+    ck_assert(!util_parse_uint("-1", 100, &value));
+    ck_assert(!util_parse_uint("4x", 100, &value));
+}
+END_TEST
+
+START_TEST(test_util_parse_diaddr)
+{
+    uint16_t diaddr;
+
+    ck_assert(util_parse_diaddr("1.5", &diaddr));
+    ck_assert_uint_eq(diaddr, osd_diaddr_build(1, 5));
+    ck_assert(util_parse_diaddr("0x1234", &diaddr));
+    ck_assert_uint_eq(diaddr, 0x1234);
+
+    ck_assert(!util_parse_diaddr("1.", &diaddr));
+    ck_assert(!util_parse_diaddr(".5", &diaddr));
+    ck_assert(!util_parse_diaddr("1.5.6", &diaddr));
+    ck_assert(!util_parse_diaddr("123456789.1", &diaddr));
+    ck_assert(!util_parse_diaddr("0x10000", &diaddr));
+}
+END_TEST
+
 Suite *suite(void)
 {
     Suite *s;
@@ -41,6 +77,8 @@ Suite *suite(void)
     tc_core = tcase_create("Core");
 
     tcase_add_test(tc_core, test_util);
+    tcase_add_test(tc_core, test_util_parse_uint);
+    tcase_add_test(tc_core, test_util_parse_diaddr);
     suite_add_tcase(s, tc_core);
 
     return s;
@@ -0,0 +1,209 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TEST_SUITE_NAME "check_wirecomp"
+
+#include "testutil.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "wirecomp.h"
+
+/**
+ * Compress and decompress a stream of DTDs, check the result
+ *
+ * @return the size of the compressed stream (bytes)
+ */
+static size_t roundtrip(const uint16_t *dtds, size_t size_words)
+{
+    uint8_t *data = malloc(wirecomp_bound(size_words));
+    ck_assert_ptr_ne(data, NULL);
+    size_t size = wirecomp_encode(dtds, size_words, data);
+    ck_assert_uint_le(size, wirecomp_bound(size_words));
+
+    uint16_t *decoded;
+    size_t decoded_words;
+    osd_result rv = wirecomp_decode(data, size, &decoded, &decoded_words);
+    ck_assert_int_eq(rv, OSD_OK);
+    ck_assert_uint_eq(decoded_words, size_words);
+    ck_assert_int_eq(
+        memcmp(decoded, dtds, size_words * sizeof(uint16_t)), 0);
+
+    free(decoded);
+    free(data);
+    return size;
+}
+
+/**
+ * Fill a buffer with a stream of EVENT packets as trace modules send them
+ *
+ * The packets come from @p sources modules in turn and carry a timestamp and
+ * a sequence number in the first payload words.
+ *
+ * @return the size of the stream (words)
+ */
+static size_t event_stream(uint16_t *dtds, unsigned int packets,
+                           unsigned int sources)
+{
+    size_t pos = 0;
+    for (unsigned int i = 0; i < packets; i++) {
+        unsigned int payload_words = 2 + i % 5;
+        dtds[pos++] = 3 + payload_words;
+        dtds[pos++] = 0x0005;                     // dest
+        dtds[pos++] = 0x0402 + i % sources;       // src
+        dtds[pos++] = 0x8000;                     // EVENT
+        dtds[pos++] = (i * 37) & 0xffff;          // timestamp
+        dtds[pos++] = i / sources;                // sequence number
+        for (unsigned int j = 2; j < payload_words; j++) {
+            dtds[pos++] = (i * 7919 + j * 104729) & 0xffff;
+        }
+    }
+    return pos;
+}
+
+START_TEST(test_wirecomp_roundtrip)
+{
+    uint16_t dtds[3000];
+
+    // empty stream
+    roundtrip(dtds, 0);
+
+    // packets of all sizes, including empty packets
+    size_t pos = 0;
+    for (unsigned int len = 0; pos + 1 + len <= 3000; len++) {
+        dtds[pos++] = len;
+        for (unsigned int i = 0; i < len; i++) {
+            dtds[pos++] = (len * 31 + i * 17) & 0xffff;
+        }
+    }
+    roundtrip(dtds, pos);
+
+    // random data: no back references
+    srand(42);
+    pos = 0;
+    while (pos + 10 <= 3000) {
+        dtds[pos++] = 9;
+        for (int i = 0; i < 9; i++) {
+            dtds[pos++] = rand();
+        }
+    }
+    roundtrip(dtds, pos);
+
+    // long runs: back references overlapping the output
+    pos = 0;
+    while (pos + 100 <= 3000) {
+        dtds[pos++] = 99;
+        for (int i = 0; i < 99; i++) {
+            dtds[pos++] = 0xabcd;
+        }
+    }
+    roundtrip(dtds, pos);
+}
+END_TEST
+
+/**
+ * Trace streams compress well
+ */
+START_TEST(test_wirecomp_event_stream)
+{
+    uint16_t *dtds = malloc(10000 * 10 * sizeof(uint16_t));
+    ck_assert_ptr_ne(dtds, NULL);
+    size_t size_words = event_stream(dtds, 10000, 4);
+
+    size_t size = roundtrip(dtds, size_words);
+    ck_assert_uint_lt(size * 2, size_words * sizeof(uint16_t));
+
+    free(dtds);
+}
+END_TEST
+
+/**
+ * Malformed input is rejected
+ */
+START_TEST(test_wirecomp_invalid)
+{
+    osd_result rv;
+    uint16_t *decoded;
+    size_t decoded_words;
+
+    uint16_t dtds[200];
+    size_t size_words = event_stream(dtds, 20, 2);
+    uint8_t data[1024];
+    ck_assert_uint_le(wirecomp_bound(size_words), sizeof(data));
+    size_t size = wirecomp_encode(dtds, size_words, data);
+
+    // truncated
+    for (size_t len = 0; len < size; len++) {
+        rv = wirecomp_decode(data, len, &decoded, &decoded_words);
+        ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+    }
+
+    // wrong size in the header
+    data[0]++;
+    rv = wirecomp_decode(data, size, &decoded, &decoded_words);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+    data[0]--;
+
+    // too large
+    uint8_t large[] = {0xff, 0xff, 0xff, 0x7f, 0x00};
+    rv = wirecomp_decode(large, sizeof(large), &decoded, &decoded_words);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    // back reference before the start of the stream
+    // (4 words: one literal byte, then 7 bytes copied from 2 bytes back)
+    uint8_t bad_ref[] = {4, 0, 0, 0, 0x13, 0xaa, 0x02, 0x00};
+    rv = wirecomp_decode(bad_ref, sizeof(bad_ref), &decoded, &decoded_words);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    // packet size exceeding the stream
+    // (an empty packet, stored as literals, with its size changed to 5)
+    uint16_t empty_dtd = 0;
+    size = wirecomp_encode(&empty_dtd, 1, data);
+    ck_assert_uint_eq(size, 4 + 1 + sizeof(uint16_t));
+    data[4 + 1] = 5;
+    rv = wirecomp_decode(data, size, &decoded, &decoded_words);
+    ck_assert_int_eq(rv, OSD_ERROR_FAILURE);
+
+    // corrupted data is rejected or decoded into a valid stream of DTDs
+    size = wirecomp_encode(dtds, size_words, data);
+    for (size_t i = 4; i < size; i++) {
+        for (int bit = 0; bit < 8; bit++) {
+            data[i] ^= 1 << bit;
+            rv = wirecomp_decode(data, size, &decoded, &decoded_words);
+            if (OSD_SUCCEEDED(rv)) {
+                ck_assert_uint_eq(decoded_words, size_words);
+                free(decoded);
+            }
+            data[i] ^= 1 << bit;
+        }
+    }
+}
+END_TEST
+
+Suite *suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create(TEST_SUITE_NAME);
+
+    tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_wirecomp_roundtrip);
+    tcase_add_test(tc_core, test_wirecomp_event_stream);
+    tcase_add_test(tc_core, test_wirecomp_invalid);
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,290 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mock_glip.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <libglip.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Byte FIFO of one direction of a channel
+ */
+struct mock_glip_fifo {
+    uint8_t *data;
+    size_t len;
+    /** Position of the next byte to be read */
+    size_t pos;
+};
+
+struct glip_ctx {
+    void *caller_ctx;
+    bool connected;
+    unsigned int channels_len;
+    /** Data to be read by the gateway (written by the simulated device) */
+    struct mock_glip_fifo rx[MOCK_GLIP_CHANNELS_MAX];
+    /** Data written by the gateway */
+    struct mock_glip_fifo tx[MOCK_GLIP_CHANNELS_MAX];
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+/** The only GLIP context */
+static struct glip_ctx *mock_glip_ctx;
+
+/** Number of channels the simulated device provides */
+static unsigned int mock_glip_channel_count = MOCK_GLIP_CHANNELS_MAX;
+
+static void mock_glip_fifo_append(struct mock_glip_fifo *fifo,
+                                  const uint8_t *data, size_t size)
+{
+    fifo->data = realloc(fifo->data, fifo->len + size);
+    assert(fifo->data);
+    memcpy(fifo->data + fifo->len, data, size);
+    fifo->len += size;
+}
+
+static void mock_glip_unlock(void *mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
+/**
+ * Set the number of channels the simulated device provides
+ */
+void mock_glip_set_channel_count(unsigned int channels)
+{
+    assert(channels <= MOCK_GLIP_CHANNELS_MAX);
+    mock_glip_channel_count = channels;
+}
+
+/**
+ * Let the simulated device send data over a channel
+ *
+ * @param words data in native endianness, converted to big endian
+ */
+void mock_glip_queue_rx(unsigned int channel, const uint16_t *words,
+                        size_t size_words)
+{
+    struct glip_ctx *ctx = mock_glip_ctx;
+    assert(ctx);
+    assert(channel < MOCK_GLIP_CHANNELS_MAX);
+
+    pthread_mutex_lock(&ctx->lock);
+    for (size_t w = 0; w < size_words; w++) {
+        uint8_t be[2] = { words[w] >> 8, words[w] & 0xff };
+        mock_glip_fifo_append(&ctx->rx[channel], be, sizeof(be));
+    }
+    pthread_cond_broadcast(&ctx->cond);
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+/**
+ * Get the number of words written to a channel so far
+ */
+size_t mock_glip_get_tx_words(unsigned int channel)
+{
+    struct glip_ctx *ctx = mock_glip_ctx;
+    assert(ctx);
+    assert(channel < MOCK_GLIP_CHANNELS_MAX);
+
+    pthread_mutex_lock(&ctx->lock);
+    size_t words = ctx->tx[channel].len / sizeof(uint16_t);
+    pthread_mutex_unlock(&ctx->lock);
+    return words;
+}
+
+/**
+ * Get the data written to a channel so far
+ *
+ * @param[out] words the data in native endianness
+ * @return the number of words stored in @p words
+ */
+size_t mock_glip_get_tx(unsigned int channel, uint16_t *words,
+                        size_t max_words)
+{
+    struct glip_ctx *ctx = mock_glip_ctx;
+    assert(ctx);
+    assert(channel < MOCK_GLIP_CHANNELS_MAX);
+
+    pthread_mutex_lock(&ctx->lock);
+    struct mock_glip_fifo *fifo = &ctx->tx[channel];
+    size_t size_words = fifo->len / sizeof(uint16_t);
+    if (size_words > max_words) {
+        size_words = max_words;
+    }
+    for (size_t w = 0; w < size_words; w++) {
+        words[w] = fifo->data[2 * w] << 8 | fifo->data[2 * w + 1];
+    }
+    pthread_mutex_unlock(&ctx->lock);
+    return size_words;
+}
+
+int glip_new(struct glip_ctx **ctx, const char *backend_name,
+             const struct glip_option opts[], size_t n, glip_log_fn fn)
+{
+    assert(!mock_glip_ctx);
+
+    struct glip_ctx *c = calloc(1, sizeof(struct glip_ctx));
+    assert(c);
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->cond, NULL);
+
+    mock_glip_ctx = c;
+    *ctx = c;
+    return 0;
+}
+
+int glip_free(struct glip_ctx *ctx)
+{
+    assert(ctx == mock_glip_ctx);
+
+    for (unsigned int i = 0; i < MOCK_GLIP_CHANNELS_MAX; i++) {
+        free(ctx->rx[i].data);
+        free(ctx->tx[i].data);
+    }
+    pthread_cond_destroy(&ctx->cond);
+    pthread_mutex_destroy(&ctx->lock);
+    free(ctx);
+    mock_glip_ctx = NULL;
+    return 0;
+}
+
+void *glip_get_caller_ctx(struct glip_ctx *ctx)
+{
+    return ctx->caller_ctx;
+}
+
+void glip_set_caller_ctx(struct glip_ctx *ctx, void *c)
+{
+    ctx->caller_ctx = c;
+}
+
+void glip_set_log_priority(struct glip_ctx *ctx, int p)
+{
+}
+
+unsigned int glip_get_fifo_width(struct glip_ctx *ctx)
+{
+    return 2;
+}
+
+int glip_open(struct glip_ctx *ctx, unsigned int num_channels)
+{
+    pthread_mutex_lock(&ctx->lock);
+    ctx->connected = true;
+    ctx->channels_len = mock_glip_channel_count;
+    pthread_mutex_unlock(&ctx->lock);
+    return 0;
+}
+
+int glip_close(struct glip_ctx *ctx)
+{
+    pthread_mutex_lock(&ctx->lock);
+    ctx->connected = false;
+    pthread_cond_broadcast(&ctx->cond);
+    pthread_mutex_unlock(&ctx->lock);
+    return 0;
+}
+
+bool glip_is_connected(struct glip_ctx *ctx)
+{
+    pthread_mutex_lock(&ctx->lock);
+    bool connected = ctx->connected;
+    pthread_mutex_unlock(&ctx->lock);
+    return connected;
+}
+
+unsigned int glip_get_channel_count(struct glip_ctx *ctx)
+{
+    return ctx->channels_len;
+}
+
+int glip_read(struct glip_ctx *ctx, uint32_t channel, size_t size,
+              uint8_t *data, size_t *size_read)
+{
+    assert(channel < ctx->channels_len);
+
+    pthread_mutex_lock(&ctx->lock);
+    if (!ctx->connected) {
+        pthread_mutex_unlock(&ctx->lock);
+        return -ENOTCONN;
+    }
+    struct mock_glip_fifo *fifo = &ctx->rx[channel];
+    if (size > fifo->len - fifo->pos) {
+        size = fifo->len - fifo->pos;
+    }
+    if (size) {
+        memcpy(data, fifo->data + fifo->pos, size);
+        fifo->pos += size;
+    }
+    *size_read = size;
+    pthread_mutex_unlock(&ctx->lock);
+    return 0;
+}
+
+/**
+ * Blocking read; the timeout is ignored
+ *
+ * Returns -ENOTCONN once the connection is closed.
+ */
+int glip_read_b(struct glip_ctx *ctx, uint32_t channel, size_t size,
+                uint8_t *data, size_t *size_read, unsigned int timeout)
+{
+    assert(channel < ctx->channels_len);
+
+    int rv = 0;
+    struct mock_glip_fifo *fifo = &ctx->rx[channel];
+
+    // the gateway cancels threads blocked in a read
+    pthread_mutex_lock(&ctx->lock);
+    pthread_cleanup_push(mock_glip_unlock, &ctx->lock);
+    while (ctx->connected && fifo->len - fifo->pos < size) {
+        pthread_cond_wait(&ctx->cond, &ctx->lock);
+    }
+    if (ctx->connected) {
+        memcpy(data, fifo->data + fifo->pos, size);
+        fifo->pos += size;
+        *size_read = size;
+    } else {
+        *size_read = 0;
+        rv = -ENOTCONN;
+    }
+    pthread_cleanup_pop(1);
+    return rv;
+}
+
+/**
+ * Blocking write; the timeout is ignored
+ */
+int glip_write_b(struct glip_ctx *ctx, uint32_t channel, size_t size,
+                 uint8_t *data, size_t *size_written, unsigned int timeout)
+{
+    assert(channel < ctx->channels_len);
+
+    pthread_mutex_lock(&ctx->lock);
+    if (!ctx->connected) {
+        pthread_mutex_unlock(&ctx->lock);
+        return -ENOTCONN;
+    }
+    mock_glip_fifo_append(&ctx->tx[channel], data, size);
+    *size_written = size;
+    pthread_mutex_unlock(&ctx->lock);
+    return 0;
+}
@@ -0,0 +1,39 @@
+/* Copyright 2017 The Open SoC Debug Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MOCK_GLIP_H
+#define MOCK_GLIP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Mock of the GLIP library: a device with in-memory FIFOs per channel
+ *
+ * The mock replaces libglip when linked into a test. Only one GLIP context
+ * can exist at a time, the functions below access it.
+ */
+
+/** Maximum number of channels of the simulated device */
+#define MOCK_GLIP_CHANNELS_MAX 16
+
+void mock_glip_set_channel_count(unsigned int channels);
+void mock_glip_queue_rx(unsigned int channel, const uint16_t *words,
+                        size_t size_words);
+size_t mock_glip_get_tx_words(unsigned int channel);
+size_t mock_glip_get_tx(unsigned int channel, uint16_t *words,
+                        size_t max_words);
+
+#endif // MOCK_GLIP_H
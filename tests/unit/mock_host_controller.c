@@ -223,6 +223,8 @@ osd_result mock_host_controller_queue_event_packet(const struct osd_packet *pkg)
 
 /**
  * Expect a management message with a given command and a given response
+ *
+ * If @p resp is NULL the request isn't answered.
  */
 void mock_host_controller_expect_mgmt_req(const char *cmd, const char *resp)
 {
@@ -238,6 +240,10 @@ void mock_host_controller_expect_mgmt_req(const char *cmd, const char *resp)
     rv = zlist_append(mock_exp_req_list, req_msg);
     ck_assert_int_eq(rv, 0);
 
+    if (!resp) {
+        return;
+    }
+
     // response
     zmsg_t *resp_msg = zmsg_new();
     ck_assert_ptr_ne(req_msg, NULL);
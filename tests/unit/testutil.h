@@ -58,6 +58,50 @@ struct osd_log_ctx* testutil_get_log_ctx()
     return log_ctx;
 }
 
+#ifdef TESTUTIL_STATS
+#include <czmq.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Get the statistics served on a stats endpoint
+ *
+ * Define TESTUTIL_STATS before including this file to use it (needs czmq).
+ * The returned string is freed with zstr_free().
+ */
+char *testutil_get_stats(const char *endpoint)
+{
+    zsock_t *stats_sock = zsock_new_req(endpoint);
+    ck_assert_ptr_ne(stats_sock, NULL);
+    zstr_send(stats_sock, "STATS");
+    char *stats = zstr_recv(stats_sock);
+    ck_assert_ptr_ne(stats, NULL);
+    zsock_destroy(&stats_sock);
+    return stats;
+}
+
+/**
+ * Get a value from the text returned by a stats endpoint
+ */
+uint64_t testutil_stats_value(const char *stats, const char *name)
+{
+    size_t name_len = strlen(name);
+    const char *line = stats;
+    while (line) {
+        if (!strncmp(line, name, name_len) && line[name_len] == ' ') {
+            return strtoull(line + name_len + 1, NULL, 10);
+        }
+        line = strchr(line, '\n');
+        if (line) {
+            line++;
+        }
+    }
+    ck_abort_msg("No statistics value %s", name);
+    return 0;
+}
+#endif // TESTUTIL_STATS
+
 /**
  * Test suite setup function. Implement this inside your test.
  */